@@ -0,0 +1,55 @@
+// This file is part of NameTag <http://github.com/ufal/nametag/>.
+//
+// Copyright 2016 Institute of Formal and Applied Linguistics, Faculty of
+// Mathematics and Physics, Charles University in Prague, Czech Republic.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+// A simple NameTag C API usage example, reading the text from the standard
+// input and printing every recognized entity on a separate line.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nametag_c.h"
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) return fprintf(stderr, "Usage: %s recognizer_model\n", argv[0]), 1;
+
+  fprintf(stderr, "Loading ner: ");
+  nametag_ner* ner = nametag_ner_load(argv[1]);
+  if (!ner) return fprintf(stderr, "Cannot load recognizer from file '%s'!\n", argv[1]), 1;
+  nametag_context* context = nametag_context_new(ner);
+  if (!context) return fprintf(stderr, "Cannot create recognizer context!\n"), 1;
+  fprintf(stderr, "done\n");
+
+  // Read the whole input
+  size_t length = 0, allocated = 1 << 16;
+  char* text = malloc(allocated);
+  for (size_t read; text && (read = fread(text + length, 1, allocated - length, stdin)); length += read)
+    if (length + read == allocated) text = realloc(text, allocated *= 2);
+  if (!text) return fprintf(stderr, "Cannot allocate memory for the input!\n"), 1;
+
+  // Recognize the entities, repeating the call when the array is too small
+  size_t capacity = 64;
+  nametag_entity* entities = malloc(capacity * sizeof(nametag_entity));
+  ptrdiff_t found;
+  while ((found = nametag_recognize_text(context, text, length, entities, capacity)) > (ptrdiff_t)capacity)
+    entities = realloc(entities, (capacity = found) * sizeof(nametag_entity));
+  if (found < 0) return fprintf(stderr, "Cannot recognize the entities!\n"), 1;
+
+  for (ptrdiff_t i = 0; i < found; i++) {
+    size_t type_length;
+    const char* type = nametag_ner_entity_type(ner, entities[i].type_id, &type_length);
+    printf("%.*s\t%.*s\n", (int)type_length, type, (int)entities[i].length, text + entities[i].start);
+  }
+
+  free(entities);
+  free(text);
+  nametag_context_free(context);
+  nametag_ner_free(ner);
+  return 0;
+}
@@ -0,0 +1,166 @@
+// This file is part of NameTag <http://github.com/ufal/nametag/>.
+//
+// Copyright 2016 Institute of Formal and Applied Linguistics, Faculty of
+// Mathematics and Physics, Charles University in Prague, Czech Republic.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "nametag.h"
+#include "nametag_c.h"
+
+using namespace std;
+using namespace ufal::nametag;
+
+struct nametag_ner {
+  unique_ptr<ner> recognizer;
+  vector<string> types;
+};
+
+// Writes the entities passed by the recognizer, which are sorted and whose
+// type ids are the indices in the types of the recognizer, directly into the
+// array of the caller, converting the form offsets to byte offsets of the
+// text if given. Entities of types not listed by the recognizer fail the call.
+struct array_entity_sink : public entity_sink {
+  const vector<string_piece>* forms = NULL;
+  const char* text = NULL;
+  nametag_entity* entities = NULL;
+  size_t capacity = 0, written = 0;
+  bool failed = false;
+
+  virtual void on_entity(unsigned /*sentence*/, unsigned start, unsigned length, int type_id, string_piece /*type*/) {
+    if (type_id < 0) {
+      failed = true;
+      return;
+    }
+
+    if (written < capacity) {
+      nametag_entity& result = entities[written];
+      if (text) {
+        const string_piece& first = (*forms)[start];
+        const string_piece& last = (*forms)[start + length - 1];
+        result.start = first.str - text;
+        result.length = last.str + last.len - first.str;
+      } else {
+        result.start = start;
+        result.length = length;
+      }
+      result.type_id = type_id;
+    }
+    written++;
+  }
+};
+
+struct nametag_context {
+  const nametag_ner* ner;
+  unique_ptr<ner_context> context;
+  unique_ptr<tokenizer> text_tokenizer;
+
+  // Buffers reused by all calls, so that their allocations are amortized
+  vector<string_piece> forms;
+  array_entity_sink sink;
+};
+
+extern "C" {
+
+void nametag_version(unsigned* major, unsigned* minor, unsigned* patch) {
+  version current = version::current();
+  if (major) *major = current.major;
+  if (minor) *minor = current.minor;
+  if (patch) *patch = current.patch;
+}
+
+nametag_ner* nametag_ner_load(const char* fname) {
+  try {
+    unique_ptr<nametag_ner> result(new nametag_ner());
+    result->recognizer.reset(ner::load(fname));
+    if (!result->recognizer) return NULL;
+
+    result->recognizer->entity_types(result->types);
+    return result.release();
+  } catch (...) {
+    return NULL;
+  }
+}
+
+void nametag_ner_free(nametag_ner* ner) {
+  delete ner;
+}
+
+unsigned nametag_ner_entity_types(const nametag_ner* ner) {
+  return ner->types.size();
+}
+
+const char* nametag_ner_entity_type(const nametag_ner* ner, unsigned type_id, size_t* length) {
+  if (type_id >= ner->types.size()) return NULL;
+  if (length) *length = ner->types[type_id].size();
+  return ner->types[type_id].c_str();
+}
+
+nametag_context* nametag_context_new(const nametag_ner* ner) {
+  try {
+    unique_ptr<nametag_context> result(new nametag_context());
+    result->ner = ner;
+    result->context.reset(ner->recognizer->new_context());
+    result->text_tokenizer.reset(ner->recognizer->new_tokenizer());
+    if (!result->context || !result->text_tokenizer) return NULL;
+    return result.release();
+  } catch (...) {
+    return NULL;
+  }
+}
+
+void nametag_context_free(nametag_context* context) {
+  delete context;
+}
+
+ptrdiff_t nametag_recognize_text(nametag_context* context, const char* text, size_t length,
+                                 nametag_entity* entities, size_t capacity) {
+  try {
+    // The forms returned by the tokenizer point into the text, because it is
+    // not copied, which allows computing the byte offsets of the entities
+    array_entity_sink& sink = context->sink;
+    sink.forms = &context->forms;
+    sink.text = text;
+    sink.entities = entities;
+    sink.capacity = capacity;
+    sink.written = 0;
+    sink.failed = false;
+    context->text_tokenizer->set_text(string_piece(text, length), false);
+    while (context->text_tokenizer->next_sentence(&context->forms, NULL)) {
+      context->ner->recognizer->recognize(context->forms, sink, *context->context);
+      if (sink.failed) return -1;
+    }
+    return sink.written;
+  } catch (...) {
+    return -1;
+  }
+}
+
+ptrdiff_t nametag_recognize_forms(nametag_context* context, const char* const* forms, const size_t* lengths, size_t count,
+                                  nametag_entity* entities, size_t capacity) {
+  try {
+    context->forms.clear();
+    for (size_t i = 0; i < count; i++)
+      context->forms.emplace_back(forms[i], lengths[i]);
+
+    array_entity_sink& sink = context->sink;
+    sink.forms = &context->forms;
+    sink.text = NULL;
+    sink.entities = entities;
+    sink.capacity = capacity;
+    sink.written = 0;
+    sink.failed = false;
+    context->ner->recognizer->recognize(context->forms, sink, *context->context);
+    return sink.failed ? -1 : ptrdiff_t(sink.written);
+  } catch (...) {
+    return -1;
+  }
+}
+
+} // extern "C"
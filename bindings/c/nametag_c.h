@@ -0,0 +1,82 @@
+// This file is part of NameTag <http://github.com/ufal/nametag/>.
+//
+// Copyright 2016 Institute of Formal and Applied Linguistics, Faculty of
+// Mathematics and Physics, Charles University in Prague, Czech Republic.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#ifndef NAMETAG_C_H
+#define NAMETAG_C_H
+
+#include <stddef.h>
+
+#if defined(_WIN32)
+#  ifdef NAMETAG_C_BUILD
+#    define NAMETAG_C_API __declspec(dllexport)
+#  else
+#    define NAMETAG_C_API __declspec(dllimport)
+#  endif
+#else
+#  define NAMETAG_C_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Flat C API of NameTag. The strings are UTF-8 encoded and passed as
+// a pointer and a length; they need not be zero terminated, apart from file
+// names. The recognized entities are written into arrays allocated by the
+// caller, the entity types being identified by their ids.
+
+typedef struct nametag_ner nametag_ner;
+typedef struct nametag_context nametag_context;
+
+typedef struct nametag_entity {
+  size_t start;
+  size_t length;
+  unsigned type_id;
+} nametag_entity;
+
+NAMETAG_C_API void nametag_version(unsigned* major, unsigned* minor, unsigned* patch);
+
+// Load the recognizer from the given file, returning NULL on failure.
+// The recognizer can be used by multiple threads concurrently, each with
+// its own context.
+NAMETAG_C_API nametag_ner* nametag_ner_load(const char* fname);
+NAMETAG_C_API void nametag_ner_free(nametag_ner* ner);
+
+// Return the number of entity types, whose ids are 0..count-1, and the name
+// of the given entity type, which is valid until the recognizer is freed.
+NAMETAG_C_API unsigned nametag_ner_entity_types(const nametag_ner* ner);
+NAMETAG_C_API const char* nametag_ner_entity_type(const nametag_ner* ner, unsigned type_id, size_t* length);
+
+// Return a new context holding the scratch state of recognition reused by
+// the following calls, or NULL on failure. The context must be used by
+// a single thread at a time and freed before its recognizer.
+NAMETAG_C_API nametag_context* nametag_context_new(const nametag_ner* ner);
+NAMETAG_C_API void nametag_context_free(nametag_context* context);
+
+// Tokenize the given text using the tokenizer of the recognizer and
+// recognize the named entities of all its sentences, their start and length
+// being in bytes of the text. Returns the number of found entities, of which
+// at most capacity are written, in the text order with longer entities first,
+// or -1 on failure; if the result is larger than capacity, the call can be
+// repeated with a larger array.
+NAMETAG_C_API ptrdiff_t nametag_recognize_text(nametag_context* context, const char* text, size_t length,
+                                               nametag_entity* entities, size_t capacity);
+
+// Recognize the named entities of the given tokenized sentence of count
+// forms, their start and length being in forms. Returns the number of found
+// entities, of which at most capacity are written, in the sentence order with
+// longer entities first, or -1 on failure.
+NAMETAG_C_API ptrdiff_t nametag_recognize_forms(nametag_context* context, const char* const* forms, const size_t* lengths, size_t count,
+                                                nametag_entity* entities, size_t capacity);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -10,6 +10,8 @@
 %include "nametag_stl.i"
 
 %{
+#include <algorithm>
+
 #include "nametag.h"
 using namespace ufal::nametag;
 %}
@@ -17,9 +19,18 @@ using namespace ufal::nametag;
 %template(Ints) std::vector<int>;
 typedef std::vector<int> Ints;
 
+%template(Doubles) std::vector<double>;
+typedef std::vector<double> Doubles;
+
+%template(Sizes) std::vector<size_t>;
+typedef std::vector<size_t> Sizes;
+
 %template(Forms) std::vector<std::string>;
 typedef std::vector<std::string> Forms;
 
+%template(FormsBatch) std::vector<std::vector<std::string> >;
+typedef std::vector<std::vector<std::string> > FormsBatch;
+
 %rename(TokenRange) token_range;
 struct token_range {
   size_t start;
@@ -39,6 +50,20 @@ struct named_entity {
 };
 %template(NamedEntities) std::vector<named_entity>;
 typedef std::vector<named_entity> NamedEntities;
+%template(NamedEntitiesBatch) std::vector<std::vector<named_entity> >;
+typedef std::vector<std::vector<named_entity> > NamedEntitiesBatch;
+
+%rename(FeatureTemplateStatistics) feature_template_statistics;
+struct feature_template_statistics {
+  std::string name;
+  size_t calls;
+  double seconds;
+  size_t features;
+  size_t lookups;
+  size_t lookup_hits;
+};
+%template(FeatureTemplatesStatistics) std::vector<feature_template_statistics>;
+typedef std::vector<feature_template_statistics> FeatureTemplatesStatistics;
 
 %rename(Version) version;
 class version {
@@ -81,6 +106,16 @@ class tokenizer {
   static tokenizer* new_vertical_tokenizer();
 };
 
+%rename(NerContext) ner_context;
+%nodefaultctor ner_context;
+class ner_context {
+ public:
+  virtual ~ner_context() {}
+
+  %rename(setEntityTypes) set_entity_types;
+  virtual bool set_entity_types(const std::vector<std::string>& types);
+};
+
 %rename(Ner) ner;
 %nodefaultctor ner;
 class ner {
@@ -98,14 +133,170 @@ class ner {
         string_pieces.emplace_back(form);
       $self->recognize(string_pieces, entities);
     }
+
+    %rename(recognizeBatch) recognize_batch;
+    void recognize_batch(const std::vector<std::vector<std::string> >& sentences, std::vector<std::vector<named_entity> >& entities) const {
+      std::vector<std::vector<string_piece> > string_pieces(sentences.size());
+      for (unsigned i = 0; i < sentences.size(); i++) {
+        string_pieces[i].reserve(sentences[i].size());
+        for (auto&& form : sentences[i])
+          string_pieces[i].emplace_back(form);
+      }
+      $self->recognize_batch(string_pieces, entities);
+    }
+
+    %rename(recognizeWithConfidences) recognize_with_confidences;
+    bool recognize_with_confidences(const std::vector<std::string>& forms, std::vector<named_entity>& entities, std::vector<double>& confidences) const {
+      std::vector<string_piece> string_pieces;
+      string_pieces.reserve(forms.size());
+      for (auto&& form : forms)
+        string_pieces.emplace_back(form);
+      return $self->recognize_with_confidences(string_pieces, entities, confidences);
+    }
+
+    %rename(recognizeNBest) recognize_nbest;
+    bool recognize_nbest(const std::vector<std::string>& forms, unsigned n, std::vector<std::vector<named_entity> >& decodings, std::vector<double>& probabilities) const {
+      std::vector<string_piece> string_pieces;
+      string_pieces.reserve(forms.size());
+      for (auto&& form : forms)
+        string_pieces.emplace_back(form);
+      return $self->recognize_nbest(string_pieces, n, decodings, probabilities);
+    }
+
+    %rename(recognizeText) recognize_text;
+    bool recognize_text(const char* text, std::vector<named_entity>& entities) const {
+      return $self->recognize_text(text, entities);
+    }
+
+    %rename(recognizeDocument) recognize_document;
+    bool recognize_document(const char* text, std::vector<int>& entities) const {
+      entities.clear();
+      std::vector<named_entity> text_entities;
+      if (!$self->recognize_text(text, text_entities)) return false;
+
+      std::vector<std::string> types;
+      $self->entity_types(types);
+      for (auto&& entity : text_entities) {
+        entities.push_back(int(entity.start));
+        entities.push_back(int(entity.length));
+        entities.push_back(int(std::find(types.begin(), types.end(), entity.type) - types.begin()));
+      }
+      return true;
+    }
+
+    void recognize(const std::vector<std::string>& forms, std::vector<named_entity>& entities, ner_context& context) const {
+      std::vector<string_piece> string_pieces;
+      string_pieces.reserve(forms.size());
+      for (auto&& form : forms)
+        string_pieces.emplace_back(form);
+      $self->recognize(string_pieces, entities, context);
+    }
+
+    void recognize_batch(const std::vector<std::vector<std::string> >& sentences, std::vector<std::vector<named_entity> >& entities, ner_context& context) const {
+      std::vector<std::vector<string_piece> > string_pieces(sentences.size());
+      for (unsigned i = 0; i < sentences.size(); i++) {
+        string_pieces[i].reserve(sentences[i].size());
+        for (auto&& form : sentences[i])
+          string_pieces[i].emplace_back(form);
+      }
+      $self->recognize_batch(string_pieces, entities, context);
+    }
   }
 
+  %rename(newContext) new_context;
+  %newobject new_context;
+  virtual ner_context* new_context() const;
+
   %rename(entityTypes) entity_types;
   virtual void entity_types(std::vector<std::string>& types) const;
 
   virtual void gazetteers(std::vector<std::string>& gazetteers, std::vector<int>* gazetteer_types) const;
 
+  %rename(reloadGazetteers) reload_gazetteers;
+  virtual bool reload_gazetteers();
+
+  %rename(setAnalysisCache) set_analysis_cache;
+  virtual bool set_analysis_cache(size_t forms);
+
+  %rename(setTaggerBeamSize) set_tagger_beam_size;
+  virtual bool set_tagger_beam_size(int beam_size);
+
+  %rename(setTaggerFastMode) set_tagger_fast_mode;
+  virtual bool set_tagger_fast_mode(bool fast);
+
+  %rename(setMaxSentenceLength) set_max_sentence_length;
+  virtual bool set_max_sentence_length(int max_length);
+
+  %rename(setPipelineThreads) set_pipeline_threads;
+  virtual bool set_pipeline_threads(int threads);
+
+  %rename(setStageSkipping) set_stage_skipping;
+  virtual bool set_stage_skipping(double probability);
+
+  %rename(setCandidatePrefilter) set_candidate_prefilter;
+  virtual bool set_candidate_prefilter(bool enabled);
+
+  %rename(memoryUsage) memory_usage;
+  virtual void memory_usage(std::vector<std::string>& components, std::vector<size_t>& bytes) const;
+
+  %rename(pooledStates) pooled_states;
+  virtual size_t pooled_states() const;
+
+  %rename(setStageProfiling) set_stage_profiling;
+  virtual bool set_stage_profiling(bool profiling);
+
+  %rename(stageProfilingStatistics) stage_profiling_statistics;
+  virtual void stage_profiling_statistics(std::vector<std::string>& stages, std::vector<double>& seconds) const;
+
+  %rename(templateStatistics) template_statistics;
+  virtual void template_statistics(std::vector<feature_template_statistics>& statistics) const;
+
   %rename(newTokenizer) new_tokenizer;
   %newobject new_tokenizer;
   virtual tokenizer* new_tokenizer() const;
+
+  %extend {
+    %rename(newNormalizingTokenizer) new_normalizing_tokenizer;
+    %newobject new_normalizing_tokenizer;
+    tokenizer* new_normalizing_tokenizer() const {
+      return tokenizer::new_normalizing_tokenizer($self->new_tokenizer());
+    }
+  }
+};
+
+%rename(NerPool) ner_pool;
+%nodefaultctor ner_pool;
+class ner_pool {
+ public:
+  virtual ~ner_pool() {}
+
+  %newobject create;
+  static ner_pool* create(unsigned max_loaded);
+
+  virtual unsigned add(const char* fname);
+  virtual const ner* acquire(unsigned id);
+  virtual void release(unsigned id);
+};
+
+%rename(NerExecutor) ner_executor;
+%nodefaultctor ner_executor;
+class ner_executor {
+ public:
+  virtual ~ner_executor() {}
+
+  %newobject create;
+  static ner_executor* create(const ner* recognizer, unsigned threads);
+
+  %extend {
+    %rename(recognizeTexts) recognize_texts;
+    void recognize_texts(const std::vector<std::string>& texts, std::vector<std::vector<named_entity> >& entities) {
+      entities.assign(texts.size(), std::vector<named_entity>());
+      std::vector<std::future<std::vector<named_entity> > > results;
+      results.reserve(texts.size());
+      for (auto&& text : texts)
+        results.push_back($self->recognize_async(text));
+      for (unsigned i = 0; i < results.size(); i++)
+        entities[i] = results[i].get();
+    }
+  }
 };
@@ -2,6 +2,113 @@
 
 %include "../common/nametag.i"
 
+// Recognition of texts in Java char arrays and direct UTF-8 ByteBuffers,
+// returning the entities as start, length and type index triples in UTF-16
+// code units, without converting the texts to Java strings.
+%{
+#include <memory>
+
+#include "unilib/utf16.h"
+#include "unilib/utf8.h"
+
+static void recognize_utf16_offsets(const ner& recognizer, ner_context* context, string_piece text, std::vector<int>& entities) {
+  entities.clear();
+  std::unique_ptr<tokenizer> text_tokenizer(recognizer.new_tokenizer());
+  if (!text_tokenizer) return;
+
+  std::vector<std::string> types;
+  recognizer.entity_types(types);
+
+  // The forms point into the text, which is not copied, so the byte offsets
+  // of the entities are first stored in the entities
+  std::vector<string_piece> forms;
+  std::vector<named_entity> sentence_entities;
+  text_tokenizer->set_text(text, false);
+  while (text_tokenizer->next_sentence(&forms, NULL)) {
+    if (context)
+      recognizer.recognize(forms, sentence_entities, *context);
+    else
+      recognizer.recognize(forms, sentence_entities);
+    std::sort(sentence_entities.begin(), sentence_entities.end(), [](const named_entity& a, const named_entity& b) {
+      return a.start < b.start || (a.start == b.start && a.length > b.length);
+    });
+    for (auto&& entity : sentence_entities) {
+      const string_piece& first = forms[entity.start];
+      const string_piece& last = forms[entity.start + entity.length - 1];
+      entities.push_back(int(first.str - text.str));
+      entities.push_back(int(last.str + last.len - text.str));
+      entities.push_back(int(std::find(types.begin(), types.end(), entity.type) - types.begin()));
+    }
+  }
+
+  // Convert the byte offsets to UTF-16 offsets in a single pass over the text
+  std::vector<int> offsets;
+  for (size_t i = 0; i < entities.size(); i += 3)
+    offsets.push_back(entities[i]), offsets.push_back(entities[i + 1]);
+  std::sort(offsets.begin(), offsets.end());
+  offsets.erase(std::unique(offsets.begin(), offsets.end()), offsets.end());
+
+  std::vector<int> utf16_offsets(offsets.size());
+  const char* str = text.str;
+  size_t len = text.len;
+  int utf16_offset = 0;
+  for (size_t i = 0; i < offsets.size(); i++) {
+    while (str < text.str + offsets[i])
+      utf16_offset += unilib::utf8::decode(str, len) >= 0x10000 ? 2 : 1;
+    utf16_offsets[i] = utf16_offset;
+  }
+
+  for (size_t i = 0; i < entities.size(); i += 3) {
+    int start = utf16_offsets[std::lower_bound(offsets.begin(), offsets.end(), entities[i]) - offsets.begin()];
+    int end = utf16_offsets[std::lower_bound(offsets.begin(), offsets.end(), entities[i + 1]) - offsets.begin()];
+    entities[i] = start;
+    entities[i + 1] = end - start;
+  }
+}
+
+static jintArray new_int_array(JNIEnv* jenv, const std::vector<int>& values) {
+  jintArray result = jenv->NewIntArray(jsize(values.size()));
+  if (result && !values.empty()) jenv->SetIntArrayRegion(result, 0, jsize(values.size()), (const jint*) values.data());
+  return result;
+}
+%}
+
+%typemap(in, numinputs=0) JNIEnv* jenv "$1 = jenv;"
+%typemap(jstype) jobject utf8_buffer "java.nio.ByteBuffer"
+%typemap(jtype) jobject utf8_buffer "java.nio.ByteBuffer"
+
+%extend ner {
+  // Recognize the UTF-16 text of the given part of the array, returning null
+  // if the part is out of the array bounds
+  %rename(recognizeUtf16) recognize_utf16;
+  jintArray recognize_utf16(JNIEnv* jenv, jcharArray text, int offset, int length, ner_context* context) const {
+    if (offset < 0 || length < 0 || offset > jenv->GetArrayLength(text) - length) return NULL;
+
+    std::vector<jchar> utf16(length);
+    jenv->GetCharArrayRegion(text, offset, length, utf16.data());
+    std::string utf8;
+    const char16_t* str = (const char16_t*) utf16.data();
+    for (size_t len = length; len; )
+      unilib::utf8::append(utf8, unilib::utf16::decode(str, len));
+
+    std::vector<int> entities;
+    recognize_utf16_offsets(*$self, context, utf8, entities);
+    return new_int_array(jenv, entities);
+  }
+
+  // Recognize the UTF-8 text of the given part of the direct ByteBuffer,
+  // returning null if the buffer is not direct or the part is out of its bounds
+  %rename(recognizeUtf8) recognize_utf8;
+  jintArray recognize_utf8(JNIEnv* jenv, jobject utf8_buffer, int offset, int length, ner_context* context) const {
+    const char* buffer = (const char*) jenv->GetDirectBufferAddress(utf8_buffer);
+    if (!buffer || offset < 0 || length < 0 || offset > jenv->GetDirectBufferCapacity(utf8_buffer) - length) return NULL;
+
+    std::vector<int> entities;
+    recognize_utf16_offsets(*$self, context, string_piece(buffer + offset, length), entities);
+    return new_int_array(jenv, entities);
+  }
+}
+
 %pragma(java) jniclasscode=%{
   static {
     java.io.File libraryFile = new java.io.File(nametag_java.libraryPath);
@@ -0,0 +1,61 @@
+# This file is part of NameTag <http://github.com/ufal/nametag/>.
+#
+# Copyright 2016 Institute of Formal and Applied Linguistics, Faculty of
+# Mathematics and Physics, Charles University in Prague, Czech Republic.
+#
+# This Source Code Form is subject to the terms of the Mozilla Public
+# License, v. 2.0. If a copy of the MPL was not distributed with this
+# file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+# A multi-threaded NameTag Python binding usage example. The recognizer is
+# shared by all threads, and because the bindings release the GIL during the
+# recognition, the paragraphs are recognized in parallel.
+
+# To run this script from the commandline, simply type:
+# python run_ner_threads.py path_to_nametag_model number_of_threads <input >output
+
+import sys
+import threading
+import time
+
+from ufal.nametag import *
+
+if len(sys.argv) < 3:
+  sys.stderr.write('Usage: %s recognizer_model number_of_threads\n' % sys.argv[0])
+  sys.exit(1)
+threads = int(sys.argv[2])
+
+sys.stderr.write('Loading ner: ')
+ner = Ner.load(sys.argv[1])
+if not ner:
+  sys.stderr.write("Cannot load recognizer from file '%s'\n" % sys.argv[1])
+  sys.exit(1)
+sys.stderr.write('done\n')
+
+types = Forms()
+ner.entityTypes(types)
+
+# Split the input into paragraphs, each recognized as a whole document.
+paragraphs = sys.stdin.read().split('\n\n')
+results = [None] * len(paragraphs)
+
+def recognize(first):
+  entities = Ints()
+  for i in range(first, len(paragraphs), threads):
+    if not ner.recognizeDocument(paragraphs[i], entities):
+      sys.stderr.write("No tokenizer is defined for the supplied model!\n")
+      return
+    results[i] = [(entities[j], entities[j + 1], types[entities[j + 2]]) for j in range(0, len(entities), 3)]
+
+start = time.time()
+workers = [threading.Thread(target=recognize, args=(i,)) for i in range(threads)]
+for worker in workers: worker.start()
+for worker in workers: worker.join()
+elapsed = time.time() - start
+
+for paragraph, entities in zip(paragraphs, results):
+  for start, length, entity_type in entities or []:
+    print("{}\t{}".format(entity_type, paragraph[start:start + length]))
+
+sys.stderr.write('Recognized {} paragraphs ({} characters) in {:.3f} seconds, {:.0f} characters per second.\n'.format(
+  len(paragraphs), sum(len(paragraph) for paragraph in paragraphs), elapsed, sum(len(paragraph) for paragraph in paragraphs) / max(elapsed, 1e-9)))
@@ -1,4 +1,4 @@
-%module nametag
+%module(threads="1") nametag
 
 %begin %{
 #ifdef _WIN32
@@ -12,4 +12,19 @@
 #endif
 %}
 
+// Release the GIL in the methods performing a lot of native work, after
+// their arguments have been converted, so that several Python threads can
+// load models, tokenize and recognize in parallel.
+%nothread;
+%thread ner::load;
+%thread ner::recognize;
+%thread ner::recognize_batch;
+%thread ner::recognize_with_confidences;
+%thread ner::recognize_nbest;
+%thread ner::recognize_text;
+%thread ner::recognize_document;
+%thread ner_pool::acquire;
+%thread ner_executor::recognize_texts;
+%thread tokenizer::next_sentence;
+
 %include "../common/nametag.i"
@@ -12,36 +12,48 @@
 namespace ufal {
 namespace nametag {
 
-void bilou_probabilities_global::init(const bilou_probabilities& local) {
-  bilou = local.bilou;
-  previous.fill(bilou_type_unknown);
+void bilou_lattice::resize(unsigned size) {
+  if (probabilities.size() < size) {
+    probabilities.resize(size);
+    entities.resize(size);
+    previous.resize(size);
+    best.resize(size);
+  }
+}
+
+void bilou_lattice::init(const bilou_probabilities& local) {
+  for (unsigned bilou = 0; bilou < bilou_type_total; bilou++) {
+    probabilities[0][bilou] = local.bilou[bilou].probability;
+    entities[0][bilou] = local.bilou[bilou].entity;
+  }
+  previous[0].fill(uint8_t(bilou_type_unknown));
 
-  best = bilou_type_B;
-  bilou[bilou_type_I].probability = 0;
-  bilou[bilou_type_L].probability = 0;
-  if (bilou[bilou_type_O].probability > bilou[best].probability) best = bilou_type_O;
-  if (bilou[bilou_type_U].probability > bilou[best].probability) best = bilou_type_U;
+  probabilities[0][bilou_type_I] = 0;
+  probabilities[0][bilou_type_L] = 0;
 }
 
-void bilou_probabilities_global::update(const bilou_probabilities& local, const bilou_probabilities_global& prev) {
+void bilou_lattice::update(unsigned word, const bilou_probabilities& local) {
+  const auto& prev = probabilities[word - 1];
+  auto& current = probabilities[word];
+
   // Find the best of previous LOU
   bilou_type best_LOU = bilou_type_L;
-  double best_LOU_prob = prev.bilou[bilou_type_L].probability;
-  if (prev.bilou[bilou_type_O].probability > best_LOU_prob) {
+  double best_LOU_prob = prev[bilou_type_L];
+  if (prev[bilou_type_O] > best_LOU_prob) {
     best_LOU = bilou_type_O;
-    best_LOU_prob = prev.bilou[bilou_type_O].probability;
+    best_LOU_prob = prev[bilou_type_O];
   }
-  if (prev.bilou[bilou_type_U].probability > best_LOU_prob) {
+  if (prev[bilou_type_U] > best_LOU_prob) {
     best_LOU = bilou_type_U;
-    best_LOU_prob = prev.bilou[bilou_type_U].probability;
+    best_LOU_prob = prev[bilou_type_U];
   }
 
   // Find the best of previous BI
   bilou_type best_BI = bilou_type_B;
-  double best_BI_prob = prev.bilou[bilou_type_B].probability;
-  if (prev.bilou[bilou_type_I].probability > best_BI_prob) {
+  double best_BI_prob = prev[bilou_type_B];
+  if (prev[bilou_type_I] > best_BI_prob) {
     best_BI = bilou_type_I;
-    best_BI_prob = prev.bilou[bilou_type_I].probability;
+    best_BI_prob = prev[bilou_type_I];
   }
 
   // Normalize the best_*_prob probabilities
@@ -54,30 +66,25 @@ void bilou_probabilities_global::update(const bilou_probabilities& local, const
   }
 
   // Store update probabilites
-  bilou[bilou_type_B].probability = best_LOU_prob * local.bilou[bilou_type_B].probability;
-  bilou[bilou_type_B].entity = local.bilou[bilou_type_B].entity;
-  previous[bilou_type_B] = best_LOU;
-  best = bilou_type_B;
-
-  bilou[bilou_type_I].probability = best_BI_prob * local.bilou[bilou_type_I].probability;
-  bilou[bilou_type_I].entity = prev.bilou[best_BI].entity;
-  previous[bilou_type_I] = best_BI;
-  if (bilou[bilou_type_I].probability > bilou[best].probability) best = bilou_type_I;
-
-  bilou[bilou_type_L].probability = best_BI_prob * local.bilou[bilou_type_L].probability;
-  bilou[bilou_type_L].entity = prev.bilou[best_BI].entity;
-  previous[bilou_type_L] = best_BI;
-  if (bilou[bilou_type_L].probability > bilou[best].probability) best = bilou_type_L;
+  current[bilou_type_B] = best_LOU_prob * local.bilou[bilou_type_B].probability;
+  current[bilou_type_I] = best_BI_prob * local.bilou[bilou_type_I].probability;
+  current[bilou_type_L] = best_BI_prob * local.bilou[bilou_type_L].probability;
+  current[bilou_type_O] = best_LOU_prob * local.bilou[bilou_type_O].probability;
+  current[bilou_type_U] = best_LOU_prob * local.bilou[bilou_type_U].probability;
 
-  bilou[bilou_type_O].probability = best_LOU_prob * local.bilou[bilou_type_O].probability;
-  bilou[bilou_type_O].entity = local.bilou[bilou_type_O].entity;
-  previous[bilou_type_O] = best_LOU;
-  if (bilou[bilou_type_O].probability > bilou[best].probability) best = bilou_type_O;
+  auto& current_entities = entities[word];
+  current_entities[bilou_type_B] = local.bilou[bilou_type_B].entity;
+  current_entities[bilou_type_I] = entities[word - 1][best_BI];
+  current_entities[bilou_type_L] = entities[word - 1][best_BI];
+  current_entities[bilou_type_O] = local.bilou[bilou_type_O].entity;
+  current_entities[bilou_type_U] = local.bilou[bilou_type_U].entity;
 
-  bilou[bilou_type_U].probability = best_LOU_prob * local.bilou[bilou_type_U].probability;
-  bilou[bilou_type_U].entity = local.bilou[bilou_type_U].entity;
-  previous[bilou_type_U] = best_LOU;
-  if (bilou[bilou_type_U].probability > bilou[best].probability) best = bilou_type_U;
+  auto& current_previous = previous[word];
+  current_previous[bilou_type_B] = best_LOU;
+  current_previous[bilou_type_I] = best_BI;
+  current_previous[bilou_type_L] = best_BI;
+  current_previous[bilou_type_O] = best_LOU;
+  current_previous[bilou_type_U] = best_LOU;
 }
 
 } // namespace nametag
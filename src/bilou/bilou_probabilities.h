@@ -28,13 +28,21 @@ class bilou_probabilities {
   array<probability_info, bilou_type_total> bilou;
 };
 
-class bilou_probabilities_global : public bilou_probabilities {
+// Decoding lattice of a sentence, stored as separate arrays of the
+// probabilities, entities and previous bilou types of all words, so that the
+// decoding of a word accesses only the few bytes it needs. The probabilities
+// of the best paths ending in a word are relative to the best path ending in
+// the previous word.
+class bilou_lattice {
  public:
-  bilou_type best;
-  array<bilou_type, bilou_type_total> previous;
+  vector<array<double, bilou_type_total>> probabilities;
+  vector<array<entity_type, bilou_type_total>> entities;
+  vector<array<uint8_t, bilou_type_total>> previous;
+  vector<bilou_type> best;
 
+  void resize(unsigned size);
   void init(const bilou_probabilities& local);
-  void update(const bilou_probabilities& local, const bilou_probabilities_global& prev);
+  void update(unsigned word, const bilou_probabilities& local);
 };
 
 } // namespace nametag
@@ -8,8 +8,12 @@
 // file, You can obtain one at http://mozilla.org/MPL/2.0/.
 
 #include <algorithm>
+#include <cmath>
+#include <limits>
 
 #include "ner_sentence.h"
+#include "unilib/unicode.h"
+#include "unilib/utf8.h"
 
 namespace ufal {
 namespace nametag {
@@ -17,14 +21,79 @@ namespace nametag {
 void ner_sentence::resize(unsigned size) {
   this->size = size;
   if (words.size() < size) words.resize(size);
-  if (features.size() < size) features.resize(size);
   if (probabilities.size() < size) probabilities.resize(size);
+  global.resize(size);
   if (previous_stage.size() < size) previous_stage.resize(size);
+  for (auto&& texts : texts_cached)
+    texts.filled = false;
+  for (auto&& recased : recased_match_sources)
+    recased.filled = false;
+}
+
+const ner_sentence::texts_info& ner_sentence::texts(int source) {
+  using namespace unilib;
+
+  auto& texts = texts_cached[source];
+  if (texts.filled) return texts;
+
+  texts.chrs.clear();
+  texts.case_normalized.clear();
+  texts.words.assign(1, 0);
+  texts.case_normalized_utf8.clear();
+  texts.case_normalized_ends.clear();
+  texts.capitalization.clear();
+  for (unsigned i = 0; i < size; i++) {
+    unsigned char capitalization = 0;
+    for (auto&& chr : utf8::decoder(source == TEXT_FORM ? words[i].form : words[i].raw_lemma)) {
+      bool first = texts.chrs.size() == texts.words.back();
+      auto category = unicode::category(chr);
+      if (category & unicode::Lut) capitalization |= CAPITALIZATION_ANY_UPPER | (first ? CAPITALIZATION_FIRST_UPPER : 0);
+      if (category & unicode::Ll) capitalization |= CAPITALIZATION_ANY_LOWER;
+
+      char32_t normalized = first ? chr : unicode::lowercase(chr);
+      texts.chrs.push_back(chr);
+      texts.case_normalized.push_back(normalized);
+      utf8::append(texts.case_normalized_utf8, normalized);
+    }
+    texts.words.push_back(texts.chrs.size());
+    texts.case_normalized_ends.push_back(texts.case_normalized_utf8.size());
+    texts.capitalization.push_back(capitalization);
+  }
+  texts.filled = true;
+
+  return texts;
 }
 
 void ner_sentence::clear_features() {
+  features.clear();
+  features_offsets.assign(size + 1, 0);
+  features_added.clear();
+}
+
+void ner_sentence::finalize_features() {
+  // Count the features of every word, first as differences of the counts of
+  // adjacent words, and compute the starting offsets
+  features_offsets.assign(size + 1, 0);
+  for (auto&& added : features_added) {
+    features_offsets[added.start + 1]++;
+    if (added.end < size) features_offsets[added.end + 1]--;
+  }
+  for (unsigned i = 1; i < size; i++)
+    features_offsets[i + 1] += features_offsets[i];
   for (unsigned i = 0; i < size; i++)
-    features[i].clear();
+    features_offsets[i + 1] += features_offsets[i];
+
+  // Store the features using the offsets as insertion positions, which
+  // shifts them to the ending offsets, and then shift them back.
+  features.resize(features_offsets[size]);
+  for (auto&& added : features_added)
+    for (unsigned i = added.start; i < added.end; i++)
+      features[features_offsets[i]++] = added.feature + i - added.start;
+  for (unsigned i = size; i; i--)
+    features_offsets[i] = features_offsets[i - 1];
+  features_offsets[0] = 0;
+
+  features_added.clear();
 }
 
 void ner_sentence::clear_probabilities_local_filled() {
@@ -42,22 +111,155 @@ void ner_sentence::clear_previous_stage() {
 void ner_sentence::compute_best_decoding() {
   // Find best L O U bilou_type for the last word
   bilou_type best = bilou_type_L;
-  auto& last_bilou = probabilities[size - 1].global.bilou;
-  if (last_bilou[bilou_type_O].probability > last_bilou[best].probability) best = bilou_type_O;
-  if (last_bilou[bilou_type_U].probability > last_bilou[best].probability) best = bilou_type_U;
-  probabilities[size - 1].global.best = best;
+  auto& last_probabilities = global.probabilities[size - 1];
+  if (last_probabilities[bilou_type_O] > last_probabilities[best]) best = bilou_type_O;
+  if (last_probabilities[bilou_type_U] > last_probabilities[best]) best = bilou_type_U;
+  global.best[size - 1] = best;
 
   // Store the best bilou_type for all preceeding words
   for (unsigned i = size - 1; i; i--) {
-    best = probabilities[i].global.previous[best];
-    probabilities[i - 1].global.best = best;
+    best = global.previous[i][best];
+    global.best[i - 1] = best;
   }
 }
 
+// In the bilou lattice, I and L must follow B or I, and B, O and U must follow
+// L, O or U; the first word cannot be I or L and the last cannot be B or I.
+static inline bool bilou_continues(bilou_type bilou) {
+  return bilou == bilou_type_B || bilou == bilou_type_I;
+}
+
+static inline bool bilou_continuing(bilou_type bilou) {
+  return bilou == bilou_type_I || bilou == bilou_type_L;
+}
+
+static inline double log_add(double a, double b) {
+  if (a < b) swap(a, b);
+  return b == -numeric_limits<double>::infinity() ? a : a + log1p(exp(b - a));
+}
+
+void ner_sentence::compute_nbest_decodings(unsigned n, vector<bilou_type>& decodings, vector<double>& decodings_probabilities) const {
+  decodings.clear();
+  decodings_probabilities.clear();
+  if (!size || !n) return;
+
+  // Every word and bilou type keep at most n best partial decodings, which
+  // reference the partial decoding of the previous word they extend
+  struct hypothesis {
+    double score;
+    unsigned previous;
+  };
+  vector<hypothesis> hypotheses(size * bilou_type_total * n), candidates;
+  vector<unsigned> hypotheses_size(size * bilou_type_total, 0);
+  auto by_score = [](const hypothesis& a, const hypothesis& b) { return a.score > b.score; };
+
+  // Log probabilities of all the decodings are summed using the forward pass
+  array<double, bilou_type_total> forward, previous_forward;
+
+  for (unsigned i = 0; i < size; i++) {
+    previous_forward = forward;
+    for (bilou_type bilou = 0; bilou < bilou_type_total; bilou++) {
+      forward[bilou] = -numeric_limits<double>::infinity();
+      double local = log(probabilities[i].local.bilou[bilou].probability);
+      if (local == -numeric_limits<double>::infinity()) continue;
+
+      candidates.clear();
+      if (!i) {
+        if (bilou_continuing(bilou)) continue;
+        candidates.push_back({local, ~0U});
+        forward[bilou] = local;
+      } else {
+        for (bilou_type previous = 0; previous < bilou_type_total; previous++) {
+          if (bilou_continues(previous) != bilou_continuing(bilou)) continue;
+          for (unsigned h = 0; h < hypotheses_size[(i - 1) * bilou_type_total + previous]; h++)
+            candidates.push_back({hypotheses[((i - 1) * bilou_type_total + previous) * n + h].score + local, previous * n + h});
+          forward[bilou] = log_add(forward[bilou], previous_forward[previous] + local);
+        }
+      }
+
+      unsigned kept = min(size_t(n), candidates.size());
+      partial_sort(candidates.begin(), candidates.begin() + kept, candidates.end(), by_score);
+      copy(candidates.begin(), candidates.begin() + kept, hypotheses.begin() + (i * bilou_type_total + bilou) * n);
+      hypotheses_size[i * bilou_type_total + bilou] = kept;
+    }
+  }
+
+  // Choose the best complete decodings
+  candidates.clear();
+  double log_total = -numeric_limits<double>::infinity();
+  for (bilou_type bilou = 0; bilou < bilou_type_total; bilou++) {
+    if (bilou_continues(bilou)) continue;
+    for (unsigned h = 0; h < hypotheses_size[(size - 1) * bilou_type_total + bilou]; h++)
+      candidates.push_back({hypotheses[((size - 1) * bilou_type_total + bilou) * n + h].score, bilou * n + h});
+    log_total = log_add(log_total, forward[bilou]);
+  }
+  unsigned kept = min(size_t(n), candidates.size());
+  partial_sort(candidates.begin(), candidates.begin() + kept, candidates.end(), by_score);
+
+  // Reconstruct them
+  decodings.resize(kept * size);
+  for (unsigned d = 0; d < kept; d++) {
+    decodings_probabilities.push_back(exp(candidates[d].score - log_total));
+    for (unsigned i = size, previous = candidates[d].previous; i--; ) {
+      decodings[d * size + i] = previous / n;
+      previous = hypotheses[(i * bilou_type_total) * n + previous].previous;
+    }
+  }
+}
+
+void ner_sentence::compute_marginals() {
+  marginals.forward.resize(size);
+  marginals.backward.resize(size);
+  marginals.log_total = -numeric_limits<double>::infinity();
+  if (!size) return;
+
+  for (unsigned i = 0; i < size; i++)
+    for (bilou_type bilou = 0; bilou < bilou_type_total; bilou++) {
+      double& forward = marginals.forward[i][bilou];
+      forward = -numeric_limits<double>::infinity();
+      if (!i) {
+        if (!bilou_continuing(bilou)) forward = 0;
+      } else {
+        for (bilou_type previous = 0; previous < bilou_type_total; previous++)
+          if (bilou_continues(previous) == bilou_continuing(bilou))
+            forward = log_add(forward, marginals.forward[i - 1][previous]);
+      }
+      forward += log(probabilities[i].local.bilou[bilou].probability);
+    }
+
+  for (unsigned i = size; i--; )
+    for (bilou_type bilou = 0; bilou < bilou_type_total; bilou++) {
+      double& backward = marginals.backward[i][bilou];
+      backward = -numeric_limits<double>::infinity();
+      if (i + 1 == size) {
+        if (!bilou_continues(bilou)) backward = 0;
+      } else {
+        for (bilou_type next = 0; next < bilou_type_total; next++)
+          if (bilou_continues(bilou) == bilou_continuing(next))
+            backward = log_add(backward, log(probabilities[i + 1].local.bilou[next].probability) + marginals.backward[i + 1][next]);
+      }
+    }
+
+  for (bilou_type bilou = 0; bilou < bilou_type_total; bilou++)
+    marginals.log_total = log_add(marginals.log_total, marginals.forward[size - 1][bilou] + marginals.backward[size - 1][bilou]);
+}
+
+double ner_sentence::entity_probability(unsigned start, unsigned length) const {
+  if (length == 1)
+    return exp(marginals.forward[start][bilou_type_U] + marginals.backward[start][bilou_type_U] - marginals.log_total);
+
+  double log_probability = marginals.forward[start][bilou_type_B];
+  for (unsigned i = start + 1; i + 1 < start + length; i++)
+    log_probability += log(probabilities[i].local.bilou[bilou_type_I].probability);
+  log_probability += log(probabilities[start + length - 1].local.bilou[bilou_type_L].probability);
+  log_probability += marginals.backward[start + length - 1][bilou_type_L];
+  return exp(log_probability - marginals.log_total);
+}
+
 void ner_sentence::fill_previous_stage() {
   for (unsigned i = 0; i < size; i++) {
-    previous_stage[i].bilou = probabilities[i].global.best;
-    previous_stage[i].entity = probabilities[i].global.bilou[probabilities[i].global.best].entity;
+    previous_stage[i].bilou = global.best[i];
+    previous_stage[i].entity = global.entities[i][global.best[i]];
   }
 }
 
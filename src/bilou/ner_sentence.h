@@ -13,6 +13,7 @@
 #include "bilou_probabilities.h"
 #include "features/ner_feature.h"
 #include "ner_word.h"
+#include "utils/string_piece.h"
 
 namespace ufal {
 namespace nametag {
@@ -20,15 +21,113 @@ namespace nametag {
 struct ner_sentence {
   unsigned size = 0;
   vector<ner_word> words;
-  vector<ner_features> features;
+
+  // Features of all words, stored in a single flat buffer, with the features
+  // of word i in features[features_offsets[i]..features_offsets[i+1]).
+  // They are first collected by add_feature in arbitrary word order, and then
+  // grouped by word by finalize_features, keeping their relative order.
+  // A base feature added to a window of words [start, end) is collected once,
+  // being expanded to the consecutive features of the words only then.
+  vector<ner_feature> features;
+  vector<unsigned> features_offsets;
+  struct added_feature {
+    unsigned start, end;
+    ner_feature feature;
+  };
+  vector<added_feature> features_added;
+
+  inline void add_feature(unsigned word, ner_feature feature) { features_added.push_back({word, word + 1, feature}); }
+  // Add consecutive features, starting with the given one, to words [start, end)
+  inline void add_features(unsigned start, unsigned end, ner_feature feature);
+  inline void reserve_features(size_t features);
+  inline const ner_feature* word_features(unsigned word) const { return features.data() + features_offsets[word]; }
+  inline unsigned word_features_size(unsigned word) const { return features_offsets[word + 1] - features_offsets[word]; }
+
+  // Words resolved to ids of the vocabularies shared by feature processors,
+  // filled by feature_templates::process_sentence for the vocabularies of
+  // a loaded model; unknown words have ner_feature_unknown id.
+  enum { VOCABULARY_NONE = -1, VOCABULARY_FORM, VOCABULARY_RAW_LEMMA, VOCABULARY_LEMMA_ID, VOCABULARY_TAG, VOCABULARIES_TOTAL };
+  vector<ner_feature> vocabulary_ids[VOCABULARIES_TOTAL];
+  inline const string& vocabulary_text(int vocabulary, unsigned word) const {
+    return vocabulary == VOCABULARY_FORM ? words[word].form : vocabulary == VOCABULARY_RAW_LEMMA ? words[word].raw_lemma :
+        vocabulary == VOCABULARY_LEMMA_ID ? words[word].lemma_id : words[word].tag;
+  }
+
+  // Analysis of the forms or raw lemmas of all words, shared by all feature
+  // templates and stages. It is computed on first use for every source and
+  // resize invalidates it. Word i has code points chrs[words[i]..words[i+1]),
+  // the same code points with all but the first lowercased are stored in
+  // case_normalized, and their UTF-8 encoding in case_normalized_utf8, word i
+  // ending at case_normalized_ends[i]. The capitalization contains
+  // a combination of CAPITALIZATION_* flags for every word.
+  enum { TEXT_FORM, TEXT_RAW_LEMMA, TEXTS_TOTAL };
+  enum { CAPITALIZATION_FIRST_UPPER = 1, CAPITALIZATION_ANY_UPPER = 2, CAPITALIZATION_ANY_LOWER = 4 };
+  struct texts_info {
+    bool filled = false;
+    vector<char32_t> chrs, case_normalized;
+    vector<unsigned> words;
+    string case_normalized_utf8;
+    vector<unsigned> case_normalized_ends;
+    vector<unsigned char> capitalization;
+
+    inline string_piece case_normalized_text(unsigned i) const {
+      unsigned start = i ? case_normalized_ends[i - 1] : 0;
+      return string_piece(case_normalized_utf8.data() + start, case_normalized_ends[i] - start);
+    }
+  };
+  const texts_info& texts(int source);
+
+  // Recased match sources of all words used by gazetteers, indexed by the
+  // match mode of the gazetteers. They are computed on first use and shared by
+  // all feature templates and stages; resize invalidates them. The sources are
+  // concatenated in the arena, source j ending at sources[j] where source j+1
+  // starts, and word i has sources words[i]..words[i+1]-1.
+  struct recased_match_sources_info {
+    bool filled = false;
+    string arena;
+    vector<unsigned> sources, words;
+
+    inline string_piece source(unsigned j) const {
+      unsigned start = j ? sources[j - 1] : 0;
+      return string_piece(arena.data() + start, sources[j] - start);
+    }
+  };
+  vector<recased_match_sources_info> recased_match_sources;
+
+  // Buffers of gazetteer feature processors, reused to avoid allocations.
+  // The marks store for every trie node the last step it was reached at.
+  struct gazetteers_buffers_info {
+    vector<unsigned> nodes, new_nodes;
+    vector<unsigned> marks;
+    unsigned step = 0;
+    vector<vector<unsigned>> match_tokens;
+    vector<vector<ner_feature>> features;
+  };
+  gazetteers_buffers_info gazetteers_buffers;
+
+  // Features and local probabilities not depending on the previous stage,
+  // stored by feature_templates::process_sentence so that the following
+  // stages need to recompute only the stage dependent features. These were
+  // added to features_added at the given stage_dependent_positions.
+  vector<added_feature> stage_independent_features;
+  vector<size_t> stage_dependent_positions;
+  struct stage_independent_probability {
+    unsigned word;
+    bilou_probabilities local;
+  };
+  vector<stage_independent_probability> stage_independent_probabilities;
 
   struct probability_info {
     bilou_probabilities local;
     bool local_filled;
-    bilou_probabilities_global global;
   };
   vector<probability_info> probabilities;
 
+  // Decoding lattice of the local probabilities, filled word by word using
+  // global.init and global.update, with the best decoding stored in
+  // global.best by compute_best_decoding.
+  bilou_lattice global;
+
   struct previous_stage_info {
     bilou_type bilou;
     entity_type entity;
@@ -37,12 +136,45 @@ struct ner_sentence {
 
   void resize(unsigned size);
   void clear_features();
+  void finalize_features();
   void clear_probabilities_local_filled();
   void clear_previous_stage();
 
   void compute_best_decoding();
   void fill_previous_stage();
+
+  // Compute at most n best decodings according to the local probabilities,
+  // the best first, together with their probabilities normalized over all
+  // decodings. The bilou types of the decoding d are stored in
+  // decodings[d * size..(d + 1) * size).
+  void compute_nbest_decodings(unsigned n, vector<bilou_type>& decodings, vector<double>& decodings_probabilities) const;
+
+  // Forward and backward log probabilities of the bilou types according to
+  // the local probabilities, computed by compute_marginals. The forward ones
+  // include the local probability of the word, the backward ones do not.
+  struct marginals_info {
+    vector<array<double, bilou_type_total>> forward, backward;
+    double log_total;
+  };
+  marginals_info marginals;
+  void compute_marginals();
+
+  // Probability of the decodings containing an entity on the given words,
+  // valid after compute_marginals.
+  double entity_probability(unsigned start, unsigned length) const;
+
+ private:
+  texts_info texts_cached[TEXTS_TOTAL];
 };
 
+void ner_sentence::add_features(unsigned start, unsigned end, ner_feature feature) {
+  features_added.push_back({start, end, feature});
+}
+
+void ner_sentence::reserve_features(size_t features) {
+  if (features_added.capacity() < features) features_added.reserve(features);
+  if (this->features.capacity() < features) this->features.reserve(features);
+}
+
 } // namespace nametag
 } // namespace ufal
@@ -15,6 +15,9 @@ namespace ufal {
 namespace nametag {
 
 struct ner_word {
+  // Flags describing which word attributes are required
+  enum { FORM = 1, RAW_LEMMA = 2, RAW_LEMMAS_ALL = 4, LEMMA_ID = 8, LEMMA_COMMENTS = 16, TAG = 32, ALL = 63 };
+
   string form;
   string raw_lemma;
   vector<string> raw_lemmas_all;
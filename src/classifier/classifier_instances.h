@@ -0,0 +1,68 @@
+// This file is part of NameTag <http://github.com/ufal/nametag/>.
+//
+// Copyright 2016 Institute of Formal and Applied Linguistics, Faculty of
+// Mathematics and Physics, Charles University in Prague, Czech Republic.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include "common.h"
+#include "classifier_feature.h"
+#include "classifier_outcome.h"
+
+namespace ufal {
+namespace nametag {
+
+// Classifier instances stored compactly -- the features of all instances are
+// kept in a single flat array, the features of instance i being
+// features[offsets[i]..offsets[i+1]).
+class classifier_instances {
+ public:
+  classifier_instances() : offsets(1, 0) {}
+
+  inline size_t size() const { return outcomes.size(); }
+  inline bool empty() const { return outcomes.empty(); }
+  inline void clear() { features.clear(); offsets.assign(1, 0); outcomes.clear(); }
+  inline void shrink_to_fit() { features.shrink_to_fit(); offsets.shrink_to_fit(); outcomes.shrink_to_fit(); }
+
+  inline void add(const classifier_feature* features, unsigned features_size, classifier_outcome outcome);
+
+  // Renumber the features using the given mapping, removing the ones mapped to removed
+  inline void renumber_features(const vector<classifier_feature>& renumbering, classifier_feature removed);
+
+  inline const classifier_feature* instance_features(size_t i) const { return features.data() + offsets[i]; }
+  inline unsigned instance_features_size(size_t i) const { return offsets[i + 1] - offsets[i]; }
+  inline classifier_outcome outcome(size_t i) const { return outcomes[i]; }
+
+  inline const classifier_features& all_features() const { return features; }
+
+ private:
+  classifier_features features;
+  vector<size_t> offsets;
+  vector<classifier_outcome> outcomes;
+};
+
+void classifier_instances::add(const classifier_feature* features, unsigned features_size, classifier_outcome outcome) {
+  this->features.insert(this->features.end(), features, features + features_size);
+  offsets.push_back(this->features.size());
+  outcomes.push_back(outcome);
+}
+
+void classifier_instances::renumber_features(const vector<classifier_feature>& renumbering, classifier_feature removed) {
+  size_t kept = 0;
+  for (size_t i = 0, start = offsets[0]; i < outcomes.size(); i++) {
+    size_t end = offsets[i + 1];
+    for (size_t j = start; j < end; j++)
+      if (renumbering[features[j]] != removed)
+        features[kept++] = renumbering[features[j]];
+    start = end;
+    offsets[i + 1] = kept;
+  }
+  features.resize(kept);
+}
+
+} // namespace nametag
+} // namespace ufal
@@ -8,11 +8,15 @@
 // file, You can obtain one at http://mozilla.org/MPL/2.0/.
 
 #include <algorithm>
+#include <chrono>
 #include <cmath>
 #include <cstring>
 #include <random>
+#include <system_error>
+#include <thread>
 
 #include "network_classifier.h"
+#include "network_kernels.h"
 #include "utils/compressor.h"
 #include "utils/unaligned_access.h"
 
@@ -25,23 +29,33 @@ bool network_classifier::load(istream& is) {
 
   try {
     // Direct connections
-    load_matrix(data, indices);
-    missing_weight = unaligned_load<double>(data.next<double>(1));
-    load_matrix(data, weights);
+    bool in_place;
+    load_direct_connections(data, in_place);
 
     // Hidden layer
     hidden_weights[0].clear();
     hidden_weights[1].clear();
     hidden_layer.resize(data.next_2B());
     if (!hidden_layer.empty()) {
-      load_matrix(data, hidden_weights[0]);
-      load_matrix(data, hidden_weights[1]);
+      if (in_place) {
+        load_matrix_in_place(data, hidden_weights[0]);
+        load_matrix_in_place(data, hidden_weights[1]);
+      } else if (float16_weights) {
+        load_matrix_float16(data, hidden_weights[0]);
+        load_matrix_float16(data, hidden_weights[1]);
+      } else {
+        load_matrix(data, hidden_weights[0]);
+        load_matrix(data, hidden_weights[1]);
+      }
     }
 
     // Output layer
     unsigned outcomes = data.next_2B();
     output_layer.resize(outcomes);
     output_error.resize(outcomes);
+
+    // The referenced weights are kept alive by the loaded data
+    if (in_place) in_place_storage = data.storage();
   } catch (binary_decoder_error&) {
     return false;
   }
@@ -49,72 +63,238 @@ bool network_classifier::load(istream& is) {
   return data.is_end();
 }
 
-template<class T>
-void network_classifier::load_matrix(binary_decoder& data, vector<vector<T>>& m) {
-  m.resize(data.next_4B());
-  for (auto&& row : m) {
-    row.resize(data.next_2B());
-    if (!row.empty())
-      memcpy((unsigned char*) row.data(), data.next<T>(row.size()), row.size() * sizeof(T));
+// Returns the array referenced in the data, or nullptr when it had to be copied
+// to the given vector because it was not suitably aligned in memory
+template <class T>
+static const T* next_in_place(binary_decoder& data, unsigned elements, vector<T>& copy) {
+  const T* array = data.next_aligned<T>(elements, copy);
+  return array == copy.data() ? nullptr : array;
+}
+
+// The in-place matrices are stored as aligned arrays of the row-major weights
+void network_classifier::load_matrix_in_place(binary_decoder& data, weight_matrix& m) {
+  m.rows = data.next_4B();
+  m.columns = data.next_4B();
+  if (m.columns && m.rows > ~0U / m.columns) throw binary_decoder_error("Too large network matrix");
+  m.in_place = next_in_place(data, m.rows * m.columns, m.weights);
+}
+
+// The rows are stored with their sizes, which must all be the same
+void network_classifier::load_matrix(binary_decoder& data, weight_matrix& m) {
+  unsigned rows = data.next_4B();
+  for (unsigned i = 0; i < rows; i++) {
+    unsigned columns = data.next_2B();
+    if (!i) m.resize(rows, columns);
+    if (columns != m.columns) throw binary_decoder_error("Rows of different sizes in a network matrix");
+    if (columns)
+      memcpy((unsigned char*) m[i], data.next<float>(columns), columns * sizeof(float));
+  }
+}
+
+void network_classifier::load_matrix_float16(binary_decoder& data, weight_matrix& m) {
+  unsigned rows = data.next_4B();
+  for (unsigned i = 0; i < rows; i++) {
+    unsigned columns = data.next_2B();
+    if (!i) m.resize(rows, columns);
+    if (columns != m.columns) throw binary_decoder_error("Rows of different sizes in a network matrix");
+    const uint16_t* values = data.next<uint16_t>(columns);
+    for (unsigned j = 0; j < columns; j++)
+      m[i][j] = network_kernels::float16_to_float(unaligned_load<uint16_t>(values + j));
   }
 }
 
-bool network_classifier::train(unsigned features, unsigned outcomes, const vector<classifier_instance>& train,
-                               const vector<classifier_instance>& heldout, const network_parameters& parameters, bool verbose) {
+void network_classifier::load_direct_connections(binary_decoder& data, bool& in_place) {
+  // Models with non-float32 weights or the in-place layout start with
+  // a marker and the weights encoding flags
+  unsigned features = data.next_4B();
+  float16_weights = in_place = false;
+  if (features == weights_encoding_marker) {
+    unsigned encoding = data.next_1B();
+    if (!encoding || (encoding & ~(weights_encoding_float16 | weights_encoding_in_place))) throw binary_decoder_error("Unknown weights encoding");
+    float16_weights = encoding & weights_encoding_float16;
+    in_place = encoding & weights_encoding_in_place;
+    features = data.next_4B();
+  }
+
+  in_place_storage.reset();
+  in_place_offsets = nullptr;
+  in_place_connections = nullptr;
+  in_place_connections_float16 = nullptr;
+  direct_offsets.clear();
+  direct_connections.clear();
+  direct_connections_float16.clear();
+
+  if (in_place) {
+    // The missing_weight is followed by aligned arrays of the offsets and the connections
+    missing_weight = unaligned_load<double>(data.next<double>(1));
+    unsigned connections = data.next_4B();
+    in_place_offsets = next_in_place(data, features + 1, direct_offsets);
+    in_place_offsets_size = features + 1;
+    if (float16_weights)
+      in_place_connections_float16 = next_in_place(data, connections, direct_connections_float16);
+    else
+      in_place_connections = next_in_place(data, connections, direct_connections);
+    in_place_connections_size = connections;
+
+    // The offsets are verified, as the classification relies on them
+    const uint32_t* offsets = this->offsets();
+    if (offsets[0]) throw binary_decoder_error("Inconsistent offsets of direct connection weights");
+    for (unsigned f = 1; f <= features; f++)
+      if (offsets[f] < offsets[f - 1]) throw binary_decoder_error("Inconsistent offsets of direct connection weights");
+    if (offsets[features] != connections) throw binary_decoder_error("Inconsistent number of direct connection weights");
+    return;
+  }
+
+  // The outcomes of all features are stored first, followed by the missing_weight and the weights
+  direct_offsets.resize(features + 1);
+  direct_offsets[0] = 0;
+  for (unsigned f = 1; f < direct_offsets.size(); f++) {
+    unsigned row = data.next_2B();
+    const uint32_t* outcomes = data.next<uint32_t>(row);
+    for (unsigned i = 0; i < row; i++)
+      if (float16_weights) {
+        uint32_t outcome = unaligned_load<uint32_t>(outcomes + i);
+        if (outcome > 0xFFFFU) throw binary_decoder_error("Outcome out of range in a float16 network");
+        direct_connections_float16.push_back({uint16_t(outcome), 0});
+      } else {
+        direct_connections.push_back({unaligned_load<uint32_t>(outcomes + i), 0.f});
+      }
+    direct_offsets[f] = float16_weights ? direct_connections_float16.size() : direct_connections.size();
+  }
+
+  missing_weight = unaligned_load<double>(data.next<double>(1));
+
+  if (data.next_4B() + 1 != direct_offsets.size()) throw binary_decoder_error("Inconsistent number of direct connection weights");
+  for (unsigned f = 1; f < direct_offsets.size(); f++) {
+    unsigned row = data.next_2B();
+    if (row != direct_offsets[f] - direct_offsets[f - 1]) throw binary_decoder_error("Inconsistent number of direct connection weights");
+    if (float16_weights) {
+      const uint16_t* weights = data.next<uint16_t>(row);
+      for (unsigned i = 0; i < row; i++)
+        direct_connections_float16[direct_offsets[f - 1] + i].weight = unaligned_load<uint16_t>(weights + i);
+    } else {
+      const float* weights = data.next<float>(row);
+      for (unsigned i = 0; i < row; i++)
+        direct_connections[direct_offsets[f - 1] + i].weight = unaligned_load<float>(weights + i);
+    }
+  }
+}
+
+bool network_classifier::train(unsigned features, unsigned outcomes, const classifier_instances& train,
+                               const classifier_instances& heldout, const network_parameters& parameters, bool verbose) {
   // Assertions
   if (features <= 0) { if (verbose) cerr << "There must be more than zero features!" << endl; return false; }
   if (outcomes <= 0) { if (verbose) cerr << "There must be more than zero features!" << endl; return false; }
+  if (outcomes > 0xFFFFU) { if (verbose) cerr << "There must be at most 65535 outcomes!" << endl; return false; }
   if (train.empty()) { if (verbose) cerr << "No training data!" << endl; return false; }
-  for (auto&& instance : train) {
-    if (instance.outcome >= outcomes) { if (verbose) cerr << "Training instances out of range!" << endl; return false; }
-    for(auto& feature : instance.features)
-      if (feature >= features) { if (verbose) cerr << "Training instances out of range!" << endl; return false; }
+  for (size_t i = 0; i < train.size(); i++)
+    if (train.outcome(i) >= outcomes) { if (verbose) cerr << "Training instances out of range!" << endl; return false; }
+  for (auto&& feature : train.all_features())
+    if (feature >= features) { if (verbose) cerr << "Training instances out of range!" << endl; return false; }
+  for (auto&& feature : heldout.all_features())
+    if (feature >= features) { if (verbose) cerr << "Heldout instances out of range!" << endl; return false; }
+
+  // When warm starting, the current weights are kept, dequantizing float16 ones
+  copy_in_place_weights();
+  bool warm_start = parameters.warm_start;
+  unsigned previous_features = direct_offsets.empty() ? 0 : direct_offsets.size() - 1, previous_outcomes = output_layer.size();
+  if (warm_start) {
+    if (features < previous_features) { if (verbose) cerr << "Cannot warm start with fewer features!" << endl; return false; }
+    if (outcomes < previous_outcomes) { if (verbose) cerr << "Cannot warm start with fewer outcomes!" << endl; return false; }
+    if (float16_weights) {
+      direct_connections.clear();
+      for (auto&& connection : direct_connections_float16)
+        direct_connections.push_back({connection.outcome, network_kernels::float16_to_float(connection.weight)});
+      float16_weights = false;
+    }
   }
-  for (auto&& instance : heldout)
-    for(auto& feature : instance.features)
-      if (feature >= features) { if (verbose) cerr << "Heldout instances out of range!" << endl; return false; }
 
   mt19937 generator(42);
   uniform_real_distribution<float> uniform(-0.1, 0.1);
 
-  // Compute indices from existing feature-outcome pairs
-  indices.clear();
-  indices.resize(features);
-  for (auto&& instance : train)
-    for (auto&& feature : instance.features)
-      indices[feature].emplace_back(instance.outcome);
+  // Compute indices from existing feature-outcome pairs, including the current
+  // connections when warm starting
+  {
+    vector<vector<uint32_t>> indices(features);
+    for (size_t i = 0; i < train.size(); i++)
+      for (auto* feature = train.instance_features(i), *feature_end = feature + train.instance_features_size(i); feature < feature_end; feature++)
+        indices[*feature].emplace_back(train.outcome(i));
+    if (warm_start)
+      for (unsigned f = 0; f < previous_features; f++)
+        for (uint32_t c = direct_offsets[f]; c < direct_offsets[f + 1]; c++)
+          indices[f].push_back(direct_connections[c].outcome);
+
+    for (auto&& row : indices) {
+      sort(row.begin(), row.end());
+      row.resize(unique(row.begin(), row.end()) - row.begin());
+    }
 
-  for (auto&& row : indices) {
-    sort(row.begin(), row.end());
-    row.resize(unique(row.begin(), row.end()) - row.begin());
+    // Initialize direct connections. When warm starting, the existing ones
+    // keep their weights and the new ones start with the missing_weight, so
+    // that the classification does not change before the training.
+    vector<uint32_t> previous_offsets;
+    vector<direct_connection> previous_connections;
+    if (warm_start) {
+      previous_offsets.swap(direct_offsets);
+      previous_connections.swap(direct_connections);
+    }
+    direct_offsets.assign(1, 0);
+    direct_connections.clear();
+    direct_connections_float16.clear();
+    float16_weights = false;
+    for (unsigned f = 0; f < features; f++) {
+      for (auto&& outcome : indices[f]) {
+        float weight = warm_start ? missing_weight : 0.f;
+        if (f < previous_features)
+          for (uint32_t c = previous_offsets[f]; c < previous_offsets[f + 1]; c++)
+            if (previous_connections[c].outcome == outcome)
+              weight = previous_connections[c].weight;
+        direct_connections.push_back({outcome, weight});
+      }
+      direct_offsets.push_back(direct_connections.size());
+    }
   }
+  if (!warm_start) missing_weight = parameters.missing_weight;
 
-  // Initialize direct connections
-  weights.clear();
-  for (auto&& row : indices)
-    weights.emplace_back(row.size());
-  missing_weight = parameters.missing_weight;
-
-  // Initialize hidden layer
-  hidden_layer.resize(parameters.hidden_layer);
+  // Initialize hidden layer, extending the current one by zero weights when
+  // warm starting
+  if (!warm_start) {
+    hidden_layer.resize(parameters.hidden_layer);
+    hidden_weights[0].clear();
+    hidden_weights[1].clear();
+  }
   if (!hidden_layer.empty()) {
     hidden_error.resize(hidden_layer.size());
 
-    hidden_weights[0].resize(features);
-    for (auto&& row : hidden_weights[0])
-      for (auto&& weight : row.resize(hidden_layer.size()), row)
-        weight = uniform(generator) + uniform(generator) + uniform(generator);
+    weight_matrix previous_weights = hidden_weights[0];
+    hidden_weights[0].resize(features, hidden_layer.size());
+    for (unsigned f = 0; f < features; f++)
+      for (unsigned h = 0; h < hidden_layer.size(); h++)
+        hidden_weights[0][f][h] = f < previous_weights.rows ? previous_weights[f][h] : warm_start ? 0.f : uniform(generator) + uniform(generator) + uniform(generator);
 
-    hidden_weights[1].resize(hidden_layer.size());
-    for (auto&& row : hidden_weights[1])
-      for (auto&& weight : row.resize(outcomes), row)
-        weight = uniform(generator) + uniform(generator) + uniform(generator);
+    previous_weights = hidden_weights[1];
+    hidden_weights[1].resize(hidden_layer.size(), outcomes);
+    for (unsigned h = 0; h < hidden_layer.size(); h++)
+      for (unsigned o = 0; o < outcomes; o++)
+        hidden_weights[1][h][o] = h < previous_weights.rows && o < previous_weights.columns ? previous_weights[h][o] : warm_start ? 0.f : uniform(generator) + uniform(generator) + uniform(generator);
   }
 
   // Initialize output layer
   output_layer.resize(outcomes);
   output_error.resize(outcomes);
 
+  // Initialize AdaGrad accumulators
+  direct_accumulators.clear();
+  hidden_accumulators[0].clear();
+  hidden_accumulators[1].clear();
+  if (parameters.adagrad) {
+    direct_accumulators.assign(direct_connections.size(), float(adagrad_initial_accumulator));
+    for (unsigned layer = 0; layer < 2; layer++) {
+      hidden_accumulators[layer].resize(hidden_weights[layer].rows, hidden_weights[layer].columns);
+      fill(hidden_accumulators[layer].weights.begin(), hidden_accumulators[layer].weights.end(), float(adagrad_initial_accumulator));
+    }
+  }
+
   // Normalize gaussian_sigma
   double gaussian_sigma = parameters.gaussian_sigma / train.size();
 
@@ -123,8 +303,32 @@ bool network_classifier::train(unsigned features, unsigned outcomes, const vecto
   for (unsigned i = 0; i < train.size(); i++)
     permutation.push_back(i);
 
+  // With multiple threads, every iteration trains independent copies of the
+  // network on consecutive parts of the shuffled training data, and then the
+  // weights of the copies are averaged. The training is therefore still
+  // deterministic, but its results differ from the sequential training.
+  // The AdaGrad accumulators of the copies are averaged in the same way.
+  // Distributed training splits the data into the copies of all processes,
+  // giving the same results as a single process with all their threads.
+  auto distribution = parameters.distribution;
+  unsigned threads = max(1, min(parameters.threads, int(train.size())));
+  unsigned all_shards = threads * (distribution ? distribution->processes() : 1);
+  unsigned first_shard = threads * (distribution ? distribution->rank() : 0);
+  vector<network_classifier> shards(all_shards > 1 ? threads : 0, *this);
+  vector<float> shards_weights;
+
+  // With early stopping, the weights of the iteration with the best heldout
+  // accuracy (and logprob) are kept, and the training stops when it does not improve
+  bool early_stopping = parameters.early_stopping > 0 && !heldout.empty();
+  int best_iteration = -1;
+  size_t best_heldout_correct = 0;
+  double best_heldout_logprob = 0;
+  vector<direct_connection> best_direct_connections;
+  weight_matrix best_hidden_weights[2];
+
   for (int iteration = 0; iteration < parameters.iterations; iteration++) {
     if (verbose) cerr << "Iteration " << iteration + 1 << ": ";
+    auto iteration_start = chrono::steady_clock::now();
 
     double learning_rate = parameters.final_learning_rate && parameters.iterations > 1 ?
         exp(((parameters.iterations - 1 - iteration) * log(parameters.initial_learning_rate) + iteration * log(parameters.final_learning_rate)) / (parameters.iterations-1)) :
@@ -134,16 +338,85 @@ bool network_classifier::train(unsigned features, unsigned outcomes, const vecto
 
     // Process instances in random order
     shuffle(permutation.begin(), permutation.end(), generator);
-    for (auto&& train_index : permutation) {
-      auto& instance = train[train_index];
-      propagate(instance.features);
+    if (shards.empty()) {
+      train_instances(train, permutation.data(), permutation.size(), learning_rate, gaussian_sigma, logprob, training_correct);
+    } else {
+      vector<double> shards_logprob(shards.size(), 0);
+      vector<int> shards_correct(shards.size(), 0);
+      run_tasks(shards.size(), [&](unsigned s) {
+        auto& shard = shards[s];
+        shard.direct_connections = direct_connections;
+        shard.hidden_weights[0] = hidden_weights[0];
+        shard.hidden_weights[1] = hidden_weights[1];
+        shard.direct_accumulators = direct_accumulators;
+        shard.hidden_accumulators[0] = hidden_accumulators[0];
+        shard.hidden_accumulators[1] = hidden_accumulators[1];
+
+        size_t begin = permutation.size() * (first_shard + s) / all_shards, end = permutation.size() * (first_shard + s + 1) / all_shards;
+        shard.train_instances(train, permutation.data() + begin, end - begin, learning_rate, gaussian_sigma, shards_logprob[s], shards_correct[s]);
+      });
+
+      // Average the weights of the shards
+      if (distribution) {
+        shards_weights.clear();
+        for (auto&& shard : shards) {
+          for (auto&& connection : shard.direct_connections)
+            shards_weights.push_back(connection.weight);
+          for (unsigned layer = 0; layer < 2; layer++)
+            shards_weights.insert(shards_weights.end(), shard.hidden_weights[layer].weights.begin(), shard.hidden_weights[layer].weights.end());
+          shards_weights.insert(shards_weights.end(), shard.direct_accumulators.begin(), shard.direct_accumulators.end());
+          for (unsigned layer = 0; layer < 2; layer++)
+            shards_weights.insert(shards_weights.end(), shard.hidden_accumulators[layer].weights.begin(), shard.hidden_accumulators[layer].weights.end());
+        }
+        if (!distribution->average(shards.size(), shards_weights, shards_logprob, shards_correct)) {
+          if (verbose) cerr << "Cannot average the weights with the other training processes!" << endl;
+          return false;
+        }
 
-      // Update logprob and training_correct
-      logprob += log(output_layer[instance.outcome]);
-      training_correct += best_outcome() == instance.outcome;
+        auto weight = shards_weights.begin();
+        for (auto&& connection : direct_connections)
+          connection.weight = *weight++;
+        for (unsigned layer = 0; layer < 2; layer++)
+          for (auto&& hidden_weight : hidden_weights[layer].weights)
+            hidden_weight = *weight++;
+        for (auto&& accumulator : direct_accumulators)
+          accumulator = *weight++;
+        for (unsigned layer = 0; layer < 2; layer++)
+          for (auto&& accumulator : hidden_accumulators[layer].weights)
+            accumulator = *weight++;
+      } else {
+        for (size_t i = 0; i < direct_connections.size(); i++) {
+          double weight = 0;
+          for (auto&& shard : shards)
+            weight += shard.direct_connections[i].weight;
+          direct_connections[i].weight = weight / shards.size();
+        }
+        for (unsigned layer = 0; layer < 2; layer++)
+          for (size_t i = 0; i < hidden_weights[layer].weights.size(); i++) {
+            double weight = 0;
+            for (auto&& shard : shards)
+              weight += shard.hidden_weights[layer].weights[i];
+            hidden_weights[layer].weights[i] = weight / shards.size();
+          }
+        for (size_t i = 0; i < direct_accumulators.size(); i++) {
+          double accumulator = 0;
+          for (auto&& shard : shards)
+            accumulator += shard.direct_accumulators[i];
+          direct_accumulators[i] = accumulator / shards.size();
+        }
+        for (unsigned layer = 0; layer < 2; layer++)
+          for (size_t i = 0; i < hidden_accumulators[layer].weights.size(); i++) {
+            double accumulator = 0;
+            for (auto&& shard : shards)
+              accumulator += shard.hidden_accumulators[layer].weights[i];
+            hidden_accumulators[layer].weights[i] = accumulator / shards.size();
+          }
+      }
 
-      // Improve network weights according to correct outcome
-      backpropagate(instance, learning_rate, gaussian_sigma);
+      for (unsigned s = 0; s < shards_logprob.size(); s++) {
+        logprob += shards_logprob[s];
+        training_correct += shards_correct[s];
+      }
     }
     if (verbose)
       cerr << "a " << fixed << setprecision(3) << learning_rate
@@ -153,68 +426,285 @@ bool network_classifier::train(unsigned features, unsigned outcomes, const vecto
 
     // Evaluate heldout accuracy if heldout data are present
     if (!heldout.empty()) {
-      int heldout_correct = 0;
-      for (auto&& instance : heldout) {
-        propagate(instance.features);
-        heldout_correct += best_outcome() == instance.outcome;
+      unsigned heldout_threads = max(1U, min(threads, unsigned(heldout.size())));
+      vector<size_t> shards_correct(heldout_threads, 0);
+      vector<double> shards_logprob(heldout_threads, 0);
+      run_tasks(heldout_threads, [&](unsigned s) {
+        shards_correct[s] = correct_instances(heldout, heldout.size() * s / heldout_threads, heldout.size() * (s + 1) / heldout_threads, shards_logprob[s]);
+      });
+
+      size_t heldout_correct = 0;
+      double heldout_logprob = 0;
+      for (unsigned s = 0; s < heldout_threads; s++) {
+        heldout_correct += shards_correct[s];
+        heldout_logprob += shards_logprob[s];
       }
       if (verbose) cerr << "heldout acc " << heldout_correct * 100. / heldout.size() << ", ";
+
+      // The heldout accuracy is compared first, and the logprob on equal accuracies
+      if (early_stopping && (best_iteration < 0 || heldout_correct > best_heldout_correct ||
+                             (heldout_correct == best_heldout_correct && heldout_logprob > best_heldout_logprob))) {
+        best_iteration = iteration;
+        best_heldout_correct = heldout_correct;
+        best_heldout_logprob = heldout_logprob;
+        best_direct_connections = direct_connections;
+        best_hidden_weights[0] = hidden_weights[0];
+        best_hidden_weights[1] = hidden_weights[1];
+      }
     }
-    if (verbose) cerr << "done." << endl;
+    if (verbose) {
+      double seconds = chrono::duration<double>(chrono::steady_clock::now() - iteration_start).count();
+      cerr << "done, in " << fixed << setprecision(3) << seconds << "s ("
+           << setprecision(0) << train.size() / seconds << " training instances/s)." << endl;
+    }
+
+    if (early_stopping && iteration - best_iteration >= parameters.early_stopping) {
+      if (verbose) cerr << "Stopping early, no heldout improvement in " << parameters.early_stopping << " iterations." << endl;
+      break;
+    }
+  }
+
+  // Restore the best weights when early stopping
+  if (early_stopping && best_iteration >= 0) {
+    if (verbose) cerr << "Using the weights of iteration " << best_iteration + 1 << " with the best heldout accuracy." << endl;
+    direct_connections.swap(best_direct_connections);
+    swap(hidden_weights[0], best_hidden_weights[0]);
+    swap(hidden_weights[1], best_hidden_weights[1]);
   }
+
+  // The AdaGrad accumulators are needed only during training
+  vector<float>().swap(direct_accumulators);
+  hidden_accumulators[0] = weight_matrix();
+  hidden_accumulators[1] = weight_matrix();
   return true;
 }
 
-void network_classifier::classify(const classifier_features& features, vector<double>& outcomes, vector<double>& buffer) const {
+void network_classifier::train_instances(const classifier_instances& train, const int* indices, size_t size, double learning_rate,
+                                         double gaussian_sigma, double& logprob, int& correct) {
+  for (size_t i = 0; i < size; i++) {
+    const classifier_feature* features = train.instance_features(indices[i]);
+    unsigned features_size = train.instance_features_size(indices[i]);
+    classifier_outcome outcome = train.outcome(indices[i]);
+    propagate(features, features_size);
+
+    // Update logprob and correct
+    logprob += log(output_layer[outcome]);
+    correct += best_outcome() == outcome;
+
+    // Improve network weights according to correct outcome
+    if (direct_accumulators.empty())
+      backpropagate(features, features_size, outcome, learning_rate, gaussian_sigma);
+    else
+      backpropagate_adagrad(features, features_size, outcome, learning_rate, gaussian_sigma);
+  }
+  normalize_hidden_output_scale();
+}
+
+size_t network_classifier::correct_instances(const classifier_instances& instances, size_t begin, size_t end, double& logprob) const {
+  vector<double> hidden(hidden_layer.size()), output(output_layer.size());
+  size_t correct = 0;
+  for (size_t i = begin; i < end; i++) {
+    propagate(instances.instance_features(i), instances.instance_features_size(i), hidden, output);
+
+    classifier_outcome best = 0;
+    for (unsigned j = 1; j < output.size(); j++)
+      if (output[j] > output[best])
+        best = j;
+    correct += best == instances.outcome(i);
+    logprob += log(output[instances.outcome(i)]);
+  }
+  return correct;
+}
+
+void network_classifier::run_tasks(unsigned tasks, const function<void(unsigned)>& task) {
+  // The first task is run in this thread, the others in separate threads if possible
+  vector<thread> threads;
+  for (unsigned i = 1; i < tasks; i++)
+    try {
+      threads.emplace_back(task, i);
+    } catch (system_error&) {
+      task(i);
+    }
+
+  if (tasks) task(0);
+  for (auto&& thread : threads)
+    thread.join();
+}
+
+void network_classifier::classify(const classifier_feature* features, unsigned features_size, vector<double>& outcomes, vector<double>& buffer) const {
   if (outcomes.size() != output_layer.size()) outcomes.resize(output_layer.size());
   if (buffer.size() != hidden_layer.size()) buffer.resize(hidden_layer.size());
 
   // Propagation
-  propagate(features, buffer, outcomes);
+  propagate(features, features_size, buffer, outcomes);
+}
+
+void network_classifier::classify_scores(const classifier_feature* features, unsigned features_size, vector<double>& scores, vector<double>& buffer) const {
+  if (scores.size() != output_layer.size()) scores.resize(output_layer.size());
+  if (buffer.size() != hidden_layer.size()) buffer.resize(hidden_layer.size());
+
+  // Propagation without the softmax
+  propagate_scores(features, features_size, buffer, scores.data());
+}
+
+void network_classifier::classify_scores_batch(const classifier_feature* features, const unsigned* offsets, unsigned instances,
+                                               vector<double>& scores, vector<double>& buffer) const {
+  size_t outcomes = output_layer.size();
+  if (scores.size() < instances * outcomes) scores.resize(instances * outcomes);
+  if (buffer.size() != hidden_layer.size()) buffer.resize(hidden_layer.size());
+
+  // The direct connections are located by direct_offsets, so the offsets are
+  // prefetched two instances ahead and the connections one instance ahead
+  if (instances > 0) prefetch_offsets(features + offsets[0], offsets[1] - offsets[0]);
+  if (instances > 1) prefetch_offsets(features + offsets[1], offsets[2] - offsets[1]);
+  if (instances > 0) prefetch_connections(features + offsets[0], offsets[1] - offsets[0]);
+  for (unsigned i = 0; i < instances; i++) {
+    if (i + 2 < instances) prefetch_offsets(features + offsets[i + 2], offsets[i + 3] - offsets[i + 2]);
+    if (i + 1 < instances) prefetch_connections(features + offsets[i + 1], offsets[i + 2] - offsets[i + 1]);
+    propagate_scores(features + offsets[i], offsets[i + 1] - offsets[i], buffer, scores.data() + i * outcomes);
+  }
+}
+
+double network_classifier::accuracy(const classifier_instances& instances) const {
+  if (instances.empty()) return 0;
+
+  vector<double> scores, buffer;
+  unsigned correct = 0;
+  for (size_t i = 0; i < instances.size(); i++) {
+    classify_scores(instances.instance_features(i), instances.instance_features_size(i), scores, buffer);
+    correct += classifier_outcome(max_element(scores.begin(), scores.end()) - scores.begin()) == instances.outcome(i);
+  }
+  return correct / double(instances.size());
+}
+
+size_t network_classifier::memory_usage() const {
+  size_t bytes = direct_offsets.capacity() * sizeof(uint32_t) + direct_connections.capacity() * sizeof(direct_connection)
+      + direct_connections_float16.capacity() * sizeof(direct_connection_float16);
+  for (auto&& matrix : hidden_weights)
+    bytes += matrix.weights.capacity() * sizeof(float);
+
+  // The weights referenced in place are included too, even if they may be shared
+  if (in_place_offsets) bytes += in_place_offsets_size * sizeof(uint32_t);
+  if (in_place_connections) bytes += in_place_connections_size * sizeof(direct_connection);
+  if (in_place_connections_float16) bytes += in_place_connections_size * sizeof(direct_connection_float16);
+  for (auto&& matrix : hidden_weights)
+    if (matrix.in_place) bytes += size_t(matrix.rows) * matrix.columns * sizeof(float);
+  return bytes;
+}
+
+void network_classifier::copy_in_place_weights() {
+  if (in_place_offsets) direct_offsets.assign(in_place_offsets, in_place_offsets + in_place_offsets_size);
+  if (in_place_connections) direct_connections.assign(in_place_connections, in_place_connections + in_place_connections_size);
+  if (in_place_connections_float16) direct_connections_float16.assign(in_place_connections_float16, in_place_connections_float16 + in_place_connections_size);
+  for (auto&& matrix : hidden_weights)
+    if (matrix.in_place) matrix.weights.assign(matrix.in_place, matrix.in_place + size_t(matrix.rows) * matrix.columns);
+
+  in_place_offsets = nullptr;
+  in_place_connections = nullptr;
+  in_place_connections_float16 = nullptr;
+  for (auto&& matrix : hidden_weights)
+    matrix.in_place = nullptr;
+  in_place_storage.reset();
 }
 
-void network_classifier::propagate(const classifier_features& features) {
-  propagate(features, hidden_layer, output_layer);
+void network_classifier::propagate(const classifier_feature* features, unsigned features_size) {
+  propagate(features, features_size, hidden_layer, output_layer);
 }
 
-void network_classifier::propagate(const classifier_features& features, vector<double>& hidden_layer, vector<double>& output_layer) const {
-  output_layer.assign(output_layer.size(), features.size() * missing_weight);
+void network_classifier::propagate(const classifier_feature* features, unsigned features_size, vector<double>& hidden_layer, vector<double>& output_layer) const {
+  propagate_scores(features, features_size, hidden_layer, output_layer.data());
+
+  // Apply softmax sigmoid to output_layer layer
+  network_kernels::softmax(output_layer.data(), output_layer.size());
+}
+
+void network_classifier::propagate_scores(const classifier_feature* features, unsigned features_size, vector<double>& hidden_layer, double* output_layer) const {
+  const classifier_feature* features_end = features + features_size;
+  size_t outcomes = this->output_layer.size();
+  fill_n(output_layer, outcomes, features_size * missing_weight);
 
   // Direct connections
-  for (auto&& feature : features)
-    if (feature < indices.size())
-      for (unsigned i = 0; i < indices[feature].size(); i++)
-        output_layer[indices[feature][i]] += weights[feature][i] - missing_weight;
+  const uint32_t* offsets = this->offsets();
+  size_t offsets_size = this->offsets_size();
+  if (!float16_weights) {
+    const direct_connection* connections = this->connections();
+    for (auto* feature = features; feature < features_end; feature++)
+      if (*feature + 1 < offsets_size)
+        for (auto* connection = connections + offsets[*feature], * connection_end = connections + offsets[*feature + 1];
+             connection < connection_end; connection++)
+          output_layer[connection->outcome] += connection->weight - missing_weight;
+  } else {
+    const direct_connection_float16* connections = connections_float16();
+    for (auto* feature = features; feature < features_end; feature++)
+      if (*feature + 1 < offsets_size)
+        for (auto* connection = connections + offsets[*feature], * connection_end = connections + offsets[*feature + 1];
+             connection < connection_end; connection++)
+          output_layer[connection->outcome] += network_kernels::float16_to_float(connection->weight) - missing_weight;
+  }
 
   // Hidden layer
   if (!hidden_layer.empty()) {
     for (auto&& weight : hidden_layer)
       weight = 0;
 
-    // Propagate to hidden layer
-    for (auto&& feature : features)
-      if (feature < hidden_weights[0].size())
-        for (unsigned i = 0; i < hidden_layer.size(); i++) {
-          hidden_layer[i] += hidden_weights[0][feature][i];
+    // Propagate to hidden layer, gathering the rows of blocks of features
+    const float* rows[network_kernels::rows_block];
+    unsigned rows_size = 0;
+    for (auto* feature = features; feature < features_end; feature++)
+      if (*feature < hidden_weights[0].rows) {
+        rows[rows_size++] = hidden_weights[0][*feature];
+        if (rows_size == network_kernels::rows_block) {
+          network_kernels::accumulate_rows(hidden_layer.data(), rows, rows_size, hidden_layer.size());
+          rows_size = 0;
         }
+      }
+    if (rows_size)
+      network_kernels::accumulate_rows(hidden_layer.data(), rows, rows_size, hidden_layer.size());
 
     // Apply logistic sigmoid to hidden layer
-    for (auto&& weight : hidden_layer)
-      weight = 1 / (1 + exp(-weight));
-
-    // Propagate to output_layer
-    for (unsigned h = 0; h < hidden_layer.size(); h++)
-      for (unsigned i = 0; i < output_layer.size(); i++)
-        output_layer[i] += hidden_layer[h] * hidden_weights[1][h][i];
+    network_kernels::sigmoid(hidden_layer.data(), hidden_layer.size());
+
+    // Propagate to output_layer, using blocks of consecutive rows of hidden_weights[1]
+    double scales[network_kernels::rows_block];
+    for (unsigned h = 0; h < hidden_layer.size(); h += network_kernels::rows_block) {
+      rows_size = min(unsigned(network_kernels::rows_block), unsigned(hidden_layer.size()) - h);
+      for (unsigned i = 0; i < rows_size; i++) {
+        rows[i] = hidden_weights[1][h + i];
+        scales[i] = hidden_layer[h + i] * hidden_output_scale;
+      }
+      network_kernels::accumulate_scaled_rows(output_layer, scales, rows, rows_size, outcomes);
+    }
   }
+}
 
-  // Apply softmax sigmoid to output_layer layer
-  double sum = 0;
-  for (unsigned i = 0; i < output_layer.size(); sum += output_layer[i], i++)
-    output_layer[i] = exp(output_layer[i]);
-  sum = 1 / sum;
-  for (unsigned i = 0; i < output_layer.size(); i++)
-    output_layer[i] *= sum;
+void network_classifier::prefetch_offsets(const classifier_feature* features, unsigned features_size) const {
+  const uint32_t* offsets = this->offsets();
+  size_t offsets_size = this->offsets_size();
+  for (auto* feature = features, * features_end = features + features_size; feature < features_end; feature++)
+    if (*feature + 1 < offsets_size)
+      network_kernels::prefetch(offsets + *feature);
+}
+
+void network_classifier::prefetch_connections(const classifier_feature* features, unsigned features_size) const {
+  const uint32_t* offsets = this->offsets();
+  size_t offsets_size = this->offsets_size();
+  for (auto* feature = features, * features_end = features + features_size; feature < features_end; feature++)
+    if (*feature + 1 < offsets_size) {
+      if (!float16_weights)
+        network_kernels::prefetch(connections() + offsets[*feature]);
+      else
+        network_kernels::prefetch(connections_float16() + offsets[*feature]);
+      if (*feature < hidden_weights[0].rows)
+        network_kernels::prefetch(hidden_weights[0][*feature]);
+    }
+}
+
+void network_classifier::normalize_hidden_output_scale() {
+  if (hidden_output_scale != 1) {
+    for (auto&& weight : hidden_weights[1].weights)
+      weight *= hidden_output_scale;
+    hidden_output_scale = 1;
+  }
 }
 
 classifier_outcome network_classifier::best_outcome() {
@@ -226,15 +716,19 @@ classifier_outcome network_classifier::best_outcome() {
   return best;
 }
 
-void network_classifier::backpropagate(const classifier_instance& instance, double learning_rate, double gaussian_sigma) {
+void network_classifier::backpropagate(const classifier_feature* features, unsigned features_size, classifier_outcome outcome, double learning_rate, double gaussian_sigma) {
+  const classifier_feature* features_end = features + features_size;
+
   // Compute error vector
   for (unsigned i = 0; i < output_error.size(); i++)
-    output_error[i] = (i == instance.outcome) - output_layer[i];
+    output_error[i] = (i == outcome) - output_layer[i];
 
   // Update direct connections
-  for (auto&& feature : instance.features)
-    for (unsigned i = 0; i < indices[feature].size(); i++)
-      weights[feature][i] += learning_rate * output_error[indices[feature][i]] - weights[feature][i] * gaussian_sigma;
+  for (auto* feature = features; feature < features_end; feature++)
+    for (auto* connection = direct_connections.data() + direct_offsets[*feature],
+         * connection_end = direct_connections.data() + direct_offsets[*feature + 1];
+         connection < connection_end; connection++)
+      connection->weight += learning_rate * output_error[connection->outcome] - connection->weight * gaussian_sigma;
 
   // Update hidden layer
   if (!hidden_layer.empty()) {
@@ -243,18 +737,70 @@ void network_classifier::backpropagate(const classifier_instance& instance, doub
       hidden_error[h] = 0;
       for (unsigned i = 0; i < output_layer.size(); i++)
         hidden_error[h] += hidden_weights[1][h][i] * output_error[i];
-      hidden_error[h] *= hidden_layer[h] * (1-hidden_layer[h]);
+      hidden_error[h] *= hidden_output_scale * hidden_layer[h] * (1-hidden_layer[h]);
     }
 
-    // Update hidden_weights[1]
-    for (unsigned h = 0; h < hidden_layer.size(); h++)
+    // Update hidden_weights[1], performing the regularization by scaling
+    hidden_output_scale *= 1 - gaussian_sigma;
+    if (hidden_output_scale < 1e-3) normalize_hidden_output_scale();
+    for (unsigned h = 0; h < hidden_layer.size(); h++) {
+      double step = learning_rate * hidden_layer[h] / hidden_output_scale;
       for (unsigned i = 0; i < output_layer.size(); i++)
-        hidden_weights[1][h][i] += learning_rate * hidden_layer[h] * output_error[i] - hidden_weights[1][h][i] * gaussian_sigma;
+        hidden_weights[1][h][i] += step * output_error[i];
+    }
 
     // Update hidden_weights[0]
-    for (auto&& feature : instance.features)
+    for (auto* feature = features; feature < features_end; feature++)
       for (unsigned i = 0; i < hidden_layer.size(); i++)
-        hidden_weights[0][feature][i] += learning_rate * hidden_error[i] - hidden_weights[0][feature][i] * gaussian_sigma;
+        hidden_weights[0][*feature][i] += learning_rate * hidden_error[i] - hidden_weights[0][*feature][i] * gaussian_sigma;
+  }
+}
+
+void network_classifier::backpropagate_adagrad(const classifier_feature* features, unsigned features_size, classifier_outcome outcome, double learning_rate, double gaussian_sigma) {
+  const classifier_feature* features_end = features + features_size;
+
+  // Compute error vector
+  for (unsigned i = 0; i < output_error.size(); i++)
+    output_error[i] = (i == outcome) - output_layer[i];
+
+  // Update direct connections, dividing the learning rate of every weight by
+  // the square root of its accumulated squared gradients
+  for (auto* feature = features; feature < features_end; feature++)
+    for (size_t c = direct_offsets[*feature], c_end = direct_offsets[*feature + 1]; c < c_end; c++) {
+      auto& connection = direct_connections[c];
+      double gradient = output_error[connection.outcome];
+      direct_accumulators[c] += gradient * gradient;
+      connection.weight += learning_rate * gradient / sqrt(direct_accumulators[c]) - connection.weight * gaussian_sigma;
+    }
+
+  // Update hidden layer
+  if (!hidden_layer.empty()) {
+    // Backpropagate output_error into hidden_error
+    for (unsigned h = 0; h < hidden_layer.size(); h++) {
+      hidden_error[h] = 0;
+      for (unsigned i = 0; i < output_layer.size(); i++)
+        hidden_error[h] += hidden_weights[1][h][i] * output_error[i];
+      hidden_error[h] *= hidden_output_scale * hidden_layer[h] * (1-hidden_layer[h]);
+    }
+
+    // Update hidden_weights[1], performing the regularization by scaling;
+    // the gradients are accumulated for the scaled weights
+    hidden_output_scale *= 1 - gaussian_sigma;
+    if (hidden_output_scale < 1e-3) normalize_hidden_output_scale();
+    for (unsigned h = 0; h < hidden_layer.size(); h++)
+      for (unsigned i = 0; i < output_layer.size(); i++) {
+        double gradient = hidden_layer[h] * output_error[i];
+        hidden_accumulators[1][h][i] += gradient * gradient;
+        hidden_weights[1][h][i] += learning_rate * gradient / (sqrt(hidden_accumulators[1][h][i]) * hidden_output_scale);
+      }
+
+    // Update hidden_weights[0]
+    for (auto* feature = features; feature < features_end; feature++)
+      for (unsigned i = 0; i < hidden_layer.size(); i++) {
+        double gradient = hidden_error[i];
+        hidden_accumulators[0][*feature][i] += gradient * gradient;
+        hidden_weights[0][*feature][i] += learning_rate * gradient / sqrt(hidden_accumulators[0][*feature][i]) - hidden_weights[0][*feature][i] * gaussian_sigma;
+      }
   }
 }
 
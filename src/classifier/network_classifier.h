@@ -9,11 +9,14 @@
 
 #pragma once
 
+#include <functional>
+
 #include "common.h"
-#include "classifier_instance.h"
+#include "classifier_instances.h"
 #include "network_parameters.h"
 #include "utils/binary_decoder.h"
 #include "utils/binary_encoder.h"
+#include "utils/compressor.h"
 
 namespace ufal {
 namespace nametag {
@@ -21,33 +24,141 @@ namespace nametag {
 class network_classifier {
  public:
   bool load(istream& is);
-  bool save(ostream& os);
+  // Networks saved with the STORED codec use the in-place layout, storing the
+  // direct connections and the hidden weights as aligned arrays in the same
+  // format as in memory, so that loading references them in the loaded data.
+  bool save(ostream& os, compressor::codec codec = compressor::LZMA);
+
+  // With parameters.warm_start, the current (possibly loaded) weights are
+  // trained further. The features and outcomes must not be fewer than the
+  // current ones. The connections of the new feature-outcome pairs of the
+  // training data are added with the missing_weight, so that the
+  // classification does not change before training, while the new hidden
+  // layer weights of the added features and outcomes start at zero.
+  bool train(unsigned features, unsigned outcomes, const classifier_instances& train,
+             const classifier_instances& heldout, const network_parameters& parameters, bool verbose);
+
+  // Store the weights as float16 in the saved model and the direct connection
+  // weights also in memory. The network cannot be trained after quantization.
+  void quantize_float16();
 
-  bool train(unsigned features, unsigned outcomes, const vector<classifier_instance>& train,
-             const vector<classifier_instance>& heldout, const network_parameters& parameters, bool verbose);
+  void classify(const classifier_feature* features, unsigned features_size, vector<double>& outcomes, vector<double>& buffer) const;
+  // Return the unnormalized log-probabilities of the outcomes, skipping the softmax.
+  void classify_scores(const classifier_feature* features, unsigned features_size, vector<double>& scores, vector<double>& buffer) const;
+  // Return the scores of the given number of instances, the features of the
+  // instance i being features[offsets[i]..offsets[i+1]), as consecutive rows
+  // of outcomes() elements. The weights of the following instances are
+  // prefetched while the current one is processed.
+  void classify_scores_batch(const classifier_feature* features, const unsigned* offsets, unsigned instances, vector<double>& scores, vector<double>& buffer) const;
+  unsigned outcomes() const { return output_layer.size(); }
 
-  void classify(const classifier_features& features, vector<double>& outcomes, vector<double>& buffer) const;
+  // Return the fraction of correctly classified instances.
+  double accuracy(const classifier_instances& instances) const;
+
+  // Return the approximate number of bytes used by the network weights.
+  size_t memory_usage() const;
 
  private:
-  // Direct connections
-  vector<vector<float>> weights;
-  vector<vector<uint32_t>> indices;
+  // Direct connections, stored in compressed sparse row format -- the
+  // connections of feature f are direct_connections[direct_offsets[f]..direct_offsets[f+1]).
+  struct direct_connection {
+    uint32_t outcome;
+    float weight;
+  };
+  vector<uint32_t> direct_offsets;
+  vector<direct_connection> direct_connections;
   double missing_weight;
 
-  // Hidden layer, experimental use only
-  vector<vector<float>> hidden_weights[2];
+  // Direct connections of float16 models, used instead of direct_connections
+  struct direct_connection_float16 {
+    uint16_t outcome;
+    uint16_t weight;
+  };
+  vector<direct_connection_float16> direct_connections_float16;
+  bool float16_weights = false;
+
+  // Hidden layer, experimental use only. The weights are stored row-major in
+  // contiguous memory, so that the rows of consecutive hidden units and of the
+  // features of an instance are processed by the kernels as blocks.
+  // The weights of a matrix loaded in place are referenced by in_place
+  // instead, and only the const access can be used.
+  struct weight_matrix {
+    unsigned rows = 0, columns = 0;
+    vector<float> weights;
+    const float* in_place = nullptr;
+
+    void resize(unsigned rows, unsigned columns) { this->rows = rows; this->columns = columns; weights.assign(size_t(rows) * columns, 0.f); in_place = nullptr; }
+    void clear() { rows = columns = 0; weights.clear(); in_place = nullptr; }
+    float* operator[](unsigned row) { return weights.data() + size_t(row) * columns; }
+    const float* operator[](unsigned row) const { return (in_place ? in_place : weights.data()) + size_t(row) * columns; }
+  };
+  weight_matrix hidden_weights[2];
   vector<double> hidden_layer, hidden_error;
 
+  // Networks loaded from the in-place layout reference the direct offsets and
+  // connections in the loaded data kept alive by in_place_storage, and the
+  // corresponding vectors stay empty. The classification therefore accesses
+  // them using the following functions; training, quantization and saving
+  // first copy the referenced weights to the vectors.
+  shared_ptr<const void> in_place_storage;
+  const uint32_t* in_place_offsets = nullptr;
+  const direct_connection* in_place_connections = nullptr;
+  const direct_connection_float16* in_place_connections_float16 = nullptr;
+  size_t in_place_offsets_size = 0, in_place_connections_size = 0;
+  inline size_t offsets_size() const { return in_place_offsets ? in_place_offsets_size : direct_offsets.size(); }
+  inline const uint32_t* offsets() const { return in_place_offsets ? in_place_offsets : direct_offsets.data(); }
+  inline const direct_connection* connections() const { return in_place_connections ? in_place_connections : direct_connections.data(); }
+  inline const direct_connection_float16* connections_float16() const { return in_place_connections_float16 ? in_place_connections_float16 : direct_connections_float16.data(); }
+  void copy_in_place_weights();
+
+  // During training, the weights from the hidden layer to the output layer are
+  // hidden_output_scale * hidden_weights[1], so that their regularization
+  // consists of updating the scale only. Outside of training, the scale is 1.
+  double hidden_output_scale = 1;
+  inline void normalize_hidden_output_scale();
+
+  // With AdaGrad, the accumulated squared gradients of the direct connections
+  // and of the hidden weights, parallel to them, are kept during training.
+  vector<float> direct_accumulators;
+  weight_matrix hidden_accumulators[2];
+
   // Output layer
   vector<double> output_layer, output_error;
 
-  inline void propagate(const classifier_features& features);
-  inline void propagate(const classifier_features& features, vector<double>& hidden_layer, vector<double>& output_layer) const;
-  inline void backpropagate(const classifier_instance& instance, double learning_rate, double gaussian_sigma);
+  inline void propagate(const classifier_feature* features, unsigned features_size);
+  inline void propagate(const classifier_feature* features, unsigned features_size, vector<double>& hidden_layer, vector<double>& output_layer) const;
+  inline void propagate_scores(const classifier_feature* features, unsigned features_size, vector<double>& hidden_layer, double* output_layer) const;
+  inline void prefetch_offsets(const classifier_feature* features, unsigned features_size) const;
+  inline void prefetch_connections(const classifier_feature* features, unsigned features_size) const;
+  inline void backpropagate(const classifier_feature* features, unsigned features_size, classifier_outcome outcome, double learning_rate, double gaussian_sigma);
+  inline void backpropagate_adagrad(const classifier_feature* features, unsigned features_size, classifier_outcome outcome, double learning_rate, double gaussian_sigma);
   inline classifier_outcome best_outcome();
 
-  template<class T> void load_matrix(binary_decoder& data, vector<vector<T>>& m);
-  template<class T> void save_matrix(binary_encoder& enc, const vector<vector<T>>& m);
+  // Train on the given training instances, returning their logprob and the number of correctly classified ones
+  void train_instances(const classifier_instances& train, const int* indices, size_t size, double learning_rate,
+                       double gaussian_sigma, double& logprob, int& correct);
+  // Return the number of correctly classified instances, adding their logprob to the given one
+  size_t correct_instances(const classifier_instances& instances, size_t begin, size_t end, double& logprob) const;
+  // Run the given number of tasks, in parallel when possible
+  static void run_tasks(unsigned tasks, const function<void(unsigned)>& task);
+
+  void load_matrix(binary_decoder& data, weight_matrix& m);
+  void save_matrix(binary_encoder& enc, const weight_matrix& m);
+  void load_matrix_float16(binary_decoder& data, weight_matrix& m);
+  void save_matrix_float16(binary_encoder& enc, const weight_matrix& m);
+  void load_matrix_in_place(binary_decoder& data, weight_matrix& m);
+  void save_matrix_in_place(binary_encoder& enc, const weight_matrix& m);
+  void load_direct_connections(binary_decoder& data, bool& in_place);
+  void save_direct_connections(binary_encoder& enc, bool in_place);
+
+  // Marker preceding the encoding flags of models with non-float32 weights or
+  // the in-place layout; older models start directly with the number of
+  // features instead.
+  enum { weights_encoding_marker = 0xFFFFFFFFU };
+  enum { weights_encoding_float16 = 1, weights_encoding_in_place = 2 };
+
+  // Initial value of the AdaGrad accumulators, bounding the first steps
+  static constexpr float adagrad_initial_accumulator = 0.1f;
 };
 
 } // namespace nametag
@@ -8,40 +8,125 @@
 // file, You can obtain one at http://mozilla.org/MPL/2.0/.
 
 #include "network_classifier.h"
+#include "network_kernels.h"
 #include "utils/compressor.h"
 
 namespace ufal {
 namespace nametag {
 
-bool network_classifier::save(ostream& os) {
+bool network_classifier::save(ostream& os, compressor::codec codec) {
+  copy_in_place_weights();
   binary_encoder enc;
 
   // Direct connections
-  save_matrix(enc, indices);
-  enc.add_double(missing_weight);
-  save_matrix(enc, weights);
+  bool in_place = codec == compressor::STORED;
+  save_direct_connections(enc, in_place);
 
   // Hidden layer
   enc.add_2B(hidden_layer.size());
   if (!hidden_layer.empty()) {
-    save_matrix(enc, hidden_weights[0]);
-    save_matrix(enc, hidden_weights[1]);
+    if (in_place) {
+      save_matrix_in_place(enc, hidden_weights[0]);
+      save_matrix_in_place(enc, hidden_weights[1]);
+    } else if (float16_weights) {
+      save_matrix_float16(enc, hidden_weights[0]);
+      save_matrix_float16(enc, hidden_weights[1]);
+    } else {
+      save_matrix(enc, hidden_weights[0]);
+      save_matrix(enc, hidden_weights[1]);
+    }
   }
 
   // Output layer
   enc.add_2B(output_layer.size());
 
-  return compressor::save(os, enc);
+  return compressor::save(os, enc, codec);
+}
+
+void network_classifier::save_direct_connections(binary_encoder& enc, bool in_place) {
+  unsigned features = direct_offsets.size() - 1;
+
+  if (float16_weights || in_place) {
+    enc.add_4B(weights_encoding_marker);
+    enc.add_1B((float16_weights ? weights_encoding_float16 : 0) | (in_place ? weights_encoding_in_place : 0));
+  }
+
+  // The in-place layout stores the offsets and the connections as in memory
+  if (in_place) {
+    enc.add_4B(features);
+    enc.add_double(missing_weight);
+    enc.add_4B(float16_weights ? direct_connections_float16.size() : direct_connections.size());
+    enc.add_aligned(direct_offsets.data(), direct_offsets.size());
+    if (float16_weights)
+      enc.add_aligned(direct_connections_float16.data(), direct_connections_float16.size());
+    else
+      enc.add_aligned(direct_connections.data(), direct_connections.size());
+    return;
+  }
+
+  // Otherwise keep the format of the original vector<vector<>> indices and weights
+
+  enc.add_4B(features);
+  for (unsigned f = 0; f < features; f++) {
+    enc.add_2B(direct_offsets[f + 1] - direct_offsets[f]);
+    for (unsigned i = direct_offsets[f]; i < direct_offsets[f + 1]; i++)
+      enc.add_4B(float16_weights ? direct_connections_float16[i].outcome : direct_connections[i].outcome);
+  }
+
+  enc.add_double(missing_weight);
+
+  enc.add_4B(features);
+  for (unsigned f = 0; f < features; f++) {
+    enc.add_2B(direct_offsets[f + 1] - direct_offsets[f]);
+    for (unsigned i = direct_offsets[f]; i < direct_offsets[f + 1]; i++)
+      if (float16_weights)
+        enc.add_2B(direct_connections_float16[i].weight);
+      else
+        enc.add_data(&direct_connections[i].weight, 1);
+  }
+}
+
+void network_classifier::quantize_float16() {
+  if (float16_weights) return;
+  copy_in_place_weights();
+
+  direct_connections_float16.clear();
+  direct_connections_float16.reserve(direct_connections.size());
+  for (auto&& connection : direct_connections)
+    direct_connections_float16.push_back({uint16_t(connection.outcome), network_kernels::float_to_float16(connection.weight)});
+  vector<direct_connection>().swap(direct_connections);
+
+  // The hidden layer weights are kept as floats in memory, only rounded
+  for (auto&& matrix : hidden_weights)
+    for (auto&& weight : matrix.weights)
+      weight = network_kernels::float16_to_float(network_kernels::float_to_float16(weight));
+
+  float16_weights = true;
+}
+
+// Keep the format of the original vector<vector<>>, storing the size of every row
+void network_classifier::save_matrix_float16(binary_encoder& enc, const weight_matrix& m) {
+  enc.add_4B(m.rows);
+  for (unsigned i = 0; i < m.rows; i++) {
+    enc.add_2B(m.columns);
+    for (unsigned j = 0; j < m.columns; j++)
+      enc.add_2B(network_kernels::float_to_float16(m[i][j]));
+  }
 }
 
-template <class T>
-void network_classifier::save_matrix(binary_encoder& enc, const vector<vector<T>>& m) {
-  enc.add_4B(m.size());
-  for (auto&& row : m) {
-    enc.add_2B(row.size());
-    enc.add_data(row.data(), row.size());
+void network_classifier::save_matrix(binary_encoder& enc, const weight_matrix& m) {
+  enc.add_4B(m.rows);
+  for (unsigned i = 0; i < m.rows; i++) {
+    enc.add_2B(m.columns);
+    enc.add_data(m[i], m.columns);
   }
 }
 
+void network_classifier::save_matrix_in_place(binary_encoder& enc, const weight_matrix& m) {
+  enc.add_4B(m.rows);
+  enc.add_4B(m.columns);
+  enc.add_aligned(m.weights.data(), m.weights.size());
+}
+
 } // namespace nametag
 } // namespace ufal
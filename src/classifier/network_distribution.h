@@ -0,0 +1,37 @@
+// This file is part of NameTag <http://github.com/ufal/nametag/>.
+//
+// Copyright 2016 Institute of Formal and Applied Linguistics, Faculty of
+// Mathematics and Physics, Charles University in Prague, Czech Republic.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include "common.h"
+
+namespace ufal {
+namespace nametag {
+
+// Averaging of the network weights with other training processes, each of
+// which trains the same number of shards of every iteration. The processes
+// have ranks 0..processes()-1, the shards of a process of rank r being the
+// shards r*shards..(r+1)*shards-1 of all processes.
+class network_distribution {
+ public:
+  virtual ~network_distribution() {}
+
+  virtual unsigned processes() const = 0;
+  virtual unsigned rank() const = 0;
+
+  // Given the concatenated weights of the local shards and their logprobs
+  // and numbers of correct instances, replace the weights by the average of
+  // the weights of the shards of all processes, and the statistics by the
+  // statistics of all the shards, in the order of their ranks. Every process
+  // obtains identical results. Returns false on communication errors.
+  virtual bool average(unsigned shards, vector<float>& weights, vector<double>& logprobs, vector<int>& corrects) = 0;
+};
+
+} // namespace nametag
+} // namespace ufal
@@ -0,0 +1,253 @@
+// This file is part of NameTag <http://github.com/ufal/nametag/>.
+//
+// Copyright 2016 Institute of Formal and Applied Linguistics, Faculty of
+// Mathematics and Physics, Charles University in Prague, Czech Republic.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include <cmath>
+#include <cstring>
+
+#include "common.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define NAMETAG_NETWORK_KERNELS_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace ufal {
+namespace nametag {
+
+// Vectorized kernels used by network_classifier::propagate.
+//
+// The SSE2 versions perform exactly the same IEEE operations in the same order
+// as the scalar fallbacks, so both produce bit-identical results. The exp is
+// a Cephes-style rational approximation with relative error below 5e-16 in
+// [-708, 709]; inputs outside this range are clamped to it.
+class network_kernels {
+ public:
+  // values[i] = exp(values[i])
+  static inline void exp(double* values, size_t size);
+
+  // values[i] = 1 / (1 + exp(-values[i]))
+  static inline void sigmoid(double* values, size_t size);
+
+  // values[i] = exp(values[i]) / sum_j exp(values[j])
+  static inline void softmax(double* values, size_t size);
+
+  // target[i] += sources[0][i] + ... + sources[sources_size-1][i] and
+  // target[i] += scales[0] * sources[0][i] + ..., adding the sources to the
+  // target one by one in the given order, while keeping it in registers.
+  // The callers pass blocks of rows_block sources.
+  enum { rows_block = 4 };
+  static inline void accumulate_rows(double* target, const float* const* sources, size_t sources_size, size_t size);
+  static inline void accumulate_scaled_rows(double* target, const double* scales, const float* const* sources, size_t sources_size, size_t size);
+
+  // Conversions between float and IEEE half precision float16. Infinities and
+  // NaNs are not supported, values out of range saturate to the largest float16.
+  static inline float float16_to_float(uint16_t value);
+  static inline uint16_t float_to_float16(float value);
+
+  // Hint the processor to load the cache line of the given address
+  static inline void prefetch(const void* address);
+
+ private:
+  static inline double exp_scalar(double x);
+#ifdef NAMETAG_NETWORK_KERNELS_SSE2
+  static inline __m128d exp_sse2(__m128d x);
+#endif
+
+  static constexpr double exp_min = -708., exp_max = 709.;
+  static constexpr double log2e = 1.4426950408889634073599;
+  static constexpr double ln2_hi = 6.93145751953125e-1, ln2_lo = 1.42860682030941723212e-6;
+  static constexpr double p0 = 1.26177193074810590878e-4, p1 = 3.02994407707441961300e-2, p2 = 9.99999999999999999910e-1;
+  static constexpr double q0 = 3.00198505138664455042e-6, q1 = 2.52448340349684104192e-3, q2 = 2.27265548208155028766e-1, q3 = 2.00000000000000000009e0;
+};
+
+double network_kernels::exp_scalar(double x) {
+  if (x < exp_min) x = exp_min;
+  if (x > exp_max) x = exp_max;
+
+  // Range reduction x = n * ln2 + r, |r| <= ln2 / 2
+  double n = std::nearbyint(x * log2e);
+  x -= n * ln2_hi;
+  x -= n * ln2_lo;
+
+  // exp(r) = 1 + 2r P(r^2) / (Q(r^2) - r P(r^2))
+  double xx = x * x;
+  double px = x * ((p0 * xx + p1) * xx + p2);
+  double qx = ((q0 * xx + q1) * xx + q2) * xx + q3;
+  x = px / (qx - px);
+  x = 1. + 2. * x;
+
+  // Multiply by 2^n
+  uint64_t bits = uint64_t(int64_t(n) + 1023) << 52;
+  double scale;
+  memcpy(&scale, &bits, sizeof(scale));
+  return x * scale;
+}
+
+#ifdef NAMETAG_NETWORK_KERNELS_SSE2
+__m128d network_kernels::exp_sse2(__m128d x) {
+  x = _mm_min_pd(_mm_max_pd(x, _mm_set1_pd(exp_min)), _mm_set1_pd(exp_max));
+
+  // Range reduction, with the default round-to-nearest as std::nearbyint
+  __m128i n_int = _mm_cvtpd_epi32(_mm_mul_pd(x, _mm_set1_pd(log2e)));
+  __m128d n = _mm_cvtepi32_pd(n_int);
+  x = _mm_sub_pd(x, _mm_mul_pd(n, _mm_set1_pd(ln2_hi)));
+  x = _mm_sub_pd(x, _mm_mul_pd(n, _mm_set1_pd(ln2_lo)));
+
+  __m128d xx = _mm_mul_pd(x, x);
+  __m128d px = _mm_mul_pd(x, _mm_add_pd(_mm_mul_pd(_mm_add_pd(_mm_mul_pd(_mm_set1_pd(p0), xx), _mm_set1_pd(p1)), xx), _mm_set1_pd(p2)));
+  __m128d qx = _mm_add_pd(_mm_mul_pd(_mm_add_pd(_mm_mul_pd(_mm_add_pd(_mm_mul_pd(_mm_set1_pd(q0), xx), _mm_set1_pd(q1)), xx), _mm_set1_pd(q2)), xx), _mm_set1_pd(q3));
+  x = _mm_div_pd(px, _mm_sub_pd(qx, px));
+  x = _mm_add_pd(_mm_set1_pd(1.), _mm_mul_pd(_mm_set1_pd(2.), x));
+
+  __m128i bits = _mm_slli_epi64(_mm_unpacklo_epi32(_mm_add_epi32(n_int, _mm_set1_epi32(1023)), _mm_setzero_si128()), 52);
+  return _mm_mul_pd(x, _mm_castsi128_pd(bits));
+}
+#endif
+
+void network_kernels::exp(double* values, size_t size) {
+  size_t i = 0;
+#ifdef NAMETAG_NETWORK_KERNELS_SSE2
+  for (; i + 2 <= size; i += 2)
+    _mm_storeu_pd(values + i, exp_sse2(_mm_loadu_pd(values + i)));
+#endif
+  for (; i < size; i++)
+    values[i] = exp_scalar(values[i]);
+}
+
+void network_kernels::sigmoid(double* values, size_t size) {
+  size_t i = 0;
+#ifdef NAMETAG_NETWORK_KERNELS_SSE2
+  for (; i + 2 <= size; i += 2) {
+    __m128d one = _mm_set1_pd(1.);
+    __m128d e = exp_sse2(_mm_sub_pd(_mm_setzero_pd(), _mm_loadu_pd(values + i)));
+    _mm_storeu_pd(values + i, _mm_div_pd(one, _mm_add_pd(one, e)));
+  }
+#endif
+  for (; i < size; i++)
+    values[i] = 1. / (1. + exp_scalar(-values[i]));
+}
+
+void network_kernels::softmax(double* values, size_t size) {
+  exp(values, size);
+
+  // The sum is computed sequentially, so that it does not depend on the vector width
+  double sum = 0;
+  for (size_t i = 0; i < size; i++)
+    sum += values[i];
+  sum = 1 / sum;
+
+  size_t i = 0;
+#ifdef NAMETAG_NETWORK_KERNELS_SSE2
+  for (; i + 2 <= size; i += 2)
+    _mm_storeu_pd(values + i, _mm_mul_pd(_mm_loadu_pd(values + i), _mm_set1_pd(sum)));
+#endif
+  for (; i < size; i++)
+    values[i] *= sum;
+}
+
+void network_kernels::accumulate_rows(double* target, const float* const* sources, size_t sources_size, size_t size) {
+  size_t i = 0;
+#ifdef NAMETAG_NETWORK_KERNELS_SSE2
+  for (; i + 4 <= size; i += 4) {
+    __m128d low = _mm_loadu_pd(target + i), high = _mm_loadu_pd(target + i + 2);
+    for (size_t j = 0; j < sources_size; j++) {
+      __m128 s = _mm_loadu_ps(sources[j] + i);
+      low = _mm_add_pd(low, _mm_cvtps_pd(s));
+      high = _mm_add_pd(high, _mm_cvtps_pd(_mm_movehl_ps(s, s)));
+    }
+    _mm_storeu_pd(target + i, low);
+    _mm_storeu_pd(target + i + 2, high);
+  }
+#endif
+  for (; i < size; i++) {
+    double value = target[i];
+    for (size_t j = 0; j < sources_size; j++)
+      value += sources[j][i];
+    target[i] = value;
+  }
+}
+
+void network_kernels::accumulate_scaled_rows(double* target, const double* scales, const float* const* sources, size_t sources_size, size_t size) {
+  size_t i = 0;
+#ifdef NAMETAG_NETWORK_KERNELS_SSE2
+  for (; i + 4 <= size; i += 4) {
+    __m128d low = _mm_loadu_pd(target + i), high = _mm_loadu_pd(target + i + 2);
+    for (size_t j = 0; j < sources_size; j++) {
+      __m128d scale_pd = _mm_set1_pd(scales[j]);
+      __m128 s = _mm_loadu_ps(sources[j] + i);
+      low = _mm_add_pd(low, _mm_mul_pd(scale_pd, _mm_cvtps_pd(s)));
+      high = _mm_add_pd(high, _mm_mul_pd(scale_pd, _mm_cvtps_pd(_mm_movehl_ps(s, s))));
+    }
+    _mm_storeu_pd(target + i, low);
+    _mm_storeu_pd(target + i + 2, high);
+  }
+#endif
+  for (; i < size; i++) {
+    double value = target[i];
+    for (size_t j = 0; j < sources_size; j++)
+      value += scales[j] * sources[j][i];
+    target[i] = value;
+  }
+}
+
+float network_kernels::float16_to_float(uint16_t value) {
+  // Shift the exponent and mantissa to their float32 positions and rebias
+  // the exponent by multiplying with 2^112, which also handles subnormals.
+  uint32_t bits = uint32_t(value & 0x7FFFU) << 13;
+  float magnitude;
+  memcpy(&magnitude, &bits, sizeof(magnitude));
+  magnitude *= 5.192296858534827628530496329220096e33f;
+
+  memcpy(&bits, &magnitude, sizeof(bits));
+  bits |= uint32_t(value & 0x8000U) << 16;
+  float result;
+  memcpy(&result, &bits, sizeof(result));
+  return result;
+}
+
+void network_kernels::prefetch(const void* address) {
+#if defined(__GNUC__)
+  __builtin_prefetch(address);
+#elif defined(NAMETAG_NETWORK_KERNELS_SSE2)
+  _mm_prefetch((const char*) address, _MM_HINT_T0);
+#else
+  (void) address;
+#endif
+}
+
+uint16_t network_kernels::float_to_float16(float value) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  uint32_t sign = bits & 0x80000000U;
+  bits ^= sign;
+
+  uint16_t result;
+  if (bits >= 0x477FF000U) {
+    // Out of float16 range, saturate
+    result = 0x7BFFU;
+  } else if (bits < 0x38800000U) {
+    // Subnormal or zero, let the float addition of 0.5 perform the rounding
+    float magnitude;
+    memcpy(&magnitude, &bits, sizeof(magnitude));
+    magnitude += 0.5f;
+    memcpy(&bits, &magnitude, sizeof(bits));
+    result = bits - 0x3F000000U;
+  } else {
+    // Normal number, rebias the exponent and round to nearest even
+    uint32_t mantissa_odd = (bits >> 13) & 1;
+    bits += 0xC8000FFFU + mantissa_odd;
+    result = bits >> 13;
+  }
+  return result | (sign >> 16);
+}
+
+} // namespace nametag
+} // namespace ufal
@@ -10,6 +10,7 @@
 #pragma once
 
 #include "common.h"
+#include "network_distribution.h"
 
 namespace ufal {
 namespace nametag {
@@ -21,6 +22,11 @@ struct network_parameters {
   double final_learning_rate;
   double gaussian_sigma;
   int hidden_layer; // Experimental use only.
+  int threads; // Training threads, 1 meaning sequential training.
+  int early_stopping; // Stop after this many iterations without heldout improvement, 0 meaning never.
+  bool adagrad; // Scale the learning rate of every weight by AdaGrad.
+  bool warm_start; // Continue training the current weights, keeping the missing_weight and hidden_layer.
+  network_distribution* distribution; // Averaging with other processes, nullptr meaning a single process.
 };
 
 } // namespace nametag
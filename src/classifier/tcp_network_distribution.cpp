@@ -0,0 +1,263 @@
+// This file is part of NameTag <http://github.com/ufal/nametag/>.
+//
+// Copyright 2016 Institute of Formal and Applied Linguistics, Faculty of
+// Mathematics and Physics, Charles University in Prague, Czech Republic.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+#include "tcp_network_distribution.h"
+
+#ifdef __linux__
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace ufal {
+namespace nametag {
+
+#ifdef __linux__
+
+// Read or write exactly the given number of bytes, failing on errors and
+// closed connections
+static bool receive_fully(int connection, void* data, size_t length) {
+  char* bytes = (char*) data;
+  while (length) {
+    ssize_t received = recv(connection, bytes, length, 0);
+    if (received < 0 && errno == EINTR) continue;
+    if (received <= 0) return false;
+    bytes += received;
+    length -= received;
+  }
+  return true;
+}
+
+static bool send_fully(int connection, const void* data, size_t length) {
+  const char* bytes = (const char*) data;
+  while (length) {
+    ssize_t sent = send(connection, bytes, length, MSG_NOSIGNAL);
+    if (sent < 0 && errno == EINTR) continue;
+    if (sent <= 0) return false;
+    bytes += sent;
+    length -= sent;
+  }
+  return true;
+}
+
+bool tcp_network_distribution::start(unsigned rank, unsigned processes, const string& host, int port, unsigned timeout, string& error) {
+  stop();
+
+  if (!processes || rank >= processes) return error.assign("The rank must be smaller than the number of processes!"), false;
+  process_rank = rank;
+  processes_count = processes;
+  if (processes == 1) return true;
+
+  int one = 1;
+  if (rank == 0) {
+    // Listen on both IPv6 and IPv4 if possible, on IPv4 only otherwise
+    int zero = 0, listening = socket(AF_INET6, SOCK_STREAM, 0);
+    if (listening >= 0) {
+      sockaddr_in6 address;
+      memset(&address, 0, sizeof(address));
+      address.sin6_family = AF_INET6;
+      address.sin6_addr = in6addr_any;
+      address.sin6_port = htons(port);
+      if (setsockopt(listening, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0 ||
+          setsockopt(listening, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero)) != 0 ||
+          bind(listening, (sockaddr*) &address, sizeof(address)) != 0)
+        close(listening), listening = -1;
+    }
+    if (listening < 0) {
+      listening = socket(AF_INET, SOCK_STREAM, 0);
+      if (listening < 0) return error.assign("Cannot create a socket!"), false;
+
+      sockaddr_in address;
+      memset(&address, 0, sizeof(address));
+      address.sin_family = AF_INET;
+      address.sin_addr.s_addr = htonl(INADDR_ANY);
+      address.sin_port = htons(port);
+      if (setsockopt(listening, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0 ||
+          bind(listening, (sockaddr*) &address, sizeof(address)) != 0)
+        return close(listening), error.assign("Cannot bind the port ").append(to_string(port)).append("!"), false;
+    }
+    timeval timeval = {time_t(timeout), 0};
+    if (listen(listening, SOMAXCONN) != 0 ||
+        setsockopt(listening, SOL_SOCKET, SO_RCVTIMEO, &timeval, sizeof(timeval)) != 0)
+      return close(listening), error.assign("Cannot listen on the port ").append(to_string(port)).append("!"), false;
+
+    // Accept the connections of all the other processes, ordered by their ranks
+    connections.assign(processes - 1, -1);
+    for (unsigned accepted = 0; accepted + 1 < processes; accepted++) {
+      int connection;
+      while ((connection = accept(listening, nullptr, nullptr)) < 0 && errno == EINTR) {}
+      if (connection < 0) {
+        close(listening), stop();
+        return error.assign("Not all the training processes connected in time!"), false;
+      }
+
+      uint32_t handshake[3];
+      if (!receive_fully(connection, handshake, sizeof(handshake)) || handshake[0] != MAGIC ||
+          handshake[1] == 0 || handshake[1] >= processes || handshake[2] != processes || connections[handshake[1] - 1] >= 0) {
+        close(connection), close(listening), stop();
+        return error.assign("A training process connected with an invalid rank or number of processes!"), false;
+      }
+      // The accepted connection inherits the timeout, which is meant only for
+      // connecting, as the processes can reach the averaging much later
+      struct timeval no_timeout = {0, 0};
+      setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &no_timeout, sizeof(no_timeout));
+      setsockopt(connection, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      connections[handshake[1] - 1] = connection;
+    }
+    close(listening);
+  } else {
+    // Connect to the process of rank 0, retrying until it starts listening
+    addrinfo hints, *addresses;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host.c_str(), to_string(port).c_str(), &hints, &addresses) != 0)
+      return error.assign("Cannot resolve the host '").append(host).append("'!"), false;
+
+    int connection = -1;
+    auto deadline = chrono::steady_clock::now() + chrono::seconds(timeout);
+    while (connection < 0) {
+      for (auto address = addresses; address && connection < 0; address = address->ai_next) {
+        connection = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (connection >= 0 && connect(connection, address->ai_addr, address->ai_addrlen) != 0)
+          close(connection), connection = -1;
+      }
+      if (connection < 0) {
+        if (chrono::steady_clock::now() >= deadline) break;
+        this_thread::sleep_for(chrono::milliseconds(500));
+      }
+    }
+    freeaddrinfo(addresses);
+    if (connection < 0)
+      return error.assign("Cannot connect to the training process of rank 0 at '").append(host).append(":").append(to_string(port)).append("'!"), false;
+
+    setsockopt(connection, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    connections.assign(1, connection);
+
+    uint32_t handshake[3] = {MAGIC, rank, processes};
+    if (!send_fully(connection, handshake, sizeof(handshake)))
+      return stop(), error.assign("Cannot connect to the training process of rank 0!"), false;
+  }
+
+  return true;
+}
+
+void tcp_network_distribution::stop() {
+  for (auto&& connection : connections)
+    if (connection >= 0)
+      close(connection);
+  connections.clear();
+}
+
+bool tcp_network_distribution::average(unsigned shards, vector<float>& weights, vector<double>& logprobs, vector<int>& corrects) {
+  if (!shards || weights.size() % shards || logprobs.size() != shards || corrects.size() != shards) return false;
+  uint64_t size = weights.size() / shards;
+
+  if (process_rank) {
+    // Send the local shards and receive the results from the process of rank 0
+    int connection = connections.front();
+    uint32_t header_shards = shards;
+    if (!send_fully(connection, &header_shards, sizeof(header_shards)) ||
+        !send_fully(connection, &size, sizeof(size)))
+      return false;
+    for (unsigned s = 0; s < shards; s++) {
+      int32_t correct = corrects[s];
+      if (!send_fully(connection, &logprobs[s], sizeof(double)) ||
+          !send_fully(connection, &correct, sizeof(correct)))
+        return false;
+    }
+    if (!send_fully(connection, weights.data(), weights.size() * sizeof(float))) return false;
+
+    uint32_t all_shards;
+    if (!receive_fully(connection, &all_shards, sizeof(all_shards)) || all_shards != shards * processes_count) return false;
+    logprobs.resize(all_shards);
+    corrects.resize(all_shards);
+    for (unsigned s = 0; s < all_shards; s++) {
+      int32_t correct;
+      if (!receive_fully(connection, &logprobs[s], sizeof(double)) ||
+          !receive_fully(connection, &correct, sizeof(correct)))
+        return false;
+      corrects[s] = correct;
+    }
+    weights.resize(size);
+    return receive_fully(connection, weights.data(), weights.size() * sizeof(float));
+  }
+
+  // Sum the weights of the local shards and of the shards of the other
+  // processes, in the order of their ranks
+  sums.assign(size, 0.);
+  for (unsigned s = 0; s < shards; s++)
+    for (size_t i = 0; i < size; i++)
+      sums[i] += weights[s * size + i];
+
+  buffer.resize(size);
+  for (auto&& connection : connections) {
+    uint32_t connection_shards;
+    uint64_t connection_size;
+    if (!receive_fully(connection, &connection_shards, sizeof(connection_shards)) ||
+        !receive_fully(connection, &connection_size, sizeof(connection_size)) ||
+        connection_shards != shards || connection_size != size)
+      return false;
+    for (unsigned s = 0; s < shards; s++) {
+      double logprob;
+      int32_t correct;
+      if (!receive_fully(connection, &logprob, sizeof(logprob)) ||
+          !receive_fully(connection, &correct, sizeof(correct)))
+        return false;
+      logprobs.push_back(logprob);
+      corrects.push_back(correct);
+    }
+    for (unsigned s = 0; s < shards; s++) {
+      if (!receive_fully(connection, buffer.data(), buffer.size() * sizeof(float))) return false;
+      for (size_t i = 0; i < size; i++)
+        sums[i] += buffer[i];
+    }
+  }
+
+  uint32_t all_shards = logprobs.size();
+  weights.resize(size);
+  for (size_t i = 0; i < size; i++)
+    weights[i] = sums[i] / all_shards;
+
+  for (auto&& connection : connections) {
+    if (!send_fully(connection, &all_shards, sizeof(all_shards))) return false;
+    for (unsigned s = 0; s < all_shards; s++) {
+      int32_t correct = corrects[s];
+      if (!send_fully(connection, &logprobs[s], sizeof(double)) ||
+          !send_fully(connection, &correct, sizeof(correct)))
+        return false;
+    }
+    if (!send_fully(connection, weights.data(), weights.size() * sizeof(float))) return false;
+  }
+  return true;
+}
+
+#else
+
+bool tcp_network_distribution::start(unsigned /*rank*/, unsigned /*processes*/, const string& /*host*/, int /*port*/, unsigned /*timeout*/, string& error) {
+  return error.assign("Distributed training is supported on Linux only!"), false;
+}
+
+void tcp_network_distribution::stop() {}
+
+bool tcp_network_distribution::average(unsigned /*shards*/, vector<float>& /*weights*/, vector<double>& /*logprobs*/, vector<int>& /*corrects*/) {
+  return false;
+}
+
+#endif
+
+} // namespace nametag
+} // namespace ufal
@@ -0,0 +1,61 @@
+// This file is part of NameTag <http://github.com/ufal/nametag/>.
+//
+// Copyright 2016 Institute of Formal and Applied Linguistics, Faculty of
+// Mathematics and Physics, Charles University in Prague, Czech Republic.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include "common.h"
+#include "network_distribution.h"
+
+namespace ufal {
+namespace nametag {
+
+// Averaging of the network weights of several processes over TCP. The
+// process of rank 0 accepts a connection from every other process, sums the
+// weights of all shards in the order of their ranks, and sends the averaged
+// weights back, so the result does not depend on the order of arrival.
+//
+// A process connects by sending uint32 magic, rank and number of processes.
+// In every averaging, it then sends uint32 number of its shards, uint64
+// number of the weights, the double logprob and int32 correct instances of
+// every shard and the float weights of the shards, and receives uint32
+// number of all shards, their logprobs and correct instances and the
+// averaged weights. All values are in the native byte order, so all the
+// processes must run on machines with the same architecture.
+class tcp_network_distribution : public network_distribution {
+ public:
+  ~tcp_network_distribution() { stop(); }
+
+  // Connect the given number of processes. The process of rank 0 listens on
+  // the given port, the other processes connect to it using the given host,
+  // and all of them wait at most timeout seconds for the connections.
+  // Supported on Linux only.
+  bool start(unsigned rank, unsigned processes, const string& host, int port, unsigned timeout, string& error);
+
+  // Close the connections
+  void stop();
+
+  virtual unsigned processes() const override { return processes_count; }
+  virtual unsigned rank() const override { return process_rank; }
+  virtual bool average(unsigned shards, vector<float>& weights, vector<double>& logprobs, vector<int>& corrects) override;
+
+ private:
+  unsigned process_rank = 0, processes_count = 1;
+
+  // The connections of the processes of ranks 1.. in the process of rank 0,
+  // the connection to the process of rank 0 otherwise
+  vector<int> connections;
+
+  vector<double> sums;
+  vector<float> buffer;
+
+  enum { MAGIC = 0x5444544EU };
+};
+
+} // namespace nametag
+} // namespace ufal
@@ -0,0 +1,62 @@
+// This file is part of NameTag <http://github.com/ufal/nametag/>.
+//
+// Copyright 2016 Institute of Formal and Applied Linguistics, Faculty of
+// Mathematics and Physics, Charles University in Prague, Czech Republic.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#include "ner/bilou_ner_converter.h"
+#include "ner/ner_ids.h"
+#include "utils/compressor.h"
+#include "utils/iostreams.h"
+#include "utils/options.h"
+#include "version/version.h"
+
+using namespace ufal::nametag;
+
+int main(int argc, char* argv[]) {
+  iostreams_init();
+
+  options::map options;
+  if (!options::parse({{"quantize", options::value{"float16"}},
+                       {"quantize_tagger", options::value{"int16"}},
+                       {"uncompressed", options::value::none},
+                       {"version", options::value::none},
+                       {"help", options::value::none}}, argc, argv, options) ||
+      options.count("help") ||
+      argc != 1)
+    runtime_failure("Usage: " << argv[0] << " [options] < input_model > output_model\n"
+                    "Options: --quantize=float16\n"
+                    "         --quantize_tagger=int16\n"
+                    "         --uncompressed\n"
+                    "         --version\n"
+                    "         --help");
+  if (options.count("version"))
+    return cout << version::version_and_copyright() << endl, 0;
+
+  bool float16_weights = options.count("quantize");
+  bool int16_tagger_scores = options.count("quantize_tagger");
+  compressor::codec codec = options.count("uncompressed") ? compressor::STORED : compressor::LZMA;
+
+  // Switch stdin and stdout to binary mode.
+  iostreams_init_binary_input();
+  iostreams_init_binary_output();
+
+  ner_id id = ner_id(cin.get());
+  switch (id) {
+    case ner_ids::CZECH_NER:
+    case ner_ids::ENGLISH_NER:
+    case ner_ids::GENERIC_NER:
+      cout.put(id);
+      bilou_ner_converter::convert(id, cin, float16_weights, int16_tagger_scores, codec, cout);
+      if (!cout.flush()) runtime_failure("Cannot write the converted model!");
+      cerr << "Recognizer converted." << endl;
+      break;
+    default:
+      runtime_failure("Unknown ner_identifier of the input model!");
+  }
+
+  return 0;
+}
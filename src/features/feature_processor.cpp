@@ -25,31 +25,67 @@ bool feature_processor::parse(int window, const vector<string>& /*args*/, entity
   this->window = window;
 
   map.clear();
+  frozen.clear();
+  vocabulary_features.clear();
+  hashed_buckets = 0;
   lookup(string(), total_features); // Always add an empty string to the map
 
   return true;
 }
 
 void feature_processor::load(binary_decoder& data, const nlp_pipeline& /*pipeline*/) {
+  // Processors with hashed features start with a marker, the number of buckets
+  // and the first hashed feature
   window = data.next_4B();
+  hashed_buckets = 0;
+  if (unsigned(window) == hashed_features_marker) {
+    hashed_buckets = data.next_4B();
+    hashed_first = data.next_4B();
+    if (!hashed_buckets) throw binary_decoder_error("Invalid number of hashed feature buckets");
+    window = data.next_4B();
+  }
 
+  // The in-place layout contains the frozen map itself. Otherwise, build the
+  // frozen map directly from the saved keys, which are distinct, keeping
+  // the map itself empty. The saved bucket count is not needed.
   map.clear();
-  map.rehash(data.next_4B());
-  for (unsigned i = data.next_4B(); i > 0; i--) {
-    string key;
-    data.next_str(key);
-    map.emplace(key, data.next_4B());
+  vocabulary_features.clear();
+  if (data.next_4B() == in_place_marker) {
+    frozen.load(data);
+    return;
+  }
+
+  vector<pair<string_piece, ner_feature>> loaded(data.next_4B());
+  for (auto&& element : loaded) {
+    unsigned len = data.next_1B();
+    if (len == 255) len = data.next_4B();
+    element.first = string_piece(data.next<char>(len), len);
+    element.second = data.next_4B();
   }
+  frozen.build(loaded);
 }
 
-void feature_processor::save(binary_encoder& enc) {
+void feature_processor::save(binary_encoder& enc, bool in_place) {
+  if (hashed_buckets) {
+    enc.add_4B(hashed_features_marker);
+    enc.add_4B(hashed_buckets);
+    enc.add_4B(hashed_first);
+  }
   enc.add_4B(window);
 
-  enc.add_4B(map.bucket_count());
-  enc.add_4B(map.size());
-
   vector<pair<string, ner_feature>> map_elements(map.begin(), map.end());
   sort(map_elements.begin(), map_elements.end());
+
+  if (in_place) {
+    frozen_map saved;
+    saved.build(map_elements);
+    enc.add_4B(in_place_marker);
+    saved.save(enc);
+    return;
+  }
+
+  enc.add_4B(map.bucket_count());
+  enc.add_4B(map.size());
   for (auto&& element : map_elements) {
     enc.add_str(element.first);
     enc.add_4B(element.second);
@@ -58,9 +94,119 @@ void feature_processor::save(binary_encoder& enc) {
 
 void feature_processor::process_sentence(ner_sentence& /*sentence*/, ner_feature* /*total_features*/, string& /*buffer*/) const {}
 
+bool feature_processor::depends_on_previous_stage() const {
+  return false;
+}
+
+unsigned feature_processor::word_attributes() const {
+  return ner_word::ALL;
+}
+
+unsigned feature_processor::word_features() const {
+  return 2*window + 1;
+}
+
 void feature_processor::process_entities(ner_sentence& /*sentence*/, vector<named_entity>& /*entities*/, vector<named_entity>& /*buffer*/) const {}
 
+void feature_processor::added_entity_types(vector<string>& /*types*/) const {}
+
 void feature_processor::gazetteers(vector<string>& /*gazetteers*/, vector<int>* /*gazetteer_types*/) const {}
 
+bool feature_processor::reload_gazetteers(const nlp_pipeline& /*pipeline*/) {
+  return true;
+}
+
+bool feature_processor::may_start_match(const vector<string_piece>& /*forms*/) const {
+  return false;
+}
+
+int feature_processor::vocabulary() const {
+  return ner_sentence::VOCABULARY_NONE;
+}
+
+size_t feature_processor::memory_usage() const {
+  return frozen.memory_usage() + vocabulary_features.capacity() * sizeof(ner_feature);
+}
+
+void feature_processor::count_lookups(bool enable) {
+  counting_lookups = enable;
+  lookups = 0;
+  lookup_hits = 0;
+}
+
+void feature_processor::lookup_statistics(size_t& lookups, size_t& hits) const {
+  lookups = this->lookups.load(memory_order_relaxed);
+  hits = lookup_hits.load(memory_order_relaxed);
+}
+
+void feature_processor::add_to_vocabulary(unordered_map<string, ner_feature>& vocabulary) const {
+  // The map is used when saving the vocabularies of a processor being trained
+  frozen.for_each([&vocabulary](string_piece key, ner_feature /*value*/) {
+    vocabulary.emplace(string(key.str, key.len), vocabulary.size());
+  });
+  vector<string> keys;
+  for (auto&& element : map)
+    keys.push_back(element.first);
+  sort(keys.begin(), keys.end());
+  for (auto&& key : keys)
+    vocabulary.emplace(key, vocabulary.size());
+}
+
+void feature_processor::added_features(ner_feature first_feature, vector<pair<ner_feature, unsigned>>& features) const {
+  for (auto&& element : map)
+    if (element.second >= first_feature + window)
+      features.emplace_back(element.second - window, 2*window + 1);
+}
+
+void feature_processor::renumber_added_features(ner_feature first_feature, const vector<ner_feature>& renumbering) {
+  for (auto it = map.begin(); it != map.end(); )
+    if (it->second < first_feature + window) {
+      ++it;
+    } else if (renumbering[it->second] == ner_feature_unknown) {
+      it = map.erase(it);
+    } else {
+      it->second = renumbering[it->second];
+      ++it;
+    }
+}
+
+void feature_processor::unfreeze() {
+  // The processors use the map whenever the frozen map is empty
+  frozen.for_each([this](string_piece key, ner_feature value) {
+    map.emplace(string(key.str, key.len), value);
+  });
+  frozen.clear();
+  vocabulary_features.clear();
+}
+
+bool feature_processor::supports_feature_hashing() const {
+  return false;
+}
+
+void feature_processor::use_feature_hashing(unsigned buckets, ner_feature* total_features) {
+  // The features of the empty string added last by parse are reused, as the
+  // empty string is hashed too
+  hashed_first = map.at(string()) - window;
+  *total_features = hashed_first + buckets * (2*window + 1);
+  hashed_buckets = buckets;
+  map.clear();
+}
+
+bool feature_processor::use_vocabulary(const frozen_map& vocabulary) {
+  // Hashed processors look up the hashed keys and not the vocabulary
+  if (hashed_buckets) return true;
+
+  bool complete = true;
+  vocabulary_features.assign(vocabulary.size(), ner_feature_unknown);
+  frozen.for_each([this, &vocabulary, &complete](string_piece key, ner_feature value) {
+    const ner_feature* id = vocabulary.find(key);
+    if (id && *id < vocabulary_features.size())
+      vocabulary_features[*id] = value;
+    else
+      complete = false;
+  });
+  return complete;
+}
+
 } // namespace nametag
 } // namespace ufal
@@ -9,8 +9,11 @@
 
 #pragma once
 
+#include <atomic>
+
 #include "common.h"
 #include "bilou/ner_sentence.h"
+#include "frozen_map.h"
 #include "ner/entity_map.h"
 #include "ner/ner.h"
 #include "nlp_pipeline.h"
@@ -27,26 +30,137 @@ class feature_processor {
   virtual bool parse(int window, const vector<string>& args, entity_map& entities,
                      ner_feature* total_features, const nlp_pipeline& pipeline);
   virtual void load(binary_decoder& data, const nlp_pipeline& pipeline);
-  virtual void save(binary_encoder& enc);
+  // With in_place, the keys are saved as a frozen map in the in-place layout,
+  // which is referenced by the loaded processor instead of being copied.
+  virtual void save(binary_encoder& enc, bool in_place);
 
   virtual void process_sentence(ner_sentence& sentence, ner_feature* total_features, string& buffer) const;
+  virtual bool depends_on_previous_stage() const;
+  // Combination of ner_word flags describing the used word attributes
+  virtual unsigned word_attributes() const;
+  // Usual maximum number of features added to a single word, used to reserve
+  // the sentence buffers; the processor can add more
+  virtual unsigned word_features() const;
   virtual void process_entities(ner_sentence& sentence, vector<named_entity>& entities, vector<named_entity>& buffer) const;
+  // Append the types of the entities which process_entities can add; the
+  // processing keeps all the given entities, so it can be skipped when only
+  // entities of other types are requested
+  virtual void added_entity_types(vector<string>& types) const;
 
   virtual void gazetteers(vector<string>& gazetteers, vector<int>* gazetteer_types) const;
+  virtual bool reload_gazetteers(const nlp_pipeline& pipeline);
+  // Whether a gazetteer match can start at a word with one of the given
+  // forms, which contain no uppercase letters, used by the candidate
+  // prefilter of bilou_ner. The processors matching lemmas also check the
+  // forms, because the lemmas are not known before tagging.
+  virtual bool may_start_match(const vector<string_piece>& forms) const;
+
+  // Approximate number of bytes used by the loaded processor
+  virtual size_t memory_usage() const;
+
+  // Count the lookups of the feature keys during recognition and how many of
+  // them were found, summed over all threads. Enabling resets the counts.
+  void count_lookups(bool enable);
+  void lookup_statistics(size_t& lookups, size_t& hits) const;
+
+  // Processors looking up whole words can use a vocabulary shared with other
+  // processors, so that every word is hashed only once per sentence. The
+  // vocabulary is built from add_to_vocabulary of all processors using it.
+  // The use_vocabulary fails if the vocabulary does not contain all the keys.
+  virtual int vocabulary() const;
+  void add_to_vocabulary(unordered_map<string, ner_feature>& vocabulary) const;
+  bool use_vocabulary(const frozen_map& vocabulary);
+
+  // The features added to the map during training, i.e., the ones starting
+  // at first_feature, can be pruned. Every added key has 2*window+1 features;
+  // the first feature and the number of features of every key are returned.
+  void added_features(ner_feature first_feature, vector<pair<ner_feature, unsigned>>& features) const;
+  // Renumber the added features, removing the keys mapped to ner_feature_unknown
+  void renumber_added_features(ner_feature first_feature, const vector<ner_feature>& renumbering);
+
+  // Move the keys of a loaded processor from the frozen map back to the map,
+  // so that further training can add new keys to it
+  void unfreeze();
+
+  // Processors looking up keys collected from the training data can instead
+  // hash the keys into the given number of buckets, every one with 2*window+1
+  // features allocated when the hashing is enabled. No keys are then stored.
+  virtual bool supports_feature_hashing() const;
+  void use_feature_hashing(unsigned buckets, ner_feature* total_features);
 
  protected:
   int window;
 
-  inline ner_feature lookup(const string& key, ner_feature* total_features) const {
-    auto it = map.find(key);
-    if (it == map.end() && total_features) {
-      it = map.emplace(key, window + *total_features).first;
+  inline ner_feature lookup_word(const ner_sentence& sentence, int vocabulary, unsigned word, ner_feature* total_features) const {
+    if (!total_features && !vocabulary_features.empty()) {
+      ner_feature id = sentence.vocabulary_ids[vocabulary][word];
+      ner_feature feature = id != ner_feature_unknown ? vocabulary_features[id] : ner_feature_unknown;
+      count_lookup(feature != ner_feature_unknown);
+      return feature;
+    }
+
+    return lookup(sentence.vocabulary_text(vocabulary, word), total_features);
+  }
+
+  inline ner_feature lookup(string_piece key, ner_feature* total_features) const {
+    if (hashed_buckets) return hashed_feature(frozen_map::hash(key));
+
+    if (!total_features) {
+      const ner_feature* feature = find_feature(key);
+      return feature ? *feature : ner_feature_unknown;
+    }
+
+    string key_string(key.str, key.len);
+    auto it = map.find(key_string);
+    if (it == map.end()) {
+      it = map.emplace(key_string, window + *total_features).first;
       *total_features += 2*window + 1;
     }
-    return it != map.end() ? it->second : ner_feature_unknown;
+    return it->second;
+  }
+
+  inline const ner_feature* find_feature(string_piece key) const {
+    if (!frozen.empty()) {
+      const ner_feature* feature = frozen.find(key);
+      count_lookup(feature);
+      return feature;
+    }
+
+    auto it = map.find(string(key.str, key.len));
+    count_lookup(it != map.end());
+    return it != map.end() ? &it->second : nullptr;
+  }
+
+  inline ner_feature hashed_feature(uint32_t key_hash) const {
+    count_lookup(true);
+    return hashed_first + window + key_hash % hashed_buckets * (2*window + 1);
   }
 
+  inline void count_lookup(bool found) const {
+    if (!counting_lookups) return;
+    lookups.fetch_add(1, memory_order_relaxed);
+    if (found) lookup_hits.fetch_add(1, memory_order_relaxed);
+  }
+
+  // The map is filled during parse and used during training. When a processor
+  // is loaded, the frozen map is used instead and the map stays empty.
   mutable unordered_map<string, ner_feature> map;
+  frozen_map frozen;
+
+  // When non-zero, the keys are hashed to features starting at hashed_first
+  unsigned hashed_buckets = 0;
+  ner_feature hashed_first = 0;
+  enum :uint32_t { hashed_features_marker = ~0U };
+
+  // Marker saved instead of the bucket count of the map by the in-place layout
+  enum :uint32_t { in_place_marker = ~0U };
+
+  // Values of the frozen map indexed by the shared vocabulary ids
+  vector<ner_feature> vocabulary_features;
+
+  // Lookup counts, see count_lookups
+  bool counting_lookups = false;
+  mutable atomic<size_t> lookups{0}, lookup_hits{0};
 
   // Factory method
  public:
@@ -8,7 +8,13 @@
 // file, You can obtain one at http://mozilla.org/MPL/2.0/.
 
 #include <algorithm>
+#include <cstdio>
 #include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <thread>
 #include <unordered_map>
 
 #include "feature_processor.h"
@@ -24,13 +30,13 @@ namespace nametag {
 // Helper functions defined as macros so that they can access arguments without passing them
 #define apply_in_window(I, Feature) apply_in_range(I, Feature, -window, window)
 
-#define apply_in_range(I, Feature, Left, Right) {                                                   \
-  ner_feature _feature = (Feature);                                                                 \
-  if (_feature != ner_feature_unknown)                                                              \
-    for (int _w = int(I) + (Left) < 0 ? 0 : int(I) + (Left),                                        \
-           _end = int(I) + (Right) + 1 < int(sentence.size) ? int(I) + (Right) + 1 : sentence.size; \
-         _w < _end; _w++)                                                                           \
-      sentence.features[_w].emplace_back(_feature + _w - int(I));                                   \
+#define apply_in_range(I, Feature, Left, Right) {                                                \
+  ner_feature _feature = (Feature);                                                              \
+  if (_feature != ner_feature_unknown) {                                                         \
+    int _start = int(I) + (Left) < 0 ? 0 : int(I) + (Left);                                      \
+    int _end = int(I) + (Right) + 1 < int(sentence.size) ? int(I) + (Right) + 1 : sentence.size; \
+    if (_start < _end) sentence.add_features(_start, _end, _feature + _start - int(I));          \
+  }                                                                                              \
 }
 
 #define apply_outer_words_in_window(Feature) {                   \
@@ -108,8 +114,8 @@ class brown_clusters : public feature_processor {
     }
   }
 
-  virtual void save(binary_encoder& enc) override {
-    feature_processor::save(enc);
+  virtual void save(binary_encoder& enc, bool in_place) override {
+    feature_processor::save(enc, in_place);
 
     enc.add_4B(clusters.size());
     for (auto&& cluster : clusters) {
@@ -121,15 +127,37 @@ class brown_clusters : public feature_processor {
 
   virtual void process_sentence(ner_sentence& sentence, ner_feature* /*total_features*/, string& /*buffer*/) const override {
     for (unsigned i = 0; i < sentence.size; i++) {
-      auto it = map.find(sentence.words[i].raw_lemma);
-      if (it != map.end()) {
-        auto& cluster = clusters[it->second];
+      ner_feature cluster_id = lookup_word(sentence, ner_sentence::VOCABULARY_RAW_LEMMA, i, nullptr);
+      if (cluster_id != ner_feature_unknown) {
+        auto& cluster = clusters[cluster_id];
         for (auto&& feature : cluster)
           apply_in_window(i, feature);
       }
     }
   }
 
+  virtual int vocabulary() const override {
+    return ner_sentence::VOCABULARY_RAW_LEMMA;
+  }
+
+  virtual unsigned word_attributes() const override {
+    return ner_word::RAW_LEMMA;
+  }
+
+  virtual unsigned word_features() const override {
+    size_t prefixes = 0;
+    for (auto&& cluster : clusters)
+      prefixes = max(prefixes, cluster.size());
+    return prefixes * (2*window + 1);
+  }
+
+  virtual size_t memory_usage() const override {
+    size_t bytes = feature_processor::memory_usage() + clusters.capacity() * sizeof(clusters[0]);
+    for (auto&& cluster : clusters)
+      bytes += cluster.capacity() * sizeof(ner_feature);
+    return bytes;
+  }
+
  private:
   vector<vector<ner_feature>> clusters;
 };
@@ -176,9 +204,18 @@ class czech_add_containers : public feature_processor {
     if (buffer.size() > entities.size()) entities = buffer;
   }
 
+  virtual void added_entity_types(vector<string>& types) const override {
+    types.push_back("P");
+    types.push_back("T");
+  }
+
   // CzechAddContainers used to be entity_processor which had empty load and save methods.
   virtual void load(binary_decoder& /*data*/, const nlp_pipeline& /*pipeline*/) override {}
-  virtual void save(binary_encoder& /*enc*/) override {}
+  virtual void save(binary_encoder& /*enc*/, bool /*in_place*/) override {}
+
+  virtual unsigned word_attributes() const override {
+    return 0;
+  }
 };
 
 
@@ -194,6 +231,10 @@ class czech_lemma_term : public feature_processor {
         }
     }
   }
+
+  virtual unsigned word_attributes() const override {
+    return ner_word::LEMMA_COMMENTS;
+  }
 };
 
 
@@ -202,57 +243,83 @@ class form : public feature_processor {
  public:
   virtual void process_sentence(ner_sentence& sentence, ner_feature* total_features, string& /*buffer*/) const override {
     for (unsigned i = 0; i < sentence.size; i++)
-      apply_in_window(i, lookup(sentence.words[i].form, total_features));
+      apply_in_window(i, lookup_word(sentence, ner_sentence::VOCABULARY_FORM, i, total_features));
 
     apply_outer_words_in_window(lookup_empty());
   }
+
+  virtual int vocabulary() const override {
+    return ner_sentence::VOCABULARY_FORM;
+  }
+
+  virtual unsigned word_attributes() const override {
+    return ner_word::FORM;
+  }
+
+  virtual bool supports_feature_hashing() const override {
+    return true;
+  }
 };
 
 
 // FormCapitalization
+enum { CAPITALIZATIONS = 3 };
+static const char* capitalization_keys[CAPITALIZATIONS] = {"f", "a", "m"};
 class form_capitalization : public feature_processor {
  public:
-  virtual void process_sentence(ner_sentence& sentence, ner_feature* total_features, string& buffer) const override {
-    using namespace unilib;
+  virtual void load(binary_decoder& data, const nlp_pipeline& pipeline) override {
+    feature_processor::load(data, pipeline);
 
-    ner_feature fst_cap = lookup(buffer.assign("f"), total_features);
-    ner_feature all_cap = lookup(buffer.assign("a"), total_features);
-    ner_feature mixed_cap = lookup(buffer.assign("m"), total_features);
+    for (unsigned i = 0; i < CAPITALIZATIONS; i++)
+      capitalization_features[i] = lookup(capitalization_keys[i], nullptr);
+  }
 
-    for (unsigned i = 0; i < sentence.size; i++) {
-      bool was_upper = false, was_lower = false;
+  virtual void process_sentence(ner_sentence& sentence, ner_feature* total_features, string& buffer) const override {
+    // The features of a loaded processor were resolved in load
+    ner_feature features[CAPITALIZATIONS];
+    for (unsigned i = 0; i < CAPITALIZATIONS; i++)
+      features[i] = total_features || frozen.empty() ? lookup(buffer.assign(capitalization_keys[i]), total_features) : capitalization_features[i];
+    ner_feature fst_cap = features[0], all_cap = features[1], mixed_cap = features[2];
 
-      auto* form = sentence.words[i].form.c_str();
-      char32_t chr;
-      for (bool first = true; (chr = utf8::decode(form)); first = false) {
-        auto category = unicode::category(chr);
-        was_upper = was_upper || category & unicode::Lut;
-        was_lower = was_lower || category & unicode::Ll;
+    auto& texts = sentence.texts(ner_sentence::TEXT_FORM);
+    for (unsigned i = 0; i < sentence.size; i++) {
+      unsigned capitalization = texts.capitalization[i];
+      bool was_upper = capitalization & ner_sentence::CAPITALIZATION_ANY_UPPER;
+      bool was_lower = capitalization & ner_sentence::CAPITALIZATION_ANY_LOWER;
 
-        if (first && was_upper) apply_in_window(i, fst_cap);
-      }
+      if (capitalization & ner_sentence::CAPITALIZATION_FIRST_UPPER) apply_in_window(i, fst_cap);
       if (was_upper && !was_lower) apply_in_window(i, all_cap);
       if (was_upper && was_lower) apply_in_window(i, mixed_cap);
     }
   }
+
+  virtual unsigned word_attributes() const override {
+    return ner_word::FORM;
+  }
+
+ private:
+  ner_feature capitalization_features[CAPITALIZATIONS];
 };
 
 
 // FormCaseNormalized
 class form_case_normalized : public feature_processor {
  public:
-  virtual void process_sentence(ner_sentence& sentence, ner_feature* total_features, string& buffer) const override {
-    using namespace unilib;
-
-    for (unsigned i = 0; i < sentence.size; i++) {
-      buffer.clear();
-      for (auto&& chr : utf8::decoder(sentence.words[i].form))
-        utf8::append(buffer, buffer.empty() ? chr : unicode::lowercase(chr));
-      apply_in_window(i, lookup(buffer, total_features));
-    }
+  virtual void process_sentence(ner_sentence& sentence, ner_feature* total_features, string& /*buffer*/) const override {
+    auto& texts = sentence.texts(ner_sentence::TEXT_FORM);
+    for (unsigned i = 0; i < sentence.size; i++)
+      apply_in_window(i, lookup(texts.case_normalized_text(i), total_features));
 
     apply_outer_words_in_window(lookup_empty());
   }
+
+  virtual unsigned word_attributes() const override {
+    return ner_word::FORM;
+  }
+
+  virtual bool supports_feature_hashing() const override {
+    return true;
+  }
 };
 
 
@@ -315,8 +382,8 @@ class gazetteers : public feature_processor {
     }
   }
 
-  virtual void save(binary_encoder& enc) override {
-    feature_processor::save(enc);
+  virtual void save(binary_encoder& enc, bool in_place) override {
+    feature_processor::save(enc, in_place);
 
     enc.add_4B(gazetteers_info.size());
     for (auto&& gazetteer : gazetteers_info) {
@@ -329,24 +396,24 @@ class gazetteers : public feature_processor {
 
   virtual void process_sentence(ner_sentence& sentence, ner_feature* /*total_features*/, string& buffer) const override {
     for (unsigned i = 0; i < sentence.size; i++) {
-      auto it = map.find(sentence.words[i].raw_lemma);
-      if (it == map.end()) continue;
+      auto* gazetteer = find_feature(sentence.words[i].raw_lemma);
+      if (!gazetteer) continue;
 
       // Apply regular gazetteer feature G + unigram gazetteer feature U
-      for (auto&& feature : gazetteers_info[it->second].features) {
+      for (auto&& feature : gazetteers_info[*gazetteer].features) {
         apply_in_window(i, feature + G * (2*window + 1));
         apply_in_window(i, feature + U * (2*window + 1));
       }
 
-      for (unsigned j = i + 1; gazetteers_info[it->second].prefix_of_longer && j < sentence.size; j++) {
+      for (unsigned j = i + 1; gazetteers_info[*gazetteer].prefix_of_longer && j < sentence.size; j++) {
         if (j == i + 1) buffer.assign(sentence.words[i].raw_lemma);
         buffer += ' ';
         buffer += sentence.words[j].raw_lemma;
-        it = map.find(buffer);
-        if (it == map.end()) break;
+        gazetteer = find_feature(buffer);
+        if (!gazetteer) break;
 
         // Apply regular gazetteer feature G + position specific gazetteers B, I, L
-        for (auto&& feature : gazetteers_info[it->second].features)
+        for (auto&& feature : gazetteers_info[*gazetteer].features)
           for (unsigned g = i; g <= j; g++) {
             apply_in_window(g, feature + G * (2*window + 1));
             apply_in_window(g, feature + (g == i ? B : g == j ? L : I) * (2*window + 1));
@@ -355,6 +422,24 @@ class gazetteers : public feature_processor {
     }
   }
 
+  virtual bool may_start_match(const vector<string_piece>& forms) const override {
+    for (auto&& form : forms)
+      if (find_feature(form))
+        return true;
+    return false;
+  }
+
+  virtual unsigned word_attributes() const override {
+    return ner_word::RAW_LEMMA;
+  }
+
+  virtual size_t memory_usage() const override {
+    size_t bytes = feature_processor::memory_usage() + gazetteers_info.capacity() * sizeof(gazetteer_info);
+    for (auto&& info : gazetteers_info)
+      bytes += info.features.capacity() * sizeof(ner_feature);
+    return bytes;
+  }
+
  private:
   struct gazetteer_info {
     vector<ner_feature> features;
@@ -399,7 +484,8 @@ class gazetteers_enhanced : public feature_processor {
     for (entity_type i = 0; i < entities.size(); i++)
       entity_list.push_back(entities.name(i));
 
-    if (!load_gazetteer_lists(pipeline, embed == EMBED_IN_MODEL)) return false;
+    if (embed == EMBED_IN_MODEL && !read_gazetteer_lists(true, gazetteer_lists)) return false;
+    if (!build_gazetteers(pipeline, embed == OUT_OF_MODEL, false)) return false;
 
     return true;
   }
@@ -431,11 +517,18 @@ class gazetteers_enhanced : public feature_processor {
     for (auto&& entity : entity_list)
       data.next_str(entity);
 
-    load_gazetteer_lists(pipeline, false);
+    build_gazetteers(pipeline, true, embed == OUT_OF_MODEL);
+  }
+
+  virtual bool reload_gazetteers(const nlp_pipeline& pipeline) override {
+    if (embed != OUT_OF_MODEL) return true;
+
+    lock_guard<mutex> lock(gazetteers_reload_mutex);
+    return build_gazetteers(pipeline, true, true);
   }
 
-  virtual void save(binary_encoder& enc) override {
-    feature_processor::save(enc);
+  virtual void save(binary_encoder& enc, bool in_place) override {
+    feature_processor::save(enc, in_place);
 
     enc.add_4B(match);
 
@@ -446,18 +539,16 @@ class gazetteers_enhanced : public feature_processor {
       enc.add_4B(gazetteer_meta.entity);
     }
 
-    if (embed == EMBED_IN_MODEL) {
-      enc.add_4B(gazetteer_lists.size());
-      for (auto&& gazetteer_list : gazetteer_lists) {
-        enc.add_4B(gazetteer_list.gazetteers.size());
-        for (auto&& gazetteer : gazetteer_list.gazetteers)
-          enc.add_str(gazetteer);
-        enc.add_4B(gazetteer_list.feature);
-        enc.add_4B(gazetteer_list.entity);
-        enc.add_4B(gazetteer_list.mode);
-      }
-    } else {
-      enc.add_4B(0);
+    // The gazetteer_lists contain only the embedded gazetteers, also when
+    // a loaded processor is saved again
+    enc.add_4B(gazetteer_lists.size());
+    for (auto&& gazetteer_list : gazetteer_lists) {
+      enc.add_4B(gazetteer_list.gazetteers.size());
+      for (auto&& gazetteer : gazetteer_list.gazetteers)
+        enc.add_str(gazetteer);
+      enc.add_4B(gazetteer_list.feature);
+      enc.add_4B(gazetteer_list.entity);
+      enc.add_4B(gazetteer_list.mode);
     }
 
     enc.add_4B(entity_list.size());
@@ -466,38 +557,35 @@ class gazetteers_enhanced : public feature_processor {
   }
 
   virtual void process_sentence(ner_sentence& sentence, ner_feature* /*total_features*/, string& /*buffer*/) const override {
-    vector<unsigned> nodes, new_nodes;
-    vector<vector<ner_feature>> features(sentence.size);
-
-    vector<vector<string>> recased_match_sources(sentence.size);
+    auto& nodes = sentence.gazetteers_buffers.nodes;
+    auto& new_nodes = sentence.gazetteers_buffers.new_nodes;
+    auto& features = sentence.gazetteers_buffers.features;
+    if (features.size() < sentence.size) features.resize(sentence.size);
     for (unsigned i = 0; i < sentence.size; i++)
-      recase_match_source(sentence.words[i], RECASE_ANY, recased_match_sources[i]);
+      features[i].clear();
+
+    auto active = atomic_load(&gazetteers_active);
+    auto& match_tokens = sentence.gazetteers_buffers.match_tokens;
+    compute_match_tokens(*active, sentence, match_tokens);
 
     for (unsigned i = 0; i < sentence.size; i++) {
       unsigned hard_pre_length = 0, hard_pre_node = -1;
       bool hard_pre_possible = true;
       nodes.assign(1, 0);
-      for (unsigned j = i; j < sentence.size && !nodes.empty(); j++) {
-        new_nodes.clear();
-        for (auto&& node : nodes)
-          if (!gazetteers_trie[node].children.empty())
-            for (auto&& match_source : recased_match_sources[j]) {
-              auto range = gazetteers_trie[node].children.equal_range(match_source);
-              for (auto&& it = range.first; it != range.second; it++)
-                append_unless_exists(new_nodes, it->second);
-            }
+      for (unsigned j = i; j < sentence.size && j - i < active->max_length && !nodes.empty(); j++) {
+        extend_frontier(*active, match_tokens[j], sentence.gazetteers_buffers);
 
         hard_pre_possible = hard_pre_possible && !sentence.probabilities[j].local_filled;
         if (hard_pre_possible)
           for (auto&& node : new_nodes)
-            if (gazetteers_trie[node].mode == HARD_PRE &&
+            if (active->trie[node].mode == HARD_PRE &&
                 ((j - i + 1) > hard_pre_length || node < hard_pre_node))
               hard_pre_length = j - i + 1, hard_pre_node = node;
 
         // Fill features
         for (auto&& node : new_nodes)
-          for (auto&& feature : gazetteers_trie[node].features)
-            for (unsigned k = i; k <= j; k++) {
+          for (unsigned f = active->trie[node].features; f < active->trie[node + 1].features; f++)
+            for (unsigned k = i, feature = active->trie_features[f]; k <= j; k++) {
               bilou_type type = j == i ? bilou_type_U : k == i ? bilou_type_B : k == j ? bilou_type_L : bilou_type_I;
               append_unless_exists(features[k], feature + G * (2 * window + 1));
               append_unless_exists(features[k], feature + type * (2 * window + 1));
@@ -515,7 +603,7 @@ class gazetteers_enhanced : public feature_processor {
           bilou_type type = hard_pre_length == 1 ? bilou_type_U :
               j == i ? bilou_type_B : j + 1 == i + hard_pre_length ? bilou_type_L : bilou_type_I;
           sentence.probabilities[j].local.bilou[type].probability = 1.;
-          sentence.probabilities[j].local.bilou[type].entity = gazetteers_trie[hard_pre_node].entity;
+          sentence.probabilities[j].local.bilou[type].entity = active->trie[hard_pre_node].entity;
           sentence.probabilities[j].local_filled = true;
         }
     }
@@ -527,11 +615,12 @@ class gazetteers_enhanced : public feature_processor {
   }
 
   virtual void process_entities(ner_sentence& sentence, vector<named_entity>& entities, vector<named_entity>& buffer) const override {
-    vector<unsigned> nodes, new_nodes;
+    auto& nodes = sentence.gazetteers_buffers.nodes;
+    auto& new_nodes = sentence.gazetteers_buffers.new_nodes;
 
-    vector<vector<string>> recased_match_sources(sentence.size);
-    for (unsigned i = 0; i < sentence.size; i++)
-      recase_match_source(sentence.words[i], RECASE_ANY, recased_match_sources[i]);
+    auto active = atomic_load(&gazetteers_active);
+    auto& match_tokens = sentence.gazetteers_buffers.match_tokens;
+    compute_match_tokens(*active, sentence, match_tokens);
 
     buffer.clear();
     unsigned entity_until = 0;
@@ -548,18 +637,11 @@ class gazetteers_enhanced : public feature_processor {
 
         unsigned hard_post_length = 0, hard_post_node = -1;
         nodes.assign(1, 0);
-        for (unsigned j = i; j < free_until && !nodes.empty(); j++) {
-          new_nodes.clear();
-          for (auto&& node : nodes)
-            if (!gazetteers_trie[node].children.empty())
-              for (auto&& match_source : recased_match_sources[j]) {
-                auto range = gazetteers_trie[node].children.equal_range(match_source);
-                for (auto&& it = range.first; it != range.second; it++)
-                  append_unless_exists(new_nodes, it->second);
-              }
+        for (unsigned j = i; j < free_until && j - i < active->max_length && !nodes.empty(); j++) {
+          extend_frontier(*active, match_tokens[j], sentence.gazetteers_buffers);
 
           for (auto&& node : new_nodes)
-            if (gazetteers_trie[node].mode == HARD_POST &&
+            if (active->trie[node].mode == HARD_POST &&
                 ((j - i + 1) > hard_post_length || node < hard_post_node))
               hard_post_length = j - i + 1, hard_post_node = node;
 
@@ -567,7 +649,7 @@ class gazetteers_enhanced : public feature_processor {
         }
 
         if (hard_post_length) {
-          buffer.emplace_back(i, hard_post_length, entity_list[gazetteers_trie[hard_post_node].entity]);
+          buffer.emplace_back(i, hard_post_length, entity_list[active->trie[hard_post_node].entity]);
           entity_until = i + hard_post_length;
         }
       }
@@ -577,14 +659,60 @@ class gazetteers_enhanced : public feature_processor {
       entities.swap(buffer);
   }
 
+  virtual void added_entity_types(vector<string>& types) const override {
+    // Only the HARD_POST gazetteers add entities
+    auto active = atomic_load(&gazetteers_active);
+    for (auto&& gazetteer_list : active->lists)
+      if (gazetteer_list.mode == HARD_POST && gazetteer_list.entity >= 0 && !gazetteer_list.gazetteers.empty())
+        types.push_back(entity_list[gazetteer_list.entity]);
+  }
+
   virtual void gazetteers(vector<string>& gazetteers, vector<int>* gazetteer_types) const override {
-    for (auto&& gazetteer_list : gazetteer_lists)
+    auto active = atomic_load(&gazetteers_active);
+    for (auto&& gazetteer_list : active->lists)
       for (auto&& gazetteer : gazetteer_list.gazetteers) {
         gazetteers.push_back(gazetteer);
         if (gazetteer_types) gazetteer_types->push_back(gazetteer_list.entity);
       }
   }
 
+  virtual bool may_start_match(const vector<string_piece>& forms) const override {
+    // The forms without uppercase letters are their only recased match source
+    auto active = atomic_load(&gazetteers_active);
+    if (!active || active->trie.size() < 2) return false;
+    auto first = active->trie_children.begin() + active->trie[0].children;
+    auto last = active->trie_children.begin() + active->trie[1].children;
+    for (auto&& form : forms) {
+      auto* token = active->tokens.find(form);
+      if (!token) continue;
+
+      auto it = lower_bound(first, last, *token, [](const gazetteer_trie_child& child, unsigned token) { return child.token < token; });
+      if (it != last && it->token == *token) return true;
+    }
+    return false;
+  }
+
+  virtual unsigned word_attributes() const override {
+    // The form is always used to determine the capitalization of the matches
+    return ner_word::FORM | (match == MATCH_RAWLEMMA ? ner_word::RAW_LEMMA : match == MATCH_RAWLEMMAS ? ner_word::RAW_LEMMAS_ALL : 0);
+  }
+
+  virtual size_t memory_usage() const override {
+    auto active = atomic_load(&gazetteers_active);
+    size_t bytes = feature_processor::memory_usage();
+    if (active) {
+      bytes += active->lists.capacity() * sizeof(gazetteer_list_info);
+      for (auto&& list : active->lists) {
+        bytes += list.gazetteers.capacity() * sizeof(string);
+        for (auto&& gazetteer : list.gazetteers)
+          bytes += gazetteer.capacity();
+      }
+      bytes += active->trie.capacity() * sizeof(gazetteer_trie_node) + active->trie_children.capacity() * sizeof(gazetteer_trie_child)
+          + active->trie_features.capacity() * sizeof(ner_feature) + active->tokens.memory_usage();
+    }
+    return bytes;
+  }
+
  private:
   enum { MATCH_FORM = 0, MATCH_RAWLEMMA = 1, MATCH_RAWLEMMAS = 2 };
   int match;
@@ -608,14 +736,35 @@ class gazetteers_enhanced : public feature_processor {
     int entity;
     int mode;
   };
-  vector<gazetteer_list_info> gazetteer_lists;
+  vector<gazetteer_list_info> gazetteer_lists; // Embedded in the model
 
   struct gazetteer_trie_node {
-    vector<ner_feature> features;
-    unordered_multimap<string, unsigned> children;
+    unsigned children = 0, features = 0;
     int mode = SOFT, entity = -1;
   };
-  vector<gazetteer_trie_node> gazetteers_trie;
+  struct gazetteer_trie_child {
+    unsigned token, node;
+  };
+
+  // All gazetteers in use, together with their trie. The children and
+  // features of all trie nodes are stored contiguously, node n using the
+  // ranges from its offsets to the offsets of node n+1 (the last node is
+  // a sentinel). The children are labeled by tokens, which are the recased
+  // match sources, and are sorted by them.
+  //
+  // The gazetteers can be replaced by reload_gazetteers during recognition,
+  // so they are always accessed using atomic_load and every call uses
+  // a single version.
+  struct gazetteers_info {
+    vector<gazetteer_list_info> lists;
+    vector<gazetteer_trie_node> trie;
+    vector<gazetteer_trie_child> trie_children;
+    vector<ner_feature> trie_features;
+    frozen_map tokens;
+    unsigned max_length = 0; // The maximum number of tokens of a gazetteer
+  };
+  shared_ptr<const gazetteers_info> gazetteers_active;
+  mutex gazetteers_reload_mutex;
 
   vector<string> entity_list;
 
@@ -630,10 +779,101 @@ class gazetteers_enhanced : public feature_processor {
       array.push_back(value);
   }
 
-  bool load_gazetteer_lists(const nlp_pipeline& pipeline, bool files_must_exist) {
+  // Fill the new_nodes by the distinct children of the nodes labeled by any
+  // of the given tokens, in the order of their first occurrence. The nodes
+  // are deduplicated using the marks instead of searching the new_nodes, and
+  // at most MAX_FRONTIER of them are kept, so that the work of every step
+  // is bounded also on adversarial input of many repeated tokens. The nodes
+  // above the cap are dropped, together with the matches through them.
+  enum { MAX_FRONTIER = 1024 };
+  static void extend_frontier(const gazetteers_info& info, const vector<unsigned>& tokens, ner_sentence::gazetteers_buffers_info& buffers) {
+    auto& marks = buffers.marks;
+    if (marks.size() < info.trie.size() || !++buffers.step)
+      marks.assign(max(marks.size(), info.trie.size()), 0), buffers.step = 1;
+
+    buffers.new_nodes.clear();
+    for (auto&& node : buffers.nodes) {
+      auto first = info.trie_children.begin() + info.trie[node].children;
+      auto last = info.trie_children.begin() + info.trie[node + 1].children;
+      if (first == last) continue;
+
+      for (auto&& token : tokens)
+        for (auto it = lower_bound(first, last, token, [](const gazetteer_trie_child& child, unsigned token) { return child.token < token; });
+             it != last && it->token == token; it++)
+          if (marks[it->node] != buffers.step) {
+            if (buffers.new_nodes.size() >= MAX_FRONTIER) return;
+            marks[it->node] = buffers.step;
+            buffers.new_nodes.push_back(it->node);
+          }
+    }
+  }
+
+  // Compute the length of the longest gazetteer, which is the depth of the
+  // trie; the children of a node always have larger indices than the node.
+  static void compute_max_length(gazetteers_info& info) {
+    vector<unsigned> depths(info.trie.size(), 0);
+    info.max_length = 0;
+    for (unsigned node = 0; node + 1 < info.trie.size(); node++)
+      for (unsigned child = info.trie[node].children; child < info.trie[node + 1].children; child++) {
+        unsigned& depth = depths[info.trie_children[child].node];
+        depth = depths[node] + 1;
+        info.max_length = max(info.max_length, depth);
+      }
+  }
+
+  void compute_match_tokens(const gazetteers_info& info, ner_sentence& sentence, vector<vector<unsigned>>& match_tokens) const {
+    if (sentence.recased_match_sources.size() <= unsigned(match)) sentence.recased_match_sources.resize(match + 1);
+    auto& recased_match_sources = sentence.recased_match_sources[match];
+    if (!recased_match_sources.filled) {
+      recased_match_sources.arena.clear();
+      recased_match_sources.sources.clear();
+      recased_match_sources.words.assign(1, 0);
+      for (unsigned i = 0; i < sentence.size; i++) {
+        recase_match_source(sentence, i, RECASE_ANY, recased_match_sources.arena, recased_match_sources.sources);
+        recased_match_sources.words.push_back(recased_match_sources.sources.size());
+      }
+      recased_match_sources.filled = true;
+    }
+
+    if (match_tokens.size() < sentence.size) match_tokens.resize(sentence.size);
+    for (unsigned i = 0; i < sentence.size; i++) {
+      match_tokens[i].clear();
+      for (unsigned j = recased_match_sources.words[i]; j < recased_match_sources.words[i + 1]; j++) {
+        auto* token = info.tokens.find(recased_match_sources.source(j));
+        count_lookup(token);
+        if (token) match_tokens[i].push_back(*token);
+      }
+    }
+  }
+
+  // Run body(tokenizer, begin, step) for begin in [0, threads), with step being
+  // the number of threads, so that all indices in [0, size) are processed.
+  // Additional threads are used only if the pipeline can create tokenizers.
+  static void parallel_for(unsigned size, const nlp_pipeline& pipeline,
+                           const function<void(ufal::nametag::tokenizer&, unsigned, unsigned)>& body) {
+    unsigned threads_count = pipeline.new_tokenizer ? min(max(thread::hardware_concurrency(), 1U), max(size / 1024, 1U)) : 1;
+
+    vector<unique_ptr<ufal::nametag::tokenizer>> tokenizers;
+    vector<thread> threads;
+    for (unsigned i = 1; i < threads_count; i++) {
+      tokenizers.emplace_back(pipeline.new_tokenizer());
+      try {
+        threads.emplace_back(body, ref(*tokenizers.back()), i, threads_count);
+      } catch (system_error&) {
+        body(*tokenizers.back(), i, threads_count);
+      }
+    }
+
+    body(*pipeline.tokenizer, 0, threads_count);
+    for (auto&& thread : threads)
+      thread.join();
+  }
+
+  // Read the gazetteer lists from files. If requested, the basename of the
+  // first list read is stored in first_basename.
+  bool read_gazetteer_lists(bool files_must_exist, vector<gazetteer_list_info>& lists, string* first_basename = nullptr) const {
     string file_name, line;
 
-    // Load raw gazetteers (maybe additional during inference)
     for (auto&& gazetteer_meta : gazetteer_metas)
       for (int mode = 0; mode < MODES_TOTAL; mode++) {
         file_name.assign(gazetteer_meta.basename).append(basename_suffixes[mode]);
@@ -645,47 +885,128 @@ class gazetteers_enhanced : public feature_processor {
           continue;
         }
 
-        gazetteer_lists.emplace_back();
-        gazetteer_lists.back().feature = gazetteer_meta.feature;
-        gazetteer_lists.back().entity = gazetteer_meta.entity;
-        gazetteer_lists.back().mode = mode;
+        if (first_basename && first_basename->empty())
+          first_basename->assign(gazetteer_meta.basename);
+
+        lists.emplace_back();
+        lists.back().feature = gazetteer_meta.feature;
+        lists.back().entity = gazetteer_meta.entity;
+        lists.back().mode = mode;
 
         while (getline(file, line))
           if (!line.empty() && line[0] != '#')
-            gazetteer_lists.back().gazetteers.push_back(line);
+            lists.back().gazetteers.push_back(line);
       }
 
-    // Build the gazetteers_trie
-    unordered_map<string, int> gazetteer_prefixes;
-    vector<string_piece> gazetteer_tokens, gazetteer_tokens_additional, gazetteer_token(1);
-    ner_sentence gazetteer_token_tagged;
-    vector<string> gazetteer_recased_match_sources;
+    return true;
+  }
 
-    gazetteers_trie.clear();
-    gazetteers_trie.emplace_back();
-    for (auto&& gazetteer_list : gazetteer_lists)
-      for (auto&& gazetteer : gazetteer_list.gazetteers) {
-        pipeline.tokenizer->set_text(gazetteer);
-        if (!pipeline.tokenizer->next_sentence(&gazetteer_tokens, nullptr)) continue;
-        while (pipeline.tokenizer->next_sentence(&gazetteer_tokens_additional, nullptr))
-          gazetteer_tokens.insert(gazetteer_tokens.end(), gazetteer_tokens_additional.begin(), gazetteer_tokens_additional.end());
+  // Build new gazetteers from the embedded ones and optionally from the
+  // gazetteer files, and make them active.
+  bool build_gazetteers(const nlp_pipeline& pipeline, bool read_files, bool use_cache) {
+    auto info = make_shared<gazetteers_info>();
+    info->lists = gazetteer_lists;
+    string first_basename;
+    if (read_files && !read_gazetteer_lists(false, info->lists, &first_basename)) return false;
+
+    // Use the compiled cache of the gazetteers trie if it is up to date. The
+    // cache is located next to the first gazetteer list read, and it is
+    // written only when the pipeline allows it.
+    string cache_file;
+    uint64_t cache_key = 0;
+    if (use_cache && !first_basename.empty()) {
+      cache_file.assign(first_basename).append(cache_suffix);
+      cache_key = gazetteer_lists_key(pipeline, info->lists);
+    }
+
+    if (cache_file.empty() || !load_trie_cache(cache_file, cache_key, *info)) {
+      unordered_map<string, ner_feature> tokens;
+      build_trie(pipeline, *info, tokens);
+      if (!cache_file.empty() && pipeline.write_caches) save_trie_cache(cache_file, cache_key, *info, tokens);
+    }
+    compute_max_length(*info);
+
+    atomic_store(&gazetteers_active, shared_ptr<const gazetteers_info>(info));
+    return true;
+  }
+
+  void build_trie(const nlp_pipeline& pipeline, gazetteers_info& info, unordered_map<string, ner_feature>& tokens) const {
+    // Tokenize all gazetteers, in parallel if possible
+    vector<const string*> gazetteers;
+    for (auto&& gazetteer_list : info.lists)
+      for (auto&& gazetteer : gazetteer_list.gazetteers)
+        gazetteers.push_back(&gazetteer);
+
+    vector<vector<string>> gazetteers_tokens_all(gazetteers.size());
+    parallel_for(gazetteers.size(), pipeline, [&](ufal::nametag::tokenizer& tokenizer, unsigned begin, unsigned step) {
+      vector<string_piece> gazetteer_tokens;
+      for (unsigned i = begin; i < gazetteers.size(); i += step) {
+        tokenizer.set_text(*gazetteers[i]);
+        while (tokenizer.next_sentence(&gazetteer_tokens, nullptr))
+          for (auto&& token : gazetteer_tokens)
+            gazetteers_tokens_all[i].emplace_back(token.str, token.len);
+      }
+    });
+
+    // Tag and recase every distinct token once, in parallel if possible
+    unordered_map<string, unsigned> distinct_tokens;
+    vector<const string*> distinct_tokens_list;
+    for (auto&& gazetteer_tokens : gazetteers_tokens_all)
+      for (auto&& token : gazetteer_tokens)
+        if (distinct_tokens.emplace(token, distinct_tokens_list.size()).second)
+          distinct_tokens_list.push_back(&token);
+
+    vector<vector<string>> distinct_tokens_recased(distinct_tokens_list.size());
+    parallel_for(distinct_tokens_list.size(), pipeline, [&](ufal::nametag::tokenizer& /*tokenizer*/, unsigned begin, unsigned step) {
+      vector<string_piece> gazetteer_token(1);
+      ner_sentence gazetteer_token_tagged;
+      string recased;
+      vector<unsigned> recased_ends;
+      for (unsigned i = begin; i < distinct_tokens_list.size(); i += step) {
+        gazetteer_token[0] = *distinct_tokens_list[i];
+        pipeline.tagger->tag(gazetteer_token, gazetteer_token_tagged);
+        recased.clear();
+        recased_ends.clear();
+        recase_match_source(gazetteer_token_tagged, 0, RECASE_NATIVE, recased, recased_ends);
+        for (unsigned j = 0, start = 0; j < recased_ends.size(); start = recased_ends[j++])
+          distinct_tokens_recased[i].emplace_back(recased, start, recased_ends[j] - start);
+      }
+    });
+
+    // Build the trie sequentially, so that the node numbering does not
+    // depend on the parallelization, and collect the children as
+    // (parent, token, child) triples
+    unordered_map<string, int> gazetteer_prefixes;
+    tokens.clear();
+    struct trie_edge { unsigned parent, token, child; };
+    vector<trie_edge> edges;
+    vector<vector<ner_feature>> nodes_features(1);
+
+    auto& trie = info.trie;
+    trie.clear();
+    trie.emplace_back();
+    for (unsigned list = 0, gazetteer = 0; list < info.lists.size(); list++)
+      for (unsigned list_gazetteer = 0; list_gazetteer < info.lists[list].gazetteers.size(); list_gazetteer++, gazetteer++) {
+        auto& gazetteer_list = info.lists[list];
+        auto& gazetteer_tokens = gazetteers_tokens_all[gazetteer];
+        if (gazetteer_tokens.empty()) continue;
 
         unsigned node = 0;
         string prefix;
         for (unsigned token = 0; token < gazetteer_tokens.size(); token++) {
           if (token) prefix.push_back('\t');
-          prefix.append(gazetteer_tokens[token].str, gazetteer_tokens[token].len);
+          prefix.append(gazetteer_tokens[token]);
           auto prefix_it = gazetteer_prefixes.find(prefix);
           if (prefix_it == gazetteer_prefixes.end()) {
-            unsigned new_node = gazetteers_trie.size();
-            gazetteers_trie.emplace_back();
+            unsigned new_node = trie.size();
+            trie.emplace_back();
+            nodes_features.emplace_back();
             gazetteer_prefixes.emplace(prefix, new_node);
 
-            gazetteer_token[0] = string_piece(gazetteer_tokens[token]);
-            pipeline.tagger->tag(gazetteer_token, gazetteer_token_tagged);
-            recase_match_source(gazetteer_token_tagged.words[0], RECASE_NATIVE, gazetteer_recased_match_sources);
-            for (auto&& match_source : gazetteer_recased_match_sources)
-              gazetteers_trie[node].children.emplace(match_source, new_node);
+            for (auto&& match_source : distinct_tokens_recased[distinct_tokens[gazetteer_tokens[token]]]) {
+              unsigned match_token = tokens.emplace(match_source, tokens.size()).first->second;
+              edges.push_back({node, match_token, new_node});
+            }
 
             node = new_node;
           } else {
@@ -693,44 +1014,162 @@ class gazetteers_enhanced : public feature_processor {
           }
         }
 
-        append_unless_exists(gazetteers_trie[node].features, gazetteer_list.feature);
-        if ((gazetteer_list.mode == HARD_PRE && gazetteers_trie[node].mode != HARD_PRE) ||
-            (gazetteer_list.mode == HARD_POST && gazetteers_trie[node].mode == SOFT)) {
-          gazetteers_trie[node].mode = gazetteer_list.mode;
-          gazetteers_trie[node].entity = gazetteer_list.entity;
+        append_unless_exists(nodes_features[node], gazetteer_list.feature);
+        if ((gazetteer_list.mode == HARD_PRE && trie[node].mode != HARD_PRE) ||
+            (gazetteer_list.mode == HARD_POST && trie[node].mode == SOFT)) {
+          trie[node].mode = gazetteer_list.mode;
+          trie[node].entity = gazetteer_list.entity;
         }
       }
 
-    return true;
+    // Store the children and features of all nodes contiguously
+    stable_sort(edges.begin(), edges.end(), [](const trie_edge& a, const trie_edge& b) {
+      return a.parent < b.parent || (a.parent == b.parent && a.token < b.token);
+    });
+
+    info.trie_children.clear();
+    info.trie_children.reserve(edges.size());
+    info.trie_features.clear();
+    for (unsigned node = 0, edge = 0; node < trie.size(); node++) {
+      trie[node].children = info.trie_children.size();
+      for (; edge < edges.size() && edges[edge].parent == node; edge++)
+        info.trie_children.push_back({edges[edge].token, edges[edge].child});
+
+      trie[node].features = info.trie_features.size();
+      info.trie_features.insert(info.trie_features.end(), nodes_features[node].begin(), nodes_features[node].end());
+    }
+    trie.emplace_back();
+    trie.back().children = info.trie_children.size();
+    trie.back().features = info.trie_features.size();
+
+    info.tokens.build(tokens);
   }
 
-  enum { TO_LOWER, TO_TITLE, TO_UPPER, TO_TOTAL };
-  static void recase_text(const string& text, int mode, vector<string>& recased) {
-    using namespace unilib;
+  // The compiled cache of the gazetteers trie is stored next to the gazetteer
+  // lists, using native byte order. It is identified by a hash of the match
+  // mode, the tagger and the content of all gazetteer lists.
+  static constexpr const char* cache_suffix = ".ntgz";
+  enum { CACHE_VERSION = 1 };
+
+  uint64_t gazetteer_lists_key(const nlp_pipeline& pipeline, const vector<gazetteer_list_info>& lists) const {
+    uint64_t hash = 14695981039346656037ULL;
+    auto add = [&hash](const void* data, size_t len) {
+      for (size_t i = 0; i < len; i++)
+        hash = (hash ^ ((const unsigned char*)data)[i]) * 1099511628211ULL;
+    };
+    auto add_value = [&add](uint64_t value) { add(&value, sizeof(value)); };
+
+    add_value(CACHE_VERSION);
+    add_value(match);
+    add_value(pipeline.tagger->identity());
+    add_value(lists.size());
+    for (auto&& gazetteer_list : lists) {
+      add_value(gazetteer_list.feature);
+      add_value(gazetteer_list.entity);
+      add_value(gazetteer_list.mode);
+      add_value(gazetteer_list.gazetteers.size());
+      for (auto&& gazetteer : gazetteer_list.gazetteers) {
+        add_value(gazetteer.size());
+        add(gazetteer.data(), gazetteer.size());
+      }
+    }
+    return hash;
+  }
+
+  static bool load_trie_cache(const string& file_name, uint64_t key, gazetteers_info& info) {
+    ifstream is(file_name, ifstream::in | ifstream::binary | ifstream::ate);
+    if (!is.is_open()) return false;
 
-    recased.emplace_back();
+    binary_decoder data;
+    streamoff size = is.tellg();
+    if (size < 0 || !is.seekg(0, ifstream::beg)) return false;
+    if (!is.read((char*) data.fill(size), size)) return false;
 
-    if (mode == TO_UPPER)
-      utf8::map(unicode::uppercase, text, recased.back());
-    else if (mode == TO_LOWER)
-      utf8::map(unicode::lowercase, text, recased.back());
-    else if (mode == TO_TITLE)
-      for (auto&& chr : utf8::decoder(text))
-        utf8::append(recased.back(), recased.back().empty() ? unicode::uppercase(chr) : unicode::lowercase(chr));
+    unordered_map<string, ner_feature> tokens;
+    try {
+      if (data.next_4B() != CACHE_VERSION) return false;
+      if (*data.next<uint64_t>(1) != key) return false;
+
+      unsigned nodes = data.next_4B();
+      auto nodes_data = data.next<gazetteer_trie_node>(nodes);
+      info.trie.assign(nodes_data, nodes_data + nodes);
+
+      unsigned children = data.next_4B();
+      auto children_data = data.next<gazetteer_trie_child>(children);
+      info.trie_children.assign(children_data, children_data + children);
+
+      unsigned features = data.next_4B();
+      auto features_data = data.next<ner_feature>(features);
+      info.trie_features.assign(features_data, features_data + features);
+
+      string token;
+      for (unsigned i = data.next_4B(), id = 0; id < i; id++) {
+        data.next_str(token);
+        tokens.emplace(token, id);
+      }
+      if (!data.is_end()) return false;
+    } catch (binary_decoder_error&) {
+      return false;
+    }
+
+    info.tokens.build(tokens);
+    return true;
   }
 
-  enum { RECASE_NATIVE, RECASE_ANY };
-  void recase_match_source(const ner_word& word, int mode, vector<string>& recased) const {
+  static void save_trie_cache(const string& file_name, uint64_t key, const gazetteers_info& info, const unordered_map<string, ner_feature>& tokens) {
+    vector<const string*> tokens_list(tokens.size());
+    for (auto&& token : tokens)
+      tokens_list[token.second] = &token.first;
+
+    binary_encoder enc;
+    enc.add_4B(CACHE_VERSION);
+    enc.add_data(&key, 1);
+    enc.add_4B(info.trie.size());
+    enc.add_data(info.trie);
+    enc.add_4B(info.trie_children.size());
+    enc.add_data(info.trie_children);
+    enc.add_4B(info.trie_features.size());
+    enc.add_data(info.trie_features);
+    enc.add_4B(tokens_list.size());
+    for (auto&& token : tokens_list)
+      enc.add_str(*token);
+
+    // Write the cache to a temporary file and rename it, so that concurrently
+    // starting processes never read a partially written cache. Failures are
+    // ignored, the cache is then just rebuilt next time.
+    string tmp_file_name = file_name + ".tmp";
+    {
+      ofstream os(tmp_file_name, ofstream::out | ofstream::binary);
+      if (!os.is_open()) return;
+      if (!os.write((const char*) enc.data.data(), enc.data.size()) || !os.flush()) {
+        os.close();
+        remove(tmp_file_name.c_str());
+        return;
+      }
+    }
+    if (rename(tmp_file_name.c_str(), file_name.c_str()) != 0)
+      remove(tmp_file_name.c_str());
+  }
+
+  enum { TO_LOWER, TO_TITLE, TO_UPPER, TO_TOTAL };
+  // Append the recased text to the arena and its end offset to the ends
+  static void recase_text(const string& text, int mode, string& arena, vector<unsigned>& ends) {
     using namespace unilib;
 
-    bool any_lower = false, first_uc = false, first = true;
-    for (auto&& chr : utf8::decoder(word.form)) {
-      any_lower = any_lower || (unicode::category(chr) & unicode::Ll);
-      if (first) first_uc = unicode::category(chr) & unicode::Lut;
-      first = false;
-    }
+    size_t start = arena.size();
+    for (auto&& chr : utf8::decoder(text))
+      utf8::append(arena, mode == TO_UPPER ? unicode::uppercase(chr) :
+                          mode == TO_LOWER ? unicode::lowercase(chr) :
+                          arena.size() == start ? unicode::uppercase(chr) : unicode::lowercase(chr));
+    ends.push_back(arena.size());
+  }
 
-    recased.clear();
+  enum { RECASE_NATIVE, RECASE_ANY };
+  void recase_match_source(ner_sentence& sentence, unsigned i, int mode, string& arena, vector<unsigned>& ends) const {
+    const ner_word& word = sentence.words[i];
+    unsigned capitalization = sentence.texts(ner_sentence::TEXT_FORM).capitalization[i];
+    bool any_lower = capitalization & ner_sentence::CAPITALIZATION_ANY_LOWER;
+    bool first_uc = capitalization & ner_sentence::CAPITALIZATION_FIRST_UPPER;
 
     for (int perform = 0; perform < TO_TOTAL; perform++) {
       if (mode == RECASE_NATIVE) {
@@ -744,12 +1183,12 @@ class gazetteers_enhanced : public feature_processor {
       }
 
       if (match == MATCH_FORM)
-        recase_text(word.form, perform, recased);
+        recase_text(word.form, perform, arena, ends);
       else if (match == MATCH_RAWLEMMA)
-        recase_text(word.raw_lemma, perform, recased);
+        recase_text(word.raw_lemma, perform, arena, ends);
       else if (match == MATCH_RAWLEMMAS)
         for (auto&& raw_lemma : word.raw_lemmas_all)
-          recase_text(raw_lemma, perform, recased);
+          recase_text(raw_lemma, perform, arena, ends);
     }
   }
 };
@@ -761,23 +1200,41 @@ class lemma : public feature_processor {
  public:
   virtual void process_sentence(ner_sentence& sentence, ner_feature* total_features, string& /*buffer*/) const override {
     for (unsigned i = 0; i < sentence.size; i++)
-      apply_in_window(i, lookup(sentence.words[i].lemma_id, total_features));
+      apply_in_window(i, lookup_word(sentence, ner_sentence::VOCABULARY_LEMMA_ID, i, total_features));
 
     apply_outer_words_in_window(lookup_empty());
   }
+
+  virtual int vocabulary() const override {
+    return ner_sentence::VOCABULARY_LEMMA_ID;
+  }
+
+  virtual unsigned word_attributes() const override {
+    return ner_word::LEMMA_ID;
+  }
+
+  virtual bool supports_feature_hashing() const override {
+    return true;
+  }
 };
 
 
 // NumericTimeValue
 class number_time_value : public feature_processor {
  public:
+  virtual void load(binary_decoder& data, const nlp_pipeline& pipeline) override {
+    feature_processor::load(data, pipeline);
+
+    for (unsigned i = 0; i < VALUES; i++)
+      value_features[i] = lookup(value_keys[i], nullptr);
+  }
+
   virtual void process_sentence(ner_sentence& sentence, ner_feature* total_features, string& buffer) const override {
-    ner_feature hour = lookup(buffer.assign("H"), total_features);
-    ner_feature minute = lookup(buffer.assign("M"), total_features);
-    ner_feature time = lookup(buffer.assign("t"), total_features);
-    ner_feature day = lookup(buffer.assign("d"), total_features);
-    ner_feature month = lookup(buffer.assign("m"), total_features);
-    ner_feature year = lookup(buffer.assign("y"), total_features);
+    // The features of a loaded processor were resolved in load
+    ner_feature features[VALUES];
+    for (unsigned i = 0; i < VALUES; i++)
+      features[i] = total_features || frozen.empty() ? lookup(buffer.assign(value_keys[i]), total_features) : value_features[i];
+    ner_feature hour = features[0], minute = features[1], time = features[2], day = features[3], month = features[4], year = features[5];
 
     for (unsigned i = 0; i < sentence.size; i++) {
       const char* form = sentence.words[i].form.c_str();
@@ -808,23 +1265,74 @@ class number_time_value : public feature_processor {
       }
     }
   }
+
+  virtual unsigned word_attributes() const override {
+    return ner_word::FORM;
+  }
+
+ private:
+  enum { VALUES = 6 };
+  static const char* value_keys[VALUES];
+  ner_feature value_features[VALUES];
 };
+const char* number_time_value::value_keys[VALUES] = {"H", "M", "t", "d", "m", "y"};
 
 
 // PreviousStage
 class previous_stage : public feature_processor {
  public:
+  virtual void load(binary_decoder& data, const nlp_pipeline& pipeline) override {
+    feature_processor::load(data, pipeline);
+
+    // Decode the keys into a dense table indexed by the bilou type and the
+    // entity type increased by one, so that entity_type_unknown is zero
+    vector<pair<pair<int, int>, ner_feature>> decoded;
+    frozen.for_each([&decoded](string_piece key, ner_feature value) {
+      const char* space = (const char*) memchr(key.str, ' ', key.len);
+      if (!space) return;
+      decoded.emplace_back(make_pair(decode(string_piece(key.str, space - key.str)),
+                                     decode(string_piece(space + 1, key.str + key.len - space - 1))), value);
+    });
+
+    stage_entities = 0;
+    for (auto&& element : decoded)
+      stage_entities = max(stage_entities, unsigned(element.first.second + 1) + 1);
+    stage_features.assign(bilou_type_total * stage_entities, ner_feature_unknown);
+    for (auto&& element : decoded)
+      if (unsigned(element.first.first) < bilou_type_total)
+        stage_features[element.first.first * stage_entities + unsigned(element.first.second + 1)] = element.second;
+  }
+
   virtual void process_sentence(ner_sentence& sentence, ner_feature* total_features, string& buffer) const override {
     for (unsigned i = 0; i < sentence.size; i++)
       if (sentence.previous_stage[i].bilou != bilou_type_unknown) {
-        buffer.clear();
-        append_encoded(buffer, sentence.previous_stage[i].bilou);
-        buffer.push_back(' ');
-        append_encoded(buffer, sentence.previous_stage[i].entity);
-        apply_in_range(i, lookup(buffer, total_features), 1, window);
+        if (total_features || frozen.empty()) {
+          buffer.clear();
+          append_encoded(buffer, sentence.previous_stage[i].bilou);
+          buffer.push_back(' ');
+          append_encoded(buffer, sentence.previous_stage[i].entity);
+          apply_in_range(i, lookup(buffer, total_features), 1, window);
+        } else {
+          unsigned entity = sentence.previous_stage[i].entity + 1;
+          ner_feature feature = entity < stage_entities ? stage_features[sentence.previous_stage[i].bilou * stage_entities + entity] : ner_feature_unknown;
+          count_lookup(feature != ner_feature_unknown);
+          apply_in_range(i, feature, 1, window);
+        }
       }
   }
 
+  virtual bool depends_on_previous_stage() const override {
+    return true;
+  }
+
+  virtual size_t memory_usage() const override {
+    return feature_processor::memory_usage() + stage_features.capacity() * sizeof(ner_feature);
+  }
+
+  virtual unsigned word_attributes() const override {
+    return 0;
+  }
+
  private:
   static void append_encoded(string& str, int value) {
     if (value < 0) {
@@ -834,6 +1342,20 @@ class previous_stage : public feature_processor {
     for (; value; value >>= 4)
       str.push_back("0123456789abcdef"[value & 0xF]);
   }
+
+  static int decode(string_piece str) {
+    bool negative = str.len && *str.str == '-';
+    int value = 0;
+    for (size_t i = str.len; i > size_t(negative); i--) {
+      char chr = str.str[i - 1];
+      value = value * 16 + (chr >= 'a' ? chr - 'a' + 10 : chr - '0');
+    }
+    return negative ? -value : value;
+  }
+
+  // Features of a loaded processor, see load
+  vector<ner_feature> stage_features;
+  unsigned stage_entities = 0;
 };
 
 
@@ -842,57 +1364,81 @@ class raw_lemma : public feature_processor {
  public:
   virtual void process_sentence(ner_sentence& sentence, ner_feature* total_features, string& /*buffer*/) const override {
     for (unsigned i = 0; i < sentence.size; i++)
-      apply_in_window(i, lookup(sentence.words[i].raw_lemma, total_features));
+      apply_in_window(i, lookup_word(sentence, ner_sentence::VOCABULARY_RAW_LEMMA, i, total_features));
 
     apply_outer_words_in_window(lookup_empty());
   }
+
+  virtual int vocabulary() const override {
+    return ner_sentence::VOCABULARY_RAW_LEMMA;
+  }
+
+  virtual unsigned word_attributes() const override {
+    return ner_word::RAW_LEMMA;
+  }
+
+  virtual bool supports_feature_hashing() const override {
+    return true;
+  }
 };
 
 
 // RawLemmaCapitalization
 class raw_lemma_capitalization : public feature_processor {
  public:
-  virtual void process_sentence(ner_sentence& sentence, ner_feature* total_features, string& buffer) const override {
-    using namespace unilib;
+  virtual void load(binary_decoder& data, const nlp_pipeline& pipeline) override {
+    feature_processor::load(data, pipeline);
 
-    ner_feature fst_cap = lookup(buffer.assign("f"), total_features);
-    ner_feature all_cap = lookup(buffer.assign("a"), total_features);
-    ner_feature mixed_cap = lookup(buffer.assign("m"), total_features);
+    for (unsigned i = 0; i < CAPITALIZATIONS; i++)
+      capitalization_features[i] = lookup(capitalization_keys[i], nullptr);
+  }
 
-    for (unsigned i = 0; i < sentence.size; i++) {
-      bool was_upper = false, was_lower = false;
+  virtual void process_sentence(ner_sentence& sentence, ner_feature* total_features, string& buffer) const override {
+    // The features of a loaded processor were resolved in load
+    ner_feature features[CAPITALIZATIONS];
+    for (unsigned i = 0; i < CAPITALIZATIONS; i++)
+      features[i] = total_features || frozen.empty() ? lookup(buffer.assign(capitalization_keys[i]), total_features) : capitalization_features[i];
+    ner_feature fst_cap = features[0], all_cap = features[1], mixed_cap = features[2];
 
-      auto* raw_lemma = sentence.words[i].raw_lemma.c_str();
-      char32_t chr;
-      for (bool first = true; (chr = utf8::decode(raw_lemma)); first = false) {
-        auto category = unicode::category(chr);
-        was_upper = was_upper || category & unicode::Lut;
-        was_lower = was_lower || category & unicode::Ll;
+    auto& texts = sentence.texts(ner_sentence::TEXT_RAW_LEMMA);
+    for (unsigned i = 0; i < sentence.size; i++) {
+      unsigned capitalization = texts.capitalization[i];
+      bool was_upper = capitalization & ner_sentence::CAPITALIZATION_ANY_UPPER;
+      bool was_lower = capitalization & ner_sentence::CAPITALIZATION_ANY_LOWER;
 
-        if (first && was_upper) apply_in_window(i, fst_cap);
-      }
+      if (capitalization & ner_sentence::CAPITALIZATION_FIRST_UPPER) apply_in_window(i, fst_cap);
       if (was_upper && !was_lower) apply_in_window(i, all_cap);
       if (was_upper && was_lower) apply_in_window(i, mixed_cap);
     }
   }
+
+  virtual unsigned word_attributes() const override {
+    return ner_word::RAW_LEMMA;
+  }
+
+ private:
+  ner_feature capitalization_features[CAPITALIZATIONS];
 };
 
 
 // RawLemmaCaseNormalized
 class raw_lemma_case_normalized : public feature_processor {
  public:
-  virtual void process_sentence(ner_sentence& sentence, ner_feature* total_features, string& buffer) const override {
-    using namespace unilib;
-
-    for (unsigned i = 0; i < sentence.size; i++) {
-      buffer.clear();
-      for (auto&& chr : utf8::decoder(sentence.words[i].raw_lemma))
-        utf8::append(buffer, buffer.empty() ? chr : unicode::lowercase(chr));
-      apply_in_window(i, lookup(buffer, total_features));
-    }
+  virtual void process_sentence(ner_sentence& sentence, ner_feature* total_features, string& /*buffer*/) const override {
+    auto& texts = sentence.texts(ner_sentence::TEXT_RAW_LEMMA);
+    for (unsigned i = 0; i < sentence.size; i++)
+      apply_in_window(i, lookup(texts.case_normalized_text(i), total_features));
 
     apply_outer_words_in_window(lookup_empty());
   }
+
+  virtual unsigned word_attributes() const override {
+    return ner_word::RAW_LEMMA;
+  }
+
+  virtual bool supports_feature_hashing() const override {
+    return true;
+  }
 };
 
 
@@ -921,8 +1467,8 @@ class suffix : public feature_processor {
     longest = data.next_4B();
   }
 
-  virtual void save(binary_encoder& enc) override {
-    feature_processor::save(enc);
+  virtual void save(binary_encoder& enc, bool in_place) override {
+    feature_processor::save(enc, in_place);
 
     enc.add_4B(shortest);
     enc.add_4B(longest);
@@ -931,17 +1477,30 @@ class suffix : public feature_processor {
   virtual void process_sentence(ner_sentence& sentence, ner_feature* total_features, string& buffer) const override {
     using namespace unilib;
 
-    vector<char32_t> chrs;
+    auto& texts = sentence.texts(source == SUFFIX_SOURCE_FORM ? ner_sentence::TEXT_FORM : ner_sentence::TEXT_RAW_LEMMA);
+    auto& chrs = casing == SUFFIX_CASE_ORIGINAL ? texts.chrs : texts.case_normalized;
     for (unsigned i = 0; i < sentence.size; i++) {
-      chrs.clear();
-      for (auto&& chr : utf8::decoder(source == SUFFIX_SOURCE_FORM ? sentence.words[i].form : sentence.words[i].raw_lemma))
-        chrs.push_back((casing == SUFFIX_CASE_ORIGINAL || chrs.empty()) ? chr : unicode::lowercase(chr));
+      unsigned end = texts.words[i + 1], length = end - texts.words[i];
 
+      // The key of a suffix extends the key of the shorter one, so when the
+      // frozen map or hashing is used, its hash is computed incrementally.
       buffer.clear();
-      for (int s = 1; s <= longest && s <= int(chrs.size()); s++) {
-        utf8::append(buffer, chrs[chrs.size() - s]);
-        if (s >= shortest) {
-          apply_in_window(i, lookup(buffer, total_features));
+      uint32_t hash = frozen_map::hash_initial;
+      for (int s = 1; s <= longest && s <= int(length); s++) {
+        size_t appended = buffer.size();
+        utf8::append(buffer, chrs[end - s]);
+        if (!hashed_buckets && (total_features || frozen.empty())) {
+          if (s >= shortest)
+            apply_in_window(i, lookup(buffer, total_features));
+        } else {
+          hash = frozen_map::hash_append(hash, string_piece(buffer.data() + appended, buffer.size() - appended));
+          if (s >= shortest && hashed_buckets) {
+            apply_in_window(i, hashed_feature(hash));
+          } else if (s >= shortest) {
+            const ner_feature* feature = frozen.find(buffer, hash);
+            count_lookup(feature);
+            apply_in_window(i, feature ? *feature : ner_feature_unknown);
+          }
         }
       }
     }
@@ -949,6 +1508,18 @@ class suffix : public feature_processor {
     apply_outer_words_in_window(lookup_empty());
   }
 
+  virtual unsigned word_attributes() const override {
+    return source == SUFFIX_SOURCE_FORM ? ner_word::FORM : ner_word::RAW_LEMMA;
+  }
+
+  virtual unsigned word_features() const override {
+    return max(longest - shortest + 1, 0) * (2*window + 1);
+  }
+
+  virtual bool supports_feature_hashing() const override {
+    return true;
+  }
+
  private:
   int shortest, longest;
   int source, casing;
@@ -960,10 +1531,18 @@ class tag : public feature_processor {
  public:
   virtual void process_sentence(ner_sentence& sentence, ner_feature* total_features, string& /*buffer*/) const override {
     for (unsigned i = 0; i < sentence.size; i++)
-      apply_in_window(i, lookup(sentence.words[i].tag, total_features));
+      apply_in_window(i, lookup_word(sentence, ner_sentence::VOCABULARY_TAG, i, total_features));
 
     apply_outer_words_in_window(lookup_empty());
   }
+
+  virtual int vocabulary() const override {
+    return ner_sentence::VOCABULARY_TAG;
+  }
+
+  virtual unsigned word_attributes() const override {
+    return ner_word::TAG;
+  }
 };
 
 
@@ -990,8 +1569,8 @@ class url_email_detector : public feature_processor {
     email = data.next_4B();
   }
 
-  virtual void save(binary_encoder& enc) override {
-    feature_processor::save(enc);
+  virtual void save(binary_encoder& enc, bool in_place) override {
+    feature_processor::save(enc, in_place);
 
     enc.add_4B(url);
     enc.add_4B(email);
@@ -1013,6 +1592,10 @@ class url_email_detector : public feature_processor {
     }
   }
 
+  virtual unsigned word_attributes() const override {
+    return ner_word::FORM;
+  }
+
  private:
   entity_type url, email;
 };
@@ -7,9 +7,13 @@
 // License, v. 2.0. If a copy of the MPL was not distributed with this
 // file, You can obtain one at http://mozilla.org/MPL/2.0/.
 
+#include <algorithm>
+#include <chrono>
+
 #include "feature_templates.h"
 #include "utils/compressor.h"
 #include "utils/binary_decoder.h"
+#include "utils/tracepoints.h"
 
 namespace ufal {
 namespace nametag {
@@ -22,6 +26,8 @@ bool feature_templates::load(istream& is, const nlp_pipeline& pipeline) {
     total_features = data.next_4B();
 
     processors.clear();
+    for (auto&& vocabulary : vocabularies)
+      vocabulary.clear();
     for (unsigned i = data.next_4B(); i; i--) {
       string name;
       data.next_str(name);
@@ -37,38 +43,241 @@ bool feature_templates::load(istream& is, const nlp_pipeline& pipeline) {
       // Could not find processor with specified name
       return false;
     }
+
+    // The in-place layout is followed by the shared vocabularies, which are
+    // otherwise built from the processors
+    if (!data.is_end()) {
+      if (data.next_1B() != ner_sentence::VOCABULARIES_TOTAL) return false;
+      for (auto&& vocabulary : vocabularies)
+        vocabulary.load(data);
+    } else {
+      for (int kind = 0; kind < ner_sentence::VOCABULARIES_TOTAL; kind++)
+        build_vocabulary(kind, vocabularies[kind]);
+    }
   } catch (binary_decoder_error&) {
     return false;
   }
+  if (!data.is_end()) return false;
 
-  return data.is_end();
+  for (int kind = 0; kind < ner_sentence::VOCABULARIES_TOTAL; kind++)
+    if (!vocabularies[kind].empty())
+      for (auto&& processor : processors)
+        if (processor.processor->vocabulary() == kind && !processor.processor->use_vocabulary(vocabularies[kind]))
+          return false;
+  compute_word_features();
+  return true;
 }
 
-void feature_templates::process_sentence(ner_sentence& sentence, string& buffer, bool adding_features) const {
+void feature_templates::build_vocabulary(int kind, frozen_map& vocabulary) const {
+  unordered_map<string, ner_feature> elements;
+  for (auto&& processor : processors)
+    if (processor.processor->vocabulary() == kind)
+      processor.processor->add_to_vocabulary(elements);
+
+  if (!elements.empty()) vocabulary.build(elements);
+}
+
+void feature_templates::process_sentence(ner_sentence& sentence, string& buffer, bool adding_features, bool store_stage_independent, processor_statistics* statistics) const {
   // Start with omnipresent feature
-  for (unsigned i = 0; i < sentence.size; i++) {
-    sentence.features[i].clear();
-    sentence.features[i].emplace_back(0);
+  sentence.clear_features();
+  sentence.reserve_features(sentence.size * word_features_total);
+  for (unsigned i = 0; i < sentence.size; i++)
+    sentence.add_feature(i, 0);
+
+  // Resolve the words in the shared vocabularies
+  for (int kind = 0; kind < ner_sentence::VOCABULARIES_TOTAL; kind++)
+    if (!vocabularies[kind].empty()) {
+      auto& ids = sentence.vocabulary_ids[kind];
+      ids.resize(sentence.size);
+      for (unsigned i = 0; i < sentence.size; i++) {
+        auto* id = vocabularies[kind].find(sentence.vocabulary_text(kind, i));
+        ids[i] = id ? *id : ner_feature_unknown;
+      }
+    }
+
+  // When requested, store the features not depending on the previous stage,
+  // together with positions where the stage dependent ones were inserted.
+  size_t stored = 0;
+  if (store_stage_independent) {
+    sentence.stage_independent_features.clear();
+    sentence.stage_dependent_positions.clear();
   }
 
   // Add features from feature processors
-  for (auto&& processor : processors)
-    processor.processor->process_sentence(sentence, adding_features ? &total_features : nullptr, buffer);
+  for (unsigned p = 0; p < processors.size(); p++) {
+    auto& processor = processors[p];
+    bool stage_dependent = store_stage_independent && processor.processor->depends_on_previous_stage();
+    if (stage_dependent) {
+      sentence.stage_independent_features.insert(sentence.stage_independent_features.end(),
+                                                 sentence.features_added.begin() + stored, sentence.features_added.end());
+      sentence.stage_dependent_positions.push_back(sentence.stage_independent_features.size());
+    }
+
+    process_with_statistics(processor, sentence, adding_features ? &total_features : nullptr, buffer, statistics ? statistics + p : nullptr);
+
+    if (stage_dependent) stored = sentence.features_added.size();
+  }
+
+  if (store_stage_independent) {
+    sentence.stage_independent_features.insert(sentence.stage_independent_features.end(),
+                                               sentence.features_added.begin() + stored, sentence.features_added.end());
+
+    // Store also the local probabilities filled by the processors
+    sentence.stage_independent_probabilities.clear();
+    for (unsigned i = 0; i < sentence.size; i++)
+      if (sentence.probabilities[i].local_filled)
+        sentence.stage_independent_probabilities.push_back({i, sentence.probabilities[i].local});
+  }
+
+  sentence.finalize_features();
 }
 
-void feature_templates::process_entities(ner_sentence& sentence, vector<named_entity>& entities, vector<named_entity>& buffer) const {
-  for (auto&& processor : processors)
-    processor.processor->process_entities(sentence, entities, buffer);
+void feature_templates::process_sentence_next_stage(ner_sentence& sentence, string& buffer, bool adding_features, processor_statistics* statistics) const {
+  // Interleave the stored features with the recomputed stage dependent ones,
+  // so that the features are in exactly the same order as in process_sentence.
+  sentence.clear_features();
+  sentence.clear_probabilities_local_filled();
+
+  size_t copied = 0, position = 0;
+  for (unsigned p = 0; p < processors.size(); p++)
+    if (processors[p].processor->depends_on_previous_stage()) {
+      size_t next = sentence.stage_dependent_positions[position++];
+      sentence.features_added.insert(sentence.features_added.end(),
+                                     sentence.stage_independent_features.begin() + copied,
+                                     sentence.stage_independent_features.begin() + next);
+      copied = next;
+
+      process_with_statistics(processors[p], sentence, adding_features ? &total_features : nullptr, buffer, statistics ? statistics + p : nullptr);
+    }
+  sentence.features_added.insert(sentence.features_added.end(),
+                                 sentence.stage_independent_features.begin() + copied,
+                                 sentence.stage_independent_features.end());
+
+  for (auto&& stored : sentence.stage_independent_probabilities) {
+    sentence.probabilities[stored.word].local = stored.local;
+    sentence.probabilities[stored.word].local_filled = true;
+  }
+
+  sentence.finalize_features();
+}
+
+void feature_templates::process_with_statistics(const feature_processor_info& processor, ner_sentence& sentence, ner_feature* total_features,
+                                                string& buffer, processor_statistics* statistics) const {
+  NAMETAG_TRACE2(feature_template_start, processor.name.c_str(), sentence.size);
+  if (!statistics) {
+    processor.processor->process_sentence(sentence, total_features, buffer);
+  } else {
+    size_t added = sentence.features_added.size();
+    auto start = chrono::steady_clock::now();
+    processor.processor->process_sentence(sentence, total_features, buffer);
+    statistics->seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    for (; added < sentence.features_added.size(); added++)
+      statistics->features += sentence.features_added[added].end - sentence.features_added[added].start;
+    statistics->calls++;
+  }
+  NAMETAG_TRACE2(feature_template_end, processor.name.c_str(), sentence.size);
+}
+
+void feature_templates::process_entities(ner_sentence& sentence, vector<named_entity>& entities, vector<named_entity>& buffer, const vector<unsigned char>* enabled) const {
+  for (unsigned i = 0; i < processors.size(); i++)
+    if (!enabled || (*enabled)[i])
+      processors[i].processor->process_entities(sentence, entities, buffer);
+}
+
+bool feature_templates::entity_processors(const vector<string>& types, vector<unsigned char>& enabled) const {
+  bool any = false;
+  vector<string> added;
+  enabled.assign(processors.size(), false);
+  for (unsigned i = 0; i < processors.size(); i++) {
+    added.clear();
+    processors[i].processor->added_entity_types(added);
+    for (auto&& type : added)
+      if (binary_search(types.begin(), types.end(), type))
+        enabled[i] = any = true;
+  }
+  return any;
+}
+
+bool feature_templates::processes_entities() const {
+  vector<string> added;
+  for (auto&& processor : processors) {
+    processor.processor->added_entity_types(added);
+    if (!added.empty()) return true;
+  }
+  return false;
 }
 
 ner_feature feature_templates::get_total_features() const {
   return total_features;
 }
 
+void feature_templates::processor_names(vector<string>& names) const {
+  for (auto&& processor : processors)
+    names.push_back(processor.name);
+}
+
+void feature_templates::count_lookups(bool enable) {
+  for (auto&& processor : processors)
+    processor.processor->count_lookups(enable);
+}
+
+void feature_templates::lookup_statistics(vector<size_t>& lookups, vector<size_t>& hits) const {
+  for (auto&& processor : processors) {
+    size_t processor_lookups, processor_hits;
+    processor.processor->lookup_statistics(processor_lookups, processor_hits);
+    lookups.push_back(processor_lookups);
+    hits.push_back(processor_hits);
+  }
+}
+
 void feature_templates::gazetteers(vector<string>& gazetteers, vector<int>* gazetteer_types) const {
   for (auto&& processor : processors)
     processor.processor->gazetteers(gazetteers, gazetteer_types);
 }
 
+bool feature_templates::may_start_match(const vector<string_piece>& forms) const {
+  for (auto&& processor : processors)
+    if (processor.processor->may_start_match(forms))
+      return true;
+  return false;
+}
+
+unsigned feature_templates::word_attributes() const {
+  unsigned attributes = 0;
+  for (auto&& processor : processors)
+    attributes |= processor.processor->word_attributes();
+  return attributes;
+}
+
+unsigned feature_templates::word_features() const {
+  return word_features_total;
+}
+
+void feature_templates::compute_word_features() {
+  word_features_total = 1; // The omnipresent feature
+  for (auto&& processor : processors)
+    word_features_total += processor.processor->word_features();
+}
+
+bool feature_templates::reload_gazetteers(const nlp_pipeline& pipeline) {
+  bool reloaded = true;
+  for (auto&& processor : processors)
+    reloaded = processor.processor->reload_gazetteers(pipeline) && reloaded;
+  return reloaded;
+}
+
+void feature_templates::memory_usage(vector<string>& components, vector<size_t>& bytes) const {
+  for (auto&& processor : processors) {
+    components.push_back("feature " + processor.name);
+    bytes.push_back(processor.processor->memory_usage());
+  }
+
+  size_t vocabularies_bytes = 0;
+  for (auto&& vocabulary : vocabularies)
+    vocabularies_bytes += vocabulary.memory_usage();
+  components.push_back("feature vocabularies");
+  bytes.push_back(vocabularies_bytes);
+}
+
 } // namespace nametag
 } // namespace ufal
@@ -18,18 +18,70 @@ namespace nametag {
 
 class feature_templates {
  public:
-  void parse(istream& is, entity_map& entities, const nlp_pipeline& pipeline);
+  // With non-zero feature_hashing, the processors supporting it hash their
+  // keys into the given number of buckets, see feature_processor.
+  void parse(istream& is, entity_map& entities, const nlp_pipeline& pipeline, unsigned feature_hashing = 0);
 
   bool load(istream& is, const nlp_pipeline& pipeline);
-  bool save(ostream& os);
+  bool save(ostream& os, compressor::codec codec = compressor::LZMA);
 
-  void process_sentence(ner_sentence& sentence, string& buffer, bool add_features = false) const;
-  void process_entities(ner_sentence& sentence, vector<named_entity>& entities, vector<named_entity>& buffer) const;
+  // Statistics of a processor accumulated by process_sentence when requested
+  struct processor_statistics {
+    size_t calls = 0, features = 0;
+    double seconds = 0;
+  };
+
+  // If statistics are given, the statistics of every processor are added to
+  // its element corresponding to the processor order of processor_names.
+  void process_sentence(ner_sentence& sentence, string& buffer, bool add_features = false, bool store_stage_independent = false, processor_statistics* statistics = nullptr) const;
+  // Recompute only the features depending on the previous stage, reusing the
+  // other features and local probabilities stored by the last process_sentence
+  // call with store_stage_independent. With add_features, only the stage
+  // dependent features can be added.
+  void process_sentence_next_stage(ner_sentence& sentence, string& buffer, bool add_features = false, processor_statistics* statistics = nullptr) const;
+  // If enabled is given, only the processors marked in it are used
+  void process_entities(ner_sentence& sentence, vector<named_entity>& entities, vector<named_entity>& buffer, const vector<unsigned char>* enabled = nullptr) const;
+  // Mark the processors whose process_entities can add an entity of one of
+  // the given sorted types, returning whether there are any
+  bool entity_processors(const vector<string>& types, vector<unsigned char>& enabled) const;
+  // Whether the process_entities of some processor can add entities
+  bool processes_entities() const;
   ner_feature get_total_features() const;
 
+  // Remove the features added during training since first_feature whose keys
+  // occur less than min_count times according to the given feature counts,
+  // and renumber the remaining features compactly. The renumbering of all
+  // features is returned, with the removed ones mapped to ner_feature_unknown.
+  void prune_features(ner_feature first_feature, const vector<size_t>& counts, size_t min_count, vector<ner_feature>& renumbering);
+  // Allow the loaded templates to add features again, as after parse,
+  // so that a loaded model can be trained further
+  void unfreeze();
+  unsigned word_attributes() const;
+  // Usual maximum number of features of a single word, computed once the
+  // templates are parsed or loaded and used to reserve sentence buffers
+  unsigned word_features() const;
+
+  // Append the names of the processors, in the order of processor statistics
+  void processor_names(vector<string>& names) const;
+
+  // Count the lookups of the processors, see feature_processor::count_lookups,
+  // and append their counts in the order of processor_names
+  void count_lookups(bool enable);
+  void lookup_statistics(vector<size_t>& lookups, vector<size_t>& hits) const;
+
   void gazetteers(vector<string>& gazetteers, vector<int>* gazetteer_types) const;
+  bool reload_gazetteers(const nlp_pipeline& pipeline);
+  // Whether a gazetteer match can start at one of the given forms without
+  // uppercase letters, see feature_processor::may_start_match
+  bool may_start_match(const vector<string_piece>& forms) const;
+
+  // Append the approximate number of bytes used by the processors and the
+  // shared vocabularies
+  void memory_usage(vector<string>& components, vector<size_t>& bytes) const;
 
  private:
+  friend struct bilou_ner_kernels;
+
   mutable ner_feature total_features;
 
   struct feature_processor_info {
@@ -39,6 +91,16 @@ class feature_templates {
     feature_processor_info(const string& name, feature_processor* processor) : name(name), processor(processor) {}
   };
   vector<feature_processor_info> processors;
+
+  inline void process_with_statistics(const feature_processor_info& processor, ner_sentence& sentence, ner_feature* total_features,
+                                      string& buffer, processor_statistics* statistics) const;
+
+  // Vocabularies shared by the processors of a loaded model
+  frozen_map vocabularies[ner_sentence::VOCABULARIES_TOTAL];
+  void build_vocabulary(int kind, frozen_map& vocabulary) const;
+
+  unsigned word_features_total = 1;
+  void compute_word_features();
 };
 
 } // namespace nametag
@@ -7,6 +7,8 @@
 // License, v. 2.0. If a copy of the MPL was not distributed with this
 // file, You can obtain one at http://mozilla.org/MPL/2.0/.
 
+#include <algorithm>
+
 #include "feature_templates.h"
 #include "utils/compressor.h"
 #include "utils/parse_int.h"
@@ -15,8 +17,10 @@
 namespace ufal {
 namespace nametag {
 
-void feature_templates::parse(istream& is, entity_map& entities, const nlp_pipeline& pipeline) {
+void feature_templates::parse(istream& is, entity_map& entities, const nlp_pipeline& pipeline, unsigned feature_hashing) {
   processors.clear();
+  for (auto&& vocabulary : vocabularies)
+    vocabulary.clear();
   total_features = 1; // An omnipresent feature used in process_sentence
 
   string line;
@@ -42,6 +46,11 @@ void feature_templates::parse(istream& is, entity_map& entities, const nlp_pipel
     auto* processor = feature_processor::create(template_name);
     if (processor) {
       if (!processor->parse(window, args, entities, &total_features, pipeline)) runtime_failure("Cannot initialize feature processor '" << template_name << "' from line '" << line << "' of feature templates file!");
+      if (feature_hashing && processor->supports_feature_hashing()) {
+        if (uint64_t(feature_hashing) * (2*window + 1) >= uint64_t(ner_feature_unknown - total_features))
+          runtime_failure("Too many feature hashing buckets for feature template '" << template_name << "'!");
+        processor->use_feature_hashing(feature_hashing, &total_features);
+      }
       processors.emplace_back(template_name, processor);
       continue;
     }
@@ -49,20 +58,72 @@ void feature_templates::parse(istream& is, entity_map& entities, const nlp_pipel
     // Fail
     runtime_failure("Cannot create feature template '" << template_name << "' from line '" << line << "' of feature templates file!");
   }
+
+  compute_word_features();
 }
 
-bool feature_templates::save(ostream& os) {
+void feature_templates::prune_features(ner_feature first_feature, const vector<size_t>& counts, size_t min_count, vector<ner_feature>& renumbering) {
+  renumbering.resize(total_features);
+  for (ner_feature i = 0; i < total_features; i++)
+    renumbering[i] = i < first_feature ? i : ner_feature_unknown;
+
+  // Keep the features of frequent keys in their original order
+  vector<pair<ner_feature, unsigned>> added;
+  for (auto&& processor : processors)
+    processor.processor->added_features(first_feature, added);
+  sort(added.begin(), added.end());
+
+  ner_feature kept_features = first_feature;
+  for (auto&& features : added) {
+    // Every key occurrence generates every feature of the key at most once,
+    // usually exactly once for at least one of them
+    size_t count = 0;
+    for (unsigned i = 0; i < features.second; i++)
+      count = max(count, counts[features.first + i]);
+    if (count < min_count) continue;
+
+    for (unsigned i = 0; i < features.second; i++)
+      renumbering[features.first + i] = kept_features++;
+  }
+
+  for (auto&& processor : processors)
+    processor.processor->renumber_added_features(first_feature, renumbering);
+  total_features = kept_features;
+}
+
+void feature_templates::unfreeze() {
+  // Without the shared vocabularies, the processors look up the words directly
+  for (auto&& vocabulary : vocabularies)
+    vocabulary.clear();
+  for (auto&& processor : processors)
+    processor.processor->unfreeze();
+}
+
+bool feature_templates::save(ostream& os, compressor::codec codec) {
   binary_encoder enc;
 
   enc.add_4B(total_features);
 
+  // Stored templates use the in-place layout, which also contains the shared
+  // vocabularies, so that nothing needs to be built during loading
+  bool in_place = codec == compressor::STORED;
+
   enc.add_4B(processors.size());
   for (auto&& processor : processors) {
     enc.add_str(processor.name);
-    processor.processor->save(enc);
+    processor.processor->save(enc, in_place);
+  }
+
+  if (in_place) {
+    enc.add_1B(ner_sentence::VOCABULARIES_TOTAL);
+    for (int kind = 0; kind < ner_sentence::VOCABULARIES_TOTAL; kind++) {
+      frozen_map vocabulary;
+      build_vocabulary(kind, vocabulary);
+      vocabulary.save(enc);
+    }
   }
 
-  return compressor::save(os, enc);
+  return compressor::save(os, enc, codec);
 }
 
 } // namespace nametag
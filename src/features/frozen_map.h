@@ -0,0 +1,209 @@
+// This file is part of NameTag <http://github.com/ufal/nametag/>.
+//
+// Copyright 2016 Institute of Formal and Applied Linguistics, Faculty of
+// Mathematics and Physics, Charles University in Prague, Czech Republic.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include <cstring>
+#include <unordered_map>
+
+#include "common.h"
+#include "ner_feature.h"
+#include "utils/binary_decoder.h"
+#include "utils/binary_encoder.h"
+#include "utils/string_piece.h"
+
+namespace ufal {
+namespace nametag {
+
+// Read-only open addressing hash table from strings to ner_features.
+// It is built once from an unordered_map and queried using string_piece
+// keys, without any allocation.
+class frozen_map {
+ public:
+  // Build the map from pairs of distinct keys convertible to string_piece
+  // and their values, for example from unordered_map<string, ner_feature>.
+  template <class Elements> inline void build(const Elements& elements);
+  inline void clear();
+  inline bool empty() const { return !size(); }
+  inline size_t size() const { return in_place_entries ? in_place_entries_size : entries.size(); }
+  inline size_t memory_usage() const;
+
+  // Save the built map in the in-place layout, which is referenced directly
+  // by the loaded map instead of being copied; the decoded data are kept
+  // alive by the map while it references them.
+  inline void save(binary_encoder& enc) const;
+  inline void load(binary_decoder& data);
+
+  // Calls function(string_piece key, ner_feature value) for all elements.
+  template <class Function> inline void for_each(Function function) const;
+
+  inline const ner_feature* find(string_piece key) const { return find(key, hash(key)); }
+
+  // The hash of a key can be computed incrementally when appending to it,
+  // starting with hash_initial and calling hash_append on the appended data.
+  inline const ner_feature* find(string_piece key, uint32_t key_hash) const;
+  static inline uint32_t hash(string_piece key) { return hash_append(hash_initial, key); }
+  static inline uint32_t hash_append(uint32_t hash, string_piece data);
+  enum :uint32_t { hash_initial = 2166136261U };
+
+ private:
+  struct slot {
+    uint32_t hash;
+    uint32_t entry;
+  };
+  struct entry {
+    uint32_t offset;
+    uint32_t len;
+    ner_feature value;
+  };
+  enum :uint32_t { slot_empty = ~0U };
+
+  vector<slot> slots;
+  uint32_t mask = 0;
+  vector<entry> entries;
+  string keys;
+
+  // Arrays of a loaded map, used instead of the above vectors when non-null
+  shared_ptr<const void> in_place_storage;
+  const slot* in_place_slots = nullptr;
+  const entry* in_place_entries = nullptr;
+  const char* in_place_keys = nullptr;
+  size_t in_place_entries_size = 0;
+  inline const slot* slots_data() const { return in_place_slots ? in_place_slots : slots.data(); }
+  inline const entry* entries_data() const { return in_place_entries ? in_place_entries : entries.data(); }
+  inline const char* keys_data() const { return in_place_keys ? in_place_keys : keys.data(); }
+};
+
+template <class Elements>
+void frozen_map::build(const Elements& elements) {
+  clear();
+
+  // Use table size being a power of two with load factor at most 0.5
+  size_t size = 2;
+  while (size < 2 * elements.size()) size <<= 1;
+  slots.assign(size, slot{0, slot_empty});
+  mask = size - 1;
+
+  entries.reserve(elements.size());
+  size_t keys_len = 0;
+  for (auto&& element : elements)
+    keys_len += string_piece(element.first).len;
+  keys.reserve(keys_len);
+
+  for (auto&& element : elements) {
+    string_piece key(element.first);
+    uint32_t element_hash = hash(key);
+    uint32_t index = element_hash & mask;
+    while (slots[index].entry != slot_empty) index = (index + 1) & mask;
+
+    slots[index].hash = element_hash;
+    slots[index].entry = entries.size();
+    entries.push_back({uint32_t(keys.size()), uint32_t(key.len), element.second});
+    keys.append(key.str, key.len);
+  }
+}
+
+void frozen_map::clear() {
+  slots.clear();
+  mask = 0;
+  entries.clear();
+  keys.clear();
+
+  in_place_storage.reset();
+  in_place_slots = nullptr;
+  in_place_entries = nullptr;
+  in_place_keys = nullptr;
+  in_place_entries_size = 0;
+}
+
+size_t frozen_map::memory_usage() const {
+  size_t bytes = slots.capacity() * sizeof(slot) + entries.capacity() * sizeof(entry) + keys.capacity();
+
+  // The arrays referenced in place are included too, even if they may be shared
+  if (in_place_slots) bytes += (size_t(mask) + 1) * sizeof(slot);
+  if (in_place_entries) bytes += in_place_entries_size * sizeof(entry);
+  if (in_place_keys && in_place_entries_size) bytes += in_place_entries[in_place_entries_size - 1].offset + in_place_entries[in_place_entries_size - 1].len;
+  return bytes;
+}
+
+void frozen_map::save(binary_encoder& enc) const {
+  enc.add_4B(size());
+  if (empty()) return;
+
+  // The keys are stored in the order of the entries
+  const entry& last = entries_data()[size() - 1];
+  size_t keys_len = last.offset + last.len;
+  enc.add_4B(mask);
+  enc.add_4B(keys_len);
+  enc.add_aligned(slots_data(), size_t(mask) + 1);
+  enc.add_aligned(entries_data(), size());
+  enc.add_data(keys_data(), keys_len);
+}
+
+void frozen_map::load(binary_decoder& data) {
+  clear();
+
+  unsigned entries_size = data.next_4B();
+  if (!entries_size) return;
+
+  mask = data.next_4B();
+  unsigned keys_len = data.next_4B();
+  if (!mask || !uint32_t(mask + 1) || (mask & (mask + 1)) || entries_size > mask / 2 + 1) throw binary_decoder_error("Invalid size of a frozen map");
+
+  const slot* loaded_slots = data.next_aligned<slot>(mask + 1, slots);
+  const entry* loaded_entries = data.next_aligned<entry>(entries_size, entries);
+  in_place_keys = data.next<char>(keys_len);
+  in_place_slots = loaded_slots == slots.data() ? nullptr : loaded_slots;
+  in_place_entries = loaded_entries == entries.data() ? nullptr : loaded_entries;
+  in_place_entries_size = entries_size;
+  in_place_storage = data.storage();
+
+  // The arrays are verified, as the lookups rely on them, including on the
+  // empty slots terminating the probing
+  unsigned used_slots = 0;
+  for (unsigned i = 0; i <= mask; i++)
+    if (loaded_slots[i].entry != slot_empty) {
+      if (loaded_slots[i].entry >= entries_size) throw binary_decoder_error("Invalid slot of a frozen map");
+      used_slots++;
+    }
+  if (used_slots != entries_size) throw binary_decoder_error("Invalid slots of a frozen map");
+  for (unsigned i = 0; i < entries_size; i++)
+    if (loaded_entries[i].offset > keys_len || loaded_entries[i].len > keys_len - loaded_entries[i].offset) throw binary_decoder_error("Invalid entry of a frozen map");
+}
+
+const ner_feature* frozen_map::find(string_piece key, uint32_t key_hash) const {
+  if (empty()) return nullptr;
+
+  const slot* slots = slots_data();
+  for (uint32_t index = key_hash & mask; slots[index].entry != slot_empty; index = (index + 1) & mask)
+    if (slots[index].hash == key_hash) {
+      const entry& candidate = entries_data()[slots[index].entry];
+      if (candidate.len == key.len && memcmp(keys_data() + candidate.offset, key.str, key.len) == 0)
+        return &candidate.value;
+    }
+
+  return nullptr;
+}
+
+template <class Function>
+void frozen_map::for_each(Function function) const {
+  const entry* entries = entries_data();
+  const char* keys = keys_data();
+  for (size_t i = 0; i < size(); i++)
+    function(string_piece(keys + entries[i].offset, entries[i].len), entries[i].value);
+}
+
+uint32_t frozen_map::hash_append(uint32_t hash, string_piece data) {
+  for (size_t i = 0; i < data.len; i++)
+    hash = (hash ^ (unsigned char)data.str[i]) * 16777619U;
+  return hash;
+}
+
+} // namespace nametag
+} // namespace ufal
@@ -9,6 +9,8 @@
 
 #pragma once
 
+#include <functional>
+
 #include "common.h"
 #include "tagger/tagger.h"
 #include "tokenizer/tokenizer.h"
@@ -20,7 +22,16 @@ struct nlp_pipeline {
   ufal::nametag::tokenizer* tokenizer;
   const ufal::nametag::tagger* tagger;
 
-  nlp_pipeline(ufal::nametag::tokenizer* tokenizer, const ufal::nametag::tagger* tagger) : tokenizer(tokenizer), tagger(tagger) {}
+  // Optional factory of additional tokenizers, allowing parallel tokenization
+  function<ufal::nametag::tokenizer*()> new_tokenizer;
+
+  // Whether the processors may write the caches of the data they read from
+  // files, see ner::set_gazetteers_cache_writing
+  bool write_caches = false;
+
+  nlp_pipeline(ufal::nametag::tokenizer* tokenizer, const ufal::nametag::tagger* tagger,
+               function<ufal::nametag::tokenizer*()> new_tokenizer = nullptr)
+      : tokenizer(tokenizer), tagger(tagger), new_tokenizer(new_tokenizer) {}
 };
 
 } // namespace nametag
@@ -21,6 +21,29 @@ namespace morphodita {
 inline void generate_casing_variants(string_piece form, string& form_uclc, string& form_lc) {
   using namespace unilib;
 
+  // Handle ASCII forms directly, without decoding them; the only uppercase
+  // or titlecase ASCII characters are A-Z.
+  {
+    bool ascii = true, first_upper = false, rest_has_upper = false;
+    for (size_t i = 0; i < form.len && ascii; i++) {
+      unsigned char chr = form.str[i];
+      ascii = chr < 0x80;
+      if (chr >= 'A' && chr <= 'Z') (i ? rest_has_upper : first_upper) = true;
+    }
+    if (ascii) {
+      if (!first_upper && !rest_has_upper) return;
+
+      form_lc.assign(form.str, form.len);
+      for (auto&& chr : form_lc)
+        if (chr >= 'A' && chr <= 'Z') chr += 'a' - 'A';
+      if (first_upper && rest_has_upper) {
+        form_uclc.assign(form_lc);
+        form_uclc[0] = form.str[0];
+      }
+      return;
+    }
+  }
+
   // Detect uppercase+titlecase characters.
   bool first_Lut = false; // first character is uppercase or titlecase
   bool rest_has_Lut = false; // any character but first is uppercase or titlecase
@@ -40,19 +40,13 @@ bool czech_morpho::load(istream& is) {
     // Load dictionary
     dictionary.load(data);
 
-    // Optionally prefix guesser if present
-    prefix_guesser.reset();
-    if (data.next_1B()) {
-      prefix_guesser.reset(new morpho_prefix_guesser<decltype(dictionary)>(dictionary));
-      prefix_guesser->load(data);
-    }
-
-    // Optionally statistical guesser if present
-    statistical_guesser.reset();
-    if (data.next_1B()) {
-      statistical_guesser.reset(new morpho_statistical_guesser());
-      statistical_guesser->load(data);
-    }
+    // Optional prefix guesser and statistical guesser are only validated
+    // and loaded on first use
+    guessers_storage = data.storage();
+    guessers_data = data.begin() + data.tell();
+    guessers_size = data.size() - data.tell();
+    if (data.next_1B()) morpho_prefix_guesser<decltype(dictionary)>::skip(data);
+    if (data.next_1B()) morpho_statistical_guesser::skip(data);
   } catch (binary_decoder_error&) {
     return false;
   }
@@ -60,6 +54,31 @@ bool czech_morpho::load(istream& is) {
   return data.is_end();
 }
 
+void czech_morpho::load_guessers() const {
+  call_once(guessers_loaded, [this]{
+    binary_decoder data;
+    data.fill(guessers_storage, guessers_data, guessers_size);
+
+    try {
+      // Optionally prefix guesser if present
+      if (data.next_1B()) {
+        prefix_guesser.reset(new morpho_prefix_guesser<decltype(dictionary)>(dictionary));
+        prefix_guesser->load(data);
+      }
+
+      // Optionally statistical guesser if present
+      if (data.next_1B()) {
+        statistical_guesser.reset(new morpho_statistical_guesser());
+        statistical_guesser->load(data);
+      }
+    } catch (binary_decoder_error&) {
+      prefix_guesser.reset();
+      statistical_guesser.reset();
+    }
+    guessers_storage.reset();
+  });
+}
+
 int czech_morpho::analyze(string_piece form, guesser_mode guesser, vector<tagged_lemma>& lemmas) const {
   lemmas.clear();
 
@@ -80,6 +99,7 @@ int czech_morpho::analyze(string_piece form, guesser_mode guesser, vector<tagged
     if (!lemmas.empty()) return NO_GUESSER;
 
     // For the prefix guesser, use only form_lc.
+    if (guesser == GUESSER) load_guessers();
     if (guesser == GUESSER && prefix_guesser)
       prefix_guesser->analyze(form_lc.empty() ? form : form_lc, lemmas);
     bool prefix_guesser_guesses = !lemmas.empty();
@@ -125,6 +145,7 @@ int czech_morpho::generate(string_piece lemma, const char* tag_wildcard, morpho:
     if (dictionary.generate(lemma, filter, forms))
       return NO_GUESSER;
 
+    if (guesser == GUESSER) load_guessers();
     if (guesser == GUESSER && prefix_guesser)
       if (prefix_guesser->generate(lemma, filter, forms))
         return GUESSER;
@@ -149,6 +170,14 @@ tokenizer* czech_morpho::new_tokenizer() const {
   return new czech_tokenizer(language, version, this);
 }
 
+size_t czech_morpho::memory_usage() const {
+  size_t bytes = morpho::memory_usage() + dictionary.memory_usage();
+  if (guessers_storage) bytes += guessers_size;
+  if (prefix_guesser) bytes += prefix_guesser->memory_usage();
+  if (statistical_guesser) bytes += statistical_guesser->memory_usage();
+  return bytes;
+}
+
 // What characters are considered punctuation except for the ones in unicode Punctuation category.
 static bool punctuation_additional[] = {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,1/*$*/,
   0,0,0,0,0,0,1/*+*/,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,1/*<*/,1/*=*/,1/*>*/,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
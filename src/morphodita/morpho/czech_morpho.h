@@ -9,6 +9,9 @@
 
 #pragma once
 
+#include <memory>
+#include <mutex>
+
 #include "common.h"
 #include "czech_lemma_addinfo.h"
 #include "morpho_dictionary.h"
@@ -32,16 +35,24 @@ class czech_morpho : public morpho {
   virtual int lemma_id_len(string_piece lemma) const override;
   virtual int raw_form_len(string_piece form) const override;
   virtual tokenizer* new_tokenizer() const override;
+  virtual size_t memory_usage() const override;
 
   bool load(istream& is);
  private:
   inline void analyze_special(string_piece form, vector<tagged_lemma>& lemmas) const;
+  void load_guessers() const;
 
   morpho_language language;
   unsigned version;
   morpho_dictionary<czech_lemma_addinfo> dictionary;
-  unique_ptr<morpho_prefix_guesser<decltype(dictionary)>> prefix_guesser;
-  unique_ptr<morpho_statistical_guesser> statistical_guesser;
+
+  // The guessers are loaded from the retained model data on first use
+  mutable once_flag guessers_loaded;
+  mutable shared_ptr<const void> guessers_storage;
+  const unsigned char* guessers_data = nullptr;
+  unsigned guessers_size = 0;
+  mutable unique_ptr<morpho_prefix_guesser<decltype(dictionary)>> prefix_guesser;
+  mutable unique_ptr<morpho_statistical_guesser> statistical_guesser;
 
   string unknown_tag = "X@-------------";
   string number_tag = "C=-------------";
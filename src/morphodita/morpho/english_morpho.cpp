@@ -95,6 +95,10 @@ tokenizer* english_morpho::new_tokenizer() const {
   return new english_tokenizer(version <= 2 ? 1 : 2);
 }
 
+size_t english_morpho::memory_usage() const {
+  return morpho::memory_usage() + dictionary.memory_usage() + morpho_guesser.memory_usage();
+}
+
 void english_morpho::analyze_special(string_piece form, vector<tagged_lemma>& lemmas) const {
   using namespace unilib;
 
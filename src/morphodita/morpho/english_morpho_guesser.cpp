@@ -17,6 +17,8 @@
 // Morpha has been released under LGPL as a part of RASP system
 //   http://ilexir.co.uk/applications/rasp/.
 
+#include <cstring>
+
 #include "english_morpho_guesser.h"
 
 namespace ufal {
@@ -358,18 +360,29 @@ inline void english_morpho_guesser::add(const string& tag, const string& form, v
   lemmas.emplace_back(form, tag);
 }
 
-inline void english_morpho_guesser::add(const string& tag, const string& tag2, const string& form, vector<tagged_lemma>& lemmas) const {
-  add(tag, form, lemmas);
-  add(tag2, form, lemmas);
+inline void english_morpho_guesser::add(const string& tag, const string& form, unsigned negation_len, vector<tagged_lemma>& lemmas) const {
+  add(tag, form, 0, nullptr, negation_len, lemmas);
 }
 
-inline void english_morpho_guesser::add(const string& tag, const string& form, unsigned negation_len, vector<tagged_lemma>& lemmas) const {
-  lemmas.emplace_back(negation_len ? form.substr(negation_len) + "^" + form.substr(0, negation_len) : form, tag);
+// The lemma is the form without the given number of final characters and
+// with the given suffix, followed by the negation if present. It is built
+// directly in the resulting analyses, without temporary strings.
+inline void english_morpho_guesser::add(const string& tag, const string& form, unsigned remove, const char* append, unsigned negation_len, vector<tagged_lemma>& lemmas) const {
+  unsigned append_len = append ? strlen(append) : 0;
+  lemmas.emplace_back();
+  string& lemma = lemmas.back().lemma;
+  lemma.reserve(form.size() - remove + append_len + (negation_len ? 1 : 0));
+  lemma.assign(form, negation_len, form.size() - remove - negation_len);
+  if (append_len) lemma.append(append, append_len);
+  if (negation_len) lemma.append(1, '^').append(form, 0, negation_len);
+  lemmas.back().tag = tag;
 }
 
-inline void english_morpho_guesser::add(const string& tag, const string& tag2, const string& form, unsigned negation_len, vector<tagged_lemma>& lemmas) const {
-  add(tag, form, negation_len, lemmas);
-  add(tag2, form, negation_len, lemmas);
+inline void english_morpho_guesser::add(const string& tag, const string& tag2, const string& form, unsigned remove, const char* append, unsigned negation_len, vector<tagged_lemma>& lemmas) const {
+  add(tag, form, remove, append, negation_len, lemmas);
+  lemmas.emplace_back();
+  lemmas.back().lemma = lemmas[lemmas.size() - 2].lemma;
+  lemmas.back().tag = tag2;
 }
 
 // Common definitions (written backwards)
@@ -602,7 +615,7 @@ _again:
 	}
 
 
-  add(NNS, form.substr(0, form.size() - remove).append(append ? append : ""), negation_len, lemmas);
+  add(NNS, form, remove, append, negation_len, lemmas);
 }
 
 
@@ -861,7 +874,7 @@ _again:
 	}
 
 
-  add(NNPS, form.substr(0, form.size() - remove).append(append ? append : ""), lemmas);
+  add(NNPS, form, remove, append, 0, lemmas);
 }
 
 
@@ -1316,7 +1329,7 @@ _again:
 	}
 
 
-  add(VBG, form.substr(0, form.size() - remove).append(append ? append : ""), lemmas);
+  add(VBG, form, remove, append, 0, lemmas);
 }
 
 
@@ -1771,7 +1784,7 @@ _again:
 	}
 
 
-  add(VBD, VBN, form.substr(0, form.size() - remove).append(append ? append : ""), lemmas);
+  add(VBD, VBN, form, remove, append, 0, lemmas);
 }
 
 
@@ -1959,7 +1972,7 @@ _again:
 	}
 
 
-  add(VBZ, form.substr(0, form.size() - remove).append(append ? append : ""), lemmas);
+  add(VBZ, form, remove, append, 0, lemmas);
 }
 
 
@@ -2185,7 +2198,7 @@ _again:
 	}
 
 
-  add(JJR, RBR, form.substr(0, form.size() - remove).append(append ? append : ""), negation_len, lemmas);
+  add(JJR, RBR, form, remove, append, negation_len, lemmas);
 }
 
 
@@ -2415,7 +2428,7 @@ _again:
 	}
 
 
-  add(JJS, RBS, form.substr(0, form.size() - remove).append(append ? append : ""), negation_len, lemmas);
+  add(JJS, RBS, form, remove, append, negation_len, lemmas);
 }
 
 } // namespace morphodita
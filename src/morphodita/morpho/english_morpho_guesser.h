@@ -23,12 +23,13 @@ class english_morpho_guesser {
   void load(binary_decoder& data);
   void analyze(string_piece form, string_piece form_lc, vector<tagged_lemma>& lemmas) const;
   bool analyze_proper_names(string_piece form, string_piece form_lc, vector<tagged_lemma>& lemmas) const;
+  size_t memory_usage() const { return exceptions.memory_usage() + negations.memory_usage(); }
 
  private:
   inline void add(const string& tag, const string& form, vector<tagged_lemma>& lemmas) const;
-  inline void add(const string& tag, const string& tag2, const string& form, vector<tagged_lemma>& lemmas) const;
   inline void add(const string& tag, const string& form, unsigned negation_len, vector<tagged_lemma>& lemmas) const;
-  inline void add(const string& tag, const string& tag2, const string& form, unsigned negation_len, vector<tagged_lemma>& lemmas) const;
+  inline void add(const string& tag, const string& form, unsigned remove, const char* append, unsigned negation_len, vector<tagged_lemma>& lemmas) const;
+  inline void add(const string& tag, const string& tag2, const string& form, unsigned remove, const char* append, unsigned negation_len, vector<tagged_lemma>& lemmas) const;
   void add_NNS(const string& form, unsigned negation_len, vector<tagged_lemma>& lemmas) const;
   void add_NNPS(const string& form, vector<tagged_lemma>& lemmas) const;
   void add_VBG(const string& form, vector<tagged_lemma>& lemmas) const;
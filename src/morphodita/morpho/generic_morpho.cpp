@@ -44,12 +44,11 @@ bool generic_morpho::load(istream& is) {
     // Load dictionary
     dictionary.load(data);
 
-    // Optionally statistical guesser if present
-    statistical_guesser.reset();
-    if (data.next_1B()) {
-      statistical_guesser.reset(new morpho_statistical_guesser());
-      statistical_guesser->load(data);
-    }
+    // Optional statistical guesser is only validated and loaded on first use
+    guesser_storage = data.storage();
+    guesser_data = data.begin() + data.tell();
+    guesser_size = data.size() - data.tell();
+    if (data.next_1B()) morpho_statistical_guesser::skip(data);
   } catch (binary_decoder_error&) {
     return false;
   }
@@ -57,6 +56,24 @@ bool generic_morpho::load(istream& is) {
   return data.is_end();
 }
 
+void generic_morpho::load_guesser() const {
+  call_once(guesser_loaded, [this]{
+    binary_decoder data;
+    data.fill(guesser_storage, guesser_data, guesser_size);
+
+    try {
+      // Optionally statistical guesser if present
+      if (data.next_1B()) {
+        statistical_guesser.reset(new morpho_statistical_guesser());
+        statistical_guesser->load(data);
+      }
+    } catch (binary_decoder_error&) {
+      statistical_guesser.reset();
+    }
+    guesser_storage.reset();
+  });
+}
+
 int generic_morpho::analyze(string_piece form, guesser_mode guesser, vector<tagged_lemma>& lemmas) const {
   lemmas.clear();
 
@@ -77,6 +94,7 @@ int generic_morpho::analyze(string_piece form, guesser_mode guesser, vector<tagg
     if (!lemmas.empty()) return NO_GUESSER;
 
     // For the statistical guesser, use all casing variants.
+    if (guesser == GUESSER) load_guesser();
     if (guesser == GUESSER && statistical_guesser) {
       if (form_uclc.empty() && form_lc.empty())
         statistical_guesser->analyze(form, lemmas, nullptr);
@@ -123,6 +141,13 @@ tokenizer* generic_morpho::new_tokenizer() const {
   return new generic_tokenizer(version);
 }
 
+size_t generic_morpho::memory_usage() const {
+  size_t bytes = morpho::memory_usage() + dictionary.memory_usage();
+  if (guesser_storage) bytes += guesser_size;
+  if (statistical_guesser) bytes += statistical_guesser->memory_usage();
+  return bytes;
+}
+
 void generic_morpho::analyze_special(string_piece form, vector<tagged_lemma>& lemmas) const {
   using namespace unilib;
 
@@ -9,6 +9,9 @@
 
 #pragma once
 
+#include <memory>
+#include <mutex>
+
 #include "common.h"
 #include "generic_lemma_addinfo.h"
 #include "morpho_dictionary.h"
@@ -28,14 +31,22 @@ class generic_morpho : public morpho {
   virtual int lemma_id_len(string_piece lemma) const override;
   virtual int raw_form_len(string_piece form) const override;
   virtual tokenizer* new_tokenizer() const override;
+  virtual size_t memory_usage() const override;
 
   bool load(istream& is);
  private:
   inline void analyze_special(string_piece form, vector<tagged_lemma>& lemmas) const;
+  void load_guesser() const;
 
   unsigned version;
   morpho_dictionary<generic_lemma_addinfo> dictionary;
-  unique_ptr<morpho_statistical_guesser> statistical_guesser;
+
+  // The guesser is loaded from the retained model data on first use
+  mutable once_flag guesser_loaded;
+  mutable shared_ptr<const void> guesser_storage;
+  const unsigned char* guesser_data = nullptr;
+  unsigned guesser_size = 0;
+  mutable unique_ptr<morpho_statistical_guesser> statistical_guesser;
 
   string unknown_tag, number_tag, punctuation_tag, symbol_tag;
 };
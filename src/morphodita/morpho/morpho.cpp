@@ -8,6 +8,7 @@
 // file, You can obtain one at http://mozilla.org/MPL/2.0/.
 
 #include <fstream>
+#include <sstream>
 
 #include "czech_morpho.h"
 #include "morphodita/derivator/derivator_dictionary.h"
@@ -16,6 +17,7 @@
 #include "generic_morpho.h"
 #include "morpho.h"
 #include "morpho_ids.h"
+#include "utils/compressor.h"
 #include "utils/new_unique_ptr.h"
 
 namespace ufal {
@@ -61,13 +63,12 @@ morpho* morpho::load(istream& is) {
       }
     case morpho_ids::DERIVATOR_DICTIONARY:
       {
-        auto derinet = new_unique_ptr<derivator_dictionary>();
-        if (!derinet->load(is)) return nullptr;
+        string derinet_raw;
+        if (!compressor::read_raw(is, derinet_raw)) return nullptr;
 
         unique_ptr<morpho> dictionary(load(is));
         if (!dictionary) return nullptr;
-        derinet->dictionary = dictionary.get();
-        dictionary->derinet.reset(derinet.release());
+        dictionary->derinet_raw = move(derinet_raw);
         return dictionary.release();
       }
   }
@@ -83,9 +84,24 @@ morpho* morpho::load(const char* fname) {
 }
 
 const derivator* morpho::get_derivator() const {
+  call_once(derinet_loaded, [this]{
+    if (derinet_raw.empty()) return;
+
+    auto derinet = new_unique_ptr<derivator_dictionary>();
+    istringstream is(derinet_raw);
+    if (derinet->load(is)) {
+      derinet->dictionary = this;
+      this->derinet.reset(derinet.release());
+    }
+    string().swap(derinet_raw);
+  });
   return derinet.get();
 }
 
+size_t morpho::memory_usage() const {
+  return derinet_raw.capacity();
+}
+
 } // namespace morphodita
 } // namespace nametag
 } // namespace ufal
@@ -9,6 +9,8 @@
 
 #pragma once
 
+#include <mutex>
+
 #include "common.h"
 #include "morphodita/derivator/derivator.h"
 #include "morphodita/tokenizer/tokenizer.h"
@@ -31,6 +33,7 @@ struct tagged_lemma {
 
   tagged_lemma() {}
   tagged_lemma(const string& lemma, const string& tag) : lemma(lemma), tag(tag) {}
+  tagged_lemma(string&& lemma, const string& tag) : lemma(move(lemma)), tag(tag) {}
 };
 
 struct tagged_lemma_forms {
@@ -99,8 +102,15 @@ class morpho {
   // The returned instance is owned by the morphology and should not be deleted.
   virtual const derivator* get_derivator() const;
 
+  // Return the approximate number of bytes used by the morphology. Must not
+  // be called concurrently with other methods.
+  virtual size_t memory_usage() const;
+
  protected:
-  unique_ptr<derivator> derinet;
+  // The derivator is constructed from its raw data on first use
+  mutable once_flag derinet_loaded;
+  mutable string derinet_raw;
+  mutable unique_ptr<derivator> derinet;
 };
 
 } // namespace morphodita
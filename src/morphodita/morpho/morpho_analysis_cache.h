@@ -0,0 +1,126 @@
+// This file is part of MorphoDiTa <http://github.com/ufal/morphodita/>.
+//
+// Copyright 2016 Institute of Formal and Applied Linguistics, Faculty of
+// Mathematics and Physics, Charles University in Prague, Czech Republic.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+
+#include "common.h"
+#include "morpho.h"
+
+namespace ufal {
+namespace nametag {
+namespace morphodita {
+
+// Bounded cache of morphological analyses of forms, which can be used
+// concurrently by multiple threads. The entries are evicted using the CLOCK
+// algorithm, separately in several independently locked shards.
+class morpho_analysis_cache {
+ public:
+  inline morpho_analysis_cache(size_t capacity);
+
+  // Returns false if the analyses of the form with the given guesser mode are
+  // not cached, filling the lemmas otherwise.
+  inline bool find(string_piece form, morpho::guesser_mode guesser, vector<tagged_lemma>& lemmas);
+  inline void insert(string_piece form, morpho::guesser_mode guesser, const vector<tagged_lemma>& lemmas);
+
+  inline size_t hits() const { return hits_count.load(memory_order_relaxed); }
+  inline size_t misses() const { return misses_count.load(memory_order_relaxed); }
+
+ private:
+  enum { SHARDS = 16 };
+
+  struct entry {
+    string key;
+    vector<tagged_lemma> lemmas;
+    bool referenced;
+  };
+  struct shard {
+    mutex lock;
+    unordered_map<string, unsigned> index;
+    vector<entry> entries;
+    size_t capacity = 0;
+    unsigned hand = 0;
+  };
+  shard shards[SHARDS];
+
+  atomic<size_t> hits_count, misses_count;
+
+  static inline void make_key(string_piece form, morpho::guesser_mode guesser, string& key);
+  inline shard& key_shard(const string& key);
+};
+
+morpho_analysis_cache::morpho_analysis_cache(size_t capacity) : hits_count(0), misses_count(0) {
+  for (unsigned i = 0; i < SHARDS; i++)
+    shards[i].capacity = capacity / SHARDS + (i < capacity % SHARDS);
+}
+
+bool morpho_analysis_cache::find(string_piece form, morpho::guesser_mode guesser, vector<tagged_lemma>& lemmas) {
+  string key;
+  make_key(form, guesser, key);
+
+  auto& shard = key_shard(key);
+  {
+    lock_guard<mutex> guard(shard.lock);
+    auto it = shard.index.find(key);
+    if (it != shard.index.end()) {
+      auto& entry = shard.entries[it->second];
+      entry.referenced = true;
+      lemmas = entry.lemmas;
+      hits_count.fetch_add(1, memory_order_relaxed);
+      return true;
+    }
+  }
+
+  misses_count.fetch_add(1, memory_order_relaxed);
+  return false;
+}
+
+void morpho_analysis_cache::insert(string_piece form, morpho::guesser_mode guesser, const vector<tagged_lemma>& lemmas) {
+  string key;
+  make_key(form, guesser, key);
+
+  auto& shard = key_shard(key);
+  lock_guard<mutex> guard(shard.lock);
+  if (!shard.capacity || shard.index.count(key)) return;
+
+  if (shard.entries.size() < shard.capacity) {
+    shard.index.emplace(key, shard.entries.size());
+    shard.entries.push_back({key, lemmas, false});
+    return;
+  }
+
+  // Find an entry not referenced since the hand passed it last time
+  while (shard.entries[shard.hand].referenced) {
+    shard.entries[shard.hand].referenced = false;
+    shard.hand = (shard.hand + 1) % shard.entries.size();
+  }
+
+  auto& entry = shard.entries[shard.hand];
+  shard.index.erase(entry.key);
+  shard.index.emplace(key, shard.hand);
+  entry.key = key;
+  entry.lemmas = lemmas;
+  shard.hand = (shard.hand + 1) % shard.entries.size();
+}
+
+void morpho_analysis_cache::make_key(string_piece form, morpho::guesser_mode guesser, string& key) {
+  key.assign(1, char('0' + guesser));
+  key.append(form.str, form.len);
+}
+
+morpho_analysis_cache::shard& morpho_analysis_cache::key_shard(const string& key) {
+  return shards[hash<string>()(key) % SHARDS];
+}
+
+} // namespace morphodita
+} // namespace nametag
+} // namespace ufal
@@ -28,6 +28,7 @@ class morpho_dictionary {
   void load(binary_decoder& data);
   void analyze(string_piece form, vector<tagged_lemma>& lemmas) const;
   bool generate(string_piece lemma, const tag_filter& filter, vector<tagged_lemma_forms>& lemmas_forms) const;
+  size_t memory_usage() const;
  private:
   persistent_unordered_map lemmas, roots, suffixes;
 
@@ -184,11 +185,16 @@ void morpho_dictionary<LemmaAddinfo>::analyze(string_piece form, vector<tagged_l
             string lemma((const char*)lemma_data, lemma_len);
             if (lemma_data[lemma_len]) lemma += LemmaAddinfo::format(lemma_data + lemma_len + 1, lemma_data[lemma_len]);
 
+            // The lemma is copied to all analyses but the last one, which takes it
             uint16_t* suff_tag_indices = suff_data + suff_classes;
             uint16_t* suff_tags = suff_tag_indices + suff_classes + 1;
-            for (unsigned i = unaligned_load<uint16_t>(suff_tag_indices + (suffix_class_ptr - suff_data));
-                 i < unaligned_load<uint16_t>(suff_tag_indices + (suffix_class_ptr - suff_data) + 1); i++)
-              lemmas.emplace_back(lemma, tags[unaligned_load<uint16_t>(suff_tags + i)]);
+            unsigned tags_start = unaligned_load<uint16_t>(suff_tag_indices + (suffix_class_ptr - suff_data));
+            unsigned tags_end = unaligned_load<uint16_t>(suff_tag_indices + (suffix_class_ptr - suff_data) + 1);
+            for (unsigned i = tags_start; i < tags_end; i++)
+              if (i + 1 < tags_end)
+                lemmas.emplace_back(lemma, tags[unaligned_load<uint16_t>(suff_tags + i)]);
+              else
+                lemmas.emplace_back(move(lemma), tags[unaligned_load<uint16_t>(suff_tags + i)]);
           }
         }
       });
@@ -243,6 +249,19 @@ bool morpho_dictionary<LemmaAddinfo>::generate(string_piece lemma, const tag_fil
   return matched_lemma;
 }
 
+template <class LemmaAddinfo>
+size_t morpho_dictionary<LemmaAddinfo>::memory_usage() const {
+  size_t bytes = lemmas.memory_usage() + roots.memory_usage() + suffixes.memory_usage();
+  for (auto&& tag : tags)
+    bytes += sizeof(tag) + tag.capacity();
+  for (auto&& clas : classes) {
+    bytes += sizeof(clas);
+    for (auto&& suffix : clas)
+      bytes += sizeof(suffix) + suffix.first.capacity() + suffix.second.capacity() * sizeof(uint16_t);
+  }
+  return bytes;
+}
+
 } // namespace morphodita
 } // namespace nametag
 } // namespace ufal
@@ -28,8 +28,10 @@ class morpho_prefix_guesser {
   morpho_prefix_guesser(const MorphoDictionary& dictionary) : dictionary(dictionary) {}
 
   void load(binary_decoder& data);
+  static void skip(binary_decoder& data);
   void analyze(string_piece form, vector<tagged_lemma>& lemmas);
   bool generate(string_piece lemma, const tag_filter& filter, vector<tagged_lemma_forms>& lemmas_forms);
+  size_t memory_usage() const { return prefixes_initial.memory_usage() + prefixes_middle.memory_usage(); }
 
  private:
   const MorphoDictionary& dictionary;
@@ -50,8 +52,17 @@ void morpho_prefix_guesser<MorphoDictionary>::load(binary_decoder& data) {
   }
 
   // Load prefixes
-  prefixes_initial.load(data);
-  prefixes_middle.load(data);
+  prefixes_initial.load_typed<uint32_t>(data);
+  prefixes_middle.load_typed<uint32_t>(data);
+}
+
+template <class MorphoDictionary>
+void morpho_prefix_guesser<MorphoDictionary>::skip(binary_decoder& data) {
+  for (unsigned tag_filters_len = data.next_1B(); tag_filters_len; tag_filters_len--)
+    data.next<char>(data.next_1B());
+
+  persistent_unordered_map().load(data);
+  persistent_unordered_map().load(data);
 }
 
 // Analyze can return non-unique lemma-tag pairs.
@@ -30,6 +30,14 @@ void morpho_statistical_guesser::load(binary_decoder& data) {
   rules.load(data);
 }
 
+void morpho_statistical_guesser::skip(binary_decoder& data) {
+  for (unsigned tags = data.next_2B(); tags; tags--)
+    data.next<char>(data.next_1B());
+  data.next_2B();
+
+  persistent_unordered_map().load(data);
+}
+
 // Helper method for analyze.
 static bool contains(morpho_statistical_guesser::used_rules* used, const string& rule) {
   if (!used) return false;
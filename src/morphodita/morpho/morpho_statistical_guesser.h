@@ -21,8 +21,10 @@ namespace morphodita {
 class morpho_statistical_guesser {
  public:
   void load(binary_decoder& data);
+  static void skip(binary_decoder& data);
   typedef vector<string> used_rules;
   void analyze(string_piece form, vector<tagged_lemma>& lemmas, used_rules* used);
+  size_t memory_usage() const { return rules.memory_usage(); }
 
  private:
   vector<string> tags;
@@ -11,6 +11,7 @@
 
 #include <cstring>
 #include <map>
+#include <memory>
 #include <unordered_map>
 
 #include "common.h"
@@ -34,6 +35,10 @@ class persistent_unordered_map {
   template <class T>
   inline const T* at_typed(const char* str, int len) const;
 
+  // Prefetch the bucket offsets of the given key, so that a subsequent lookup
+  // of several keys does not wait for each of them separately
+  inline void prefetch(const char* str, int len) const;
+
   template <class EntryProcess>
   inline void iter(const char* str, int len, EntryProcess entry_process) const;
 
@@ -44,6 +49,9 @@ class persistent_unordered_map {
   inline int max_length() const;
   inline const unsigned char* data_start(int len) const;
 
+  // Return the approximate number of bytes used by the map
+  inline size_t memory_usage() const;
+
   // Creation functions
   persistent_unordered_map() {}
   template <class Entry, class EntryEncode>
@@ -60,6 +68,11 @@ class persistent_unordered_map {
 
   // Serialization
   inline void load(binary_decoder& data);
+  // Load a map whose entries all have type T. The bucket offsets are then
+  // stored together with fingerprints of the keys in the bucket, so that
+  // at_typed usually rejects a missing key after reading only the bucket.
+  template <class T>
+  inline void load_typed(binary_decoder& data);
   inline void save(binary_encoder& enc);
 
  private:
@@ -80,15 +93,13 @@ struct persistent_unordered_map::fnv_hash {
     hash.resize(mask + 1);
     mask--;
   }
-  fnv_hash(binary_decoder& data) {
-    uint32_t size = data.next_4B();
-    mask = size - 2;
-    hash.resize(size);
-    memcpy(hash.data(), data.next<uint32_t>(size), size * sizeof(uint32_t));
+  fnv_hash(binary_decoder& data) : storage(data.storage()) {
+    offsets_size = data.next_4B();
+    mask = offsets_size - 2;
+    offsets = (const unsigned char*) data.next<uint32_t>(offsets_size);
 
-    size = data.next_4B();
-    this->data.resize(size);
-    if (size) memcpy(this->data.data(), data.next<char>(size), size);
+    entries_size = data.next_4B();
+    entries = data.next<unsigned char>(entries_size);
   }
 
   inline uint32_t index(const char* data, int len) const {
@@ -96,26 +107,69 @@ struct persistent_unordered_map::fnv_hash {
     if (len == 1) return unaligned_load<uint8_t>(data);
     if (len == 2) return unaligned_load<uint16_t>(data);
 
+    return fnv(data, len) & mask;
+  }
+
+  static inline uint32_t fnv(const char* data, int len) {
     uint32_t hash = 2166136261U;
     while (len--)
       hash = (hash ^ unsigned(*data++)) * 16777619U;
-    return hash & mask;
+    return hash;
   }
 
+  // The fingerprint of a key longer than two bytes is a single bit chosen by
+  // the highest bits of its hash, which are usually not part of the index.
+  static inline uint32_t fingerprint(uint32_t fnv) { return 1U << (fnv >> 27); }
+
+  inline uint32_t offset(uint32_t index) const {
+    return unaligned_load<uint32_t>(offsets + index * sizeof(uint32_t));
+  }
+
+  inline void bucket(uint32_t index, const unsigned char*& start, const unsigned char*& end) const {
+    if (tagged.empty()) {
+      start = entries + offset(index);
+      end = entries + offset(index+1);
+    } else {
+      start = entries + tagged[index].offset;
+      end = entries + tagged[index+1].offset;
+    }
+  }
+
+  // Make the constructed hash and data the storage of the map
+  inline void own();
+
   inline void save(binary_encoder& enc);
 
   unsigned mask;
+
+  // The bucket offsets and the entries are stored in hash and data during
+  // construction. Afterwards they are accessed only through the following
+  // views of the storage, which is either the constructed data, or the
+  // (possibly unaligned) buffer of the binary_decoder the map was loaded
+  // from, so that loading does not copy the map.
   vector<uint32_t> hash;
   vector<unsigned char> data;
+  const unsigned char* offsets = nullptr;
+  unsigned offsets_size = 0;
+  const unsigned char* entries = nullptr;
+  size_t entries_size = 0;
+  shared_ptr<const void> storage;
+
+  // Bucket offsets with the union of the fingerprints of the bucket keys,
+  // used instead of hash by maps loaded with load_typed
+  struct tagged_bucket {
+    uint32_t offset;
+    uint32_t fingerprints;
+  };
+  vector<tagged_bucket> tagged;
 };
 
 template <class EntrySize>
 const unsigned char* persistent_unordered_map::at(const char* str, int len, EntrySize entry_size) const {
   if (unsigned(len) >= hashes.size()) return nullptr;
 
-  unsigned index = hashes[len].index(str, len);
-  const unsigned char* data = hashes[len].data.data() + hashes[len].hash[index];
-  const unsigned char* end = hashes[len].data.data() + hashes[len].hash[index+1];
+  const unsigned char *data, *end;
+  hashes[len].bucket(hashes[len].index(str, len), data, end);
 
   if (len <= 2)
     return data != end ? data + len : nullptr;
@@ -134,12 +188,22 @@ template <class T>
 const T* persistent_unordered_map::at_typed(const char* str, int len) const {
   if (unsigned(len) >= hashes.size()) return nullptr;
 
-  unsigned index = hashes[len].index(str, len);
-  const unsigned char* data = hashes[len].data.data() + hashes[len].hash[index];
-  const unsigned char* end = hashes[len].data.data() + hashes[len].hash[index+1];
-
-  if (len <= 2)
+  auto& hash = hashes[len];
+  const unsigned char *data, *end;
+  if (len <= 2) {
+    hash.bucket(hash.index(str, len), data, end);
     return data != end ? (const T*)(data + len) : nullptr;
+  }
+
+  uint32_t fnv = fnv_hash::fnv(str, len);
+  if (hash.tagged.empty()) {
+    hash.bucket(fnv & hash.mask, data, end);
+  } else {
+    auto bucket = hash.tagged.data() + (fnv & hash.mask);
+    if (!(bucket->fingerprints & fnv_hash::fingerprint(fnv))) return nullptr;
+    data = hash.entries + bucket[0].offset;
+    end = hash.entries + bucket[1].offset;
+  }
 
   while (data < end) {
     if (small_memeq(str, data, len)) return (const T*)(data + len);
@@ -149,13 +213,26 @@ const T* persistent_unordered_map::at_typed(const char* str, int len) const {
   return nullptr;
 }
 
+void persistent_unordered_map::prefetch(const char* str, int len) const {
+#if defined(__GNUC__)
+  if (unsigned(len) >= hashes.size() || len <= 2) return;
+
+  auto& hash = hashes[len];
+  if (hash.tagged.empty())
+    __builtin_prefetch(hash.offsets + hash.index(str, len) * sizeof(uint32_t));
+  else
+    __builtin_prefetch(hash.tagged.data() + hash.index(str, len));
+#else
+  (void)str; (void)len;
+#endif
+}
+
 template <class EntryProcess>
 void persistent_unordered_map::iter(const char* str, int len, EntryProcess entry_process) const {
   if (unsigned(len) >= hashes.size()) return;
 
-  unsigned index = hashes[len].index(str, len);
-  const unsigned char* data = hashes[len].data.data() + hashes[len].hash[index];
-  const unsigned char* end = hashes[len].data.data() + hashes[len].hash[index+1];
+  const unsigned char *data, *end;
+  hashes[len].bucket(hashes[len].index(str, len), data, end);
 
   while (data < end) {
     auto start = (const char*) data;
@@ -168,8 +245,8 @@ void persistent_unordered_map::iter(const char* str, int len, EntryProcess entry
 template <class EntryProcess>
 void persistent_unordered_map::iter_all(EntryProcess entry_process) const {
   for (unsigned len = 0; len < hashes.size(); len++) {
-    const unsigned char* data = hashes[len].data.data();
-    const unsigned char* end = data + hashes[len].data.size();
+    const unsigned char* data = hashes[len].entries;
+    const unsigned char* end = data + hashes[len].entries_size;
 
     while (data < end) {
       auto start = (const char*) data;
@@ -185,7 +262,18 @@ int persistent_unordered_map::max_length() const {
 }
 
 const unsigned char* persistent_unordered_map::data_start(int len) const {
-  return unsigned(len) < hashes.size() ? hashes[len].data.data() : nullptr;
+  if (unsigned(len) >= hashes.size()) return nullptr;
+
+  // The entries of a map being filled are not yet in its storage
+  auto& hash = hashes[len];
+  return hash.entries ? hash.entries : hash.data.data();
+}
+
+size_t persistent_unordered_map::memory_usage() const {
+  size_t bytes = hashes.capacity() * sizeof(fnv_hash);
+  for (auto&& hash : hashes)
+    bytes += hash.offsets_size * sizeof(uint32_t) + hash.entries_size + hash.tagged.capacity() * sizeof(fnv_hash::tagged_bucket);
+  return bytes;
 }
 
 void persistent_unordered_map::resize(unsigned elems) {
@@ -220,9 +308,20 @@ unsigned char* persistent_unordered_map::fill(const char* str, int str_len, int
 }
 
 void persistent_unordered_map::done_filling() {
-  for (auto&& hash : hashes)
+  for (auto&& hash : hashes) {
     for (int i = hash.hash.size() - 1; i >= 0; i--)
       hash.hash[i] = i > 0 ? hash.hash[i-1] : 0;
+    hash.own();
+  }
+}
+
+void persistent_unordered_map::fnv_hash::own() {
+  auto owned = make_shared<pair<vector<uint32_t>, vector<unsigned char>>>(move(hash), move(data));
+  offsets = (const unsigned char*) owned->first.data();
+  offsets_size = owned->first.size();
+  entries = owned->second.data();
+  entries_size = owned->second.size();
+  storage = owned;
 }
 
 void persistent_unordered_map::load(binary_decoder& data) {
@@ -233,6 +332,28 @@ void persistent_unordered_map::load(binary_decoder& data) {
     hashes.emplace_back(data);
 }
 
+template <class T>
+void persistent_unordered_map::load_typed(binary_decoder& data) {
+  load(data);
+
+  for (unsigned len = 0; len < hashes.size(); len++) {
+    auto& hash = hashes[len];
+    hash.tagged.resize(hash.offsets_size);
+    for (unsigned i = 0; i < hash.offsets_size; i++) {
+      hash.tagged[i].offset = hash.offset(i);
+      hash.tagged[i].fingerprints = len <= 2 ? ~0U : 0U;
+      if (len > 2 && i + 1 < hash.offsets_size)
+        for (unsigned offset = hash.offset(i); offset < hash.offset(i+1); offset += len + sizeof(T))
+          hash.tagged[i].fingerprints |= fnv_hash::fingerprint(fnv_hash::fnv((const char*)hash.entries + offset, len));
+    }
+
+    // Only the tagged bucket offsets are new, the entries stay in the decoder
+    // buffer like in load, which can be a memory mapped model file
+    hash.offsets = nullptr;
+    hash.offsets_size = 0;
+  }
+}
+
 } // namespace morphodita
 } // namespace nametag
 } // namespace ufal
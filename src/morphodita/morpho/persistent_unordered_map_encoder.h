@@ -83,11 +83,17 @@ void persistent_unordered_map::save(binary_encoder& enc) {
 }
 
 void persistent_unordered_map::fnv_hash::save(binary_encoder& enc) {
-  enc.add_4B(hash.size());
-  enc.add_data(hash);
+  if (tagged.empty()) {
+    enc.add_4B(offsets_size);
+    enc.add_data(offsets, offsets_size * sizeof(uint32_t));
+  } else {
+    enc.add_4B(tagged.size());
+    for (auto&& bucket : tagged)
+      enc.add_4B(bucket.offset);
+  }
 
-  enc.add_4B(data.size());
-  enc.add_data(data);
+  enc.add_4B(entries_size);
+  enc.add_data(entries, entries_size);
 }
 
 } // namespace morphodita
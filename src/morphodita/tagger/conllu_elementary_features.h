@@ -10,6 +10,7 @@
 #pragma once
 
 #include "elementary_features.h"
+#include "per_form_features_cache.h"
 #include "unilib/unicode.h"
 #include "unilib/utf8.h"
 #include "viterbi.h"
@@ -38,7 +39,14 @@ class conllu_elementary_features : public elementary_features<Map> {
   void compute_features(const vector<string_piece>& forms, const vector<vector<tagged_lemma>>& analyses, vector<per_form_features>& per_form, vector<vector<per_tag_features>>& per_tag) const;
   inline void compute_dynamic_features(const tagged_lemma& tag, const per_form_features& per_form, const per_tag_features& per_tag, const dynamic_features* prev_dynamic, dynamic_features& dynamic) const;
 
+  // Optional cache of the per-form features depending only on the form,
+  // shared by the copies of the features
+  shared_ptr<per_form_features_cache<per_form_features>> form_cache;
+
   using elementary_features<Map>::maps;
+
+ private:
+  void compute_form_features(string_piece form, bool ortographic, per_form_features& per_form) const;
 };
 
 typedef conllu_elementary_features<persistent_elementary_feature_map> persistent_conllu_elementary_features;
@@ -92,8 +100,6 @@ vector<elementary_feature_description> conllu_elementary_features<Map>::descript
 
 template <class Map>
 void conllu_elementary_features<Map>::compute_features(const vector<string_piece>& forms, const vector<vector<tagged_lemma>>& analyses, vector<per_form_features>& per_form, vector<vector<per_tag_features>>& per_tag) const {
-  using namespace unilib;
-
   // We process the sentence in reverse order, so that we can compute FollowingVerbTag and FollowingVerbLemma directly.
   elementary_feature_value following_verb_tag = elementary_feature_empty, following_verb_form = elementary_feature_empty;
   for (unsigned i = forms.size(); i--;) {
@@ -155,8 +161,14 @@ void conllu_elementary_features<Map>::compute_features(const vector<string_piece
       }
     }
 
-    // Per_form features
-    per_form[i].values[FORM] = maps[MAP_FORM].value(forms[i].str, forms[i].len);
+    // Per_form features, the ones depending only on the form possibly cached.
+    // The cached entries contain the ortographic features even if they are
+    // not needed for the current form.
+    bool ortographic = analyses[i].size() != 1;
+    if (!form_cache || !form_cache->find(forms[i], per_form[i])) {
+      compute_form_features(forms[i], ortographic || form_cache, per_form[i]);
+      if (form_cache) form_cache->insert(forms[i], per_form[i]);
+    }
     per_form[i].values[FOLLOWING_VERB_TAG] = following_verb_tag;
     per_form[i].values[FOLLOWING_VERB_FORM] = following_verb_form;
 
@@ -166,8 +178,8 @@ void conllu_elementary_features<Map>::compute_features(const vector<string_piece
       following_verb_form = per_form[i].values[FORM];
     }
 
-    // Ortographic per_form features if needed
-    if (analyses[i].size() == 1) {
+    // Ortographic per_form features are needed only for ambiguous forms
+    if (!ortographic) {
       per_form[i].values[NUM] = per_form[i].values[CAP] = per_form[i].values[DASH] = elementary_feature_unknown;
       per_form[i].values[PREFIX1] = per_form[i].values[PREFIX2] = per_form[i].values[PREFIX3] = elementary_feature_unknown;
       per_form[i].values[PREFIX4] = per_form[i].values[PREFIX5] = per_form[i].values[PREFIX6] = elementary_feature_unknown;
@@ -175,54 +187,63 @@ void conllu_elementary_features<Map>::compute_features(const vector<string_piece
       per_form[i].values[SUFFIX1] = per_form[i].values[SUFFIX2] = per_form[i].values[SUFFIX3] = elementary_feature_unknown;
       per_form[i].values[SUFFIX4] = per_form[i].values[SUFFIX5] = per_form[i].values[SUFFIX6] = elementary_feature_unknown;
       per_form[i].values[SUFFIX7] = per_form[i].values[SUFFIX8] = per_form[i].values[SUFFIX9] = elementary_feature_unknown;
-    } else if (forms[i].len <= 0) {
-      per_form[i].values[NUM] = per_form[i].values[CAP] = per_form[i].values[DASH] = elementary_feature_empty + 1;
-      per_form[i].values[PREFIX1] = per_form[i].values[PREFIX2] = per_form[i].values[PREFIX3] = elementary_feature_empty;
-      per_form[i].values[PREFIX4] = per_form[i].values[PREFIX5] = per_form[i].values[PREFIX6] = elementary_feature_empty;
-      per_form[i].values[PREFIX7] = per_form[i].values[PREFIX8] = per_form[i].values[PREFIX9] = elementary_feature_empty;
-      per_form[i].values[SUFFIX1] = per_form[i].values[SUFFIX2] = per_form[i].values[SUFFIX3] = elementary_feature_empty;
-      per_form[i].values[SUFFIX4] = per_form[i].values[SUFFIX5] = per_form[i].values[SUFFIX6] = elementary_feature_empty;
-      per_form[i].values[SUFFIX7] = per_form[i].values[SUFFIX8] = per_form[i].values[SUFFIX9] = elementary_feature_empty;
-    } else {
-      string_piece form = forms[i];
-      const char* form_start = form.str;
-
-      bool num = false, cap = false, dash = false;
-      size_t indices[18] = {0, form.len, form.len, form.len, form.len, form.len, form.len, form.len, form.len, form.len, 0, 0, 0, 0, 0, 0, 0, 0}; // careful here regarding forms shorter than 9 characters
-      int index = 0;
-      while (form.len) {
-        indices[(index++) % 18] = form.str - form_start;
-
-        unicode::category_t cat = unicode::category(utf8::decode(form.str, form.len));
-        num = num || cat & unicode::N;
-        cap = cap || cat & unicode::Lut;
-        dash = dash || cat & unicode::Pd;
-
-        if (index == 10 || (!form.len && index < 10)) {
-          per_form[i].values[PREFIX1] = maps[MAP_PREFIX1].value(form_start, indices[1]);
-          per_form[i].values[PREFIX2] = maps[MAP_PREFIX2].value(form_start, indices[2]);
-          per_form[i].values[PREFIX3] = maps[MAP_PREFIX3].value(form_start, indices[3]);
-          per_form[i].values[PREFIX4] = maps[MAP_PREFIX4].value(form_start, indices[4]);
-          per_form[i].values[PREFIX5] = maps[MAP_PREFIX5].value(form_start, indices[5]);
-          per_form[i].values[PREFIX6] = maps[MAP_PREFIX6].value(form_start, indices[6]);
-          per_form[i].values[PREFIX7] = maps[MAP_PREFIX7].value(form_start, indices[7]);
-          per_form[i].values[PREFIX8] = maps[MAP_PREFIX8].value(form_start, indices[8]);
-          per_form[i].values[PREFIX9] = maps[MAP_PREFIX9].value(form_start, indices[9]);
-        }
+    }
+  }
+}
+
+template <class Map>
+void conllu_elementary_features<Map>::compute_form_features(string_piece form, bool ortographic, per_form_features& per_form) const {
+  using namespace unilib;
+
+  per_form.values[FORM] = maps[MAP_FORM].value(form.str, form.len);
+  if (!ortographic) return;
+
+  if (form.len <= 0) {
+    per_form.values[NUM] = per_form.values[CAP] = per_form.values[DASH] = elementary_feature_empty + 1;
+    per_form.values[PREFIX1] = per_form.values[PREFIX2] = per_form.values[PREFIX3] = elementary_feature_empty;
+    per_form.values[PREFIX4] = per_form.values[PREFIX5] = per_form.values[PREFIX6] = elementary_feature_empty;
+    per_form.values[PREFIX7] = per_form.values[PREFIX8] = per_form.values[PREFIX9] = elementary_feature_empty;
+    per_form.values[SUFFIX1] = per_form.values[SUFFIX2] = per_form.values[SUFFIX3] = elementary_feature_empty;
+    per_form.values[SUFFIX4] = per_form.values[SUFFIX5] = per_form.values[SUFFIX6] = elementary_feature_empty;
+    per_form.values[SUFFIX7] = per_form.values[SUFFIX8] = per_form.values[SUFFIX9] = elementary_feature_empty;
+  } else {
+    const char* form_start = form.str;
+
+    bool num = false, cap = false, dash = false;
+    size_t indices[18] = {0, form.len, form.len, form.len, form.len, form.len, form.len, form.len, form.len, form.len, 0, 0, 0, 0, 0, 0, 0, 0}; // careful here regarding forms shorter than 9 characters
+    int index = 0;
+    while (form.len) {
+      indices[(index++) % 18] = form.str - form_start;
+
+      unicode::category_t cat = unicode::category(utf8::decode(form.str, form.len));
+      num = num || cat & unicode::N;
+      cap = cap || cat & unicode::Lut;
+      dash = dash || cat & unicode::Pd;
+
+      if (index == 10 || (!form.len && index < 10)) {
+        per_form.values[PREFIX1] = maps[MAP_PREFIX1].value(form_start, indices[1]);
+        per_form.values[PREFIX2] = maps[MAP_PREFIX2].value(form_start, indices[2]);
+        per_form.values[PREFIX3] = maps[MAP_PREFIX3].value(form_start, indices[3]);
+        per_form.values[PREFIX4] = maps[MAP_PREFIX4].value(form_start, indices[4]);
+        per_form.values[PREFIX5] = maps[MAP_PREFIX5].value(form_start, indices[5]);
+        per_form.values[PREFIX6] = maps[MAP_PREFIX6].value(form_start, indices[6]);
+        per_form.values[PREFIX7] = maps[MAP_PREFIX7].value(form_start, indices[7]);
+        per_form.values[PREFIX8] = maps[MAP_PREFIX8].value(form_start, indices[8]);
+        per_form.values[PREFIX9] = maps[MAP_PREFIX9].value(form_start, indices[9]);
       }
-      per_form[i].values[SUFFIX1] = maps[MAP_SUFFIX1].value(form_start + indices[(index+18-1) % 18], form.str - form_start - indices[(index+18-1) % 18]);
-      per_form[i].values[SUFFIX2] = maps[MAP_SUFFIX2].value(form_start + indices[(index+18-2) % 18], form.str - form_start - indices[(index+18-2) % 18]);
-      per_form[i].values[SUFFIX3] = maps[MAP_SUFFIX3].value(form_start + indices[(index+18-3) % 18], form.str - form_start - indices[(index+18-3) % 18]);
-      per_form[i].values[SUFFIX4] = maps[MAP_SUFFIX4].value(form_start + indices[(index+18-4) % 18], form.str - form_start - indices[(index+18-4) % 18]);
-      per_form[i].values[SUFFIX5] = maps[MAP_SUFFIX5].value(form_start + indices[(index+18-5) % 18], form.str - form_start - indices[(index+18-5) % 18]);
-      per_form[i].values[SUFFIX6] = maps[MAP_SUFFIX6].value(form_start + indices[(index+18-6) % 18], form.str - form_start - indices[(index+18-6) % 18]);
-      per_form[i].values[SUFFIX7] = maps[MAP_SUFFIX7].value(form_start + indices[(index+18-7) % 18], form.str - form_start - indices[(index+18-7) % 18]);
-      per_form[i].values[SUFFIX8] = maps[MAP_SUFFIX8].value(form_start + indices[(index+18-8) % 18], form.str - form_start - indices[(index+18-8) % 18]);
-      per_form[i].values[SUFFIX9] = maps[MAP_SUFFIX9].value(form_start + indices[(index+18-9) % 18], form.str - form_start - indices[(index+18-9) % 18]);
-      per_form[i].values[NUM] = elementary_feature_empty + 1 + num;
-      per_form[i].values[CAP] = elementary_feature_empty + 1 + cap;
-      per_form[i].values[DASH] = elementary_feature_empty + 1 + dash;
     }
+    per_form.values[SUFFIX1] = maps[MAP_SUFFIX1].value(form_start + indices[(index+18-1) % 18], form.str - form_start - indices[(index+18-1) % 18]);
+    per_form.values[SUFFIX2] = maps[MAP_SUFFIX2].value(form_start + indices[(index+18-2) % 18], form.str - form_start - indices[(index+18-2) % 18]);
+    per_form.values[SUFFIX3] = maps[MAP_SUFFIX3].value(form_start + indices[(index+18-3) % 18], form.str - form_start - indices[(index+18-3) % 18]);
+    per_form.values[SUFFIX4] = maps[MAP_SUFFIX4].value(form_start + indices[(index+18-4) % 18], form.str - form_start - indices[(index+18-4) % 18]);
+    per_form.values[SUFFIX5] = maps[MAP_SUFFIX5].value(form_start + indices[(index+18-5) % 18], form.str - form_start - indices[(index+18-5) % 18]);
+    per_form.values[SUFFIX6] = maps[MAP_SUFFIX6].value(form_start + indices[(index+18-6) % 18], form.str - form_start - indices[(index+18-6) % 18]);
+    per_form.values[SUFFIX7] = maps[MAP_SUFFIX7].value(form_start + indices[(index+18-7) % 18], form.str - form_start - indices[(index+18-7) % 18]);
+    per_form.values[SUFFIX8] = maps[MAP_SUFFIX8].value(form_start + indices[(index+18-8) % 18], form.str - form_start - indices[(index+18-8) % 18]);
+    per_form.values[SUFFIX9] = maps[MAP_SUFFIX9].value(form_start + indices[(index+18-9) % 18], form.str - form_start - indices[(index+18-9) % 18]);
+    per_form.values[NUM] = elementary_feature_empty + 1 + num;
+    per_form.values[CAP] = elementary_feature_empty + 1 + cap;
+    per_form.values[DASH] = elementary_feature_empty + 1 + dash;
   }
 }
 
@@ -10,6 +10,7 @@
 #pragma once
 
 #include "elementary_features.h"
+#include "per_form_features_cache.h"
 #include "unilib/unicode.h"
 #include "unilib/utf8.h"
 #include "viterbi.h"
@@ -38,7 +39,14 @@ class czech_elementary_features : public elementary_features<Map> {
   void compute_features(const vector<string_piece>& forms, const vector<vector<tagged_lemma>>& analyses, vector<per_form_features>& per_form, vector<vector<per_tag_features>>& per_tag) const;
   inline void compute_dynamic_features(const tagged_lemma& tag, const per_form_features& per_form, const per_tag_features& per_tag, const dynamic_features* prev_dynamic, dynamic_features& dynamic) const;
 
+  // Optional cache of the per-form features depending only on the form,
+  // shared by the copies of the features
+  shared_ptr<per_form_features_cache<per_form_features>> form_cache;
+
   using elementary_features<Map>::maps;
+
+ private:
+  void compute_form_features(string_piece form, bool ortographic, per_form_features& per_form) const;
 };
 
 typedef czech_elementary_features<persistent_elementary_feature_map> persistent_czech_elementary_features;
@@ -79,8 +87,6 @@ vector<elementary_feature_description> czech_elementary_features<Map>::descripti
 
 template <class Map>
 void czech_elementary_features<Map>::compute_features(const vector<string_piece>& forms, const vector<vector<tagged_lemma>>& analyses, vector<per_form_features>& per_form, vector<vector<per_tag_features>>& per_tag) const {
-  using namespace unilib;
-
   // We process the sentence in reverse order, so that we can compute FollowingVerbTag and FollowingVerbLemma directly.
   elementary_feature_value following_verb_tag = elementary_feature_empty, following_verb_lemma = elementary_feature_empty;
   for (unsigned i = forms.size(); i--;) {
@@ -102,8 +108,14 @@ void czech_elementary_features<Map>::compute_features(const vector<string_piece>
       }
     }
 
-    // Per_form features
-    per_form[i].values[FORM] = maps[MAP_FORM].value(forms[i].str, forms[i].len);
+    // Per_form features, the ones depending only on the form possibly cached.
+    // The cached entries contain the ortographic features even if they are
+    // not needed for the current form.
+    bool ortographic = analyses[i].size() != 1;
+    if (!form_cache || !form_cache->find(forms[i], per_form[i])) {
+      compute_form_features(forms[i], ortographic || form_cache, per_form[i]);
+      if (form_cache) form_cache->insert(forms[i], per_form[i]);
+    }
     per_form[i].values[FOLLOWING_VERB_TAG] = following_verb_tag;
     per_form[i].values[FOLLOWING_VERB_LEMMA] = following_verb_lemma;
 
@@ -113,45 +125,54 @@ void czech_elementary_features<Map>::compute_features(const vector<string_piece>
       following_verb_lemma = per_tag[i][verb_candidate].values[LEMMA];
     }
 
-    // Ortographic per_form features if needed
-    if (analyses[i].size() == 1) {
+    // Ortographic per_form features are needed only for ambiguous forms
+    if (!ortographic) {
       per_form[i].values[NUM] = per_form[i].values[CAP] = per_form[i].values[DASH] = elementary_feature_unknown;
       per_form[i].values[PREFIX1] = per_form[i].values[PREFIX2] = per_form[i].values[PREFIX3] = per_form[i].values[PREFIX4] = elementary_feature_unknown;
       per_form[i].values[SUFFIX1] = per_form[i].values[SUFFIX2] = per_form[i].values[SUFFIX3] = per_form[i].values[SUFFIX4] = elementary_feature_unknown;
-    } else if (forms[i].len <= 0) {
-      per_form[i].values[NUM] = per_form[i].values[CAP] = per_form[i].values[DASH] = elementary_feature_empty + 1;
-      per_form[i].values[PREFIX1] = per_form[i].values[PREFIX2] = per_form[i].values[PREFIX3] = per_form[i].values[PREFIX4] = elementary_feature_empty;
-      per_form[i].values[SUFFIX1] = per_form[i].values[SUFFIX2] = per_form[i].values[SUFFIX3] = per_form[i].values[SUFFIX4] = elementary_feature_empty;
-    } else {
-      string_piece form = forms[i];
-      const char* form_start = form.str;
-
-      bool num = false, cap = false, dash = false;
-      size_t indices[8] = {0, form.len, form.len, form.len, form.len, 0, 0, 0}; // careful here regarding forms shorter than 4 characters
-      int index = 0;
-      while (form.len) {
-        indices[(index++)&7] = form.str - form_start;
-
-        unicode::category_t cat = unicode::category(utf8::decode(form.str, form.len));
-        num = num || cat & unicode::N;
-        cap = cap || cat & unicode::Lut;
-        dash = dash || cat & unicode::Pd;
-
-        if (index == 5 || (!form.len && index < 5)) {
-          per_form[i].values[PREFIX1] = maps[MAP_PREFIX1].value(form_start, indices[1]);
-          per_form[i].values[PREFIX2] = maps[MAP_PREFIX2].value(form_start, indices[2]);
-          per_form[i].values[PREFIX3] = maps[MAP_PREFIX3].value(form_start, indices[3]);
-          per_form[i].values[PREFIX4] = maps[MAP_PREFIX4].value(form_start, indices[4]);
-        }
+    }
+  }
+}
+
+template <class Map>
+void czech_elementary_features<Map>::compute_form_features(string_piece form, bool ortographic, per_form_features& per_form) const {
+  using namespace unilib;
+
+  per_form.values[FORM] = maps[MAP_FORM].value(form.str, form.len);
+  if (!ortographic) return;
+
+  if (form.len <= 0) {
+    per_form.values[NUM] = per_form.values[CAP] = per_form.values[DASH] = elementary_feature_empty + 1;
+    per_form.values[PREFIX1] = per_form.values[PREFIX2] = per_form.values[PREFIX3] = per_form.values[PREFIX4] = elementary_feature_empty;
+    per_form.values[SUFFIX1] = per_form.values[SUFFIX2] = per_form.values[SUFFIX3] = per_form.values[SUFFIX4] = elementary_feature_empty;
+  } else {
+    const char* form_start = form.str;
+
+    bool num = false, cap = false, dash = false;
+    size_t indices[8] = {0, form.len, form.len, form.len, form.len, 0, 0, 0}; // careful here regarding forms shorter than 4 characters
+    int index = 0;
+    while (form.len) {
+      indices[(index++)&7] = form.str - form_start;
+
+      unicode::category_t cat = unicode::category(utf8::decode(form.str, form.len));
+      num = num || cat & unicode::N;
+      cap = cap || cat & unicode::Lut;
+      dash = dash || cat & unicode::Pd;
+
+      if (index == 5 || (!form.len && index < 5)) {
+        per_form.values[PREFIX1] = maps[MAP_PREFIX1].value(form_start, indices[1]);
+        per_form.values[PREFIX2] = maps[MAP_PREFIX2].value(form_start, indices[2]);
+        per_form.values[PREFIX3] = maps[MAP_PREFIX3].value(form_start, indices[3]);
+        per_form.values[PREFIX4] = maps[MAP_PREFIX4].value(form_start, indices[4]);
       }
-      per_form[i].values[SUFFIX1] = maps[MAP_SUFFIX1].value(form_start + indices[(index-1)&7], form.str - form_start - indices[(index-1)&7]);
-      per_form[i].values[SUFFIX2] = maps[MAP_SUFFIX2].value(form_start + indices[(index-2)&7], form.str - form_start - indices[(index-2)&7]);
-      per_form[i].values[SUFFIX3] = maps[MAP_SUFFIX3].value(form_start + indices[(index-3)&7], form.str - form_start - indices[(index-3)&7]);
-      per_form[i].values[SUFFIX4] = maps[MAP_SUFFIX4].value(form_start + indices[(index-4)&7], form.str - form_start - indices[(index-4)&7]);
-      per_form[i].values[NUM] = elementary_feature_empty + 1 + num;
-      per_form[i].values[CAP] = elementary_feature_empty + 1 + cap;
-      per_form[i].values[DASH] = elementary_feature_empty + 1 + dash;
     }
+    per_form.values[SUFFIX1] = maps[MAP_SUFFIX1].value(form_start + indices[(index-1)&7], form.str - form_start - indices[(index-1)&7]);
+    per_form.values[SUFFIX2] = maps[MAP_SUFFIX2].value(form_start + indices[(index-2)&7], form.str - form_start - indices[(index-2)&7]);
+    per_form.values[SUFFIX3] = maps[MAP_SUFFIX3].value(form_start + indices[(index-3)&7], form.str - form_start - indices[(index-3)&7]);
+    per_form.values[SUFFIX4] = maps[MAP_SUFFIX4].value(form_start + indices[(index-4)&7], form.str - form_start - indices[(index-4)&7]);
+    per_form.values[NUM] = elementary_feature_empty + 1 + num;
+    per_form.values[CAP] = elementary_feature_empty + 1 + cap;
+    per_form.values[DASH] = elementary_feature_empty + 1 + dash;
   }
 }
 
@@ -49,6 +49,8 @@ class persistent_elementary_feature_map : public persistent_unordered_map {
   persistent_elementary_feature_map() : persistent_unordered_map() {}
   persistent_elementary_feature_map(const persistent_unordered_map&& map) : persistent_unordered_map(map) {}
 
+  void load(binary_decoder& data) { load_typed<elementary_feature_value>(data); }
+
   elementary_feature_value value(const char* feature, int len) const {
     auto* it = at_typed<elementary_feature_value>(feature, len);
     return it ? unaligned_load<elementary_feature_value>(it) : elementary_feature_unknown;
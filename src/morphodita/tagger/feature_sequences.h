@@ -52,9 +52,13 @@ class feature_sequences {
 
   struct cache;
 
+  // Caches retain elementary features of at most this number of forms after
+  // an outlier sentence is followed by a shorter one
+  enum { MAX_RETAINED_FORMS = 1024 };
+
   inline void initialize_sentence(const vector<string_piece>& forms, const vector<vector<tagged_lemma>>& analyses, cache& c) const;
   inline void compute_dynamic_features(int form_index, int tag_index, const dynamic_features* prev_dynamic, dynamic_features& dynamic, cache& c) const;
-  inline feature_sequences_score score(int form_index, int tags_window[], int tags_unchanged, dynamic_features& dynamic, cache& c) const;
+  inline feature_sequences_score score(int form_index, int tags_window[], int tags_unchanged, dynamic_features& dynamic, cache& c, bool use_memo = true) const;
   void feature_keys(int form_index, int tags_window[], int tags_unchanged, dynamic_features& dynamic, vector<string>& keys, cache& c) const;
 
   ElementaryFeatures elementary;
@@ -67,10 +71,30 @@ class persistent_feature_sequence_map : public persistent_unordered_map {
   persistent_feature_sequence_map() : persistent_unordered_map() {}
   persistent_feature_sequence_map(const persistent_unordered_map&& map) : persistent_unordered_map(map) {}
 
+  void load(binary_decoder& data) { int16_scale = 0; load_typed<feature_sequence_score>(data); }
+  void load_int16(binary_decoder& data) { int16_scale = data.next_4B(); load_typed<int16_t>(data); }
+  inline void save(binary_encoder& enc);
+
+  // Store the scores as int16 multiplied by a per-map scale, rounding them to
+  // the nearest multiple of the scale and dropping the ones rounded to zero
+  inline void quantize_int16();
+
   feature_sequence_score score(const char* feature, int len) const {
+    if (int16_scale) {
+      auto* it = at_typed<int16_t>(feature, len);
+      return it ? feature_sequence_score(unaligned_load<int16_t>(it)) * int16_scale : 0;
+    }
     auto* it = at_typed<feature_sequence_score>(feature, len);
     return it ? unaligned_load<feature_sequence_score>(it) : 0;
   }
+
+  // The scale of int16 scores, zero if the scores are stored as int32
+  feature_sequence_score int16_scale = 0;
+
+  // Feature sequences with int16 scores store this marker instead of the
+  // number of the score maps, followed by their number. Therefore, they
+  // cannot have exactly this number of sequences.
+  enum { INT16_SCORES_MARKER = 0xFF };
 };
 
 template <class ElementaryFeatures> using persistent_feature_sequences = feature_sequences<ElementaryFeatures, persistent_feature_sequence_map>;
@@ -96,9 +120,17 @@ inline bool feature_sequences<ElementaryFeatures, Map>::load(istream& is) {
       }
     }
 
-    scores.resize(data.next_1B());
+    unsigned scores_size = data.next_1B();
+    bool int16_scores = scores_size == persistent_feature_sequence_map::INT16_SCORES_MARKER &&
+        sequences.size() != persistent_feature_sequence_map::INT16_SCORES_MARKER;
+    if (int16_scores) scores_size = data.next_1B();
+
+    scores.resize(scores_size);
     for (auto&& score : scores)
-      score.load(data);
+      if (int16_scores)
+        score.load_int16(data);
+      else
+        score.load(data);
   } catch (binary_decoder_error&) {
     return false;
   }
@@ -121,23 +153,68 @@ struct feature_sequences<ElementaryFeatures, Map>::cache {
     cache_element(int elements) : key(vli<elementary_feature_value>::max_length() * elements), key_size(0), score(0) {}
   };
   vector<cache_element> caches;
+  struct cache_changed {
+    unsigned sequence;
+    bool memoize;
+    uint64_t memo_key;
+  };
+  vector<cache_changed> caches_changed;
   vector<const per_tag_features*> window;
   vector<char> key;
   feature_sequences_score score;
 
-  cache(const feature_sequences<ElementaryFeatures, Map>& self) : score(0) {
+  // Per-sentence direct-mapped memo of scores of sequences without dynamic
+  // elements, which depend only on the form index and the tags window of
+  // memo_depth tags. The entries are invalidated by changing memo_generation.
+  enum { MEMO_BITS = 12, MEMO_TAG_BITS = 8, MEMO_MAX_DEPTH = 4 };
+  struct memo_entry {
+    uint64_t key;
+    unsigned generation;
+    feature_sequence_score score;
+  };
+  vector<memo_entry> memo;
+  unsigned memo_generation;
+  vector<int> memo_depth;
+
+  cache(const feature_sequences<ElementaryFeatures, Map>& self) : score(0), memo(1 << MEMO_BITS, memo_entry{0, 0, 0}), memo_generation(0) {
     caches.reserve(self.sequences.size());
+    caches_changed.reserve(self.sequences.size());
+    memo_depth.reserve(self.sequences.size());
     int max_sequence_elements = 0, max_window_size = 1;
     for (auto&& sequence : self.sequences) {
       caches.emplace_back(int(sequence.elements.size()));
       if (int(sequence.elements.size()) > max_sequence_elements) max_sequence_elements = sequence.elements.size();
-      for (auto&& element : sequence.elements)
+      int depth = 1;
+      for (auto&& element : sequence.elements) {
         if (element.type == PER_TAG && 1 - element.sequence_index > max_window_size)
           max_window_size = 1 - element.sequence_index;
+        if (element.type == PER_TAG && 1 - element.sequence_index > depth)
+          depth = 1 - element.sequence_index;
+        if (element.type == DYNAMIC)
+          depth = MEMO_MAX_DEPTH + 1;
+      }
+      memo_depth.push_back(depth <= MEMO_MAX_DEPTH && memo_depth.size() < 1023 ? depth : -1);
     }
     key.resize(max_sequence_elements * vli<elementary_feature_value>::max_length());
     window.resize(max_window_size);
   }
+
+  // Returns false if the sequence in the given context cannot be memoized
+  inline bool memo_key(unsigned sequence, int form_index, const int tags_window[], uint64_t& key) const {
+    int depth = memo_depth[sequence];
+    if (depth < 0 || form_index >= (1 << 22)) return false;
+
+    key = (uint64_t(sequence) << 54) | (uint64_t(form_index) << 32);
+    for (int i = 0; i < depth && i <= form_index; i++) {
+      if (tags_window[i] >= (1 << MEMO_TAG_BITS)) return false;
+      key |= uint64_t(tags_window[i]) << (MEMO_TAG_BITS * i);
+    }
+    return true;
+  }
+
+  inline memo_entry& memo_slot(uint64_t key) {
+    return memo[(key * 0x9E3779B97F4A7C15ULL) >> (64 - MEMO_BITS)];
+  }
 };
 
 template <class ElementaryFeatures, class Map>
@@ -146,7 +223,14 @@ void feature_sequences<ElementaryFeatures, Map>::initialize_sentence(const vecto
   c.forms = &forms;
   c.analyses = &analyses;
 
-  // Enlarge elementary features vectors if needed
+  // Release elementary features of outlier sentences, then enlarge the
+  // elementary features vectors if needed
+  if (c.elementary_per_tag.size() > MAX_RETAINED_FORMS && forms.size() * 2 < c.elementary_per_tag.size()) {
+    c.elementary_per_form.resize(max(forms.size() * 2, size_t(MAX_RETAINED_FORMS)));
+    c.elementary_per_form.shrink_to_fit();
+    c.elementary_per_tag.resize(max(forms.size() * 2, size_t(MAX_RETAINED_FORMS)));
+    c.elementary_per_tag.shrink_to_fit();
+  }
   if (forms.size() > c.elementary_per_form.size()) c.elementary_per_form.resize(forms.size() * 2);
   if (forms.size() > c.elementary_per_tag.size()) c.elementary_per_tag.resize(forms.size() * 2);
   for (unsigned i = 0; i < forms.size(); i++)
@@ -156,10 +240,15 @@ void feature_sequences<ElementaryFeatures, Map>::initialize_sentence(const vecto
   // Compute elementary features
   elementary.compute_features(forms, analyses, c.elementary_per_form, c.elementary_per_tag);
 
-  // Clear score cache, because scores may have been modified
+  // Clear score cache and memo, because scores may have been modified
   c.score = 0;
   for (auto&& cache : c.caches)
     cache.key_size = cache.score = 0;
+  if (!++c.memo_generation) {
+    for (auto&& entry : c.memo)
+      entry.generation = 0;
+    c.memo_generation = 1;
+  }
 }
 
 template <class ElementaryFeatures, class Map>
@@ -168,17 +257,32 @@ void feature_sequences<ElementaryFeatures, Map>::compute_dynamic_features(int fo
 }
 
 template <class ElementaryFeatures, class Map>
-feature_sequences_score feature_sequences<ElementaryFeatures, Map>::score(int form_index, int tags_window[], int tags_unchanged, dynamic_features& dynamic, cache& c) const {
+feature_sequences_score feature_sequences<ElementaryFeatures, Map>::score(int form_index, int tags_window[], int tags_unchanged, dynamic_features& dynamic, cache& c, bool use_memo) const {
   // Start by creating a window of per_tag_features*
   for (int i = 0; i < int(c.window.size()) && form_index - i >= 0; i++)
     c.window[i] = &c.elementary_per_tag[form_index - i][tags_window[i]];
 
-  // Compute the score
+  // Compute the score. First the keys of all sequences are generated and the
+  // changed ones are prefetched, then they are looked up together.
   feature_sequences_score result = c.score;
+  c.caches_changed.clear();
   for (unsigned i = 0; i < sequences.size(); i++) {
     if (tags_unchanged >= sequences[i].dependant_range)
       break;
 
+    // Use the memoized score if available. The cached key is then invalid.
+    uint64_t memo_key = 0;
+    bool memoize = use_memo && c.memo_key(i, form_index, tags_window, memo_key);
+    if (memoize) {
+      auto& entry = c.memo_slot(memo_key);
+      if (entry.generation == c.memo_generation && entry.key == memo_key) {
+        result += entry.score - c.caches[i].score;
+        c.caches[i].score = entry.score;
+        c.caches[i].key_size = -1;
+        continue;
+      }
+    }
+
     char* key = c.key.data();
     for (unsigned j = 0; j < sequences[i].elements.size(); j++) {
       auto& element = sequences[i].elements[j];
@@ -203,17 +307,27 @@ feature_sequences_score feature_sequences<ElementaryFeatures, Map>::score(int fo
       vli<elementary_feature_value>::encode(value, key);
     }
 
-    result -= c.caches[i].score;
     int key_size = key - c.key.data();
     if (!key_size) {
+      result -= c.caches[i].score;
       c.caches[i].score = 0;
       c.caches[i].key_size = 0;
     } else if (key_size != c.caches[i].key_size || !small_memeq(c.key.data(), c.caches[i].key.data(), key_size)) {
-      c.caches[i].score = scores[i].score(c.key.data(), key_size);
+      result -= c.caches[i].score;
       c.caches[i].key_size = key_size;
       small_memcpy(c.caches[i].key.data(), c.key.data(), key_size);
+      scores[i].prefetch(c.caches[i].key.data(), key_size);
+      c.caches_changed.push_back({i, memoize, memo_key});
+      continue;
     }
-    result += c.caches[i].score;
+    if (memoize) c.memo_slot(memo_key) = {memo_key, c.memo_generation, c.caches[i].score};
+  }
+
+  for (auto&& changed : c.caches_changed) {
+    auto& cache = c.caches[changed.sequence];
+    cache.score = scores[changed.sequence].score(cache.key.data(), cache.key_size);
+    result += cache.score;
+    if (changed.memoize) c.memo_slot(changed.memo_key) = {changed.memo_key, c.memo_generation, cache.score};
   }
 
   c.score = result;
@@ -222,7 +336,7 @@ feature_sequences_score feature_sequences<ElementaryFeatures, Map>::score(int fo
 
 template <class ElementaryFeatures, class Map>
 void feature_sequences<ElementaryFeatures, Map>::feature_keys(int form_index, int tags_window[], int tags_unchanged, dynamic_features& dynamic, vector<string>& keys, cache& c) const {
-  score(form_index, tags_window, tags_unchanged, dynamic, c);
+  score(form_index, tags_window, tags_unchanged, dynamic, c, false);
 
   keys.resize(c.caches.size());
   for (unsigned i = 0; i < c.caches.size(); i++)
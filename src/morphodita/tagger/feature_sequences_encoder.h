@@ -10,6 +10,7 @@
 #pragma once
 
 #include <algorithm>
+#include <cmath>
 
 #include "common.h"
 #include "feature_sequences.h"
@@ -79,6 +80,10 @@ inline bool feature_sequences<ElementaryFeatures, Map>::save(ostream& os) {
     }
   }
 
+  if (!scores.empty() && scores.front().int16_scale) {
+    if (sequences.size() == persistent_feature_sequence_map::INT16_SCORES_MARKER) return false;
+    enc.add_1B(persistent_feature_sequence_map::INT16_SCORES_MARKER);
+  }
   enc.add_1B(scores.size());
   for (auto&& score : scores)
     score.save(enc);
@@ -86,6 +91,35 @@ inline bool feature_sequences<ElementaryFeatures, Map>::save(ostream& os) {
   return compressor::save(os, enc);
 }
 
+void persistent_feature_sequence_map::save(binary_encoder& enc) {
+  if (int16_scale) enc.add_4B(int16_scale);
+  persistent_unordered_map::save(enc);
+}
+
+void persistent_feature_sequence_map::quantize_int16() {
+  if (int16_scale) return;
+
+  unordered_map<string, feature_sequence_score> map;
+  int64_t max_score = 0;
+  iter_all([&map, &max_score](const char* key, int len, pointer_decoder& data) {
+    feature_sequence_score score = unaligned_load<feature_sequence_score>(data.next<feature_sequence_score>(1));
+    map.emplace(string(key, len), score);
+    max_score = max(max_score, score < 0 ? -int64_t(score) : int64_t(score));
+  });
+
+  feature_sequence_score scale = max(feature_sequence_score(1), feature_sequence_score((max_score + 32766) / 32767));
+  for (auto it = map.begin(); it != map.end(); )
+    if (!(it->second = feature_sequence_score(lround(it->second / double(scale)))))
+      it = map.erase(it);
+    else
+      it++;
+
+  *this = persistent_feature_sequence_map(persistent_unordered_map(map, 1, [](binary_encoder& enc, feature_sequence_score score) {
+    enc.add_2B(uint16_t(int16_t(score)));
+  }));
+  int16_scale = scale;
+}
+
 } // namespace morphodita
 } // namespace nametag
 } // namespace ufal
@@ -0,0 +1,124 @@
+// This file is part of MorphoDiTa <http://github.com/ufal/morphodita/>.
+//
+// Copyright 2016 Institute of Formal and Applied Linguistics, Faculty of
+// Mathematics and Physics, Charles University in Prague, Czech Republic.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+
+#include "common.h"
+#include "utils/string_piece.h"
+
+namespace ufal {
+namespace nametag {
+namespace morphodita {
+
+// Bounded cache of the per-form elementary features depending only on the
+// form, which can be used concurrently by multiple threads. As in
+// morpho_analysis_cache, the entries are evicted using the CLOCK algorithm,
+// separately in several independently locked shards.
+template <class PerFormFeatures>
+class per_form_features_cache {
+ public:
+  inline per_form_features_cache(size_t capacity);
+
+  // Returns false if the features of the form are not cached, filling the
+  // features otherwise.
+  inline bool find(string_piece form, PerFormFeatures& features);
+  inline void insert(string_piece form, const PerFormFeatures& features);
+
+  inline size_t hits() const { return hits_count.load(memory_order_relaxed); }
+  inline size_t misses() const { return misses_count.load(memory_order_relaxed); }
+
+ private:
+  enum { SHARDS = 16 };
+
+  struct entry {
+    string key;
+    PerFormFeatures features;
+    bool referenced;
+  };
+  struct shard {
+    mutex lock;
+    unordered_map<string, unsigned> index;
+    vector<entry> entries;
+    size_t capacity = 0;
+    unsigned hand = 0;
+  };
+  shard shards[SHARDS];
+
+  atomic<size_t> hits_count, misses_count;
+
+  inline shard& key_shard(const string& key);
+};
+
+template <class PerFormFeatures>
+per_form_features_cache<PerFormFeatures>::per_form_features_cache(size_t capacity) : hits_count(0), misses_count(0) {
+  for (unsigned i = 0; i < SHARDS; i++)
+    shards[i].capacity = capacity / SHARDS + (i < capacity % SHARDS);
+}
+
+template <class PerFormFeatures>
+bool per_form_features_cache<PerFormFeatures>::find(string_piece form, PerFormFeatures& features) {
+  string key(form.str, form.len);
+
+  auto& shard = key_shard(key);
+  {
+    lock_guard<mutex> guard(shard.lock);
+    auto it = shard.index.find(key);
+    if (it != shard.index.end()) {
+      auto& entry = shard.entries[it->second];
+      entry.referenced = true;
+      features = entry.features;
+      hits_count.fetch_add(1, memory_order_relaxed);
+      return true;
+    }
+  }
+
+  misses_count.fetch_add(1, memory_order_relaxed);
+  return false;
+}
+
+template <class PerFormFeatures>
+void per_form_features_cache<PerFormFeatures>::insert(string_piece form, const PerFormFeatures& features) {
+  string key(form.str, form.len);
+
+  auto& shard = key_shard(key);
+  lock_guard<mutex> guard(shard.lock);
+  if (!shard.capacity || shard.index.count(key)) return;
+
+  if (shard.entries.size() < shard.capacity) {
+    shard.index.emplace(key, shard.entries.size());
+    shard.entries.push_back({key, features, false});
+    return;
+  }
+
+  // Find an entry not referenced since the hand passed it last time
+  while (shard.entries[shard.hand].referenced) {
+    shard.entries[shard.hand].referenced = false;
+    shard.hand = (shard.hand + 1) % shard.entries.size();
+  }
+
+  auto& entry = shard.entries[shard.hand];
+  shard.index.erase(entry.key);
+  shard.index.emplace(key, shard.hand);
+  entry.key = key;
+  entry.features = features;
+  shard.hand = (shard.hand + 1) % shard.entries.size();
+}
+
+template <class PerFormFeatures>
+typename per_form_features_cache<PerFormFeatures>::shard& per_form_features_cache<PerFormFeatures>::key_shard(const string& key) {
+  return shards[hash<string>()(key) % SHARDS];
+}
+
+} // namespace morphodita
+} // namespace nametag
+} // namespace ufal
@@ -7,6 +7,7 @@
 // License, v. 2.0. If a copy of the MPL was not distributed with this
 // file, You can obtain one at http://mozilla.org/MPL/2.0/.
 
+#include "morphodita/morpho/morpho_analysis_cache.h"
 #include "tagger.h"
 #include "utils/threadsafe_stack.h"
 #include "viterbi.h"
@@ -24,17 +25,32 @@ class perceptron_tagger : public tagger {
   bool load(istream& is);
   virtual const morpho* get_morpho() const override;
   virtual void tag(const vector<string_piece>& forms, vector<tagged_lemma>& tags, morpho::guesser_mode guesser = morpho::guesser_mode(-1)) const override;
+  virtual morpho::guesser_mode tag(const vector<string_piece>& forms, vector<tagged_lemma>& tags, vector<vector<tagged_lemma>>& analyses,
+                                   morpho::guesser_mode guesser = morpho::guesser_mode(-1)) const override;
+  virtual tagger_context* new_context() const override;
+  virtual morpho::guesser_mode tag(const vector<string_piece>& forms, vector<tagged_lemma>& tags, vector<vector<tagged_lemma>>& analyses,
+                                   tagger_context& context, morpho::guesser_mode guesser = morpho::guesser_mode(-1)) const override;
   virtual void tag_analyzed(const vector<string_piece>& forms, const vector<vector<tagged_lemma>>& analyses, vector<int>& tags) const override;
 
+  virtual void analyze(string_piece form, morpho::guesser_mode guesser, vector<tagged_lemma>& lemmas) const override;
+  virtual void set_analysis_cache(size_t forms) override;
+  virtual void analysis_cache_statistics(size_t& hits, size_t& misses) const override;
+  virtual void set_beam_size(int beam_size) override;
+  virtual void set_fast_mode(bool fast) override;
+  virtual size_t memory_usage() const override;
+
  private:
   int decoding_order, window_size;
 
   unique_ptr<morpho> dict;
   bool use_guesser;
+  unique_ptr<morpho_analysis_cache> analysis_cache;
+  int beam_size = 0;
+  bool fast_mode = false;
   FeatureSequences features;
   typedef viterbi<FeatureSequences> viterbi_decoder;
   viterbi_decoder decoder;
-  struct cache {
+  struct cache : public tagger_context {
     vector<string_piece> forms;
     vector<vector<tagged_lemma>> analyses;
     vector<int> tags;
@@ -44,6 +60,9 @@ class perceptron_tagger : public tagger {
   };
 
   mutable threadsafe_stack<cache> caches;
+
+  morpho::guesser_mode analyze_and_tag(const vector<string_piece>& forms, vector<tagged_lemma>& tags, vector<vector<tagged_lemma>>& analyses,
+                                       morpho::guesser_mode guesser, cache& c) const;
 };
 
 
@@ -74,21 +93,63 @@ void perceptron_tagger<FeatureSequences>::tag(const vector<string_piece>& forms,
   cache* c = caches.pop();
   if (!c) c = new cache(*this);
 
-  c->forms.resize(forms.size());
-  if (c->analyses.size() < forms.size()) c->analyses.resize(forms.size());
+  analyze_and_tag(forms, tags, c->analyses, guesser, *c);
+
+  caches.push(c);
+}
+
+template<class FeatureSequences>
+morpho::guesser_mode perceptron_tagger<FeatureSequences>::tag(const vector<string_piece>& forms, vector<tagged_lemma>& tags, vector<vector<tagged_lemma>>& analyses,
+                                                              morpho::guesser_mode guesser) const {
+  tags.clear();
+  if (!dict) return guesser;
+
+  cache* c = caches.pop();
+  if (!c) c = new cache(*this);
+
+  guesser = analyze_and_tag(forms, tags, analyses, guesser, *c);
+
+  caches.push(c);
+  return guesser;
+}
+
+template<class FeatureSequences>
+tagger_context* perceptron_tagger<FeatureSequences>::new_context() const {
+  return new cache(*this);
+}
+
+template<class FeatureSequences>
+morpho::guesser_mode perceptron_tagger<FeatureSequences>::tag(const vector<string_piece>& forms, vector<tagged_lemma>& tags, vector<vector<tagged_lemma>>& analyses,
+                                                              tagger_context& context, morpho::guesser_mode guesser) const {
+  tags.clear();
+  if (!dict) return guesser;
+
+  return analyze_and_tag(forms, tags, analyses, guesser, static_cast<cache&>(context));
+}
+
+template<class FeatureSequences>
+morpho::guesser_mode perceptron_tagger<FeatureSequences>::analyze_and_tag(const vector<string_piece>& forms, vector<tagged_lemma>& tags, vector<vector<tagged_lemma>>& analyses,
+                                                                          morpho::guesser_mode guesser, cache& c) const {
+  if (guesser < 0) guesser = use_guesser ? morpho::GUESSER : morpho::NO_GUESSER;
+
+  c.forms.resize(forms.size());
+  if (analyses.size() < forms.size()) analyses.resize(forms.size());
   for (unsigned i = 0; i < forms.size(); i++) {
-    c->forms[i] = forms[i];
-    c->forms[i].len = dict->raw_form_len(forms[i]);
-    dict->analyze(forms[i], guesser >= 0 ? guesser : use_guesser ? morpho::GUESSER : morpho::NO_GUESSER, c->analyses[i]);
+    c.forms[i] = forms[i];
+    c.forms[i].len = dict->raw_form_len(forms[i]);
+    analyze(forms[i], guesser, analyses[i]);
   }
 
-  if (c->tags.size() < forms.size()) c->tags.resize(forms.size() * 2);
-  decoder.tag(c->forms, c->analyses, c->decoder_cache, c->tags);
+  if (c.tags.size() < forms.size()) c.tags.resize(forms.size() * 2);
+  if (fast_mode)
+    fill(c.tags.begin(), c.tags.begin() + forms.size(), 0);
+  else
+    decoder.tag(c.forms, analyses, c.decoder_cache, c.tags, beam_size);
 
   for (unsigned i = 0; i < forms.size(); i++)
-    tags.emplace_back(c->analyses[i][c->tags[i]]);
+    tags.emplace_back(analyses[i][c.tags[i]]);
 
-  caches.push(c);
+  return guesser;
 }
 
 template<class FeatureSequences>
@@ -99,11 +160,52 @@ void perceptron_tagger<FeatureSequences>::tag_analyzed(const vector<string_piece
   if (!c) c = new cache(*this);
 
   tags.resize(forms.size());
-  decoder.tag(forms, analyses, c->decoder_cache, tags);
+  if (!fast_mode)
+    decoder.tag(forms, analyses, c->decoder_cache, tags, beam_size);
 
   caches.push(c);
 }
 
+template<class FeatureSequences>
+void perceptron_tagger<FeatureSequences>::analyze(string_piece form, morpho::guesser_mode guesser, vector<tagged_lemma>& lemmas) const {
+  if (!analysis_cache || !analysis_cache->find(form, guesser, lemmas)) {
+    dict->analyze(form, guesser, lemmas);
+    if (analysis_cache) analysis_cache->insert(form, guesser, lemmas);
+  }
+}
+
+template<class FeatureSequences>
+void perceptron_tagger<FeatureSequences>::set_analysis_cache(size_t forms) {
+  analysis_cache.reset(forms ? new morpho_analysis_cache(forms) : nullptr);
+  features.elementary.form_cache.reset(forms ? new per_form_features_cache<typename FeatureSequences::per_form_features>(forms) : nullptr);
+}
+
+template<class FeatureSequences>
+void perceptron_tagger<FeatureSequences>::analysis_cache_statistics(size_t& hits, size_t& misses) const {
+  hits = analysis_cache ? analysis_cache->hits() : 0;
+  misses = analysis_cache ? analysis_cache->misses() : 0;
+}
+
+template<class FeatureSequences>
+void perceptron_tagger<FeatureSequences>::set_beam_size(int beam_size) {
+  this->beam_size = beam_size;
+}
+
+template<class FeatureSequences>
+void perceptron_tagger<FeatureSequences>::set_fast_mode(bool fast) {
+  fast_mode = fast;
+}
+
+template<class FeatureSequences>
+size_t perceptron_tagger<FeatureSequences>::memory_usage() const {
+  size_t bytes = 0;
+  for (auto&& map : features.elementary.maps)
+    bytes += map.memory_usage();
+  for (auto&& map : features.scores)
+    bytes += map.memory_usage();
+  return bytes;
+}
+
 } // namespace morphodita
 } // namespace nametag
 } // namespace ufal
@@ -11,11 +11,18 @@
 
 #include "common.h"
 #include "morphodita/morpho/morpho.h"
+#include "utils/compressor.h"
 
 namespace ufal {
 namespace nametag {
 namespace morphodita {
 
+// Scratch state of tagging used by a single thread, see tagger::new_context.
+class tagger_context {
+ public:
+  virtual ~tagger_context() {}
+};
+
 class tagger {
  public:
   virtual ~tagger() {}
@@ -23,6 +30,14 @@ class tagger {
   static tagger* load(const char* fname);
   static tagger* load(istream& is);
 
+  // Re-encode the tagger model from the seekable stream, storing the scores
+  // of its feature sequences as int16 with a per-map scale.
+  static bool quantize_int16(istream& is, ostream& os);
+
+  // Re-encode the tagger model, storing all its blocks using the given codec.
+  // The dictionaries of stored blocks are then referenced in place on load.
+  static bool recompress(istream& is, ostream& os, compressor::codec codec);
+
   // Return morpho associated with the tagger. Do not delete the pointer, it is
   // owned by the tagger instance and deleted in the tagger destructor.
   virtual const morpho* get_morpho() const = 0;
@@ -30,9 +45,48 @@ class tagger {
   // Perform morphologic analysis and subsequent disambiguation.
   virtual void tag(const vector<string_piece>& forms, vector<tagged_lemma>& tags, morpho::guesser_mode guesser = morpho::GUESSER_UNSPECIFIED) const = 0;
 
+  // Perform morphologic analysis and subsequent disambiguation, returning also
+  // all analyses of the forms. Returns the guesser mode used for the analysis.
+  virtual morpho::guesser_mode tag(const vector<string_piece>& forms, vector<tagged_lemma>& tags, vector<vector<tagged_lemma>>& analyses,
+                                   morpho::guesser_mode guesser = morpho::GUESSER_UNSPECIFIED) const = 0;
+
+  // Return a new context holding the scratch state of tagging, which can be
+  // passed to tag by a single thread at a time instead of acquiring the
+  // internal caches. It must be used only with this tagger.
+  virtual tagger_context* new_context() const = 0;
+
+  // Perform morphologic analysis and subsequent disambiguation, returning also
+  // all analyses of the forms, using the given context.
+  virtual morpho::guesser_mode tag(const vector<string_piece>& forms, vector<tagged_lemma>& tags, vector<vector<tagged_lemma>>& analyses,
+                                   tagger_context& context, morpho::guesser_mode guesser = morpho::GUESSER_UNSPECIFIED) const = 0;
+
+  // Perform morphologic analysis of a single form, using the analysis cache.
+  virtual void analyze(string_piece form, morpho::guesser_mode guesser, vector<tagged_lemma>& lemmas) const = 0;
+
+  // Cache morphological analyses and the elementary features depending only
+  // on the form of at most the given number of forms, shared by all threads;
+  // zero disables the caches. Must not be called concurrently with tagging.
+  virtual void set_analysis_cache(size_t forms) = 0;
+
+  // Return number of cache hits and misses since the cache was enabled.
+  virtual void analysis_cache_statistics(size_t& hits, size_t& misses) const = 0;
+
+  // Keep only the given number of best hypotheses for every form during
+  // disambiguation, instead of the exact decoding used when it is zero.
+  // Must not be called concurrently with tagging.
+  virtual void set_beam_size(int beam_size) = 0;
+
+  // Skip the disambiguation, choosing the first analysis of every form.
+  // Must not be called concurrently with tagging.
+  virtual void set_fast_mode(bool fast) = 0;
+
   // Perform disambiguation only on given analyses.
   virtual void tag_analyzed(const vector<string_piece>& forms, const vector<vector<tagged_lemma>>& analyses, vector<int>& tags) const = 0;
 
+  // Return the approximate number of bytes used by the tagger features, not
+  // including the morphology, whose usage is reported by get_morpho.
+  virtual size_t memory_usage() const = 0;
+
   // Construct a new tokenizer instance appropriate for this tagger.
   // Can return NULL if no such tokenizer exists.
   // Is equal to get_morpho()->new_tokenizer.
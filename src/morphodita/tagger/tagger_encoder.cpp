@@ -0,0 +1,110 @@
+// This file is part of MorphoDiTa <http://github.com/ufal/morphodita/>.
+//
+// Copyright 2015 Institute of Formal and Applied Linguistics, Faculty of
+// Mathematics and Physics, Charles University in Prague, Czech Republic.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#include "conllu_elementary_features.h"
+#include "czech_elementary_features.h"
+#include "elementary_features_encoder.h"
+#include "generic_elementary_features.h"
+#include "feature_sequences_encoder.h"
+#include "morphodita/morpho/morpho_ids.h"
+#include "tagger.h"
+#include "tagger_ids.h"
+
+namespace ufal {
+namespace nametag {
+namespace morphodita {
+
+template <class FeatureSequences>
+static bool quantize_perceptron_tagger_int16(istream& is, ostream& os) {
+  // The morphology is copied as is
+  auto morpho_start = is.tellg();
+  unique_ptr<morpho> dict(morpho::load(is));
+  if (!dict) return false;
+  string morpho_data(size_t(is.tellg() - morpho_start), '\0');
+  if (!is.seekg(morpho_start) || !is.read(&morpho_data[0], morpho_data.size())) return false;
+  if (!os.write(morpho_data.data(), morpho_data.size())) return false;
+
+  int use_guesser = is.get();
+  if (use_guesser == EOF || !os.put(use_guesser)) return false;
+
+  FeatureSequences features;
+  if (!features.load(is)) return false;
+  for (auto&& score : features.scores)
+    score.quantize_int16();
+  return features.save(os);
+}
+
+bool tagger::quantize_int16(istream& is, ostream& os) {
+  int id = is.get();
+  if (id == EOF || !os.put(id)) return false;
+
+  switch (tagger_id(id)) {
+    case tagger_ids::CZECH2:
+    case tagger_ids::CZECH2_3:
+    case tagger_ids::CZECH3:
+      return quantize_perceptron_tagger_int16<persistent_feature_sequences<persistent_czech_elementary_features>>(is, os);
+    case tagger_ids::GENERIC2:
+    case tagger_ids::GENERIC2_3:
+    case tagger_ids::GENERIC3:
+    case tagger_ids::GENERIC4:
+      return quantize_perceptron_tagger_int16<persistent_feature_sequences<persistent_generic_elementary_features>>(is, os);
+    case tagger_ids::CONLLU2:
+    case tagger_ids::CONLLU2_3:
+    case tagger_ids::CONLLU3:
+      return quantize_perceptron_tagger_int16<persistent_feature_sequences<persistent_conllu_elementary_features>>(is, os);
+  }
+
+  return false;
+}
+
+// Every morphology is a single block, the derivator dictionary is followed
+// by the morphology it is built on
+static bool recompress_morpho(istream& is, ostream& os, compressor::codec codec) {
+  int id = is.get();
+  if (id == EOF || !os.put(id)) return false;
+
+  if (!compressor::recompress(is, os, codec)) return false;
+  if (morpho_id(id) == morpho_ids::DERIVATOR_DICTIONARY)
+    return recompress_morpho(is, os, codec);
+  return true;
+}
+
+bool tagger::recompress(istream& is, ostream& os, compressor::codec codec) {
+  int id = is.get();
+  if (id == EOF || !os.put(id)) return false;
+
+  // All the perceptron taggers consist of a morphology, the use_guesser flag,
+  // the elementary features and the feature sequences
+  switch (tagger_id(id)) {
+    case tagger_ids::CZECH2:
+    case tagger_ids::CZECH2_3:
+    case tagger_ids::CZECH3:
+    case tagger_ids::GENERIC2:
+    case tagger_ids::GENERIC2_3:
+    case tagger_ids::GENERIC3:
+    case tagger_ids::GENERIC4:
+    case tagger_ids::CONLLU2:
+    case tagger_ids::CONLLU2_3:
+    case tagger_ids::CONLLU3:
+      {
+        if (!recompress_morpho(is, os, codec)) return false;
+
+        int use_guesser = is.get();
+        if (use_guesser == EOF || !os.put(use_guesser)) return false;
+
+        return compressor::recompress(is, os, codec) && compressor::recompress(is, os, codec);
+      }
+  }
+
+  return false;
+}
+
+} // namespace morphodita
+} // namespace nametag
+} // namespace ufal
@@ -32,6 +32,7 @@ class training_feature_sequence_map {
   };
 
   inline feature_sequence_score score(const char* feature, int len) const;
+  inline void prefetch(const char* /*feature*/, int /*len*/) const {}
   mutable unordered_map<string, info> map;
  private:
   mutable string key;
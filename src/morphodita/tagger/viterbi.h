@@ -9,6 +9,9 @@
 
 #pragma once
 
+#include <algorithm>
+#include <functional>
+
 #include "common.h"
 #include "elementary_features.h"
 #include "feature_sequences.h"
@@ -27,11 +30,22 @@ class viterbi {
       : features(features), decoding_order(decoding_order), window_size(window_size) {}
 
   struct cache;
-  void tag(const vector<string_piece>& forms, const vector<vector<tagged_lemma>>& analyses, cache& c, vector<int>& tags) const;
+  // With a positive beam_size, only that many best nodes are kept for every
+  // form, otherwise the decoding is exact.
+  void tag(const vector<string_piece>& forms, const vector<vector<tagged_lemma>>& analyses, cache& c, vector<int>& tags, int beam_size = 0) const;
 
  private:
   struct node;
 
+  // Decoding with the given decoding order and window size known at compile
+  // time, or with the runtime ones when they are zero
+  template <int DecodingOrder, int WindowSize>
+  void tag_fixed(const vector<string_piece>& forms, const vector<vector<tagged_lemma>>& analyses, cache& c, vector<int>& tags, int beam_size) const;
+
+  // Caches retain at most this number of nodes after a sentence is tagged,
+  // so that outlier sentences do not keep their memory allocated
+  enum { MAX_RETAINED_NODES = 1 << 16 };
+
   const FeatureSequences& features;
   int decoding_order, window_size;
 };
@@ -41,6 +55,7 @@ class viterbi {
 template <class FeatureSequences>
 struct viterbi<FeatureSequences>::cache {
   vector<node> nodes;
+  vector<feature_sequences_score> beam_scores;
   typename FeatureSequences::cache features_cache;
 
   cache(const viterbi<FeatureSequences>& self) : features_cache(self.features) {}
@@ -55,14 +70,29 @@ struct viterbi<FeatureSequences>::node {
 };
 
 template <class FeatureSequences>
-void viterbi<FeatureSequences>::tag(const vector<string_piece>& forms, const vector<vector<tagged_lemma>>& analyses, cache& c, vector<int>& tags) const {
+void viterbi<FeatureSequences>::tag(const vector<string_piece>& forms, const vector<vector<tagged_lemma>>& analyses, cache& c, vector<int>& tags, int beam_size) const {
+  // The configurations of the tagger_ids are decoded by specialized
+  // instantiations, whose predecessor walks and tags window have fixed bounds
+  if (decoding_order == 2 && window_size == 2) return tag_fixed<2, 2>(forms, analyses, c, tags, beam_size);
+  if (decoding_order == 2 && window_size == 3) return tag_fixed<2, 3>(forms, analyses, c, tags, beam_size);
+  if (decoding_order == 3 && window_size == 3) return tag_fixed<3, 3>(forms, analyses, c, tags, beam_size);
+  if (decoding_order == 4 && window_size == 4) return tag_fixed<4, 4>(forms, analyses, c, tags, beam_size);
+  tag_fixed<0, 0>(forms, analyses, c, tags, beam_size);
+}
+
+template <class FeatureSequences>
+template <int DecodingOrder, int WindowSize>
+void viterbi<FeatureSequences>::tag_fixed(const vector<string_piece>& forms, const vector<vector<tagged_lemma>>& analyses, cache& c, vector<int>& tags, int beam_size) const {
   if (!forms.size()) return;
 
+  const int order = DecodingOrder ? DecodingOrder : decoding_order;
+  const int window_length = WindowSize ? WindowSize : window_size;
+
   // Count number of nodes and allocate
   unsigned nodes = 0;
   for (unsigned i = 0, states = 1; i < forms.size(); i++) {
     if (analyses[i].empty()) return;
-    states = (i+1 >= unsigned(decoding_order) ? states / analyses[i-decoding_order+1].size() : states) * analyses[i].size();
+    states = (i+1 >= unsigned(order) ? states / analyses[i-order+1].size() : states) * analyses[i].size();
     nodes += states;
   }
   if (nodes > c.nodes.size()) c.nodes.resize(nodes);
@@ -70,8 +100,8 @@ void viterbi<FeatureSequences>::tag(const vector<string_piece>& forms, const vec
   // Init feature sequences
   features.initialize_sentence(forms, analyses, c.features_cache);
 
-  int window_stack[16]; vector<int> window_heap;
-  int* window = window_size <= 16 ? window_stack : (window_heap.resize(window_size), window_heap.data());
+  int window_stack[WindowSize ? WindowSize : 16]; vector<int> window_heap;
+  int* window = window_length <= 16 ? window_stack : (window_heap.resize(window_length), window_heap.data());
   typename FeatureSequences::dynamic_features dynamic;
   feature_sequences_score score;
 
@@ -80,13 +110,13 @@ void viterbi<FeatureSequences>::tag(const vector<string_piece>& forms, const vec
   for (unsigned i = 0; i < forms.size(); i++) {
     int nodes_next = nodes_now;
 
-    for (int j = 0; j < window_size; j++) window[j] = -1;
+    for (int j = 0; j < window_length; j++) window[j] = -1;
     for (int tag = 0; tag < int(analyses[i].size()); tag++)
       for (int prev = nodes_prev; prev < nodes_now; prev++) {
         // Compute predecessors and number of unchanges
         int same_tags = window[0] == tag;
         window[0] = tag;
-        for (int p = prev, n = 1; p >= 0 && n < window_size; p = c.nodes[p].prev, n++) {
+        for (int p = prev, n = 1; p >= 0 && n < window_length; p = c.nodes[p].prev, n++) {
           same_tags += same_tags == n && window[n] == c.nodes[p].tag;
           window[n] = c.nodes[p].tag;
         }
@@ -97,7 +127,7 @@ void viterbi<FeatureSequences>::tag(const vector<string_piece>& forms, const vec
             (prev >= 0 ? c.nodes[prev].score : 0);
 
         // Update existing node or create a new one
-        if (same_tags >= decoding_order-1) {
+        if (same_tags >= order-1) {
           if (score <= c.nodes[nodes_next-1].score) continue;
           nodes_next--;
         }
@@ -107,6 +137,24 @@ void viterbi<FeatureSequences>::tag(const vector<string_piece>& forms, const vec
         c.nodes[nodes_next++].dynamic = dynamic;
       }
 
+    // Keep only the nodes with beam_size best scores, preserving their order,
+    // which is required when merging nodes with the same history.
+    if (beam_size > 0 && nodes_next - nodes_now > beam_size) {
+      c.beam_scores.clear();
+      for (int node = nodes_now; node < nodes_next; node++)
+        c.beam_scores.push_back(c.nodes[node].score);
+      nth_element(c.beam_scores.begin(), c.beam_scores.begin() + beam_size - 1, c.beam_scores.end(), greater<feature_sequences_score>());
+      feature_sequences_score threshold = c.beam_scores[beam_size - 1];
+
+      int nodes_kept = nodes_now;
+      for (int node = nodes_now; node < nodes_next; node++)
+        if (c.nodes[node].score >= threshold) {
+          if (node != nodes_kept) c.nodes[nodes_kept] = c.nodes[node];
+          nodes_kept++;
+        }
+      nodes_next = nodes_kept;
+    }
+
     nodes_prev = nodes_now;
     nodes_now = nodes_next;
   }
@@ -119,6 +167,11 @@ void viterbi<FeatureSequences>::tag(const vector<string_piece>& forms, const vec
 
   for (int i = forms.size() - 1; i >= 0; i--, best = c.nodes[best].prev)
     tags[i] = c.nodes[best].tag;
+
+  if (c.nodes.size() > MAX_RETAINED_NODES) {
+    c.nodes.resize(MAX_RETAINED_NODES);
+    c.nodes.shrink_to_fit();
+  }
 }
 
 } // namespace morphodita
@@ -151,7 +151,7 @@ static const int czech_tokenizer_start = 7;
 // (e.g., Japanese).
 // perl -CSD -ple 'use Encode;s/([^[:ascii:]])/join("", map {sprintf "\\%o", ord($_)} split(m@@, encode("utf-8", $1)))/ge'
 // perl -CSD -ple 'use Encode;s/\\([0-7]{3})\\([0-7]{3})/decode("utf-8", chr(oct($1)).chr(oct($2)))/ge'
-const unordered_set<string> czech_tokenizer::abbreviations_czech = {
+const abbreviation_set czech_tokenizer::abbreviations_czech = {
   // Titles
   "prof", "csc", "drsc", "doc", "phd", "ph", "d",
   "judr", "mddr", "mudr", "mvdr", "paeddr", "paedr", "phdr", "rndr", "rsdr", "dr",
@@ -167,7 +167,7 @@ const unordered_set<string> czech_tokenizer::abbreviations_czech = {
   "sv", "tel", "tj", "tzv", "\303\272", "u", "uh", "ul", "um", "zl", "zn",
 };
 
-const unordered_set<string> czech_tokenizer::abbreviations_slovak = {
+const abbreviation_set czech_tokenizer::abbreviations_slovak = {
   // Titles
   "prof", "csc", "drsc", "doc", "phd", "ph", "d",
   "judr", "mddr", "mudr", "mvdr", "paeddr", "paedr", "phdr", "rndr", "rsdr", "dr",
@@ -27,13 +27,13 @@ class czech_tokenizer : public ragel_tokenizer {
 
  private:
   const morpho* m;
-  const unordered_set<string>* abbreviations;
+  const abbreviation_set* abbreviations;
   vector<tagged_lemma> lemmas;
 
   void merge_hyphenated(vector<token_range>& tokens);
 
-  static const unordered_set<string> abbreviations_czech;
-  static const unordered_set<string> abbreviations_slovak;
+  static const abbreviation_set abbreviations_czech;
+  static const abbreviation_set abbreviations_slovak;
 };
 
 } // namespace morphodita
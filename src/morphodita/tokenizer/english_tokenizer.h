@@ -26,7 +26,7 @@ class english_tokenizer : public ragel_tokenizer {
  private:
   void split_token(vector<token_range>& tokens);
 
-  static const unordered_set<string> abbreviations;
+  static const abbreviation_set abbreviations;
 };
 
 } // namespace morphodita
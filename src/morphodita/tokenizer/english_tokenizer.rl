@@ -15,7 +15,7 @@ namespace nametag {
 namespace morphodita {
 
 // The list of lowercased words that when preceding eos do not end sentence.
-const unordered_set<string> english_tokenizer::abbreviations = {
+const abbreviation_set english_tokenizer::abbreviations = {
   // Titles
   "adj", "adm", "adv", "assoc", "asst", "bart", "bldg", "brig", "bros", "capt",
   "cmdr", "col", "comdr", "con", "corp", "cpl", "d", "dr", "dr", "drs", "ens",
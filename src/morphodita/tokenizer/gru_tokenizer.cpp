@@ -50,7 +50,10 @@ bool gru_tokenizer::next_sentence(vector<token_range>& tokens) {
 
 int gru_tokenizer::next_outcome() {
   if (network_index >= network_length) {
-    // Compute required window
+    // Compute required window. Every window is classified from zero states,
+    // because the network is trained on independent segments; the GRU states
+    // of the previous window therefore cannot be reused. The windows overlap
+    // only by the few characters after the last break chosen below.
     network_index = 0;
     network_length = 0;
     network_chars.clear();
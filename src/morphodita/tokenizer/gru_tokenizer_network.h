@@ -64,17 +64,25 @@ class gru_tokenizer_network_implementation : public gru_tokenizer_network {
 
  protected:
   void cache_embeddings();
+  inline uint32_t cache_entry(char32_t chr) const;
+  inline const float* embedding_cache(const char_info& chr) const;
 
   struct cached_embedding {
     matrix<1, D> e;
-    matrix<6, D> cache;
   };
 
   struct gru {
     matrix<D,D> X, X_r, X_z;
     matrix<D,D> H, H_r, H_z;
 
+    // Transposed H_z and H_r stacked side by side, and transposed H, filled
+    // by cache_embeddings, so that the products with the state iterate over
+    // consecutive elements and can be vectorized.
+    float H_zr_t[D][2 * D], H_t[D][D];
+
     void load(binary_decoder& data);
+    void cache_transposed();
+    void step(const float* embedding_cache, float* state) const;
   };
 
   unordered_map<char32_t, cached_embedding> embeddings;
@@ -82,6 +90,17 @@ class gru_tokenizer_network_implementation : public gru_tokenizer_network {
   gru gru_fwd, gru_bwd;
   matrix<3, D> projection_fwd, projection_bwd;
   unordered_map<unilib::unicode::category_t, char32_t> unknown_chars;
+
+  // The embeddings multiplied by the GRU input matrices, stored by
+  // cache_embeddings in one array with 6*D floats per character, the first
+  // entry being the empty embedding. The characters are mapped to the entries
+  // directly in the BMP and using a sorted array above it, and the unknown
+  // characters using their category.
+  vector<float> caches;
+  vector<uint32_t> bmp_caches;
+  vector<pair<char32_t, uint32_t>> astral_caches;
+  vector<pair<unilib::unicode::category_t, uint32_t>> unknown_caches;
+  enum : uint32_t { CACHE_UNKNOWN = ~0U };
 };
 
 // Definitions
@@ -108,63 +127,79 @@ void gru_tokenizer_network_implementation<D>::gru::load(binary_decoder& data) {
   H_z.load(data);
 }
 
+template <int D>
+void gru_tokenizer_network_implementation<D>::gru::cache_transposed() {
+  for (int j = 0; j < D; j++)
+    for (int k = 0; k < D; k++) {
+      H_zr_t[k][j] = H_z.w[j][k];
+      H_zr_t[k][D + j] = H_r.w[j][k];
+      H_t[k][j] = H.w[j][k];
+    }
+}
+
+template <int D>
+void gru_tokenizer_network_implementation<D>::gru::step(const float* embedding_cache, float* state) const {
+  // Compute the update and reset gates together
+  float gates[2 * D], candidate[D];
+  for (int j = 0; j < D; j++) {
+    gates[j] = X_z.b[j] + embedding_cache[2*D + j];
+    gates[D + j] = X_r.b[j] + embedding_cache[D + j];
+  }
+  for (int k = 0; k < D; k++)
+    for (int j = 0; j < 2 * D; j++)
+      gates[j] += state[k] * H_zr_t[k][j];
+  for (int j = 0; j < 2 * D; j++)
+    gates[j] = 1.f / (1.f + exp(-gates[j]));
+  for (int j = 0; j < D; j++)
+    gates[D + j] *= state[j];
+
+  for (int j = 0; j < D; j++)
+    candidate[j] = X.b[j] + embedding_cache[j];
+  for (int k = 0; k < D; k++)
+    for (int j = 0; j < D; j++)
+      candidate[j] += gates[D + k] * H_t[k][j];
+  for (int j = 0; j < D; j++)
+    state[j] = gates[j] * state[j] + (1.f - gates[j]) * tanh(candidate[j]);
+}
+
 template <int D>
 void gru_tokenizer_network_implementation<D>::classify(const vector<char_info>& chars, vector<outcome_t>& outcomes) const {
   if (chars.empty()) return;
 
   // Resolve embeddings, possibly with unknown_chars or empty_embedding
-  for (size_t i = 0; i < chars.size(); i++) {
-    auto embedding = embeddings.find(chars[i].chr);
-    if (embedding != embeddings.end()) {
-      outcomes[i].embedding = embedding->second.cache.w[0];
-    } else {
-      auto unknown_char = unknown_chars.find(chars[i].cat);
-      if (unknown_char != unknown_chars.end()) embedding = embeddings.find(unknown_char->second);
-      outcomes[i].embedding = embedding != embeddings.end() ? embedding->second.cache.w[0] : empty_embedding.cache.w[0];
-    }
-  }
+  for (size_t i = 0; i < chars.size(); i++)
+    outcomes[i].embedding = embedding_cache(chars[i]);
 
   // Clear outcome probabilities
   for (auto&& outcome : outcomes)
     for (int i = 0; i < 3; i++)
       outcome.w[i] = projection_fwd.b[i];
 
-  // Perform forward & backward GRU
-  matrix<1, D> state, update, reset, candidate;
-  for (int dir = 0; dir < 2; dir++) {
-    auto& gru = dir == 0 ? gru_fwd : gru_bwd;
-    auto& projection = dir == 0 ? projection_fwd : projection_bwd;
-
-    state.clear();
-    for (size_t i = 0; i < outcomes.size(); i++) {
-      auto& outcome = outcomes[dir == 0 ? i : outcomes.size() - 1 - i];
-      auto* embedding_cache = outcome.embedding + (dir == 1) * 3 * D;
-
-      for (int j = 0; j < D; j++) {
-        update.w[0][j] = gru.X_z.b[j] + embedding_cache[2*D + j];
-        reset.w[0][j] = gru.X_r.b[j] + embedding_cache[D + j];
-        for (int k = 0; k < D; k++) {
-          update.w[0][j] += state.w[0][k] * gru.H_z.w[j][k];
-          reset.w[0][j] += state.w[0][k] * gru.H_r.w[j][k];
-        }
-        update.w[0][j] = 1.f / (1.f + exp(-update.w[0][j]));
-        reset.w[0][j] = 1.f / (1.f + exp(-reset.w[0][j]));
-        reset.w[0][j] *= state.w[0][j];
-      }
-      for (int j = 0; j < D; j++) {
-        candidate.w[0][j] = gru.X.b[j] + embedding_cache[j];
-        for (int k = 0; k < D; k++)
-          candidate.w[0][j] += reset.w[0][k] * gru.H.w[j][k];
-        candidate.w[0][j] = tanh(candidate.w[0][j]);
-        state.w[0][j] = update.w[0][j] * state.w[0][j] + (1.f - update.w[0][j]) * candidate.w[0][j];
-      }
-
-      for (int j = 0; j < 3; j++)
-        for (int k = 0; k < D; k++)
-          outcome.w[j] += projection.w[j][k] * state.w[0][k];
-    }
+  // Perform forward & backward GRU, interleaving the independent directions.
+  // The backward states are projected only after all the forward ones, so that
+  // the outcome weights are summed in the same order as by separate passes.
+  matrix<1, D> state_fwd, state_bwd;
+  vector<float> states_bwd(outcomes.size() * D);
+  state_fwd.clear();
+  state_bwd.clear();
+  for (size_t i = 0; i < outcomes.size(); i++) {
+    auto& outcome = outcomes[i];
+    size_t i_bwd = outcomes.size() - 1 - i;
+
+    gru_fwd.step(outcome.embedding, state_fwd.w[0]);
+    gru_bwd.step(outcomes[i_bwd].embedding + 3 * D, state_bwd.w[0]);
+
+    for (int j = 0; j < 3; j++)
+      for (int k = 0; k < D; k++)
+        outcome.w[j] += projection_fwd.w[j][k] * state_fwd.w[0][k];
+    copy_n(state_bwd.w[0], D, states_bwd.data() + i_bwd * D);
   }
 
+  for (size_t i = 0; i < outcomes.size(); i++)
+    for (int j = 0; j < 3; j++)
+      for (int k = 0; k < D; k++)
+        outcomes[i].w[j] += projection_bwd.w[j][k] * states_bwd[i * D + k];
+
   // Choose the outcome with the highest weight
   for (auto&& outcome : outcomes) {
     outcome.outcome = outcome.w[1] > outcome.w[0];
@@ -172,6 +207,28 @@ void gru_tokenizer_network_implementation<D>::classify(const vector<char_info>&
   }
 }
 
+template <int D>
+uint32_t gru_tokenizer_network_implementation<D>::cache_entry(char32_t chr) const {
+  if (chr < bmp_caches.size()) return bmp_caches[chr];
+
+  auto astral = lower_bound(astral_caches.begin(), astral_caches.end(), make_pair(chr, uint32_t(0)));
+  return astral != astral_caches.end() && astral->first == chr ? astral->second : CACHE_UNKNOWN;
+}
+
+template <int D>
+const float* gru_tokenizer_network_implementation<D>::embedding_cache(const char_info& chr) const {
+  uint32_t entry = cache_entry(chr.chr);
+  if (entry == CACHE_UNKNOWN) {
+    entry = 0;
+    for (auto&& unknown : unknown_caches)
+      if (unknown.first == chr.cat) {
+        entry = unknown.second;
+        break;
+      }
+  }
+  return caches.data() + entry * 6 * D;
+}
+
 template <int D>
 gru_tokenizer_network_implementation<D>* gru_tokenizer_network_implementation<D>::load(binary_decoder& data) {
   unique_ptr<gru_tokenizer_network_implementation<D>> network(new gru_tokenizer_network_implementation<D>());
@@ -200,19 +257,38 @@ gru_tokenizer_network_implementation<D>* gru_tokenizer_network_implementation<D>
 
 template <int D>
 void gru_tokenizer_network_implementation<D>::cache_embeddings() {
+  caches.assign((embeddings.size() + 1) * 6 * D, 0.f);
+  bmp_caches.assign(0x10000, CACHE_UNKNOWN);
+  astral_caches.clear();
+
+  uint32_t entry = 1;
   for (auto&& embedding : embeddings) {
     auto& e = embedding.second.e;
-    auto& cache = embedding.second.cache;
-
-    for (int i = 0; i < 6; i++) fill_n(cache.w[i], D, 0.f);
-    for (int i = 0; i < D; i++) for (int j = 0; j < D; j++) cache.w[0][i] += e.w[0][j] * gru_fwd.X.w[i][j];
-    for (int i = 0; i < D; i++) for (int j = 0; j < D; j++) cache.w[1][i] += e.w[0][j] * gru_fwd.X_r.w[i][j];
-    for (int i = 0; i < D; i++) for (int j = 0; j < D; j++) cache.w[2][i] += e.w[0][j] * gru_fwd.X_z.w[i][j];
-    for (int i = 0; i < D; i++) for (int j = 0; j < D; j++) cache.w[3][i] += e.w[0][j] * gru_bwd.X.w[i][j];
-    for (int i = 0; i < D; i++) for (int j = 0; j < D; j++) cache.w[4][i] += e.w[0][j] * gru_bwd.X_r.w[i][j];
-    for (int i = 0; i < D; i++) for (int j = 0; j < D; j++) cache.w[5][i] += e.w[0][j] * gru_bwd.X_z.w[i][j];
+    float* cache = caches.data() + entry * 6 * D;
+
+    for (int i = 0; i < D; i++) for (int j = 0; j < D; j++) cache[0*D + i] += e.w[0][j] * gru_fwd.X.w[i][j];
+    for (int i = 0; i < D; i++) for (int j = 0; j < D; j++) cache[1*D + i] += e.w[0][j] * gru_fwd.X_r.w[i][j];
+    for (int i = 0; i < D; i++) for (int j = 0; j < D; j++) cache[2*D + i] += e.w[0][j] * gru_fwd.X_z.w[i][j];
+    for (int i = 0; i < D; i++) for (int j = 0; j < D; j++) cache[3*D + i] += e.w[0][j] * gru_bwd.X.w[i][j];
+    for (int i = 0; i < D; i++) for (int j = 0; j < D; j++) cache[4*D + i] += e.w[0][j] * gru_bwd.X_r.w[i][j];
+    for (int i = 0; i < D; i++) for (int j = 0; j < D; j++) cache[5*D + i] += e.w[0][j] * gru_bwd.X_z.w[i][j];
+
+    if (embedding.first < bmp_caches.size())
+      bmp_caches[embedding.first] = entry;
+    else
+      astral_caches.emplace_back(embedding.first, entry);
+    entry++;
   }
-  for (int i = 0; i < 6; i++) fill_n(empty_embedding.cache.w[i], D, 0.f);
+  sort(astral_caches.begin(), astral_caches.end());
+
+  unknown_caches.clear();
+  for (auto&& unknown_char : unknown_chars) {
+    uint32_t entry = cache_entry(unknown_char.second);
+    unknown_caches.emplace_back(unknown_char.first, entry == CACHE_UNKNOWN ? 0 : entry);
+  }
+
+  gru_fwd.cache_transposed();
+  gru_bwd.cache_transposed();
 }
 
 } // namespace morphodita
@@ -16,6 +16,21 @@ namespace ufal {
 namespace nametag {
 namespace morphodita {
 
+abbreviation_set::abbreviation_set(initializer_list<const char*> abbreviations) : by_length(1) {
+  vector<u32string> sorted;
+  for (auto&& abbreviation : abbreviations) {
+    sorted.emplace_back();
+    unilib::utf8::decode(abbreviation, sorted.back());
+  }
+  sort(sorted.begin(), sorted.end());
+  sorted.erase(unique(sorted.begin(), sorted.end()), sorted.end());
+
+  for (auto&& abbreviation : sorted) {
+    if (abbreviation.size() >= by_length.size()) by_length.resize(abbreviation.size() + 1);
+    by_length[abbreviation.size()].insert(by_length[abbreviation.size()].end(), abbreviation.begin(), abbreviation.end());
+  }
+}
+
 unicode_tokenizer::unicode_tokenizer(unsigned url_email_tokenizer) : url_email_tokenizer(url_email_tokenizer) {
   ragel_tokenizer::initialize_ragel_map();
 
@@ -31,9 +46,24 @@ void unicode_tokenizer::set_text(string_piece text, bool make_copy /*= false*/)
   }
   current = 0;
 
+  // Categories of ASCII characters, which are decoded directly
+  static const struct ascii_categories_t {
+    unicode::category_t categories[128];
+    ascii_categories_t() { for (char32_t chr = 0; chr < 128; chr++) categories[chr] = unicode::category(chr); }
+  } ascii_categories;
+
+  // There are at most as many characters as bytes of the text
   chars.clear();
-  for (const char* curr_str = text.str; text.len; curr_str = text.str)
-    chars.emplace_back(utf8::decode(text.str, text.len), curr_str);
+  chars.reserve(text.len + 1);
+  while (text.len)
+    if ((unsigned char)*text.str < 0x80) {
+      chars.emplace_back(char32_t(*text.str), ascii_categories.categories[(unsigned char)*text.str], text.str);
+      text.str++, text.len--;
+    } else {
+      const char* curr_str = text.str;
+      char32_t chr = utf8::decode(text.str, text.len);
+      chars.emplace_back(chr, curr_str);
+    }
   chars.emplace_back(0, text.str);
 }
 
@@ -52,9 +82,18 @@ bool unicode_tokenizer::next_sentence(vector<string_piece>* forms, vector<token_
 }
 
 bool unicode_tokenizer::tokenize_url_email(vector<token_range>& tokens) {
-  if (current >= chars.size() - 1) return false;
-
-  return url_email_tokenizer ? ragel_tokenizer::ragel_url_email(url_email_tokenizer, chars, current, tokens) : false;
+  if (current >= chars.size() - 1 || !url_email_tokenizer) return false;
+
+  // Every URL and email contains a hostname or a host number, and therefore
+  // a dot between two ASCII alphanumeric characters, preceded only by
+  // printable ASCII characters. Check it before running the automaton.
+  auto ascii_alnum = [](char32_t chr) { return (chr >= '0' && chr <= '9') || (chr >= 'a' && chr <= 'z') || (chr >= 'A' && chr <= 'Z'); };
+  bool host_dot = false;
+  for (size_t i = current + 1; !host_dot && i + 1 < chars.size() - 1 && chars[i].chr > ' ' && chars[i].chr < 128; i++)
+    host_dot = chars[i].chr == '.' && ascii_alnum(chars[i - 1].chr) && ascii_alnum(chars[i + 1].chr);
+  if (!host_dot) return false;
+
+  return ragel_tokenizer::ragel_url_email(url_email_tokenizer, chars, current, tokens);
 }
 
 bool unicode_tokenizer::emergency_sentence_split(const vector<token_range>& tokens) {
@@ -66,7 +105,7 @@ bool unicode_tokenizer::emergency_sentence_split(const vector<token_range>& toke
          (tokens.size() >= 400 && chars[tokens.back().start].cat & unicode::Po);
 }
 
-bool unicode_tokenizer::is_eos(const vector<token_range>& tokens, char32_t eos_chr, const unordered_set<string>* abbreviations) {
+bool unicode_tokenizer::is_eos(const vector<token_range>& tokens, char32_t eos_chr, const abbreviation_set* abbreviations) {
   using namespace unilib;
 
   if (eos_chr == '.' && !tokens.empty()) {
@@ -75,11 +114,11 @@ bool unicode_tokenizer::is_eos(const vector<token_range>& tokens, char32_t eos_c
       return false;
 
     // Ignore specified abbreviations
-    if (abbreviations) {
+    if (abbreviations && tokens.back().length <= abbreviations->max_length()) {
       eos_buffer.clear();
       for (size_t i = 0; i < tokens.back().length; i++)
-        utf8::append(eos_buffer, unicode::lowercase(chars[tokens.back().start + i].chr));
-      if (abbreviations->count(eos_buffer))
+        eos_buffer.push_back(unicode::lowercase(chars[tokens.back().start + i].chr));
+      if (abbreviations->contains(eos_buffer.data(), eos_buffer.size()))
         return false;
     }
   }
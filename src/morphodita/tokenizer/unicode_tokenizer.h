@@ -9,7 +9,8 @@
 
 #pragma once
 
-#include <unordered_set>
+#include <algorithm>
+#include <initializer_list>
 
 #include "common.h"
 #include "tokenizer.h"
@@ -20,6 +21,20 @@ namespace ufal {
 namespace nametag {
 namespace morphodita {
 
+// Set of lowercased abbreviations, which can be queried without allocation.
+// The abbreviations are stored as characters in sorted arrays, one for every
+// abbreviation length.
+class abbreviation_set {
+ public:
+  abbreviation_set(initializer_list<const char*> abbreviations);
+
+  inline size_t max_length() const { return by_length.size() - 1; }
+  inline bool contains(const char32_t* chars, size_t length) const;
+
+ private:
+  vector<vector<char32_t>> by_length;
+};
+
 class unicode_tokenizer : public tokenizer {
  public:
   enum { URL_EMAIL_LATEST = 2 };
@@ -37,21 +52,38 @@ class unicode_tokenizer : public tokenizer {
     const char* str;
 
     char_info(char32_t chr, const char* str) : chr(chr), cat(unilib::unicode::category(chr)), str(str) {}
+    char_info(char32_t chr, unilib::unicode::category_t cat, const char* str) : chr(chr), cat(cat), str(str) {}
   };
   vector<char_info> chars;
   size_t current;
 
   bool tokenize_url_email(vector<token_range>& tokens);
   bool emergency_sentence_split(const vector<token_range>& tokens);
-  bool is_eos(const vector<token_range>& tokens, char32_t eos_chr, const unordered_set<string>* abbreviations);
+  bool is_eos(const vector<token_range>& tokens, char32_t eos_chr, const abbreviation_set* abbreviations);
 
  private:
   unsigned url_email_tokenizer;
   string text_buffer;
   vector<token_range> tokens_buffer;
-  string eos_buffer;
+  u32string eos_buffer;
 };
 
+bool abbreviation_set::contains(const char32_t* chars, size_t length) const {
+  if (!length || length > max_length()) return false;
+
+  // Binary search in the abbreviations of the given length
+  auto& abbreviations = by_length[length];
+  size_t left = 0, right = abbreviations.size() / length;
+  while (left < right) {
+    size_t middle = (left + right) / 2;
+    auto abbreviation = abbreviations.data() + middle * length;
+    auto difference = mismatch(chars, chars + length, abbreviation);
+    if (difference.first == chars + length) return true;
+    if (*difference.first < *difference.second) right = middle; else left = middle + 1;
+  }
+  return false;
+}
+
 } // namespace morphodita
 } // namespace nametag
 } // namespace ufal
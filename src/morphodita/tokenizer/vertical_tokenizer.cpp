@@ -7,37 +7,71 @@
 // License, v. 2.0. If a copy of the MPL was not distributed with this
 // file, You can obtain one at http://mozilla.org/MPL/2.0/.
 
+#include <cstring>
+
+#include "unilib/utf8.h"
 #include "vertical_tokenizer.h"
 
 namespace ufal {
 namespace nametag {
 namespace morphodita {
 
-bool vertical_tokenizer::next_sentence(vector<token_range>& tokens) {
-  if (current >= chars.size() - 1) return false;
+void vertical_tokenizer::set_text(string_piece text, bool make_copy /*= false*/) {
+  if (make_copy && text.str) {
+    text_buffer.assign(text.str, text.len);
+    text.str = text_buffer.c_str();
+  }
+  this->text = text;
+  next_lf = nullptr;
+  counted_str = text.str;
+  counted_chars = 0;
+}
 
+bool vertical_tokenizer::next_sentence(vector<string_piece>* forms, vector<token_range>* tokens) {
+  if (forms) forms->clear();
+  if (tokens) tokens->clear();
+  if (!text.len) return false;
+
+  // The lines are terminated by \n, \r, \r\n or \n\r; the position of the
+  // following \n is remembered, so that texts with \r line ends are not
+  // scanned repeatedly.
+  const char* text_end = text.str + text.len;
   while (true) {
-    size_t line_start = current;
-    while (current < chars.size() - 1 && chars[current].chr != '\r' && chars[current].chr != '\n') current++;
-
-    size_t line_end = current;
-    if (current < chars.size() - 1) {
-      current++;
-      if (current < chars.size() - 1 &&
-          ((chars[current-1].chr == '\r' && chars[current].chr == '\n') ||
-           (chars[current-1].chr == '\n' && chars[current].chr == '\r')))
-        current++;
+    if (!next_lf || next_lf < text.str) {
+      next_lf = (const char*) memchr(text.str, '\n', text.len);
+      if (!next_lf) next_lf = text_end;
     }
+    const char* line_end = (const char*) memchr(text.str, '\r', next_lf - text.str);
+    if (!line_end) line_end = next_lf;
 
-    if (line_start < line_end)
-      tokens.emplace_back(line_start, line_end - line_start);
-    else
-      break;
+    const char* line_start = text.str;
+    if (line_end < text_end) {
+      const char* next = line_end + 1;
+      if (next < text_end && ((*line_end == '\r' && *next == '\n') || (*line_end == '\n' && *next == '\r')))
+        next++;
+      text = string_piece(next, text_end - next);
+    } else {
+      text = string_piece(text_end, 0);
+    }
+
+    if (line_start == line_end) break;
+    if (forms) forms->emplace_back(line_start, line_end - line_start);
+    if (tokens) {
+      size_t start = chars_until(line_start);
+      tokens->emplace_back(start, chars_until(line_end) - start);
+    }
   }
 
   return true;
 }
 
+size_t vertical_tokenizer::chars_until(const char* str) {
+  // Count the characters exactly as decoded by the other tokenizers
+  for (size_t len = str - counted_str; len; counted_chars++)
+    unilib::utf8::decode(counted_str, len);
+  return counted_chars;
+}
+
 } // namespace morphodita
 } // namespace nametag
 } // namespace ufal
@@ -10,17 +10,31 @@
 #pragma once
 
 #include "common.h"
-#include "unicode_tokenizer.h"
+#include "tokenizer.h"
 
 namespace ufal {
 namespace nametag {
 namespace morphodita {
 
-class vertical_tokenizer : public unicode_tokenizer {
+// Tokenizer returning the lines as tokens and the empty lines as sentence
+// boundaries. It scans the bytes of the text directly, so the forms are
+// returned without decoding or copying the text, and the characters are
+// counted only when token ranges are requested.
+class vertical_tokenizer : public tokenizer {
  public:
-  vertical_tokenizer() : unicode_tokenizer(0) {}
+  vertical_tokenizer() { set_text(string_piece(nullptr, 0)); }
 
-  virtual bool next_sentence(vector<token_range>& tokens) override;
+  virtual void set_text(string_piece text, bool make_copy = false) override;
+  virtual bool next_sentence(vector<string_piece>* forms, vector<token_range>* tokens) override;
+
+ private:
+  inline size_t chars_until(const char* str);
+
+  string_piece text;
+  const char* next_lf;
+  const char* counted_str;
+  size_t counted_chars;
+  string text_buffer;
 };
 
 } // namespace morphodita
@@ -0,0 +1,387 @@
+// This file is part of NameTag <http://github.com/ufal/nametag/>.
+//
+// Copyright 2016 Institute of Formal and Applied Linguistics, Faculty of
+// Mathematics and Physics, Charles University in Prague, Czech Republic.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <thread>
+#include <unordered_map>
+
+#include "ner/ner.h"
+#include "tagger/tagger.h"
+#include "utils/iostreams.h"
+#include "utils/options.h"
+#include "utils/paragraph_reader.h"
+#include "utils/parse_double.h"
+#include "utils/parse_int.h"
+#include "utils/peak_memory.h"
+#include "utils/split.h"
+#include "version/version.h"
+
+using namespace ufal::nametag;
+
+// Paragraphs of all benchmarked corpora, tokenized once all are loaded so that
+// the tag phase does not include the tokenization
+struct corpus {
+  vector<string> paragraphs;
+  vector<vector<vector<string_piece>>> sentences;
+  size_t tokens = 0, sentence_count = 0;
+};
+
+enum bench_phase { TOKENIZE, TAG, RECOGNIZE };
+static const char* phase_names[] = {"tokenize", "tag", "recognize"};
+
+// Labelled sentences in the train_ner format, with the entities decoded
+struct heldout {
+  vector<vector<string>> forms;
+  vector<vector<named_entity>> entities;
+};
+
+static void tokenize_corpus(corpus& corpus, const ner& recognizer);
+static void load_baseline(const char* fname, unordered_map<string, double>& baseline);
+static string json_value(const string& line, const char* key);
+static string run_key(const string& line);
+static void load_heldout(const char* fname, heldout& heldout);
+static void heldout_evaluate(const heldout& heldout, const ner& recognizer, double& f1, double& recall);
+static tagger* load_tagger(const char* fname);
+static void run_phase(bench_phase phase, const corpus& corpus, const ner& recognizer, const tagger* tagger,
+                      int threads, int repeat, double& seconds, vector<double>& latencies);
+
+int main(int argc, char* argv[]) {
+  iostreams_init();
+
+  options::map options;
+  if (!options::parse({{"baseline", options::value::any},
+                       {"heldout", options::value::any},
+                       {"phases", options::value::any},
+                       {"prefilter", options::value::none},
+                       {"repeat", options::value::any},
+                       {"stage_skipping", options::value::any},
+                       {"tagger_fast", options::value::none},
+                       {"threads", options::value::any},
+                       {"version", options::value::none},
+                       {"help", options::value::none}}, argc, argv, options) ||
+      options.count("help") ||
+      (argc < 3 && !options.count("version")))
+    runtime_failure("Usage: " << argv[0] << " [options] recognizer_model corpus_file...\n"
+                    "Options: --baseline=output of a previous run, printing the speed-up of the same runs\n"
+                    "         --heldout=labelled data evaluated after every recognize run\n"
+                    "         --phases=comma separated tokenize,tag,recognize (default all)\n"
+                    "         --prefilter (skip the sentences without candidates of entities in recognize runs)\n"
+                    "         --repeat=number of passes over the corpora in every run (default 1)\n"
+                    "         --stage_skipping=comma separated stage skipping probabilities of recognize runs\n"
+                    "         --tagger_fast (skip morphological disambiguation, using the first analyses)\n"
+                    "         --threads=run with 1..N threads (default 1)\n"
+                    "         --version\n"
+                    "         --help");
+  if (options.count("version"))
+    return cout << version::version_and_copyright() << endl, 0;
+
+  int threads = options.count("threads") ? parse_int(options["threads"], "number of threads") : 1;
+  if (threads < 1) runtime_failure("The number of threads must be positive!");
+  int repeat = options.count("repeat") ? parse_int(options["repeat"], "number of repetitions") : 1;
+  if (repeat < 1) runtime_failure("The number of repetitions must be positive!");
+
+  vector<bench_phase> phases;
+  string phases_list = options.count("phases") ? options["phases"] : "tokenize,tag,recognize";
+  for (size_t start = 0, comma; start <= phases_list.size(); start = comma + 1) {
+    if ((comma = phases_list.find(',', start)) == string::npos) comma = phases_list.size();
+    string name = phases_list.substr(start, comma - start);
+    auto phase = find(begin(phase_names), end(phase_names), name);
+    if (phase == end(phase_names)) runtime_failure("Unknown benchmark phase '" << name << "'!");
+    phases.push_back(bench_phase(phase - begin(phase_names)));
+  }
+
+  // The recognize runs are performed for every stage skipping probability,
+  // or only once without the option
+  vector<double> stage_skipping;
+  if (options.count("stage_skipping")) {
+    vector<string> probabilities;
+    split(options["stage_skipping"], ',', probabilities);
+    for (auto&& probability : probabilities) {
+      stage_skipping.push_back(parse_double(probability, "stage skipping probability"));
+      if (stage_skipping.back() < 0 || stage_skipping.back() > 1) runtime_failure("The stage skipping probability must be between 0 and 1!");
+    }
+  }
+
+  cerr << "Loading ner: ";
+  unique_ptr<ner> recognizer(ner::load(argv[1]));
+  if (!recognizer) runtime_failure("Cannot load ner from file '" << argv[1] << "'!");
+  cerr << "done" << endl;
+
+  if (options.count("tagger_fast") && !recognizer->set_tagger_fast_mode(true))
+    runtime_failure("The supplied model does not perform morphological disambiguation!");
+  bool prefilter = options.count("prefilter");
+  if (prefilter && !recognizer->set_candidate_prefilter(true))
+    runtime_failure("The supplied model does not support the candidate prefilter!");
+
+  // The tagger of the tag phase shares its data, including the fast mode,
+  // with the identical tagger of the recognizer
+  unique_ptr<tagger> tagger;
+  if (find(phases.begin(), phases.end(), TAG) != phases.end()) {
+    tagger.reset(load_tagger(argv[1]));
+    if (!tagger) runtime_failure("Cannot load the tagger of the ner from file '" << argv[1] << "'!");
+  }
+
+  corpus corpus;
+  for (int argi = 2; argi < argc; argi++) {
+    ifstream is(argv[argi]);
+    if (!is) runtime_failure("Cannot open file '" << argv[argi] << "' for reading!");
+
+    paragraph_reader reader(is);
+    string_piece para;
+    while (reader.next(para))
+      corpus.paragraphs.emplace_back(para.str, para.len);
+  }
+  tokenize_corpus(corpus, *recognizer);
+  cerr << "Loaded " << corpus.paragraphs.size() << " paragraphs, " << corpus.sentence_count << " sentences and "
+       << corpus.tokens << " tokens." << endl;
+
+  unordered_map<string, double> baseline;
+  if (options.count("baseline"))
+    load_baseline(options["baseline"].c_str(), baseline);
+
+  heldout heldout;
+  if (options.count("heldout")) {
+    load_heldout(options["heldout"].c_str(), heldout);
+    cerr << "Loaded " << heldout.forms.size() << " heldout sentences." << endl;
+  }
+
+  // Every run is printed as a separate JSON object on its own line
+  string output;
+  size_t recognize_runs = max(stage_skipping.size(), size_t(1));
+  vector<double> latencies;
+  for (auto&& phase : phases)
+    for (int run_threads = 1; run_threads <= threads; run_threads++)
+      for (unsigned skipping = 0; skipping < (phase == RECOGNIZE ? recognize_runs : 1); skipping++) {
+        bool skipping_used = phase == RECOGNIZE && !stage_skipping.empty();
+        if (skipping_used && !recognizer->set_stage_skipping(stage_skipping[skipping]))
+          runtime_failure("The supplied model does not support skipping stages!");
+        // Reset the prefilter statistics, which include the heldout sentences
+        if (phase == RECOGNIZE && prefilter) recognizer->set_candidate_prefilter(true);
+
+        double seconds;
+        run_phase(phase, corpus, *recognizer, tagger.get(), run_threads, repeat, seconds, latencies);
+        sort(latencies.begin(), latencies.end());
+        auto percentile = [&](unsigned p) { return latencies.empty() ? 0. : latencies[min(latencies.size() - 1, latencies.size() * p / 100)] * 1000; };
+
+        output.assign("{\"phase\": \"").append(phase_names[phase]);
+        output.append("\", \"threads\": ").append(to_string(run_threads));
+        output.append(", \"seconds\": ").append(to_string(seconds));
+        output.append(", \"tokens_per_second\": ").append(to_string(corpus.tokens * repeat / seconds));
+        output.append(", \"sentences_per_second\": ").append(to_string(corpus.sentence_count * repeat / seconds));
+        output.append(", \"paragraph_latency_ms\": {\"p50\": ").append(to_string(percentile(50)));
+        output.append(", \"p95\": ").append(to_string(percentile(95)));
+        output.append(", \"p99\": ").append(to_string(percentile(99))).append("}");
+        if (skipping_used) {
+          size_t skipped, sentences;
+          recognizer->stage_skipping_statistics(skipped, sentences);
+          output.append(", \"stage_skipping\": ").append(to_string(stage_skipping[skipping]));
+          output.append(", \"skipped_sentences\": ").append(to_string(sentences ? double(skipped) / sentences : 0.));
+        }
+        if (phase == RECOGNIZE && prefilter) {
+          size_t filtered, sentences;
+          recognizer->candidate_prefilter_statistics(filtered, sentences);
+          output.append(", \"prefiltered_sentences\": ").append(to_string(sentences ? double(filtered) / sentences : 0.));
+        }
+        if (phase == RECOGNIZE && !heldout.forms.empty()) {
+          double f1, recall;
+          heldout_evaluate(heldout, *recognizer, f1, recall);
+          output.append(", \"heldout_f1\": ").append(to_string(f1 * 100));
+          if (prefilter) {
+            // The recall lost by the prefilter is the difference to the recall
+            // of the recognition of all sentences
+            double unfiltered_f1, unfiltered_recall;
+            recognizer->set_candidate_prefilter(false);
+            heldout_evaluate(heldout, *recognizer, unfiltered_f1, unfiltered_recall);
+            recognizer->set_candidate_prefilter(true);
+            output.append(", \"heldout_recall\": ").append(to_string(recall * 100));
+            output.append(", \"heldout_prefilter_recall_loss\": ").append(to_string((unfiltered_recall - recall) * 100));
+          }
+        }
+        auto baseline_run = baseline.find(run_key(output));
+        if (baseline_run != baseline.end())
+          output.append(", \"speedup\": ").append(to_string(corpus.tokens * repeat / seconds / baseline_run->second));
+        long rss = peak_memory_kb();
+        output.append(", \"peak_rss_kb\": ").append(rss >= 0 ? to_string(rss) : "null").append("}\n");
+        cout << output << flush;
+      }
+
+  return 0;
+}
+
+void tokenize_corpus(corpus& corpus, const ner& recognizer) {
+  unique_ptr<tokenizer> tokenizer(recognizer.new_tokenizer());
+  if (!tokenizer) runtime_failure("No tokenizer is defined for the supplied model!");
+
+  vector<string_piece> forms;
+  corpus.sentences.resize(corpus.paragraphs.size());
+  for (size_t p = 0; p < corpus.paragraphs.size(); p++) {
+    tokenizer->set_text(corpus.paragraphs[p]);
+    while (tokenizer->next_sentence(&forms, nullptr)) {
+      corpus.sentences[p].push_back(forms);
+      corpus.tokens += forms.size();
+      corpus.sentence_count++;
+    }
+  }
+}
+
+void load_baseline(const char* fname, unordered_map<string, double>& baseline) {
+  ifstream is(fname);
+  if (!is) runtime_failure("Cannot open baseline file '" << fname << "' for reading!");
+
+  // The tokens per second of every run, identified by its phase, number of
+  // threads and stage skipping probability
+  for (string line; getline(is, line); ) {
+    string tokens_per_second = json_value(line, "tokens_per_second");
+    if (!tokens_per_second.empty())
+      baseline[run_key(line)] = parse_double(tokens_per_second, "baseline tokens per second");
+  }
+}
+
+string json_value(const string& line, const char* key) {
+  // Return the value of the given key of a run printed by this program,
+  // without the quotes of strings, or an empty string if missing
+  string quoted_key = string("\"").append(key).append("\": ");
+  size_t start = line.find(quoted_key);
+  if (start == string::npos) return string();
+  start += quoted_key.size();
+
+  size_t end = line.find_first_of(",}", start);
+  if (end == string::npos) end = line.size();
+  if (end > start && line[start] == '"' && line[end - 1] == '"') start++, end--;
+  return line.substr(start, end - start);
+}
+
+string run_key(const string& line) {
+  return json_value(line, "phase").append(" ").append(json_value(line, "threads")).append(" ").append(json_value(line, "stage_skipping"));
+}
+
+void load_heldout(const char* fname, heldout& heldout) {
+  ifstream is(fname);
+  if (!is) runtime_failure("Cannot open heldout file '" << fname << "' for reading!");
+
+  // Entities start by a B- tag or by an I- tag not continuing an entity of the
+  // same type, and continue by the I- tags of the same type, as in train_ner
+  vector<string> forms, tags, tokens;
+  string line;
+  for (bool eof; true; ) {
+    eof = !getline(is, line);
+    if (eof || line.empty()) {
+      if (!forms.empty()) {
+        heldout.forms.push_back(forms);
+        heldout.entities.emplace_back();
+        for (unsigned i = 0; i < tags.size(); i++) {
+          if (tags[i] == "_" || tags[i] == "O") continue;
+          if (tags[i].size() < 3 || (tags[i].compare(0, 2, "I-") != 0 && tags[i].compare(0, 2, "B-") != 0))
+            runtime_failure("Cannot parse entity type " << tags[i] << " of heldout data!");
+
+          unsigned length = 1;
+          while (i + length < tags.size() && tags[i + length].compare(0, 2, "I-") == 0 && tags[i + length].compare(2, string::npos, tags[i], 2, string::npos) == 0)
+            length++;
+          heldout.entities.back().emplace_back(i, length, tags[i].substr(2));
+          i += length - 1;
+        }
+        forms.clear();
+        tags.clear();
+      }
+      if (eof) break;
+    } else {
+      split(line, '\t', tokens);
+      if (tokens.size() != 2) runtime_failure("The heldout data line '" << line << "' does not contain two columns!");
+      forms.push_back(tokens[0]);
+      tags.push_back(tokens[1]);
+    }
+  }
+}
+
+void heldout_evaluate(const heldout& heldout, const ner& recognizer, double& f1, double& recall) {
+  // The F1-measure and recall of the recognized entities exactly matching the gold ones
+  size_t gold = 0, recognized = 0, correct = 0;
+  vector<string_piece> forms;
+  vector<named_entity> entities;
+  for (unsigned s = 0; s < heldout.forms.size(); s++) {
+    forms.assign(heldout.forms[s].begin(), heldout.forms[s].end());
+    recognizer.recognize(forms, entities);
+
+    gold += heldout.entities[s].size();
+    recognized += entities.size();
+    for (auto&& entity : entities)
+      for (auto&& gold_entity : heldout.entities[s])
+        if (entity.start == gold_entity.start && entity.length == gold_entity.length && entity.type == gold_entity.type)
+          correct++;
+  }
+  f1 = gold + recognized ? 2. * correct / (gold + recognized) : 1.;
+  recall = gold ? double(correct) / gold : 1.;
+}
+
+tagger* load_tagger(const char* fname) {
+  // The recognizer model starts by its ner_id, followed by its tagger
+  ifstream is(fname, ifstream::in | ifstream::binary);
+  if (!is.is_open() || is.get() == EOF) return nullptr;
+
+  return tagger::load_instance(is);
+}
+
+void run_phase(bench_phase phase, const corpus& corpus, const ner& recognizer, const tagger* tagger,
+               int threads, int repeat, double& seconds, vector<double>& latencies) {
+  // The paragraphs of all passes are processed by the given number of threads,
+  // every thread taking the next unprocessed one
+  size_t items = corpus.paragraphs.size() * repeat;
+  latencies.assign(items, 0.);
+  atomic<size_t> next_item(0);
+
+  auto worker = [&] {
+    unique_ptr<tokenizer> tokenizer(recognizer.new_tokenizer());
+    unique_ptr<tagger_context> tagging(tagger ? tagger->new_context() : nullptr);
+    unique_ptr<ner_context> recognizing(recognizer.new_context());
+    vector<vector<string_piece>> sentences;
+    vector<vector<named_entity>> entities;
+    ner_sentence sentence;
+
+    for (size_t item; (item = next_item++) < items; ) {
+      const auto& para = corpus.paragraphs[item % corpus.paragraphs.size()];
+      auto start = chrono::steady_clock::now();
+
+      switch (phase) {
+        case TOKENIZE:
+          tokenizer->set_text(para);
+          for (sentences.resize(1); tokenizer->next_sentence(&sentences[0], nullptr); ) {}
+          break;
+        case TAG:
+          for (auto&& forms : corpus.sentences[item % corpus.paragraphs.size()])
+            tagger->tag(forms, sentence, tagging.get());
+          break;
+        case RECOGNIZE:
+          tokenizer->set_text(para);
+          for (unsigned s = 0; true; s++) {
+            if (s >= sentences.size()) sentences.emplace_back();
+            if (!tokenizer->next_sentence(&sentences[s], nullptr)) {
+              sentences.resize(s);
+              break;
+            }
+          }
+          recognizer.recognize_batch(sentences, entities, *recognizing);
+          break;
+      }
+
+      latencies[item] = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+  };
+
+  auto start = chrono::steady_clock::now();
+  vector<thread> workers;
+  for (int i = 1; i < threads; i++)
+    workers.emplace_back(worker);
+  worker();
+  for (auto&& thread : workers)
+    thread.join();
+  seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
@@ -0,0 +1,463 @@
+// This file is part of NameTag <http://github.com/ufal/nametag/>.
+//
+// Copyright 2016 Institute of Formal and Applied Linguistics, Faculty of
+// Mathematics and Physics, Charles University in Prague, Czech Republic.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <new>
+#include <random>
+
+#include "features/frozen_map.h"
+#include "morphodita/morpho/english_morpho_guesser.h"
+#include "morphodita/morpho/persistent_unordered_map_encoder.h"
+#include "ner/bilou_ner.h"
+#include "utils/iostreams.h"
+#include "utils/options.h"
+#include "utils/paragraph_reader.h"
+#include "utils/parse_int.h"
+#include "version/version.h"
+
+using namespace ufal::nametag;
+
+// The heap allocations are counted by replacing the global operator new.
+// GCC warns about releasing its memory using free when inlining.
+static atomic<size_t> allocations(0);
+
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void* operator new(size_t size) {
+  allocations.fetch_add(1, memory_order_relaxed);
+  if (void* ptr = malloc(size ? size : 1)) return ptr;
+  throw bad_alloc();
+}
+void* operator new[](size_t size) { return operator new(size); }
+void* operator new(size_t size, const nothrow_t&) noexcept {
+  allocations.fetch_add(1, memory_order_relaxed);
+  return malloc(size ? size : 1);
+}
+void* operator new[](size_t size, const nothrow_t& tag) noexcept { return operator new(size, tag); }
+void operator delete(void* ptr) noexcept { free(ptr); }
+void operator delete[](void* ptr) noexcept { free(ptr); }
+void operator delete(void* ptr, const nothrow_t&) noexcept { free(ptr); }
+void operator delete[](void* ptr, const nothrow_t&) noexcept { free(ptr); }
+
+// A benchmarked kernel, processing the given number of items and sentences
+// (zero when the kernel does not process sentences) in every run
+struct kernel {
+  string name;
+  size_t items, sentences;
+  function<void()> run;
+};
+
+// Measurement of the kernels, printing their results and remembering the
+// kernels allocating memory after the first run, which serves as a warm-up
+struct measurement {
+  string input;
+  int repeat;
+  vector<string> allocating;
+
+  void measure(const kernel& kernel);
+};
+
+// Benchmarked sentences, either tokenized from the given corpora,
+// or generated from a synthetic lexicon
+struct sentences {
+  string input;
+  vector<string> paragraphs, lexicon;
+  vector<vector<string_piece>> forms;
+  size_t words = 0;
+};
+
+static void load_sentences(sentences& sentences, const ner& recognizer, int argc, char* argv[]);
+static void synthetic_sentences(sentences& sentences, unsigned count, mt19937& generator);
+static void random_keys(vector<string>& keys, unsigned count, mt19937& generator);
+static bool selected(const string& name, const vector<string>& kernels);
+
+// Volatile sink keeping the results of the lookup kernels alive
+static volatile size_t sink;
+
+namespace ufal {
+namespace nametag {
+
+// The kernels of bilou_ner recognition, using its internal members
+struct bilou_ner_kernels {
+  static void run(const bilou_ner& recognizer, const sentences& sentences, const vector<string>& kernels, measurement& measurement);
+};
+
+} // namespace nametag
+} // namespace ufal
+
+int main(int argc, char* argv[]) {
+  iostreams_init();
+
+  options::map options;
+  if (!options::parse({{"kernels", options::value::any},
+                       {"repeat", options::value::any},
+                       {"sentences", options::value::any},
+                       {"keys", options::value::any},
+                       {"seed", options::value::any},
+                       {"check_allocations", options::value::none},
+                       {"version", options::value::none},
+                       {"help", options::value::none}}, argc, argv, options) ||
+      options.count("help"))
+    runtime_failure("Usage: " << argv[0] << " [options] [recognizer_model [corpus_file...]]\n"
+                    "Options: --kernels=comma separated kernels or kernel groups (default all)\n"
+                    "         --repeat=number of measured runs of every kernel (default 5)\n"
+                    "         --sentences=number of synthetic sentences without corpus (default 2000)\n"
+                    "         --keys=number of keys of the synthetic maps (default 100000)\n"
+                    "         --seed=seed of the synthetic inputs (default 42)\n"
+                    "         --check_allocations (fail if a kernel allocates after warm-up)\n"
+                    "         --version\n"
+                    "         --help");
+  if (options.count("version"))
+    return cout << version::version_and_copyright() << endl, 0;
+
+  int repeat = options.count("repeat") ? parse_int(options["repeat"], "number of repetitions") : 5;
+  if (repeat < 1) runtime_failure("The number of repetitions must be positive!");
+  int sentence_count = options.count("sentences") ? parse_int(options["sentences"], "number of sentences") : 2000;
+  if (sentence_count < 1) runtime_failure("The number of synthetic sentences must be positive!");
+  int key_count = options.count("keys") ? parse_int(options["keys"], "number of keys") : 100000;
+  if (key_count < 1) runtime_failure("The number of synthetic keys must be positive!");
+  mt19937 generator(options.count("seed") ? parse_int(options["seed"], "seed") : 42);
+
+  vector<string> kernels;
+  if (options.count("kernels"))
+    for (size_t start = 0, comma; start <= options["kernels"].size(); start = comma + 1) {
+      if ((comma = options["kernels"].find(',', start)) == string::npos) comma = options["kernels"].size();
+      kernels.push_back(options["kernels"].substr(start, comma - start));
+    }
+
+  // The map kernels use synthetic keys, half of the queries being missing
+  vector<string> keys, queries;
+  random_keys(keys, key_count, generator);
+  random_keys(queries, key_count, generator);
+  for (unsigned i = 0; i < queries.size(); i += 2)
+    queries[i] = keys[generator() % keys.size()];
+
+  measurement synthetic{"synthetic", repeat, {}};
+  if (selected("frozen_map_find", kernels)) {
+    unordered_map<string, ner_feature> elements;
+    for (unsigned i = 0; i < keys.size(); i++)
+      elements.emplace(keys[i], i);
+    frozen_map map;
+    map.build(elements);
+
+    synthetic.measure({"frozen_map_find", queries.size(), 0, [&] {
+      size_t found = 0;
+      for (auto&& query : queries)
+        found += map.find(query) != nullptr;
+      sink = found;
+    }});
+  }
+
+  if (selected("persistent_unordered_map_at", kernels)) {
+    unordered_map<string, unsigned> elements;
+    for (unsigned i = 0; i < keys.size(); i++)
+      elements.emplace(keys[i], i);
+    morphodita::persistent_unordered_map map(elements, 1, [](binary_encoder& enc, unsigned value) { enc.add_4B(value); });
+
+    synthetic.measure({"persistent_unordered_map_at", queries.size(), 0, [&] {
+      size_t found = 0;
+      for (auto&& query : queries)
+        found += map.at(query.c_str(), query.size(), [](pointer_decoder& data) { data.next_4B(); }) != nullptr;
+      sink = found;
+    }});
+  }
+
+  // The English guesser analyzes synthetic lowercase words with common
+  // English negative prefixes and suffixes, short enough to avoid allocating
+  // the lemmas. The guesser has no exceptions.
+  if (selected("english_morpho_guesser", kernels)) {
+    static const char* prefixes[] = {"", "", "", "un", "non", "in"};
+    static const char* suffixes[] = {"", "s", "es", "ies", "ed", "ied", "ing", "er", "est", "ly"};
+    vector<string> words;
+    random_keys(words, key_count, generator);
+    for (auto&& word : words) {
+      word.resize(min(word.size(), size_t(8)));
+      word.insert(0, prefixes[generator() % (sizeof(prefixes) / sizeof(*prefixes))]);
+      word.append(suffixes[generator() % (sizeof(suffixes) / sizeof(*suffixes))]);
+    }
+
+    binary_encoder enc;
+    enc.add_2B(0);
+    morphodita::persistent_unordered_map(unordered_map<string, int>(), 1, [](binary_encoder&, int) {}).save(enc);
+    unordered_map<string, pair<unsigned, unsigned>> negations = {{"un", {2, 3}}, {"non", {3, 3}}, {"in", {2, 4}}};
+    morphodita::persistent_unordered_map(negations, 5, true, false, [](binary_encoder& enc, const pair<unsigned, unsigned>& negation) {
+      enc.add_1B(negation.first);
+      enc.add_1B(negation.second);
+    }).save(enc);
+    binary_decoder data;
+    memcpy(data.fill(enc.data.size()), enc.data.data(), enc.data.size());
+    morphodita::english_morpho_guesser guesser;
+    guesser.load(data);
+    vector<morphodita::tagged_lemma> lemmas;
+
+    synthetic.measure({"english_morpho_guesser", words.size(), 0, [&] {
+      size_t analyses = 0;
+      for (auto&& word : words) {
+        lemmas.clear();
+        guesser.analyze(word, word, lemmas);
+        analyses += lemmas.size();
+      }
+      sink = analyses;
+    }});
+  }
+
+  // The recognition kernels require a model
+  measurement recognition{"", repeat, {}};
+  if (argc >= 2) {
+    cerr << "Loading ner: ";
+    unique_ptr<ner> recognizer(ner::load(argv[1]));
+    if (!recognizer) runtime_failure("Cannot load ner from file '" << argv[1] << "'!");
+    cerr << "done" << endl;
+
+    auto bilou = dynamic_cast<const bilou_ner*>(recognizer.get());
+    if (!bilou) runtime_failure("The recognition kernels support only bilou_ner models!");
+
+    sentences sentences;
+    if (argc > 2) {
+      load_sentences(sentences, *recognizer, argc, argv);
+    } else {
+      synthetic_sentences(sentences, sentence_count, generator);
+    }
+    cerr << "Using " << sentences.forms.size() << " " << sentences.input << " sentences with "
+         << sentences.words << " words." << endl;
+
+    recognition.input = sentences.input;
+    bilou_ner_kernels::run(*bilou, sentences, kernels, recognition);
+  }
+
+  if (options.count("check_allocations")) {
+    vector<string> allocating(synthetic.allocating);
+    allocating.insert(allocating.end(), recognition.allocating.begin(), recognition.allocating.end());
+    if (!allocating.empty()) {
+      string names;
+      for (auto&& name : allocating)
+        names.append(names.empty() ? "" : ", ").append(name);
+      runtime_failure("The following kernels allocate memory after warm-up: " << names << "!");
+    }
+  }
+
+  return 0;
+}
+
+void ufal::nametag::bilou_ner_kernels::run(const bilou_ner& recognizer, const sentences& sentences, const vector<string>& kernels, measurement& measurement) {
+  auto& templates = recognizer.templates;
+  auto& network = recognizer.networks.front();
+  bool stages = recognizer.networks.size() > 1;
+  size_t words = sentences.words, sentences_size = sentences.forms.size();
+
+  // Tag the sentences and compute the features and probabilities of the
+  // first stage, which are the inputs of the individual kernels
+  vector<ner_sentence> tagged(sentences.forms.size());
+  vector<vector<vector<double>>> scores(sentences.forms.size());
+  vector<double> outcomes, buffer;
+  string string_buffer;
+  for (size_t s = 0; s < tagged.size(); s++) {
+    auto& sentence = tagged[s];
+    recognizer.tagger->tag(sentences.forms[s], sentence);
+    sentence.clear_previous_stage();
+    sentence.clear_features();
+    sentence.clear_probabilities_local_filled();
+    templates.process_sentence(sentence, string_buffer, false, stages);
+
+    scores[s].resize(sentence.size);
+    for (unsigned i = 0; i < sentence.size; i++) {
+      network.classify_scores(sentence.word_features(i), sentence.word_features_size(i), scores[s][i], buffer);
+      bilou_ner::fill_bilou_probabilities_from_scores(scores[s][i].data(), scores[s][i].size(), sentence.probabilities[i].local);
+    }
+  }
+
+  vector<kernel> measured;
+  unique_ptr<tagger_context> tagging(recognizer.tagger->new_context());
+  ner_sentence tagger_sentence;
+  measured.push_back({"tag", words, sentences_size, [&] {
+    for (auto&& forms : sentences.forms)
+      recognizer.tagger->tag(forms, tagger_sentence, tagging.get());
+  }});
+
+  // Every feature processor is measured separately, followed by all the
+  // feature templates, which leaves the sentences with all their features.
+  // The cached sentence texts are recomputed in every run.
+  for (auto&& processor : templates.processors)
+    measured.push_back({"features:" + processor.name, words, sentences_size, [&] {
+      for (auto&& sentence : tagged) {
+        sentence.resize(sentence.size);
+        sentence.clear_features();
+        processor.processor->process_sentence(sentence, nullptr, string_buffer);
+      }
+    }});
+  measured.push_back({"features", words, sentences_size, [&] {
+    for (auto&& sentence : tagged) {
+      sentence.resize(sentence.size);
+      sentence.clear_features();
+      templates.process_sentence(sentence, string_buffer, false, stages);
+    }
+  }});
+
+  measured.push_back({"classify", words, sentences_size, [&] {
+    for (auto&& sentence : tagged)
+      for (unsigned i = 0; i < sentence.size; i++)
+        network.classify_scores(sentence.word_features(i), sentence.word_features_size(i), outcomes, buffer);
+  }});
+  measured.push_back({"classify_batch", words, sentences_size, [&] {
+    for (auto&& sentence : tagged)
+      network.classify_scores_batch(sentence.features.data(), sentence.features_offsets.data(), sentence.size, outcomes, buffer);
+  }});
+  measured.push_back({"fill_bilou_probabilities", words, sentences_size, [&] {
+    for (size_t s = 0; s < tagged.size(); s++)
+      for (unsigned i = 0; i < tagged[s].size; i++)
+        bilou_ner::fill_bilou_probabilities_from_scores(scores[s][i].data(), scores[s][i].size(), tagged[s].probabilities[i].local);
+  }});
+  measured.push_back({"bilou_update", words, sentences_size, [&] {
+    for (auto&& sentence : tagged)
+      for (unsigned i = 0; i < sentence.size; i++)
+        if (i == 0) {
+          sentence.global.init(sentence.probabilities[i].local);
+        } else {
+          sentence.global.update(i, sentence.probabilities[i].local);
+        }
+  }});
+  measured.push_back({"best_decoding", words, sentences_size, [&] {
+    for (auto&& sentence : tagged)
+      if (sentence.size)
+        sentence.compute_best_decoding();
+  }});
+
+  // The output consists of storing and processing the decoded entities
+  bilou_ner::cache cache(recognizer);
+  vector<named_entity> entities;
+  measured.push_back({"store_entities", words, sentences_size, [&] {
+    for (auto&& sentence : tagged)
+      recognizer.store_entities(cache, sentence, entities);
+  }});
+
+  // The whole recognition of the sentences, including tagging
+  unique_ptr<ner_context> context(recognizer.new_context());
+  measured.push_back({"recognize", words, sentences_size, [&] {
+    for (auto&& forms : sentences.forms)
+      recognizer.recognize(forms, entities, *context);
+  }});
+
+  for (auto&& kernel : measured)
+    if (selected(kernel.name, kernels))
+      measurement.measure(kernel);
+}
+
+void load_sentences(sentences& sentences, const ner& recognizer, int argc, char* argv[]) {
+  for (int argi = 2; argi < argc; argi++) {
+    ifstream is(argv[argi]);
+    if (!is) runtime_failure("Cannot open file '" << argv[argi] << "' for reading!");
+
+    paragraph_reader reader(is);
+    string_piece para;
+    while (reader.next(para))
+      sentences.paragraphs.emplace_back(para.str, para.len);
+  }
+
+  // The paragraphs are tokenized once all are loaded, so that the forms stay valid
+  unique_ptr<tokenizer> tokenizer(recognizer.new_tokenizer());
+  if (!tokenizer) runtime_failure("No tokenizer is defined for the supplied model!");
+
+  vector<string_piece> forms;
+  for (auto&& para : sentences.paragraphs) {
+    tokenizer->set_text(para);
+    while (tokenizer->next_sentence(&forms, nullptr))
+      if (!forms.empty()) {
+        sentences.forms.push_back(forms);
+        sentences.words += forms.size();
+      }
+  }
+  sentences.input = "corpus";
+}
+
+void synthetic_sentences(sentences& sentences, unsigned count, mt19937& generator) {
+  // The lexicon consists of punctuation, lowercase and capitalized
+  // pseudo-words and numbers, chosen with a Zipf-like distribution.
+  // Every sentence ends by the first lexicon entry, a full stop.
+  vector<string> words;
+  random_keys(words, 5000, generator);
+  for (unsigned i = 0; i < words.size(); i++)
+    if (i % 6 == 5)
+      words[i][0] = words[i][0] - 'a' + 'A';
+    else if (i % 50 == 7)
+      words[i] = to_string(generator() % 10000);
+  sentences.lexicon = {".", ",", "(", ")", "-", ":"};
+  sentences.lexicon.insert(sentences.lexicon.end(), words.begin(), words.end());
+
+  uniform_int_distribution<unsigned> length(5, 40);
+  uniform_real_distribution<double> rank(0., 1.);
+  for (unsigned s = 0; s < count; s++) {
+    sentences.forms.emplace_back(length(generator));
+    for (auto&& form : sentences.forms.back())
+      form = sentences.lexicon[min(sentences.lexicon.size() - 1, size_t(pow(double(sentences.lexicon.size()), rank(generator)) - 1))];
+    sentences.forms.back().back() = sentences.lexicon.front();
+    sentences.words += sentences.forms.back().size();
+  }
+  sentences.input = "synthetic";
+}
+
+void random_keys(vector<string>& keys, unsigned count, mt19937& generator) {
+  uniform_int_distribution<unsigned> length(3, 12), letter('a', 'z');
+
+  keys.resize(count);
+  for (auto&& key : keys) {
+    key.resize(length(generator));
+    for (auto&& chr : key)
+      chr = letter(generator);
+  }
+}
+
+bool selected(const string& name, const vector<string>& kernels) {
+  if (kernels.empty()) return true;
+
+  // A kernel is selected also by a group, which is its name prefix ending by a colon
+  for (auto&& kernel : kernels)
+    if (kernel == name || name.compare(0, kernel.size() + 1, kernel + ":") == 0)
+      return true;
+  return false;
+}
+
+void measurement::measure(const kernel& kernel) {
+  vector<double> seconds;
+  seconds.reserve(repeat);
+  size_t run_allocations = 0;
+  for (int r = 0; r < repeat; r++) {
+    size_t allocations_start = allocations.load();
+    auto start = chrono::steady_clock::now();
+    kernel.run();
+    seconds.push_back(chrono::duration<double>(chrono::steady_clock::now() - start).count());
+    run_allocations = allocations.load() - allocations_start;
+  }
+  sort(seconds.begin(), seconds.end());
+
+  // The allocations of the last run are reported, so a kernel run only once
+  // is never considered allocating after warm-up
+  if (repeat > 1 && run_allocations) allocating.push_back(kernel.name);
+
+  string output;
+  output.assign("{\"kernel\": \"").append(kernel.name);
+  output.append("\", \"input\": \"").append(input);
+  output.append("\", \"items\": ").append(to_string(kernel.items));
+  output.append(", \"runs\": ").append(to_string(seconds.size()));
+  output.append(", \"ns_per_item_min\": ").append(to_string(seconds.front() * 1e9 / kernel.items));
+  output.append(", \"ns_per_item_median\": ").append(to_string(seconds[seconds.size() / 2] * 1e9 / kernel.items));
+  output.append(", \"allocations\": ").append(to_string(run_allocations));
+  if (kernel.sentences)
+    output.append(", \"allocations_per_sentence\": ").append(to_string(double(run_allocations) / kernel.sentences));
+  output.append("}\n");
+  cout << output << flush;
+}
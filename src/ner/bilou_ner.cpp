@@ -7,90 +7,804 @@
 // License, v. 2.0. If a copy of the MPL was not distributed with this
 // file, You can obtain one at http://mozilla.org/MPL/2.0/.
 
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <functional>
+#include <limits>
+#include <sstream>
+#include <system_error>
+#include <thread>
+
 #include "common.h"
 #include "bilou_ner.h"
 #include "bilou/bilou_entity.h"
 #include "bilou/bilou_type.h"
 #include "tokenizer/morphodita_tokenizer_wrapper.h"
+#include "unilib/unicode.h"
+#include "unilib/utf8.h"
+#include "utils/compressor.h"
+#include "utils/memory_streambuf.h"
+#include "utils/tracepoints.h"
+#include "utils/url_detector.h"
 
 namespace ufal {
 namespace nametag {
 
-bilou_ner::bilou_ner(ner_id id) : id(id) {}
+bilou_ner::bilou_ner(ner_id id) : id(id), max_sentence_length(0), pipeline_threads(0), classification_cache_hits(0), classification_cache_misses(0),
+  stage_skipping_probability(0.), stage_skipping_skipped(0), stage_skipping_sentences(0), candidate_prefilter(false), prefilter_filtered(0),
+  prefilter_sentences(0) {}
 
 bool bilou_ner::load(istream& is) {
   if (tagger.reset(tagger::load_instance(is)), !tagger) return false;
-  if (!named_entities.load(is)) return false;
 
-  unique_ptr<tokenizer> tokenizer(new_tokenizer());
-  if (!templates.load(is, nlp_pipeline(tokenizer.get(), tagger.get()))) return false;
+  // Read the remaining sections first, so that they can be decompressed in
+  // parallel; the sections of memory mapped models are not copied
+  unique_ptr<memory_streambuf> entities_raw, templates_raw;
+  if (!compressor::read_raw(is, entities_raw)) return false;
+  if (!compressor::read_raw(is, templates_raw)) return false;
 
   int stages = is.get();
   if (stages == EOF) return false;
+  vector<unique_ptr<memory_streambuf>> networks_raw(stages);
+  for (auto&& network_raw : networks_raw)
+    if (!compressor::read_raw(is, network_raw)) return false;
+
+  unique_ptr<tokenizer> tokenizer(new_tokenizer());
+  nlp_pipeline pipeline(tokenizer.get(), tagger.get(), [this]{ return new_tokenizer(); });
+  pipeline.write_caches = write_gazetteers_cache();
   networks.resize(stages);
-  for (auto&& network : networks)
-    if (!network.load(is)) return false;
 
+  vector<function<bool()>> sections;
+  sections.emplace_back([&]{ istream is(templates_raw.get()); return templates.load(is, pipeline); });
+  sections.emplace_back([&]{ istream is(entities_raw.get()); return named_entities.load(is); });
+  for (int i = 0; i < stages; i++)
+    sections.emplace_back([&, i]{ istream is(networks_raw[i].get()); return networks[i].load(is); });
+
+  if (!load_sections(sections)) return false;
+
+  // Let the taggers fill only the word attributes used by the templates
+  tagger->set_word_attributes(templates.word_attributes());
+  pretagged_tagger.set_word_attributes(templates.word_attributes());
   return true;
 }
 
+bool bilou_ner::load_sections(const vector<function<bool()>>& sections) {
+  // The first section is loaded in this thread, the others in separate threads if possible
+  vector<unsigned char> loaded(sections.size(), false);
+  vector<thread> threads;
+  for (unsigned i = 1; i < sections.size(); i++)
+    try {
+      threads.emplace_back([&, i]{ loaded[i] = sections[i](); });
+    } catch (system_error&) {
+      loaded[i] = sections[i]();
+    }
+
+  if (!sections.empty()) loaded[0] = sections[0]();
+  for (auto&& thread : threads)
+    thread.join();
+
+  return find(loaded.begin(), loaded.end(), false) == loaded.end();
+}
+
 void bilou_ner::recognize(const vector<string_piece>& forms, vector<named_entity>& entities) const {
-  entities.clear();
-  if (forms.empty() || !tagger || !named_entities.size() || !networks.size()) return;
+  // Acquire cache
+  cache* c = caches.pop();
+  if (!c) c = new cache(*this);
+
+  recognize(forms, entities, *c);
 
+  caches.push(c);
+}
+
+void bilou_ner::recognize_batch(const vector<vector<string_piece>>& sentences, vector<vector<named_entity>>& entities) const {
   // Acquire cache
   cache* c = caches.pop();
-  if (!c) c = new cache();
-  auto& sentence = c->sentence;
+  if (!c) c = new cache(*this);
+
+  recognize_batch(sentences, entities, *c);
+
+  caches.push(c);
+}
+
+ner_context* bilou_ner::new_context() const {
+  return new cache(*this);
+}
+
+void bilou_ner::recognize(const vector<string_piece>& forms, vector<named_entity>& entities, ner_context& context) const {
+  cache* c = dynamic_cast<cache*>(&context);
+  if (!c || c->owner != this) return recognize(forms, entities);
+
+  recognize(forms, entities, *c);
+}
+
+void bilou_ner::recognize_batch(const vector<vector<string_piece>>& sentences, vector<vector<named_entity>>& entities, ner_context& context) const {
+  cache* c = dynamic_cast<cache*>(&context);
+  if (!c || c->owner != this) return recognize_batch(sentences, entities);
+
+  recognize_batch(sentences, entities, *c);
+}
+
+void bilou_ner::recognize(const vector<string_piece>& forms, entity_sink& sink, ner_context& context) const {
+  cache* c = dynamic_cast<cache*>(&context);
+  if (!c || c->owner != this) return ner::recognize(forms, sink, context);
+
+  c->sink_sentences.resize(1);
+  c->sink_sentences[0].assign(forms.begin(), forms.end());
+  recognize_batch(c->sink_sentences, sink, *c);
+}
+
+void bilou_ner::recognize_batch(const vector<vector<string_piece>>& sentences, entity_sink& sink, ner_context& context) const {
+  cache* c = dynamic_cast<cache*>(&context);
+  if (!c || c->owner != this) return ner::recognize_batch(sentences, sink, context);
+
+  // The split sentences are recognized after the others, so the batch is
+  // then recognized first and its entities passed afterwards
+  bool split = false;
+  for (auto&& sentence : sentences)
+    split = split || (max_sentence_length && sentence.size() > max_sentence_length);
+
+  if (split) {
+    recognize_batch(sentences, c->sink_entities, *c);
+    for (unsigned i = 0; i < sentences.size(); i++)
+      sink_entities(c->sink_entities[i], i, sink);
+  } else {
+    recognize_batch(sentences, c->sink_entities, *c, &sink);
+  }
+  c->trim_batch_buffers();
+}
+
+void bilou_ner::recognize(const vector<string_piece>& forms, vector<named_entity>& entities, cache& c) const {
+  if (forms.empty() || !tagger || !named_entities.size() || !networks.size()) return entities.clear();
+
+  if (candidate_prefilter && !c.pretagged) {
+    prefilter_sentences.fetch_add(1, memory_order_relaxed);
+    if (!has_candidates(forms)) {
+      prefilter_filtered.fetch_add(1, memory_order_relaxed);
+      return entities.clear();
+    }
+  }
+
+  // Reuse the entities of an identical cached sentence, unless the forms are
+  // pretagged tokens, which would not be distinguished from plain forms
+  sentence_cache* cached = c.pretagged ? nullptr : cached_sentences.get();
+  unsigned generation = 0;
+  if (cached) {
+    generation = cached->generation();
+    sentence_cache::make_key(forms, c.sentence_key);
+    if (cached->find(c.sentence_key, entities)) return filter_entity_subset(c, entities);
+  }
+
+  if (max_sentence_length && forms.size() > max_sentence_length) {
+    recognize_split(forms, entities, c);
+    if (cached) cached->insert(c.sentence_key, entities, generation);
+    return filter_entity_subset(c, entities);
+  }
+
+  // Only the complete entities are cached, not the ones of an entity subset
+  bool subset = !c.entity_subset.empty();
+  if (subset) c.entity_subset_processed = templates.entity_processors(c.entity_subset, c.entity_subset_processors);
+
+  if (c.sentences.empty()) c.sentences.resize(1);
+  auto& sentence = c.sentences[0];
+  NAMETAG_TRACE1(sentence_start, forms.size());
 
   // Tag
-  tagger->tag(forms, sentence);
+  profile_start(c);
+  NAMETAG_TRACE1(tagger_start, 1);
+  tag_sentence(forms, sentence, c, c.tagging.get());
+  NAMETAG_TRACE1(tagger_end, 1);
+  profile_stage(c, PROFILE_TAGGER);
 
-  if (sentence.size) {
-    sentence.clear_previous_stage();
+  // Recognize
+  recognize_tagged(c, 0, 1);
+  store_entities(c, sentence, entities);
+  profile_flush(c);
+  if (cached && !subset) cached->insert(c.sentence_key, entities, generation);
+  NAMETAG_TRACE1(sentence_end, entities.size());
+}
 
-    // Perform required NER stages
-    for (auto&& network : networks) {
-      sentence.clear_features();
-      sentence.clear_probabilities_local_filled();
+void bilou_ner::recognize_batch(const vector<vector<string_piece>>& sentences, vector<vector<named_entity>>& entities, cache& c, entity_sink* sink) const {
+  entities.resize(sentences.size());
+  if (sentences.empty() || !tagger || !named_entities.size() || !networks.size()) {
+    for (auto&& sentence_entities : entities)
+      sentence_entities.clear();
+    return;
+  }
 
-      // Compute per-sentence feature templates
-      templates.process_sentence(sentence, c->string_buffer);
+  if (c.sentences.size() < sentences.size()) c.sentences.resize(sentences.size());
+  NAMETAG_TRACE1(batch_start, sentences.size());
 
-      // Sequentially classify sentence words
-      for (unsigned i = 0; i < sentence.size; i++) {
-        if (!sentence.probabilities[i].local_filled) {
-          network.classify(sentence.features[i], c->outcomes, c->network_buffer);
-          fill_bilou_probabilities(c->outcomes, sentence.probabilities[i].local);
-          sentence.probabilities[i].local_filled = true;
+  // The sentences without candidates have no entities, and are then handled
+  // as the sentences with cached entities
+  c.sentence_cached.assign(sentences.size(), false);
+  if (candidate_prefilter && !c.pretagged) {
+    size_t filtered = 0, checked = 0;
+    for (unsigned i = 0; i < sentences.size(); i++)
+      if (!sentences[i].empty()) {
+        checked++;
+        if (!has_candidates(sentences[i])) {
+          entities[i].clear();
+          c.sentence_cached[i] = true;
+          filtered++;
         }
+      }
+    prefilter_sentences.fetch_add(checked, memory_order_relaxed);
+    prefilter_filtered.fetch_add(filtered, memory_order_relaxed);
+  }
 
-        if (i == 0) {
-          sentence.probabilities[i].global.init(sentence.probabilities[i].local);
-        } else {
-          sentence.probabilities[i].global.update(sentence.probabilities[i].local, sentence.probabilities[i - 1].global);
+  // Reuse the entities of identical cached sentences
+  sentence_cache* cached = c.pretagged ? nullptr : cached_sentences.get();
+  unsigned generation = 0;
+  if (cached) {
+    generation = cached->generation();
+    if (c.sentence_keys.size() < sentences.size()) c.sentence_keys.resize(sentences.size());
+    for (unsigned i = 0; i < sentences.size(); i++)
+      if (!sentences[i].empty() && !c.sentence_cached[i]) {
+        sentence_cache::make_key(sentences[i], c.sentence_keys[i]);
+        c.sentence_cached[i] = cached->find(c.sentence_keys[i], entities[i]);
+        if (c.sentence_cached[i]) filter_entity_subset(c, entities[i]);
+      }
+  }
+
+  // Only the complete entities are cached, not the ones of an entity subset
+  bool subset = !c.entity_subset.empty();
+  if (subset) c.entity_subset_processed = templates.entity_processors(c.entity_subset, c.entity_subset_processors);
+
+  // The decoded entities are passed to the sink directly, unless they are
+  // processed or cached
+  bool sink_direct = sink && !(cached && !subset) && !(subset ? c.entity_subset_processed : templates.processes_entities());
+
+  // Tag all sentences, except for the over-long ones which are split
+  vector<unsigned> split;
+  for (unsigned i = 0; i < sentences.size(); i++)
+    if (!sentences[i].empty() && !c.sentence_cached[i] && max_sentence_length && sentences[i].size() > max_sentence_length)
+      split.push_back(i);
+
+  auto tag_chunk = [&](unsigned begin, unsigned end, tagger_context* tagging) {
+    for (unsigned i = begin; i < end; i++)
+      if (sentences[i].empty() || c.sentence_cached[i] || (max_sentence_length && sentences[i].size() > max_sentence_length))
+        c.sentences[i].resize(0);
+      else
+        tag_sentence(sentences[i], c.sentences[i], c, tagging);
+  };
+
+  // Recognize
+  auto recognize_chunk = [&](unsigned begin, unsigned end) {
+    recognize_tagged(c, begin, end);
+    for (unsigned i = begin; i < end; i++)
+      if (sink_direct && !c.sentence_cached[i]) {
+        sink_decoded(c, c.sentences[i], i, *sink);
+      } else {
+        if (!c.sentence_cached[i]) {
+          store_entities(c, c.sentences[i], entities[i]);
+          if (cached && !subset && c.sentences[i].size) cached->insert(c.sentence_keys[i], entities[i], generation);
         }
+        if (sink) sink_entities(entities[i], i, *sink);
       }
+  };
 
-      sentence.compute_best_decoding();
-      sentence.fill_previous_stage();
+  if (pipeline_threads && sentences.size() > pipeline_chunk) {
+    tag_pipelined(sentences.size(), c, tag_chunk, recognize_chunk);
+  } else {
+    profile_start(c);
+    NAMETAG_TRACE1(tagger_start, sentences.size());
+    tag_chunk(0, sentences.size(), c.tagging.get());
+    NAMETAG_TRACE1(tagger_end, sentences.size());
+    profile_stage(c, PROFILE_TAGGER);
+
+    recognize_chunk(0, sentences.size());
+  }
+  profile_flush(c);
+
+  // The split sentences recognize their chunks as a batch using the cache
+  // buffers, so their cache keys are computed again afterwards
+  for (auto&& i : split) {
+    recognize_split(sentences[i], entities[i], c);
+    if (cached) {
+      sentence_cache::make_key(sentences[i], c.sentence_key);
+      cached->insert(c.sentence_key, entities[i], generation);
     }
+    filter_entity_subset(c, entities[i]);
+  }
+  c.trim_batch_buffers();
+  NAMETAG_TRACE1(batch_end, sentences.size());
+}
 
-    // Store entities in the output array
+bool bilou_ner::recognize_pretagged(const vector<string_piece>& tokens, vector<named_entity>& entities) const {
+  // Acquire cache
+  cache* c = caches.pop();
+  if (!c) c = new cache(*this);
+
+  c->pretagged = true;
+  recognize(tokens, entities, *c);
+  c->pretagged = false;
+
+  caches.push(c);
+  return true;
+}
+
+void bilou_ner::tag_sentence(const vector<string_piece>& forms, ner_sentence& sentence, const cache& c, tagger_context* tagging) const {
+  if (c.pretagged)
+    pretagged_tagger.tag(forms, sentence);
+  else
+    tagger->tag(forms, sentence, tagging);
+}
+
+void bilou_ner::tag_pipelined(unsigned sentences, cache& c, const function<void(unsigned, unsigned, tagger_context*)>& tag_chunk,
+                              const function<void(unsigned, unsigned)>& recognize_chunk) const {
+  // The chunks are tagged in order by the pipeline threads, each with its own
+  // tagger context, and recognized in order by the current thread. The
+  // taggers wait when they get too far ahead, bounding the tagged chunks.
+  unsigned chunks = (sentences + pipeline_chunk - 1) / pipeline_chunk;
+  unsigned threads = min(pipeline_threads, chunks);
+  unsigned max_ahead = pipeline_ahead * threads;
+  while (c.pipeline_tagging.size() < threads)
+    c.pipeline_tagging.emplace_back(tagger->new_context());
+
+  auto chunk_end = [&](unsigned chunk) { return min((chunk + 1) * unsigned(pipeline_chunk), sentences); };
+  vector<unsigned char> tagged(chunks, false);
+  unsigned next_chunk = 0, recognized = 0;
+  double tagging_seconds = 0;
+  mutex pipeline_mutex;
+  condition_variable tagged_cv, recognized_cv;
+
+  NAMETAG_TRACE1(tagger_start, sentences);
+  vector<thread> taggers;
+  for (unsigned t = 0; t < threads; t++)
+    taggers.emplace_back([&, t]() {
+      unique_lock<mutex> lock(pipeline_mutex);
+      while (true) {
+        recognized_cv.wait(lock, [&]{ return next_chunk >= chunks || next_chunk < recognized + max_ahead; });
+        if (next_chunk >= chunks) break;
+        unsigned chunk = next_chunk++;
+
+        lock.unlock();
+        auto start = chrono::steady_clock::now();
+        tag_chunk(chunk * pipeline_chunk, chunk_end(chunk), c.pipeline_tagging[t].get());
+        double seconds = profiling ? chrono::duration<double>(chrono::steady_clock::now() - start).count() : 0.;
+        lock.lock();
+
+        tagged[chunk] = true;
+        tagging_seconds += seconds;
+        if (chunk == recognized) tagged_cv.notify_one();
+      }
+    });
+
+  for (unsigned chunk = 0; chunk < chunks; chunk++) {
+    {
+      unique_lock<mutex> lock(pipeline_mutex);
+      tagged_cv.wait(lock, [&]{ return bool(tagged[chunk]); });
+    }
+    recognize_chunk(chunk * pipeline_chunk, chunk_end(chunk));
+    {
+      lock_guard<mutex> lock(pipeline_mutex);
+      recognized++;
+    }
+    recognized_cv.notify_all();
+  }
+
+  for (auto&& tagger : taggers)
+    tagger.join();
+  NAMETAG_TRACE1(tagger_end, sentences);
+
+  // The tagging time is summed over the pipeline threads
+  profile_start(c);
+  if (profiling) c.profile[PROFILE_TAGGER] += tagging_seconds;
+}
+
+bool bilou_ner::recognize_with_confidences(const vector<string_piece>& forms, vector<named_entity>& entities, vector<double>& confidences) const {
+  if (forms.empty() || !tagger || !named_entities.size() || !networks.size()) return entities.clear(), confidences.clear(), true;
+
+  // Acquire cache
+  cache* c = caches.pop();
+  if (!c) c = new cache(*this);
+  if (c->sentences.empty()) c->sentences.resize(1);
+  auto& sentence = c->sentences[0];
+  NAMETAG_TRACE1(sentence_start, forms.size());
+
+  // Tag and recognize
+  profile_start(*c);
+  NAMETAG_TRACE1(tagger_start, 1);
+  tagger->tag(forms, sentence, c->tagging.get());
+  NAMETAG_TRACE1(tagger_end, 1);
+  profile_stage(*c, PROFILE_TAGGER);
+  recognize_tagged(*c, 0, 1);
+  store_entities(*c, sentence, entities, &confidences);
+  profile_flush(*c);
+  NAMETAG_TRACE1(sentence_end, entities.size());
+
+  caches.push(c);
+  return true;
+}
+
+bool bilou_ner::recognize_nbest(const vector<string_piece>& forms, unsigned n, vector<vector<named_entity>>& decodings, vector<double>& probabilities) const {
+  decodings.clear();
+  probabilities.clear();
+  if (forms.empty() || !n || !tagger || !named_entities.size() || !networks.size()) return true;
+
+  // Acquire cache
+  cache* c = caches.pop();
+  if (!c) c = new cache(*this);
+  if (c->sentences.empty()) c->sentences.resize(1);
+  auto& sentence = c->sentences[0];
+  NAMETAG_TRACE1(sentence_start, forms.size());
+
+  // Tag and recognize
+  profile_start(*c);
+  NAMETAG_TRACE1(tagger_start, 1);
+  tagger->tag(forms, sentence, c->tagging.get());
+  NAMETAG_TRACE1(tagger_end, 1);
+  profile_stage(*c, PROFILE_TAGGER);
+  recognize_tagged(*c, 0, 1);
+
+  // Decode the local probabilities of the last stage
+  vector<bilou_type> bilou_decodings;
+  vector<double> bilou_probabilities;
+  sentence.compute_nbest_decodings(n, bilou_decodings, bilou_probabilities);
+
+  vector<named_entity> entities;
+  for (unsigned d = 0; d < bilou_probabilities.size(); d++) {
+    entities.clear();
+    const bilou_type* bilou = bilou_decodings.data() + d * sentence.size;
     for (unsigned i = 0; i < sentence.size; i++)
-      if (sentence.probabilities[i].global.best == bilou_type_U) {
-        entities.emplace_back(i, 1, named_entities.name(sentence.probabilities[i].global.bilou[bilou_type_U].entity));
-      } else if (sentence.probabilities[i].global.best == bilou_type_B) {
+      if (bilou[i] == bilou_type_U) {
+        entities.emplace_back(i, 1, named_entities.name(sentence.probabilities[i].local.bilou[bilou_type_U].entity));
+      } else if (bilou[i] == bilou_type_B) {
         unsigned start = i++;
-        while (i < sentence.size && sentence.probabilities[i].global.best != bilou_type_L) i++;
-        entities.emplace_back(start, i - start + (i < sentence.size), named_entities.name(sentence.probabilities[start].global.bilou[bilou_type_B].entity));
+        while (bilou[i] != bilou_type_L) i++;
+        entities.emplace_back(start, i - start + 1, named_entities.name(sentence.probabilities[start].local.bilou[bilou_type_B].entity));
       }
-
-    // Process the entities
     templates.process_entities(sentence, entities, c->entities_buffer);
+
+    // The processing of the entities can make different decodings identical
+    unsigned same = 0;
+    while (same < decodings.size() && !(decodings[same].size() == entities.size() &&
+           equal(entities.begin(), entities.end(), decodings[same].begin(), [](const named_entity& a, const named_entity& b) {
+             return a.start == b.start && a.length == b.length && a.type == b.type;
+           }))) same++;
+    if (same < decodings.size()) {
+      probabilities[same] += bilou_probabilities[d];
+      for (; same && probabilities[same] > probabilities[same - 1]; same--) {
+        decodings[same].swap(decodings[same - 1]);
+        swap(probabilities[same], probabilities[same - 1]);
+      }
+    } else {
+      decodings.push_back(entities);
+      probabilities.push_back(bilou_probabilities[d]);
+    }
   }
+  profile_flush(*c);
+  NAMETAG_TRACE1(sentence_end, decodings.size());
 
   caches.push(c);
+  return true;
+}
+
+void bilou_ner::recognize_split(const vector<string_piece>& forms, vector<named_entity>& entities, cache& c) const {
+  // Split the sentence into chunks of max_sentence_length words, the
+  // consecutive ones overlapping by a quarter of their length
+  unsigned overlap = max_sentence_length / 4;
+  vector<vector<string_piece>> chunks;
+  vector<size_t> starts;
+  for (size_t start = 0; ; start += max_sentence_length - overlap) {
+    size_t end = min(start + max_sentence_length, forms.size());
+    chunks.emplace_back(forms.begin() + start, forms.begin() + end);
+    starts.push_back(start);
+    if (end == forms.size()) break;
+  }
+
+  // All entity types of the chunks are needed to merge them, and the entity
+  // subset is applied by the caller
+  vector<vector<named_entity>> chunks_entities;
+  vector<string> entity_subset;
+  entity_subset.swap(c.entity_subset);
+  recognize_batch(chunks, chunks_entities, c);
+  entity_subset.swap(c.entity_subset);
+
+  // Every entity is taken from the chunk whose part without the halves of the
+  // overlaps contains its start, unless it intersects an already taken entity
+  entities.clear();
+  size_t covered = 0;
+  for (unsigned i = 0; i < chunks.size(); i++) {
+    size_t owned_start = i ? starts[i] + overlap / 2 : 0;
+    size_t owned_end = i + 1 < chunks.size() ? starts[i + 1] + overlap / 2 : forms.size();
+    size_t chunk_covered = covered;
+    for (auto&& entity : chunks_entities[i]) {
+      size_t start = starts[i] + entity.start;
+      if (start < owned_start || start >= owned_end || start < covered) continue;
+      entities.emplace_back(start, entity.length, entity.type);
+      chunk_covered = max(chunk_covered, start + entity.length);
+    }
+    covered = chunk_covered;
+  }
+}
+
+void bilou_ner::recognize_tagged(cache& c, unsigned begin, unsigned end) const {
+  for (unsigned s = begin; s < end; s++)
+    if (c.sentences[s].size)
+      c.sentences[s].clear_previous_stage();
+  if (c.classifications.size() != classification_cache_size)
+    c.classifications.assign(classification_cache_size, classification_cache_entry());
+  bool skipping = stage_skipping_probability > 0 && networks.size() > 1;
+  if (skipping) {
+    if (c.stages_skipped.size() < end) c.stages_skipped.resize(end);
+    fill(c.stages_skipped.begin() + begin, c.stages_skipped.begin() + end, false);
+  }
+
+  // Perform required NER stages, each on all sentences
+  for (unsigned stage = 0; stage < networks.size(); stage++) {
+    NAMETAG_TRACE2(stage_start, stage, end - begin);
+    for (unsigned s = begin; s < end; s++) {
+      auto& network = networks[stage];
+      auto& sentence = c.sentences[s];
+      if (!sentence.size || (skipping && c.stages_skipped[s])) continue;
+
+      // Compute per-sentence feature templates. In the following stages,
+      // only the features depending on the previous stage are recomputed.
+      profile_start(c);
+      auto* processor_statistics = profiling ? c.feature_profile.data() : nullptr;
+      if (stage == 0) {
+        sentence.clear_features();
+        sentence.clear_probabilities_local_filled();
+        templates.process_sentence(sentence, c.string_buffer, false, networks.size() > 1, processor_statistics);
+      } else {
+        templates.process_sentence_next_stage(sentence, c.string_buffer, false, processor_statistics);
+      }
+      profile_stage(c, PROFILE_FEATURES);
+
+      // The probabilities are normalized only when the following stages can
+      // be skipped, the decoding itself does not need it
+      bool normalize = skipping && stage + 1 < networks.size();
+      if (normalize && c.normalizers.size() < sentence.size) c.normalizers.resize(sentence.size);
+
+      // Reuse the cached classifications of the feature vectors
+      if (!c.classifications.empty())
+        for (unsigned i = 0; i < sentence.size; i++)
+          if (!sentence.probabilities[i].local_filled) {
+            auto* entry = classification_cache_find(c, stage, sentence, i, normalize);
+            if (entry) {
+              sentence.probabilities[i].local = entry->local;
+              sentence.probabilities[i].local_filled = true;
+              if (normalize) c.normalizers[i] = entry->normalizer;
+            }
+          }
+
+      // Classify sentence words not filled by the feature processors, every
+      // consecutive run of them in a single batch, so that the weights of the
+      // following words are loaded while the current word is classified
+      unsigned outcomes = network.outcomes();
+      for (unsigned i = 0, j; i < sentence.size; i = j) {
+        for (; i < sentence.size && sentence.probabilities[i].local_filled; i++) {}
+        for (j = i; j < sentence.size && !sentence.probabilities[j].local_filled; j++) {}
+        if (j == i) continue;
+
+        network.classify_scores_batch(sentence.features.data(), sentence.features_offsets.data() + i, j - i, c.outcomes, c.network_buffer);
+        for (unsigned k = i; k < j; k++) {
+          const double* scores = c.outcomes.data() + (k - i) * outcomes;
+          fill_bilou_probabilities_from_scores(scores, outcomes, sentence.probabilities[k].local);
+          sentence.probabilities[k].local_filled = true;
+          if (normalize) c.normalizers[k] = bilou_probabilities_normalizer(scores, outcomes);
+          if (!c.classifications.empty()) classification_cache_insert(c, stage, sentence, k, normalize ? c.normalizers[k] : 0);
+        }
+      }
+      profile_stage(c, PROFILE_CLASSIFIERS + stage);
+
+      // Sequentially decode the sentence
+      for (unsigned i = 0; i < sentence.size; i++)
+        if (i == 0) {
+          sentence.global.init(sentence.probabilities[i].local);
+        } else {
+          sentence.global.update(i, sentence.probabilities[i].local);
+        }
+
+      sentence.compute_best_decoding();
+      sentence.fill_previous_stage();
+
+      // Skip the following stages if the decoding of all words is confident,
+      // keeping the current decoding and local probabilities
+      if (normalize) {
+        bool confident = true;
+        for (unsigned i = 0; i < sentence.size && confident; i++)
+          confident = sentence.probabilities[i].local.bilou[sentence.global.best[i]].probability >= stage_skipping_probability * c.normalizers[i];
+        c.stages_skipped[s] = confident;
+      }
+      profile_stage(c, PROFILE_DECODING);
+    }
+    NAMETAG_TRACE2(stage_end, stage, end - begin);
+  }
+
+  if (skipping) {
+    size_t skipped = 0, recognized = 0;
+    for (unsigned s = begin; s < end; s++)
+      if (c.sentences[s].size) {
+        skipped += c.stages_skipped[s];
+        recognized++;
+      }
+    stage_skipping_skipped.fetch_add(skipped, memory_order_relaxed);
+    stage_skipping_sentences.fetch_add(recognized, memory_order_relaxed);
+  }
+
+  if (c.classification_hits || c.classification_misses) {
+    classification_cache_hits.fetch_add(c.classification_hits, memory_order_relaxed);
+    classification_cache_misses.fetch_add(c.classification_misses, memory_order_relaxed);
+    c.classification_hits = c.classification_misses = 0;
+  }
+}
+
+const bilou_ner::classification_cache_entry* bilou_ner::classification_cache_find(cache& c, unsigned stage, const ner_sentence& sentence, unsigned word, bool with_normalizer) const {
+  auto* features = sentence.word_features(word);
+  unsigned features_size = sentence.word_features_size(word);
+  uint64_t hash = classification_hash(stage, features, features_size);
+
+  auto& entry = c.classifications[hash % c.classifications.size()];
+  if (entry.stage == stage && entry.hash == hash && entry.features.size() == features_size &&
+      equal(features, features + features_size, entry.features.begin()) && (!with_normalizer || entry.normalizer)) {
+    c.classification_hits++;
+    return &entry;
+  }
+
+  c.classification_misses++;
+  return nullptr;
+}
+
+void bilou_ner::classification_cache_insert(cache& c, unsigned stage, const ner_sentence& sentence, unsigned word, double normalizer) const {
+  auto* features = sentence.word_features(word);
+  unsigned features_size = sentence.word_features_size(word);
+  uint64_t hash = classification_hash(stage, features, features_size);
+
+  auto& entry = c.classifications[hash % c.classifications.size()];
+  entry.stage = stage;
+  entry.hash = hash;
+  entry.features.assign(features, features + features_size);
+  entry.local = sentence.probabilities[word].local;
+  entry.normalizer = normalizer;
+}
+
+uint64_t bilou_ner::classification_hash(unsigned stage, const ner_feature* features, unsigned features_size) {
+  // FNV-1a of the stage and the features
+  uint64_t hash = 14695981039346656037ULL;
+  hash = (hash ^ stage) * 1099511628211ULL;
+  for (unsigned i = 0; i < features_size; i++)
+    hash = (hash ^ features[i]) * 1099511628211ULL;
+  return hash;
+}
+
+void bilou_ner::store_entities(cache& c, ner_sentence& sentence, vector<named_entity>& entities, vector<double>* confidences) const {
+  if (confidences) confidences->clear();
+  if (!sentence.size) return entities.clear();
+
+  // Store entities in the output array. The already present elements are
+  // overwritten, so that the capacity of their type strings is reused.
+  // With an entity subset and no processors adding its entities, only the
+  // entities of the subset are stored.
+  size_t stored = 0;
+  const vector<unsigned char>* stored_ids = !c.entity_subset.empty() && !c.entity_subset_processed ? &c.entity_subset_ids : nullptr;
+  auto store_entity = [this, &entities, &stored, stored_ids](size_t start, size_t length, entity_type entity) {
+    if (stored_ids && (entity >= stored_ids->size() || !(*stored_ids)[entity])) return;
+    if (stored < entities.size()) {
+      entities[stored].start = start;
+      entities[stored].length = length;
+      entities[stored].type.assign(named_entities.name(entity));
+    } else {
+      entities.emplace_back(start, length, named_entities.name(entity));
+    }
+    stored++;
+  };
+
+  decoded_entities(sentence, store_entity);
+  entities.resize(stored);
+
+  // Compute the confidences of the decoded entities as their marginal probabilities
+  if (confidences) {
+    sentence.compute_marginals();
+    for (auto&& entity : entities)
+      confidences->push_back(sentence.entity_probability(entity.start, entity.length));
+    c.decoded_entities = entities;
+    c.decoded_confidences = *confidences;
+  }
+
+  // Process the entities, using only the processors adding entities of the
+  // entity subset if any, whose other entities are then removed
+  profile_start(c);
+  if (c.entity_subset.empty()) {
+    templates.process_entities(sentence, entities, c.entities_buffer);
+  } else if (c.entity_subset_processed) {
+    templates.process_entities(sentence, entities, c.entities_buffer, &c.entity_subset_processors);
+    filter_entity_subset(c, entities);
+  }
+  profile_stage(c, PROFILE_ENTITIES);
+
+  // The entities added by the processing have confidence 1
+  if (confidences) {
+    confidences->assign(entities.size(), 1.);
+    for (unsigned i = 0; i < entities.size(); i++) {
+      unsigned d = 0;
+      while (d < c.decoded_entities.size() && !(c.decoded_entities[d].start == entities[i].start &&
+             c.decoded_entities[d].length == entities[i].length && c.decoded_entities[d].type == entities[i].type)) d++;
+      if (d < c.decoded_entities.size()) (*confidences)[i] = c.decoded_confidences[d];
+    }
+  }
+}
+
+template <class F>
+void bilou_ner::decoded_entities(const ner_sentence& sentence, F f) const {
+  for (unsigned i = 0; i < sentence.size; i++)
+    if (sentence.global.best[i] == bilou_type_U) {
+      f(i, 1, sentence.global.entities[i][bilou_type_U]);
+    } else if (sentence.global.best[i] == bilou_type_B) {
+      unsigned start = i++;
+      while (i < sentence.size && sentence.global.best[i] != bilou_type_L) i++;
+      f(start, i - start + (i < sentence.size), sentence.global.entities[start][bilou_type_B]);
+    }
+}
+
+void bilou_ner::sink_decoded(const cache& c, const ner_sentence& sentence, unsigned index, entity_sink& sink) const {
+  const vector<unsigned char>* ids = c.entity_subset.empty() ? nullptr : &c.entity_subset_ids;
+  decoded_entities(sentence, [this, index, ids, &sink](unsigned start, unsigned length, entity_type entity) {
+    if (ids && (entity >= ids->size() || !(*ids)[entity])) return;
+    const string& type = named_entities.name(entity);
+    sink.on_entity(index, start, length, entity < named_entities.size() ? int(entity) : -1, string_piece(type.c_str(), type.size()));
+  });
+}
+
+void bilou_ner::sink_entities(vector<named_entity>& entities, unsigned index, entity_sink& sink) const {
+  auto lt = [](const named_entity& a, const named_entity& b) {
+    return a.start < b.start || (a.start == b.start && a.length > b.length);
+  };
+  if (!is_sorted(entities.begin(), entities.end(), lt))
+    sort(entities.begin(), entities.end(), lt);
+
+  for (auto&& entity : entities) {
+    entity_type id = named_entities.parse(entity.type.c_str());
+    sink.on_entity(index, entity.start, entity.length, id == entity_type_unknown ? -1 : int(id), string_piece(entity.type.c_str(), entity.type.size()));
+  }
+}
+
+void bilou_ner::filter_entity_subset(const cache& c, vector<named_entity>& entities) {
+  if (c.entity_subset.empty()) return;
+
+  entities.erase(remove_if(entities.begin(), entities.end(), [&c](const named_entity& entity) {
+    return !binary_search(c.entity_subset.begin(), c.entity_subset.end(), entity.type);
+  }), entities.end());
+}
+
+bool bilou_ner::cache::set_entity_types(const vector<string>& types) {
+  // Every type must be decoded or added by some processor of the entities
+  vector<string> subset(types);
+  sort(subset.begin(), subset.end());
+  subset.erase(unique(subset.begin(), subset.end()), subset.end());
+  vector<string> type(1);
+  vector<unsigned char> processors;
+  for (auto&& entity : subset) {
+    type[0] = entity;
+    if (owner->named_entities.parse(entity.c_str()) == entity_type_unknown && !owner->templates.entity_processors(type, processors))
+      return false;
+  }
+
+  entity_subset.swap(subset);
+  entity_subset_ids.assign(owner->named_entities.size(), false);
+  for (auto&& entity : entity_subset) {
+    entity_type id = owner->named_entities.parse(entity.c_str());
+    if (id != entity_type_unknown) entity_subset_ids[id] = true;
+  }
+  return true;
+}
+
+template <class T>
+static void trim_buffers(vector<T>& buffers, size_t size) {
+  if (buffers.size() > size) {
+    buffers.resize(size);
+    buffers.shrink_to_fit();
+  }
+}
+
+void bilou_ner::cache::trim_batch_buffers() {
+  trim_buffers(sentences, cache_retained_sentences);
+  trim_buffers(sentence_keys, cache_retained_sentences);
+  trim_buffers(sentence_cached, cache_retained_sentences);
+  trim_buffers(stages_skipped, cache_retained_sentences);
+  trim_buffers(sink_entities, cache_retained_sentences);
 }
 
 tokenizer* bilou_ner::new_tokenizer() const {
@@ -110,19 +824,282 @@ void bilou_ner::gazetteers(vector<string>& gazetteers, vector<int>* gazetteer_ty
   templates.gazetteers(gazetteers, gazetteer_types);
 }
 
-void bilou_ner::fill_bilou_probabilities(const vector<double>& outcomes, bilou_probabilities& prob) {
-  for (auto&& prob_bilou : prob.bilou)
-    prob_bilou.probability = -1;
-
-  for (bilou_entity::value i = 0; i < outcomes.size(); i++) {
-    auto bilou = bilou_entity::get_bilou(i);
-    if (outcomes[i] > prob.bilou[bilou].probability) {
-      prob.bilou[bilou].probability = outcomes[i];
-      prob.bilou[bilou].entity = bilou_entity::get_entity(i);
+bool bilou_ner::reload_gazetteers() {
+  unique_ptr<tokenizer> tokenizer(new_tokenizer());
+  nlp_pipeline pipeline(tokenizer.get(), tagger.get(), [this]{ return new_tokenizer(); });
+  pipeline.write_caches = write_gazetteers_cache();
+
+  if (!templates.reload_gazetteers(pipeline)) return false;
+
+  if (cached_sentences) cached_sentences->clear();
+  return true;
+}
+
+bool bilou_ner::set_analysis_cache(size_t forms) {
+  return tagger && tagger->set_analysis_cache(forms);
+}
+
+void bilou_ner::analysis_cache_statistics(size_t& hits, size_t& misses) const {
+  hits = misses = 0;
+  if (tagger) tagger->analysis_cache_statistics(hits, misses);
+}
+
+bool bilou_ner::set_classification_cache(size_t feature_vectors) {
+  classification_cache_size = feature_vectors;
+  classification_cache_hits = classification_cache_misses = 0;
+  return true;
+}
+
+void bilou_ner::classification_cache_statistics(size_t& hits, size_t& misses) const {
+  hits = classification_cache_hits.load(memory_order_relaxed);
+  misses = classification_cache_misses.load(memory_order_relaxed);
+}
+
+bool bilou_ner::set_sentence_cache(size_t sentences) {
+  cached_sentences.reset(sentences ? new sentence_cache(sentences) : nullptr);
+  return true;
+}
+
+void bilou_ner::sentence_cache_statistics(size_t& hits, size_t& misses) const {
+  hits = cached_sentences ? cached_sentences->hits() : 0;
+  misses = cached_sentences ? cached_sentences->misses() : 0;
+}
+
+bool bilou_ner::set_stage_skipping(double probability) {
+  stage_skipping_probability = max(probability, 0.);
+  stage_skipping_skipped = stage_skipping_sentences = 0;
+  if (cached_sentences) cached_sentences->clear();
+  return true;
+}
+
+void bilou_ner::stage_skipping_statistics(size_t& skipped, size_t& sentences) const {
+  skipped = stage_skipping_skipped.load(memory_order_relaxed);
+  sentences = stage_skipping_sentences.load(memory_order_relaxed);
+}
+
+bool bilou_ner::set_candidate_prefilter(bool enabled) {
+  candidate_prefilter = enabled;
+  prefilter_filtered = prefilter_sentences = 0;
+  if (cached_sentences) cached_sentences->clear();
+  return true;
+}
+
+void bilou_ner::candidate_prefilter_statistics(size_t& filtered, size_t& sentences) const {
+  filtered = prefilter_filtered.load(memory_order_relaxed);
+  sentences = prefilter_sentences.load(memory_order_relaxed);
+}
+
+bool bilou_ner::has_candidates(const vector<string_piece>& forms) const {
+  // Uppercase and caseless letters and digits are checked first, being the
+  // usual candidates, then URLs and emails and finally the gazetteers
+  for (auto&& form : forms)
+    for (const char* str = form.str, *end = form.str + form.len; str < end; ) {
+      unsigned char chr = *str;
+      if (chr < 0x80) {
+        if ((chr >= 'A' && chr <= 'Z') || (chr >= '0' && chr <= '9')) return true;
+        str++;
+        continue;
+      }
+      size_t len = end - str;
+      if (unilib::unicode::category(unilib::utf8::decode(str, len)) & (unilib::unicode::Lut | unilib::unicode::Lo | unilib::unicode::Nd))
+        return true;
+    }
+
+  for (auto&& form : forms)
+    if (utils::url_detector::detect(form) != utils::url_detector::NO_URL) return true;
+
+  return templates.may_start_match(forms);
+}
+
+bool bilou_ner::set_tagger_beam_size(int beam_size) {
+  if (!tagger || !tagger->set_beam_size(beam_size)) return false;
+
+  if (cached_sentences) cached_sentences->clear();
+  return true;
+}
+
+bool bilou_ner::set_tagger_fast_mode(bool fast) {
+  if (!tagger || !tagger->set_fast_mode(fast)) return false;
+
+  if (cached_sentences) cached_sentences->clear();
+  return true;
+}
+
+bool bilou_ner::set_max_sentence_length(int max_length) {
+  max_sentence_length = max(max_length, 0);
+  if (cached_sentences) cached_sentences->clear();
+  return true;
+}
+
+bool bilou_ner::set_pipeline_threads(int threads) {
+  pipeline_threads = max(threads, 0);
+  return true;
+}
+
+void bilou_ner::memory_usage(vector<string>& components, vector<size_t>& bytes) const {
+  components.clear();
+  bytes.clear();
+
+  if (tagger) tagger->memory_usage(components, bytes);
+  templates.memory_usage(components, bytes);
+  for (unsigned stage = 0; stage < networks.size(); stage++) {
+    components.push_back("classifier stage " + to_string(stage + 1));
+    bytes.push_back(networks[stage].memory_usage());
+  }
+}
+
+size_t bilou_ner::pooled_states() const {
+  return caches.size();
+}
+
+bool bilou_ner::set_stage_profiling(bool profiling) {
+  this->profiling = profiling;
+
+  vector<string> processors;
+  templates.processor_names(processors);
+  profile_seconds.assign(profiling ? PROFILE_CLASSIFIERS + networks.size() : 0, 0.);
+  profile_features.assign(profiling ? processors.size() : 0, feature_templates::processor_statistics());
+  templates.count_lookups(profiling);
+  return true;
+}
+
+void bilou_ner::stage_profiling_statistics(vector<string>& stages, vector<double>& seconds) const {
+  stages.clear();
+  seconds.clear();
+  if (!profiling) return;
+
+  lock_guard<mutex> lock(profile_mutex);
+  vector<string> processors;
+  templates.processor_names(processors);
+
+  stages.push_back("tagger");
+  seconds.push_back(profile_seconds[PROFILE_TAGGER]);
+
+  // The time of the feature processing outside of the processors is reported separately
+  double features_other = profile_seconds[PROFILE_FEATURES];
+  for (unsigned i = 0; i < processors.size(); i++) {
+    stages.push_back("feature " + processors[i]);
+    seconds.push_back(profile_features[i].seconds);
+    features_other -= profile_features[i].seconds;
+  }
+  stages.push_back("feature vocabularies and merging");
+  seconds.push_back(max(features_other, 0.));
+
+  for (unsigned stage = 0; stage < networks.size(); stage++) {
+    stages.push_back("classifier stage " + to_string(stage + 1));
+    seconds.push_back(profile_seconds[PROFILE_CLASSIFIERS + stage]);
+  }
+  stages.push_back("decoding");
+  seconds.push_back(profile_seconds[PROFILE_DECODING]);
+  stages.push_back("entity processing");
+  seconds.push_back(profile_seconds[PROFILE_ENTITIES]);
+}
+
+void bilou_ner::template_statistics(vector<feature_template_statistics>& statistics) const {
+  statistics.clear();
+  if (!profiling) return;
+
+  vector<string> processors;
+  vector<size_t> lookups, lookup_hits;
+  templates.processor_names(processors);
+  templates.lookup_statistics(lookups, lookup_hits);
+
+  lock_guard<mutex> lock(profile_mutex);
+  statistics.resize(processors.size());
+  for (unsigned i = 0; i < processors.size(); i++) {
+    statistics[i].name = processors[i];
+    statistics[i].calls = profile_features[i].calls;
+    statistics[i].seconds = profile_features[i].seconds;
+    statistics[i].features = profile_features[i].features;
+    statistics[i].lookups = lookups[i];
+    statistics[i].lookup_hits = lookup_hits[i];
+  }
+}
+
+void bilou_ner::profile_start(cache& c) const {
+  if (!profiling) return;
+
+  if (c.profile.size() != profile_seconds.size()) c.profile.assign(profile_seconds.size(), 0.);
+  if (c.feature_profile.size() != profile_features.size()) c.feature_profile.assign(profile_features.size(), feature_templates::processor_statistics());
+  c.profile_time = chrono::steady_clock::now();
+}
+
+void bilou_ner::profile_stage(cache& c, unsigned stage) const {
+  if (!profiling) return;
+
+  // The following stage starts when this one ends
+  auto now = chrono::steady_clock::now();
+  c.profile[stage] += chrono::duration<double>(now - c.profile_time).count();
+  c.profile_time = now;
+}
+
+void bilou_ner::profile_flush(cache& c) const {
+  if (!profiling || c.profile.empty()) return;
+
+  lock_guard<mutex> lock(profile_mutex);
+  for (unsigned i = 0; i < c.profile.size(); i++)
+    profile_seconds[i] += c.profile[i], c.profile[i] = 0.;
+  for (unsigned i = 0; i < c.feature_profile.size(); i++) {
+    profile_features[i].calls += c.feature_profile[i].calls;
+    profile_features[i].seconds += c.feature_profile[i].seconds;
+    profile_features[i].features += c.feature_profile[i].features;
+    c.feature_profile[i] = feature_templates::processor_statistics();
+  }
+}
+
+void bilou_ner::best_bilou_values(const double* values, unsigned values_size, array<double, bilou_type_total>& best, bilou_probabilities& prob) {
+  best.fill(-numeric_limits<double>::infinity());
+
+  // The outcomes are I, L and O, followed by B and U of every entity, so
+  // instead of decoding every outcome, the B and U outcomes are visited in pairs
+  const bilou_type outcome_bilou[] = {bilou_type_I, bilou_type_L, bilou_type_O};
+  for (unsigned i = 0; i < bilou_entity::B_first && i < values_size; i++)
+    if (values[i] > best[outcome_bilou[i]]) {
+      best[outcome_bilou[i]] = values[i];
+      prob.bilou[outcome_bilou[i]].entity = entity_type_unknown;
+    }
+
+  entity_type entity = 0;
+  for (unsigned i = bilou_entity::B_first; i < values_size; i += 2, entity++) {
+    if (values[i] > best[bilou_type_B]) {
+      best[bilou_type_B] = values[i];
+      prob.bilou[bilou_type_B].entity = entity;
+    }
+    if (i + 1 < values_size && values[i + 1] > best[bilou_type_U]) {
+      best[bilou_type_U] = values[i + 1];
+      prob.bilou[bilou_type_U].entity = entity;
     }
   }
 }
 
+void bilou_ner::fill_bilou_probabilities(const vector<double>& outcomes, bilou_probabilities& prob) {
+  array<double, bilou_type_total> best;
+  best_bilou_values(outcomes.data(), outcomes.size(), best, prob);
+
+  for (unsigned bilou = 0; bilou < bilou_type_total; bilou++)
+    prob.bilou[bilou].probability = best[bilou];
+}
+
+void bilou_ner::fill_bilou_probabilities_from_scores(const double* scores, unsigned scores_size, bilou_probabilities& prob) {
+  // The decoding only compares probabilities of the same word and ratios of
+  // probabilities of the previous word, so it is enough to compute the
+  // probabilities up to a multiplicative constant. We therefore exponentiate
+  // only the best score of every bilou type, relative to the best score overall.
+  array<double, bilou_type_total> best_scores;
+  best_bilou_values(scores, scores_size, best_scores, prob);
+  double best_score = *max_element(best_scores.begin(), best_scores.end());
+
+  for (unsigned bilou = 0; bilou < bilou_type_total; bilou++)
+    prob.bilou[bilou].probability = exp(best_scores[bilou] - best_score);
+}
+
+double bilou_ner::bilou_probabilities_normalizer(const double* scores, unsigned scores_size) {
+  double best_score = *max_element(scores, scores + scores_size), normalizer = 0;
+  for (unsigned i = 0; i < scores_size; i++)
+    normalizer += exp(scores[i] - best_score);
+  return normalizer;
+}
+
 tokenizer* bilou_ner::new_tokenizer(ner_id id) {
   switch (id) {
     case ner_id::CZECH_NER:
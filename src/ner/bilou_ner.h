@@ -9,6 +9,11 @@
 
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+
 #include "common.h"
 #include "bilou/bilou_entity.h"
 #include "classifier/network_classifier.h"
@@ -16,6 +21,8 @@
 #include "features/feature_templates.h"
 #include "ner.h"
 #include "ner_ids.h"
+#include "sentence_cache.h"
+#include "tagger/external_tagger.h"
 #include "tagger/tagger.h"
 #include "tokenizer/tokenizer.h"
 #include "utils/threadsafe_stack.h"
@@ -30,13 +37,44 @@ class bilou_ner : public ner {
   bool load(istream& is);
 
   virtual void recognize(const vector<string_piece>& forms, vector<named_entity>& entities) const override;
+  virtual void recognize_batch(const vector<vector<string_piece>>& sentences, vector<vector<named_entity>>& entities) const override;
+  virtual bool recognize_with_confidences(const vector<string_piece>& forms, vector<named_entity>& entities, vector<double>& confidences) const override;
+  virtual bool recognize_nbest(const vector<string_piece>& forms, unsigned n, vector<vector<named_entity>>& decodings, vector<double>& probabilities) const override;
+  virtual bool recognize_pretagged(const vector<string_piece>& tokens, vector<named_entity>& entities) const override;
+  virtual ner_context* new_context() const override;
+  virtual void recognize(const vector<string_piece>& forms, vector<named_entity>& entities, ner_context& context) const override;
+  virtual void recognize_batch(const vector<vector<string_piece>>& sentences, vector<vector<named_entity>>& entities, ner_context& context) const override;
+  virtual void recognize(const vector<string_piece>& forms, entity_sink& sink, ner_context& context) const override;
+  virtual void recognize_batch(const vector<vector<string_piece>>& sentences, entity_sink& sink, ner_context& context) const override;
   virtual tokenizer* new_tokenizer() const override;
 
   virtual void entity_types(vector<string>& types) const override;
 
   virtual void gazetteers(vector<string>& gazetteers, vector<int>* gazetteer_types) const override;
+  virtual bool reload_gazetteers() override;
+  virtual bool set_analysis_cache(size_t forms) override;
+  virtual void analysis_cache_statistics(size_t& hits, size_t& misses) const override;
+  virtual bool set_classification_cache(size_t feature_vectors) override;
+  virtual void classification_cache_statistics(size_t& hits, size_t& misses) const override;
+  virtual bool set_sentence_cache(size_t sentences) override;
+  virtual void sentence_cache_statistics(size_t& hits, size_t& misses) const override;
+  virtual bool set_stage_skipping(double probability) override;
+  virtual void stage_skipping_statistics(size_t& skipped, size_t& sentences) const override;
+  virtual bool set_candidate_prefilter(bool enabled) override;
+  virtual void candidate_prefilter_statistics(size_t& filtered, size_t& sentences) const override;
+  virtual bool set_tagger_beam_size(int beam_size) override;
+  virtual bool set_tagger_fast_mode(bool fast) override;
+  virtual bool set_max_sentence_length(int max_length) override;
+  virtual bool set_pipeline_threads(int threads) override;
+  virtual void memory_usage(vector<string>& components, vector<size_t>& bytes) const override;
+  virtual size_t pooled_states() const override;
+  virtual bool set_stage_profiling(bool profiling) override;
+  virtual void stage_profiling_statistics(vector<string>& stages, vector<double>& seconds) const override;
+  virtual void template_statistics(vector<feature_template_statistics>& statistics) const override;
  private:
+  friend class bilou_ner_converter;
   friend class bilou_ner_trainer;
+  friend struct bilou_ner_kernels;
 
   // Methods used by bylou_ner_trainer
   static void fill_bilou_probabilities(const vector<double>& outcomes, bilou_probabilities& prob);
@@ -45,17 +83,154 @@ class bilou_ner : public ner {
   // Internal members of bilou_ner
   ner_id id;
   unique_ptr<ufal::nametag::tagger> tagger;
+  // Tagger of pretagged tokens, used instead of the tagger of the model
+  external_tagger pretagged_tagger;
   entity_map named_entities;
   feature_templates templates;
   vector<network_classifier> networks;
+  unsigned max_sentence_length;
+
+  // Number of threads tagging the sentences of a batch in chunks of
+  // pipeline_chunk sentences, while the tagged chunks are recognized by the
+  // calling thread; zero when the tagging is not pipelined. The taggers are
+  // at most pipeline_ahead chunks per thread ahead of the recognition.
+  unsigned pipeline_threads;
+  enum { pipeline_chunk = 16, pipeline_ahead = 2 };
+
+  // Number of per-sentence buffers a cache retains after a batch, so that
+  // a single huge batch does not pin its memory in every parked cache
+  enum { cache_retained_sentences = 64 };
+
+  // Classification cache of every thread, storing the local probabilities of
+  // a feature vector of a stage in the entry given by its hash, together with
+  // their normalizer if it was computed (zero otherwise). The hits and
+  // misses are counted in the thread cache and added to the totals after
+  // every recognize_tagged.
+  struct classification_cache_entry {
+    unsigned stage = ~0U;
+    uint64_t hash = 0;
+    vector<ner_feature> features;
+    bilou_probabilities local;
+    double normalizer = 0;
+  };
+  size_t classification_cache_size = 0;
+  mutable atomic<size_t> classification_cache_hits, classification_cache_misses;
+
+  // Cache of the entities of recognized sentences shared by all threads,
+  // cleared whenever the recognition results can change
+  unique_ptr<sentence_cache> cached_sentences;
+
+  // Minimum normalized probability of the decoded bilou types of all words of
+  // a sentence needed to skip its following stages, zero when the stages are
+  // never skipped, and the counts of skipped and all multi-stage sentences
+  double stage_skipping_probability;
+  mutable atomic<size_t> stage_skipping_skipped, stage_skipping_sentences;
+
+  // Whether the sentences without candidates of entities are not recognized,
+  // see ner::set_candidate_prefilter, and the counts of such and all checked
+  // sentences
+  bool candidate_prefilter;
+  mutable atomic<size_t> prefilter_filtered, prefilter_sentences;
+  bool has_candidates(const vector<string_piece>& forms) const;
 
-  struct cache {
-    ner_sentence sentence;
+  struct cache : public ner_context {
+    const bilou_ner* owner;
+    unique_ptr<tagger_context> tagging;
+    vector<ner_sentence> sentences;
     vector<double> outcomes, network_buffer;
     string string_buffer;
     vector<named_entity> entities_buffer;
+    vector<named_entity> decoded_entities;
+    vector<double> decoded_confidences;
+    vector<double> profile;
+    vector<feature_templates::processor_statistics> feature_profile;
+    chrono::steady_clock::time_point profile_time;
+    vector<classification_cache_entry> classifications;
+    size_t classification_hits = 0, classification_misses = 0;
+    string sentence_key;
+    vector<string> sentence_keys;
+    vector<unsigned char> sentence_cached;
+    vector<unsigned char> stages_skipped;
+    vector<double> normalizers;
+    vector<unique_ptr<tagger_context>> pipeline_tagging;
+    bool pretagged = false;
+    // The sorted entity types returned when not empty, see
+    // ner_context::set_entity_types, the entity ids among them and the
+    // processors of entities adding some of them, computed by every
+    // recognition as the gazetteers can be reloaded
+    vector<string> entity_subset;
+    vector<unsigned char> entity_subset_ids;
+    vector<unsigned char> entity_subset_processors;
+    bool entity_subset_processed = false;
+    // Buffers of the recognitions passing the entities to a sink
+    vector<vector<string_piece>> sink_sentences;
+    vector<vector<named_entity>> sink_entities;
+
+    cache(const bilou_ner& self) : owner(&self), tagging(self.tagger ? self.tagger->new_context() : nullptr) {}
+
+    virtual bool set_entity_types(const vector<string>& types) override;
+
+    // Release the per-sentence buffers above cache_retained_sentences
+    void trim_batch_buffers();
   };
   mutable threadsafe_stack<cache> caches;
+
+  // Recognize using the given cache or context
+  void recognize(const vector<string_piece>& forms, vector<named_entity>& entities, cache& c) const;
+  // With a sink, the entities are passed to it and the given entities are
+  // used only as buffers; no sentence may then be split
+  void recognize_batch(const vector<vector<string_piece>>& sentences, vector<vector<named_entity>>& entities, cache& c, entity_sink* sink = nullptr) const;
+  void recognize_split(const vector<string_piece>& forms, vector<named_entity>& entities, cache& c) const;
+  // Tag the forms using the tagger of the model and the given tagger context,
+  // or parse them as pretagged tokens
+  void tag_sentence(const vector<string_piece>& forms, ner_sentence& sentence, const cache& c, tagger_context* tagging) const;
+  // Tag the sentences of the batch using the pipeline threads, calling
+  // recognize_chunk by the current thread on every tagged chunk in order
+  void tag_pipelined(unsigned sentences, cache& c, const function<void(unsigned, unsigned, tagger_context*)>& tag_chunk,
+                     const function<void(unsigned, unsigned)>& recognize_chunk) const;
+
+  // Recognize the already tagged sentences [begin, end) in the cache
+  void recognize_tagged(cache& c, unsigned begin, unsigned end) const;
+  void store_entities(cache& c, ner_sentence& sentence, vector<named_entity>& entities, vector<double>* confidences = nullptr) const;
+  // Remove the entities not in the entity subset of the cache
+  static void filter_entity_subset(const cache& c, vector<named_entity>& entities);
+  // Call the given function with the start, length and entity id of every
+  // decoded entity of the sentence, in order
+  template <class F> void decoded_entities(const ner_sentence& sentence, F f) const;
+  // Pass the decoded entities of the entity subset of the cache, or the given
+  // entities after sorting, as the entities of the given sentence to the sink
+  void sink_decoded(const cache& c, const ner_sentence& sentence, unsigned index, entity_sink& sink) const;
+  void sink_entities(vector<named_entity>& entities, unsigned index, entity_sink& sink) const;
+  static void fill_bilou_probabilities_from_scores(const double* scores, unsigned scores_size, bilou_probabilities& prob);
+  // Return the sum of the probabilities filled by the above method over all
+  // the scores, dividing by which gives the normalized probabilities
+  static double bilou_probabilities_normalizer(const double* scores, unsigned scores_size);
+  // Return the cached local probabilities of the features of the given word
+  // in the given stage, or nullptr; the insert caches the current ones
+  // The entries without a normalizer are not found if with_normalizer is set
+  const classification_cache_entry* classification_cache_find(cache& c, unsigned stage, const ner_sentence& sentence, unsigned word, bool with_normalizer) const;
+  void classification_cache_insert(cache& c, unsigned stage, const ner_sentence& sentence, unsigned word, double normalizer) const;
+  static inline uint64_t classification_hash(unsigned stage, const ner_feature* features, unsigned features_size);
+  // Store the best of the given values of every bilou type, together with the
+  // entity of its outcome, the first one on ties
+  static inline void best_bilou_values(const double* values, unsigned values_size, array<double, bilou_type_total>& best, bilou_probabilities& prob);
+
+  // Profiling of the recognition stages. The times are accumulated in the
+  // cache profile, whose elements are the stages below followed by the
+  // classifier stages, and the statistics of the feature processors in the
+  // cache feature_profile. They are added to profile_seconds and
+  // profile_features once a recognition finishes.
+  enum { PROFILE_TAGGER, PROFILE_FEATURES, PROFILE_DECODING, PROFILE_ENTITIES, PROFILE_CLASSIFIERS };
+  bool profiling = false;
+  mutable mutex profile_mutex;
+  mutable vector<double> profile_seconds;
+  mutable vector<feature_templates::processor_statistics> profile_features;
+  void profile_start(cache& c) const;
+  void profile_stage(cache& c, unsigned stage) const;
+  void profile_flush(cache& c) const;
+
+  // Load the given independent model sections, in parallel when possible
+  static bool load_sections(const vector<function<bool()>>& sections);
 };
 
 } // namespace nametag
@@ -0,0 +1,80 @@
+// This file is part of NameTag <http://github.com/ufal/nametag/>.
+//
+// Copyright 2016 Institute of Formal and Applied Linguistics, Faculty of
+// Mathematics and Physics, Charles University in Prague, Czech Republic.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#include <sstream>
+
+#include "bilou_ner.h"
+#include "bilou_ner_converter.h"
+#include "classifier/network_classifier.h"
+#include "features/feature_templates.h"
+#include "tagger/tagger.h"
+#include "utils/compressor.h"
+
+namespace ufal {
+namespace nametag {
+
+void bilou_ner_converter::convert(ner_id id, istream& is, bool float16_weights, bool int16_tagger_scores, compressor::codec codec, ostream& os) {
+  // The tagger is loaded only to find its end, so the model must be seekable
+  ostringstream input;
+  input << is.rdbuf();
+  istringstream model(input.str());
+
+  // The stored models use the in-place layout, so their sections are re-encoded
+  bool in_place = codec == compressor::STORED;
+
+  unique_ptr<tagger> tagger(tagger::load_instance(model));
+  if (!tagger) runtime_failure("Cannot load the tagger!");
+  auto tagger_end = model.tellg();
+  if (int16_tagger_scores) {
+    ostringstream quantized;
+    if (!model.seekg(0) || !tagger::quantize_int16_instance(model, quantized))
+      runtime_failure("Cannot store the tagger scores as int16, only MorphoDiTa taggers support it!");
+    if (model.tellg() != tagger_end) runtime_failure("Cannot convert the tagger!");
+
+    istringstream quantized_model(quantized.str());
+    if (in_place ? !tagger::recompress_instance(quantized_model, os, codec) : !(os << quantized_model.rdbuf()))
+      runtime_failure("Cannot save the tagger!");
+  } else if (in_place) {
+    if (!model.seekg(0) || !tagger::recompress_instance(model, os, codec)) runtime_failure("Cannot convert the tagger!");
+    if (model.tellg() != tagger_end) runtime_failure("Cannot convert the tagger!");
+  } else {
+    if (!os.write(model.str().data(), tagger_end)) runtime_failure("Cannot save the tagger!");
+  }
+
+  if (!compressor::recompress(model, os, codec)) runtime_failure("Cannot convert entity map!");
+  if (in_place) {
+    // The templates are loaded and saved again, which needs the NLP pipeline
+    unique_ptr<tokenizer> tokenizer(bilou_ner::new_tokenizer(id));
+    nlp_pipeline pipeline(tokenizer.get(), tagger.get());
+    feature_templates templates;
+    if (!templates.load(model, pipeline)) runtime_failure("Cannot load feature templates!");
+    templates.unfreeze();
+    if (!templates.save(os, codec)) runtime_failure("Cannot save feature templates!");
+  } else {
+    if (!compressor::recompress(model, os, codec)) runtime_failure("Cannot convert feature templates!");
+  }
+
+  int stages = model.get();
+  if (stages == EOF) runtime_failure("Cannot load number of stages!");
+  if (!os.put(stages)) runtime_failure("Cannot save number of stages!");
+  for (int i = 0; i < stages; i++)
+    if (float16_weights || in_place) {
+      network_classifier network;
+      if (!network.load(model)) runtime_failure("Cannot load classifier network!");
+      if (float16_weights) network.quantize_float16();
+      if (!network.save(os, codec)) runtime_failure("Cannot save classifier network!");
+    } else {
+      if (!compressor::recompress(model, os, codec)) runtime_failure("Cannot convert classifier network!");
+    }
+
+  if (model.peek() != EOF) runtime_failure("Unexpected data after the recognizer!");
+}
+
+} // namespace nametag
+} // namespace ufal
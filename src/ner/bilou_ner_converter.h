@@ -0,0 +1,30 @@
+// This file is part of NameTag <http://github.com/ufal/nametag/>.
+//
+// Copyright 2016 Institute of Formal and Applied Linguistics, Faculty of
+// Mathematics and Physics, Charles University in Prague, Czech Republic.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include "common.h"
+#include "ner_ids.h"
+#include "utils/compressor.h"
+
+namespace ufal {
+namespace nametag {
+
+class bilou_ner_converter {
+ public:
+  // Convert the bilou_ner model with the given id (without the ner_id),
+  // optionally quantizing the classifier weights and the tagger scores, and
+  // storing the data using the given codec. The STORED codec re-encodes the
+  // tagger, the feature templates and the networks in the in-place layout.
+  // Otherwise the tagger is copied as is.
+  static void convert(ner_id id, istream& is, bool float16_weights, bool int16_tagger_scores, compressor::codec codec, ostream& os);
+};
+
+} // namespace nametag
+} // namespace ufal
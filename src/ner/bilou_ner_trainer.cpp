@@ -8,94 +8,307 @@
 // file, You can obtain one at http://mozilla.org/MPL/2.0/.
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <system_error>
+#include <thread>
 #include <unordered_map>
 
 #include "bilou_ner.h"
 #include "bilou_ner_trainer.h"
+#include "utils/binary_decoder.h"
+#include "utils/binary_encoder.h"
+#include "utils/compressor.h"
+#include "utils/peak_memory.h"
 #include "utils/split.h"
 
 namespace ufal {
 namespace nametag {
 
-void bilou_ner_trainer::train(ner_id id, int stages, const network_parameters& parameters, const tagger& tagger,
-                              istream& features, istream& train, istream& heldout, ostream& os) {
+// Every phase reports its wall time and throughput, and every stage also
+// the peak memory usage so far
+static double elapsed(chrono::steady_clock::time_point& start) {
+  auto now = chrono::steady_clock::now();
+  double seconds = chrono::duration<double>(now - start).count();
+  start = now;
+  return seconds;
+}
+
+static void report_memory() {
+  long peak_memory = peak_memory_kb();
+  if (peak_memory >= 0) cerr << "Peak memory usage so far: " << peak_memory / 1024 << " MB." << endl;
+}
+
+void bilou_ner_trainer::train(ner_id id, int stages, const vector<network_parameters>& parameters, bool float16_weights, compressor::codec codec, int threads,
+                              int min_feature_count, int feature_hashing, const tagger& tagger, const string& tagged_data_cache, istream& features, istream& train, istream& heldout, ostream& os) {
   if (stages <= 0) runtime_failure("Cannot train NER with <= 0 stages!");
   if (stages >= 256) runtime_failure("Cannot train NER with >= 256 stages!");
+  if (parameters.empty()) runtime_failure("No network parameters to train NER with!");
+
+  auto training_start = chrono::steady_clock::now(), start = training_start;
 
   // Load training and possibly also heldout data
   entity_map entities;
-  vector<labelled_sentence> train_data;
+  labelled_data train_data;
   cerr << "Loading train data: ";
-  load_data(train, tagger, train_data, entities, true);
-  cerr << "done, " << train_data.size() << " sentences" << endl;
+  load_data(train, tagger, threads, tagged_data_cache, train_data, entities, true);
+  double seconds = elapsed(start);
+  cerr << "done, " << train_data.size() << " sentences, in " << fixed << setprecision(3) << seconds << "s ("
+       << setprecision(0) << train_data.size() / seconds << " sentences/s)" << endl;
   cerr << "Found " << entities.size() << " annotated entity types." << endl;
 
-  vector<labelled_sentence> heldout_data;
+  labelled_data heldout_data;
   if (heldout) {
     cerr << "Loading heldout data: ";
-    load_data(heldout, tagger, heldout_data, entities, false);
-    cerr << "done, " << heldout_data.size() << " sentences" << endl;
+    load_data(heldout, tagger, threads, tagged_data_cache, heldout_data, entities, false);
+    double seconds = elapsed(start);
+    cerr << "done, " << heldout_data.size() << " sentences, in " << fixed << setprecision(3) << seconds << "s ("
+         << setprecision(0) << heldout_data.size() / seconds << " sentences/s)" << endl;
   }
 
   // Parse feature templates
   feature_templates templates;
   unique_ptr<tokenizer> tokenizer(bilou_ner::new_tokenizer(id));
   cerr << "Parsing feature templates: ";
-  templates.parse(features, entities, nlp_pipeline(tokenizer.get(), &tagger));
-  cerr << "done" << endl;
+  templates.parse(features, entities, nlp_pipeline(tokenizer.get(), &tagger, [id]{ return bilou_ner::new_tokenizer(id); }), feature_hashing);
+  if (feature_hashing) cerr << "hashing keys into " << feature_hashing << " buckets, " << templates.get_total_features() << " features, ";
+  cerr << "done, in " << fixed << setprecision(3) << elapsed(start) << "s" << endl;
+  report_memory();
 
   // Train required number of stages
   vector<network_classifier> networks(stages);
+  train_stages(networks, templates, entities, train_data, heldout_data, parameters, float16_weights, threads, min_feature_count);
 
-  for (auto&& network : networks) {
-    // Generate features
-    cerr << "Generating features: ";
-    vector<classifier_instance> train_instances, heldout_instances;
-    generate_instances(train_data, templates, train_instances, true);
-    generate_instances(heldout_data, templates, heldout_instances, false);
-    cerr << "done" << endl;
+  // Encode the recognizer
+  cerr << "Encoding the recognizer." << endl;
+  if (!entities.save(os, codec)) runtime_error("Cannot save entity map!");
+  if (!templates.save(os, codec)) runtime_error("Cannot save feature templates!");
+  if (!os.put(stages)) runtime_error("Cannot save number of stages!");
+  for (auto&& network : networks)
+    if (!network.save(os, codec)) runtime_error("Cannot save classifier network!");
+  cerr << "Training done, in " << fixed << setprecision(3) << elapsed(training_start) << "s." << endl;
+  report_memory();
+}
 
-    // Train and encode the recognizer
-    cerr << "Training network classifier." << endl;
-    if (!network.train(templates.get_total_features(), bilou_entity::total(entities.size()), train_instances, heldout_instances, parameters, true))
-      runtime_failure("Cannot train the network classifier!");
+void bilou_ner_trainer::fine_tune(ner_id id, const network_parameters& parameters, bool float16_weights, compressor::codec codec, int threads, int min_feature_count,
+                                  const string& tagged_data_cache_directory, istream& model, istream& train, istream& heldout, ostream& os) {
+  auto training_start = chrono::steady_clock::now(), start = training_start;
+
+  // Load the recognizer, keeping the encoded tagger to store it unchanged
+  cerr << "Loading the recognizer: ";
+  ostringstream model_data;
+  model_data << model.rdbuf();
+  istringstream recognizer(model_data.str());
 
-    // Use the trained classifier to compute previous_stage
-    compute_previous_stage(train_data, templates, network);
-    compute_previous_stage(heldout_data, templates, network);
+  unique_ptr<tagger> tagger(tagger::load_instance(recognizer));
+  if (!tagger) runtime_failure("Cannot load the tagger!");
+  string tagger_encoding = model_data.str().substr(0, recognizer.tellg());
+
+  entity_map entities;
+  if (!entities.load(recognizer)) runtime_failure("Cannot load entity map!");
+
+  feature_templates templates;
+  unique_ptr<tokenizer> tokenizer(bilou_ner::new_tokenizer(id));
+  if (!templates.load(recognizer, nlp_pipeline(tokenizer.get(), tagger.get(), [id]{ return bilou_ner::new_tokenizer(id); })))
+    runtime_failure("Cannot load feature templates!");
+  templates.unfreeze();
+
+  int stages = recognizer.get();
+  if (stages == EOF) runtime_failure("Cannot load number of stages!");
+  vector<network_classifier> networks(stages);
+  for (auto&& network : networks)
+    if (!network.load(recognizer)) runtime_failure("Cannot load classifier network!");
+  if (recognizer.peek() != EOF) runtime_failure("Unexpected data after the recognizer!");
+  cerr << "done, " << stages << " stages, " << templates.get_total_features() << " features, "
+       << entities.size() << " entity types, in " << fixed << setprecision(3) << elapsed(start) << "s" << endl;
+
+  // Load training and possibly also heldout data, allowing new entity types
+  string tagged_data_cache;
+  if (!tagged_data_cache_directory.empty())
+    tagged_data_cache = tagged_data_cache_prefix(tagged_data_cache_directory, tagger_encoding);
+
+  labelled_data train_data;
+  entity_type previous_entities = entities.size();
+  cerr << "Loading train data: ";
+  load_data(train, *tagger, threads, tagged_data_cache, train_data, entities, true);
+  double seconds = elapsed(start);
+  cerr << "done, " << train_data.size() << " sentences, in " << fixed << setprecision(3) << seconds << "s ("
+       << setprecision(0) << train_data.size() / seconds << " sentences/s)" << endl;
+  if (entities.size() > previous_entities) cerr << "Found " << entities.size() - previous_entities << " new annotated entity types." << endl;
+
+  labelled_data heldout_data;
+  if (heldout) {
+    cerr << "Loading heldout data: ";
+    load_data(heldout, *tagger, threads, tagged_data_cache, heldout_data, entities, false);
+    double seconds = elapsed(start);
+    cerr << "done, " << heldout_data.size() << " sentences, in " << fixed << setprecision(3) << seconds << "s ("
+         << setprecision(0) << heldout_data.size() / seconds << " sentences/s)" << endl;
   }
 
+  // Continue training all the stages
+  network_parameters warm_parameters = parameters;
+  warm_parameters.warm_start = true;
+  ner_feature previous_features = templates.get_total_features();
+  train_stages(networks, templates, entities, train_data, heldout_data, {warm_parameters}, float16_weights, threads, min_feature_count);
+  cerr << "Added " << templates.get_total_features() - previous_features << " features to the " << previous_features << " existing ones." << endl;
+
   // Encode the recognizer
   cerr << "Encoding the recognizer." << endl;
-  if (!entities.save(os)) runtime_error("Cannot save entity map!");
-  if (!templates.save(os)) runtime_error("Cannot save feature templates!");
-  if (!os.put(stages)) runtime_error("Cannot save number of stages!");
+  if (!os.write(tagger_encoding.data(), tagger_encoding.size())) runtime_failure("Cannot save the tagger!");
+  if (!entities.save(os, codec)) runtime_failure("Cannot save entity map!");
+  if (!templates.save(os, codec)) runtime_failure("Cannot save feature templates!");
+  if (!os.put(stages)) runtime_failure("Cannot save number of stages!");
   for (auto&& network : networks)
-    if (!network.save(os)) runtime_error("Cannot save classifier network!");
+    if (!network.save(os, codec)) runtime_failure("Cannot save classifier network!");
+  cerr << "Fine-tuning done, in " << fixed << setprecision(3) << elapsed(training_start) << "s." << endl;
+  report_memory();
+}
+
+void bilou_ner_trainer::train_stages(vector<network_classifier>& networks, feature_templates& templates, const entity_map& entities,
+                                     labelled_data& train_data, labelled_data& heldout_data,
+                                     const vector<network_parameters>& parameters, bool float16_weights, int threads, int min_feature_count) {
+  auto start = chrono::steady_clock::now();
+  network_parameters stage_parameters = parameters.front();
+
+  // The features not depending on the previous stage are computed only in the
+  // first stage and reused in the following ones
+  bool store_stage_independent = networks.size() > 1;
+  for (unsigned stage = 0; stage < networks.size(); stage++) {
+    auto& network = networks[stage];
+
+    // Generate features
+    cerr << "Generating features: ";
+    classifier_instances train_instances, heldout_instances;
+    ner_feature first_added_feature = templates.get_total_features();
+    generate_instances(train_data, templates, threads, train_instances, true, stage > 0, store_stage_independent);
+    if (min_feature_count > 1) {
+      // Prune the rare features added in this stage before processing heldout data
+      ner_feature added_features = templates.get_total_features() - first_added_feature;
+      vector<size_t> counts(templates.get_total_features(), 0);
+      for (auto&& feature : train_instances.all_features())
+        counts[feature]++;
+
+      vector<ner_feature> renumbering;
+      templates.prune_features(first_added_feature, counts, min_feature_count, renumbering);
+      train_instances.renumber_features(renumbering, ner_feature_unknown);
+      if (store_stage_independent) renumber_stage_independent_features(train_data, renumbering);
+      cerr << "kept " << templates.get_total_features() - first_added_feature << " of " << added_features << " added features, ";
+    }
+    generate_instances(heldout_data, templates, threads, heldout_instances, false, stage > 0, store_stage_independent);
+    double seconds = elapsed(start);
+    cerr << "done, " << train_instances.size() + heldout_instances.size() << " instances, in " << fixed << setprecision(3)
+         << seconds << "s (" << setprecision(0) << (train_instances.size() + heldout_instances.size()) / seconds << " instances/s)" << endl;
+
+    // Train and encode the recognizer
+    if (stage == 0 && parameters.size() > 1) {
+      cerr << "Training network classifier with " << parameters.size() << " parameter configurations." << endl;
+      train_sweep(network, templates.get_total_features(), bilou_entity::total(entities.size()), train_instances, heldout_instances,
+                  parameters, threads, stage_parameters);
+    } else {
+      cerr << "Training network classifier." << endl;
+      if (!network.train(templates.get_total_features(), bilou_entity::total(entities.size()), train_instances, heldout_instances, stage_parameters, true))
+        runtime_failure("Cannot train the network classifier!");
+    }
+    cerr << "Training network classifier done, in " << fixed << setprecision(3) << elapsed(start) << "s." << endl;
+
+    // Quantize the weights if requested, before computing previous_stage
+    if (float16_weights) {
+      cerr << "Quantizing weights to float16: ";
+      double heldout_accuracy = heldout_instances.empty() ? 0 : network.accuracy(heldout_instances);
+      network.quantize_float16();
+      if (!heldout_instances.empty())
+        cerr << "heldout acc " << fixed << setprecision(2) << heldout_accuracy * 100 << " -> " << network.accuracy(heldout_instances) * 100 << ", ";
+      cerr << "done." << endl;
+    }
+
+    // Use the trained classifier to compute previous_stage, which the last
+    // stage does not need
+    if (stage + 1 == networks.size()) {
+      report_memory();
+      continue;
+    }
+    cerr << "Computing previous stage: ";
+    compute_previous_stage(train_data, templates, network, threads);
+    compute_previous_stage(heldout_data, templates, network, threads);
+    seconds = elapsed(start);
+    cerr << "done, in " << fixed << setprecision(3) << seconds << "s (" << setprecision(0)
+         << (train_data.size() + heldout_data.size()) / seconds << " sentences/s)" << endl;
+    report_memory();
+  }
+}
+
+void bilou_ner_trainer::train_sweep(network_classifier& network, unsigned features, unsigned outcomes, const classifier_instances& train,
+                                    const classifier_instances& heldout, const vector<network_parameters>& parameters, int threads,
+                                    network_parameters& best_parameters) {
+  if (heldout.empty()) runtime_failure("Cannot choose the network parameters without heldout data!");
+
+  // Every configuration is trained sequentially, using the given number of
+  // threads for different configurations. Only the best network trained so far
+  // is kept, preferring the earlier configuration on equal accuracies.
+  atomic<size_t> next_configuration(0);
+  size_t best = parameters.size();
+  double best_accuracy = 0;
+  mutex best_mutex;
+  run_workers(min(threads, int(parameters.size())), [&] {
+    for (size_t i; (i = next_configuration++) < parameters.size(); ) {
+      auto start = chrono::steady_clock::now();
+      network_parameters configuration = parameters[i];
+      configuration.threads = 1;
+
+      network_classifier candidate;
+      if (!candidate.train(features, outcomes, train, heldout, configuration, false))
+        runtime_failure("Cannot train the network classifier!");
+      double accuracy = candidate.accuracy(heldout);
+
+      lock_guard<mutex> lock(best_mutex);
+      cerr << "Configuration " << i + 1 << " (iterations " << configuration.iterations << ", missing_weight " << setprecision(4)
+           << defaultfloat << configuration.missing_weight << ", learning rate " << configuration.initial_learning_rate << '-'
+           << configuration.final_learning_rate << ", gaussian " << configuration.gaussian_sigma << "): heldout acc " << fixed
+           << setprecision(2) << accuracy * 100 << ", in " << setprecision(3) << elapsed(start) << "s" << endl;
+      if (best == parameters.size() || accuracy > best_accuracy || (accuracy == best_accuracy && i < best)) {
+        best = i;
+        best_accuracy = accuracy;
+        network = move(candidate);
+      }
+    }
+  });
+
+  best_parameters = parameters[best];
+  cerr << "Using configuration " << best + 1 << " with the best heldout acc " << fixed << setprecision(2) << best_accuracy * 100 << " for all stages." << endl;
 }
 
-void bilou_ner_trainer::load_data(istream& is, const tagger& tagger, vector<labelled_sentence>& data, entity_map& entity_map, bool add_entities) {
+void bilou_ner_trainer::load_data(istream& is, const tagger& tagger, int threads, const string& tagged_data_cache,
+                                  labelled_data& data, entity_map& entity_map, bool add_entities) {
   vector<string> words, entities;
-  vector<string_piece> forms;
+  uint64_t data_hash = hash_initial;
 
-  data.clear();
+  // The forms of all sentences are kept for tagging in a single buffer, the
+  // form f ending at form_ends[f] and the sentence s of forms ending at sentence_ends[s]
+  string forms;
+  vector<size_t> form_ends, sentence_ends;
+
+  data.corpus.clear();
+  data.sentences.clear();
 
   string line;
   vector<string> tokens;
   for (bool eof; true; ) {
     eof = !getline(is, line);
+    if (!eof) data_hash = hash_append(hash_append(data_hash, line), "\n");
     if (eof || line.empty()) {
       if (!words.empty()) {
-        // Tag the sentence
-        forms.clear();
-        for (auto&& word : words)
-          forms.emplace_back(word);
-        data.emplace_back();
-        auto& sentence = data.back();
-        tagger.tag(forms, sentence.sentence);
-
-        // Clear previous_stage
-        sentence.sentence.clear_previous_stage();
+        // Keep the words for tagging, which is performed after all sentences are read
+        data.sentences.emplace_back();
+        auto& sentence = data.sentences.back();
+        for (auto&& word : words) {
+          forms.append(word);
+          form_ends.push_back(forms.size());
+        }
+        sentence_ends.push_back(form_ends.size());
 
         // Decode the entities names and ranges
         for (unsigned i = 0; i < entities.size(); i++)
@@ -122,56 +335,271 @@ void bilou_ner_trainer::load_data(istream& is, const tagger& tagger, vector<labe
       entities.emplace_back(tokens[1]);
     }
   }
-}
 
-void bilou_ner_trainer::generate_instances(vector<labelled_sentence>& data, const feature_templates& templates, vector<classifier_instance>& instances, bool add_features) {
-  string buffer;
+  auto sentence_forms = [&](size_t s, vector<string_piece>& sentence) {
+    sentence.clear();
+    for (size_t f = s ? sentence_ends[s - 1] : 0; f < sentence_ends[s]; f++) {
+      size_t start = f ? form_ends[f - 1] : 0;
+      sentence.emplace_back(forms.data() + start, form_ends[f] - start);
+    }
+  };
 
-  for (auto&& sentence : data) {
-    sentence.sentence.clear_features();
-    sentence.sentence.clear_probabilities_local_filled();
+  // Use the cached tagged data if available
+  string cache_file;
+  if (!tagged_data_cache.empty() && !data.sentences.empty()) {
+    cache_file = tagged_data_cache + hash_hex(data_hash) + ".tagged";
+
+    if (load_tagged_data(cache_file, sentence_forms, data)) {
+      cerr << "(using cached tagged data) ";
+      return;
+    }
+  }
 
-    // Sentence processors
-    templates.process_sentence(sentence.sentence, buffer, add_features);
+  // Tag the sentences in batches, using the given number of threads if
+  // possible. Every sentence is tagged independently into its own place, and
+  // the batch is then stored in the corpus in order, so the results do not
+  // depend on the scheduling.
+  vector<ner_sentence> batch(1024);
+  for (size_t batch_start = 0; batch_start < data.sentences.size(); batch_start += batch.size()) {
+    size_t batch_end = min(batch_start + batch.size(), data.sentences.size());
+    atomic<size_t> next_sentence(batch_start);
+    auto tag_sentences = [&] {
+      vector<string_piece> forms;
+      for (size_t i; (i = next_sentence++) < batch_end; ) {
+        sentence_forms(i, forms);
+        tagger.tag(forms, batch[i - batch_start]);
+      }
+    };
 
-    // Create classifier instances
-    for (unsigned i = 0; i < sentence.sentence.size; i++)
-     instances.emplace_back(sentence.sentence.features[i], sentence.outcomes[i]);
+    run_workers(threads, tag_sentences);
+    for (size_t i = batch_start; i < batch_end; i++)
+      data.corpus.add(batch[i - batch_start]);
   }
+
+  if (!cache_file.empty() && !save_tagged_data(cache_file, data))
+    cerr << "(cannot cache tagged data in '" << cache_file << "') ";
 }
 
-void bilou_ner_trainer::compute_previous_stage(vector<labelled_sentence>& data, const feature_templates& templates, const network_classifier& network) {
-  string buffer;
-  vector<double> outcomes, network_buffer;
+bool bilou_ner_trainer::load_tagged_data(const string& file, const function<void(size_t, vector<string_piece>&)>& sentence_forms, labelled_data& data) {
+  ifstream is(file, ifstream::binary);
+  if (!is.is_open()) return false;
 
-  for (auto&& labelled_sentence : data) {
-    auto& sentence = labelled_sentence.sentence;
+  binary_decoder dec;
+  if (!compressor::load(is, dec)) return false;
 
-    sentence.clear_features();
-    sentence.clear_probabilities_local_filled();
+  try {
+    if (dec.next_4B() != data.sentences.size()) return false;
 
-    // Sentence processors
-    templates.process_sentence(sentence, buffer);
+    ner_sentence sentence;
+    vector<string_piece> forms;
+    for (unsigned i = 0; i < data.sentences.size(); i++) {
+      sentence_forms(i, forms);
+      unsigned size = dec.next_4B();
+      if (size != forms.size()) return false;
 
-    // Sequentially classify sentence words
-    for (unsigned i = 0; i < sentence.size; i++) {
-      if (!sentence.probabilities[i].local_filled) {
-        network.classify(sentence.features[i], outcomes, network_buffer);
-        bilou_ner::fill_bilou_probabilities(outcomes, sentence.probabilities[i].local);
-        sentence.probabilities[i].local_filled = true;
+      sentence.resize(size);
+      for (unsigned j = 0; j < size; j++) {
+        auto& word = sentence.words[j];
+        dec.next_str(word.form);
+        if (word.form != forms[j]) return false;
+        dec.next_str(word.raw_lemma);
+        word.raw_lemmas_all.resize(dec.next_4B());
+        for (auto&& raw_lemma : word.raw_lemmas_all)
+          dec.next_str(raw_lemma);
+        dec.next_str(word.lemma_id);
+        dec.next_str(word.lemma_comments);
+        dec.next_str(word.tag);
       }
+      data.corpus.add(sentence);
+    }
+  } catch (binary_decoder_error&) {
+    data.corpus.clear();
+    return false;
+  }
+
+  if (!dec.is_end()) return data.corpus.clear(), false;
+  return true;
+}
+
+bool bilou_ner_trainer::save_tagged_data(const string& file, const labelled_data& data) {
+  binary_encoder enc;
+
+  enc.add_4B(data.corpus.size());
+  ner_sentence sentence;
+  for (size_t s = 0; s < data.corpus.size(); s++) {
+    data.corpus.get(s, sentence);
+    enc.add_4B(sentence.size);
+    for (unsigned i = 0; i < sentence.size; i++) {
+      auto& word = sentence.words[i];
+      enc.add_str(word.form);
+      enc.add_str(word.raw_lemma);
+      enc.add_4B(word.raw_lemmas_all.size());
+      for (auto&& raw_lemma : word.raw_lemmas_all)
+        enc.add_str(raw_lemma);
+      enc.add_str(word.lemma_id);
+      enc.add_str(word.lemma_comments);
+      enc.add_str(word.tag);
+    }
+  }
+
+  // Write the data to a temporary file first, so that an interrupted run
+  // cannot leave a truncated cache behind
+  string temporary_file = file + ".tmp";
+  {
+    ofstream os(temporary_file, ofstream::binary);
+    if (!os.is_open() || !compressor::save(os, enc, compressor::STORED) || !os.flush()) return false;
+  }
+  return rename(temporary_file.c_str(), file.c_str()) == 0;
+}
+
+string bilou_ner_trainer::tagged_data_cache_prefix(const string& directory, const string& tagger_encoding) {
+  string prefix = directory;
+  if (!prefix.empty() && prefix.back() != '/' && prefix.back() != '\\') prefix.push_back('/');
+  return prefix.append(hash_hex(hash_append(hash_initial, tagger_encoding))).append("-");
+}
+
+string bilou_ner_trainer::hash_hex(uint64_t hash) {
+  char hex[17];
+  snprintf(hex, sizeof(hex), "%016llx", (unsigned long long) hash);
+  return hex;
+}
+
+uint64_t bilou_ner_trainer::hash_append(uint64_t hash, string_piece data) {
+  for (size_t i = 0; i < data.len; i++)
+    hash = (hash ^ (unsigned char)data.str[i]) * 1099511628211ULL;
+  return hash;
+}
 
-      if (i == 0) {
-        sentence.probabilities[i].global.init(sentence.probabilities[i].local);
+void bilou_ner_trainer::generate_instances(labelled_data& data, const feature_templates& templates, int threads,
+                                           classifier_instances& instances, bool add_features, bool next_stage, bool store_stage_independent) {
+  // Sentence processors. When adding features, the sentences must be processed
+  // sequentially, because the feature ids are assigned in the processing order.
+  atomic<size_t> next_sentence(0);
+  auto process_sentences = [&] {
+    ner_sentence sentence;
+    string buffer;
+    for (size_t i; (i = next_sentence++) < data.size(); ) {
+      auto& labelled = data.sentences[i];
+      load_sentence(data, i, sentence);
+      if (next_stage) {
+        templates.process_sentence_next_stage(sentence, buffer, add_features);
       } else {
-        sentence.probabilities[i].global.update(sentence.probabilities[i].local, sentence.probabilities[i - 1].global);
+        sentence.clear_features();
+        sentence.clear_probabilities_local_filled();
+        templates.process_sentence(sentence, buffer, add_features, store_stage_independent);
+        if (store_stage_independent) {
+          labelled.stage_independent_features.assign(sentence.stage_independent_features.begin(), sentence.stage_independent_features.end());
+          labelled.stage_dependent_positions.assign(sentence.stage_dependent_positions.begin(), sentence.stage_dependent_positions.end());
+          labelled.stage_independent_probabilities.assign(sentence.stage_independent_probabilities.begin(), sentence.stage_independent_probabilities.end());
+        }
       }
+      labelled.features.assign(sentence.features.begin(), sentence.features.end());
+      labelled.features_offsets.assign(sentence.features_offsets.begin(), sentence.features_offsets.begin() + sentence.size + 1);
     }
+  };
+  run_workers(add_features ? 1 : threads, process_sentences);
+
+  // Create classifier instances, releasing the features of the sentences
+  for (auto&& sentence : data.sentences) {
+    for (unsigned i = 0; i < sentence.outcomes.size(); i++)
+      instances.add(sentence.features.data() + sentence.features_offsets[i], sentence.features_offsets[i + 1] - sentence.features_offsets[i], sentence.outcomes[i]);
+    vector<ner_feature>().swap(sentence.features);
+    vector<unsigned>().swap(sentence.features_offsets);
+  }
+
+  // Release the spare capacity of the instances, which are kept during the whole training
+  instances.shrink_to_fit();
+}
+
+void bilou_ner_trainer::load_sentence(const labelled_data& data, size_t i, ner_sentence& sentence) {
+  auto& labelled = data.sentences[i];
+  data.corpus.get(i, sentence);
+
+  if (labelled.previous_stage.empty())
+    sentence.clear_previous_stage();
+  else
+    copy(labelled.previous_stage.begin(), labelled.previous_stage.end(), sentence.previous_stage.begin());
 
-    sentence.compute_best_decoding();
-    sentence.fill_previous_stage();
+  sentence.stage_independent_features.assign(labelled.stage_independent_features.begin(), labelled.stage_independent_features.end());
+  sentence.stage_dependent_positions.assign(labelled.stage_dependent_positions.begin(), labelled.stage_dependent_positions.end());
+  sentence.stage_independent_probabilities.assign(labelled.stage_independent_probabilities.begin(), labelled.stage_independent_probabilities.end());
+}
+
+void bilou_ner_trainer::renumber_stage_independent_features(labelled_data& data, const vector<ner_feature>& renumbering) {
+  // The features of a key are renumbered consecutively, so every stored feature
+  // is renumbered using its first feature; the removed ones are dropped and the
+  // positions of the stage dependent features are adjusted accordingly.
+  for (auto&& sentence : data.sentences) {
+    auto& features = sentence.stage_independent_features;
+    auto position = sentence.stage_dependent_positions.begin();
+    size_t kept = 0;
+    for (size_t i = 0; i < features.size(); i++) {
+      for (; position != sentence.stage_dependent_positions.end() && *position == i; position++)
+        *position = kept;
+      if (renumbering[features[i].feature] != ner_feature_unknown) {
+        features[kept] = features[i];
+        features[kept++].feature = renumbering[features[i].feature];
+      }
+    }
+    for (; position != sentence.stage_dependent_positions.end(); position++)
+      *position = kept;
+    features.resize(kept);
   }
 }
 
+void bilou_ner_trainer::compute_previous_stage(labelled_data& data, const feature_templates& templates, const network_classifier& network, int threads) {
+  // The sentences are independent, so they can be processed in parallel
+  atomic<size_t> next_sentence(0);
+  run_workers(threads, [&] {
+    ner_sentence sentence;
+    string buffer;
+    vector<double> outcomes, network_buffer;
+    for (size_t s; (s = next_sentence++) < data.size(); ) {
+      load_sentence(data, s, sentence);
+      compute_previous_stage(sentence, templates, network, buffer, outcomes, network_buffer);
+      data.sentences[s].previous_stage.assign(sentence.previous_stage.begin(), sentence.previous_stage.begin() + sentence.size);
+    }
+  });
+}
+
+void bilou_ner_trainer::compute_previous_stage(ner_sentence& sentence, const feature_templates& templates, const network_classifier& network,
+                                               string& buffer, vector<double>& outcomes, vector<double>& network_buffer) {
+  // Sentence processors, reusing the stored stage independent features
+  templates.process_sentence_next_stage(sentence, buffer);
+
+  // Sequentially classify sentence words
+  for (unsigned i = 0; i < sentence.size; i++) {
+    if (!sentence.probabilities[i].local_filled) {
+      network.classify(sentence.word_features(i), sentence.word_features_size(i), outcomes, network_buffer);
+      bilou_ner::fill_bilou_probabilities(outcomes, sentence.probabilities[i].local);
+      sentence.probabilities[i].local_filled = true;
+    }
+
+    if (i == 0) {
+      sentence.global.init(sentence.probabilities[i].local);
+    } else {
+      sentence.global.update(i, sentence.probabilities[i].local);
+    }
+  }
+
+  sentence.compute_best_decoding();
+  sentence.fill_previous_stage();
+}
+
+void bilou_ner_trainer::run_workers(int threads, const function<void()>& worker) {
+  // The worker is run in this thread and in additional threads, if they can be started
+  vector<thread> workers;
+  for (int i = 1; i < threads; i++)
+    try {
+      workers.emplace_back(worker);
+    } catch (system_error&) {
+      break;
+    }
+
+  worker();
+  for (auto&& thread : workers)
+    thread.join();
+}
+
 } // namespace nametag
 } // namespace ufal
@@ -9,31 +9,89 @@
 
 #pragma once
 
+#include <functional>
+
 #include "common.h"
 #include "bilou/bilou_entity.h"
 #include "classifier/network_classifier.h"
 #include "entity_map.h"
 #include "features/feature_templates.h"
 #include "ner/ner_ids.h"
+#include "ner/training_corpus.h"
 #include "tagger/tagger.h"
+#include "utils/compressor.h"
+#include "utils/string_piece.h"
 
 namespace ufal {
 namespace nametag {
 
 class bilou_ner_trainer {
  public:
-  static void train(ner_id id, int stages, const network_parameters& parameters, const tagger& tagger,
-                    istream& features, istream& train, istream& heldout, ostream& os);
+  // With several parameters, the first stage is trained with every one of
+  // them and the one with the best heldout accuracy is used for all stages.
+  static void train(ner_id id, int stages, const vector<network_parameters>& parameters, bool float16_weights, compressor::codec codec, int threads,
+                    int min_feature_count, int feature_hashing, const tagger& tagger, const string& tagged_data_cache, istream& features, istream& train, istream& heldout, ostream& os);
+
+  // Continue training the loaded recognizer on the given data, adding the
+  // features and entity types of the data and keeping its tagger, feature
+  // templates, number of stages, missing_weight and hidden layer.
+  static void fine_tune(ner_id id, const network_parameters& parameters, bool float16_weights, compressor::codec codec, int threads, int min_feature_count,
+                        const string& tagged_data_cache_directory, istream& model, istream& train, istream& heldout, ostream& os);
+
+  // Return the prefix of tagged data cache files in the given directory,
+  // specific for the tagger with the given encoding
+  static string tagged_data_cache_prefix(const string& directory, const string& tagger_encoding);
 
  private:
+  // The tagged words of the sentences are kept in the compact corpus, and
+  // every sentence is expanded into a ner_sentence only when processed.
   struct labelled_sentence {
-    ner_sentence sentence;
     vector<bilou_entity::value> outcomes;
+    vector<ner_sentence::previous_stage_info> previous_stage;
+    vector<ner_sentence::added_feature> stage_independent_features;
+    vector<size_t> stage_dependent_positions;
+    vector<ner_sentence::stage_independent_probability> stage_independent_probabilities;
+    // The features of the sentence, kept only until the instances are created
+    vector<ner_feature> features;
+    vector<unsigned> features_offsets;
   };
+  struct labelled_data {
+    training_corpus corpus;
+    vector<labelled_sentence> sentences;
+
+    size_t size() const { return sentences.size(); }
+  };
+
+  static void train_stages(vector<network_classifier>& networks, feature_templates& templates, const entity_map& entities,
+                           labelled_data& train_data, labelled_data& heldout_data,
+                           const vector<network_parameters>& parameters, bool float16_weights, int threads, int min_feature_count);
+  // Train a network for every parameters concurrently on the shared instances,
+  // keeping the one with the best heldout accuracy and its parameters
+  static void train_sweep(network_classifier& network, unsigned features, unsigned outcomes, const classifier_instances& train,
+                          const classifier_instances& heldout, const vector<network_parameters>& parameters, int threads,
+                          network_parameters& best_parameters);
+  static void load_data(istream& is, const tagger& tagger, int threads, const string& tagged_data_cache,
+                        labelled_data& data, entity_map& entity_map, bool add_entities);
+
+  // Tagged data cached in a file, keyed by the hashes of the tagger and the data
+  static bool load_tagged_data(const string& file, const function<void(size_t, vector<string_piece>&)>& sentence_forms, labelled_data& data);
+  static bool save_tagged_data(const string& file, const labelled_data& data);
+  static uint64_t hash_append(uint64_t hash, string_piece data);
+  static string hash_hex(uint64_t hash);
+  static constexpr uint64_t hash_initial = 14695981039346656037ULL;
+  // In the first stage, the stage independent features are stored in the
+  // sentences when requested, and the next stages recompute only the others.
+  static void generate_instances(labelled_data& data, const feature_templates& templates, int threads,
+                                 classifier_instances& instances, bool add_features, bool next_stage, bool store_stage_independent);
+  // Expand the i-th sentence, including its previous_stage and stored features
+  static void load_sentence(const labelled_data& data, size_t i, ner_sentence& sentence);
+  static void renumber_stage_independent_features(labelled_data& data, const vector<ner_feature>& renumbering);
+  static void compute_previous_stage(labelled_data& data, const feature_templates& templates, const network_classifier& network, int threads);
+  static void compute_previous_stage(ner_sentence& sentence, const feature_templates& templates, const network_classifier& network,
+                                     string& buffer, vector<double>& outcomes, vector<double>& network_buffer);
 
-  static void load_data(istream& is, const tagger& tagger, vector<labelled_sentence>& data, entity_map& entity_map, bool add_entities);
-  static void generate_instances(vector<labelled_sentence>& data, const feature_templates& templates, vector<classifier_instance>& instances, bool add_features);
-  static void compute_previous_stage(vector<labelled_sentence>& data, const feature_templates& templates, const network_classifier& network);
+  // Run the worker in the given number of threads, if possible
+  static void run_workers(int threads, const function<void()>& worker);
 };
 
 } // namespace nametag
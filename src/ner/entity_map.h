@@ -13,6 +13,7 @@
 
 #include "common.h"
 #include "bilou/entity_type.h"
+#include "utils/compressor.h"
 
 namespace ufal {
 namespace nametag {
@@ -23,7 +24,7 @@ class entity_map {
   const string& name(entity_type entity) const;
 
   bool load(istream& is);
-  bool save(ostream& os) const;
+  bool save(ostream& os, compressor::codec codec = compressor::LZMA) const;
 
   entity_type size() const;
  private:
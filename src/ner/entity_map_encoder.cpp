@@ -14,14 +14,14 @@
 namespace ufal {
 namespace nametag {
 
-bool entity_map::save(ostream& os) const {
+bool entity_map::save(ostream& os, compressor::codec codec) const {
   binary_encoder enc;
 
   enc.add_4B(id2str.size());
   for (auto&& entity : id2str)
     enc.add_str(entity);
 
-  return compressor::save(os, enc);
+  return compressor::save(os, enc, codec);
 }
 
 } // namespace nametag
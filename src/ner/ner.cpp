@@ -7,11 +7,15 @@
 // License, v. 2.0. If a copy of the MPL was not distributed with this
 // file, You can obtain one at http://mozilla.org/MPL/2.0/.
 
+#include <algorithm>
+#include <atomic>
 #include <fstream>
+#include <memory>
 
 #include "bilou_ner.h"
 #include "ner.h"
 #include "ner_ids.h"
+#include "utils/memory_streambuf.h"
 
 namespace ufal {
 namespace nametag {
@@ -33,11 +37,208 @@ ner* ner::load(istream& is) {
 }
 
 ner* ner::load(const char* fname) {
+  // Map the file if possible, so that the stored sections are used in place
+  unique_ptr<memory_streambuf> mapped(memory_streambuf::map_file(fname));
+  if (mapped) {
+    istream in(mapped.get());
+    return load(in);
+  }
+
   ifstream in(fname, ifstream::in | ifstream::binary);
   if (!in.is_open()) return nullptr;
 
   return load(in);
 }
 
+static atomic<bool> gazetteers_cache_writing(false);
+
+void ner::set_gazetteers_cache_writing(bool enabled) {
+  gazetteers_cache_writing = enabled;
+}
+
+bool ner::write_gazetteers_cache() {
+  return gazetteers_cache_writing;
+}
+
+void ner::recognize_batch(const vector<vector<string_piece>>& sentences, vector<vector<named_entity>>& entities) const {
+  entities.resize(sentences.size());
+  for (unsigned i = 0; i < sentences.size(); i++)
+    recognize(sentences[i], entities[i]);
+}
+
+bool ner::recognize_with_confidences(const vector<string_piece>& forms, vector<named_entity>& entities, vector<double>& confidences) const {
+  recognize(forms, entities);
+  confidences.clear();
+  return false;
+}
+
+bool ner::recognize_nbest(const vector<string_piece>& /*forms*/, unsigned /*n*/, vector<vector<named_entity>>& decodings, vector<double>& probabilities) const {
+  decodings.clear();
+  probabilities.clear();
+  return false;
+}
+
+bool ner::recognize_pretagged(const vector<string_piece>& /*tokens*/, vector<named_entity>& entities) const {
+  entities.clear();
+  return false;
+}
+
+bool ner_context::set_entity_types(const vector<string>& types) {
+  return types.empty();
+}
+
+ner_context* ner::new_context() const {
+  return new ner_context();
+}
+
+void ner::recognize(const vector<string_piece>& forms, vector<named_entity>& entities, ner_context& /*context*/) const {
+  recognize(forms, entities);
+}
+
+void ner::recognize_batch(const vector<vector<string_piece>>& sentences, vector<vector<named_entity>>& entities, ner_context& /*context*/) const {
+  recognize_batch(sentences, entities);
+}
+
+void ner::recognize(const vector<string_piece>& forms, entity_sink& sink, ner_context& context) const {
+  vector<vector<string_piece>> sentences(1, forms);
+  recognize_batch(sentences, sink, context);
+}
+
+void ner::recognize_batch(const vector<vector<string_piece>>& sentences, entity_sink& sink, ner_context& context) const {
+  vector<vector<named_entity>> entities;
+  recognize_batch(sentences, entities, context);
+
+  vector<string> types;
+  entity_types(types);
+  for (unsigned s = 0; s < entities.size(); s++) {
+    sort(entities[s].begin(), entities[s].end(), [](const named_entity& a, const named_entity& b) {
+      return a.start < b.start || (a.start == b.start && a.length > b.length);
+    });
+    for (auto&& entity : entities[s]) {
+      auto type = find(types.begin(), types.end(), entity.type);
+      sink.on_entity(s, entity.start, entity.length, type == types.end() ? -1 : int(type - types.begin()), entity.type);
+    }
+  }
+}
+
+bool ner::recognize_text(string_piece text, vector<named_entity>& entities) const {
+  entities.clear();
+  unique_ptr<tokenizer> tokenizer(new_tokenizer());
+  if (!tokenizer) return false;
+
+  // Tokenize the whole text and recognize all sentences at once
+  vector<vector<string_piece>> sentences;
+  vector<vector<token_range>> tokens;
+  tokenizer->set_text(text);
+  for (unsigned s = 0; true; s++) {
+    if (s >= sentences.size()) sentences.emplace_back(), tokens.emplace_back();
+    if (!tokenizer->next_sentence(&sentences[s], &tokens[s])) {
+      sentences.resize(s), tokens.resize(s);
+      break;
+    }
+  }
+
+  vector<vector<named_entity>> sentences_entities;
+  recognize_batch(sentences, sentences_entities);
+
+  // Convert the entities to character offsets; the sentences are already in
+  // text order, so sorting the entities of every sentence is enough
+  for (unsigned s = 0; s < sentences.size(); s++) {
+    auto& sentence_entities = sentences_entities[s];
+    sort(sentence_entities.begin(), sentence_entities.end(), [](const named_entity& a, const named_entity& b) {
+      return a.start < b.start || (a.start == b.start && a.length > b.length);
+    });
+
+    for (auto&& entity : sentence_entities) {
+      auto& first = tokens[s][entity.start];
+      auto& last = tokens[s][entity.start + entity.length - 1];
+      entities.emplace_back(first.start, last.start + last.length - first.start, entity.type);
+    }
+  }
+  return true;
+}
+
+bool ner::reload_gazetteers() {
+  return true;
+}
+
+bool ner::set_analysis_cache(size_t /*forms*/) {
+  return false;
+}
+
+void ner::analysis_cache_statistics(size_t& hits, size_t& misses) const {
+  hits = misses = 0;
+}
+
+bool ner::set_classification_cache(size_t /*feature_vectors*/) {
+  return false;
+}
+
+void ner::classification_cache_statistics(size_t& hits, size_t& misses) const {
+  hits = misses = 0;
+}
+
+bool ner::set_sentence_cache(size_t /*sentences*/) {
+  return false;
+}
+
+void ner::sentence_cache_statistics(size_t& hits, size_t& misses) const {
+  hits = misses = 0;
+}
+
+bool ner::set_stage_skipping(double /*probability*/) {
+  return false;
+}
+
+void ner::stage_skipping_statistics(size_t& skipped, size_t& sentences) const {
+  skipped = sentences = 0;
+}
+
+bool ner::set_candidate_prefilter(bool /*enabled*/) {
+  return false;
+}
+
+void ner::candidate_prefilter_statistics(size_t& filtered, size_t& sentences) const {
+  filtered = sentences = 0;
+}
+
+bool ner::set_tagger_beam_size(int /*beam_size*/) {
+  return false;
+}
+
+bool ner::set_tagger_fast_mode(bool /*fast*/) {
+  return false;
+}
+
+bool ner::set_max_sentence_length(int /*max_length*/) {
+  return false;
+}
+
+bool ner::set_pipeline_threads(int /*threads*/) {
+  return false;
+}
+
+void ner::memory_usage(vector<string>& components, vector<size_t>& bytes) const {
+  components.clear();
+  bytes.clear();
+}
+
+size_t ner::pooled_states() const {
+  return 0;
+}
+
+bool ner::set_stage_profiling(bool /*profiling*/) {
+  return false;
+}
+
+void ner::stage_profiling_statistics(vector<string>& stages, vector<double>& seconds) const {
+  stages.clear();
+  seconds.clear();
+}
+
+void ner::template_statistics(vector<feature_template_statistics>& statistics) const {
+  statistics.clear();
+}
+
 } // namespace nametag
 } // namespace ufal
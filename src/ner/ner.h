@@ -24,6 +24,44 @@ struct named_entity {
   named_entity(size_t start, size_t length, const string& type) : start(start), length(length), type(type) {}
 };
 
+// Statistics of a feature template gathered during stage profiling, see
+// ner::template_statistics.
+struct feature_template_statistics {
+  string name;
+  size_t calls;
+  double seconds;
+  size_t features;
+  size_t lookups;
+  size_t lookup_hits;
+
+  feature_template_statistics() : calls(0), seconds(0), features(0), lookups(0), lookup_hits(0) {}
+};
+
+// Scratch state of recognition used by a single thread, see ner::new_context.
+class ner_context {
+ public:
+  virtual ~ner_context() {}
+
+  // Return only the entities of the given types from the recognitions using
+  // this context, all of them if the types are empty. The processing of the
+  // found entities which can add only entities of the other types is skipped;
+  // the results are the same as when filtering all the found entities.
+  // Returns false if the recognizer does not support it or if some of the
+  // types cannot be found by the recognizer.
+  virtual bool set_entity_types(const vector<string>& types);
+};
+
+// Receiver of the found named entities, see ner::recognize with a sink.
+class entity_sink {
+ public:
+  virtual ~entity_sink() {}
+
+  // Receive an entity of the given sentence of the recognized batch. The type
+  // is given as its index in ner::entity_types (or -1 if it is not listed
+  // there) and as its name, which is valid only during the call.
+  virtual void on_entity(unsigned sentence, unsigned start, unsigned length, int type_id, string_piece type) = 0;
+};
+
 class ner {
  public:
   virtual ~ner() {}
@@ -31,16 +69,183 @@ class ner {
   static ner* load(const char* fname);
   static ner* load(istream& is);
 
+  // Write the compiled caches of the GazetteersEnhanced gazetteers read from
+  // files, next to the files, when loading the recognizers and reloading
+  // their gazetteers. The setting is process-wide and disabled by default,
+  // in which case only the existing up-to-date caches are used.
+  static void set_gazetteers_cache_writing(bool enabled);
+  static bool write_gazetteers_cache();
+
   // Perform named entity recognition on a tokenizes sentence and return found
   // named entities in the given vector.
   virtual void recognize(const vector<string_piece>& forms, vector<named_entity>& entities) const = 0;
 
+  // Perform named entity recognition on a batch of tokenized sentences and
+  // return found named entities of every sentence in the given vector.
+  virtual void recognize_batch(const vector<vector<string_piece>>& sentences, vector<vector<named_entity>>& entities) const;
+
+  // Perform named entity recognition on a tokenized sentence and return found
+  // named entities together with their confidences, which are the marginal
+  // probabilities of the entities. Returns false if the recognizer does not
+  // support it.
+  virtual bool recognize_with_confidences(const vector<string_piece>& forms, vector<named_entity>& entities, vector<double>& confidences) const;
+
+  // Perform named entity recognition on a tokenized sentence and return at
+  // most n best alternative decodings of its named entities, the best first,
+  // together with their probabilities. Returns false if the recognizer does
+  // not support it.
+  virtual bool recognize_nbest(const vector<string_piece>& forms, unsigned n, vector<vector<named_entity>>& decodings, vector<double>& probabilities) const;
+
+  // Perform named entity recognition on a sentence of already tagged tokens,
+  // every token consisting of a form, a lemma and a tag separated by spaces
+  // (the form is used as a missing lemma), instead of tagging the forms by
+  // the tagger of the recognizer. Returns false if the recognizer does not
+  // support it.
+  virtual bool recognize_pretagged(const vector<string_piece>& tokens, vector<named_entity>& entities) const;
+
+  // Return a new context holding all the scratch state of recognition, which
+  // can be passed to recognize and recognize_batch by a single thread at a
+  // time instead of acquiring the internal caches of the recognizer. The
+  // context must be deleted before the recognizer.
+  virtual ner_context* new_context() const;
+
+  // Perform named entity recognition like recognize and recognize_batch,
+  // using the given context created by new_context of this recognizer.
+  virtual void recognize(const vector<string_piece>& forms, vector<named_entity>& entities, ner_context& context) const;
+  virtual void recognize_batch(const vector<vector<string_piece>>& sentences, vector<vector<named_entity>>& entities, ner_context& context) const;
+
+  // Perform named entity recognition like recognize and recognize_batch with
+  // the given context, passing the found entities to the sink instead of
+  // storing them. The sentences are passed in order (a single sentence
+  // having index 0), and the entities of every sentence sorted by their
+  // start, longer first. When the entities need no further processing, they
+  // are passed directly from the decoding, without copying their types.
+  virtual void recognize(const vector<string_piece>& forms, entity_sink& sink, ner_context& context) const;
+  virtual void recognize_batch(const vector<vector<string_piece>>& sentences, entity_sink& sink, ner_context& context) const;
+
+  // Tokenize the given text using new_tokenizer and recognize all its
+  // sentences, returning the found named entities with start and length in
+  // Unicode characters of the text, sorted by start and longer first. Returns
+  // false if no tokenizer is defined for the recognizer.
+  virtual bool recognize_text(string_piece text, vector<named_entity>& entities) const;
+
   // Return the possible entity types
   virtual void entity_types(vector<string>& types) const = 0;
 
   // Return gazetteers used by the recognizer, if any, optionally with the index of entity type
   virtual void gazetteers(vector<string>& gazetteers, vector<int>* gazetteer_types) const = 0;
 
+  // Reload the gazetteers which are not embedded in the model (currently only
+  // GazetteersEnhanced ones). Recognition can run concurrently, using either
+  // the old or the new gazetteers. On failure, false is returned and the
+  // current gazetteers are kept.
+  virtual bool reload_gazetteers();
+
+  // Cache morphological analyses of at most the given number of forms, shared
+  // by all threads; zero disables the cache. Returns false if the recognizer
+  // does not perform morphological analysis. Must not be called concurrently
+  // with recognition.
+  virtual bool set_analysis_cache(size_t forms);
+
+  // Return the number of analysis cache hits and misses.
+  virtual void analysis_cache_statistics(size_t& hits, size_t& misses) const;
+
+  // Reuse the classifier results of the recently classified feature vectors,
+  // caching at most the given number of them separately in every thread; zero
+  // disables the cache. Returns false if the recognizer does not classify
+  // feature vectors. Must not be called concurrently with recognition.
+  virtual bool set_classification_cache(size_t feature_vectors);
+
+  // Return the number of classification cache hits and misses.
+  virtual void classification_cache_statistics(size_t& hits, size_t& misses) const;
+
+  // Cache the entities of at most the given number of recently recognized
+  // sentences, shared by all threads, so that identical sentences are not
+  // tagged and classified again; zero disables the cache. The cache is
+  // cleared when the recognition results can change. Returns false if the
+  // recognizer does not support it. Must not be called concurrently with
+  // recognition.
+  virtual bool set_sentence_cache(size_t sentences);
+
+  // Return the number of sentence cache hits and misses.
+  virtual void sentence_cache_statistics(size_t& hits, size_t& misses) const;
+
+  // Skip the following classifier stages of a sentence once the probability
+  // of the decoded bilou type of every word, according to the classifier of
+  // the current stage, is at least the given one; zero disables the skipping.
+  // This can change the recognition results. Returns false if the recognizer
+  // does not support it. Must not be called concurrently with recognition.
+  virtual bool set_stage_skipping(double probability);
+
+  // Return the number of sentences whose following stages were skipped and
+  // the number of all sentences recognized by multiple stages.
+  virtual void stage_skipping_statistics(size_t& skipped, size_t& sentences) const;
+
+  // Return no entities for the sentences without any candidate of an entity,
+  // i.e., without an uppercase or caseless letter, a digit, an URL or an email
+  // and a form starting a gazetteer match, without tagging and classifying
+  // them. This can change the recognition results, so the recall of the model
+  // should be verified first, for example using nametag_bench --prefilter
+  // with --heldout. Returns false if the recognizer does not support it.
+  // Must not be called concurrently with recognition.
+  virtual bool set_candidate_prefilter(bool enabled);
+
+  // Return the number of sentences without candidates and the number of all
+  // sentences checked by the candidate prefilter.
+  virtual void candidate_prefilter_statistics(size_t& filtered, size_t& sentences) const;
+
+  // Keep only the given number of best hypotheses for every word during
+  // morphological disambiguation, instead of exact decoding used when zero.
+  // Returns false if the recognizer does not perform morphological
+  // disambiguation. Must not be called concurrently with recognition.
+  virtual bool set_tagger_beam_size(int beam_size);
+
+  // Skip the morphological disambiguation, using the first analysis of every
+  // word, which is faster but usually chooses worse lemmas and tags. Returns
+  // false if the recognizer does not perform morphological disambiguation.
+  // Must not be called concurrently with recognition.
+  virtual bool set_tagger_fast_mode(bool fast);
+
+  // Split sentences longer than the given number of words into overlapping
+  // chunks, which are recognized independently and whose entities are then
+  // merged; zero disables the splitting. Returns false if the recognizer does
+  // not support it. Must not be called concurrently with recognition.
+  virtual bool set_max_sentence_length(int max_length);
+
+  // Tag the sentences of a batch by the given number of additional threads,
+  // while the already tagged sentences are recognized by the calling thread;
+  // zero disables the pipelining. The recognition results are not changed.
+  // Returns false if the recognizer does not support it. Must not be called
+  // concurrently with recognition.
+  virtual bool set_pipeline_threads(int threads);
+
+  // Return the approximate number of bytes used by the individual components
+  // of the recognizer, like the tagger, the feature processors and the
+  // classifiers. Components shared with other recognizers are included in
+  // the figures of each of them. Must not be called concurrently with
+  // recognition.
+  virtual void memory_usage(vector<string>& components, vector<size_t>& bytes) const;
+
+  // Return the number of the recognition working states, which are allocated
+  // by the threads performing recognition and kept for reuse afterwards.
+  virtual size_t pooled_states() const;
+
+  // Accumulate the wall time spent in the individual recognition stages, like
+  // tagging, every feature processor, every classifier stage and decoding,
+  // summed over all threads. Enabling the profiling resets the accumulated
+  // times. Returns false if the recognizer does not support profiling. Must
+  // not be called concurrently with recognition.
+  virtual bool set_stage_profiling(bool profiling);
+
+  // Return the names of the profiled stages and the seconds spent in them.
+  virtual void stage_profiling_statistics(vector<string>& stages, vector<double>& seconds) const;
+
+  // Return the statistics of every feature template gathered while the stage
+  // profiling is enabled: the number of processed sentences, the seconds
+  // spent, the number of added features and the number of lookups of feature
+  // keys together with the number of found ones.
+  virtual void template_statistics(vector<feature_template_statistics>& statistics) const;
+
   // Construct a new tokenizer instance appropriate for this recognizer.
   // Can return NULL if no such tokenizer exists.
   virtual tokenizer* new_tokenizer() const = 0;
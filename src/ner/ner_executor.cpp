@@ -0,0 +1,173 @@
+// This file is part of NameTag <http://github.com/ufal/nametag/>.
+//
+// Copyright 2016 Institute of Formal and Applied Linguistics, Faculty of
+// Mathematics and Physics, Charles University in Prague, Czech Republic.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <system_error>
+#include <thread>
+
+#include "ner_executor.h"
+
+namespace ufal {
+namespace nametag {
+
+// Worker threads taking the texts from a shared queue
+class threaded_ner_executor : public ner_executor {
+ public:
+  threaded_ner_executor(const ner* recognizer) : recognizer(recognizer) {}
+
+  virtual ~threaded_ner_executor() override {
+    {
+      unique_lock<mutex> lock(queue_mutex);
+      stopping = true;
+    }
+    queue_ready.notify_all();
+    for (auto&& thread : threads)
+      thread.join();
+  }
+
+  bool start(unsigned count) {
+    for (unsigned i = 0; i < count; i++) {
+      unique_ptr<worker> created(new worker());
+      created->context.reset(recognizer->new_context());
+      created->text_tokenizer.reset(recognizer->new_tokenizer());
+      if (!created->context || !created->text_tokenizer) return false;
+      workers.push_back(move(created));
+    }
+
+    for (auto&& state : workers)
+      try {
+        threads.emplace_back(&threaded_ner_executor::run, this, state.get());
+      } catch (system_error&) {
+        return false;
+      }
+    return true;
+  }
+
+  virtual future<vector<named_entity>> recognize_async(string_piece text) override {
+    auto result = make_shared<promise<vector<named_entity>>>();
+    auto entities = result->get_future();
+    submit(text, [result](vector<named_entity>& entities) { result->set_value(move(entities)); },
+           [result](exception_ptr error) { result->set_exception(error); });
+    return entities;
+  }
+
+  virtual void recognize_async(string_piece text, const function<void(vector<named_entity>& entities)>& callback) override {
+    submit(text, callback, nullptr);
+  }
+
+  virtual void wait() override {
+    unique_lock<mutex> lock(queue_mutex);
+    all_done.wait(lock, [this] { return !pending; });
+    if (callback_error) {
+      exception_ptr error;
+      swap(error, callback_error);
+      rethrow_exception(error);
+    }
+  }
+
+ private:
+  // A task is passed the exception thrown while recognizing it or calling its
+  // callback if it has a failure handler, otherwise the first such exception
+  // is rethrown by wait
+  struct task {
+    string text;
+    function<void(vector<named_entity>&)> callback;
+    function<void(exception_ptr)> failure;
+
+    task(string&& text, const function<void(vector<named_entity>&)>& callback, const function<void(exception_ptr)>& failure)
+        : text(move(text)), callback(callback), failure(failure) {}
+  };
+
+  void submit(string_piece text, const function<void(vector<named_entity>&)>& callback, const function<void(exception_ptr)>& failure) {
+    {
+      unique_lock<mutex> lock(queue_mutex);
+      queue.emplace_back(string(text.str, text.len), callback, failure);
+      pending++;
+    }
+    queue_ready.notify_one();
+  }
+
+  struct worker {
+    unique_ptr<ner_context> context;
+    unique_ptr<tokenizer> text_tokenizer;
+    vector<string_piece> forms;
+    vector<token_range> tokens;
+    vector<named_entity> sentence_entities;
+  };
+
+  void run(worker* state) {
+    vector<named_entity> entities;
+    for (;;) {
+      unique_lock<mutex> lock(queue_mutex);
+      queue_ready.wait(lock, [this] { return stopping || !queue.empty(); });
+      if (queue.empty()) return;
+      task current(move(queue.front()));
+      queue.pop_front();
+      lock.unlock();
+
+      exception_ptr error;
+      try {
+        recognize(*state, current.text, entities);
+        current.callback(entities);
+      } catch (...) {
+        error = current_exception();
+      }
+      if (error && current.failure) current.failure(error), error = nullptr;
+
+      lock.lock();
+      if (error && !callback_error) callback_error = error;
+      if (!--pending) all_done.notify_all();
+    }
+  }
+
+  void recognize(worker& state, const string& text, vector<named_entity>& entities) const {
+    // The same recognition as ner::recognize_text, reusing the tokenizer and
+    // the context of the worker
+    entities.clear();
+    state.text_tokenizer->set_text(text);
+    while (state.text_tokenizer->next_sentence(&state.forms, &state.tokens)) {
+      recognizer->recognize(state.forms, state.sentence_entities, *state.context);
+      sort(state.sentence_entities.begin(), state.sentence_entities.end(), [](const named_entity& a, const named_entity& b) {
+        return a.start < b.start || (a.start == b.start && a.length > b.length);
+      });
+
+      for (auto&& entity : state.sentence_entities) {
+        auto& first = state.tokens[entity.start];
+        auto& last = state.tokens[entity.start + entity.length - 1];
+        entities.emplace_back(first.start, last.start + last.length - first.start, entity.type);
+      }
+    }
+  }
+
+  const ner* recognizer;
+  vector<unique_ptr<worker>> workers;
+  vector<thread> threads;
+
+  mutex queue_mutex;
+  condition_variable queue_ready, all_done;
+  deque<task> queue;
+  size_t pending = 0;
+  bool stopping = false;
+  exception_ptr callback_error;
+};
+
+ner_executor* ner_executor::create(const ner* recognizer, unsigned threads) {
+  if (!recognizer || !threads) return nullptr;
+
+  unique_ptr<threaded_ner_executor> executor(new threaded_ner_executor(recognizer));
+  if (!executor->start(threads)) return nullptr;
+  return executor.release();
+}
+
+} // namespace nametag
+} // namespace ufal
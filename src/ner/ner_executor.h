@@ -0,0 +1,50 @@
+// This file is part of NameTag <http://github.com/ufal/nametag/>.
+//
+// Copyright 2016 Institute of Formal and Applied Linguistics, Faculty of
+// Mathematics and Physics, Charles University in Prague, Czech Republic.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include <functional>
+#include <future>
+
+#include "common.h"
+#include "ner.h"
+
+namespace ufal {
+namespace nametag {
+
+// Recognition of texts by a pool of worker threads, every one of them
+// keeping its own tokenizer and context of the recognizer.
+class ner_executor {
+ public:
+  // Wait until all submitted texts are recognized and stop the threads.
+  virtual ~ner_executor() {}
+
+  // Create an executor using the given positive number of threads to
+  // recognize the texts by the given recognizer, which must not be destroyed
+  // before the executor. Returns NULL if the recognizer has no tokenizer or
+  // the threads cannot be started.
+  static ner_executor* create(const ner* recognizer, unsigned threads);
+
+  // Recognize the given text, which is copied, like ner::recognize_text, the
+  // texts being processed in the order of submission. The entities are
+  // returned either in the future, or passed to the callback called by
+  // the worker thread, which must not call wait. An exception thrown during
+  // the recognition is stored in the future; with the callback, the first
+  // exception thrown during the recognition or by the callback is rethrown
+  // by wait.
+  virtual future<vector<named_entity>> recognize_async(string_piece text) = 0;
+  virtual void recognize_async(string_piece text, const function<void(vector<named_entity>& entities)>& callback) = 0;
+
+  // Wait until all texts submitted so far are recognized, rethrowing the
+  // first exception of the texts submitted with a callback.
+  virtual void wait() = 0;
+};
+
+} // namespace nametag
+} // namespace ufal
@@ -0,0 +1,55 @@
+// This file is part of NameTag <http://github.com/ufal/nametag/>.
+//
+// Copyright 2016 Institute of Formal and Applied Linguistics, Faculty of
+// Mathematics and Physics, Charles University in Prague, Czech Republic.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#include "ner_pool.h"
+#include "utils/threadsafe_resource_loader.h"
+
+namespace ufal {
+namespace nametag {
+
+// Recognizers loaded on demand by threadsafe_resource_loader
+class loaded_ner_pool : public ner_pool {
+ public:
+  loaded_ner_pool(unsigned max_loaded) : loader(max_loaded) {}
+
+  virtual unsigned add(const char* fname) override {
+    models.emplace_back(new model(fname));
+    return loader.add(models.back().get());
+  }
+
+  virtual const ner* acquire(unsigned id) override {
+    model* loaded = loader.load(id);
+    return loaded ? loaded->recognizer.get() : nullptr;
+  }
+
+  virtual void release(unsigned id) override {
+    loader.release(id);
+  }
+
+ private:
+  struct model {
+    string fname;
+    unique_ptr<ner> recognizer;
+
+    model(const char* fname) : fname(fname) {}
+
+    // Load and release the model, used by the threadsafe_resource_loader
+    bool load() { recognizer.reset(ner::load(fname.c_str())); return bool(recognizer); }
+    void release() { recognizer.reset(); }
+  };
+  vector<unique_ptr<model>> models;
+  utils::threadsafe_resource_loader<model> loader;
+};
+
+ner_pool* ner_pool::create(unsigned max_loaded) {
+  return max_loaded ? new loaded_ner_pool(max_loaded) : nullptr;
+}
+
+} // namespace nametag
+} // namespace ufal
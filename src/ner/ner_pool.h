@@ -0,0 +1,42 @@
+// This file is part of NameTag <http://github.com/ufal/nametag/>.
+//
+// Copyright 2016 Institute of Formal and Applied Linguistics, Faculty of
+// Mathematics and Physics, Charles University in Prague, Czech Republic.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include "common.h"
+#include "ner.h"
+
+namespace ufal {
+namespace nametag {
+
+// A pool of recognizers loaded on demand, keeping a bounded number of them
+// loaded and unloading the least recently used ones.
+class ner_pool {
+ public:
+  virtual ~ner_pool() {}
+
+  // Create a pool keeping at most the given number of recognizers loaded,
+  // which must be positive.
+  static ner_pool* create(unsigned max_loaded);
+
+  // Add a recognizer model file to the pool without loading it, returning
+  // its id. Must not be called concurrently with other methods.
+  virtual unsigned add(const char* fname) = 0;
+
+  // Return the recognizer with the given id, loading it if needed. When the
+  // maximum number of recognizers is in use, wait until one is released;
+  // otherwise the least recently used unused recognizer is unloaded if
+  // required. Returns NULL if the model cannot be loaded. Every returned
+  // recognizer must be released after use.
+  virtual const ner* acquire(unsigned id) = 0;
+  virtual void release(unsigned id) = 0;
+};
+
+} // namespace nametag
+} // namespace ufal
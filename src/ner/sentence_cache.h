@@ -0,0 +1,145 @@
+// This file is part of NameTag <http://github.com/ufal/nametag/>.
+//
+// Copyright 2016 Institute of Formal and Applied Linguistics, Faculty of
+// Mathematics and Physics, Charles University in Prague, Czech Republic.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+
+#include "common.h"
+#include "ner.h"
+
+namespace ufal {
+namespace nametag {
+
+// Bounded cache of the entities of recognized sentences, which can be used
+// concurrently by multiple threads. The sentences are keyed by their forms,
+// which are compared on lookup, and the entries are evicted using the CLOCK
+// algorithm, separately in several independently locked shards.
+//
+// Clearing the cache starts a new generation, and the entities recognized
+// by a recognition started in a previous generation are not inserted.
+class sentence_cache {
+ public:
+  inline sentence_cache(size_t capacity);
+
+  // Fill the key identifying the sentence with the given forms.
+  static inline void make_key(const vector<string_piece>& forms, string& key);
+
+  // Returns false if the entities of the key are not cached, filling them otherwise.
+  inline bool find(const string& key, vector<named_entity>& entities);
+  inline void insert(const string& key, const vector<named_entity>& entities, unsigned generation);
+
+  inline void clear();
+  inline unsigned generation() const { return current_generation.load(); }
+
+  inline size_t hits() const { return hits_count.load(memory_order_relaxed); }
+  inline size_t misses() const { return misses_count.load(memory_order_relaxed); }
+
+ private:
+  enum { SHARDS = 16 };
+
+  struct entry {
+    string key;
+    vector<named_entity> entities;
+    bool referenced;
+  };
+  struct shard {
+    mutex lock;
+    unordered_map<string, unsigned> index;
+    vector<entry> entries;
+    size_t capacity = 0;
+    unsigned hand = 0;
+  };
+  shard shards[SHARDS];
+
+  atomic<unsigned> current_generation;
+  atomic<size_t> hits_count, misses_count;
+
+  inline shard& key_shard(const string& key);
+};
+
+sentence_cache::sentence_cache(size_t capacity) : current_generation(0), hits_count(0), misses_count(0) {
+  for (unsigned i = 0; i < SHARDS; i++)
+    shards[i].capacity = capacity / SHARDS + (i < capacity % SHARDS);
+}
+
+void sentence_cache::make_key(const vector<string_piece>& forms, string& key) {
+  // Every form is preceded by its length, so that the forms cannot be confused
+  key.clear();
+  for (auto&& form : forms) {
+    uint32_t len = form.len;
+    key.append((const char*) &len, sizeof(len));
+    key.append(form.str, form.len);
+  }
+}
+
+bool sentence_cache::find(const string& key, vector<named_entity>& entities) {
+  auto& shard = key_shard(key);
+  {
+    lock_guard<mutex> guard(shard.lock);
+    auto it = shard.index.find(key);
+    if (it != shard.index.end()) {
+      auto& entry = shard.entries[it->second];
+      entry.referenced = true;
+      entities = entry.entities;
+      hits_count.fetch_add(1, memory_order_relaxed);
+      return true;
+    }
+  }
+
+  misses_count.fetch_add(1, memory_order_relaxed);
+  return false;
+}
+
+void sentence_cache::insert(const string& key, const vector<named_entity>& entities, unsigned generation) {
+  auto& shard = key_shard(key);
+  lock_guard<mutex> guard(shard.lock);
+  if (!shard.capacity || generation != current_generation.load() || shard.index.count(key)) return;
+
+  if (shard.entries.size() < shard.capacity) {
+    shard.index.emplace(key, shard.entries.size());
+    shard.entries.push_back({key, entities, false});
+    return;
+  }
+
+  // Find an entry not referenced since the hand passed it last time
+  while (shard.entries[shard.hand].referenced) {
+    shard.entries[shard.hand].referenced = false;
+    shard.hand = (shard.hand + 1) % shard.entries.size();
+  }
+
+  auto& entry = shard.entries[shard.hand];
+  shard.index.erase(entry.key);
+  shard.index.emplace(key, shard.hand);
+  entry.key = key;
+  entry.entities = entities;
+  shard.hand = (shard.hand + 1) % shard.entries.size();
+}
+
+void sentence_cache::clear() {
+  // The generation is changed first, so that a recognition which started
+  // before cannot insert its entities after its shard is cleared
+  current_generation.fetch_add(1);
+
+  for (auto&& shard : shards) {
+    lock_guard<mutex> guard(shard.lock);
+    shard.index.clear();
+    shard.entries.clear();
+    shard.hand = 0;
+  }
+}
+
+sentence_cache::shard& sentence_cache::key_shard(const string& key) {
+  return shards[hash<string>()(key) % SHARDS];
+}
+
+} // namespace nametag
+} // namespace ufal
@@ -0,0 +1,82 @@
+// This file is part of NameTag <http://github.com/ufal/nametag/>.
+//
+// Copyright 2016 Institute of Formal and Applied Linguistics, Faculty of
+// Mathematics and Physics, Charles University in Prague, Czech Republic.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#include <algorithm>
+#include <cstring>
+
+#include "training_corpus.h"
+
+namespace ufal {
+namespace nametag {
+
+void training_corpus::clear() {
+  sentences.assign(1, 0);
+  words.clear();
+  raw_lemmas_all.clear();
+  strings.clear();
+  string_offsets.assign(1, 0);
+  table.clear();
+}
+
+void training_corpus::add(const ner_sentence& sentence) {
+  for (unsigned i = 0; i < sentence.size; i++) {
+    auto& word = sentence.words[i];
+    words.push_back({intern(word.form), intern(word.raw_lemma), intern(word.lemma_id), intern(word.lemma_comments),
+                     intern(word.tag), uint32_t(raw_lemmas_all.size())});
+    for (auto&& raw_lemma : word.raw_lemmas_all)
+      raw_lemmas_all.push_back(intern(raw_lemma));
+  }
+  sentences.push_back(words.size());
+}
+
+void training_corpus::get(size_t i, ner_sentence& sentence) const {
+  sentence.resize(sentence_size(i));
+  for (size_t w = sentences[i]; w < sentences[i + 1]; w++) {
+    auto& word = sentence.words[w - sentences[i]];
+    auto assign = [this](string& str, uint32_t id) { string_piece piece = string_at(id); str.assign(piece.str, piece.len); };
+    assign(word.form, words[w].form);
+    assign(word.raw_lemma, words[w].raw_lemma);
+    assign(word.lemma_id, words[w].lemma_id);
+    assign(word.lemma_comments, words[w].lemma_comments);
+    assign(word.tag, words[w].tag);
+
+    uint32_t raw_lemmas_end = w + 1 < words.size() ? words[w + 1].raw_lemmas_all : raw_lemmas_all.size();
+    word.raw_lemmas_all.resize(raw_lemmas_end - words[w].raw_lemmas_all);
+    for (uint32_t r = words[w].raw_lemmas_all; r < raw_lemmas_end; r++)
+      assign(word.raw_lemmas_all[r - words[w].raw_lemmas_all], raw_lemmas_all[r]);
+  }
+}
+
+uint32_t training_corpus::intern(const string& str) {
+  // Keep the load factor of the table at most 0.5
+  size_t count = string_offsets.size() - 1;
+  if (2 * (count + 1) > table.size()) {
+    table.assign(max(size_t(1024), 2 * table.size()), table_empty);
+    for (uint32_t id = 0; id < count; id++) {
+      size_t index = hash(string_at(id)) & (table.size() - 1);
+      while (table[index] != table_empty) index = (index + 1) & (table.size() - 1);
+      table[index] = id;
+    }
+  }
+
+  size_t index = hash(str) & (table.size() - 1);
+  for (; table[index] != table_empty; index = (index + 1) & (table.size() - 1)) {
+    string_piece candidate = string_at(table[index]);
+    if (candidate.len == str.size() && memcmp(candidate.str, str.data(), str.size()) == 0)
+      return table[index];
+  }
+
+  table[index] = count;
+  strings.append(str);
+  string_offsets.push_back(strings.size());
+  return count;
+}
+
+} // namespace nametag
+} // namespace ufal
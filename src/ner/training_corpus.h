@@ -0,0 +1,70 @@
+// This file is part of NameTag <http://github.com/ufal/nametag/>.
+//
+// Copyright 2016 Institute of Formal and Applied Linguistics, Faculty of
+// Mathematics and Physics, Charles University in Prague, Czech Republic.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include "common.h"
+#include "bilou/ner_sentence.h"
+#include "utils/string_piece.h"
+
+namespace ufal {
+namespace nametag {
+
+// Tagged words of the training sentences, stored compactly in flat arrays.
+// Every distinct string (form, lemma, tag, ...) is stored only once, and the
+// words refer to the strings using their ids. The sentences are added in
+// order and their words are expanded into a ner_sentence when processed.
+class training_corpus {
+ public:
+  void clear();
+
+  // Append the words of the given tagged sentence
+  void add(const ner_sentence& sentence);
+  // Resize the given sentence and fill its words by the i-th sentence
+  void get(size_t i, ner_sentence& sentence) const;
+
+  size_t size() const { return sentences.size() - 1; }
+  unsigned sentence_size(size_t i) const { return sentences[i + 1] - sentences[i]; }
+
+ private:
+  // The words of sentence i are words[sentences[i]..sentences[i+1]), and the
+  // raw_lemmas_all of word w are raw_lemmas_all[w.raw_lemmas_all..(w+1).raw_lemmas_all)
+  struct word {
+    uint32_t form, raw_lemma, lemma_id, lemma_comments, tag;
+    uint32_t raw_lemmas_all;
+  };
+  vector<size_t> sentences{0};
+  vector<word> words;
+  vector<uint32_t> raw_lemmas_all;
+
+  // Interned strings, string i being strings[string_offsets[i]..string_offsets[i+1]),
+  // found using an open addressing hash table of the string ids
+  string strings;
+  vector<size_t> string_offsets{0};
+  vector<uint32_t> table;
+  enum :uint32_t { table_empty = ~0U };
+
+  uint32_t intern(const string& str);
+  inline string_piece string_at(uint32_t id) const;
+  static inline uint32_t hash(string_piece str);
+};
+
+string_piece training_corpus::string_at(uint32_t id) const {
+  return string_piece(strings.data() + string_offsets[id], string_offsets[id + 1] - string_offsets[id]);
+}
+
+uint32_t training_corpus::hash(string_piece str) {
+  uint32_t hash = 2166136261U;
+  for (size_t i = 0; i < str.len; i++)
+    hash = (hash ^ (unsigned char)str.str[i]) * 16777619U;
+  return hash;
+}
+
+} // namespace nametag
+} // namespace ufal
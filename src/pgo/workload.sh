@@ -0,0 +1,50 @@
+#!/bin/sh
+
+# This file is part of NameTag <http://github.com/ufal/nametag/>.
+#
+# Copyright 2016 Institute of Formal and Applied Linguistics, Faculty of
+# Mathematics and Physics, Charles University in Prague, Czech Republic.
+#
+# This Source Code Form is subject to the terms of the Mozilla Public
+# License, v. 2.0. If a copy of the MPL was not distributed with this
+# file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+# Representative workload of the pgo target of the Makefile, run in the src
+# directory by the instrumented binaries. It trains a small English model on
+# the bundled data and tokenizes, tags and recognizes the bundled text, using
+# run_ner, nametag_bench and nametag_server. The model and other generated
+# files are stored in the given directory.
+
+set -e
+[ $# -eq 1 ] || { echo "Usage: $0 output_directory" >&2; exit 1; }
+dir="$1"
+model="$dir/english.ner"
+
+echo "Training the workload model." >&2
+./train_ner --threads=2 english trivial pgo/features.txt 2 10 -0.1 0.1 0.01 0.5 0 <pgo/train.txt >"$model"
+
+echo "Tokenizing and recognizing the workload text." >&2
+./run_tokenizer --output=vertical "$model" <pgo/text.txt >"$dir/text.vertical"
+./run_ner --output=xml "$model" <pgo/text.txt >/dev/null
+./run_ner --output=conll --threads=2 --classification_cache=4096 "$model" <pgo/text.txt >/dev/null
+./run_ner --output=offsets --pipeline_threads=1 "$model" <pgo/text.txt >/dev/null
+./run_ner --input=vertical --output=vertical --stage_skipping=0.99 "$model" <"$dir/text.vertical" >/dev/null
+./nametag_bench --repeat=3 "$model" pgo/text.txt >/dev/null
+
+# The REST server listens on a Unix domain socket only and is stopped by
+# SIGINT, so that it exits normally and writes its profile
+if command -v curl >/dev/null 2>&1; then
+  echo "Recognizing the workload text by the REST server." >&2
+  socket="$dir/server.socket"
+  rm -f "$socket"
+  ./rest_server/nametag_server --log_file= --unix_socket="$socket" --warm_up=pgo/text.txt 0 english "$model" "" &
+  server=$!
+  for i in 1 2 3 4 5 6 7 8 9 10; do [ -S "$socket" ] && break; sleep 1; done
+  for output in xml vertical conll; do
+    curl -s --unix-socket "$socket" -F data=@pgo/text.txt -F output=$output http://localhost/recognize >/dev/null
+  done
+  kill -INT $server
+  wait $server
+else
+  echo "The curl command is not available, skipping the REST server workload." >&2
+fi
@@ -45,6 +45,7 @@
 #ifdef LINUX
 # define HAVE_DECL_TCP_CORK 1 /* Define to 1 if you have the declaration of `TCP_CORK', and to 0 if you don't. */
 # define HAVE_LISTEN_SHUTDOWN 1 /* can use shutdown on listen sockets */
+# define EPOLL_SUPPORT 1 /* define to 0 to disable epoll support */
 #endif
 
 // 4) Generic settings
@@ -52,7 +53,9 @@
 #define _MHD_EXTERN /* defines how to decorate public symbols while building */
 // #undef BAUTH_SUPPORT /* disable basic Auth support */
 // #undef DAUTH_SUPPORT /* disable digest Auth support */
-#define EPOLL_SUPPORT 0 /* define to 0 to disable epoll support */
+#ifndef EPOLL_SUPPORT
+# define EPOLL_SUPPORT 0 /* define to 0 to disable epoll support */
+#endif
 #define HAVE_ACCEPT4 0 /* Define to 1 if you have the `accept4' function. */
 // #undef HAVE_CLOCK_GETTIME /* Have clock_gettime */
 #define HAVE_INET6 1 /* Provides IPv6 headers */
@@ -1846,6 +1846,9 @@ MHD_accept_connection (struct MHD_Daemon *daemon)
   nonblock = 0; if (nonblock) s = 0;
   s = accept (fd, addr, &addrlen);
 #endif
+  /* the addresses of Unix domain sockets may not fit, truncate them */
+  if (addrlen > (socklen_t) sizeof (addrstorage))
+    addrlen = sizeof (addrstorage);
   if ((MHD_INVALID_SOCKET == s) || (addrlen <= 0))
     {
 #if HAVE_MESSAGES
@@ -2619,7 +2622,7 @@ MHD_epoll (struct MHD_Daemon *daemon,
 	      /* this is an event relating to a 'normal' connection,
 		 remember the event and if appropriate mark the
 		 connection as 'eready'. */
-	      pos = events[i].data.ptr;
+	      pos = (struct MHD_Connection *) events[i].data.ptr;
 	      if (0 != (events[i].events & EPOLLIN))
 		{
 		  pos->epoll_state |= MHD_EPOLL_STATE_READ_READY;
@@ -753,8 +753,9 @@ struct MHD_Connection
 #if EPOLL_SUPPORT
   /**
    * What is the state of this socket in relation to epoll?
+   * (Combination of enum MHD_EpollState flags, an int in C++.)
    */
-  enum MHD_EpollState epoll_state;
+  int epoll_state;
 #endif
 
   /**
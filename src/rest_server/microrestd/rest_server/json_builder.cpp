@@ -14,6 +14,19 @@ namespace microrestd {
 
 const char* json_builder::mime = "application/json";
 
+// Characters which must be escaped in JSON strings, and additionally when
+// escaping XML
+static const struct escaped_chars {
+  enum { JSON = 1, XML = 2 };
+  unsigned char flags[256];
+
+  escaped_chars() : flags() {
+    for (int chr = 0; chr < 32; chr++) flags[chr] = JSON;
+    flags[(unsigned char)'"'] = flags[(unsigned char)'\\'] = JSON;
+    flags[(unsigned char)'&'] = flags[(unsigned char)'<'] = flags[(unsigned char)'>'] = XML;
+  }
+} escaped;
+
 void json_builder::discard_current_prefix(size_t length) {
   if (!length) return;
 
@@ -24,44 +37,52 @@ void json_builder::discard_current_prefix(size_t length) {
 }
 
 void json_builder::encode(string_piece str) {
-  for (; str.len; str.str++, str.len--)
-    switch (*str.str) {
+  const char* end = str.str + str.len;
+  for (const char* run = str.str; run < end; run++) {
+    // Append the longest run of characters not needing escaping at once
+    const char* chr = run;
+    while (chr < end && !(escaped.flags[(unsigned char)*chr] & escaped_chars::JSON)) chr++;
+    json.insert(json.end(), run, chr);
+    if ((run = chr) == end) break;
+
+    switch (*chr) {
       case '"': json.push_back('\\'); json.push_back('\"'); break;
       case '\\': json.push_back('\\'); json.push_back('\\'); break;
-      case '\b': json.push_back('\\'); json.push_back('b'); break;
-      case '\f': json.push_back('\\'); json.push_back('f'); break;
-      case '\n': json.push_back('\\'); json.push_back('n'); break;
-      case '\r': json.push_back('\\'); json.push_back('r'); break;
-      case '\t': json.push_back('\\'); json.push_back('t'); break;
-      default:
-        if (((unsigned char)*str.str) < 32) {
-          json.push_back('u'); json.push_back('0'); json.push_back('0'); json.push_back('0' + (*str.str >> 4)); json.push_back("0123456789ABCDEF"[*str.str & 0xF]);
-        } else {
-          json.push_back(*str.str);
-        }
+      default: encode_control(*chr);
     }
+  }
 }
 
 void json_builder::encode_xml_escape(string_piece str) {
-  for (; str.len; str.str++, str.len--)
-    switch (*str.str) {
+  const char* end = str.str + str.len;
+  for (const char* run = str.str; run < end; run++) {
+    // Append the longest run of characters not needing escaping at once
+    const char* chr = run;
+    while (chr < end && !escaped.flags[(unsigned char)*chr]) chr++;
+    json.insert(json.end(), run, chr);
+    if ((run = chr) == end) break;
+
+    switch (*chr) {
       case '&': json.push_back('&'); json.push_back('a'); json.push_back('m'); json.push_back('p'); json.push_back(';'); break;
       case '<': json.push_back('&'); json.push_back('l'); json.push_back('t'); json.push_back(';'); break;
       case '>': json.push_back('&'); json.push_back('g'); json.push_back('t'); json.push_back(';'); break;
       case '"': json.push_back('&'); json.push_back('q'); json.push_back('u'); json.push_back('o'); json.push_back('t'); json.push_back(';'); break;
       case '\\': json.push_back('\\'); json.push_back('\\'); break;
-      case '\b': json.push_back('\\'); json.push_back('b'); break;
-      case '\f': json.push_back('\\'); json.push_back('f'); break;
-      case '\n': json.push_back('\\'); json.push_back('n'); break;
-      case '\r': json.push_back('\\'); json.push_back('r'); break;
-      case '\t': json.push_back('\\'); json.push_back('t'); break;
-      default:
-        if (((unsigned char)*str.str) < 32) {
-          json.push_back('u'); json.push_back('0'); json.push_back('0'); json.push_back('0' + (*str.str >> 4)); json.push_back("0123456789ABCDEF"[*str.str & 0xF]);
-        } else {
-          json.push_back(*str.str);
-        }
+      default: encode_control(*chr);
     }
+  }
+}
+
+void json_builder::encode_control(char chr) {
+  switch (chr) {
+    case '\b': json.push_back('\\'); json.push_back('b'); break;
+    case '\f': json.push_back('\\'); json.push_back('f'); break;
+    case '\n': json.push_back('\\'); json.push_back('n'); break;
+    case '\r': json.push_back('\\'); json.push_back('r'); break;
+    case '\t': json.push_back('\\'); json.push_back('t'); break;
+    default:
+      json.push_back('\\'); json.push_back('u'); json.push_back('0'); json.push_back('0'); json.push_back('0' + (chr >> 4)); json.push_back("0123456789ABCDEF"[chr & 0xF]);
+  }
 }
 
 } // namespace microrestd
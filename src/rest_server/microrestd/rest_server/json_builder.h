@@ -23,12 +23,19 @@ class json_builder {
   // Clear
   inline json_builder& clear();
 
+  // Reserve the buffer for json of given length
+  inline json_builder& reserve(size_t length);
+  // Exchange the buffer with the given one (for example to reuse it),
+  // together with the json it contains
+  inline void swap_buffer(std::vector<char>& buffer);
+
   // Encode
   inline json_builder& object();
   inline json_builder& array();
   inline json_builder& key(string_piece str);
   inline json_builder& value(string_piece str, bool append = false);
   inline json_builder& value(int number);
+  inline json_builder& value(size_t number);
   inline json_builder& value_bool(bool boolean);
   inline json_builder& value(std::nullptr_t null);
   inline json_builder& value_xml_escape(string_piece str, bool append = false);
@@ -36,6 +43,9 @@ class json_builder {
   inline json_builder& close();
   inline json_builder& finish(bool indent = false);
 
+  // Return the number of currently open objects and arrays
+  inline size_t depth() const { return stack.size(); }
+
   // Return current json
   inline string_piece current() const;
   inline operator string_piece() const;
@@ -52,6 +62,7 @@ class json_builder {
   inline void normalize_mode(bool start_value);
   void encode(string_piece str);
   void encode_xml_escape(string_piece str);
+  void encode_control(char chr);
 
   std::vector<char> json;
   std::vector<char> stack;
@@ -69,6 +80,15 @@ json_builder& json_builder::clear() {
   return *this;
 }
 
+json_builder& json_builder::reserve(size_t length) {
+  json.reserve(length);
+  return *this;
+}
+
+void json_builder::swap_buffer(std::vector<char>& buffer) {
+  json.swap(buffer);
+}
+
 json_builder& json_builder::object() {
   normalize_mode(true);
   json.push_back('{');
@@ -110,6 +130,14 @@ json_builder& json_builder::value(int number) {
   return *this;
 }
 
+json_builder& json_builder::value(size_t number) {
+  normalize_mode(true);
+  for (auto&& chr : std::to_string(number))
+    json.push_back(chr);
+  mode = AFTER_VALUE;
+  return *this;
+}
+
 json_builder& json_builder::value_bool(bool boolean) {
   normalize_mode(true);
   if (boolean) {
@@ -7,6 +7,8 @@
 // License, v. 2.0. If a copy of the MPL was not distributed with this
 // file, You can obtain one at http://mozilla.org/MPL/2.0/.
 
+#include <vector>
+
 #include "json_response_generator.h"
 
 namespace ufal {
@@ -14,6 +16,29 @@ namespace microrestd {
 
 const char* json_response_generator::mime = "application/json";
 
+static thread_local std::vector<std::vector<char>> json_response_generator_buffers;
+
+json_response_generator::json_response_generator() {
+  auto& buffers = json_response_generator_buffers;
+  if (!buffers.empty()) {
+    json.swap_buffer(buffers.back());
+    buffers.pop_back();
+  }
+}
+
+json_response_generator::~json_response_generator() {
+  std::vector<char> buffer;
+  json.clear().swap_buffer(buffer);
+
+  auto& buffers = json_response_generator_buffers;
+  if (buffer.capacity() && buffer.capacity() <= pooled_capacity && buffers.size() < pooled_buffers)
+    buffers.push_back(std::move(buffer));
+}
+
+void json_response_generator::reserve(size_t length) {
+  json.reserve(length < pooled_capacity ? length : size_t(pooled_capacity));
+}
+
 string_piece json_response_generator::current() const {
   return json.current();
 }
@@ -17,6 +17,17 @@ namespace microrestd {
 
 class json_response_generator : public response_generator {
  public:
+  // The json buffers are kept when the generators are destroyed and reused by
+  // the generators created later in the same thread, keeping at most
+  // pooled_buffers of them per thread, each with at most pooled_capacity.
+  json_response_generator();
+  virtual ~json_response_generator() override;
+  enum { pooled_buffers = 4, pooled_capacity = 1 << 20 };
+
+  // Reserve the json buffer for the given response length, up to the
+  // pooled_capacity
+  void reserve(size_t length);
+
   virtual string_piece current() const override;
   virtual void consume(size_t length) override;
 
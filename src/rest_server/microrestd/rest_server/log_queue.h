@@ -0,0 +1,87 @@
+// This file is part of MicroRestD <http://github.com/ufal/microrestd/>.
+//
+// Copyright 2015 Institute of Formal and Applied Linguistics, Faculty of
+// Mathematics and Physics, Charles University in Prague, Czech Republic.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+
+namespace ufal {
+namespace microrestd {
+
+// Bounded lock-free queue of log records, which can be pushed to by several
+// threads and popped from by a single thread. Every cell carries a sequence
+// number, which tells whether the cell is free for the push of the given
+// position or filled for its pop, so that neither operation ever blocks.
+class log_queue {
+ public:
+  // The capacity is rounded up to a power of two.
+  inline log_queue(unsigned capacity);
+
+  // Returns false when the queue is full, leaving the record intact.
+  inline bool push(std::string& record);
+  // Returns false when the queue is empty.
+  inline bool pop(std::string& record);
+
+ private:
+  struct cell {
+    std::atomic<size_t> sequence;
+    std::string record;
+  };
+  std::unique_ptr<cell[]> cells;
+  size_t mask;
+
+  std::atomic<size_t> push_position, pop_position;
+};
+
+log_queue::log_queue(unsigned capacity) : push_position(0), pop_position(0) {
+  size_t size = 1;
+  while (size < capacity) size <<= 1;
+
+  cells.reset(new cell[size]);
+  for (size_t i = 0; i < size; i++)
+    cells[i].sequence.store(i, std::memory_order_relaxed);
+  mask = size - 1;
+}
+
+bool log_queue::push(std::string& record) {
+  size_t position = push_position.load(std::memory_order_relaxed);
+  while (true) {
+    cell& cell = cells[position & mask];
+    size_t sequence = cell.sequence.load(std::memory_order_acquire);
+    if (sequence == position) {
+      if (push_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+        cell.record.swap(record);
+        cell.sequence.store(position + 1, std::memory_order_release);
+        return true;
+      }
+    } else if (sequence < position) {
+      // The cell still holds a record a full round behind, so the queue is full
+      return false;
+    } else {
+      position = push_position.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+bool log_queue::pop(std::string& record) {
+  size_t position = pop_position.load(std::memory_order_relaxed);
+  cell& cell = cells[position & mask];
+  if (cell.sequence.load(std::memory_order_acquire) != position + 1) return false;
+
+  record.swap(cell.record);
+  cell.record.clear();
+  pop_position.store(position + 1, std::memory_order_relaxed);
+  cell.sequence.store(position + mask + 1, std::memory_order_release);
+  return true;
+}
+
+} // namespace microrestd
+} // namespace ufal
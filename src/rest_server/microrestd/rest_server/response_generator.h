@@ -9,6 +9,8 @@
 
 #pragma once
 
+#include <string>
+
 #include "string_piece.h"
 
 namespace ufal {
@@ -21,6 +23,10 @@ class response_generator {
   virtual bool generate() = 0;
   virtual string_piece current() const = 0;
   virtual void consume(size_t length) = 0;
+
+  // Append tab separated statistics of generating the response to the log
+  // record written when the request completes (even if it was aborted).
+  virtual void log_statistics(std::string& /*record*/) const {}
 };
 
 } // namespace microrestd
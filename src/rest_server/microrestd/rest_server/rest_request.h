@@ -9,6 +9,7 @@
 
 #pragma once
 
+#include <memory>
 #include <string>
 #include <unordered_map>
 
@@ -18,6 +19,20 @@
 namespace ufal {
 namespace microrestd {
 
+class rest_request;
+
+// Processor of the POST arguments of a request which are still being
+// received, allowing a service to start processing the request early.
+class rest_upload_processor {
+ public:
+  virtual ~rest_upload_processor() {}
+
+  // Called after every received part of the given POST argument, whose value
+  // contains all the parts received so far, the last part_length bytes being
+  // the just received part; a new value starts when they are the whole value.
+  virtual void process(rest_request& req, const std::string& key, const std::string& value, size_t part_length) = 0;
+};
+
 class rest_request {
  public:
   virtual ~rest_request() {}
@@ -27,12 +42,14 @@ class rest_request {
   virtual bool respond_not_found() = 0;
   virtual bool respond_method_not_allowed(const char* comma_separated_allowed_methods) = 0;
   virtual bool respond_error(string_piece error, int code = 400, bool make_copy = true) = 0;
+  virtual bool respond_service_unavailable(string_piece error, unsigned retry_after, bool make_copy = true) = 0;
 
   std::string url;
   std::string method;
   std::string body;
   std::string content_type;
   std::unordered_map<std::string, std::string> params;
+  std::unique_ptr<rest_upload_processor> upload_processor;
 };
 
 } // namespace microrestd
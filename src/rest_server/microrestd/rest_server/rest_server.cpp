@@ -7,11 +7,15 @@
 // License, v. 2.0. If a copy of the MPL was not distributed with this
 // file, You can obtain one at http://mozilla.org/MPL/2.0/.
 
+#include <algorithm>
 #include <chrono>
+#include <cstdlib>
+#include <cstring>
 #include <ctime>
 #include <iomanip>
 #include <iostream>
 #include <memory>
+#include <sstream>
 #include <thread>
 
 #if defined(_WIN32) && !defined(__CYGWIN__)
@@ -22,13 +26,20 @@
 #define MHD_socket_close(fd) closesocket((fd))
 #else
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <netinet/in.h>
 #include <netdb.h>
+#include <fcntl.h>
 #include <signal.h>
 #include <unistd.h>
 #define MHD_socket_close(fd) close((fd))
 #endif
 
+#ifdef MICRORESTD_ZLIB
+#include <zlib.h>
+#endif
+
 #include "response_generator.h"
 #include "rest_server.h"
 #include "../libmicrohttpd/microhttpd.h"
@@ -53,6 +64,24 @@ class MHD_PostProcessorDeleter {
   }
 };
 
+#ifdef MICRORESTD_ZLIB
+class DeflateStreamDeleter {
+ public:
+  void operator()(z_stream* stream) {
+    deflateEnd(stream);
+    delete stream;
+  }
+};
+
+class InflateStreamDeleter {
+ public:
+  void operator()(z_stream* stream) {
+    inflateEnd(stream);
+    delete stream;
+  }
+};
+#endif
+
 // Class rest_server::microhttpd_request
 class rest_server::microhttpd_request : public rest_request {
  public:
@@ -62,15 +91,21 @@ class rest_server::microhttpd_request : public rest_request {
 
   int handle(rest_service* service);
   bool process_request_body(const char* request_body, size_t request_body_len);
+  bool process_decoded_request_body(const char* request_body, size_t request_body_len);
+  bool process_urlencoded(const char* data, size_t data_len);
+  void finish_urlencoded();
 
   const sockaddr* address() const;
   const char* forwarded_for() const;
+  double seconds() const;
+  void log_statistics(string& record) const;
 
   virtual bool respond(const char* content_type, string_piece body, bool make_copy = true) override;
   virtual bool respond(const char* content_type, response_generator* generator) override;
   virtual bool respond_not_found() override;
   virtual bool respond_method_not_allowed(const char* comma_separated_allowed_methods) override;
   virtual bool respond_error(string_piece error, int code = 400, bool make_copy = true) override;
+  virtual bool respond_service_unavailable(string_piece error, unsigned retry_after, bool make_copy = true) override;
 
  private:
   const rest_server& server;
@@ -78,45 +113,104 @@ class rest_server::microhttpd_request : public rest_request {
 
   unique_ptr<MHD_PostProcessor, MHD_PostProcessorDeleter> post_processor;
   bool need_post_processor;
+  bool urlencoded;
   bool unsupported_multipart_encoding;
+  bool unsupported_content_encoding;
   unsigned remaining_request_body_size;
+  size_t expected_request_body_size;
+
+  // State of the urlencoded body, which is decoded in place into the values
+  enum { URLENCODED_KEY, URLENCODED_VALUE, URLENCODED_END } urlencoded_state;
+  string urlencoded_key, urlencoded_incomplete;
+  string* urlencoded_value;
+
+  chrono::steady_clock::time_point received;
 
   unique_ptr<response_generator> generator;
   bool generator_end;
   unsigned generator_offset;
 
-  static MHD_Response* create_response(string_piece data, const char* content_type, bool make_copy);
+#ifdef MICRORESTD_ZLIB
+  unique_ptr<z_stream, InflateStreamDeleter> decompression;
+  bool decompression_end, decompression_invalid;
+
+  unique_ptr<z_stream, DeflateStreamDeleter> compression;
+  bool compression_end;
+
+  int compression_window_bits() const;
+  static bool compress(string_piece data, int level, int window_bits, string& compressed);
+  static bool compression_headers(MHD_Response* response, int window_bits);
+  static ssize_t compressed_generator_callback(microhttpd_request* request, char* buf, size_t max);
+#endif
+
+  static MHD_Response* create_response(string_piece data, const char* content_type, bool make_copy, bool keep_alive);
   static MHD_Response* create_generator_response(microhttpd_request* request, const char* content_type);
   static MHD_Response* create_plain_permanent_response(const string& data);
-  static void response_common_headers(unique_ptr<MHD_Response, MHD_ResponseDeleter>& response, const char* content_type);
+  static void response_common_headers(unique_ptr<MHD_Response, MHD_ResponseDeleter>& response, const char* content_type, bool keep_alive = false);
 
   static int get_iterator(void* cls, MHD_ValueKind kind, const char* key, const char* value);
   static int post_iterator(void* cls, MHD_ValueKind kind, const char* key, const char* filename, const char* content_type, const char* transfer_encoding, const char* data, uint64_t off, size_t size);
   static ssize_t generator_callback(void* cls, uint64_t pos, char* buf, size_t max);
 
   static bool valid_utf8(const string& text);
+  static size_t url_decode(char* text, size_t length, bool final, size_t& incomplete);
+  static size_t parse_content_length(const char* content_length);
 
   static bool http_value_compare(const char* string, const char* pattern);
 
-  static unique_ptr<MHD_Response, MHD_ResponseDeleter> response_not_allowed, response_not_found, response_too_large, response_unsupported_multipart_encoding, response_invalid_utf8;
+  static unique_ptr<MHD_Response, MHD_ResponseDeleter> response_not_allowed, response_not_found, response_too_large, response_unsupported_multipart_encoding, response_unsupported_content_encoding, response_invalid_content_encoding, response_invalid_utf8;
 };
 unique_ptr<MHD_Response, MHD_ResponseDeleter> rest_server::microhttpd_request::response_not_allowed,
                                               rest_server::microhttpd_request::response_not_found,
                                               rest_server::microhttpd_request::response_too_large,
                                               rest_server::microhttpd_request::response_unsupported_multipart_encoding,
+                                              rest_server::microhttpd_request::response_unsupported_content_encoding,
+                                              rest_server::microhttpd_request::response_invalid_content_encoding,
                                               rest_server::microhttpd_request::response_invalid_utf8;
 
 rest_server::microhttpd_request::microhttpd_request(const rest_server& server, MHD_Connection* connection, const char* url, const char* content_type, const char* method)
-  : server(server), connection(connection), unsupported_multipart_encoding(false), remaining_request_body_size(server.max_request_body_size + 1) {
+  : server(server), connection(connection), urlencoded(false), unsupported_multipart_encoding(false), unsupported_content_encoding(false), remaining_request_body_size(server.max_request_body_size + 1),
+    expected_request_body_size(0), urlencoded_state(URLENCODED_KEY), urlencoded_value(nullptr), received(chrono::steady_clock::now()) {
   // Initialize rest_request fields
   this->url = url;
   this->method = method;
   this->content_type = content_type;
 
-  // Create post processor if needed
-  need_post_processor = this->method == MHD_HTTP_METHOD_POST &&
-      (http_value_compare(content_type, MHD_HTTP_POST_ENCODING_FORM_URLENCODED) ||
-       http_value_compare(content_type, MHD_HTTP_POST_ENCODING_MULTIPART_FORMDATA));
+  // A valid Content-Length is used to allocate the body and the POST arguments
+  // at once, so that they are not reallocated when appended to. It is trusted
+  // only up to max_request_body_size, and not without this limit at all.
+  const char* content_length = MHD_lookup_connection_value(connection, MHD_HEADER_KIND, MHD_HTTP_HEADER_CONTENT_LENGTH);
+  if (content_length && server.max_request_body_size &&
+      !MHD_lookup_connection_value(connection, MHD_HEADER_KIND, MHD_HTTP_HEADER_TRANSFER_ENCODING))
+    expected_request_body_size = min(parse_content_length(content_length), size_t(server.max_request_body_size));
+
+  // Decompress the request body if it has a supported Content-Encoding; the
+  // max_request_body_size limit then applies to the decompressed size
+#ifdef MICRORESTD_ZLIB
+  decompression_end = decompression_invalid = false;
+#endif
+  const char* content_encoding = MHD_lookup_connection_value(connection, MHD_HEADER_KIND, MHD_HTTP_HEADER_CONTENT_ENCODING);
+  if (content_encoding && !http_value_compare(content_encoding, "identity")) {
+    unsupported_content_encoding = true;
+#ifdef MICRORESTD_ZLIB
+    if (http_value_compare(content_encoding, "gzip") || http_value_compare(content_encoding, "x-gzip") || http_value_compare(content_encoding, "deflate")) {
+      unsupported_content_encoding = false;
+      // Detect the gzip or zlib header automatically
+      decompression.reset(new z_stream());
+      if (inflateInit2(decompression.get(), 32 + MAX_WBITS) != Z_OK) {
+        delete decompression.release();
+        cerr << "Cannot allocate new request body decompressor!" << endl;
+        decompression_invalid = true;
+      }
+    }
+#endif
+  }
+
+  // Create post processor if needed; the urlencoded body is decoded directly
+  // into the argument values, without copying it through the post processor
+  urlencoded = this->method == MHD_HTTP_METHOD_POST && http_value_compare(content_type, MHD_HTTP_POST_ENCODING_FORM_URLENCODED);
+  need_post_processor = this->method == MHD_HTTP_METHOD_POST && !urlencoded &&
+      http_value_compare(content_type, MHD_HTTP_POST_ENCODING_MULTIPART_FORMDATA);
   if (need_post_processor) {
     post_processor.reset(MHD_create_post_processor(connection, 32 << 10, &post_iterator, this));
     if (!post_processor) cerr << "Cannot allocate new post processor!" << endl;
@@ -124,6 +218,10 @@ rest_server::microhttpd_request::microhttpd_request(const rest_server& server, M
 
   // Collect GET arguments
   MHD_get_connection_values(connection, MHD_GET_ARGUMENT_KIND, get_iterator, this);
+
+  // Let the service process the POST arguments while they are received
+  if ((post_processor || urlencoded) && server.service)
+    upload_processor.reset(server.service->new_upload_processor(*this));
 }
 
 bool rest_server::microhttpd_request::initialize() {
@@ -131,6 +229,8 @@ bool rest_server::microhttpd_request::initialize() {
   static string not_found = "Requested URL was not found.\n";
   static string too_large = "Request was too large.\n";
   static string unsupported_multipart_encoding = "Unsupported transfer-encoding of multipart/form-data POST request part. Currently only 7bit, 8bit or binary is supported.\n";
+  static string unsupported_content_encoding = "Unsupported Content-Encoding of the request body.\n";
+  static string invalid_content_encoding = "The request body is not valid according to its Content-Encoding.\n";
   static string invalid_utf8 = "The request arguments are not valid UTF-8.\n";
 
   response_not_allowed.reset(create_plain_permanent_response(not_allowed));
@@ -146,6 +246,12 @@ bool rest_server::microhttpd_request::initialize() {
   response_unsupported_multipart_encoding.reset(create_plain_permanent_response(unsupported_multipart_encoding));
   if (!response_unsupported_multipart_encoding) return false;
 
+  response_unsupported_content_encoding.reset(create_plain_permanent_response(unsupported_content_encoding));
+  if (!response_unsupported_content_encoding) return false;
+
+  response_invalid_content_encoding.reset(create_plain_permanent_response(invalid_content_encoding));
+  if (!response_invalid_content_encoding) return false;
+
   response_invalid_utf8.reset(create_plain_permanent_response(invalid_utf8));
   if (!response_invalid_utf8) return false;
 
@@ -159,6 +265,15 @@ int rest_server::microhttpd_request::handle(rest_service* service) {
 
   // Close post_processor if exists
   if (post_processor) post_processor.reset();
+  if (urlencoded) finish_urlencoded();
+
+  // Was the Content-Encoding of the request body supported and valid
+  if (unsupported_content_encoding)
+    return MHD_queue_response(connection, MHD_HTTP_UNSUPPORTED_MEDIA_TYPE, response_unsupported_content_encoding.get());
+#ifdef MICRORESTD_ZLIB
+  if (decompression_invalid || (decompression && !decompression_end && !(server.max_request_body_size && !remaining_request_body_size)))
+    return MHD_queue_response(connection, MHD_HTTP_BAD_REQUEST, response_invalid_content_encoding.get());
+#endif
 
   // Was the multipart/form-data transfer-encoding supported
   if (unsupported_multipart_encoding)
@@ -178,11 +293,44 @@ int rest_server::microhttpd_request::handle(rest_service* service) {
 }
 
 bool rest_server::microhttpd_request::process_request_body(const char* request_body, size_t request_body_len) {
+  if (unsupported_content_encoding) return true;
+
+#ifdef MICRORESTD_ZLIB
+  if (decompression_invalid) return true;
+  if (decompression) {
+    // Decompress the body by parts, stopping once it is too large
+    char buffer[16 << 10];
+    decompression->next_in = (Bytef*) request_body;
+    decompression->avail_in = request_body_len;
+    do {
+      if (decompression_end || (server.max_request_body_size && !remaining_request_body_size)) break;
+
+      decompression->next_out = (Bytef*) buffer;
+      decompression->avail_out = sizeof(buffer);
+      int result = inflate(decompression.get(), Z_NO_FLUSH);
+      if (result == Z_STREAM_END) decompression_end = true;
+      else if (result != Z_OK && result != Z_BUF_ERROR) return decompression_invalid = true;
+
+      size_t decompressed = sizeof(buffer) - decompression->avail_out;
+      if (decompressed && !process_decoded_request_body(buffer, decompressed)) return false;
+    } while (decompression->avail_in || !decompression->avail_out);
+    return true;
+  }
+#endif
+
+  return process_decoded_request_body(request_body, request_body_len);
+}
+
+bool rest_server::microhttpd_request::process_decoded_request_body(const char* request_body, size_t request_body_len) {
   if (!server.max_request_body_size || remaining_request_body_size > request_body_len) {
-    if (need_post_processor) {
+    if (urlencoded) {
+      if (!process_urlencoded(request_body, request_body_len))
+        return false;
+    } else if (need_post_processor) {
       if (!post_processor || MHD_post_process(post_processor.get(), request_body, request_body_len) != MHD_YES)
         return false;
     } else {
+      if (body.empty() && expected_request_body_size > request_body_len) body.reserve(expected_request_body_size);
       body.append(request_body, request_body_len);
     }
     if (server.max_request_body_size) remaining_request_body_size -= request_body_len;
@@ -192,17 +340,98 @@ bool rest_server::microhttpd_request::process_request_body(const char* request_b
   return true;
 }
 
+bool rest_server::microhttpd_request::process_urlencoded(const char* data, size_t data_len) {
+  while (data_len) {
+    if (urlencoded_state == URLENCODED_KEY) {
+      // The key extends until '=' and is decoded once complete
+      const char* equals = (const char*) memchr(data, '=', data_len);
+      size_t key_len = equals ? equals - data : data_len;
+      if (urlencoded_key.size() + key_len > (32 << 10)) return false;
+      urlencoded_key.append(data, key_len);
+      if (!equals) return true;
+      data += key_len + 1, data_len -= key_len + 1;
+
+      size_t incomplete;
+      urlencoded_key.resize(url_decode(&urlencoded_key[0], urlencoded_key.size(), true, incomplete));
+      urlencoded_value = &params[urlencoded_key];
+      urlencoded_value->clear();
+      urlencoded_incomplete.clear();
+      urlencoded_state = URLENCODED_VALUE;
+    } else if (urlencoded_state == URLENCODED_VALUE) {
+      // The value extends until '&' or an end of line, and is appended raw
+      // and decoded in place, keeping an incomplete escape at its end pending
+      size_t value_len = 0;
+      while (value_len < data_len && data[value_len] != '&' && data[value_len] != '\r' && data[value_len] != '\n') value_len++;
+      bool value_end = value_len < data_len;
+
+      string& value = *urlencoded_value;
+      size_t start = value.size(), part_len = urlencoded_incomplete.size() + value_len;
+      // Values continuing after this part are usually the large ones, so the
+      // whole request body size is reserved for them (bounding the decoded size)
+      if (!value_end && start + part_len > value.capacity() && expected_request_body_size > start + part_len)
+        value.reserve(expected_request_body_size);
+      value.append(urlencoded_incomplete).append(data, value_len);
+
+      size_t incomplete;
+      size_t decoded = url_decode(&value[start], part_len, value_end, incomplete);
+      urlencoded_incomplete.assign(value, start + part_len - incomplete, incomplete);
+      value.resize(start + decoded);
+      if (decoded && upload_processor) upload_processor->process(*this, urlencoded_key, value, decoded);
+
+      data += value_len, data_len -= value_len;
+      if (value_end) {
+        urlencoded_key.clear();
+        urlencoded_state = *data == '&' ? URLENCODED_KEY : URLENCODED_END;
+        data++, data_len--;
+      }
+    } else /* urlencoded_state == URLENCODED_END */ {
+      // Everything after the end of line finishing the body is ignored
+      return true;
+    }
+  }
+  return true;
+}
+
+void rest_server::microhttpd_request::finish_urlencoded() {
+  // An incomplete escape at the end of the body is kept verbatim
+  if (urlencoded_state == URLENCODED_VALUE && !urlencoded_incomplete.empty()) {
+    urlencoded_value->append(urlencoded_incomplete);
+    if (upload_processor) upload_processor->process(*this, urlencoded_key, *urlencoded_value, urlencoded_incomplete.size());
+    urlencoded_incomplete.clear();
+  }
+  urlencoded_state = URLENCODED_END;
+}
+
 const sockaddr* rest_server::microhttpd_request::address() const {
   auto info = MHD_get_connection_info(connection, MHD_CONNECTION_INFO_CLIENT_ADDRESS);
   return info ? info->client_addr : nullptr;
 }
 
+double rest_server::microhttpd_request::seconds() const {
+  return chrono::duration<double>(chrono::steady_clock::now() - received).count();
+}
+
+void rest_server::microhttpd_request::log_statistics(string& record) const {
+  if (generator) generator->log_statistics(record);
+}
+
 const char* rest_server::microhttpd_request::forwarded_for() const {
   return MHD_lookup_connection_value(connection, MHD_HEADER_KIND, "X-Forwarded-For");
 }
 
 bool rest_server::microhttpd_request::respond(const char* content_type, string_piece body, bool make_copy) {
-  unique_ptr<MHD_Response, MHD_ResponseDeleter> response(create_response(body, content_type, make_copy));
+#ifdef MICRORESTD_ZLIB
+  // Small responses are not worth compressing
+  int window_bits = body.len >= 1024 ? compression_window_bits() : 0;
+  string compressed;
+  if (window_bits && compress(body, server.compression, window_bits, compressed)) {
+    unique_ptr<MHD_Response, MHD_ResponseDeleter> response(create_response(compressed, content_type, true, server.keep_alive));
+    if (!response || !compression_headers(response.get(), window_bits)) return false;
+    return MHD_queue_response(connection, MHD_HTTP_OK, response.get()) == MHD_YES;
+  }
+#endif
+
+  unique_ptr<MHD_Response, MHD_ResponseDeleter> response(create_response(body, content_type, make_copy, server.keep_alive));
   if (!response) return false;
   return MHD_queue_response(connection, MHD_HTTP_OK, response.get()) == MHD_YES;
 }
@@ -211,8 +440,23 @@ bool rest_server::microhttpd_request::respond(const char* content_type, response
   this->generator.reset(generator);
   this->generator_end = false;
   this->generator_offset = 0;
+
+#ifdef MICRORESTD_ZLIB
+  // The generated data are compressed by the generator_callback
+  int window_bits = compression_window_bits();
+  if (window_bits) {
+    compression.reset(new z_stream());
+    if (deflateInit2(compression.get(), server.compression, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+      delete compression.release();
+    compression_end = false;
+  }
+#endif
+
   unique_ptr<MHD_Response, MHD_ResponseDeleter> response(create_generator_response(this, content_type));
   if (!response) return false;
+#ifdef MICRORESTD_ZLIB
+  if (compression && !compression_headers(response.get(), window_bits)) return false;
+#endif
   return MHD_queue_response(connection, MHD_HTTP_OK, response.get()) == MHD_YES;
 }
 
@@ -221,41 +465,49 @@ bool rest_server::microhttpd_request::respond_not_found() {
 }
 
 bool rest_server::microhttpd_request::respond_method_not_allowed(const char* comma_separated_allowed_methods) {
-  unique_ptr<MHD_Response, MHD_ResponseDeleter> response(create_response("Requested method is not allowed.\n", "text/plain", false));
+  unique_ptr<MHD_Response, MHD_ResponseDeleter> response(create_response("Requested method is not allowed.\n", "text/plain", false, server.keep_alive));
   if (!response) return false;
   if (MHD_add_response_header(response.get(), MHD_HTTP_HEADER_ALLOW, comma_separated_allowed_methods) != MHD_YES) return response.reset(), false;
   return MHD_queue_response(connection, MHD_HTTP_METHOD_NOT_ALLOWED, response.get()) == MHD_YES;
 }
 
 bool rest_server::microhttpd_request::respond_error(string_piece error, int code, bool make_copy) {
-  unique_ptr<MHD_Response, MHD_ResponseDeleter> response(create_response(error, "text/plain", make_copy));
+  unique_ptr<MHD_Response, MHD_ResponseDeleter> response(create_response(error, "text/plain", make_copy, server.keep_alive));
   if (!response) return false;
   return MHD_queue_response(connection, code, response.get()) == MHD_YES;
 }
 
+bool rest_server::microhttpd_request::respond_service_unavailable(string_piece error, unsigned retry_after, bool make_copy) {
+  unique_ptr<MHD_Response, MHD_ResponseDeleter> response(create_response(error, "text/plain", make_copy, server.keep_alive));
+  if (!response) return false;
+  if (MHD_add_response_header(response.get(), MHD_HTTP_HEADER_RETRY_AFTER, to_string(retry_after).c_str()) != MHD_YES) return response.reset(), false;
+  return MHD_queue_response(connection, MHD_HTTP_SERVICE_UNAVAILABLE, response.get()) == MHD_YES;
+}
+
 MHD_Response* rest_server::microhttpd_request::create_plain_permanent_response(const string& data) {
   unique_ptr<MHD_Response, MHD_ResponseDeleter> response(MHD_create_response_from_buffer(data.size(), (void*) data.c_str(), MHD_RESPMEM_PERSISTENT));
   response_common_headers(response, "text/plain");
   return response.release();
 }
 
-MHD_Response* rest_server::microhttpd_request::create_response(string_piece data, const char* content_type, bool make_copy) {
+MHD_Response* rest_server::microhttpd_request::create_response(string_piece data, const char* content_type, bool make_copy, bool keep_alive) {
   unique_ptr<MHD_Response, MHD_ResponseDeleter> response(MHD_create_response_from_buffer(data.len, (void*) data.str, make_copy ? MHD_RESPMEM_MUST_COPY : MHD_RESPMEM_PERSISTENT));
-  response_common_headers(response, content_type);
+  response_common_headers(response, content_type, keep_alive);
   return response.release();
 }
 
 MHD_Response* rest_server::microhttpd_request::create_generator_response(microhttpd_request* request, const char* content_type) {
   unique_ptr<MHD_Response, MHD_ResponseDeleter> response(MHD_create_response_from_callback(-1, 32 << 10, generator_callback, request, nullptr));
-  response_common_headers(response, content_type);
+  response_common_headers(response, content_type, request->server.keep_alive);
   return response.release();
 }
 
-void rest_server::microhttpd_request::response_common_headers(unique_ptr<MHD_Response, MHD_ResponseDeleter>& response, const char* content_type) {
+void rest_server::microhttpd_request::response_common_headers(unique_ptr<MHD_Response, MHD_ResponseDeleter>& response, const char* content_type, bool keep_alive) {
   if (!response) return;
+  // Without keep-alive, the connection is closed after every response
   if (MHD_add_response_header(response.get(), MHD_HTTP_HEADER_CONTENT_TYPE, content_type) != MHD_YES ||
       MHD_add_response_header(response.get(), MHD_HTTP_HEADER_ACCESS_CONTROL_ALLOW_ORIGIN, "*") != MHD_YES ||
-      MHD_add_response_header(response.get(), MHD_HTTP_HEADER_CONNECTION, "close") != MHD_YES)
+      (!keep_alive && MHD_add_response_header(response.get(), MHD_HTTP_HEADER_CONNECTION, "close") != MHD_YES))
     response.reset();
 }
 
@@ -279,7 +531,12 @@ int rest_server::microhttpd_request::post_iterator(void* cls, MHD_ValueKind kind
     } else {
       string& value = self->params[key];
       if (!off) value.clear();
+      // Values longer than a single chunk are usually the large ones, so the
+      // whole request body size is reserved for them (bounding the decoded size)
+      if (value.size() && value.size() + size > value.capacity() && self->expected_request_body_size > value.size() + size)
+        value.reserve(self->expected_request_body_size);
       if (size) value.append(data, size);
+      if (size && self->upload_processor) self->upload_processor->process(*self, key, value, size);
     }
   }
 
@@ -288,6 +545,9 @@ int rest_server::microhttpd_request::post_iterator(void* cls, MHD_ValueKind kind
 
 ssize_t rest_server::microhttpd_request::generator_callback(void* cls, uint64_t /*pos*/, char* buf, size_t max) {
   auto request = (microhttpd_request*) cls;
+#ifdef MICRORESTD_ZLIB
+  if (request->compression) return compressed_generator_callback(request, buf, max);
+#endif
   string_piece data = request->generator->current();
   unsigned minimum = request->server.min_generated < max ? request->server.min_generated : max;
   while (data.len - request->generator_offset < minimum && !request->generator_end) {
@@ -309,6 +569,92 @@ ssize_t rest_server::microhttpd_request::generator_callback(void* cls, uint64_t
   return data_len;
 }
 
+#ifdef MICRORESTD_ZLIB
+int rest_server::microhttpd_request::compression_window_bits() const {
+  if (!server.compression) return 0;
+
+  const char* accept_encoding = MHD_lookup_connection_value(connection, MHD_HEADER_KIND, MHD_HTTP_HEADER_ACCEPT_ENCODING);
+  if (!accept_encoding) return 0;
+
+  // Process comma separated codings, each with optional parameters, of which
+  // only a zero quality value is recognized. Gzip is preferred over deflate.
+  bool deflate = false;
+  for (const char* str = accept_encoding; *str; ) {
+    while (*str == ',' || isspace(*str)) str++;
+    const char* coding = str;
+    while (*str && *str != ',' && *str != ';' && !isspace(*str)) str++;
+    size_t coding_len = str - coding;
+
+    bool accepted = true;
+    while (*str && *str != ',')
+      if (*str++ == ';') {
+        while (isspace(*str)) str++;
+        if (tolower(*str) == 'q' && str[1] == '=') accepted = strtod(str + 2, nullptr) > 0;
+      }
+
+    if (!accepted) continue;
+    string coding_name(coding, coding_len);
+    if (http_value_compare(coding_name.c_str(), "gzip")) return 16 + MAX_WBITS;
+    if (http_value_compare(coding_name.c_str(), "deflate")) deflate = true;
+  }
+  return deflate ? MAX_WBITS : 0;
+}
+
+bool rest_server::microhttpd_request::compress(string_piece data, int level, int window_bits, string& compressed) {
+  z_stream stream = z_stream();
+  if (deflateInit2(&stream, level, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK) return false;
+
+  compressed.resize(deflateBound(&stream, data.len));
+  stream.next_in = (Bytef*) data.str;
+  stream.avail_in = data.len;
+  stream.next_out = (Bytef*) &compressed[0];
+  stream.avail_out = compressed.size();
+  bool finished = deflate(&stream, Z_FINISH) == Z_STREAM_END;
+  compressed.resize(compressed.size() - stream.avail_out);
+  deflateEnd(&stream);
+
+  return finished;
+}
+
+bool rest_server::microhttpd_request::compression_headers(MHD_Response* response, int window_bits) {
+  return MHD_add_response_header(response, MHD_HTTP_HEADER_CONTENT_ENCODING, window_bits > MAX_WBITS ? "gzip" : "deflate") == MHD_YES &&
+         MHD_add_response_header(response, MHD_HTTP_HEADER_VARY, MHD_HTTP_HEADER_ACCEPT_ENCODING) == MHD_YES;
+}
+
+ssize_t rest_server::microhttpd_request::compressed_generator_callback(microhttpd_request* request, char* buf, size_t max) {
+  z_stream& stream = *request->compression;
+  stream.next_out = (Bytef*) buf;
+  stream.avail_out = max;
+
+  // Compress at least min_generated bytes of the generated data at a time,
+  // flushing the compressed data after them, so that they are streamed
+  unsigned minimum = request->server.min_generated ? request->server.min_generated : 1;
+  while (stream.avail_out == max) {
+    if (request->compression_end) return MHD_CONTENT_READER_END_OF_STREAM;
+
+    string_piece data = request->generator->current();
+    while (data.len - request->generator_offset < minimum && !request->generator_end) {
+      request->generator_end = !request->generator->generate();
+      data = request->generator->current();
+    }
+
+    stream.next_in = (Bytef*) data.str + request->generator_offset;
+    stream.avail_in = data.len - request->generator_offset;
+    int result = deflate(&stream, request->generator_end ? Z_FINISH : Z_SYNC_FLUSH);
+    if (result == Z_STREAM_ERROR) return MHD_CONTENT_READER_END_WITH_ERROR;
+    if (result == Z_STREAM_END) request->compression_end = true;
+
+    // Remove the compressed data from the generator
+    request->generator_offset = data.len - stream.avail_in;
+    if (data.len - request->generator_offset < minimum) {
+      request->generator->consume(request->generator_offset);
+      request->generator_offset = 0;
+    }
+  }
+  return max - stream.avail_out;
+}
+#endif
+
 bool rest_server::microhttpd_request::valid_utf8(const string& text) {
   for (auto str = (const unsigned char*) text.c_str(); *str; str++)
     if (*str >= 0x80) {
@@ -328,6 +674,45 @@ bool rest_server::microhttpd_request::valid_utf8(const string& text) {
   return true;
 }
 
+size_t rest_server::microhttpd_request::url_decode(char* text, size_t length, bool final, size_t& incomplete) {
+  // Decode the '+' and %HH escapes in place, leaving invalid escapes verbatim;
+  // an incomplete escape at the end of a non-final text is not decoded and its
+  // length is returned in incomplete, its bytes remaining at the text end
+  auto hex = [](char c) { return c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1; };
+
+  char* end = text + length;
+  char* out = text;
+  while (out < end && *out != '+' && *out != '%') out++;
+
+  incomplete = 0;
+  for (char* in = out; in < end; ) {
+    if (*in == '+') {
+      *out++ = ' ', in++;
+    } else if (*in == '%' && end - in < 3 && !final) {
+      incomplete = end - in;
+      break;
+    } else if (*in == '%' && end - in >= 3 && hex(in[1]) >= 0 && hex(in[2]) >= 0) {
+      *out++ = char(hex(in[1]) * 16 + hex(in[2])), in += 3;
+    } else {
+      *out++ = *in++;
+    }
+  }
+  return out - text;
+}
+
+size_t rest_server::microhttpd_request::parse_content_length(const char* content_length) {
+  // Only a plain decimal number is valid, anything else giving zero
+  size_t value = 0;
+  while (*content_length == ' ' || *content_length == '\t') content_length++;
+  if (!*content_length) return 0;
+  for (; *content_length >= '0' && *content_length <= '9'; content_length++) {
+    if (value > (size_t(-1) - 9) / 10) return 0;
+    value = 10 * value + (*content_length - '0');
+  }
+  while (*content_length == ' ' || *content_length == '\t') content_length++;
+  return *content_length ? 0 : value;
+}
+
 bool rest_server::microhttpd_request::http_value_compare(const char* string, const char* pattern) {
   // While there are pattern characters.
   while (*pattern) {
@@ -348,17 +733,72 @@ bool rest_server::microhttpd_request::http_value_compare(const char* string, con
 
 
 // Class rest_server
+rest_server::~rest_server() {
+  async_log_stop();
+}
+
 void rest_server::set_log_file(ostream* log_file, unsigned max_log_size) {
   lock_guard<decltype(log_file_mutex)> log_file_lock(log_file_mutex);
 
   this->log_file = log_file;
   this->max_log_size = max_log_size;
 }
+void rest_server::set_async_log(unsigned queue_capacity) { this->async_log_capacity = queue_capacity; }
+size_t rest_server::dropped_log_records() const { return async_log_dropped.load(); }
 void rest_server::set_min_generated(unsigned min_generated) { this->min_generated = min_generated; }
 void rest_server::set_max_connections(unsigned max_connections) { this->max_connections = max_connections; }
 void rest_server::set_max_request_body_size(unsigned max_request_body_size) { this->max_request_body_size = max_request_body_size; }
 void rest_server::set_threads(unsigned threads) { this->threads = threads; }
 void rest_server::set_timeout(unsigned timeout) { this->timeout = timeout; }
+void rest_server::set_epoll(bool epoll) { this->epoll = epoll; }
+void rest_server::set_keep_alive(bool keep_alive) { this->keep_alive = keep_alive; }
+bool rest_server::set_compression(int level) {
+#ifdef MICRORESTD_ZLIB
+  this->compression = level;
+  return true;
+#else
+  return !level;
+#endif
+}
+
+bool rest_server::set_unix_socket(const string& path) {
+#if defined(_WIN32) && !defined(__CYGWIN__)
+  return path.empty();
+#else
+  this->unix_socket = path;
+  return true;
+#endif
+}
+
+#if !defined(_WIN32) || defined(__CYGWIN__)
+// Open a listening Unix domain socket, replacing a socket file left by
+// a previous process, but not a socket of a running one or other files
+static MHD_socket open_unix_socket(const string& path) {
+  sockaddr_un address;
+  if (path.size() >= sizeof(address.sun_path)) return MHD_INVALID_SOCKET;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  memcpy(address.sun_path, path.c_str(), path.size());
+
+  MHD_socket socket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (socket == MHD_INVALID_SOCKET) return MHD_INVALID_SOCKET;
+
+  struct stat path_stat;
+  if (lstat(path.c_str(), &path_stat) == 0) {
+    if (!S_ISSOCK(path_stat.st_mode) || connect(socket, (sockaddr*) &address, sizeof(address)) == 0)
+      return MHD_socket_close(socket), MHD_INVALID_SOCKET;
+    MHD_socket_close(socket);
+    unlink(path.c_str());
+    socket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (socket == MHD_INVALID_SOCKET) return MHD_INVALID_SOCKET;
+  }
+
+  if (bind(socket, (sockaddr*) &address, sizeof(address)) != 0 || listen(socket, 128) != 0 ||
+      fcntl(socket, F_SETFL, fcntl(socket, F_GETFL) | O_NONBLOCK) != 0)
+    return MHD_socket_close(socket), MHD_INVALID_SOCKET;
+  return socket;
+}
+#endif
 
 bool rest_server::start(rest_service* service, unsigned port) {
   if (!service) return false;
@@ -366,7 +806,21 @@ bool rest_server::start(rest_service* service, unsigned port) {
 
   if (!microhttpd_request::initialize()) return false;
 
-  for (int use_poll = 1; use_poll >= 0; use_poll--) {
+  // The Unix domain socket is created here and passed to microhttpd
+  MHD_socket unix_listening = MHD_INVALID_SOCKET;
+#if !defined(_WIN32) || defined(__CYGWIN__)
+  if (!unix_socket.empty() && (unix_listening = open_unix_socket(unix_socket)) == MHD_INVALID_SOCKET) return false;
+#endif
+
+  if (async_log_capacity && log_file && !async_log_queue) {
+    async_log_queue.reset(new log_queue(async_log_capacity));
+    async_log_stopping = false;
+    async_log_writer = thread(&rest_server::async_log_write, this);
+  }
+
+  // Use epoll if requested, falling back to poll and then to select
+  enum { SELECT, POLL, EPOLL };
+  for (int polling = epoll ? EPOLL : POLL; polling >= SELECT; polling--) {
     MHD_OptionItem threadpool_size[] = {
       { threads ? MHD_OPTION_THREAD_POOL_SIZE : MHD_OPTION_END, int(threads), nullptr },
       { MHD_OPTION_END, 0, nullptr }
@@ -376,8 +830,11 @@ bool rest_server::start(rest_service* service, unsigned port) {
       { MHD_OPTION_END, 0, nullptr }
     };
 
-    daemon = MHD_start_daemon((threads ? MHD_USE_SELECT_INTERNALLY : MHD_USE_THREAD_PER_CONNECTION) | (use_poll ? MHD_USE_POLL : 0) | MHD_USE_PIPE_FOR_SHUTDOWN,
+    auto start_daemon = [&](unsigned port, MHD_socket listening) {
+      return MHD_start_daemon((threads ? MHD_USE_SELECT_INTERNALLY : MHD_USE_THREAD_PER_CONNECTION) | MHD_USE_PIPE_FOR_SHUTDOWN |
+                              (polling == EPOLL ? MHD_USE_EPOLL_LINUX_ONLY : polling == POLL ? MHD_USE_POLL : 0),
                               port, nullptr, nullptr, &handle_request, this,
+                              MHD_OPTION_LISTEN_SOCKET, listening,
                               MHD_OPTION_LISTENING_ADDRESS_REUSE, 1,
                               MHD_OPTION_ARRAY, threadpool_size,
                               MHD_OPTION_ARRAY, connection_limit,
@@ -385,34 +842,56 @@ bool rest_server::start(rest_service* service, unsigned port) {
                               MHD_OPTION_CONNECTION_TIMEOUT, timeout,
                               MHD_OPTION_NOTIFY_COMPLETED, &request_completed, this,
                               MHD_OPTION_END);
+    };
 
-    if (daemon) {
-      log("REST server starting, port ", port, ", max connections ", max_connections, ", timeout ", timeout, ", max request body size ", max_request_body_size, ", min generated ", min_generated, '.');
-      return true;
+    // Listen on the port unless listening only on the Unix domain socket
+    if (port || unix_listening == MHD_INVALID_SOCKET)
+      if (!(daemon = start_daemon(port, MHD_INVALID_SOCKET))) continue;
+    if (unix_listening != MHD_INVALID_SOCKET && !(unix_daemon = start_daemon(0, unix_listening))) {
+      if (daemon) MHD_stop_daemon(daemon), daemon = nullptr;
+      continue;
     }
+
+    log("REST server starting, port ", port, unix_daemon ? ", unix socket " : "", unix_daemon ? unix_socket : string(),
+        ", max connections ", max_connections, ", timeout ", timeout, ", max request body size ", max_request_body_size, ", min generated ", min_generated,
+        ", using ", polling == EPOLL ? "epoll" : polling == POLL ? "poll" : "select", keep_alive ? " with keep-alive" : "", '.');
+    return true;
   }
 
+  if (unix_listening != MHD_INVALID_SOCKET) {
+    MHD_socket_close(unix_listening);
+    unlink(unix_socket.c_str());
+  }
+  async_log_stop();
   return false;
 }
 
 void rest_server::stop() {
-  if (!daemon) return;
+  if (!daemon && !unix_daemon) return;
 
-  // Quiesce the daemon and wait for current requests to be handled.
+  // Quiesce the daemons and wait for current requests to be handled.
   log("REST server closing listening port and waiting for current requests to finish.");
-  MHD_socket socket = MHD_quiesce_daemon(daemon);
-  if (socket != MHD_INVALID_SOCKET) MHD_socket_close(socket);
+  for (auto&& quiesced : {daemon, unix_daemon})
+    if (quiesced) {
+      MHD_socket socket = MHD_quiesce_daemon(quiesced);
+      if (socket != MHD_INVALID_SOCKET) MHD_socket_close(socket);
+    }
+  if (unix_daemon) unlink(unix_socket.c_str());
   while (true) {
-    unsigned connections = *(unsigned*) MHD_get_daemon_info(daemon, MHD_DAEMON_INFO_CURRENT_CONNECTIONS);
+    unsigned connections = 0;
+    for (auto&& running : {daemon, unix_daemon})
+      if (running) connections += *(unsigned*) MHD_get_daemon_info(running, MHD_DAEMON_INFO_CURRENT_CONNECTIONS);
     log("There are ", connections, " current connections.");
     if (!connections) break;
     this_thread::sleep_for(chrono::milliseconds(500));
   }
   log("REST server stopped.");
 
-  MHD_stop_daemon(daemon);
-  daemon = nullptr;
+  if (daemon) MHD_stop_daemon(daemon);
+  if (unix_daemon) MHD_stop_daemon(unix_daemon);
+  daemon = unix_daemon = nullptr;
   service = nullptr;
+  async_log_stop();
   log_file = nullptr;
 }
 
@@ -503,14 +982,40 @@ int rest_server::handle_request(void* cls, struct MHD_Connection* connection, co
   return request->handle(self->service) ? MHD_YES : MHD_NO;
 }
 
-void rest_server::request_completed(void* /*cls*/, struct MHD_Connection* /*connection*/, void** con_cls, int /*toe*/) {
+void rest_server::request_completed(void* cls, struct MHD_Connection* /*connection*/, void** con_cls, int toe) {
+  auto self = (rest_server*) cls;
   auto request = (const microhttpd_request*) *con_cls;
-  if (request) delete request;
+  if (request) {
+    self->log_completed(request, toe != MHD_REQUEST_TERMINATED_COMPLETED_OK);
+    delete request;
+  }
 }
 
 template <typename... Args> void rest_server::log(Args&&... args) {
   if (!log_file) return;
 
+  // In asynchronous mode, only format the record and pass it to the writer
+  if (async_log_queue) {
+    ostringstream os;
+    log_format(os, forward<Args>(args)...);
+    string record = os.str();
+    if (async_log_queue->push(record))
+      async_log_ready.notify_one();
+    else
+      async_log_dropped.fetch_add(1);
+    return;
+  }
+
+  // Locked using the log_file_mutex
+  {
+    lock_guard<decltype(log_file_mutex)> log_file_lock(log_file_mutex);
+
+    log_format(*log_file, forward<Args>(args)...);
+    *log_file << endl;
+  }
+}
+
+template <typename... Args> void rest_server::log_format(ostream& os, Args&&... args) {
   // Prepare timestamp
   char timestamp[32];
   time_t time_now;
@@ -523,20 +1028,14 @@ template <typename... Args> void rest_server::log(Args&&... args) {
 #endif
   size_t len = strftime(timestamp, sizeof(timestamp), "%a %d. %b %Y %H:%M:%S\t", &tm_now);
 
-  // Locked using the log_file_mutex
-  {
-    lock_guard<decltype(log_file_mutex)> log_file_lock(log_file_mutex);
-
-    if (len) *log_file << timestamp;
-    log_append(forward<Args>(args)...);
-    *log_file << endl;
-  }
+  if (len) os << timestamp;
+  log_append(os, forward<Args>(args)...);
 }
 
-void rest_server::log_append() {}
-template <typename Arg, typename... Args> void rest_server::log_append(Arg&& arg, Args&&... args) {
-  *log_file << arg;
-  log_append(forward<Args>(args)...);
+void rest_server::log_append(ostream& /*os*/) {}
+template <typename Arg, typename... Args> void rest_server::log_append(ostream& os, Arg&& arg, Args&&... args) {
+  os << arg;
+  log_append(os, forward<Args>(args)...);
 }
 
 void rest_server::log_append_pair(string& message, const char* key, const string& value) {
@@ -576,14 +1075,18 @@ void rest_server::log_append_pair(string& message, const char* key, const string
     }
 }
 
+void rest_server::log_address(const microhttpd_request* request, char* address, size_t address_size) {
+  auto sock_addr = request->address();
+  *address = '\0';
+  if (sock_addr && sock_addr->sa_family == AF_INET) getnameinfo(sock_addr, sizeof(sockaddr_in), address, address_size, nullptr, 0, NI_NUMERICHOST);
+  if (sock_addr && sock_addr->sa_family == AF_INET6) getnameinfo(sock_addr, sizeof(sockaddr_in6), address, address_size, nullptr, 0, NI_NUMERICHOST);
+}
+
 void rest_server::log_request(const microhttpd_request* request) {
   if (!log_file) return;
 
-  auto sock_addr = request->address();
-  char address[64] = "";
-  if (sock_addr && sock_addr->sa_family == AF_INET) getnameinfo(sock_addr, sizeof(sockaddr_in), address, sizeof(address), nullptr, 0, NI_NUMERICHOST);
-  if (sock_addr && sock_addr->sa_family == AF_INET6) getnameinfo(sock_addr, sizeof(sockaddr_in6), address, sizeof(address), nullptr, 0, NI_NUMERICHOST);
-
+  char address[64];
+  log_address(request, address, sizeof(address));
   auto forwarded_for = request->forwarded_for();
 
   string data;
@@ -596,5 +1099,71 @@ void rest_server::log_request(const microhttpd_request* request) {
   log("Request\t", address, '\t', forwarded_for ? forwarded_for : "", '\t', request->url, '\t', data);
 }
 
+void rest_server::log_completed(const microhttpd_request* request, bool aborted) {
+  if (!log_file) return;
+
+  char address[64];
+  log_address(request, address, sizeof(address));
+  auto forwarded_for = request->forwarded_for();
+
+  // The duration since the request was received, followed by the statistics
+  // of the response generator, if any
+  char seconds[32];
+  snprintf(seconds, sizeof(seconds), "seconds:%.6f", request->seconds());
+  string statistics(seconds);
+  if (aborted) statistics.append("\taborted");
+  request->log_statistics(statistics);
+
+  log("Completed\t", address, '\t', forwarded_for ? forwarded_for : "", '\t', request->url, '\t', statistics);
+}
+
+void rest_server::async_log_write() {
+  string record;
+  size_t reported_dropped = 0;
+
+  while (true) {
+    // The records pushed before the stop was requested are written below
+    bool stopping;
+    {
+      unique_lock<decltype(async_log_mutex)> async_log_lock(async_log_mutex);
+      if (!async_log_stopping) async_log_ready.wait_for(async_log_lock, chrono::milliseconds(100));
+      stopping = async_log_stopping;
+    }
+
+    // Write all queued records, flushing the log once per batch
+    {
+      lock_guard<decltype(log_file_mutex)> log_file_lock(log_file_mutex);
+
+      bool written = false;
+      while (async_log_queue->pop(record))
+        if (log_file) *log_file << record << '\n', written = true;
+
+      size_t dropped = async_log_dropped.load();
+      if (dropped != reported_dropped && log_file) {
+        log_format(*log_file, "Dropped ", dropped - reported_dropped, " log records because the log queue was full.");
+        *log_file << '\n';
+        reported_dropped = dropped;
+        written = true;
+      }
+
+      if (written) log_file->flush();
+    }
+
+    if (stopping) break;
+  }
+}
+
+void rest_server::async_log_stop() {
+  if (!async_log_queue) return;
+
+  {
+    lock_guard<decltype(async_log_mutex)> async_log_lock(async_log_mutex);
+    async_log_stopping = true;
+  }
+  async_log_ready.notify_one();
+  async_log_writer.join();
+  async_log_queue.reset();
+}
+
 } // namespace microrestd
 } // namespace ufal
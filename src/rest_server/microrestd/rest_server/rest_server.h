@@ -9,10 +9,15 @@
 
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
+#include <memory>
 #include <mutex>
 #include <ostream>
 #include <string>
+#include <thread>
 
+#include "log_queue.h"
 #include "rest_request.h"
 #include "rest_service.h"
 
@@ -27,12 +32,32 @@ struct MHD_Connection;
 
 class rest_server {
  public:
+  ~rest_server();
+
   void set_log_file(std::ostream* log_file, unsigned max_log_size = 0);
+  // Write the log in a background thread, passing it the formatted records
+  // through a lock-free queue of the given capacity; records which do not
+  // fit in the queue are dropped and counted. Zero capacity logs synchronously.
+  void set_async_log(unsigned queue_capacity);
+  // Return the number of log records dropped because the queue was full
+  size_t dropped_log_records() const;
   void set_min_generated(unsigned min_generated);
   void set_max_connections(unsigned max_connections);
   void set_max_request_body_size(unsigned max_request_body_size);
   void set_threads(unsigned threads);
   void set_timeout(unsigned timeout);
+  // Use epoll instead of poll, requires Linux and set_threads
+  void set_epoll(bool epoll);
+  // Keep the connections open after a response, allowing further requests
+  void set_keep_alive(bool keep_alive);
+  // Compress the responses using gzip or deflate if the client accepts it,
+  // with the given zlib compression level (0 disables the compression).
+  // Returns false when compiled without zlib (MICRORESTD_ZLIB).
+  bool set_compression(int level);
+  // Listen also on a Unix domain socket with the given path (replacing a
+  // stale socket file), or only on it if the port passed to start is zero.
+  // Returns false on platforms without Unix domain sockets.
+  bool set_unix_socket(const std::string& path);
 
   bool start(rest_service* service, unsigned port);
   void stop();
@@ -45,23 +70,41 @@ class rest_server {
   static void request_completed(void* cls, libmicrohttpd::MHD_Connection* connection, void** con_cls, int toe);
 
   template<typename... Args> void log(Args&&... args);
-  void log_append();
-  template<typename Arg, typename... Args> void log_append(Arg&& arg, Args&&... args);
+  template<typename... Args> static void log_format(std::ostream& os, Args&&... args);
+  static void log_append(std::ostream& os);
+  template<typename Arg, typename... Args> static void log_append(std::ostream& os, Arg&& arg, Args&&... args);
   void log_append_pair(std::string& message, const char* key, const std::string& value);
+  static void log_address(const microhttpd_request* request, char* address, size_t address_size);
   void log_request(const microhttpd_request* request);
+  void log_completed(const microhttpd_request* request, bool aborted);
 
   libmicrohttpd::MHD_Daemon* daemon = nullptr;
+  libmicrohttpd::MHD_Daemon* unix_daemon = nullptr;
   rest_service* service = nullptr;
 
   std::ostream* log_file = nullptr;
   std::mutex log_file_mutex;
   unsigned max_log_size = 0;
 
+  void async_log_write();
+  void async_log_stop();
+  unsigned async_log_capacity = 0;
+  std::unique_ptr<log_queue> async_log_queue;
+  std::thread async_log_writer;
+  std::mutex async_log_mutex;
+  std::condition_variable async_log_ready;
+  bool async_log_stopping = false;
+  std::atomic<size_t> async_log_dropped{0};
+
   unsigned min_generated = 1 << 10;
   unsigned max_connections = 0;
   unsigned max_request_body_size = 0;
   unsigned threads = 0;
   unsigned timeout = 0;
+  bool epoll = false;
+  bool keep_alive = false;
+  int compression = 0;
+  std::string unix_socket;
 };
 
 } // namespace microrestd
@@ -19,6 +19,12 @@ namespace microrestd {
 class rest_service {
  public:
   virtual bool handle(rest_request& req) = 0;
+
+  // Optionally return a processor of the POST arguments of the request while
+  // they are received, called when the request has form encoded body, before
+  // receiving it (only the GET arguments are available in req.params then).
+  // The processor is stored in req.upload_processor.
+  virtual rest_upload_processor* new_upload_processor(rest_request& /*req*/) { return nullptr; }
 };
 
 } // namespace microrestd
@@ -0,0 +1,231 @@
+// This file is part of NameTag <http://github.com/ufal/nametag/>.
+//
+// Copyright 2016 Institute of Formal and Applied Linguistics, Faculty of
+// Mathematics and Physics, Charles University in Prague, Czech Republic.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#include <cerrno>
+#include <cstring>
+
+#include "nametag_binary_server.h"
+
+#ifdef __linux__
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace ufal {
+namespace nametag {
+
+#ifdef __linux__
+
+static inline void store_uint32(char* data, size_t value) {
+  for (int i = 0; i < 4; i++)
+    data[i] = char((value >> (24 - 8 * i)) & 0xFF);
+}
+
+static inline void append_uint8(string& str, unsigned value) {
+  str.push_back(char(value & 0xFF));
+}
+
+static inline void append_uint32(string& str, size_t value) {
+  str.resize(str.size() + 4);
+  store_uint32(&str[str.size() - 4], value);
+}
+
+static inline uint32_t parse_uint32(const char* data) {
+  const unsigned char* bytes = (const unsigned char*) data;
+  return (uint32_t(bytes[0]) << 24) | (uint32_t(bytes[1]) << 16) | (uint32_t(bytes[2]) << 8) | uint32_t(bytes[3]);
+}
+
+// Read or write exactly the given number of bytes, failing on errors,
+// timeouts and closed connections
+static bool receive_fully(int connection, char* data, size_t length) {
+  while (length) {
+    ssize_t received = recv(connection, data, length, 0);
+    if (received < 0 && errno == EINTR) continue;
+    if (received <= 0) return false;
+    data += received;
+    length -= received;
+  }
+  return true;
+}
+
+static bool send_fully(int connection, const char* data, size_t length) {
+  while (length) {
+    ssize_t sent = send(connection, data, length, MSG_NOSIGNAL);
+    if (sent < 0 && errno == EINTR) continue;
+    if (sent <= 0) return false;
+    data += sent;
+    length -= sent;
+  }
+  return true;
+}
+
+bool nametag_binary_server::start(nametag_service* service, int port, unsigned max_connections, size_t max_frame_size, unsigned timeout) {
+  stop();
+
+  this->service = service;
+  this->max_connections = max_connections;
+  this->max_frame_size = max_frame_size;
+  this->timeout = timeout;
+
+  // Listen on both IPv6 and IPv4 if possible, on IPv4 only otherwise, allowing
+  // the worker processes of nametag_server to listen on the same port
+  int one = 1, zero = 0;
+  listening = socket(AF_INET6, SOCK_STREAM, 0);
+  if (listening >= 0) {
+    sockaddr_in6 address;
+    memset(&address, 0, sizeof(address));
+    address.sin6_family = AF_INET6;
+    address.sin6_addr = in6addr_any;
+    address.sin6_port = htons(port);
+    if (setsockopt(listening, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0 ||
+        setsockopt(listening, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) != 0 ||
+        setsockopt(listening, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero)) != 0 ||
+        bind(listening, (sockaddr*) &address, sizeof(address)) != 0)
+      close(listening), listening = -1;
+  }
+  if (listening < 0) {
+    listening = socket(AF_INET, SOCK_STREAM, 0);
+    if (listening < 0) return false;
+
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+    if (setsockopt(listening, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0 ||
+        setsockopt(listening, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) != 0 ||
+        bind(listening, (sockaddr*) &address, sizeof(address)) != 0)
+      return close(listening), listening = -1, false;
+  }
+  if (listen(listening, SOMAXCONN) != 0)
+    return close(listening), listening = -1, false;
+
+  acceptor = thread(&nametag_binary_server::accept_connections, this);
+  return true;
+}
+
+void nametag_binary_server::stop() {
+  if (listening < 0) return;
+
+  // Shutting down the sockets wakes up the threads blocked on them
+  shutdown(listening, SHUT_RDWR);
+  acceptor.join();
+  close(listening);
+  listening = -1;
+
+  unique_lock<mutex> lock(connections_mutex);
+  for (auto&& connection : connections)
+    shutdown(connection, SHUT_RDWR);
+  connections_finished.wait(lock, [this]{ return connections.empty(); });
+}
+
+void nametag_binary_server::accept_connections() {
+  while (true) {
+    int connection = accept(listening, nullptr, nullptr);
+    if (connection < 0) {
+      if (errno == EINTR || errno == ECONNABORTED || errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) continue;
+      break;
+    }
+
+    int one = 1;
+    setsockopt(connection, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (timeout) {
+      timeval timeval = {time_t(timeout), 0};
+      setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeval, sizeof(timeval));
+      setsockopt(connection, SOL_SOCKET, SO_SNDTIMEO, &timeval, sizeof(timeval));
+    }
+
+    {
+      lock_guard<mutex> lock(connections_mutex);
+      if (!max_connections || connections.size() < max_connections) {
+        try {
+          thread(&nametag_binary_server::handle_connection, this, connection).detach();
+          connections.insert(connection);
+          continue;
+        } catch (system_error&) {}
+      }
+    }
+
+    string response;
+    append_response(response, UNAVAILABLE, "Too many connections are open, retry later.\n");
+    send_fully(connection, response.data(), response.size());
+    close(connection);
+  }
+}
+
+void nametag_binary_server::handle_connection(int connection) {
+  string request, response, model_name, error;
+  vector<named_entity> entities;
+
+  for (char header[4]; receive_fully(connection, header, sizeof(header)); ) {
+    size_t length = parse_uint32(header);
+    if (length > max_frame_size) {
+      response.clear();
+      append_response(response, FAILED, "The request frame is larger than the maximum request size.\n");
+      send_fully(connection, response.data(), response.size());
+      break;
+    }
+
+    request.resize(length);
+    if (!receive_fully(connection, &request[0], length)) break;
+
+    response.clear();
+    bool unavailable = false;
+    if (length < 2 || length < 2 + size_t((unsigned char) request[1])) {
+      append_response(response, FAILED, "The request frame is malformed.\n");
+    } else {
+      bool vertical = request[0] & 1;
+      model_name.assign(request, 2, (unsigned char) request[1]);
+      string_piece text(request.data() + 2 + model_name.size(), length - 2 - model_name.size());
+
+      if (service->recognize_text(model_name, text, vertical, entities, error, unavailable)) {
+        response.resize(4);
+        append_uint8(response, RECOGNIZED);
+        append_uint32(response, entities.size());
+        for (auto&& entity : entities) {
+          size_t type_length = min(entity.type.size(), size_t(255));
+          append_uint32(response, entity.start);
+          append_uint32(response, entity.length);
+          append_uint8(response, type_length);
+          response.append(entity.type, 0, type_length);
+        }
+        store_uint32(&response[0], response.size() - 4);
+      } else {
+        append_response(response, unavailable ? UNAVAILABLE : FAILED, error);
+      }
+    }
+    if (!send_fully(connection, response.data(), response.size())) break;
+  }
+
+  lock_guard<mutex> lock(connections_mutex);
+  connections.erase(connection);
+  close(connection);
+  connections_finished.notify_all();
+}
+
+void nametag_binary_server::append_response(string& response, status_t status, const string& message) {
+  append_uint32(response, 1 + message.size());
+  append_uint8(response, status);
+  response.append(message);
+}
+
+#else
+
+bool nametag_binary_server::start(nametag_service* /*service*/, int /*port*/, unsigned /*max_connections*/, size_t /*max_frame_size*/, unsigned /*timeout*/) {
+  return false;
+}
+
+void nametag_binary_server::stop() {}
+
+#endif
+
+} // namespace nametag
+} // namespace ufal
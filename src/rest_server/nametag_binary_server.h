@@ -0,0 +1,76 @@
+// This file is part of NameTag <http://github.com/ufal/nametag/>.
+//
+// Copyright 2016 Institute of Formal and Applied Linguistics, Faculty of
+// Mathematics and Physics, Charles University in Prague, Czech Republic.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+
+#include "common.h"
+#include "nametag_service.h"
+
+namespace ufal {
+namespace nametag {
+
+// Server of a length-prefixed binary protocol over persistent TCP
+// connections, which recognizes the texts using the nametag_service::
+// recognize_text, sharing the models and workers with the REST service.
+// Every connection is handled by a separate thread, which processes the
+// requests of the connection in order.
+//
+// All integers are unsigned and in network byte order. A request frame
+// consists of
+//   uint32 length of the rest of the frame,
+//   uint8 flags (bit 0 set if the text is in vertical format),
+//   uint8 length of the model name and the model name (empty for the default
+//     model),
+//   the UTF-8 encoded text, up to the end of the frame.
+// The response frame consists of
+//   uint32 length of the rest of the frame,
+//   uint8 status (RECOGNIZED, FAILED or UNAVAILABLE),
+//   if RECOGNIZED, uint32 number of entities and for every entity uint32
+//     start and uint32 length in bytes of the text, uint8 length of the type
+//     and the type,
+//   otherwise the error message, up to the end of the frame.
+class nametag_binary_server {
+ public:
+  enum status_t { RECOGNIZED = 0, FAILED = 1, UNAVAILABLE = 2 };
+
+  ~nametag_binary_server() { stop(); }
+
+  // Start listening on the given port, handling at most max_connections
+  // connections (others get an UNAVAILABLE response and are closed), closing
+  // the connections after a request frame larger than max_frame_size bytes
+  // or after timeout seconds of inactivity. Supported on Linux only.
+  bool start(nametag_service* service, int port, unsigned max_connections, size_t max_frame_size, unsigned timeout);
+
+  // Stop listening, close the connections and wait until their threads finish
+  void stop();
+
+ private:
+  void accept_connections();
+  void handle_connection(int connection);
+  static void append_response(string& response, status_t status, const string& message);
+
+  nametag_service* service = nullptr;
+  unsigned max_connections = 0;
+  size_t max_frame_size = 0;
+  unsigned timeout = 0;
+
+  int listening = -1;
+  thread acceptor;
+  mutex connections_mutex;
+  condition_variable connections_finished;
+  unordered_set<int> connections;
+};
+
+} // namespace nametag
+} // namespace ufal
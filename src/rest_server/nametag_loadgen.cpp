@@ -0,0 +1,446 @@
+// This file is part of NameTag <http://github.com/ufal/nametag/>.
+//
+// Copyright 2016 Institute of Formal and Applied Linguistics, Faculty of
+// Mathematics and Physics, Charles University in Prague, Czech Republic.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <thread>
+
+#include "common.h"
+#include "utils/iostreams.h"
+#include "utils/options.h"
+#include "utils/paragraph_reader.h"
+#include "utils/parse_double.h"
+#include "utils/parse_int.h"
+#include "utils/split.h"
+#include "version/version.h"
+
+#if !defined(_WIN32) || defined(__CYGWIN__)
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#define NAMETAG_LOADGEN_SOCKETS
+#endif
+
+using namespace ufal::nametag;
+
+// Result of a single request; the status is -1 if no response was received
+struct request_result {
+  int status;
+  double seconds;
+  size_t request_bytes, response_bytes;
+};
+
+#ifdef NAMETAG_LOADGEN_SOCKETS
+
+// A connection to the server sending one request at a time and receiving the
+// whole response, which is either chunked, has a Content-Length or ends when
+// the connection is closed. The connection is reopened when needed.
+class http_connection {
+ public:
+  http_connection(const addrinfo* address, double timeout) : address(address), timeout(timeout) {}
+  ~http_connection() { close(); }
+
+  // Send the request and return the response status, or -1 on failure
+  int request(const string& request, size_t& response_bytes);
+
+ private:
+  bool open();
+  void close();
+  bool send_fully(const char* data, size_t length);
+  bool fill(size_t length);
+  bool receive_response(int& status, size_t& response_bytes, bool& keep_alive);
+  static bool header_equals(const string& headers, const char* name, const char* value);
+  static bool header_value(const string& headers, const char* name, string& value);
+
+  const addrinfo* address;
+  double timeout;
+  int fd = -1;
+  string buffer;
+};
+
+int http_connection::request(const string& request, size_t& response_bytes) {
+  // A reused connection may have been closed by the server, in which case
+  // the request is retried once using a new connection
+  for (bool reused = fd >= 0; ; reused = false) {
+    if (fd < 0 && !open()) return -1;
+
+    int status;
+    bool keep_alive;
+    buffer.clear();
+    if (send_fully(request.data(), request.size()) && receive_response(status, response_bytes, keep_alive)) {
+      if (!keep_alive) close();
+      return status;
+    }
+    close();
+    if (!reused) return -1;
+  }
+}
+
+bool http_connection::open() {
+  fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+  if (fd < 0) return false;
+
+  if (timeout > 0) {
+    timeval tv;
+    tv.tv_sec = long(timeout);
+    tv.tv_usec = long((timeout - tv.tv_sec) * 1e6);
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+  }
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+  if (connect(fd, address->ai_addr, address->ai_addrlen) < 0) return close(), false;
+  return true;
+}
+
+void http_connection::close() {
+  if (fd >= 0) ::close(fd);
+  fd = -1;
+}
+
+bool http_connection::send_fully(const char* data, size_t length) {
+  while (length) {
+    ssize_t sent = send(fd, data, length, 0);
+    if (sent < 0 && errno == EINTR) continue;
+    if (sent <= 0) return false;
+    data += sent;
+    length -= sent;
+  }
+  return true;
+}
+
+bool http_connection::fill(size_t length) {
+  // Receive until the buffer contains at least the given number of bytes
+  char chunk[64 << 10];
+  while (buffer.size() < length) {
+    ssize_t received = recv(fd, chunk, sizeof(chunk), 0);
+    if (received < 0 && errno == EINTR) continue;
+    if (received <= 0) return false;
+    buffer.append(chunk, received);
+  }
+  return true;
+}
+
+bool http_connection::receive_response(int& status, size_t& response_bytes, bool& keep_alive) {
+  size_t headers_end;
+  while ((headers_end = buffer.find("\r\n\r\n")) == string::npos)
+    if (!fill(buffer.size() + 1)) return false;
+
+  string headers = buffer.substr(0, headers_end + 2);
+  if (headers.compare(0, 5, "HTTP/") || headers.size() < 12) return false;
+  status = atoi(headers.c_str() + headers.find(' ') + 1);
+  keep_alive = !header_equals(headers, "Connection", "close") &&
+      (headers.compare(0, 8, "HTTP/1.0") || header_equals(headers, "Connection", "keep-alive"));
+
+  size_t position = headers_end + 4;
+  string value;
+  response_bytes = 0;
+  if (header_equals(headers, "Transfer-Encoding", "chunked")) {
+    // Every chunk is preceded by its hexadecimal size, the last one being empty
+    while (true) {
+      size_t line_end;
+      while ((line_end = buffer.find("\r\n", position)) == string::npos)
+        if (!fill(buffer.size() + 1)) return false;
+      size_t chunk_size = strtoull(buffer.c_str() + position, nullptr, 16);
+      position = line_end + 2;
+      if (!chunk_size) break;
+      if (!fill(position + chunk_size + 2)) return false;
+      response_bytes += chunk_size;
+      position += chunk_size + 2;
+      // Keep the buffer small for large responses
+      buffer.erase(0, position);
+      position = 0;
+    }
+    // Skip the trailers ending by an empty line
+    while (true) {
+      size_t line_end;
+      while ((line_end = buffer.find("\r\n", position)) == string::npos)
+        if (!fill(buffer.size() + 1)) return false;
+      if (line_end == position) break;
+      position = line_end + 2;
+    }
+  } else if (header_value(headers, "Content-Length", value)) {
+    size_t length = strtoull(value.c_str(), nullptr, 10);
+    if (!fill(position + length)) return false;
+    response_bytes = length;
+  } else {
+    // The response ends when the server closes the connection
+    while (fill(buffer.size() + 1)) {}
+    response_bytes = buffer.size() - position;
+    keep_alive = false;
+  }
+  return true;
+}
+
+bool http_connection::header_value(const string& headers, const char* name, string& value) {
+  size_t name_len = strlen(name);
+  for (size_t line = headers.find("\r\n") + 2, line_end; (line_end = headers.find("\r\n", line)) != string::npos; line = line_end + 2)
+    if (line_end - line > name_len && headers[line + name_len] == ':' && strncasecmp(headers.c_str() + line, name, name_len) == 0) {
+      size_t start = line + name_len + 1, end = line_end;
+      while (start < end && (headers[start] == ' ' || headers[start] == '\t')) start++;
+      while (end > start && (headers[end - 1] == ' ' || headers[end - 1] == '\t')) end--;
+      value.assign(headers, start, end - start);
+      return true;
+    }
+  return false;
+}
+
+bool http_connection::header_equals(const string& headers, const char* name, const char* value) {
+  string header;
+  return header_value(headers, name, header) && strcasecmp(header.c_str(), value) == 0;
+}
+
+#endif
+
+// Percent-encode the given text as a value of a form encoded body
+static void append_urlencoded(string& body, string_piece text) {
+  static const char hex[] = "0123456789ABCDEF";
+  for (size_t i = 0; i < text.len; i++) {
+    unsigned char chr = text.str[i];
+    if ((chr >= 'a' && chr <= 'z') || (chr >= 'A' && chr <= 'Z') || (chr >= '0' && chr <= '9') || chr == '-' || chr == '.' || chr == '_' || chr == '~') {
+      body.push_back(chr);
+    } else if (chr == ' ') {
+      body.push_back('+');
+    } else {
+      body.push_back('%');
+      body.push_back(hex[chr >> 4]);
+      body.push_back(hex[chr & 15]);
+    }
+  }
+}
+
+static void run_load(const vector<string>& requests, const void* address, double timeout, unsigned concurrency, double qps,
+                     double duration, size_t max_requests, double& seconds, vector<request_result>& results);
+
+int main(int argc, char* argv[]) {
+  iostreams_init();
+
+  options::map options;
+  if (!options::parse({{"args", options::value::any},
+                       {"concurrency", options::value::any},
+                       {"duration", options::value::any},
+                       {"method", options::value::any},
+                       {"model", options::value::any},
+                       {"no_keep_alive", options::value::none},
+                       {"paragraphs", options::value::any},
+                       {"qps", options::value::any},
+                       {"requests", options::value::any},
+                       {"timeout", options::value::any},
+                       {"version", options::value::none},
+                       {"help", options::value::none}}, argc, argv, options) ||
+      options.count("help") ||
+      (argc < 3 && !options.count("version")))
+    runtime_failure("Usage: " << argv[0] << " [options] [host:]port corpus_file...\n"
+                    "Options: --args=additional form encoded arguments of the requests\n"
+                    "         --concurrency=comma separated numbers of connections (default 1)\n"
+                    "         --duration=seconds of every run (default 10)\n"
+                    "         --method=recognize|tokenize (default recognize)\n"
+                    "         --model=model of the requests (default the server default)\n"
+                    "         --no_keep_alive (use a new connection for every request)\n"
+                    "         --paragraphs=paragraphs of the corpora sent in every request (default 1)\n"
+                    "         --qps=comma separated target requests per second (default as fast as possible)\n"
+                    "         --requests=maximum number of requests of every run\n"
+                    "         --timeout=seconds before an unanswered request fails (default 60)\n"
+                    "         --version\n"
+                    "         --help");
+  if (options.count("version"))
+    return cout << version::version_and_copyright() << endl, 0;
+
+  string method = options.count("method") ? options["method"] : "recognize";
+  if (method != "recognize" && method != "tokenize") runtime_failure("Unknown method '" << method << "', only recognize and tokenize are supported!");
+  int paragraphs = options.count("paragraphs") ? parse_int(options["paragraphs"], "paragraphs per request") : 1;
+  if (paragraphs < 1) runtime_failure("The number of paragraphs per request must be positive!");
+  double duration = options.count("duration") ? parse_double(options["duration"], "duration") : 10;
+  if (duration <= 0) runtime_failure("The duration must be positive!");
+  int max_requests = options.count("requests") ? parse_int(options["requests"], "maximum number of requests") : 0;
+  if (max_requests < 0) runtime_failure("The maximum number of requests must be positive!");
+  double timeout = options.count("timeout") ? parse_double(options["timeout"], "timeout") : 60;
+  if (timeout < 0) runtime_failure("The timeout must not be negative!");
+
+  // Every run is performed for every concurrency and target rate
+  vector<unsigned> concurrencies;
+  vector<string> values;
+  split(options.count("concurrency") ? options["concurrency"] : "1", ',', values);
+  for (auto&& value : values) {
+    int concurrency = parse_int(value, "concurrency");
+    if (concurrency < 1) runtime_failure("The concurrency must be positive!");
+    concurrencies.push_back(concurrency);
+  }
+  vector<double> rates{0};
+  if (options.count("qps")) {
+    rates.clear();
+    split(options["qps"], ',', values);
+    for (auto&& value : values) {
+      rates.push_back(parse_double(value, "target requests per second"));
+      if (rates.back() <= 0) runtime_failure("The target requests per second must be positive!");
+    }
+  }
+
+  // The server address is host:port, or only a port of the local host
+  string host = "localhost", port = argv[1];
+  if (port.find(':') != string::npos) {
+    host = port.substr(0, port.rfind(':'));
+    port = port.substr(port.rfind(':') + 1);
+    if (host.size() > 2 && host.front() == '[' && host.back() == ']') host = host.substr(1, host.size() - 2);
+  }
+
+  // The paragraphs of the corpora are sent in order, cyclically
+  vector<string> requests;
+  string args = options.count("args") ? options["args"] : string();
+  if (options.count("model")) {
+    string model("model=");
+    append_urlencoded(model, options["model"]);
+    args = args.empty() ? model : model + "&" + args;
+  }
+  string body;
+  int body_paragraphs = 0;
+  auto add_request = [&] {
+    string request = "POST /" + method + " HTTP/1.1\r\nHost: " + host + ":" + port + "\r\n"
+        "Content-Type: application/x-www-form-urlencoded\r\nContent-Length: " + to_string(body.size()) + "\r\n" +
+        (options.count("no_keep_alive") ? "Connection: close\r\n" : "") + "\r\n";
+    requests.push_back(request + body);
+    body.clear();
+    body_paragraphs = 0;
+  };
+  for (int argi = 2; argi < argc; argi++) {
+    ifstream is(argv[argi]);
+    if (!is) runtime_failure("Cannot open file '" << argv[argi] << "' for reading!");
+
+    paragraph_reader reader(is);
+    string_piece para;
+    while (reader.next(para)) {
+      if (!body_paragraphs) body.assign(args).append(args.empty() ? "data=" : "&data=");
+      append_urlencoded(body, para);
+      if (++body_paragraphs == paragraphs) add_request();
+    }
+  }
+  if (body_paragraphs) add_request();
+  if (requests.empty()) runtime_failure("The given corpora contain no paragraphs!");
+  cerr << "Loaded " << requests.size() << " requests." << endl;
+
+#ifdef NAMETAG_LOADGEN_SOCKETS
+  signal(SIGPIPE, SIG_IGN);
+
+  addrinfo hints, *addresses;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses) != 0 || !addresses)
+    runtime_failure("Cannot resolve the server address '" << argv[1] << "'!");
+#else
+  runtime_failure("The nametag_loadgen is not supported on this platform!");
+  const void* addresses = nullptr;
+#endif
+
+  // Every run is printed as a separate JSON object on its own line
+  string output;
+  vector<request_result> results;
+  for (auto&& concurrency : concurrencies)
+    for (auto&& qps : rates) {
+      double seconds;
+      run_load(requests, addresses, timeout, concurrency, qps, duration, max_requests, seconds, results);
+
+      size_t ok = 0, rejected = 0, failed = 0, request_bytes = 0, response_bytes = 0;
+      double total_latency = 0;
+      vector<double> latencies;
+      for (auto&& result : results) {
+        if (result.status == 200) ok++;
+        else if (result.status == 503) rejected++;
+        else if (result.status < 0) failed++;
+        request_bytes += result.request_bytes;
+        response_bytes += result.response_bytes;
+        latencies.push_back(result.seconds);
+        total_latency += result.seconds;
+      }
+      sort(latencies.begin(), latencies.end());
+      auto percentile = [&](unsigned p) { return latencies.empty() ? 0. : latencies[min(latencies.size() - 1, latencies.size() * p / 1000)] * 1000; };
+
+      output.assign("{\"method\": \"").append(method);
+      output.append("\", \"concurrency\": ").append(to_string(concurrency));
+      output.append(", \"target_qps\": ").append(qps ? to_string(qps) : "null");
+      output.append(", \"seconds\": ").append(to_string(seconds));
+      output.append(", \"requests\": ").append(to_string(results.size()));
+      output.append(", \"requests_per_second\": ").append(to_string(results.size() / seconds));
+      output.append(", \"ok_per_second\": ").append(to_string(ok / seconds));
+      output.append(", \"request_bytes_per_second\": ").append(to_string(request_bytes / seconds));
+      output.append(", \"response_bytes_per_second\": ").append(to_string(response_bytes / seconds));
+      output.append(", \"rejected\": ").append(to_string(rejected));
+      output.append(", \"failed\": ").append(to_string(failed));
+      output.append(", \"errors\": ").append(to_string(results.size() - ok - rejected - failed));
+      output.append(", \"error_rate\": ").append(to_string(results.empty() ? 0. : double(results.size() - ok) / results.size()));
+      output.append(", \"latency_ms\": {\"mean\": ").append(to_string(latencies.empty() ? 0. : total_latency / latencies.size() * 1000));
+      output.append(", \"p50\": ").append(to_string(percentile(500)));
+      output.append(", \"p90\": ").append(to_string(percentile(900)));
+      output.append(", \"p99\": ").append(to_string(percentile(990)));
+      output.append(", \"p999\": ").append(to_string(percentile(999)));
+      output.append(", \"max\": ").append(to_string(latencies.empty() ? 0. : latencies.back() * 1000)).append("}}\n");
+      cout << output << flush;
+    }
+
+#ifdef NAMETAG_LOADGEN_SOCKETS
+  freeaddrinfo(addresses);
+#endif
+  return 0;
+}
+
+void run_load(const vector<string>& requests, const void* address, double timeout, unsigned concurrency, double qps,
+              double duration, size_t max_requests, double& seconds, vector<request_result>& results) {
+  results.clear();
+
+#ifdef NAMETAG_LOADGEN_SOCKETS
+  // With a target rate, the i-th request is scheduled i/qps seconds after the
+  // start and its latency is measured from the scheduled time, so that the
+  // requests delayed by slow responses are not omitted from the latencies.
+  // Otherwise every connection sends the next request once it has a response.
+  atomic<size_t> next_request(0);
+  vector<vector<request_result>> connection_results(concurrency);
+  auto start = chrono::steady_clock::now();
+  auto end = start + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(duration));
+
+  vector<thread> threads;
+  for (unsigned c = 0; c < concurrency; c++)
+    threads.emplace_back([&, c] {
+      http_connection connection((const addrinfo*) address, timeout);
+      while (true) {
+        size_t index = next_request.fetch_add(1);
+        if (max_requests && index >= max_requests) break;
+
+        auto scheduled = qps ? start + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(index / qps)) : chrono::steady_clock::now();
+        if (scheduled >= end) break;
+        if (qps) this_thread::sleep_until(scheduled);
+
+        const string& request = requests[index % requests.size()];
+        request_result result;
+        result.request_bytes = request.size();
+        result.status = connection.request(request, result.response_bytes);
+        if (result.status < 0) result.response_bytes = 0;
+        result.seconds = chrono::duration<double>(chrono::steady_clock::now() - scheduled).count();
+        connection_results[c].push_back(result);
+      }
+    });
+  for (auto&& thread : threads)
+    thread.join();
+  seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+  for (auto&& connection : connection_results)
+    results.insert(results.end(), connection.begin(), connection.end());
+#else
+  (void) requests, (void) address, (void) timeout, (void) concurrency, (void) qps, (void) duration, (void) max_requests;
+  seconds = 0;
+#endif
+}
@@ -7,23 +7,35 @@
 // License, v. 2.0. If a copy of the MPL was not distributed with this
 // file, You can obtain one at http://mozilla.org/MPL/2.0/.
 
+#include <chrono>
 #include <fstream>
+#include <iomanip>
 #include <sstream>
 
 #include "common.h"
+#include "nametag_binary_server.h"
 #include "nametag_service.h"
 #include "utils/iostreams.h"
 #include "utils/options.h"
+#include "utils/parse_double.h"
 #include "utils/parse_int.h"
+#include "utils/split.h"
 #include "version/version.h"
 
 using namespace ufal::nametag;
 
 // On Linux define streambuf writing to syslog
 #ifdef __linux__
+#include <cerrno>
+#include <csignal>
+#include <sched.h>
 #include <streambuf>
+#include <sys/wait.h>
 #include <syslog.h>
+#include <thread>
 #include <unistd.h>
+#include <unordered_map>
+#include <unordered_set>
 
 class syslog_streambuf : public streambuf {
  public:
@@ -53,32 +65,239 @@ class syslog_streambuf : public streambuf {
 #endif
 
 microrestd::rest_server server;
+nametag_binary_server binary_server;
 nametag_service service;
 
+#ifdef __linux__
+// Parse a sysfs list of ranges like 0-3,8,10-11
+static vector<unsigned> parse_sysfs_list(const string& list) {
+  vector<unsigned> values;
+  vector<string> ranges, bounds;
+  split(list, ',', ranges);
+  for (auto&& range : ranges) {
+    if (range.empty()) continue;
+    split(range, '-', bounds);
+    int first = parse_int(bounds.front(), "sysfs range start"), last = parse_int(bounds.back(), "sysfs range end");
+    for (int value = first; value >= 0 && value <= last; value++)
+      values.push_back(value);
+  }
+  return values;
+}
+
+// Return the CPUs of the online NUMA nodes which have any
+static vector<vector<unsigned>> numa_node_cpus() {
+  vector<vector<unsigned>> nodes;
+  string list;
+  ifstream online("/sys/devices/system/node/online");
+  if (!getline(online, list)) return nodes;
+  for (auto&& node : parse_sysfs_list(list)) {
+    ifstream cpulist("/sys/devices/system/node/node" + to_string(node) + "/cpulist");
+    if (!getline(cpulist, list)) continue;
+    nodes.push_back(parse_sysfs_list(list));
+    if (nodes.back().empty()) nodes.pop_back();
+  }
+  return nodes;
+}
+
+// Pin the calling thread and the threads it starts afterwards to the given CPUs
+static void pin_to_cpus(const vector<unsigned>& cpus) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (auto&& cpu : cpus)
+    if (cpu < CPU_SETSIZE) CPU_SET(cpu, &set);
+  if (sched_setaffinity(0, sizeof(set), &set) != 0)
+    cerr << "Cannot pin the process to the CPUs of a NUMA node!" << endl;
+}
+
+// Fork the given number of worker processes, which share the loaded models
+// copy-on-write and listen on the same ports, and respawn the crashed ones.
+// The master forwards SIGHUP to the workers and on SIGUSR2 reloads the models
+// itself, replacing the workers by new ones sharing the reloaded models.
+// If NUMA nodes are given, the workers are distributed evenly among them and
+// pinned to their CPUs. Before forking the workers of a node, the master pins
+// itself to the node and, if reload_on_nodes is set, loads the models again
+// there, unless they were loaded on the node already (the models are expected
+// to be loaded on the first node initially), so that the workers of every node
+// share node-local models; the respawned workers only pin themselves.
+// Returns true in the workers, which continue starting the server, and false
+// in the master after SIGINT or SIGUSR1 stops the workers.
+static bool run_worker_processes(unsigned processes, const vector<vector<unsigned>>& nodes, bool reload_on_nodes) {
+  sigset_t set, original;
+  sigemptyset(&set);
+  for (int signal : {SIGCHLD, SIGHUP, SIGINT, SIGUSR1, SIGUSR2})
+    sigaddset(&set, signal);
+  if (sigprocmask(SIG_BLOCK, &set, &original) != 0)
+    runtime_failure("Cannot block the signals of the master process!");
+
+  struct worker_info {
+    chrono::steady_clock::time_point started;
+    int node;
+  };
+  unordered_map<pid_t, worker_info> workers;
+  unordered_set<pid_t> replaced;
+  auto start_workers = [&](unsigned count, int node) {
+    for (unsigned i = 0; i < count; i++) {
+      pid_t pid = fork();
+      if (pid < 0) cerr << "Cannot fork a worker process!" << endl;
+      if (pid == 0) {
+        if (node >= 0) pin_to_cpus(nodes[node]);
+        return sigprocmask(SIG_SETMASK, &original, nullptr), true;
+      }
+      if (pid > 0) workers.emplace(pid, worker_info{chrono::steady_clock::now(), node});
+    }
+    return false;
+  };
+  unsigned models_node = 0;
+  auto start_all_workers = [&]() {
+    if (nodes.empty()) return start_workers(processes, -1);
+
+    // Start with the node the models were loaded on, to avoid loading them again
+    for (unsigned i = 0, first = models_node; i < nodes.size() && i < processes; i++) {
+      unsigned node = (first + i) % nodes.size();
+      pin_to_cpus(nodes[node]);
+      if (reload_on_nodes && node != models_node) {
+        if (service.reload_models())
+          models_node = node;
+        else
+          cerr << "Cannot load the models on NUMA node " << node << ", its workers use the models of node " << models_node << "." << endl;
+      }
+      if (start_workers((processes - i + nodes.size() - 1) / nodes.size(), node)) return true;
+    }
+    return false;
+  };
+  auto signal_workers = [&](int signal) {
+    for (auto&& worker : workers)
+      kill(worker.first, signal);
+  };
+
+  if (start_all_workers()) return true;
+  cerr << "Started " << workers.size() << " worker processes";
+  if (!nodes.empty()) cerr << " on " << min(unsigned(nodes.size()), processes) << " NUMA nodes";
+  cerr << "." << endl;
+
+  for (int signal; sigwait(&set, &signal) == 0 && signal != SIGINT && signal != SIGUSR1; )
+    if (signal == SIGHUP) {
+      signal_workers(SIGHUP);
+    } else if (signal == SIGUSR2) {
+      cerr << "Reloading models." << endl;
+      if (!service.reload_models()) continue;
+      for (auto&& worker : workers)
+        replaced.insert(worker.first);
+      if (start_all_workers()) return true;
+      for (auto&& pid : replaced)
+        kill(pid, SIGINT);
+      cerr << "Successfully reloaded models, replacing the worker processes." << endl;
+    } else if (signal == SIGCHLD) {
+      int status;
+      for (pid_t pid; (pid = waitpid(-1, &status, WNOHANG)) > 0; ) {
+        auto worker = workers.find(pid);
+        if (worker == workers.end()) continue;
+        bool short_lived = chrono::steady_clock::now() - worker->second.started < chrono::seconds(1);
+        int node = worker->second.node;
+        workers.erase(worker);
+        if (replaced.erase(pid)) continue;
+
+        cerr << "Worker process " << pid << (WIFSIGNALED(status) ? " was killed by signal " : " exited with status ")
+             << (WIFSIGNALED(status) ? WTERMSIG(status) : WEXITSTATUS(status)) << ", respawning it." << endl;
+        // Avoid respawning the workers failing during start too quickly
+        if (short_lived) this_thread::sleep_for(chrono::seconds(1));
+        if (start_workers(1, node)) return true;
+      }
+    }
+
+  // Stop the workers gracefully, waiting until they finish
+  signal_workers(SIGINT);
+  for (int status; !workers.empty(); ) {
+    pid_t pid = waitpid(-1, &status, 0);
+    if (pid < 0 && errno != EINTR) break;
+    if (pid > 0) workers.erase(pid);
+  }
+  return false;
+}
+#endif
+
 int main(int argc, char* argv[]) {
   iostreams_init();
 
   options::map options;
-  if (!options::parse({{"connection_timeout", options::value::any},
+  if (!options::parse({{"analysis_cache", options::value::any},
+                       {"binary_port", options::value::any},
+                       {"compression", options::value::any},
+                       {"connection_timeout", options::value::any},
                        {"daemon", options::value::none},
+                       {"epoll", options::value::none},
+                       {"gazetteers_cache", options::value::none},
+                       {"keep_alive", options::value::none},
+                       {"large_request_size", options::value::any},
+                       {"load_threads", options::value::any},
+                       {"log_async", options::value::any},
                        {"log_file", options::value::any},
                        {"log_request_max_size", options::value::any},
                        {"max_connections", options::value::any},
+                       {"max_loaded_models", options::value::any},
+                       {"max_model_requests", options::value::any},
+                       {"max_queued", options::value::any},
                        {"max_request_size", options::value::any},
+                       {"max_sentence_length", options::value::any},
+                       {"metrics", options::value::none},
+                       {"model_cascade", options::value::any},
+                       {"prefilter_models", options::value::any},
+                       {"parallel_sentences", options::value::any},
+                       {"pin_workers", options::value::none},
+                       {"processes", options::value::any},
+                       {"request_timeout", options::value::any},
+                       {"sentence_batch", options::value::any},
+                       {"sentence_batch_wait", options::value::any},
+                       {"sentence_cache", options::value::any},
+                       {"shared_memory", options::value::any},
+                       {"stream_uploads", options::value::none},
+                       {"template_metrics", options::value::none},
                        {"threads", options::value::any},
+                       {"unix_socket", options::value::any},
                        {"version", options::value::none},
+                       {"warm_up", options::value::any},
+                       {"workers", options::value::any},
                        {"help", options::value::none}}, argc, argv, options) ||
       options.count("help") ||
       ((argc < 2 || (argc % 3) != 2) && !options.count("version")))
     runtime_failure("Usage: " << argv[0] << " [options] port (model_name model_file acknowledgements)*\n"
-                    "Options: --connection_timeout=maximum connection timeout [s] (default 60)\n"
+                    "Options: --analysis_cache=number of cached analysed forms per model (default 0)\n"
+                    "         --binary_port=port of the binary protocol server (default 0 meaning none)\n"
+                    "         --compression=gzip/deflate level of accepted responses (default 0 meaning none)\n"
+                    "         --connection_timeout=maximum connection timeout [s] (default 60)\n"
                     "         --daemon (daemonize after start, supported on Linux only)\n"
+                    "         --epoll (use epoll for connections, requires --threads, Linux only)\n"
+                    "         --gazetteers_cache (write the compiled caches of gazetteers read from files)\n"
+                    "         --keep_alive (keep connections open for further requests)\n"
+                    "         --large_request_size=size [kB] of requests recognized with low priority (default 0 meaning none)\n"
+                    "         --load_threads=threads loading the models (default 1)\n"
+                    "         --log_async=log records queued for a background writer (default 0 meaning synchronous)\n"
                     "         --log_file=file path (no logging if empty, default nametag_server.log)\n"
                     "         --log_request_max_size=max req log size [kB] (0 unlimited, default 64)\n"
                     "         --max_connections=maximum network connections (default 256)\n"
+                    "         --max_loaded_models=models loaded at a time (default 0 meaning all)\n"
+                    "         --max_model_requests=comma separated model:requests processed at a time (default none)\n"
+                    "         --max_queued=recognitions waiting for workers (default 256)\n"
                     "         --max_request_size=maximum request size [kB] (default 1024)\n"
+                    "         --max_sentence_length=split longer sentences (default 0 meaning never)\n"
+                    "         --metrics (collect metrics provided by the metrics method)\n"
+                    "         --model_cascade=comma separated model:screening_model[:probability] (default none)\n"
+                    "         --prefilter_models=comma separated models skipping sentences without entity candidates (default none)\n"
+                    "         --parallel_sentences=sentences of a request recognized in parallel by workers (default 1)\n"
+                    "         --pin_workers (distribute --processes among NUMA nodes, loading the models on each)\n"
+                    "         --processes=worker processes sharing the models (default 0 meaning none, Linux only)\n"
+                    "         --request_timeout=maximum response generation time [s] (default 0 meaning unlimited)\n"
+                    "         --sentence_batch=sentences of concurrent requests recognized together (default 0 meaning none)\n"
+                    "         --sentence_batch_wait=maximum wait for collecting a batch [us] (default 200)\n"
+                    "         --sentence_cache=number of cached recognized sentences per model (default 0)\n"
+                    "         --shared_memory=name prefix of shared memory segments to load the models from (default none)\n"
+                    "         --stream_uploads (recognize posted data while they are received)\n"
+                    "         --template_metrics (add feature template statistics to metrics)\n"
                     "         --threads=threads to use (default 0 means unlimitted)\n"
+                    "         --unix_socket=path of Unix domain socket to listen on too (only on it if port is 0)\n"
                     "         --version\n"
+                    "         --warm_up=file with text recognized by all models before serving\n"
+                    "         --workers=recognition threads (default 0 means connection threads)\n"
                     "         --help");
   if (options.count("version")) {
     ostringstream other_libraries;
@@ -89,23 +308,127 @@ int main(int argc, char* argv[]) {
 
   // Process options
   int port = parse_int(argv[1], "port number");
+  int analysis_cache = options.count("analysis_cache") ? parse_int(options["analysis_cache"], "analysis cache size") : 0;
+  if (analysis_cache < 0) runtime_failure("The analysis cache size must not be negative!");
+  int binary_port = options.count("binary_port") ? parse_int(options["binary_port"], "binary protocol port number") : 0;
+  if (binary_port < 0) runtime_failure("The binary protocol port number must not be negative!");
+  int compression = options.count("compression") ? parse_int(options["compression"], "compression level") : 0;
+  if (compression < 0 || compression > 9) runtime_failure("The compression level must be between 0 and 9!");
+  if (!server.set_compression(compression)) runtime_failure("The --compression option requires nametag_server compiled with ZLIB=1!");
   int connection_timeout = options.count("connection_timeout") ? parse_int(options["connection_timeout"], "connection timeout") : 60;
+  int log_async = options.count("log_async") ? parse_int(options["log_async"], "asynchronous log queue size") : 0;
+  if (log_async < 0) runtime_failure("The asynchronous log queue size must not be negative!");
   int log_request_max_size = options.count("log_request_max_size") ? parse_int(options["log_request_max_size"], "log request maximum size") : 64;
   int max_connections = options.count("max_connections") ? parse_int(options["max_connections"], "maximum connections") : 256;
+  int max_loaded_models = options.count("max_loaded_models") ? parse_int(options["max_loaded_models"], "maximum loaded models") : 0;
+  if (max_loaded_models < 0) runtime_failure("The maximum loaded models must not be negative!");
+  int load_threads = options.count("load_threads") ? parse_int(options["load_threads"], "number of loading threads") : 1;
+  if (load_threads < 1) runtime_failure("The number of loading threads must be positive!");
   int max_request_size = options.count("max_request_size") ? parse_int(options["max_request_size"], "maximum request size") : 1024;
+  int max_sentence_length = options.count("max_sentence_length") ? parse_int(options["max_sentence_length"], "maximum sentence length") : 0;
+  if (max_sentence_length < 0) runtime_failure("The maximum sentence length must not be negative!");
+  int request_timeout = options.count("request_timeout") ? parse_int(options["request_timeout"], "request timeout") : 0;
+  if (request_timeout < 0) runtime_failure("The request timeout must not be negative!");
+  int sentence_cache = options.count("sentence_cache") ? parse_int(options["sentence_cache"], "sentence cache size") : 0;
+  if (sentence_cache < 0) runtime_failure("The sentence cache size must not be negative!");
+  int sentence_batch = options.count("sentence_batch") ? parse_int(options["sentence_batch"], "sentence batch size") : 0;
+  if (sentence_batch < 0) runtime_failure("The sentence batch size must not be negative!");
+  int sentence_batch_wait = options.count("sentence_batch_wait") ? parse_int(options["sentence_batch_wait"], "sentence batch wait") : 200;
+  if (sentence_batch_wait < 0) runtime_failure("The sentence batch wait must not be negative!");
   int threads = options.count("threads") ? parse_int(options["threads"], "number of threads") : 0;
+  int workers = options.count("workers") ? parse_int(options["workers"], "number of workers") : 0;
+  if (workers < 0) runtime_failure("The number of workers must not be negative!");
+  int max_queued = options.count("max_queued") ? parse_int(options["max_queued"], "maximum queued recognitions") : 256;
+  if (max_queued < 0) runtime_failure("The maximum queued recognitions must not be negative!");
+  int parallel_sentences = options.count("parallel_sentences") ? parse_int(options["parallel_sentences"], "parallel sentences") : 1;
+  if (parallel_sentences < 1) runtime_failure("The number of parallel sentences must be positive!");
+  if (parallel_sentences > 1 && !workers) runtime_failure("The --parallel_sentences option requires --workers!");
+  int large_request_size = options.count("large_request_size") ? parse_int(options["large_request_size"], "large request size") : 0;
+  if (large_request_size < 0) runtime_failure("The large request size must not be negative!");
+  if (large_request_size && !workers) runtime_failure("The --large_request_size option requires --workers!");
+  int processes = options.count("processes") ? parse_int(options["processes"], "number of worker processes") : 0;
+  if (processes < 0) runtime_failure("The number of worker processes must not be negative!");
+  if (processes && options.count("unix_socket")) runtime_failure("The --unix_socket option cannot be used with --processes!");
+  if (options.count("pin_workers") && !processes) runtime_failure("The --pin_workers option requires --processes!");
+  if (options.count("shared_memory") && (options["shared_memory"].empty() || options["shared_memory"].find('/') != string::npos))
+    runtime_failure("The shared memory prefix must be nonempty and must not contain a slash!");
 
+  if (options.count("epoll") && !threads) runtime_failure("The --epoll option requires --threads!");
 #ifndef __linux__
   if (options.count("daemon")) runtime_failure("The --daemon option is currently supported on Linux only!");
+  if (options.count("epoll")) runtime_failure("The --epoll option is supported on Linux only!");
+  if (binary_port) runtime_failure("The --binary_port option is supported on Linux only!");
+  if (processes) runtime_failure("The --processes option is supported on Linux only!");
 #endif
 
+  // Load the models on the first NUMA node when pinning the workers
+#ifdef __linux__
+  vector<vector<unsigned>> numa_nodes;
+  if (options.count("pin_workers")) {
+    numa_nodes = numa_node_cpus();
+    if (numa_nodes.size() < 2) {
+      cerr << "Found " << (numa_nodes.empty() ? "no NUMA nodes" : "a single NUMA node") << ", not pinning the worker processes." << endl;
+      numa_nodes.clear();
+    }
+    if (!numa_nodes.empty()) pin_to_cpus(numa_nodes.front());
+  }
+#endif
+
+  if (options.count("gazetteers_cache")) ner::set_gazetteers_cache_writing(true);
+
   // Initialize the service
   vector<nametag_service::model_description> models;
   for (int i = 2; i < argc; i += 3)
     models.emplace_back(argv[i], argv[i + 1], argv[i + 2]);
+  if (options.count("max_model_requests")) {
+    vector<string> limits, parts;
+    split(options["max_model_requests"], ',', limits);
+    for (auto&& limit : limits) {
+      split(limit, ':', parts);
+      if (parts.size() != 2) runtime_failure("Cannot parse model requests limit '" << limit << "'!");
+      int max_requests = parse_int(parts[1], "maximum model requests");
+      if (max_requests < 1) runtime_failure("The maximum model requests must be positive!");
+      auto model = find_if(models.begin(), models.end(), [&](const nametag_service::model_description& model) { return model.rest_id == parts[0]; });
+      if (model == models.end()) runtime_failure("Unknown model '" << parts[0] << "' in --max_model_requests!");
+      model->max_requests = max_requests;
+    }
+  }
+  if (options.count("model_cascade")) {
+    vector<string> cascades, parts;
+    split(options["model_cascade"], ',', cascades);
+    for (auto&& cascade : cascades) {
+      split(cascade, ':', parts);
+      if (parts.size() != 2 && parts.size() != 3) runtime_failure("Cannot parse model cascade '" << cascade << "'!");
+      auto model = find_if(models.begin(), models.end(), [&](const nametag_service::model_description& model) { return model.rest_id == parts[0]; });
+      if (model == models.end()) runtime_failure("Unknown model '" << parts[0] << "' in --model_cascade!");
+      if (!any_of(models.begin(), models.end(), [&](const nametag_service::model_description& model) { return model.rest_id == parts[1]; }))
+        runtime_failure("Unknown screening model '" << parts[1] << "' in --model_cascade!");
+      if (parts[1] == parts[0]) runtime_failure("The model '" << parts[0] << "' cannot screen its own sentences!");
+      model->screening_model = parts[1];
+      if (parts.size() == 3) {
+        model->screening_probability = parse_double(parts[2], "screening probability");
+        if (model->screening_probability < 0 || model->screening_probability > 1) runtime_failure("The screening probability must be between 0 and 1!");
+      }
+    }
+  }
+  if (options.count("prefilter_models")) {
+    vector<string> prefiltered;
+    split(options["prefilter_models"], ',', prefiltered);
+    for (auto&& rest_id : prefiltered) {
+      auto model = find_if(models.begin(), models.end(), [&](const nametag_service::model_description& model) { return model.rest_id == rest_id; });
+      if (model == models.end()) runtime_failure("Unknown model '" << rest_id << "' in --prefilter_models!");
+      model->candidate_prefilter = true;
+    }
+  }
 
-  if (!service.init(models))
+  if (options.count("shared_memory")) service.set_shared_memory(options["shared_memory"]);
+  if (!service.init(models, analysis_cache, max_sentence_length, max_loaded_models, sentence_cache, load_threads))
     runtime_failure("Cannot load specified models!");
+  if (options.count("template_metrics") && !options.count("metrics")) runtime_failure("The --template_metrics option requires --metrics!");
+  if (options.count("metrics")) service.enable_metrics(options.count("template_metrics"));
+  service.set_request_timeout(request_timeout);
+  service.set_stream_uploads(options.count("stream_uploads"));
+  service.set_sentence_batching(sentence_batch, sentence_batch_wait);
 
   // Open log file
   ofstream log_file;
@@ -114,6 +437,8 @@ int main(int argc, char* argv[]) {
     log_file.open(log_file_name.c_str(), ofstream::app);
     if (!log_file) runtime_failure("Cannot open log file '" << log_file_name << "' for writing!");
   }
+  // The costs of the requests are accounted when they are logged or exported
+  if (!log_file_name.empty() || options.count("metrics")) service.enable_request_accounting();
 
   // Daemonize if requested
 #ifdef __linux__
@@ -126,24 +451,89 @@ int main(int argc, char* argv[]) {
     static syslog_streambuf syslog;
     cerr.rdbuf(&syslog);
   }
+
+  // Fork the worker processes before starting any threads
+  if (processes && !run_worker_processes(processes, numa_nodes, !max_loaded_models))
+    return 0;
+#endif
+
+  // Reload gazetteers on SIGHUP in a separate thread, also logging the
+  // analysis cache statistics, and reload the models on SIGUSR2. The signals
+  // are blocked before starting the server, so that all its threads inherit the mask.
+#ifdef __linux__
+  sigset_t reload_set;
+  sigemptyset(&reload_set);
+  sigaddset(&reload_set, SIGHUP);
+  sigaddset(&reload_set, SIGUSR2);
+  if (pthread_sigmask(SIG_BLOCK, &reload_set, nullptr) != 0)
+    runtime_failure("Cannot block SIGHUP and SIGUSR2 in '" << argv[0] << "' executable!");
+
+  thread([reload_set]{
+    for (int signal; sigwait(&reload_set, &signal) == 0; )
+      if (signal == SIGUSR2) {
+        cerr << "Reloading models." << endl;
+        auto start = chrono::steady_clock::now();
+        if (service.reload_models())
+          cerr << "Successfully reloaded models in " << fixed << setprecision(3)
+               << chrono::duration<double>(chrono::steady_clock::now() - start).count() << " seconds." << endl;
+      } else {
+        cerr << "Reloading gazetteers." << endl;
+        if (service.reload_gazetteers())
+          cerr << "Successfully reloaded gazetteers." << endl;
+        service.log_cache_statistics();
+      }
+  }).detach();
 #endif
 
+  // Start the recognition workers, after daemonizing and blocking SIGHUP
+  if (workers && !service.start_workers(workers, max_queued, parallel_sentences, size_t(large_request_size) << 10))
+    runtime_failure("Cannot start recognition workers!");
+
+  // Warm up the models before accepting connections
+  if (options.count("warm_up")) {
+    ifstream warm_up_file(options["warm_up"]);
+    if (!warm_up_file.is_open()) runtime_failure("Cannot open warm-up file '" << options["warm_up"] << "'!");
+    ostringstream warm_up_text;
+    warm_up_text << warm_up_file.rdbuf();
+
+    auto start = chrono::steady_clock::now();
+    service.warm_up(warm_up_text.str());
+    cerr << "Warmed up the models in " << fixed << setprecision(3)
+         << chrono::duration<double>(chrono::steady_clock::now() - start).count() << " seconds." << endl;
+  }
+
   // Start the server
   if (!log_file_name.empty())
     server.set_log_file(&log_file, log_request_max_size << 10);
+  server.set_async_log(log_async);
   server.set_max_connections(max_connections);
   server.set_max_request_body_size(max_request_size << 10);
   server.set_min_generated(32 << 10);
   server.set_threads(threads);
   server.set_timeout(connection_timeout);
+  server.set_epoll(options.count("epoll"));
+  server.set_keep_alive(options.count("keep_alive"));
+  if (options.count("unix_socket") && !server.set_unix_socket(options["unix_socket"]))
+    runtime_failure("The --unix_socket option is not supported on this platform!");
 
   if (!server.start(&service, port))
     runtime_failure("Cannot start nametag_server'!");
 
-  cerr << "Successfully started nametag_server on port " << port << "." << endl;
+  if (options.count("unix_socket"))
+    cerr << "Successfully started nametag_server on " << (port ? "port " + to_string(port) + " and " : "")
+         << "Unix domain socket '" << options["unix_socket"] << "'." << endl;
+  else
+    cerr << "Successfully started nametag_server on port " << port << "." << endl;
+
+  if (binary_port) {
+    if (!binary_server.start(&service, binary_port, max_connections, max_request_size << 10, connection_timeout))
+      runtime_failure("Cannot start the binary protocol server on port " << binary_port << "!");
+    cerr << "Successfully started the binary protocol server on port " << binary_port << "." << endl;
+  }
 
   // Wait until finished
   server.wait_until_signalled();
+  binary_server.stop();
   server.stop();
 
   return 0;
@@ -8,27 +8,88 @@
 // file, You can obtain one at http://mozilla.org/MPL/2.0/.
 
 #include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <functional>
+
+#if defined(_WIN32) && !defined(__CYGWIN__)
+#include <windows.h>
+#endif
 
 #include "nametag_service.h"
+#include "unilib/utf8.h"
+#include "utils/memory_streambuf.h"
+#include "utils/split.h"
+#include "utils/tracepoints.h"
 
 namespace ufal {
 namespace nametag {
 
 // Init the NameTag service -- load the models
-bool nametag_service::init(const vector<model_description>& model_descriptions) {
+bool nametag_service::init(const vector<model_description>& model_descriptions, size_t analysis_cache, int max_sentence_length,
+                           unsigned max_loaded_models, size_t sentence_cache, unsigned load_threads) {
   if (model_descriptions.empty()) return false;
 
-  // Load models
   models.clear();
   rest_models_map.clear();
+  loader.reset(max_loaded_models ? new threadsafe_resource_loader<model_info>(max_loaded_models) : nullptr);
   for (auto& model_description : model_descriptions) {
-    Ner* ner = Ner::load(model_description.file.c_str());
-    if (!ner) return false;
+    models.emplace_back(model_description.rest_id, model_description.file, model_description.acknowledgements, analysis_cache, max_sentence_length, sentence_cache);
+    models.back().max_requests = model_description.max_requests;
+    models.back().candidate_prefilter = model_description.candidate_prefilter;
+    models.back().shared_memory = shared_memory;
+  }
+
+  // Resolve the screening models of the cascades
+  for (unsigned i = 0; i < models.size(); i++) {
+    auto& screening_model = model_descriptions[i].screening_model;
+    if (screening_model.empty()) continue;
+
+    auto screening = find_if(model_descriptions.begin(), model_descriptions.end(), [&](const model_description& model) { return model.rest_id == screening_model; });
+    if (screening == model_descriptions.end() || size_t(screening - model_descriptions.begin()) == i) {
+      cerr << "Cannot use '" << screening_model << "' as the screening model of model '" << models[i].rest_id << "'!" << endl;
+      return false;
+    }
+    models[i].screening_model = screening - model_descriptions.begin();
+    models[i].screening_file = screening->file;
+    models[i].screening_probability = model_descriptions[i].screening_probability;
+  }
 
-    // Store the model
-    models.emplace_back(model_description.rest_id, ner, model_description.acknowledgements);
+  // Without loading on demand, the models of the same file and candidate
+  // prefilter share the recognizer
+  vector<unsigned> loaded_models, same_file_models(models.size());
+  for (unsigned i = 0; i < models.size(); i++) {
+    same_file_models[i] = i;
+    for (unsigned j = 0; !loader && j < i && same_file_models[i] == i; j++)
+      if (models[j].file == models[i].file && models[j].candidate_prefilter == models[i].candidate_prefilter)
+        same_file_models[i] = j;
+    if (same_file_models[i] == i) loaded_models.push_back(i);
   }
 
+  // Load the models concurrently, releasing them if they are loaded on demand
+  vector<char> models_loaded(loaded_models.size());
+  utils::worker_pool loading;
+  if (load_threads > 1) loading.start(min(load_threads, unsigned(loaded_models.size())) - 1);
+  loading.run_parallel(loaded_models.size(), [&](unsigned i) {
+    auto& model = models[loaded_models[i]];
+    models_loaded[i] = model.load(loader != nullptr);
+    if (loader && models_loaded[i]) model.release();
+  });
+  if (find(models_loaded.begin(), models_loaded.end(), 0) != models_loaded.end()) return false;
+
+  for (unsigned i = 0; i < models.size(); i++)
+    if (same_file_models[i] != i)
+      models[i].share(models[same_file_models[i]]);
+  if (!loader)
+    for (auto& model : models)
+      if (model.screening_model >= 0)
+        model.screening = models[model.screening_model].ner;
+  if (loader)
+    for (auto& model : models)
+      model.loader_id = loader->add(&model);
+
   // Fill rest_models_map with model name and aliases
   for (auto& model : models) {
     // Fail if this model id is aready in use.
@@ -60,32 +121,417 @@ bool nametag_service::init(const vector<model_description>& model_descriptions)
     if (model.can_tokenize) json_models.value("tokenize");
     json_models.close();
   }
-  json_models.indent().close().indent().key("default_model").indent().value(model_descriptions.front().rest_id).finish(true);
+  json_models.indent().close().indent().key("default_model").indent().value(model_descriptions.front().rest_id);
+
+  // Memory usage of the model components is known only for the models which are
+  // not loaded on demand
+  if (!loader) {
+    json_models.indent().key("memory_usage").indent().object();
+    vector<string> components;
+    vector<size_t> bytes;
+    for (auto& model : models) {
+      model.ner->memory_usage(components, bytes);
+      json_models.indent().key(model.rest_id).indent().object();
+      for (unsigned i = 0; i < components.size(); i++)
+        json_models.indent().key(components[i]).value(bytes[i]);
+      json_models.indent().close();
+    }
+    json_models.indent().close();
+  }
+  json_models.finish(true);
+
+  // Without loading on demand, the requests use the current versions of the
+  // models, so that the models can be replaced by reload_models
+  if (!loader)
+    for (auto& model : models) {
+      auto current = model.clone_settings();
+      current->share(model);
+      current->screening = model.screening;
+      model.current = current;
+      model.release();
+    }
+
+  return true;
+}
+
+// Load the model from the given file, or from the shared memory segment named
+// by the prefix and a hash of the file name if the prefix is not empty
+static ner* load_ner(const string& file, const string& shared_memory) {
+  if (shared_memory.empty()) return ner::load(file.c_str());
+
+  char hash[17];
+  snprintf(hash, sizeof(hash), "%016llx", (unsigned long long) std::hash<string>()(file));
+  string name = "/" + shared_memory + "." + hash;
+  unique_ptr<utils::memory_streambuf> mapped(utils::memory_streambuf::map_shared_memory(file.c_str(), name.c_str()));
+  if (!mapped) {
+    cerr << "Cannot map the model '" << file << "' to the shared memory segment '" << name << "'!" << endl;
+    return nullptr;
+  }
+
+  istream in(mapped.get());
+  return ner::load(in);
+}
+
+bool nametag_service::model_info::load(bool with_screening) {
+  ner.reset(load_ner(file, shared_memory));
+  if (!ner) return false;
+  if (analysis_cache) ner->set_analysis_cache(analysis_cache);
+  if (max_sentence_length) ner->set_max_sentence_length(max_sentence_length);
+  if (sentence_cache) ner->set_sentence_cache(sentence_cache);
+  if (stage_profiling) ner->set_stage_profiling(true);
+  if (candidate_prefilter && !ner->set_candidate_prefilter(true))
+    cerr << "The model '" << rest_id << "' does not support the candidate prefilter, recognizing all sentences." << endl;
+
+  if (with_screening && !screening_file.empty()) {
+    screening.reset(load_ner(screening_file, shared_memory));
+    if (!screening) return ner.reset(), false;
+    if (analysis_cache) screening->set_analysis_cache(analysis_cache);
+    if (max_sentence_length) screening->set_max_sentence_length(max_sentence_length);
+  }
+
+  unique_ptr<Tokenizer> tokenizer(ner->new_tokenizer());
+  can_tokenize = tokenizer != nullptr;
+  if (tokenizer) tokenizers->tokenizers.push_back(move(tokenizer));
+
+  ner->entity_types(entity_types);
+  entity_type_ids.clear();
+  for (unsigned i = 0; i < entity_types.size(); i++)
+    entity_type_ids.emplace(entity_types[i], i);
+  return true;
+}
+
+void nametag_service::model_info::release() {
+  {
+    lock_guard<mutex> guard(tokenizers->lock);
+    tokenizers->tokenizers.clear();
+  }
+  ner.reset();
+  screening.reset();
+}
+
+nametag_service::pooled_tokenizer nametag_service::model_info::new_tokenizer() const {
+  {
+    lock_guard<mutex> guard(tokenizers->lock);
+    if (!tokenizers->tokenizers.empty()) {
+      pooled_tokenizer tokenizer(tokenizers->tokenizers.back().release(), tokenizer_deleter{this});
+      tokenizers->tokenizers.pop_back();
+      return tokenizer;
+    }
+  }
+  return pooled_tokenizer(ner->new_tokenizer(), tokenizer_deleter{this});
+}
+
+bool nametag_service::model_info::admit_request() const {
+  if (!max_requests) return true;
+
+  for (unsigned current = admitted_requests->load(); current < max_requests; )
+    if (admitted_requests->compare_exchange_weak(current, current + 1)) return true;
+  return false;
+}
+
+void nametag_service::model_info::release_request() const {
+  if (max_requests) admitted_requests->fetch_sub(1);
+}
+
+void nametag_service::tokenizer_deleter::operator()(Tokenizer* tokenizer) const {
+  if (model) {
+    lock_guard<mutex> guard(model->tokenizers->lock);
+    if (model->tokenizers->tokenizers.size() < model_info::tokenizer_pool::max_pooled)
+      return model->tokenizers->tokenizers.emplace_back(tokenizer);
+  }
+  delete tokenizer;
+}
+
+void nametag_service::model_info::share(const model_info& other) {
+  ner = other.ner;
+  can_tokenize = other.can_tokenize;
+  entity_types = other.entity_types;
+  entity_type_ids = other.entity_type_ids;
+}
+
+shared_ptr<nametag_service::model_info> nametag_service::model_info::clone_settings() const {
+  shared_ptr<model_info> clone(new model_info(rest_id, file, acknowledgements, analysis_cache, max_sentence_length, sentence_cache));
+  clone->stage_profiling = stage_profiling;
+  clone->candidate_prefilter = candidate_prefilter;
+  clone->shared_memory = shared_memory;
+  clone->loader_id = loader_id;
+  clone->max_requests = max_requests;
+  clone->admitted_requests = admitted_requests;
+  clone->screening_file = screening_file;
+  clone->screening_model = screening_model;
+  clone->screening_probability = screening_probability;
+  clone->screened_sentences = screened_sentences;
+  clone->cascaded_sentences = cascaded_sentences;
+  return clone;
+}
+
+// Start the recognition workers
+unsigned nametag_service::start_workers(unsigned workers, unsigned max_queued, unsigned parallel_sentences, size_t large_request_size) {
+  unsigned started = this->workers.start(workers);
+  max_admitted = started ? started + max_queued : 0;
+  this->parallel_sentences = started && parallel_sentences ? parallel_sentences : 1;
+  this->large_request_size = started ? large_request_size : 0;
+  return started;
+}
+
+// Warm up the loaded models. The models loaded on demand which are not loaded
+// now are not loaded just for the warm-up.
+void nametag_service::warm_up(const string& text) {
+  warm_up_text = text;
+  for (auto& model : models)
+    if (auto loaded = use_if_loaded(model))
+      warm_up_model(*loaded);
+}
+
+void nametag_service::warm_up_model(const model_info& model) {
+  const string& text = warm_up_text;
+  workers.run_parallel(max(workers.workers(), 1U), [&model, &text](unsigned /*job*/) {
+    auto tokenizer = model.new_tokenizer();
+    if (!tokenizer) return;
+
+    vector<string_piece> forms;
+    vector<named_entity> entities;
+    tokenizer->set_text(text);
+    while (tokenizer->next_sentence(&forms, nullptr)) {
+      model.ner->recognize(forms, entities);
+      if (model.screening) model.screening->recognize(forms, entities);
+    }
+  });
+}
+
+// Reload out-of-model gazetteers of all models. The models loaded on demand
+// which are not loaded now will load the current gazetteers when loaded.
+bool nametag_service::reload_gazetteers() {
+  bool reloaded = true;
+  for (auto& model : models) {
+    auto loaded = use_if_loaded(model);
+    if (!loaded) continue;
+    if (!loaded->ner->reload_gazetteers()) {
+      cerr << "Cannot reload gazetteers of model '" << model.rest_id << "'!" << endl;
+      reloaded = false;
+    }
+  }
 
+  return reloaded;
+}
+
+// Reload the model files. The models are loaded and warmed up first, and
+// replaced only when all of them are ready, so the requests never wait.
+bool nametag_service::reload_models() {
+  if (loader) {
+    cerr << "Cannot reload the models loaded on demand, they are loaded from the model files when needed!" << endl;
+    return false;
+  }
+
+  vector<shared_ptr<model_info>> reloaded;
+  for (auto& model : models) {
+    reloaded.push_back(model.clone_settings());
+    auto same_file = find_if(models.begin(), models.begin() + reloaded.size() - 1, [&](const model_info& other) { return other.file == model.file && other.candidate_prefilter == model.candidate_prefilter; });
+    if (same_file != models.begin() + reloaded.size() - 1) {
+      reloaded.back()->share(*reloaded[same_file - models.begin()]);
+      continue;
+    }
+
+    if (!reloaded.back()->load(false)) {
+      cerr << "Cannot reload model '" << model.rest_id << "' from file '" << model.file << "'!" << endl;
+      return false;
+    }
+    // The list of the models and their methods is not updated
+    if (reloaded.back()->can_tokenize != atomic_load(&model.current)->can_tokenize) {
+      cerr << "Cannot reload model '" << model.rest_id << "', the new model " << (reloaded.back()->can_tokenize ? "has" : "does not have") << " a tokenizer!" << endl;
+      return false;
+    }
+    if (!warm_up_text.empty()) warm_up_model(*reloaded.back());
+  }
+
+  for (auto& model : reloaded)
+    if (model->screening_model >= 0)
+      model->screening = reloaded[model->screening_model]->ner;
+  for (unsigned i = 0; i < models.size(); i++)
+    atomic_store(&models[i].current, shared_ptr<const model_info>(reloaded[i]));
+  return true;
+}
+
+// Log analysis and sentence cache statistics of all models
+void nametag_service::log_cache_statistics() {
+  for (auto& model : models) {
+    auto loaded = use_if_loaded(model);
+    if (!loaded) continue;
+    size_t hits, misses;
+    loaded->ner->analysis_cache_statistics(hits, misses);
+    if (hits + misses)
+      cerr << "Analysis cache of model '" << model.rest_id << "': " << hits << " hits, " << misses << " misses." << endl;
+    loaded->ner->sentence_cache_statistics(hits, misses);
+    if (hits + misses)
+      cerr << "Sentence cache of model '" << model.rest_id << "': " << hits << " hits, " << misses << " misses." << endl;
+  }
+}
+
+// Recognize a text outside of the REST service
+bool nametag_service::recognize_text(const string& model_name, string_piece text, bool vertical, vector<named_entity>& entities,
+                                     string& error, bool& unavailable) {
+  entities.clear();
+  unavailable = false;
+
+  auto model = load_rest_model(model_name, error);
+  if (!model) return false;
+  if (!vertical && !model->can_tokenize) return error.assign("No tokenizer is defined for the requested model.\n"), false;
+  auto tokenizer = vertical ? pooled_tokenizer(Tokenizer::new_vertical_tokenizer()) : model->new_tokenizer();
+  if (!admit_request()) return unavailable = true, error.assign("Too many recognition requests are being processed, retry later.\n"), false;
+  if (!model->admit_request()) {
+    if (max_admitted) admitted.fetch_sub(1);
+    return unavailable = true, error.assign("Too many recognition requests of the model are being processed, retry later.\n"), false;
+  }
+
+  // A large text is recognized by low priority jobs of parallel_sentences
+  // sentences, a small one by a single job
+  bool low_priority = large_request_size && text.len > large_request_size;
+  unsigned job_sentences = low_priority ? parallel_sentences : 0;
+
+  auto deadline = chrono::steady_clock::now() + chrono::seconds(request_timeout);
+  bool timed_out = false, finished = false;
+  sentence_info sentence;
+  tokenizer->set_text(text);
+  auto recognize = [&]() {
+    for (unsigned sentences = 0; !job_sentences || sentences < job_sentences; sentences++) {
+      if (request_timeout && chrono::steady_clock::now() > deadline) {
+        timed_out = finished = true;
+        break;
+      }
+
+      auto start = metrics ? chrono::steady_clock::now() : chrono::steady_clock::time_point();
+      bool tokenized = tokenizer->next_sentence(&sentence.forms, nullptr);
+      if (metrics) metrics->tokenize.observe(start);
+      if (!tokenized) {
+        finished = true;
+        break;
+      }
+
+      recognize_sentence(*model, false, false, {}, metrics.get(), batcher.get(), sentence);
+      for (auto&& entity : sentence.entities) {
+        auto& first = sentence.forms[entity.start];
+        auto& last = sentence.forms[entity.start + entity.length - 1];
+        entities.emplace_back(first.str - text.str, last.str + last.len - first.str, entity.type);
+      }
+    }
+  };
+  if (max_admitted) {
+    while (!finished) workers.run(recognize, low_priority);
+    admitted.fetch_sub(1);
+  } else {
+    recognize();
+  }
+  model->release_request();
+
+  if (timed_out) return error.assign("The request timeout was exceeded.\n"), false;
   return true;
 }
 
 // Handlers with their URLs
 unordered_map<string, bool (nametag_service::*)(microrestd::rest_request&)> nametag_service::handlers = {
   // REST service
+  {"/metrics", &nametag_service::handle_rest_metrics},
   {"/models", &nametag_service::handle_rest_models},
   {"/recognize", &nametag_service::handle_rest_recognize},
+  {"/recognize_batch", &nametag_service::handle_rest_recognize_batch},
   {"/tokenize", &nametag_service::handle_rest_tokenize},
 };
 
 // Handle a request using the specified URL/handler map
 bool nametag_service::handle(microrestd::rest_request& req) {
   auto handler_it = handlers.find(req.url);
-  return handler_it == handlers.end() ? req.respond_not_found() : (this->*handler_it->second)(req);
+  if (handler_it == handlers.end()) return req.respond_not_found();
+
+  if (metrics) {
+    auto method = get_method_metrics(req);
+    size_t request_bytes = req.body.size();
+    for (auto&& param : req.params)
+      request_bytes += param.first.size() + param.second.size();
+    method->requests.fetch_add(1, memory_order_relaxed);
+    method->request_bytes.fetch_add(request_bytes, memory_order_relaxed);
+  }
+
+  return (this->*handler_it->second)(req);
+}
+
+// Metrics
+void nametag_service::enable_metrics(bool template_statistics) {
+  metrics.reset(new metrics_info());
+  for (auto&& handler : handlers)
+    metrics->methods[handler.first];
+
+  // The stage durations and template statistics are gathered by the stage
+  // profiling of the models, which is enabled also in the already loaded ones
+  metrics->template_statistics = template_statistics;
+  for (auto&& model : models) {
+    model.stage_profiling = true;
+    if (auto loaded = use_if_loaded(model)) loaded->ner->set_stage_profiling(true);
+  }
+}
+
+void nametag_service::set_sentence_batching(unsigned max_sentences, unsigned max_wait_microseconds) {
+  batcher.reset(max_sentences > 1 ? new sentence_batcher(max_sentences, max_wait_microseconds) : nullptr);
+}
+
+nametag_service::method_metrics* nametag_service::get_method_metrics(microrestd::rest_request& req) {
+  auto method_it = metrics->methods.find(req.url);
+  return method_it == metrics->methods.end() ? nullptr : &method_it->second;
+}
+
+const unsigned nametag_service::latency_histogram::bucket_microseconds[BUCKETS] = {
+  10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000
+};
+const char* nametag_service::latency_histogram::bucket_labels[BUCKETS] = {
+  "0.00001", "0.000025", "0.00005", "0.0001", "0.00025", "0.0005", "0.001", "0.0025", "0.005", "0.01", "0.025", "0.05", "0.1", "0.25", "0.5", "1", "2.5", "5", "10"
+};
+
+nametag_service::latency_histogram::latency_histogram() : total_microseconds(0) {
+  for (auto&& count : counts)
+    count.store(0);
+}
+
+void nametag_service::latency_histogram::observe(chrono::steady_clock::time_point start) {
+  observe_microseconds(chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count());
+}
+
+void nametag_service::latency_histogram::observe_microseconds(size_t microseconds) {
+  unsigned bucket = 0;
+  while (bucket < BUCKETS && microseconds > bucket_microseconds[bucket]) bucket++;
+  counts[bucket].fetch_add(1, memory_order_relaxed);
+  total_microseconds.fetch_add(microseconds, memory_order_relaxed);
+}
+
+void nametag_service::latency_histogram::output(string& text, const string& name, const string& labels) const {
+  size_t cumulative = 0;
+  for (unsigned bucket = 0; bucket <= BUCKETS; bucket++) {
+    cumulative += counts[bucket].load(memory_order_relaxed);
+    text.append(name).append("_bucket{").append(labels).append(labels.empty() ? "" : ",").append("le=\"")
+        .append(bucket < BUCKETS ? bucket_labels[bucket] : "+Inf").append("\"} ").append(to_string(cumulative)).push_back('\n');
+  }
+  size_t total = total_microseconds.load(memory_order_relaxed);
+  text.append(name).append("_sum{").append(labels).append("} ").append(to_string(total / 1000000))
+      .append(".").append(to_string(1000000 + total % 1000000).substr(1)).push_back('\n');
+  text.append(name).append("_count{").append(labels).append("} ").append(to_string(cumulative)).push_back('\n');
 }
 
 // Load selected model
-const nametag_service::model_info* nametag_service::load_rest_model(const string& rest_id, string& error) {
+shared_ptr<const nametag_service::model_info> nametag_service::load_rest_model(const string& rest_id, string& error) {
   auto model_it = rest_models_map.find(rest_id);
   if (model_it == rest_models_map.end())
     return error.assign("Requested model '").append(rest_id).append("' does not exist.\n"), nullptr;
 
-  return model_it->second;
+  if (!loader) return atomic_load(&model_it->second->current);
+
+  model_info* model = loader->load(model_it->second->loader_id);
+  if (!model) return error.assign("Cannot load requested model '").append(rest_id).append("'.\n"), nullptr;
+  return shared_ptr<const model_info>(model, [this](const model_info* model) { loader->release(model->loader_id); });
+}
+
+shared_ptr<const nametag_service::model_info> nametag_service::use_if_loaded(model_info& model) {
+  if (!loader) return atomic_load(&model.current);
+
+  if (!loader->use_if_loaded(model.loader_id)) return nullptr;
+  return shared_ptr<const model_info>(&model, [this](const model_info* model) { loader->release(model->loader_id); });
 }
 
 // REST service
@@ -93,26 +539,143 @@ inline microrestd::string_piece sp(string_piece str) { return microrestd::string
 inline microrestd::string_piece sp(const char* str, size_t len) { return microrestd::string_piece(str, len); }
 
 const char* nametag_service::json_mime = "application/json";
+bool nametag_service::admit_request() {
+  if (!max_admitted) return true;
+
+  for (unsigned current = admitted.load(); current < max_admitted; )
+    if (admitted.compare_exchange_weak(current, current + 1)) return true;
+  return false;
+}
+
 const char* nametag_service::operation_not_supported = "Required operation is not supported by the chosen model.\n";
 
-nametag_service::rest_response_generator::rest_response_generator(const model_info* model, rest_output_mode output)
-  : first(true), last(false), output(output) {
+nametag_service::rest_response_generator::rest_response_generator(const shared_ptr<const model_info>& model, rest_output_mode output)
+  : model(model), first(true), last(false), output(output) {
   json.object();
   json.indent().key("model").indent().value(model->rest_id);
   json.indent().key("acknowledgements").indent().array();
   json.indent().value("http://ufal.mff.cuni.cz/nametag/1#nametag_acknowledgements");
   if (!model->acknowledgements.empty()) json.indent().value(model->acknowledgements);
-  json.indent().close().indent().key("result").indent();
+  json.indent().close();
+  if (output.mode == COMPACT) {
+    // The compact output refers to the entity types using their indices
+    json.indent().key("entity_types").indent().array();
+    for (auto&& entity_type : model->entity_types)
+      json.value(entity_type);
+    json.close();
+  }
+  json.indent().key("result").indent();
+}
+
+nametag_service::rest_response_generator::~rest_response_generator() {
+  if (method) method->latency.observe(started);
+  if (method && accounting) {
+    method->cpu.observe_microseconds(accounting->cpu_microseconds.load());
+    method->wait_microseconds.fetch_add(accounting->wait_microseconds, memory_order_relaxed);
+    method->processing_microseconds.fetch_add(accounting->processing_microseconds, memory_order_relaxed);
+    method->sentences.fetch_add(accounting->sentences, memory_order_relaxed);
+    method->tokens.fetch_add(accounting->tokens, memory_order_relaxed);
+  }
+  if (workers_service) workers_service->admitted.fetch_sub(1);
+  if (model_admitted) model->release_request();
+}
+
+void nametag_service::rest_response_generator::use_metrics(metrics_info* metrics, method_metrics* method) {
+  this->metrics = metrics;
+  this->method = method;
+  started = chrono::steady_clock::now();
+}
+
+void nametag_service::rest_response_generator::reserve_for_input(size_t input_length) {
+  // The XML output is usually several times longer than the input, other
+  // outputs contain only the entities or tokens
+  reserve((output.mode == XML ? 8 : 2) * input_length + 1024);
+}
+
+void nametag_service::rest_response_generator::use_timeout(double timeout) {
+  if (!timeout) return;
+
+  // Timeouts longer than a year are considered infinite
+  if (timeout < 365 * 24 * 3600.) {
+    deadline = chrono::steady_clock::now() + chrono::microseconds(int64_t(timeout * 1e6));
+    has_deadline = true;
+  }
+}
+
+void nametag_service::rest_response_generator::use_accounting() {
+  accounting.reset(new accounting_info());
+}
+
+void nametag_service::rest_response_generator::log_statistics(string& record) const {
+  if (!accounting) return;
+
+  char statistics[160];
+  snprintf(statistics, sizeof(statistics), "\tcpu_seconds:%.6f\twait_seconds:%.6f\tprocessing_seconds:%.6f\tsentences:%zu\ttokens:%zu",
+           accounting->cpu_microseconds.load() / 1e6, accounting->wait_microseconds / 1e6, accounting->processing_microseconds / 1e6,
+           accounting->sentences, accounting->tokens);
+  record.append(statistics);
+}
+
+bool nametag_service::rest_response_generator::accounted_next() {
+  if (!accounting) return next(first);
+
+  auto start = chrono::steady_clock::now();
+  int64_t cpu_start = thread_cpu_microseconds();
+  accounting->next_thread = this_thread::get_id();
+  bool generated = next(first);
+  accounting->next_thread = thread::id();
+  accounting->cpu_microseconds.fetch_add(thread_cpu_microseconds() - cpu_start, memory_order_relaxed);
+  accounting->processing_microseconds += chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+  return generated;
+}
+
+int64_t nametag_service::rest_response_generator::thread_cpu_microseconds() {
+#if defined(_WIN32) && !defined(__CYGWIN__)
+  FILETIME creation, exit, kernel, user;
+  if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user)) return 0;
+  return ((int64_t(kernel.dwHighDateTime) << 32 | kernel.dwLowDateTime) + (int64_t(user.dwHighDateTime) << 32 | user.dwLowDateTime)) / 10;
+#else
+  timespec cpu;
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu)) return 0;
+  return int64_t(cpu.tv_sec) * 1000000 + cpu.tv_nsec / 1000;
+#endif
+}
+
+void nametag_service::rest_response_generator::consume(size_t length) {
+  if (method) method->response_bytes.fetch_add(length, memory_order_relaxed);
+  json_response_generator::consume(length);
 }
 
 bool nametag_service::rest_response_generator::generate() {
   if (last) return false;
 
-  if (!next(first)) {
+  // When the deadline is exceeded, the result is closed and an error is reported
+  if (has_deadline && chrono::steady_clock::now() > deadline) {
+    while (json.depth() > 1) json.close();
+    json.indent().key("error").indent().value("The request timeout was exceeded.\n").finish(true);
+    return !(last = true);
+  }
+
+  // Every generated part of the response is traced, identified by the generator
+  NAMETAG_TRACE1(response_start, (const void*) this);
+  bool generated;
+  if (workers_service) {
+    // The time until a worker starts running next is accounted as waiting
+    auto submitted = accounting ? chrono::steady_clock::now() : chrono::steady_clock::time_point();
+    workers_service->workers.run([this, &generated, submitted]{
+      if (accounting) accounting->wait_microseconds += chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - submitted).count();
+      generated = accounted_next();
+    }, low_priority);
+  } else {
+    generated = accounted_next();
+  }
+
+  if (!generated) {
     json.finish(true);
     last = true;
   }
   first = false;
+  NAMETAG_TRACE2(response_end, (const void*) this, last);
   return true;
 }
 
@@ -120,77 +683,561 @@ bool nametag_service::rest_output_mode::parse(const string& str, rest_output_mod
   if (str.compare("xml") == 0) return output.mode = XML, true;
   if (str.compare("vertical") == 0) return output.mode = VERTICAL, true;
   if (str.compare("conll") == 0) return output.mode = CONLL, true;
+  if (str.compare("compact") == 0) return output.mode = COMPACT, true;
+  if (str.compare("sentences") == 0) return output.mode = SENTENCES, true;
   return false;
 }
 
 // REST service handlers
 
+bool nametag_service::handle_rest_metrics(microrestd::rest_request& req) {
+  if (!metrics) return req.respond_not_found();
+
+  string text;
+  auto metric = [&text](const char* name, const char* type, const char* help) {
+    text.append("# HELP ").append(name).append(" ").append(help).append("\n# TYPE ").append(name).append(" ").append(type).push_back('\n');
+  };
+
+  metric("nametag_requests_total", "counter", "Number of requests by method.");
+  for (auto&& method : metrics->methods)
+    text.append("nametag_requests_total{method=\"").append(method.first, 1, string::npos).append("\"} ")
+        .append(to_string(method.second.requests.load(memory_order_relaxed))).push_back('\n');
+  metric("nametag_request_bytes_total", "counter", "Size of the request bodies and arguments by method.");
+  for (auto&& method : metrics->methods)
+    text.append("nametag_request_bytes_total{method=\"").append(method.first, 1, string::npos).append("\"} ")
+        .append(to_string(method.second.request_bytes.load(memory_order_relaxed))).push_back('\n');
+  metric("nametag_response_bytes_total", "counter", "Size of the streamed responses by method.");
+  for (auto&& method : metrics->methods)
+    text.append("nametag_response_bytes_total{method=\"").append(method.first, 1, string::npos).append("\"} ")
+        .append(to_string(method.second.response_bytes.load(memory_order_relaxed))).push_back('\n');
+  metric("nametag_response_duration_seconds", "histogram", "Duration of the streamed responses by method.");
+  for (auto&& method : metrics->methods)
+    method.second.latency.output(text, "nametag_response_duration_seconds", "method=\"" + method.first.substr(1) + "\"");
+
+  if (request_accounting) {
+    metric("nametag_request_cpu_seconds", "histogram", "CPU time of the threads processing the streamed responses by method.");
+    for (auto&& method : metrics->methods)
+      method.second.cpu.output(text, "nametag_request_cpu_seconds", "method=\"" + method.first.substr(1) + "\"");
+    auto counter = [this, &text, &metric](const char* name, const char* help, atomic<size_t> method_metrics::*value, bool microseconds) {
+      metric(name, "counter", help);
+      for (auto&& method : metrics->methods) {
+        size_t total = (method.second.*value).load(memory_order_relaxed);
+        text.append(name).append("{method=\"").append(method.first, 1, string::npos).append("\"} ")
+            .append(microseconds ? to_string(total / 1000000).append(".").append(to_string(1000000 + total % 1000000).substr(1)) : to_string(total)).push_back('\n');
+      }
+    };
+    counter("nametag_request_wait_seconds_total", "Time the streamed responses waited for the workers by method.", &method_metrics::wait_microseconds, true);
+    counter("nametag_request_processing_seconds_total", "Time spent generating the streamed responses by method.", &method_metrics::processing_microseconds, true);
+    counter("nametag_request_sentences_total", "Number of sentences of the streamed responses by method.", &method_metrics::sentences, false);
+    counter("nametag_request_tokens_total", "Number of tokens of the streamed responses by method.", &method_metrics::tokens, false);
+  }
+
+  metric("nametag_stage_duration_seconds", "histogram", "Duration of processing single sentences by stage.");
+  metrics->tokenize.output(text, "nametag_stage_duration_seconds", "stage=\"tokenize\"");
+  metrics->recognize.output(text, "nametag_stage_duration_seconds", "stage=\"recognize\"");
+
+  metric("nametag_workers", "gauge", "Number of recognition worker threads.");
+  text.append("nametag_workers ").append(to_string(workers.workers())).push_back('\n');
+  metric("nametag_admitted_recognitions", "gauge", "Recognition requests being processed or waiting for workers.");
+  text.append("nametag_admitted_recognitions ").append(to_string(admitted.load())).push_back('\n');
+
+  metric("nametag_model_loaded", "gauge", "Whether the model is loaded.");
+  string admitted_metrics, cascade_metrics, cache_metrics, sentence_cache_metrics, pooled_metrics, stage_metrics, template_metrics[4];
+  vector<string> stages;
+  vector<double> seconds;
+  vector<feature_template_statistics> templates;
+  for (auto& model : models) {
+    if (model.max_requests)
+      admitted_metrics.append("nametag_model_admitted_recognitions{model=\"").append(model.rest_id).append("\"} ")
+          .append(to_string(model.admitted_requests->load())).push_back('\n');
+    if (model.screening_model >= 0) {
+      cascade_metrics.append("nametag_cascade_sentences_total{model=\"").append(model.rest_id).append("\",result=\"screened\"} ")
+          .append(to_string(model.screened_sentences->load(memory_order_relaxed))).push_back('\n');
+      cascade_metrics.append("nametag_cascade_sentences_total{model=\"").append(model.rest_id).append("\",result=\"recognized\"} ")
+          .append(to_string(model.cascaded_sentences->load(memory_order_relaxed))).push_back('\n');
+    }
+
+    auto loaded = use_if_loaded(model);
+    text.append("nametag_model_loaded{model=\"").append(model.rest_id).append("\"} ").append(loaded ? "1" : "0").push_back('\n');
+    if (!loaded) continue;
+
+    size_t hits, misses;
+    loaded->ner->analysis_cache_statistics(hits, misses);
+    cache_metrics.append("nametag_analysis_cache_lookups_total{model=\"").append(model.rest_id).append("\",result=\"hit\"} ").append(to_string(hits)).push_back('\n');
+    cache_metrics.append("nametag_analysis_cache_lookups_total{model=\"").append(model.rest_id).append("\",result=\"miss\"} ").append(to_string(misses)).push_back('\n');
+    loaded->ner->sentence_cache_statistics(hits, misses);
+    sentence_cache_metrics.append("nametag_sentence_cache_lookups_total{model=\"").append(model.rest_id).append("\",result=\"hit\"} ").append(to_string(hits)).push_back('\n');
+    sentence_cache_metrics.append("nametag_sentence_cache_lookups_total{model=\"").append(model.rest_id).append("\",result=\"miss\"} ").append(to_string(misses)).push_back('\n');
+    pooled_metrics.append("nametag_model_pooled_states{model=\"").append(model.rest_id).append("\"} ").append(to_string(loaded->ner->pooled_states())).push_back('\n');
+
+    loaded->ner->stage_profiling_statistics(stages, seconds);
+    for (unsigned i = 0; i < stages.size(); i++)
+      stage_metrics.append("nametag_model_stage_seconds_total{model=\"").append(model.rest_id).append("\",stage=\"").append(stages[i]).append("\"} ")
+          .append(to_string(seconds[i])).push_back('\n');
+
+    if (!metrics->template_statistics) continue;
+    loaded->ner->template_statistics(templates);
+    for (unsigned i = 0; i < templates.size(); i++) {
+      string labels = "{model=\"" + model.rest_id + "\",template=\"" + templates[i].name + "\",index=\"" + to_string(i) + "\"";
+      template_metrics[0].append("nametag_feature_template_calls_total").append(labels).append("} ").append(to_string(templates[i].calls)).push_back('\n');
+      template_metrics[1].append("nametag_feature_template_seconds_total").append(labels).append("} ").append(to_string(templates[i].seconds)).push_back('\n');
+      template_metrics[2].append("nametag_feature_template_features_total").append(labels).append("} ").append(to_string(templates[i].features)).push_back('\n');
+      template_metrics[3].append("nametag_feature_template_lookups_total").append(labels).append(",result=\"hit\"} ").append(to_string(templates[i].lookup_hits)).push_back('\n');
+      template_metrics[3].append("nametag_feature_template_lookups_total").append(labels).append(",result=\"miss\"} ").append(to_string(templates[i].lookups - templates[i].lookup_hits)).push_back('\n');
+    }
+  }
+  if (!admitted_metrics.empty()) {
+    metric("nametag_model_admitted_recognitions", "gauge", "Recognition requests of the models with limited requests being processed.");
+    text.append(admitted_metrics);
+  }
+  if (!cascade_metrics.empty()) {
+    metric("nametag_cascade_sentences_total", "counter", "Sentences of the cascaded models screened out by their screening models or recognized by them.");
+    text.append(cascade_metrics);
+  }
+  metric("nametag_analysis_cache_lookups_total", "counter", "Hits and misses of the analysis caches of the loaded models.");
+  text.append(cache_metrics);
+  metric("nametag_sentence_cache_lookups_total", "counter", "Hits and misses of the sentence caches of the loaded models.");
+  text.append(sentence_cache_metrics);
+  metric("nametag_model_pooled_states", "gauge", "Recognition working states kept for reuse by the threads of the loaded models.");
+  text.append(pooled_metrics);
+  metric("nametag_model_stage_seconds_total", "counter", "Time spent in the recognition stages of the loaded models, summed over all threads.");
+  text.append(stage_metrics);
+
+  if (metrics->template_statistics) {
+    metric("nametag_feature_template_calls_total", "counter", "Number of feature template invocations by model and template.");
+    text.append(template_metrics[0]);
+    metric("nametag_feature_template_seconds_total", "counter", "Time spent in the feature templates by model and template.");
+    text.append(template_metrics[1]);
+    metric("nametag_feature_template_features_total", "counter", "Number of features added by the feature templates by model and template.");
+    text.append(template_metrics[2]);
+    metric("nametag_feature_template_lookups_total", "counter", "Hits and misses of the feature key lookups by model and template.");
+    text.append(template_metrics[3]);
+  }
+
+  return req.respond("text/plain; version=0.0.4", text);
+}
+
 bool nametag_service::handle_rest_models(microrestd::rest_request& req) {
   return req.respond(json_mime, json_models);
 }
 
+void nametag_service::recognize_sentence(const model_info& model, bool with_confidences, bool pretagged, const vector<string>& entity_types,
+                                         metrics_info* metrics, sentence_batcher* batcher, sentence_info& sentence) {
+  const Ner* ner = model.ner.get();
+  auto start = metrics ? chrono::steady_clock::now() : chrono::steady_clock::time_point();
+  if (pretagged) {
+    // Only the forms of the recognized tokens are kept
+    ner->recognize_pretagged(sentence.forms, sentence.entities);
+    for (auto&& form : sentence.forms)
+      form.len = find(form.str, form.str + form.len, ' ') - form.str;
+  } else if (model.screening && screen_sentence(model, sentence)) {
+    sentence.entities.clear();
+    sentence.confidences.clear();
+  } else if (with_confidences) {
+    if (!ner->recognize_with_confidences(sentence.forms, sentence.entities, sentence.confidences))
+      sentence.confidences.assign(sentence.entities.size(), 1.);
+  } else if (batcher) {
+    batcher->recognize(ner, sentence.forms, sentence.entities);
+  } else if (!entity_types.empty()) {
+    // The context is created by the first recognized sentence of the request
+    if (!sentence.entity_types_context) {
+      sentence.entity_types_context.reset(ner->new_context());
+      sentence.entity_types_context->set_entity_types(entity_types);
+    }
+    ner->recognize(sentence.forms, sentence.entities, *sentence.entity_types_context);
+  } else {
+    ner->recognize(sentence.forms, sentence.entities);
+  }
+  if (metrics) metrics->recognize.observe(start);
+  if (!entity_types.empty()) filter_entity_types(entity_types, sentence);
+
+  struct named_entity_comparator {
+    static bool lt(const named_entity& a, const named_entity& b) {
+      return a.start < b.start || (a.start == b.start && a.length > b.length);
+    }
+  };
+  auto& entities = sentence.entities;
+  auto& confidences = sentence.confidences;
+
+  // Many models return entities sorted -- it is worthwhile to check that.
+  if (is_sorted(entities.begin(), entities.end(), named_entity_comparator::lt)) return;
+
+  if (confidences.empty()) {
+    sort(entities.begin(), entities.end(), named_entity_comparator::lt);
+  } else {
+    // Sort the confidences together with the entities
+    auto& sorted = sentence.sorted;
+    sorted.clear();
+    for (unsigned i = 0; i < entities.size(); i++)
+      sorted.emplace_back(entities[i], confidences[i]);
+    sort(sorted.begin(), sorted.end(), [](const pair<named_entity, double>& a, const pair<named_entity, double>& b) {
+      return named_entity_comparator::lt(a.first, b.first);
+    });
+    for (unsigned i = 0; i < entities.size(); i++)
+      entities[i] = sorted[i].first, confidences[i] = sorted[i].second;
+  }
+}
+
+void nametag_service::filter_entity_types(const vector<string>& entity_types, sentence_info& sentence) {
+  auto& entities = sentence.entities;
+  auto& confidences = sentence.confidences;
+  size_t kept = 0;
+  for (size_t i = 0; i < entities.size(); i++)
+    if (binary_search(entity_types.begin(), entity_types.end(), entities[i].type)) {
+      if (kept != i) {
+        swap(entities[kept], entities[i]);
+        if (!confidences.empty()) confidences[kept] = confidences[i];
+      }
+      kept++;
+    }
+  entities.resize(kept);
+  if (!confidences.empty()) confidences.resize(kept);
+}
+
+bool nametag_service::screen_sentence(const model_info& model, sentence_info& sentence) {
+  // The probability of no entities is the probability of the best decoding
+  // if it is empty; without n-best decoding, any found entity is a candidate
+  bool screened;
+  auto& decodings = sentence.screening_decodings;
+  auto& probabilities = sentence.screening_probabilities;
+  if (model.screening->recognize_nbest(sentence.forms, 1, decodings, probabilities)) {
+    screened = decodings.empty() || (decodings[0].empty() && probabilities[0] >= model.screening_probability);
+  } else {
+    model.screening->recognize(sentence.forms, sentence.entities);
+    screened = sentence.entities.empty();
+  }
+
+  (screened ? model.screened_sentences : model.cascaded_sentences)->fetch_add(1, memory_order_relaxed);
+  return screened;
+}
+
+microrestd::rest_upload_processor* nametag_service::new_upload_processor(microrestd::rest_request& req) {
+  if (!stream_uploads || req.url != "/recognize") return nullptr;
+  if (req.params.count("input") && req.params["input"] == "tagged") return nullptr;
+
+  // Errors are reported when handling the request
+  string error;
+  auto model = load_rest_model(get_rest_model_id(req), error);
+  if (!model) return nullptr;
+  auto tokenizer = get_tokenizer(req, model.get(), error);
+  if (!tokenizer) return nullptr;
+  bool vertical = req.params.count("input") && req.params["input"] == "vertical";
+
+  return new recognize_upload_processor(model, move(tokenizer), vertical, req.params.count("confidences"), metrics.get());
+}
+
+void nametag_service::recognize_upload_processor::process(microrestd::rest_request& /*req*/, const string& key, const string& value, size_t part_length) {
+  if (key != "data") return;
+
+  // Start again if a new value of the data is being received
+  if (value.size() - part_length != received) {
+    sentences.clear();
+    form_offsets.clear();
+    recognized = scanned = 0;
+  }
+  received = value.size();
+
+  // Find the last blank line, at which the tokenizers usually end a sentence
+  size_t end = recognized;
+  for (size_t i = max(scanned, recognized + 1); i < received; i++)
+    if (value[i] == '\n' && value[i - 1] == '\n') end = i + 1;
+  scanned = received;
+  if (end == recognized) return;
+
+  tokenizer->set_text(string_piece(value.data() + recognized, end - recognized));
+  for (sentence_info sentence; ; ) {
+    auto start = metrics ? chrono::steady_clock::now() : chrono::steady_clock::time_point();
+    bool tokenized = tokenizer->next_sentence(&sentence.forms, nullptr);
+    if (metrics) metrics->tokenize.observe(start);
+    if (!tokenized) break;
+
+    recognize_sentence(*model, confidences, false, {}, metrics, nullptr, sentence);
+    for (auto&& form : sentence.forms)
+      form_offsets.push_back(form.str - value.data());
+    sentences.push_back(sentence);
+  }
+  recognized = end;
+}
+
 bool nametag_service::handle_rest_recognize(microrestd::rest_request& req) {
+  return handle_recognize(req, false);
+}
+
+bool nametag_service::handle_rest_recognize_batch(microrestd::rest_request& req) {
+  return handle_recognize(req, true);
+}
+
+bool nametag_service::handle_recognize(microrestd::rest_request& req, bool batch) {
   string error;
   auto rest_id = get_rest_model_id(req);
   auto model = load_rest_model(rest_id, error);
   if (!model) return req.respond_error(error);
 
-  auto data = get_data(req, error); if (!data) return req.respond_error(error);
-  unique_ptr<Tokenizer> tokenizer(get_tokenizer(req, model, error)); if (!tokenizer) return req.respond_error(error);
+  const char* data = nullptr;
+  vector<string> documents;
+  if (batch) {
+    // The documents are in the request body, or in the data argument when the
+    // body was sent as a form (for example by curl -d)
+    auto data_it = req.params.find("data");
+    if (req.body.empty() && data_it == req.params.end())
+      return req.respond_error("The documents are missing, expected a JSON array or NDJSON of documents in the request body or in the 'data' argument.\n");
+    if (!parse_documents(req.body.empty() ? data_it->second : req.body, documents, error)) return req.respond_error(error);
+  } else {
+    data = get_data(req, error); if (!data) return req.respond_error(error);
+  }
+  auto tokenizer = get_tokenizer(req, model.get(), error); if (!tokenizer) return req.respond_error(error);
+  bool tagged = req.params.count("input") && req.params["input"] == "tagged";
+  bool vertical = tagged || (req.params.count("input") && req.params["input"] == "vertical");
   rest_output_mode output(XML); if (!get_output_mode(req, output, error)) return req.respond_error(error);
+  bool confidences = req.params.count("confidences");
+  if (confidences && tagged) return req.respond_error("The confidences are not supported with tagged input.\n");
+  if (output.mode == SENTENCES) return req.respond_error("Unsupported output mode 'sentences'");
+  if (confidences && output.mode == CONLL) return req.respond_error("The confidences are not supported with CoNLL output.\n");
+  if (confidences && output.mode == COMPACT) return req.respond_error("The confidences are not supported with compact output.\n");
+  double timeout; if (!get_timeout(req, timeout, error)) return req.respond_error(error);
+  vector<string> entity_types; if (!get_entity_types(req, model.get(), entity_types, error)) return req.respond_error(error);
+  if (!admit_request()) return req.respond_service_unavailable("Too many recognition requests are being processed, retry later.\n", 1);
+  if (!model->admit_request()) {
+    if (max_admitted) admitted.fetch_sub(1);
+    return req.respond_service_unavailable("Too many recognition requests of the model are being processed, retry later.\n", 1);
+  }
+
+  // Reuse the sentences recognized while the data were received, if they were
+  // recognized the same way and the data were not received again
+  recognize_upload_processor* uploaded = nullptr;
+  if (!batch && req.upload_processor) {
+    auto processor = static_cast<recognize_upload_processor*>(req.upload_processor.get());
+    if (processor->model.get() == model.get() && processor->vertical == vertical && processor->confidences == confidences &&
+        processor->received == strlen(data))
+      uploaded = processor;
+  }
 
   class generator : public rest_response_generator {
    public:
-    generator(const model_info* model, const char* data, const Ner* ner, Tokenizer* tokenizer, rest_output_mode output)
-        : rest_response_generator(model, output), ner(ner), tokenizer(tokenizer), unprinted(data) {
-      tokenizer->set_text(data);
+    generator(const shared_ptr<const model_info>& model, const char* data, vector<string>& documents, bool batch, sentence_batcher* batcher,
+              pooled_tokenizer&& tokenizer, bool vertical, bool tagged, rest_output_mode output, bool confidences, vector<string>& entity_types,
+              unsigned parallel_sentences, bool low_priority, recognize_upload_processor* uploaded)
+        : rest_response_generator(model, output), batcher(batcher), tokenizer(move(tokenizer)), vertical(vertical), tagged(tagged), unprinted(data),
+          with_confidences(confidences), batch(batch), sentences(parallel_sentences) {
+      this->entity_types.swap(entity_types);
+      this->low_priority = low_priority;
+      if (batch) {
+        // The results of the documents are stored in an array, using the same
+        // tokenizer for all documents
+        this->documents.swap(documents);
+        json.array();
+        if (!this->documents.empty()) start_document();
+      } else {
+        if (uploaded) {
+          uploaded_sentences.swap(uploaded->sentences);
+          uploaded_form_offsets.swap(uploaded->form_offsets);
+        }
+        this->tokenizer->set_text(data);
+        text = data;
+        // The uploaded sentences are reused only when tokenizing sequentially
+        if (uploaded_sentences.empty()) start_segments(strlen(data));
+        if (output.mode == COMPACT) json.array();
+      }
     }
 
-    void sort_entities(vector<named_entity>& entities) {
-      struct named_entity_comparator {
-        static bool lt(const named_entity& a, const named_entity& b) {
-          return a.start < b.start || (a.start == b.start && a.length > b.length);
-        }
-      };
+    void start_document() {
+      unprinted = text = documents[document].c_str();
+      tokenizer->set_text(unprinted);
+      tokenized = false;
+      start_segments(documents[document].size());
+      total_tokens = 0;
+      if (output.mode == COMPACT) {
+        if (document) json.close();
+        json.indent().array();
+      } else {
+        json.indent().value("");
+      }
+    }
+
+    // When several sentences are recognized in parallel, a large text is also
+    // tokenized in parallel, by splitting it after blank lines following a
+    // printable character (at which the tokenizers always end a sentence,
+    // unlike after other whitespace) into segments of roughly segment_size
+    // bytes, which are tokenized and recognized by separate tokenizers.
+    // The texts of low priority requests are not split, so that their jobs
+    // stay short.
+    struct segment_info {
+      string_piece text;
+      pooled_tokenizer tokenizer;
+      vector<sentence_info> sentences;
+      unsigned sentences_size = 0;
+    };
+    enum { segment_size = 1 << 16 };
+
+    void start_segments(size_t text_len) {
+      segment_start = nullptr;
+      if (sentences.size() <= 1 || low_priority || text_len < 2 * segment_size) return;
+
+      segment_start = text;
+      text_end = text + text_len;
+      if (segments.empty()) segments.resize(sentences.size());
+    }
+
+    void recognize(sentence_info& sentence) {
+      recognize_sentence(*model, with_confidences, tagged, entity_types, metrics, batcher, sentence);
+    }
+
+    // Reuse the entities of the sentence recognized while the data were
+    // received, if it was tokenized the same way
+    bool reuse_uploaded(sentence_info& sentence) {
+      if (uploaded_next >= uploaded_sentences.size() || sentence.forms.empty()) return false;
+
+      size_t start = sentence.forms.front().str - text;
+      while (uploaded_next < uploaded_sentences.size() && uploaded_form_offsets[uploaded_form_next] < start)
+        uploaded_form_next += uploaded_sentences[uploaded_next++].forms.size();
+      if (uploaded_next >= uploaded_sentences.size()) return false;
 
-      // Many models return entities sorted -- it is worthwhile to check that.
-      if (!is_sorted(entities.begin(), entities.end(), named_entity_comparator::lt))
-        sort(entities.begin(), entities.end(), named_entity_comparator::lt);
+      auto& uploaded = uploaded_sentences[uploaded_next];
+      if (uploaded.forms.size() != sentence.forms.size()) return false;
+      for (size_t i = 0; i < sentence.forms.size(); i++)
+        if (uploaded_form_offsets[uploaded_form_next + i] != size_t(sentence.forms[i].str - text) || uploaded.forms[i].len != sentence.forms[i].len)
+          return false;
+
+      sentence.entities.swap(uploaded.entities);
+      sentence.confidences.swap(uploaded.confidences);
+      if (!entity_types.empty()) filter_entity_types(entity_types, sentence);
+      uploaded_form_next += uploaded_sentences[uploaded_next++].forms.size();
+      return true;
     }
 
     bool next(bool /*first*/) {
-      if (!tokenizer->next_sentence(&forms, nullptr)) {
+      if (batch && document >= documents.size()) return false;
+
+      while (!(segment_start ? next_segments() : next_sentences())) {
         if (output.mode == XML && *unprinted) json.value_xml_escape(unprinted, true);
-        return false;
+        if (!batch || ++document >= documents.size()) return false;
+        start_document();
+      }
+      return true;
+    }
+
+    bool next_sentences() {
+      // Tokenize the following sentences of the current document
+      unsigned sentences_size = 0;
+      while (!tokenized && sentences_size < sentences.size()) {
+        auto start = metrics ? chrono::steady_clock::now() : chrono::steady_clock::time_point();
+        if (tokenizer->next_sentence(&sentences[sentences_size].forms, nullptr))
+          sentences_size++;
+        else
+          tokenized = true;
+        if (metrics) metrics->tokenize.observe(start);
+      }
+      if (!sentences_size) return false;
+
+      // Recognize them, in parallel when possible, and output them in order
+      if (uploaded_reused.size() < sentences_size) uploaded_reused.resize(sentences_size);
+      for (unsigned s = 0; s < sentences_size; s++)
+        uploaded_reused[s] = reuse_uploaded(sentences[s]);
+      if (workers_service && sentences_size > 1) {
+        workers_service->workers.run_parallel(sentences_size, [this](unsigned s) {
+          if (!uploaded_reused[s]) accounted_job([this, s]{ recognize(sentences[s]); });
+        }, low_priority);
+      } else {
+        for (unsigned s = 0; s < sentences_size; s++)
+          if (!uploaded_reused[s]) recognize(sentences[s]);
+      }
+
+      for (unsigned s = 0; s < sentences_size; s++)
+        output_sentence(sentences[s]);
+      return true;
+    }
+
+    bool next_segments() {
+      // Split the following segments of the current document
+      unsigned segments_size = 0;
+      for (; segments_size < segments.size() && segment_start < text_end; segments_size++) {
+        const char* segment_end = text_end;
+        for (const char* eol = segment_start + segment_size; eol < text_end && (eol = (const char*) memchr(eol, '\n', text_end - eol)); eol++)
+          if (eol + 1 < text_end && eol[1] == '\n' && (unsigned char) eol[-1] > ' ' && (unsigned char) eol[-1] < 0x80) {
+            segment_end = eol + 2;
+            break;
+          }
+
+        segments[segments_size].text = string_piece(segment_start, segment_end - segment_start);
+        segment_start = segment_end;
       }
+      if (!segments_size) return false;
 
-      ner->recognize(forms, entities);
-      sort_entities(entities);
+      // Tokenize and recognize them in parallel, and output them in order
+      if (workers_service && segments_size > 1) {
+        workers_service->workers.run_parallel(segments_size, [this](unsigned s) { accounted_job([this, s]{ tokenize_segment(segments[s]); }); }, low_priority);
+      } else {
+        for (unsigned s = 0; s < segments_size; s++)
+          tokenize_segment(segments[s]);
+      }
+
+      for (unsigned s = 0; s < segments_size; s++)
+        for (unsigned i = 0; i < segments[s].sentences_size; i++)
+          output_sentence(segments[s].sentences[i]);
+      return true;
+    }
+
+    void tokenize_segment(segment_info& segment) {
+      if (!segment.tokenizer) segment.tokenizer = vertical ? pooled_tokenizer(Tokenizer::new_vertical_tokenizer()) : model->new_tokenizer();
+      segment.tokenizer->set_text(segment.text);
+
+      for (segment.sentences_size = 0; ; segment.sentences_size++) {
+        if (segment.sentences_size >= segment.sentences.size()) segment.sentences.emplace_back();
+        auto& sentence = segment.sentences[segment.sentences_size];
+
+        auto start = metrics ? chrono::steady_clock::now() : chrono::steady_clock::time_point();
+        bool tokenized = segment.tokenizer->next_sentence(&sentence.forms, nullptr);
+        if (metrics) metrics->tokenize.observe(start);
+        if (!tokenized) break;
+
+        recognize(sentence);
+      }
+    }
+
+    void output_sentence(const sentence_info& sentence) {
+      auto& forms = sentence.forms;
+      auto& entities = sentence.entities;
+      auto& confidences = sentence.confidences;
+      account_sentence(forms.size());
 
       if (output.mode == CONLL) {
-        vector<named_entity> stack;
+        auto& stack = entity_stack;
+        stack.clear();
         for (size_t i = 0, e = 0; i < forms.size(); i++) {
           for (; e < entities.size() && entities[e].start == i; e++)
-            stack.push_back(entities[e]);
+            stack.push_back(&entities[e]);
 
           json.value(sp(forms[i]), true);
           json.value("\t", true);
           if (stack.size()) {
             for (size_t j = 0; j < stack.size(); j++) {
               if (j) json.value("|", true);
-              json.value(stack[j].start == i ? "B-" : "I-", true);
-              json.value(stack[j].type, true);
+              json.value(stack[j]->start == i ? "B-" : "I-", true);
+              json.value(stack[j]->type, true);
             }
           } else {
             json.value("O", true);
           }
 
           for (size_t j = stack.size(); j--; )
-            if (stack[j].start + stack[j].length == i + 1)
+            if (stack[j]->start + stack[j]->length == i + 1)
               stack.erase(stack.begin() + j);
           json.value("\n", true);
         }
         json.value("\n", true);
+      } else if (output.mode == COMPACT) {
+        // Every entity is [start byte, length in bytes, type index or type]
+        for (auto&& entity : entities) {
+          const string_piece& first = forms[entity.start];
+          const string_piece& last = forms[entity.start + entity.length - 1];
+          json.array().value(int(first.str - text)).value(int(last.str + last.len - first.str));
+          auto type_id = model->entity_type_ids.find(entity.type);
+          if (type_id != model->entity_type_ids.end())
+            json.value(int(type_id->second));
+          else
+            json.value(entity.type);
+          json.close();
+        }
       } else if (output.mode == VERTICAL) {
         for (auto&& entity : entities) {
           for (size_t i = entity.start; i < entity.start + entity.length; i++) {
@@ -203,6 +1250,10 @@ bool nametag_service::handle_rest_recognize(microrestd::rest_request& req) {
             if (i > entity.start) json.value(" ", true);
             json.value(sp(forms[i]), true);
           }
+          if (with_confidences) {
+            sprintf(confidence, "\t%.4f", confidences[&entity - entities.data()]);
+            json.value(confidence, true);
+          }
           json.value("\n", true);
         }
       } else {
@@ -212,7 +1263,12 @@ bool nametag_service::handle_rest_recognize(microrestd::rest_request& req) {
 
           // Open entities starting at current token
           for (; e < entities.size() && entities[e].start == i; e++) {
-            json.value("<ne type=\"", true).value_xml_escape(entities[e].type, true).value("\">", true);
+            json.value("<ne type=\"", true).value_xml_escape(entities[e].type, true);
+            if (with_confidences) {
+              sprintf(confidence, "\" confidence=\"%.4f", confidences[e]);
+              json.value(confidence, true);
+            }
+            json.value("\">", true);
             entity_ends.push_back(entities[e].start + entities[e].length - 1);
           }
 
@@ -230,20 +1286,45 @@ bool nametag_service::handle_rest_recognize(microrestd::rest_request& req) {
       }
 
       total_tokens += forms.size() + 1;
-      return true;
     }
 
    private:
-    const Ner* ner;
-    unique_ptr<Tokenizer> tokenizer;
+    sentence_batcher* batcher;
+    pooled_tokenizer tokenizer;
+    bool vertical, tagged;
+    const char* text;
     const char* unprinted;
-    vector<string_piece> forms;
-    vector<named_entity> entities;
+    bool tokenized = false;
+    vector<segment_info> segments;
+    const char* segment_start = nullptr;
+    const char* text_end = nullptr;
+    vector<const named_entity*> entity_stack;
     vector<size_t> entity_ends;
     size_t total_tokens = 0;
     char token_number[sizeof(size_t) * 3/*ceil(log_10(256))*/];
+    bool with_confidences;
+    vector<string> entity_types;
+    char confidence[32];
+    bool batch;
+    vector<string> documents;
+    size_t document = 0;
+    vector<sentence_info> sentences;
+    vector<sentence_info> uploaded_sentences;
+    vector<size_t> uploaded_form_offsets;
+    size_t uploaded_next = 0, uploaded_form_next = 0;
+    vector<char> uploaded_reused;
   };
-  return req.respond(json_mime, new generator(model, data, model->ner.get(), tokenizer.release(), output));
+  size_t input_length = batch ? req.body.size() : strlen(data);
+  bool low_priority = large_request_size && input_length > large_request_size;
+  auto response = new generator(model, data, documents, batch, batcher.get(), move(tokenizer),
+                                vertical, tagged, output, confidences, entity_types, parallel_sentences, low_priority, uploaded);
+  response->reserve_for_input(input_length);
+  response->use_timeout(timeout);
+  if (max_admitted) response->use_workers(this);
+  response->use_model_admission();
+  if (metrics) response->use_metrics(metrics.get(), get_method_metrics(req));
+  if (request_accounting) response->use_accounting();
+  return req.respond(json_mime, response);
 }
 
 bool nametag_service::handle_rest_tokenize(microrestd::rest_request& req) {
@@ -256,19 +1337,34 @@ bool nametag_service::handle_rest_tokenize(microrestd::rest_request& req) {
   auto data = get_data(req, error); if (!data) return req.respond_error(error);
   rest_output_mode output(XML); if (!get_output_mode(req, output, error)) return req.respond_error(error);
   if (output.mode == CONLL) return req.respond_error("Unsupported output mode 'conll'");
+  if (output.mode == COMPACT) return req.respond_error("Unsupported output mode 'compact'");
+  double timeout; if (!get_timeout(req, timeout, error)) return req.respond_error(error);
 
   class generator : public rest_response_generator {
    public:
-    generator(const model_info* model, const char* data, rest_output_mode output, Tokenizer* tokenizer)
-        : rest_response_generator(model, output), tokenizer(tokenizer), unprinted(data) {
-      tokenizer->set_text(data);
+    generator(const shared_ptr<const model_info>& model, const char* data, rest_output_mode output, pooled_tokenizer&& tokenizer)
+        : rest_response_generator(model, output), tokenizer(move(tokenizer)), text(data), unprinted(data) {
+      this->tokenizer->set_text(data);
+      if (output.mode == SENTENCES) json.array();
     }
 
     bool next(bool /*first*/) {
-      if (!tokenizer->next_sentence(&forms, nullptr)) {
+      auto start = metrics ? chrono::steady_clock::now() : chrono::steady_clock::time_point();
+      bool tokenized = tokenizer->next_sentence(&forms, nullptr);
+      if (metrics) metrics->tokenize.observe(start);
+      if (!tokenized) {
         if (output.mode == XML && *unprinted) json.value_xml_escape(unprinted, true);
         return false;
       }
+      account_sentence(forms.size());
+
+      if (output.mode == SENTENCES) {
+        // Every sentence is [start byte, length in bytes]
+        auto& first = forms.front();
+        auto& last = forms.back();
+        json.array().value(int(first.str - text)).value(int(last.str + last.len - first.str)).close();
+        return true;
+      }
 
       for (unsigned i = 0; i < forms.size(); i++) {
         switch (output.mode) {
@@ -281,6 +1377,8 @@ bool nametag_service::handle_rest_tokenize(microrestd::rest_request& req) {
             json.value("<token>", true).value_xml_escape(sp(forms[i]), true).value("</token>", true);
             break;
           case CONLL: // Keep the compiler happy
+          case COMPACT:
+          case SENTENCES:
             break;
         }
         unprinted = forms[i].str + forms[i].len;
@@ -292,11 +1390,17 @@ bool nametag_service::handle_rest_tokenize(microrestd::rest_request& req) {
     }
 
    private:
-    unique_ptr<Tokenizer> tokenizer;
+    pooled_tokenizer tokenizer;
+    const char* text;
     const char* unprinted;
     vector<string_piece> forms;
   };
-  return req.respond(json_mime, new generator(model, data, output, model->ner->new_tokenizer()));
+  auto response = new generator(model, data, output, model->new_tokenizer());
+  response->reserve_for_input(strlen(data));
+  response->use_timeout(timeout);
+  if (metrics) response->use_metrics(metrics.get(), get_method_metrics(req));
+  if (request_accounting) response->use_accounting();
+  return req.respond(json_mime, response);
 }
 
 // REST service helpers
@@ -315,14 +1419,103 @@ const char* nametag_service::get_data(microrestd::rest_request& req, string& err
   return data_it->second.c_str();
 }
 
-tokenizer* nametag_service::get_tokenizer(microrestd::rest_request& req, const model_info* model, string& error) {
+bool nametag_service::parse_documents(const string& body, vector<string>& documents, string& error) {
+  documents.clear();
+
+  // The documents are either a JSON array of strings, or JSON strings on
+  // separate lines (NDJSON)
+  const char* json = body.c_str();
+  const char* end = json + body.size();
+  auto skip_whitespace = [&json, end](bool newlines) {
+    while (json < end && (*json == ' ' || *json == '\t' || *json == '\r' || (newlines && *json == '\n'))) json++;
+  };
+
+  skip_whitespace(true);
+  if (json == end) return error.assign("The documents are empty, expected a JSON array or NDJSON of documents.\n"), false;
+  bool array = json < end && *json == '[';
+  if (array) json++, skip_whitespace(true);
+
+  while (json < end && !(array && *json == ']')) {
+    documents.emplace_back();
+    if (!parse_json_string(json, end, documents.back()))
+      return error.assign("Cannot parse document ").append(to_string(documents.size())).append(" as a JSON string.\n"), false;
+
+    skip_whitespace(array);
+    if (array) {
+      if (json < end && *json == ',') json++, skip_whitespace(true);
+      else if (!(json < end && *json == ']')) return error.assign("Expected ',' or ']' after a document in the JSON array.\n"), false;
+    } else {
+      if (json < end && *json != '\n') return error.assign("Expected a new line after a document in the NDJSON.\n"), false;
+      skip_whitespace(true);
+    }
+  }
+
+  if (array) {
+    if (json == end) return error.assign("Unterminated JSON array of documents.\n"), false;
+    json++, skip_whitespace(true);
+    if (json < end) return error.assign("Unexpected data after the JSON array of documents.\n"), false;
+  }
+  return true;
+}
+
+bool nametag_service::parse_json_string(const char*& json, const char* end, string& str) {
+  auto parse_hex4 = [&json, end](char32_t& chr) {
+    if (end - json < 4) return false;
+    chr = 0;
+    for (int i = 0; i < 4; i++, json++)
+      if (*json >= '0' && *json <= '9') chr = chr * 16 + *json - '0';
+      else if (*json >= 'a' && *json <= 'f') chr = chr * 16 + *json - 'a' + 10;
+      else if (*json >= 'A' && *json <= 'F') chr = chr * 16 + *json - 'A' + 10;
+      else return false;
+    return true;
+  };
+
+  str.clear();
+  if (json >= end || *json != '"') return false;
+  for (json++; json < end && *json != '"'; )
+    if (*json != '\\') {
+      str.push_back(*json++);
+    } else {
+      if (++json == end) return false;
+      char32_t chr;
+      switch (*json++) {
+        case '"': str.push_back('"'); break;
+        case '\\': str.push_back('\\'); break;
+        case '/': str.push_back('/'); break;
+        case 'b': str.push_back('\b'); break;
+        case 'f': str.push_back('\f'); break;
+        case 'n': str.push_back('\n'); break;
+        case 'r': str.push_back('\r'); break;
+        case 't': str.push_back('\t'); break;
+        case 'u':
+          if (!parse_hex4(chr)) return false;
+          if (chr >= 0xD800 && chr < 0xDC00) {
+            // A high surrogate must be followed by a low one
+            char32_t low;
+            if (end - json < 2 || json[0] != '\\' || json[1] != 'u') return false;
+            json += 2;
+            if (!parse_hex4(low) || low < 0xDC00 || low >= 0xE000) return false;
+            chr = 0x10000 + ((chr - 0xD800) << 10) + (low - 0xDC00);
+          }
+          unilib::utf8::append(str, chr);
+          break;
+        default:
+          return false;
+      }
+    }
+  if (json == end) return false;
+  json++;
+  return true;
+}
+
+nametag_service::pooled_tokenizer nametag_service::get_tokenizer(microrestd::rest_request& req, const model_info* model, string& error) {
   auto input_it = req.params.find("input");
   if (input_it == req.params.end() || input_it->second.compare("untokenized") == 0) {
-    if (!model->can_tokenize) return error.assign("No tokenizer is defined for the requested model.\n"), nullptr;
-    return model->ner->new_tokenizer();
+    if (!model->can_tokenize) return error.assign("No tokenizer is defined for the requested model.\n"), pooled_tokenizer();
+    return model->new_tokenizer();
   }
-  if (input_it->second.compare("vertical") == 0) return tokenizer::new_vertical_tokenizer();
-  return error.assign("Value '").append(input_it->second).append("' of parameter input is not either 'untokenized' or 'vertical'.\n"), nullptr;
+  if (input_it->second.compare("vertical") == 0 || input_it->second.compare("tagged") == 0) return pooled_tokenizer(tokenizer::new_vertical_tokenizer());
+  return error.assign("Value '").append(input_it->second).append("' of parameter input is not 'untokenized', 'vertical' or 'tagged'.\n"), pooled_tokenizer();
 }
 
 bool nametag_service::get_output_mode(microrestd::rest_request& req, rest_output_mode& output, string& error) {
@@ -332,5 +1525,34 @@ bool nametag_service::get_output_mode(microrestd::rest_request& req, rest_output
   return true;
 }
 
+bool nametag_service::get_entity_types(microrestd::rest_request& req, const model_info* model, vector<string>& entity_types, string& error) {
+  entity_types.clear();
+
+  auto entity_types_it = req.params.find("entity_types");
+  if (entity_types_it != req.params.end() && !entity_types_it->second.empty()) {
+    split(entity_types_it->second, ',', entity_types);
+    for (auto&& entity_type : entity_types)
+      if (!model->entity_type_ids.count(entity_type))
+        return error.assign("Unknown entity type '").append(entity_type).append("' of the requested model.\n"), false;
+    sort(entity_types.begin(), entity_types.end());
+    entity_types.erase(unique(entity_types.begin(), entity_types.end()), entity_types.end());
+  }
+  return true;
+}
+
+bool nametag_service::get_timeout(microrestd::rest_request& req, double& timeout, string& error) {
+  timeout = request_timeout;
+
+  auto timeout_it = req.params.find("timeout");
+  if (timeout_it != req.params.end()) {
+    char* end;
+    double requested = strtod(timeout_it->second.c_str(), &end);
+    if (timeout_it->second.empty() || *end || !(requested > 0))
+      return error.assign("Invalid timeout '").append(timeout_it->second).append("', it must be a positive number of seconds.\n"), false;
+    if (!timeout || requested < timeout) timeout = requested;
+  }
+  return true;
+}
+
 } // namespace nametag
 } // namespace ufal
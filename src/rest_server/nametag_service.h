@@ -9,12 +9,19 @@
 
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
 #include <unordered_map>
 
 #include "common.h"
 #include "microrestd/microrestd.h"
 #include "ner/ner.h"
+#include "sentence_batcher.h"
 #include "tokenizer/tokenizer.h"
+#include "utils/threadsafe_resource_loader.h"
+#include "utils/worker_pool.h"
 
 namespace ufal {
 namespace nametag {
@@ -25,44 +32,235 @@ class nametag_service : public microrestd::rest_service {
  public:
   typedef ufal::nametag::tokenizer Tokenizer;
   typedef ufal::nametag::ner Ner;
+  typedef ufal::nametag::ner_context NerContext;
 
   struct model_description {
     string rest_id, file, acknowledgements;
+    // At most max_requests recognition requests of the model are processed
+    // at a time (0 means no limit), the others are refused
+    unsigned max_requests = 0;
+    // If not empty, the sentences are first recognized by this cheaper model
+    // (given by its name), and only when it finds some entities, or when the
+    // probability of no entities is less than screening_probability, they
+    // are recognized by this model too
+    string screening_model;
+    double screening_probability = 0;
+    // Skip the sentences without candidates of entities, see
+    // ner::set_candidate_prefilter
+    bool candidate_prefilter = false;
 
     model_description(string rest_id, string file, string acknowledgements)
         : rest_id(rest_id), file(file), acknowledgements(acknowledgements) {}
   };
 
-  bool init(const vector<model_description>& model_descriptions);
+  // Load the models. If max_loaded_models is nonzero, every model is only
+  // verified and released, and at most the given number of models are kept
+  // loaded at a time, loading them on demand and releasing the least recently
+  // used unused ones. The models are loaded by load_threads threads.
+  bool init(const vector<model_description>& model_descriptions, size_t analysis_cache = 0, int max_sentence_length = 0,
+            unsigned max_loaded_models = 0, size_t sentence_cache = 0, unsigned load_threads = 1);
+
+  // Load the models from copies of their files kept in named shared memory
+  // segments, whose names start with the given prefix, so that the pages of
+  // the models are shared by all server processes using the same prefix,
+  // see utils::memory_streambuf::map_shared_memory. Must be called before init.
+  void set_shared_memory(const string& prefix) { shared_memory = prefix; }
+
+  // Perform the recognition using the given number of worker threads instead
+  // of the connection threads, admitting at most max_queued recognition
+  // requests in addition to the recognized ones and refusing the others.
+  // The workers recognize up to parallel_sentences sentences of a request in
+  // parallel, tokenizing also up to parallel_sentences segments of a large
+  // document in parallel. The recognition of inputs larger than
+  // large_request_size bytes (if nonzero) runs with a low priority, yielding
+  // the workers to the other requests after every parallel_sentences
+  // sentences, and large documents are not split into parallel segments then.
+  // Returns the number of started workers; must be called before
+  // starting the server (and after daemonizing, which does not retain threads).
+  unsigned start_workers(unsigned workers, unsigned max_queued, unsigned parallel_sentences = 1, size_t large_request_size = 0);
+
+  // Recognize the given text using every loaded model, by as many concurrent
+  // jobs as there are workers, so that the model data are paged in and the
+  // per-thread caches allocated before serving. Must be called after
+  // start_workers and before starting the server.
+  void warm_up(const string& text);
+
+  // Stop generating the responses taking longer than the given number of
+  // seconds (0 means no limit); the clients can also request a shorter timeout
+  void set_request_timeout(unsigned seconds) { request_timeout = seconds; }
+
+  // Reload out-of-model gazetteers of all models, concurrently with requests
+  bool reload_gazetteers();
+
+  // Reload the model files concurrently with requests, replacing the models
+  // only after all of them are loaded (and warmed up using the warm-up text,
+  // if any). The requests being processed finish using the previous models,
+  // which are freed afterwards. Not supported for models loaded on demand.
+  bool reload_models();
+
+  // Log hits and misses of analysis caches of all models
+  void log_cache_statistics();
+
+  // Collect the metrics exported by the /metrics method, which is not
+  // available otherwise, optionally including the statistics of the feature
+  // templates of the models. Must be called before starting the server.
+  void enable_metrics(bool template_statistics = false);
+
+  // Account the costs of every recognize and tokenize request, i.e., the CPU
+  // time of its threads, the time spent waiting for the workers and processing
+  // and the numbers of its sentences and tokens, reporting them in the log
+  // record of the completed request and in the metrics, if enabled.
+  void enable_request_accounting() { request_accounting = true; }
+
+  // Recognize the data of the recognize method posted in a form encoded body
+  // while the body is being received, up to its last blank line, in the
+  // thread receiving the request. When the request is handled, the sentences
+  // of the whole data which were tokenized the same way reuse their entities.
+  void set_stream_uploads(bool stream_uploads) { this->stream_uploads = stream_uploads; }
+
+  // Recognize the sentences of concurrent requests (without confidences) in
+  // batches of up to max_sentences sentences, waiting at most
+  // max_wait_microseconds for a batch to be collected while a previous batch
+  // of the model is recognized. Must be called before starting the server.
+  void set_sentence_batching(unsigned max_sentences, unsigned max_wait_microseconds);
+
+  // Recognize the text using the model with the given name (the default one
+  // if the name is empty) outside of the REST service, by the workers if they
+  // were started, observing the request timeout. The start and length of the
+  // returned entities are in bytes of the text. On failure, the error is
+  // filled and unavailable is set when too many recognitions are admitted.
+  bool recognize_text(const string& model_name, string_piece text, bool vertical, vector<named_entity>& entities,
+                      string& error, bool& unavailable);
 
   virtual bool handle(microrestd::rest_request& req) override;
+  virtual microrestd::rest_upload_processor* new_upload_processor(microrestd::rest_request& req) override;
 
  private:
   static unordered_map<string, bool (nametag_service::*)(microrestd::rest_request&)> handlers;
 
   // Models
+  struct model_info;
+
+  // Return the tokenizers of the model to its pool when destroyed, deleting
+  // the tokenizers without a model
+  struct tokenizer_deleter {
+    tokenizer_deleter() : model(nullptr) {}
+    tokenizer_deleter(const model_info* model) : model(model) {}
+    const model_info* model;
+    void operator()(Tokenizer* tokenizer) const;
+  };
+  typedef unique_ptr<Tokenizer, tokenizer_deleter> pooled_tokenizer;
+
   struct model_info {
-    model_info(const string& rest_id, ner* ner, const string& acknowledgements)
-        : rest_id(rest_id), ner(ner), acknowledgements(acknowledgements) {
-      unique_ptr<Tokenizer> tokenizer(ner->new_tokenizer());
-      can_tokenize = tokenizer != nullptr;
-    }
+    model_info(const string& rest_id, const string& file, const string& acknowledgements, size_t analysis_cache, int max_sentence_length, size_t sentence_cache)
+        : rest_id(rest_id), file(file), acknowledgements(acknowledgements), analysis_cache(analysis_cache), max_sentence_length(max_sentence_length),
+          sentence_cache(sentence_cache) {}
+
+    // Load and release the model, used by the threadsafe_resource_loader;
+    // the screening model is loaded from its file only if requested, otherwise
+    // it is shared with the screening model afterwards by the caller
+    bool load(bool with_screening = true);
+    void release();
+    // Share the loaded recognizer of another model with the same file
+    void share(const model_info& other);
+    // Create a model with the same settings, which is not loaded
+    shared_ptr<model_info> clone_settings() const;
+
+    // Borrow a tokenizer of the model, reusing the tokenizers returned by
+    // previous requests
+    pooled_tokenizer new_tokenizer() const;
+
+    // Admit a recognition request of the model unless max_requests of them
+    // are being processed, counting the requests of all versions of the model
+    bool admit_request() const;
+    void release_request() const;
 
     string rest_id;
-    unique_ptr<Ner> ner;
-    bool can_tokenize;
+    string file;
+    // The prefix of the shared memory segments, if the model is loaded from them
+    string shared_memory;
+    shared_ptr<Ner> ner;
+    bool can_tokenize = false;
     string acknowledgements;
+    vector<string> entity_types;
+    unordered_map<string, unsigned> entity_type_ids;
+    size_t analysis_cache;
+    int max_sentence_length;
+    size_t sentence_cache;
+    bool stage_profiling = false;
+    bool candidate_prefilter = false;
+    unsigned loader_id = 0;
+    // Without loading on demand, the requests use the current version of
+    // the model, replaced when the model is reloaded
+    shared_ptr<const model_info> current;
+    unsigned max_requests = 0;
+    shared_ptr<atomic<unsigned>> admitted_requests = make_shared<atomic<unsigned>>(0);
+    // The cheaper model of a cascade, see model_description::screening_model,
+    // and the numbers of sentences it screened out and passed to this model
+    string screening_file;
+    int screening_model = -1;
+    double screening_probability = 0;
+    shared_ptr<Ner> screening;
+    shared_ptr<atomic<size_t>> screened_sentences = make_shared<atomic<size_t>>(0);
+    shared_ptr<atomic<size_t>> cascaded_sentences = make_shared<atomic<size_t>>(0);
+
+    // At most max_pooled returned tokenizers are kept
+    struct tokenizer_pool {
+      enum { max_pooled = 64 };
+      mutex lock;
+      vector<unique_ptr<Tokenizer>> tokenizers;
+    };
+    unique_ptr<tokenizer_pool> tokenizers{new tokenizer_pool()};
   };
   vector<model_info> models;
-  unordered_map<string, const model_info*> rest_models_map;
+  unordered_map<string, model_info*> rest_models_map;
+  unique_ptr<threadsafe_resource_loader<model_info>> loader;
+  string shared_memory;
+
+  // The returned model stays loaded until the last copy of the pointer is destroyed
+  shared_ptr<const model_info> load_rest_model(const string& rest_id, string& error);
+  // Use the model only if it is loaded, without loading it
+  shared_ptr<const model_info> use_if_loaded(model_info& model);
 
-  const model_info* load_rest_model(const string& rest_id, string& error);
+  void warm_up_model(const model_info& model);
+  string warm_up_text;
+
+  // Metrics, collected only when enabled
+  struct latency_histogram {
+    enum { BUCKETS = 19 };
+    static const unsigned bucket_microseconds[BUCKETS];
+    static const char* bucket_labels[BUCKETS];
+    atomic<size_t> counts[BUCKETS + 1];
+    atomic<size_t> total_microseconds;
+
+    latency_histogram();
+    void observe(chrono::steady_clock::time_point start);
+    void observe_microseconds(size_t microseconds);
+    void output(string& text, const string& name, const string& labels) const;
+  };
+  struct method_metrics {
+    atomic<size_t> requests{0}, request_bytes{0}, response_bytes{0};
+    latency_histogram latency;
+    // Collected only with the request accounting
+    latency_histogram cpu;
+    atomic<size_t> wait_microseconds{0}, processing_microseconds{0}, sentences{0}, tokens{0};
+  };
+  struct metrics_info {
+    unordered_map<string, method_metrics> methods;
+    latency_histogram tokenize, recognize;
+    bool template_statistics = false;
+  };
+  unique_ptr<metrics_info> metrics;
+  method_metrics* get_method_metrics(microrestd::rest_request& req);
+  bool request_accounting = false;
 
   // REST service
   enum rest_output_mode_t {
     XML,
     VERTICAL,
     CONLL,
+    COMPACT,
+    SENTENCES,
   };
   struct rest_output_mode {
     rest_output_mode_t mode;
@@ -71,31 +269,147 @@ class nametag_service : public microrestd::rest_service {
     static bool parse(const string& mode, rest_output_mode& output);
   };
 
+  struct sentence_info {
+    vector<string_piece> forms;
+    vector<named_entity> entities;
+    vector<double> confidences;
+    vector<pair<named_entity, double>> sorted;
+    vector<vector<named_entity>> screening_decodings;
+    vector<double> screening_probabilities;
+    // Context of the model returning only the requested entity types
+    shared_ptr<NerContext> entity_types_context;
+  };
+  // Recognize the sentence by the model (using its screening model first, if
+  // any), sorting its entities; the forms of a pretagged sentence are
+  // truncated to the forms of its tokens afterwards. If entity_types are not
+  // empty, only the entities of these sorted types are kept, and when the
+  // sentence is not batched, the others are not even produced by the model.
+  static void recognize_sentence(const model_info& model, bool with_confidences, bool pretagged, const vector<string>& entity_types,
+                                 metrics_info* metrics, sentence_batcher* batcher, sentence_info& sentence);
+  // Keep only the entities (and confidences) of the given sorted types
+  static void filter_entity_types(const vector<string>& entity_types, sentence_info& sentence);
+  // Whether the screening model is confident the sentence has no entities
+  static bool screen_sentence(const model_info& model, sentence_info& sentence);
+  unique_ptr<sentence_batcher> batcher;
+
+  class recognize_upload_processor : public microrestd::rest_upload_processor {
+   public:
+    recognize_upload_processor(const shared_ptr<const model_info>& model, pooled_tokenizer&& tokenizer, bool vertical, bool confidences, metrics_info* metrics)
+        : model(model), vertical(vertical), confidences(confidences), tokenizer(move(tokenizer)), metrics(metrics) {}
+
+    virtual void process(microrestd::rest_request& req, const string& key, const string& value, size_t part_length) override;
+
+    shared_ptr<const model_info> model;
+    bool vertical, confidences;
+    // The sentences in the first recognized bytes of the received data, whose
+    // forms start at the given offsets (only the form lengths are valid)
+    vector<sentence_info> sentences;
+    vector<size_t> form_offsets;
+    size_t recognized = 0, received = 0, scanned = 0;
+
+   private:
+    pooled_tokenizer tokenizer;
+    metrics_info* metrics;
+  };
+  bool stream_uploads = false;
+
   class rest_response_generator : public microrestd::json_response_generator {
    public:
-    rest_response_generator(const model_info* model, rest_output_mode output);
+    rest_response_generator(const shared_ptr<const model_info>& model, rest_output_mode output);
+    virtual ~rest_response_generator() override;
 
     virtual bool next(bool first) = 0;
     virtual bool generate() override;
 
+    // Run next on the workers of the given service, which admitted the request
+    void use_workers(nametag_service* service) { workers_service = service; }
+
+    // Release the request admitted by the model when destroyed
+    void use_model_admission() { model_admitted = true; }
+
+    // Record the metrics of the response and of its processing
+    void use_metrics(metrics_info* metrics, method_metrics* method);
+
+    // Stop the generation after the given number of seconds (if nonzero),
+    // reporting an error
+    void use_timeout(double timeout);
+
+    // Account the costs of the request, which are logged when it completes
+    // and added to the method metrics, if used
+    void use_accounting();
+    virtual void log_statistics(string& record) const override;
+
+    // Reserve the response buffer for the expected output of the given input
+    void reserve_for_input(size_t input_length);
+    virtual void consume(size_t length) override;
+
    protected:
+    shared_ptr<const model_info> model;
     bool first, last;
     rest_output_mode output;
+    nametag_service* workers_service = nullptr;
+    bool model_admitted = false;
+    // Run next after the jobs of the other requests, used for large requests
+    bool low_priority = false;
+    metrics_info* metrics = nullptr;
+    method_metrics* method = nullptr;
+    chrono::steady_clock::time_point started;
+    bool has_deadline = false;
+    chrono::steady_clock::time_point deadline;
+
+    // The CPU time is accounted for the thread running next and for the
+    // parallel jobs of next running on other threads, using accounted_job
+    struct accounting_info {
+      atomic<int64_t> cpu_microseconds{0};
+      int64_t wait_microseconds = 0, processing_microseconds = 0;
+      size_t sentences = 0, tokens = 0;
+      thread::id next_thread;
+    };
+    unique_ptr<accounting_info> accounting;
+    bool accounted_next();
+    template <class Job> void accounted_job(const Job& job);
+    void account_sentence(size_t tokens) { if (accounting) accounting->sentences++, accounting->tokens += tokens; }
+    static int64_t thread_cpu_microseconds();
   };
 
+  bool handle_rest_metrics(microrestd::rest_request& req);
   bool handle_rest_models(microrestd::rest_request& req);
   bool handle_rest_recognize(microrestd::rest_request& req);
+  bool handle_rest_recognize_batch(microrestd::rest_request& req);
+  bool handle_recognize(microrestd::rest_request& req, bool batch);
   bool handle_rest_tokenize(microrestd::rest_request& req);
 
   const string& get_rest_model_id(microrestd::rest_request& req);
   const char* get_data(microrestd::rest_request& req, string& error);
-  tokenizer* get_tokenizer(microrestd::rest_request& req, const model_info* model, string& error);
+  static bool parse_documents(const string& body, vector<string>& documents, string& error);
+  static bool parse_json_string(const char*& json, const char* end, string& str);
+  pooled_tokenizer get_tokenizer(microrestd::rest_request& req, const model_info* model, string& error);
   bool get_output_mode(microrestd::rest_request& req, rest_output_mode& mode, string& error);
+  bool get_timeout(microrestd::rest_request& req, double& timeout, string& error);
+  bool get_entity_types(microrestd::rest_request& req, const model_info* model, vector<string>& entity_types, string& error);
+  unsigned request_timeout = 0;
+
+  // Workers performing the recognition and the number of admitted requests
+  utils::worker_pool workers;
+  unsigned max_admitted = 0;
+  unsigned parallel_sentences = 1;
+  size_t large_request_size = 0;
+  atomic<unsigned> admitted{0};
+  bool admit_request();
 
   microrestd::json_builder json_models;
   static const char* json_mime;
   static const char* operation_not_supported;
 };
 
+template <class Job>
+void nametag_service::rest_response_generator::accounted_job(const Job& job) {
+  if (!accounting || this_thread::get_id() == accounting->next_thread) return job();
+
+  int64_t start = thread_cpu_microseconds();
+  job();
+  accounting->cpu_microseconds.fetch_add(thread_cpu_microseconds() - start, memory_order_relaxed);
+}
+
 } // namespace nametag
 } // namespace ufal
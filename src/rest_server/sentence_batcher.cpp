@@ -0,0 +1,52 @@
+// This file is part of NameTag <http://github.com/ufal/nametag/>.
+//
+// Copyright 2016 Institute of Formal and Applied Linguistics, Faculty of
+// Mathematics and Physics, Charles University in Prague, Czech Republic.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#include "sentence_batcher.h"
+
+namespace ufal {
+namespace nametag {
+
+void sentence_batcher::recognize(const ner* recognizer, vector<string_piece>& forms, vector<named_entity>& entities) {
+  unique_lock<mutex> guard(lock);
+
+  // The references to the map elements stay valid while they are not erased,
+  // which happens only when no batch of the recognizer exists
+  auto& batches = recognizers[recognizer];
+  bool collecting = !batches.collecting;
+  if (collecting) batches.collecting = make_shared<batch>();
+  auto current = batches.collecting;
+  size_t index = current->sentences.size();
+  current->sentences.emplace_back();
+  current->sentences.back().swap(forms);
+
+  if (collecting) {
+    changed.wait_until(guard, chrono::steady_clock::now() + max_wait, [&]{
+      return current->sentences.size() >= max_sentences || !batches.recognizing;
+    });
+    batches.collecting.reset();
+    batches.recognizing++;
+
+    guard.unlock();
+    recognizer->recognize_batch(current->sentences, current->entities);
+    guard.lock();
+
+    current->recognized = true;
+    if (!--batches.recognizing && !batches.collecting) recognizers.erase(recognizer);
+    changed.notify_all();
+  } else {
+    if (current->sentences.size() >= max_sentences) changed.notify_all();
+    changed.wait(guard, [&]{ return current->recognized; });
+  }
+
+  forms.swap(current->sentences[index]);
+  entities.swap(current->entities[index]);
+}
+
+} // namespace nametag
+} // namespace ufal
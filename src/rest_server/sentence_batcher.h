@@ -0,0 +1,59 @@
+// This file is part of NameTag <http://github.com/ufal/nametag/>.
+//
+// Copyright 2016 Institute of Formal and Applied Linguistics, Faculty of
+// Mathematics and Physics, Charles University in Prague, Czech Republic.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#include "common.h"
+#include "ner/ner.h"
+
+namespace ufal {
+namespace nametag {
+
+// Recognize the sentences of concurrent requests together, using the batch
+// recognition of the recognizer. The first thread recognizing a sentence by
+// a recognizer collects the sentences of the other threads, until
+// max_sentences sentences are collected, the previous batch of the
+// recognizer is recognized, or max_wait_microseconds pass. Then it recognizes
+// the batch, while the other threads wait for the entities of their sentences.
+// Without a previous batch being recognized, a sentence is recognized at once.
+class sentence_batcher {
+ public:
+  sentence_batcher(unsigned max_sentences, unsigned max_wait_microseconds)
+      : max_sentences(max_sentences), max_wait(max_wait_microseconds) {}
+
+  // Recognize the sentence, whose forms are left unchanged
+  void recognize(const ner* recognizer, vector<string_piece>& forms, vector<named_entity>& entities);
+
+ private:
+  struct batch {
+    vector<vector<string_piece>> sentences;
+    vector<vector<named_entity>> entities;
+    bool recognized = false;
+  };
+  struct recognizer_batches {
+    shared_ptr<batch> collecting;
+    unsigned recognizing = 0;
+  };
+
+  unsigned max_sentences;
+  chrono::microseconds max_wait;
+
+  mutex lock;
+  condition_variable changed;
+  unordered_map<const ner*, recognizer_batches> recognizers;
+};
+
+} // namespace nametag
+} // namespace ufal
@@ -8,177 +8,715 @@
 // file, You can obtain one at http://mozilla.org/MPL/2.0/.
 
 #include <algorithm>
-#include <ctime>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
 
 #include "ner/ner.h"
-#include "utils/getpara.h"
+#include "tokenizer/nfc_normalizer.h"
 #include "utils/iostreams.h"
 #include "utils/options.h"
+#include "utils/paragraph_reader.h"
+#include "utils/parse_double.h"
+#include "utils/parse_int.h"
 #include "utils/process_args.h"
-#include "utils/xml_encoded.h"
+#include "utils/split.h"
 #include "version/version.h"
 
 using namespace ufal::nametag;
 
-static void sort_entities(vector<named_entity>& entities);
-static void recognize_conll(istream& is, ostream& os, const ner& recognizer, tokenizer& tokenizer);
-static void recognize_vertical(istream& is, ostream& os, const ner& recognizer, tokenizer& tokenizer);
-static void recognize_untokenized(istream& is, ostream& os, const ner& recognizer, tokenizer& tokenizer);
+struct recognized_paragraph {
+  string para;
+  vector<vector<string_piece>> forms;
+  vector<vector<token_range>> tokens;
+  vector<vector<named_entity>> entities;
+  double tokenization_seconds;
+
+  // With normalization, the text before it, if it changed, and its offsets
+  nfc_normalizer normalizer;
+  string original;
+  bool normalized = false;
+
+  // The vectors of the sentences beyond the current number, kept so that
+  // their memory is reused by the following paragraphs
+  vector<vector<string_piece>> spare_forms;
+  vector<vector<token_range>> spare_tokens;
+  vector<vector<named_entity>> spare_entities;
+
+  // Buffers of the output functions
+  mutable vector<const named_entity*> entity_stack;
+  mutable vector<size_t> entity_ends;
+
+  // Stores the entities passed by the recognizer, which are sorted, into the
+  // sentences, reusing the type strings of the already present elements
+  struct entities_sink : public entity_sink {
+    vector<vector<named_entity>>* entities;
+    vector<size_t> stored;
+
+    void start(vector<vector<named_entity>>& sentences_entities) {
+      entities = &sentences_entities;
+      stored.assign(sentences_entities.size(), 0);
+    }
+
+    virtual void on_entity(unsigned sentence, unsigned start, unsigned length, int /*type_id*/, string_piece type) override {
+      auto& sentence_entities = (*entities)[sentence];
+      if (stored[sentence] < sentence_entities.size()) {
+        auto& entity = sentence_entities[stored[sentence]];
+        entity.start = start;
+        entity.length = length;
+        entity.type.assign(type.str, type.len);
+      } else {
+        sentence_entities.emplace_back(start, length, string(type.str, type.len));
+      }
+      stored[sentence]++;
+    }
+
+    void finish() {
+      for (size_t i = 0; i < stored.size(); i++)
+        (*entities)[i].resize(stored[i]);
+    }
+  } sink;
+};
+// Recognition latencies of the individual paragraphs, printed by --stats, and
+// the total tokenization time, printed by --profile
+struct recognition_stats {
+  mutex stats_mutex;
+  vector<double> latencies;
+  double tokenization = 0;
+
+  void add(const vector<double>& file_latencies, double file_tokenization) {
+    lock_guard<mutex> lock(stats_mutex);
+    latencies.insert(latencies.end(), file_latencies.begin(), file_latencies.end());
+    tokenization += file_tokenization;
+  }
+};
+
+typedef void (*output_function)(const recognized_paragraph& paragraph, string& output, size_t& total_tokens);
+
+// Reads the input by paragraphs. To bound the memory, a paragraph longer than
+// max_block_size is returned in several blocks, every one ending at the start
+// of its last sentence, which is returned at the beginning of the next block.
+class block_reader {
+ public:
+  block_reader(istream& is, const ner& recognizer, bool vertical_input);
+
+  bool next_block(string& block);
+
+  static const size_t max_block_size = 1 << 20;
+
+ private:
+  paragraph_reader reader;
+  unique_ptr<tokenizer> block_tokenizer;
+  string carry;
+  vector<string_piece> forms;
+};
+
+static tokenizer* new_input_tokenizer(const ner& recognizer, bool vertical_input);
+template <class T> static void resize_reusing(vector<vector<T>>& sentences, size_t size, vector<vector<T>>& spare);
+static void recognize_paragraph(recognized_paragraph& paragraph, const ner& recognizer, ner_context& context, tokenizer& tokenizer, bool normalize, bool token_ranges);
+static void recognize(istream& is, ostream& os, const ner& recognizer, bool vertical_input, bool normalize, const vector<string>& entity_types, output_function output, int threads, bool flush, recognition_stats* stats);
+static void recognize_parallel(istream& is, ostream& os, const ner& recognizer, bool vertical_input, bool normalize, const vector<string>& entity_types, output_function output, int threads, bool flush, recognition_stats* stats);
+static void write_output(ostream& os, string& output, bool flush);
+static void output_conll(const recognized_paragraph& paragraph, string& output, size_t& total_tokens);
+static void output_vertical(const recognized_paragraph& paragraph, string& output, size_t& total_tokens);
+static void output_untokenized(const recognized_paragraph& paragraph, string& output, size_t& total_tokens);
+static void output_offsets(const recognized_paragraph& paragraph, string& output, size_t& total_chars);
+static void append_number(string& output, size_t number);
+static void append_xml_encoded(string& output, string_piece str, bool encode_quot = false);
+
+// Without flushing, the output is written once this many bytes are formatted
+static const size_t output_buffer_size = 1 << 16;
 
 int main(int argc, char* argv[]) {
   iostreams_init();
 
   options::map options;
-  if (!options::parse({{"input",options::value{"untokenized", "vertical"}},
-                       {"output",options::value{"vertical","xml", "conll"}},
+  if (!options::parse({{"analysis_cache", options::value::any},
+                       {"classification_cache", options::value::any},
+                       {"entity_types", options::value::any},
+                       {"flush", options::value::none},
+                       {"gazetteers_cache", options::value::none},
+                       {"input",options::value{"untokenized", "vertical"}},
+                       {"jobs", options::value::any},
+                       {"max_sentence_length", options::value::any},
+                       {"normalize", options::value::none},
+                       {"output",options::value{"vertical","xml", "conll", "offsets"}},
+                       {"pipeline_threads", options::value::any},
+                       {"prefilter", options::value::none},
+                       {"profile", options::value::none},
+                       {"sentence_cache", options::value::any},
+                       {"stage_skipping", options::value::any},
+                       {"stats", options::value::none},
+                       {"tagger_beam", options::value::any},
+                       {"tagger_fast", options::value::none},
+                       {"threads", options::value::any},
                        {"version", options::value::none},
                        {"help", options::value::none}}, argc, argv, options) ||
       options.count("help") ||
       (argc < 2 && !options.count("version")))
     runtime_failure("Usage: " << argv[0] << " [options] recognizer_model [file[:output_file]]...\n"
-                    "Options: --input=untokenized|vertical\n"
-                    "         --output=conll|vertical|xml\n"
+                    "Options: --analysis_cache=number of cached analysed forms (default 0)\n"
+                    "         --classification_cache=number of cached classified feature vectors per thread (default 0)\n"
+                    "         --entity_types=comma separated types of the returned entities (default all)\n"
+                    "         --flush (flush the output after every paragraph)\n"
+                    "         --gazetteers_cache (write the compiled caches of gazetteers read from files)\n"
+                    "         --input=untokenized|vertical\n"
+                    "         --jobs=number of files processed in parallel (default 1)\n"
+                    "         --max_sentence_length=split longer sentences (default 0 meaning never)\n"
+                    "         --normalize (normalize the input to NFC before tokenization)\n"
+                    "         --output=conll|offsets|vertical|xml\n"
+                    "         --pipeline_threads=number of threads tagging ahead of every recognition thread (default 0)\n"
+                    "         --prefilter (skip the sentences without candidates of entities)\n"
+                    "         --profile (print the time spent in the individual recognition stages)\n"
+                    "         --sentence_cache=number of cached recognized sentences (default 0)\n"
+                    "         --stage_skipping=probability of all words skipping the following stages (default 0 meaning never)\n"
+                    "         --stats (print memory usage of the model components and recognition latencies)\n"
+                    "         --tagger_beam=morphological disambiguation beam (default 0 meaning exact)\n"
+                    "         --tagger_fast (skip morphological disambiguation, using the first analyses)\n"
+                    "         --threads=number of recognition threads (default 1)\n"
                     "         --version\n"
                     "         --help");
   if (options.count("version"))
     return cout << version::version_and_copyright() << endl, 0;
 
+  int threads = options.count("threads") ? parse_int(options["threads"], "number of threads") : 1;
+  if (threads < 1) runtime_failure("The number of threads must be positive!");
+  int jobs = options.count("jobs") ? parse_int(options["jobs"], "number of jobs") : 1;
+  if (jobs < 1) runtime_failure("The number of jobs must be positive!");
+  int analysis_cache = options.count("analysis_cache") ? parse_int(options["analysis_cache"], "analysis cache size") : 0;
+  if (analysis_cache < 0) runtime_failure("The analysis cache size must not be negative!");
+  int classification_cache = options.count("classification_cache") ? parse_int(options["classification_cache"], "classification cache size") : 0;
+  if (classification_cache < 0) runtime_failure("The classification cache size must not be negative!");
+  int sentence_cache = options.count("sentence_cache") ? parse_int(options["sentence_cache"], "sentence cache size") : 0;
+  if (sentence_cache < 0) runtime_failure("The sentence cache size must not be negative!");
+  double stage_skipping = options.count("stage_skipping") ? parse_double(options["stage_skipping"], "stage skipping probability") : 0;
+  if (stage_skipping < 0 || stage_skipping > 1) runtime_failure("The stage skipping probability must be between 0 and 1!");
+  int tagger_beam = options.count("tagger_beam") ? parse_int(options["tagger_beam"], "tagger beam size") : 0;
+  if (tagger_beam < 0) runtime_failure("The tagger beam size must not be negative!");
+  int max_sentence_length = options.count("max_sentence_length") ? parse_int(options["max_sentence_length"], "maximum sentence length") : 0;
+  if (max_sentence_length < 0) runtime_failure("The maximum sentence length must not be negative!");
+  int pipeline_threads = options.count("pipeline_threads") ? parse_int(options["pipeline_threads"], "number of pipeline threads") : 0;
+  if (pipeline_threads < 0) runtime_failure("The number of pipeline threads must not be negative!");
+
+  if (options.count("gazetteers_cache")) ner::set_gazetteers_cache_writing(true);
+
   cerr << "Loading ner: ";
   unique_ptr<ner> recognizer(ner::load(argv[1]));
   if (!recognizer) runtime_failure("Cannot load ner from file '" << argv[1] << "'!");
   cerr << "done" << endl;
 
-  unique_ptr<tokenizer> tokenizer(options.count("input") && options["input"] == "vertical" ? tokenizer::new_vertical_tokenizer() : recognizer->new_tokenizer());
+  if (analysis_cache && !recognizer->set_analysis_cache(analysis_cache))
+    cerr << "The supplied model does not perform morphological analysis, ignoring the analysis cache." << endl;
+  if (classification_cache && !recognizer->set_classification_cache(classification_cache))
+    cerr << "The supplied model does not support the classification cache, ignoring it." << endl;
+  if (sentence_cache && !recognizer->set_sentence_cache(sentence_cache))
+    cerr << "The supplied model does not support the sentence cache, ignoring it." << endl;
+  if (stage_skipping && !recognizer->set_stage_skipping(stage_skipping))
+    cerr << "The supplied model does not support skipping stages, ignoring it." << endl;
+  if (tagger_beam && !recognizer->set_tagger_beam_size(tagger_beam))
+    cerr << "The supplied model does not perform morphological disambiguation, ignoring the tagger beam." << endl;
+  if (options.count("tagger_fast") && !recognizer->set_tagger_fast_mode(true))
+    cerr << "The supplied model does not perform morphological disambiguation, ignoring the tagger fast mode." << endl;
+  if (max_sentence_length && !recognizer->set_max_sentence_length(max_sentence_length))
+    cerr << "The supplied model does not support splitting sentences, ignoring the maximum sentence length." << endl;
+  if (pipeline_threads && !recognizer->set_pipeline_threads(pipeline_threads))
+    cerr << "The supplied model does not support pipelined tagging, ignoring the pipeline threads." << endl;
+  if (options.count("prefilter") && !recognizer->set_candidate_prefilter(true))
+    cerr << "The supplied model does not support the candidate prefilter, ignoring it." << endl;
+
+  vector<string> entity_types;
+  if (options.count("entity_types")) {
+    split(options["entity_types"], ',', entity_types);
+    unique_ptr<ner_context> context(recognizer->new_context());
+    if (!context->set_entity_types(entity_types))
+      runtime_failure("The supplied model cannot recognize all the given entity types!");
+  }
+
+  bool vertical_input = options.count("input") && options["input"] == "vertical";
+  unique_ptr<tokenizer> tokenizer(new_input_tokenizer(*recognizer, vertical_input));
   if (!tokenizer) runtime_failure("No tokenizer is defined for the supplied model!");
+  tokenizer.reset();
+
+  output_function output = output_untokenized;
+  if (options.count("output") && options["output"] == "vertical") output = output_vertical;
+  if (options.count("output") && options["output"] == "conll") output = output_conll;
+  if (options.count("output") && options["output"] == "offsets") output = output_offsets;
+
+  if (options.count("profile") && !recognizer->set_stage_profiling(true))
+    cerr << "The supplied model does not support profiling, printing only the tokenization time." << endl;
+
+  recognition_stats stats;
+  auto now = chrono::steady_clock::now();
+  process_args_parallel(jobs, 2, argc, argv, recognize, *recognizer, vertical_input, bool(options.count("normalize")), entity_types, output, threads, bool(options.count("flush")),
+                        options.count("stats") || options.count("profile") ? &stats : nullptr);
+  cerr << "Recognizing done, in " << fixed << setprecision(3) << chrono::duration<double>(chrono::steady_clock::now() - now).count() << " seconds." << endl;
+
+  if (analysis_cache) {
+    size_t hits, misses;
+    recognizer->analysis_cache_statistics(hits, misses);
+    if (hits + misses)
+      cerr << "Analysis cache: " << hits << " hits, " << misses << " misses, hit rate "
+           << setprecision(2) << 100. * hits / (hits + misses) << "%." << endl;
+  }
+  if (classification_cache) {
+    size_t hits, misses;
+    recognizer->classification_cache_statistics(hits, misses);
+    if (hits + misses)
+      cerr << "Classification cache: " << hits << " hits, " << misses << " misses, hit rate "
+           << setprecision(2) << 100. * hits / (hits + misses) << "%." << endl;
+  }
+  if (sentence_cache) {
+    size_t hits, misses;
+    recognizer->sentence_cache_statistics(hits, misses);
+    if (hits + misses)
+      cerr << "Sentence cache: " << hits << " hits, " << misses << " misses, hit rate "
+           << setprecision(2) << 100. * hits / (hits + misses) << "%." << endl;
+  }
+  if (stage_skipping) {
+    size_t skipped, sentences;
+    recognizer->stage_skipping_statistics(skipped, sentences);
+    if (sentences)
+      cerr << "Stage skipping: skipped the following stages of " << skipped << " of " << sentences << " sentences ("
+           << setprecision(2) << 100. * skipped / sentences << "%)." << endl;
+  }
+
+  if (options.count("prefilter")) {
+    size_t filtered, sentences;
+    recognizer->candidate_prefilter_statistics(filtered, sentences);
+    if (sentences)
+      cerr << "Candidate prefilter: skipped " << filtered << " of " << sentences << " sentences ("
+           << setprecision(2) << 100. * filtered / sentences << "%)." << endl;
+  }
+
+  if (options.count("stats")) {
+    vector<string> components;
+    vector<size_t> bytes;
+    recognizer->memory_usage(components, bytes);
+
+    size_t total = 0;
+    for (unsigned i = 0; i < components.size(); i++) {
+      cerr << "Memory usage of " << components[i] << ": " << setprecision(3) << bytes[i] / 1048576. << " MB" << endl;
+      total += bytes[i];
+    }
+    cerr << "Memory usage in total: " << setprecision(3) << total / 1048576. << " MB" << endl;
+
+    auto& paragraphs = stats.latencies;
+    if (!paragraphs.empty()) {
+      sort(paragraphs.begin(), paragraphs.end());
+      cerr << "Recognition latency of " << paragraphs.size() << " paragraphs: "
+           << "median " << defaultfloat << setprecision(3) << paragraphs[paragraphs.size() / 2] * 1000 << " ms, "
+           << "99th percentile " << paragraphs[min(paragraphs.size() - 1, paragraphs.size() * 99 / 100)] * 1000 << " ms, "
+           << "maximum " << paragraphs.back() * 1000 << " ms" << endl;
+    }
+  }
 
-  clock_t now = clock();
-  if (options.count("output") && options["output"] == "vertical")  process_args(2, argc, argv, recognize_vertical, *recognizer, *tokenizer);
-  else if (options.count("output") && options["output"] == "conll")  process_args(2, argc, argv, recognize_conll, *recognizer, *tokenizer);
-  else process_args(2, argc, argv, recognize_untokenized, *recognizer, *tokenizer);
-  cerr << "Recognizing done, in " << fixed << setprecision(3) << (clock() - now) / double(CLOCKS_PER_SEC) << " seconds." << endl;
+  if (options.count("profile")) {
+    vector<string> stages(1, "tokenization");
+    vector<double> seconds(1, stats.tokenization);
+    vector<string> recognizer_stages;
+    vector<double> recognizer_seconds;
+    recognizer->stage_profiling_statistics(recognizer_stages, recognizer_seconds);
+    stages.insert(stages.end(), recognizer_stages.begin(), recognizer_stages.end());
+    seconds.insert(seconds.end(), recognizer_seconds.begin(), recognizer_seconds.end());
+
+    double total = 0;
+    size_t width = 0;
+    for (unsigned i = 0; i < stages.size(); i++)
+      total += seconds[i], width = max(width, stages[i].size());
+
+    cerr << "Time spent in the recognition stages, summed over all threads:" << endl;
+    for (unsigned i = 0; i < stages.size(); i++)
+      cerr << "  " << left << setw(width) << stages[i] << right << fixed << setprecision(3) << setw(10) << seconds[i] << " s"
+           << setprecision(1) << setw(7) << (total ? 100 * seconds[i] / total : 0.) << "%" << endl;
+    cerr << "  " << left << setw(width) << "total" << right << setprecision(3) << setw(10) << total << " s" << endl;
+
+    vector<feature_template_statistics> templates;
+    recognizer->template_statistics(templates);
+    if (!templates.empty()) {
+      width = 0;
+      for (auto&& feature_template : templates)
+        width = max(width, feature_template.name.size());
+
+      cerr << "Feature templates: calls, features per call, lookups per call, lookup hit rate:" << endl;
+      for (auto&& feature_template : templates) {
+        double calls = max(feature_template.calls, size_t(1));
+        cerr << "  " << left << setw(width) << feature_template.name << right << setw(10) << feature_template.calls
+             << setprecision(1) << setw(10) << feature_template.features / calls << setw(10) << feature_template.lookups / calls;
+        if (feature_template.lookups) cerr << setw(7) << 100. * feature_template.lookup_hits / feature_template.lookups << "%";
+        cerr << endl;
+      }
+    }
+  }
 
   return 0;
 }
 
-void recognize_conll(istream& is, ostream& os, const ner& recognizer, tokenizer& tokenizer) {
-  string para;
-  vector<string_piece> forms;
-  vector<named_entity> entities;
-
-  while (getpara(is, para)) {
-    // Tokenize and tag
-    tokenizer.set_text(para);
-    while (tokenizer.next_sentence(&forms, nullptr)) {
-      recognizer.recognize(forms, entities);
-      sort_entities(entities);
-
-      vector<named_entity> stack;
-      for (size_t i = 0, e = 0; i < forms.size(); i++) {
-        for (; e < entities.size() && entities[e].start == i; e++)
-          stack.push_back(entities[e]);
-
-        os << forms[i] << '\t';
-        if (stack.size()) {
-          for (size_t j = 0; j < stack.size(); j++)
-            os << (j ? "|" : "") << (stack[j].start == i ? "B-" : "I-") << stack[j].type;
-        } else {
-          os << 'O';
-        }
+tokenizer* new_input_tokenizer(const ner& recognizer, bool vertical_input) {
+  return vertical_input ? tokenizer::new_vertical_tokenizer() : recognizer.new_tokenizer();
+}
+
+block_reader::block_reader(istream& is, const ner& recognizer, bool vertical_input)
+  : reader(is), block_tokenizer(new_input_tokenizer(recognizer, vertical_input)) {}
+
+bool block_reader::next_block(string& block) {
+  block.swap(carry);
+  carry.clear();
+
+  string_piece lines;
+  bool ended;
+  for (size_t split_size = max_block_size; reader.next(lines, &ended, block.size() < split_size ? split_size - block.size() : 0); ) {
+    block.append(lines.str, lines.len);
+    if (ended) break;
+
+    if (block.size() >= split_size) {
+      // Split the block at the start of its last sentence, if there are more
+      block_tokenizer->set_text(block);
+      const char* last_sentence = nullptr;
+      while (block_tokenizer->next_sentence(&forms, nullptr))
+        if (!forms.empty()) last_sentence = forms.front().str;
+
+      if (last_sentence && last_sentence > block.c_str()) {
+        carry.assign(last_sentence, block.c_str() + block.size() - last_sentence);
+        block.resize(last_sentence - block.c_str());
+        break;
+      }
+      split_size = block.size() + max_block_size;
+    }
+  }
+
+  return !block.empty();
+}
+
+template <class T>
+void resize_reusing(vector<vector<T>>& sentences, size_t size, vector<vector<T>>& spare) {
+  for (; sentences.size() > size; sentences.pop_back())
+    spare.push_back(move(sentences.back()));
+
+  while (sentences.size() < size)
+    if (spare.empty()) {
+      sentences.emplace_back();
+    } else {
+      sentences.push_back(move(spare.back()));
+      spare.pop_back();
+    }
+}
 
-        for (size_t j = stack.size(); j--; )
-          if (stack[j].start + stack[j].length == i + 1)
-            stack.erase(stack.begin() + j);
-        os << '\n';
+void recognize_paragraph(recognized_paragraph& paragraph, const ner& recognizer, ner_context& context, tokenizer& tokenizer, bool normalize, bool token_ranges) {
+  // Normalize the paragraph to NFC if requested, keeping the original text
+  // only when it changes, which is detected without copying
+  auto start = chrono::steady_clock::now();
+  paragraph.normalized = normalize && paragraph.normalizer.normalize(paragraph.para, paragraph.original);
+  if (paragraph.normalized) paragraph.para.swap(paragraph.original);
+
+  // Tokenize the whole paragraph, computing also the token ranges if requested
+  unsigned sentences = 0;
+  tokenizer.set_text(paragraph.para);
+  for (; true; sentences++) {
+    if (sentences >= paragraph.forms.size()) resize_reusing(paragraph.forms, sentences + 1, paragraph.spare_forms);
+    if (token_ranges && sentences >= paragraph.tokens.size()) resize_reusing(paragraph.tokens, sentences + 1, paragraph.spare_tokens);
+    if (!tokenizer.next_sentence(&paragraph.forms[sentences], token_ranges ? &paragraph.tokens[sentences] : nullptr)) break;
+  }
+  resize_reusing(paragraph.forms, sentences, paragraph.spare_forms);
+  if (token_ranges) resize_reusing(paragraph.tokens, sentences, paragraph.spare_tokens);
+
+  // The token ranges are in characters of the original text
+  if (token_ranges && paragraph.normalized)
+    for (auto&& tokens : paragraph.tokens)
+      for (auto&& token : tokens) {
+        size_t token_start = paragraph.normalizer.original_offset(token.start);
+        token.length = paragraph.normalizer.original_offset(token.start + token.length, true) - token_start;
+        token.start = token_start;
       }
+  paragraph.tokenization_seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+  // Find named entities in all its sentences
+  resize_reusing(paragraph.entities, sentences, paragraph.spare_entities);
+  paragraph.sink.start(paragraph.entities);
+  recognizer.recognize_batch(paragraph.forms, paragraph.sink, context);
+  paragraph.sink.finish();
+}
 
-      os << '\n' << flush;
+void recognize(istream& is, ostream& os, const ner& recognizer, bool vertical_input, bool normalize, const vector<string>& entity_types, output_function output, int threads, bool flush, recognition_stats* stats) {
+  if (threads > 1) return recognize_parallel(is, os, recognizer, vertical_input, normalize, entity_types, output, threads, flush, stats);
+
+  unique_ptr<tokenizer> tokenizer(new_input_tokenizer(recognizer, vertical_input));
+  unique_ptr<ner_context> context(recognizer.new_context());
+  context->set_entity_types(entity_types);
+  block_reader reader(is, recognizer, vertical_input);
+  recognized_paragraph paragraph;
+  string formatted;
+  size_t total_tokens = 0;
+  vector<double> file_latencies;
+  double file_tokenization = 0;
+
+  while (reader.next_block(paragraph.para)) {
+    auto start = chrono::steady_clock::now();
+    recognize_paragraph(paragraph, recognizer, *context, *tokenizer, normalize, output == output_offsets);
+    if (stats) {
+      file_latencies.push_back(chrono::duration<double>(chrono::steady_clock::now() - start).count());
+      file_tokenization += paragraph.tokenization_seconds;
     }
+
+    output(paragraph, formatted, total_tokens);
+    if (flush || formatted.size() >= output_buffer_size) write_output(os, formatted, flush);
   }
+  write_output(os, formatted, flush);
+  if (stats) stats->add(file_latencies, file_tokenization);
 }
 
-void recognize_vertical(istream& is, ostream& os, const ner& recognizer, tokenizer& tokenizer) {
-  string para;
-  vector<string_piece> forms;
-  vector<named_entity> entities;
-  unsigned total_tokens = 0;
-  string entity_ids, entity_text;
-
-  while (getpara(is, para)) {
-    // Tokenize and tag
-    tokenizer.set_text(para);
-    while (tokenizer.next_sentence(&forms, nullptr)) {
-      recognizer.recognize(forms, entities);
-      sort_entities(entities);
-
-      for (auto&& entity : entities) {
-        entity_ids.clear();
-        entity_text.clear();
-        for (auto i = entity.start; i < entity.start + entity.length; i++) {
-          if (i > entity.start) {
-            entity_ids += ',';
-            entity_text += ' ';
-          }
-          entity_ids += to_string(total_tokens + i + 1);
-          entity_text.append(forms[i].str, forms[i].len);
-        }
-        os << entity_ids << '\t' << entity.type << '\t' << entity_text << '\n';
+void recognize_parallel(istream& is, ostream& os, const ner& recognizer, bool vertical_input, bool normalize, const vector<string>& entity_types, output_function output, int threads, bool flush, recognition_stats* stats) {
+  // The paragraphs are read by the current thread and recognized by the worker
+  // threads. The jobs are kept in input order, so that the finished ones
+  // can be output in the same order as in the single-threaded mode.
+  struct job {
+    recognized_paragraph paragraph;
+    bool done;
+    double latency;
+  };
+  deque<unique_ptr<job>> jobs, free_jobs;
+  deque<job*> pending;
+  bool finished = false;
+  mutex jobs_mutex;
+  condition_variable pending_cv, done_cv;
+
+  vector<thread> workers;
+  for (int i = 0; i < threads; i++)
+    workers.emplace_back([&]() {
+      unique_ptr<tokenizer> tokenizer(new_input_tokenizer(recognizer, vertical_input));
+      unique_ptr<ner_context> context(recognizer.new_context());
+      context->set_entity_types(entity_types);
+
+      unique_lock<mutex> lock(jobs_mutex);
+      while (true) {
+        pending_cv.wait(lock, [&]{ return finished || !pending.empty(); });
+        if (pending.empty()) break;
+        job* current = pending.front();
+        pending.pop_front();
+
+        lock.unlock();
+        auto start = chrono::steady_clock::now();
+        recognize_paragraph(current->paragraph, recognizer, *context, *tokenizer, normalize, output == output_offsets);
+        current->latency = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        lock.lock();
+
+        current->done = true;
+        if (current == jobs.front().get()) done_cv.notify_one();
+      }
+    });
+
+  block_reader reader(is, recognizer, vertical_input);
+  string formatted;
+  size_t total_tokens = 0;
+  vector<double> file_latencies;
+  double file_tokenization = 0;
+  size_t max_jobs = 16 * threads;
+  bool eof = false;
+
+  unique_lock<mutex> lock(jobs_mutex);
+  while (!eof || !jobs.empty()) {
+    // Output finished jobs in order
+    while (!jobs.empty() && jobs.front()->done) {
+      unique_ptr<job> current(jobs.front().release());
+      jobs.pop_front();
+
+      lock.unlock();
+      if (stats) {
+        file_latencies.push_back(current->latency);
+        file_tokenization += current->paragraph.tokenization_seconds;
       }
-      os << flush;
-      total_tokens += forms.size() + 1;
+      output(current->paragraph, formatted, total_tokens);
+      if (flush || formatted.size() >= output_buffer_size) write_output(os, formatted, flush);
+      lock.lock();
+
+      free_jobs.push_back(move(current));
+    }
+
+    if (!eof && jobs.size() < max_jobs) {
+      // Read next paragraph
+      unique_ptr<job> current;
+      if (!free_jobs.empty()) {
+        current.reset(free_jobs.front().release());
+        free_jobs.pop_front();
+      } else {
+        current.reset(new job());
+      }
+
+      lock.unlock();
+      eof = !reader.next_block(current->paragraph.para);
+      lock.lock();
+
+      if (!eof) {
+        current->done = false;
+        pending.push_back(current.get());
+        jobs.push_back(move(current));
+        pending_cv.notify_one();
+      }
+    } else if (!jobs.empty()) {
+      done_cv.wait(lock, [&]{ return jobs.front()->done; });
     }
   }
+  finished = true;
+  lock.unlock();
+
+  pending_cv.notify_all();
+  for (auto&& worker : workers)
+    worker.join();
+
+  write_output(os, formatted, flush);
+  if (stats) stats->add(file_latencies, file_tokenization);
 }
 
-void recognize_untokenized(istream& is, ostream& os, const ner& recognizer, tokenizer& tokenizer) {
-  string para;
-  vector<string_piece> forms;
-  vector<named_entity> entities;
-  vector<size_t> entity_ends;
-
-  while (getpara(is, para)) {
-    // Tokenize the text and find named entities
-    tokenizer.set_text(para);
-    const char* unprinted = para.c_str();
-    while (tokenizer.next_sentence(&forms, nullptr)) {
-      recognizer.recognize(forms, entities);
-      sort_entities(entities);
-
-      for (unsigned i = 0, e = 0; i < forms.size(); i++) {
-        if (unprinted < forms[i].str) os << xml_encoded(string_piece(unprinted, forms[i].str - unprinted));
-        if (i == 0) os << "<sentence>";
-
-        // Open entities starting at current token
-        for (; e < entities.size() && entities[e].start == i; e++) {
-          os << "<ne type=\"" << xml_encoded(entities[e].type, true) << "\">";
-          entity_ends.push_back(entities[e].start + entities[e].length - 1);
+void write_output(ostream& os, string& output, bool flush) {
+  os.write(output.data(), output.size());
+  if (flush) os.flush();
+  output.clear();
+}
+
+void output_conll(const recognized_paragraph& paragraph, string& output, size_t& /*total_tokens*/) {
+  auto& stack = paragraph.entity_stack;
+  stack.clear();
+
+  for (unsigned s = 0; s < paragraph.forms.size(); s++) {
+    auto& forms = paragraph.forms[s];
+    auto& entities = paragraph.entities[s];
+
+    for (size_t i = 0, e = 0; i < forms.size(); i++) {
+      for (; e < entities.size() && entities[e].start == i; e++)
+        stack.push_back(&entities[e]);
+
+      output.append(forms[i].str, forms[i].len).push_back('\t');
+      if (stack.size()) {
+        for (size_t j = 0; j < stack.size(); j++) {
+          if (j) output.push_back('|');
+          output.append(stack[j]->start == i ? "B-" : "I-").append(stack[j]->type);
         }
+      } else {
+        output.push_back('O');
+      }
+
+      for (size_t j = stack.size(); j--; )
+        if (stack[j]->start + stack[j]->length == i + 1)
+          stack.erase(stack.begin() + j);
+      output.push_back('\n');
+    }
+
+    output.push_back('\n');
+  }
+}
+
+void output_vertical(const recognized_paragraph& paragraph, string& output, size_t& total_tokens) {
+  string entity_text;
 
-        // The token itself
-        os << "<token>" << xml_encoded(forms[i]) << "</token>";
+  for (unsigned s = 0; s < paragraph.forms.size(); s++) {
+    auto& forms = paragraph.forms[s];
 
-        // Close entities ending after current token
-        while (!entity_ends.empty() && entity_ends.back() == i) {
-          os << "</ne>";
-          entity_ends.pop_back();
+    for (auto&& entity : paragraph.entities[s]) {
+      entity_text.clear();
+      for (auto i = entity.start; i < entity.start + entity.length; i++) {
+        if (i > entity.start) {
+          output.push_back(',');
+          entity_text.push_back(' ');
         }
-        if (i + 1 == forms.size()) os << "</sentence>";
-        unprinted = forms[i].str + forms[i].len;
+        append_number(output, total_tokens + i + 1);
+        entity_text.append(forms[i].str, forms[i].len);
       }
+      output.append(1, '\t').append(entity.type).append(1, '\t').append(entity_text).push_back('\n');
     }
-    // Write rest of the text (should be just spaces)
-    if (unprinted < para.c_str() + para.size()) os << xml_encoded(string_piece(unprinted, para.c_str() + para.size() - unprinted));
-    os << flush;
+    total_tokens += forms.size() + 1;
   }
 }
 
-void sort_entities(vector<named_entity>& entities) {
-  struct named_entity_comparator {
-    static bool lt(const named_entity& a, const named_entity& b) {
-      return a.start < b.start || (a.start == b.start && a.length > b.length);
+void output_untokenized(const recognized_paragraph& paragraph, string& output, size_t& /*total_tokens*/) {
+  auto& entity_ends = paragraph.entity_ends;
+  entity_ends.clear();
+
+  const char* unprinted = paragraph.para.c_str();
+  for (unsigned s = 0; s < paragraph.forms.size(); s++) {
+    auto& forms = paragraph.forms[s];
+    auto& entities = paragraph.entities[s];
+
+    for (unsigned i = 0, e = 0; i < forms.size(); i++) {
+      if (unprinted < forms[i].str) append_xml_encoded(output, string_piece(unprinted, forms[i].str - unprinted));
+      if (i == 0) output.append("<sentence>");
+
+      // Open entities starting at current token
+      for (; e < entities.size() && entities[e].start == i; e++) {
+        output.append("<ne type=\"");
+        append_xml_encoded(output, entities[e].type, true);
+        output.append("\">");
+        entity_ends.push_back(entities[e].start + entities[e].length - 1);
+      }
+
+      // The token itself
+      output.append("<token>");
+      append_xml_encoded(output, forms[i]);
+      output.append("</token>");
+
+      // Close entities ending after current token
+      while (!entity_ends.empty() && entity_ends.back() == i) {
+        output.append("</ne>");
+        entity_ends.pop_back();
+      }
+      if (i + 1 == forms.size()) output.append("</sentence>");
+      unprinted = forms[i].str + forms[i].len;
     }
-  };
+  }
+  // Write rest of the text (should be just spaces)
+  if (unprinted < paragraph.para.c_str() + paragraph.para.size())
+    append_xml_encoded(output, string_piece(unprinted, paragraph.para.c_str() + paragraph.para.size() - unprinted));
+}
+
+void output_offsets(const recognized_paragraph& paragraph, string& output, size_t& total_chars) {
+  for (unsigned s = 0; s < paragraph.forms.size(); s++) {
+    auto& tokens = paragraph.tokens[s];
 
-  // Many models return entities sorted -- it is worthwhile to check that.
-  if (!is_sorted(entities.begin(), entities.end(), named_entity_comparator::lt))
-    sort(entities.begin(), entities.end(), named_entity_comparator::lt);
+    for (auto&& entity : paragraph.entities[s]) {
+      auto& first = tokens[entity.start];
+      auto& last = tokens[entity.start + entity.length - 1];
+      append_number(output, total_chars + first.start);
+      output.push_back('\t');
+      append_number(output, last.start + last.length - first.start);
+      output.append(1, '\t').append(entity.type).push_back('\n');
+    }
+  }
+
+  // The offsets of the following paragraphs start after this one
+  for (auto&& chr : paragraph.normalized ? paragraph.original : paragraph.para)
+    total_chars += (chr & 0xC0) != 0x80;
+}
+
+void append_number(string& output, size_t number) {
+  char digits[20];
+  unsigned length = 0;
+  do digits[length++] = '0' + number % 10; while (number /= 10);
+  while (length) output.push_back(digits[--length]);
 }
+
+// Characters encoded by append_xml_encoded, the quote only on request
+static const struct xml_encoded_chars {
+  enum { ALWAYS = 1, QUOT = 2 };
+  unsigned char flags[256];
+
+  xml_encoded_chars() : flags() {
+    flags[(unsigned char)'<'] = flags[(unsigned char)'>'] = flags[(unsigned char)'&'] = ALWAYS;
+    flags[(unsigned char)'"'] = QUOT;
+  }
+} xml_encoded;
+
+void append_xml_encoded(string& output, string_piece str, bool encode_quot) {
+  unsigned char encoded = xml_encoded_chars::ALWAYS | (encode_quot ? xml_encoded_chars::QUOT : 0);
+  const char* end = str.str + str.len;
+
+  for (const char* run = str.str; run < end; run++) {
+    // Append the longest run of characters not needing encoding at once
+    const char* chr = run;
+    while (chr < end && !(xml_encoded.flags[(unsigned char)*chr] & encoded)) chr++;
+    output.append(run, chr - run);
+    if ((run = chr) == end) break;
+
+    output.append(*chr == '<' ? "&lt;" : *chr == '>' ? "&gt;" : *chr == '&' ? "&amp;" : "&quot;");
+  }
+}
+
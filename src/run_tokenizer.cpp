@@ -8,9 +8,9 @@
 // file, You can obtain one at http://mozilla.org/MPL/2.0/.
 
 #include "ner/ner.h"
-#include "utils/getpara.h"
 #include "utils/iostreams.h"
 #include "utils/options.h"
+#include "utils/paragraph_reader.h"
 #include "utils/process_args.h"
 #include "utils/xml_encoded.h"
 #include "version/version.h"
@@ -19,18 +19,19 @@ using namespace ufal::nametag;
 
 static void tokenize_vertical(istream& in, ostream& os, tokenizer& tokenizer);
 static void tokenize_xml(istream& is, ostream& os, tokenizer& tokenizer);
+static void tokenize_sentences(istream& is, ostream& os, tokenizer& tokenizer);
 
 int main(int argc, char* argv[]) {
   iostreams_init();
 
   options::map options;
-  if (!options::parse({{"output",options::value{"vertical","xml"}},
+  if (!options::parse({{"output",options::value{"vertical","xml","sentences"}},
                        {"version", options::value::none},
                        {"help", options::value::none}}, argc, argv, options) ||
       options.count("help") ||
       (argc < 2 && !options.count("version")))
     runtime_failure("Usage: " << argv[0] << " [options] ner_model [file[:output_file]]...\n"
-                    "Options: --output=vertical|xml\n"
+                    "Options: --output=sentences|vertical|xml\n"
                     "         --version\n"
                     "         --help");
   if (options.count("version"))
@@ -45,15 +46,17 @@ int main(int argc, char* argv[]) {
   if (!tokenizer) runtime_failure("No tokenizer is defined for the supplied model!");
 
   if (options.count("output") && options["output"] == "vertical") process_args(2, argc, argv, tokenize_vertical, *tokenizer);
+  else if (options.count("output") && options["output"] == "sentences") process_args(2, argc, argv, tokenize_sentences, *tokenizer);
   else process_args(2, argc, argv, tokenize_xml, *tokenizer);
 
   return 0;
 }
 
 void tokenize_vertical(istream& is, ostream& os, tokenizer& tokenizer) {
-  string para;
+  paragraph_reader reader(is);
+  string_piece para;
   vector<string_piece> forms;
-  while (getpara(is, para)) {
+  while (reader.next(para)) {
     // Tokenize
     tokenizer.set_text(para);
     while (tokenizer.next_sentence(&forms, nullptr)) {
@@ -66,12 +69,13 @@ void tokenize_vertical(istream& is, ostream& os, tokenizer& tokenizer) {
 }
 
 static void tokenize_xml(istream& is, ostream& os, tokenizer& tokenizer) {
-  string para;
+  paragraph_reader reader(is);
+  string_piece para;
   vector<string_piece> forms;
-  while (getpara(is, para)) {
+  while (reader.next(para)) {
     // Tokenize
     tokenizer.set_text(para);
-    const char* unprinted = para.c_str();
+    const char* unprinted = para.str;
     while (tokenizer.next_sentence(&forms, nullptr))
       for (unsigned i = 0; i < forms.size(); i++) {
         if (unprinted < forms[i].str) os << xml_encoded(string_piece(unprinted, forms[i].str - unprinted));
@@ -81,7 +85,23 @@ static void tokenize_xml(istream& is, ostream& os, tokenizer& tokenizer) {
         unprinted = forms[i].str + forms[i].len;
       }
 
-    if (unprinted < para.c_str() + para.size()) os << xml_encoded(string_piece(unprinted, para.c_str() + para.size() - unprinted));
+    if (unprinted < para.str + para.len) os << xml_encoded(string_piece(unprinted, para.str + para.len - unprinted));
+    os << flush;
+  }
+}
+
+void tokenize_sentences(istream& is, ostream& os, tokenizer& tokenizer) {
+  paragraph_reader reader(is);
+  string_piece para;
+  vector<string_piece> forms;
+  for (size_t total_bytes = 0; reader.next(para); total_bytes += para.len) {
+    // Tokenize, printing only the byte offset and length of every sentence
+    tokenizer.set_text(para);
+    while (tokenizer.next_sentence(&forms, nullptr)) {
+      auto& first = forms.front();
+      auto& last = forms.back();
+      os << total_bytes + (first.str - para.str) << '\t' << last.str + last.len - first.str << '\n';
+    }
     os << flush;
   }
 }
@@ -29,36 +29,37 @@ bool external_tagger::create_and_encode(const string& /*params*/, ostream& /*os*
   return true;
 }
 
-void external_tagger::tag(const vector<string_piece>& forms, ner_sentence& sentence) const {
+void external_tagger::tag(const vector<string_piece>& forms, ner_sentence& sentence, tagger_context* /*context*/) const {
   sentence.resize(forms.size());
   for (unsigned i = 0; i < forms.size(); i++) {
-    string_piece form = forms[i];
+    auto& word = sentence.words[i];
 
+    // Split the form, raw lemma and tag as pieces of the input
+    string_piece form = forms[i], raw_lemma, tag(form.str, 0);
     size_t space = strnchrpos(form.str, ' ', form.len);
     if (space < form.len) {
-      sentence.words[i].form.assign(form.str, space);
-      form.len -= space + 1;
-      form.str += space + 1;
+      raw_lemma = string_piece(form.str + space + 1, form.len - space - 1);
+      form.len = space;
 
-      space = strnchrpos(form.str, ' ', form.len);
-      if (space < form.len) {
-        sentence.words[i].raw_lemma.assign(form.str, space);
-        form.len -= space + 1;
-        form.str += space + 1;
-
-        sentence.words[i].tag.assign(form.str, strnchrpos(form.str, ' ', form.len));
-      } else {
-        sentence.words[i].raw_lemma.assign(form.str, form.len);
-        sentence.words[i].tag.clear();
+      space = strnchrpos(raw_lemma.str, ' ', raw_lemma.len);
+      if (space < raw_lemma.len) {
+        tag = string_piece(raw_lemma.str + space + 1, strnchrpos(raw_lemma.str + space + 1, ' ', raw_lemma.len - space - 1));
+        raw_lemma.len = space;
       }
     } else {
-      sentence.words[i].form.assign(form.str, form.len);
-      sentence.words[i].raw_lemma = sentence.words[i].form;
-      sentence.words[i].tag.clear();
+      raw_lemma = form;
+    }
+
+    // Fill only the required attributes
+    if (word_attributes & ner_word::FORM) word.form.assign(form.str, form.len);
+    if (word_attributes & ner_word::RAW_LEMMA) word.raw_lemma.assign(raw_lemma.str, raw_lemma.len);
+    if (word_attributes & ner_word::RAW_LEMMAS_ALL) {
+      word.raw_lemmas_all.resize(1);
+      word.raw_lemmas_all[0].assign(raw_lemma.str, raw_lemma.len);
     }
-    sentence.words[i].raw_lemmas_all.assign(1, sentence.words[i].raw_lemma);
-    sentence.words[i].lemma_id = sentence.words[i].raw_lemma;
-    sentence.words[i].lemma_comments.clear();
+    if (word_attributes & ner_word::LEMMA_ID) word.lemma_id.assign(raw_lemma.str, raw_lemma.len);
+    if (word_attributes & ner_word::LEMMA_COMMENTS) word.lemma_comments.clear();
+    if (word_attributes & ner_word::TAG) word.tag.assign(tag.str, tag.len);
   }
 }
 
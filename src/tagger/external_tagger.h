@@ -19,7 +19,7 @@ class external_tagger : public tagger {
  public:
   virtual bool load(istream& is) override;
   virtual bool create_and_encode(const string& params, ostream& os) override;
-  virtual void tag(const vector<string_piece>& forms, ner_sentence& sentence) const override;
+  virtual void tag(const vector<string_piece>& forms, ner_sentence& sentence, tagger_context* context = nullptr) const override;
 };
 
 } // namespace nametag
@@ -8,7 +8,10 @@
 // file, You can obtain one at http://mozilla.org/MPL/2.0/.
 
 #include <algorithm>
+#include <cstring>
 #include <fstream>
+#include <mutex>
+#include <unordered_map>
 
 #include "morphodita_tagger.h"
 #include "unilib/unicode.h"
@@ -36,44 +39,132 @@ bool morphodita_tagger::create_and_encode(const string& params, ostream& os) {
   return bool(os);
 }
 
-void morphodita_tagger::tag(const vector<string_piece>& forms, ner_sentence& sentence) const {
+void morphodita_tagger::share_identical() {
+  static mutex shared_mutex;
+  static unordered_map<uint64_t, weak_ptr<morphodita::tagger>> shared_taggers;
+
+  lock_guard<mutex> lock(shared_mutex);
+  for (auto it = shared_taggers.begin(); it != shared_taggers.end(); )
+    if (it->second.expired())
+      it = shared_taggers.erase(it);
+    else
+      ++it;
+
+  auto& shared_tagger = shared_taggers[identity()];
+  if (auto identical = shared_tagger.lock()) {
+    tagger = identical;
+    morpho = tagger->get_morpho();
+  } else {
+    shared_tagger = tagger;
+  }
+}
+
+void morphodita_tagger::tag(const vector<string_piece>& forms, ner_sentence& sentence, tagger_context* context) const {
   sentence.resize(0);
   if (!tagger || !morpho) return;
 
-  // Obtain a cache
-  cache* c = caches.pop();
-  if (!c) c = new cache();
+  // Use the given context, or obtain a cache
+  cache* c = context ? static_cast<cache*>(context) : caches.pop();
+  if (!c) c = static_cast<cache*>(new_context());
 
-  // Tag
-  tagger->tag(forms, c->tags);
+  // Tag, obtaining also the analyses of all forms. The raw lemmas of all
+  // analyses are generated using the guesser, so the analyses of the tagger
+  // can be reused only if it used the guesser too.
+  bool reuse_analyses = tagger->tag(forms, c->tags, c->analyses, *c->morphodita_context) == morphodita::morpho::GUESSER;
 
   // Fill sentence
   if (c->tags.size() >= forms.size()) {
     sentence.resize(forms.size());
     for (unsigned i = 0; i < forms.size(); i++) {
-      sentence.words[i].form.assign(forms[i].str, morpho->raw_form_len(forms[i]));
-
+      auto& word = sentence.words[i];
       const string& lemma = c->tags[i].lemma;
 
-      unsigned raw_lemma_len = morpho->raw_lemma_len(lemma);
-      sentence.words[i].raw_lemma.assign(lemma, 0, raw_lemma_len);
-
-      morpho->analyze(forms[i], morphodita::morpho::GUESSER, c->analyses);
-      sentence.words[i].raw_lemmas_all.clear();
-      for (auto&& analysis : c->analyses)
-        sentence.words[i].raw_lemmas_all.emplace_back(analysis.lemma, 0, morpho->raw_lemma_len(analysis.lemma));
-      sort(sentence.words[i].raw_lemmas_all.begin(), sentence.words[i].raw_lemmas_all.end());
-      sentence.words[i].raw_lemmas_all.erase(unique(sentence.words[i].raw_lemmas_all.begin(), sentence.words[i].raw_lemmas_all.end()),
-                                             sentence.words[i].raw_lemmas_all.end());
-
-      unsigned lemma_id_len = morpho->lemma_id_len(lemma);
-      sentence.words[i].lemma_id.assign(sentence.words[i].raw_lemma).append(lemma, raw_lemma_len, lemma_id_len - raw_lemma_len);
-      sentence.words[i].lemma_comments.assign(lemma, lemma_id_len, string::npos);
-      sentence.words[i].tag = c->tags[i].tag;
+      // Fill only the required attributes
+      if (word_attributes & ner_word::FORM)
+        word.form.assign(forms[i].str, morpho->raw_form_len(forms[i]));
+
+      if (word_attributes & ner_word::RAW_LEMMA)
+        word.raw_lemma.assign(lemma, 0, morpho->raw_lemma_len(lemma));
+
+      if (word_attributes & ner_word::RAW_LEMMAS_ALL) {
+        if (!reuse_analyses) tagger->analyze(forms[i], morphodita::morpho::GUESSER, c->guessed_analyses);
+
+        // Sort and deduplicate the raw lemmas as pieces of the analyses, and
+        // store only the unique ones, reusing the strings of the word. The
+        // analyses of one lemma are usually consecutive, so the raw lemma is
+        // found only once for all of them.
+        c->raw_lemmas.clear();
+        const string* previous_lemma = nullptr;
+        for (auto&& analysis : reuse_analyses ? c->analyses[i] : c->guessed_analyses) {
+          if (previous_lemma && analysis.lemma == *previous_lemma) continue;
+          c->raw_lemmas.emplace_back(analysis.lemma.c_str(), morpho->raw_lemma_len(analysis.lemma));
+          previous_lemma = &analysis.lemma;
+        }
+        sort(c->raw_lemmas.begin(), c->raw_lemmas.end(), [](const string_piece& a, const string_piece& b) {
+          int prefix_compare = memcmp(a.str, b.str, min(a.len, b.len));
+          return prefix_compare < 0 || (prefix_compare == 0 && a.len < b.len);
+        });
+        c->raw_lemmas.erase(unique(c->raw_lemmas.begin(), c->raw_lemmas.end()), c->raw_lemmas.end());
+
+        word.raw_lemmas_all.resize(c->raw_lemmas.size());
+        for (unsigned j = 0; j < c->raw_lemmas.size(); j++)
+          word.raw_lemmas_all[j].assign(c->raw_lemmas[j].str, c->raw_lemmas[j].len);
+      }
+
+      if (word_attributes & (ner_word::LEMMA_ID | ner_word::LEMMA_COMMENTS)) {
+        unsigned lemma_id_len = morpho->lemma_id_len(lemma);
+        if (word_attributes & ner_word::LEMMA_ID) word.lemma_id.assign(lemma, 0, lemma_id_len);
+        if (word_attributes & ner_word::LEMMA_COMMENTS) word.lemma_comments.assign(lemma, lemma_id_len, string::npos);
+      }
+
+      if (word_attributes & ner_word::TAG)
+        word.tag = c->tags[i].tag;
     }
   }
 
-  caches.push(c);
+  if (!context) caches.push(c);
+}
+
+tagger_context* morphodita_tagger::new_context() const {
+  cache* c = new cache();
+  if (tagger) c->morphodita_context.reset(tagger->new_context());
+  return c;
+}
+
+bool morphodita_tagger::set_analysis_cache(size_t forms) {
+  if (!tagger || tagger.use_count() > 1) return false;
+
+  tagger->set_analysis_cache(forms);
+  return true;
+}
+
+void morphodita_tagger::analysis_cache_statistics(size_t& hits, size_t& misses) const {
+  hits = misses = 0;
+  if (tagger) tagger->analysis_cache_statistics(hits, misses);
+}
+
+bool morphodita_tagger::set_beam_size(int beam_size) {
+  if (!tagger || tagger.use_count() > 1) return false;
+
+  tagger->set_beam_size(beam_size);
+  return true;
+}
+
+bool morphodita_tagger::set_fast_mode(bool fast) {
+  if (!tagger || tagger.use_count() > 1) return false;
+
+  tagger->set_fast_mode(fast);
+  return true;
+}
+
+void morphodita_tagger::memory_usage(vector<string>& components, vector<size_t>& bytes) const {
+  if (!tagger) return;
+
+  auto morpho = tagger->get_morpho();
+  components.push_back("tagger morphology");
+  bytes.push_back(morpho ? morpho->memory_usage() : 0);
+  components.push_back("tagger features");
+  bytes.push_back(tagger->memory_usage());
 }
 
 } // namespace nametag
@@ -20,19 +20,34 @@ namespace nametag {
 
 class morphodita_tagger : public tagger {
  public:
-  virtual void tag(const vector<string_piece>& forms, ner_sentence& sentence) const override;
+  virtual void tag(const vector<string_piece>& forms, ner_sentence& sentence, tagger_context* context = nullptr) const override;
+
+  virtual tagger_context* new_context() const override;
+
+  virtual bool set_analysis_cache(size_t forms) override;
+  virtual void analysis_cache_statistics(size_t& hits, size_t& misses) const override;
+  virtual bool set_beam_size(int beam_size) override;
+  virtual bool set_fast_mode(bool fast) override;
+  virtual void memory_usage(vector<string>& components, vector<size_t>& bytes) const override;
 
  protected:
   virtual bool load(istream& is) override;
   virtual bool create_and_encode(const string& params, ostream& os) override;
+  virtual void share_identical() override;
 
  private:
-  unique_ptr<morphodita::tagger> tagger;
+  // Shared by all loaded instances with the same identity; the analysis cache,
+  // the beam size and the fast mode can be changed only while the tagger is
+  // not shared.
+  shared_ptr<morphodita::tagger> tagger;
   const morphodita::morpho* morpho;
 
-  struct cache {
-    vector<morphodita::tagged_lemma> tags, analyses;
+  struct cache : public tagger_context {
+    vector<morphodita::tagged_lemma> tags, guessed_analyses;
+    vector<vector<morphodita::tagged_lemma>> analyses;
+    vector<string_piece> raw_lemmas;
     string lemma_cased;
+    unique_ptr<morphodita::tagger_context> morphodita_context;
   };
   mutable threadsafe_stack<cache> caches;
 };
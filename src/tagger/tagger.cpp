@@ -12,16 +12,108 @@
 #include "tagger.h"
 #include "tagger_ids.h"
 #include "trivial_tagger.h"
+#include "utils/memory_streambuf.h"
 
 namespace ufal {
 namespace nametag {
 
+// Unbuffered stream buffer reading from another stream buffer and computing
+// the FNV-1a hash identifying the read data. Instead of hashing the whole
+// data, only the short reads are hashed completely, while the long ones,
+// which are the payloads of the blocks, contribute their length and their
+// first and last bytes. As LZMA output depends on all preceding input, a
+// different content changes the length or the end of the payload; the
+// headers of the stored blocks contain the hash of their data. The data
+// provided in place by the source are hashed the same way as when read.
+class tagger_identity_streambuf : public in_place_streambuf {
+ public:
+  tagger_identity_streambuf(streambuf* source) : source(source), in_place_source(dynamic_cast<in_place_streambuf*>(source)) {}
+
+  uint64_t hash = 14695981039346656037ULL;
+
+  virtual const char* next_in_place(size_t len, shared_ptr<const void>& storage) override {
+    const char* data = in_place_source ? in_place_source->next_in_place(len, storage) : nullptr;
+    if (data) add_read(data, len);
+    return data;
+  }
+
+ protected:
+  virtual int_type underflow() override {
+    return source->sgetc();
+  }
+
+  virtual int_type uflow() override {
+    int_type c = source->sbumpc();
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+      char chr = traits_type::to_char_type(c);
+      add(&chr, 1);
+    }
+    return c;
+  }
+
+  virtual streamsize xsgetn(char* s, streamsize n) override {
+    streamsize read = source->sgetn(s, n);
+    add_read(s, read);
+    return read;
+  }
+
+ private:
+  streambuf* source;
+  in_place_streambuf* in_place_source;
+  enum { sampled_bytes = 128 };
+
+  void add_read(const char* data, streamsize len) {
+    if (len <= 2 * sampled_bytes) {
+      add(data, len);
+    } else {
+      uint64_t read = len;
+      add((const char*) &read, sizeof(read));
+      add(data, sampled_bytes);
+      add(data + len - sampled_bytes, sampled_bytes);
+    }
+  }
+
+  void add(const char* data, streamsize len) {
+    for (streamsize i = 0; i < len; i++)
+      hash = (hash ^ (unsigned char)data[i]) * 1099511628211ULL;
+  }
+};
+
+tagger_context* tagger::new_context() const {
+  return nullptr;
+}
+
+bool tagger::set_analysis_cache(size_t /*forms*/) {
+  return false;
+}
+
+void tagger::analysis_cache_statistics(size_t& hits, size_t& misses) const {
+  hits = misses = 0;
+}
+
+bool tagger::set_beam_size(int /*beam_size*/) {
+  return false;
+}
+
+bool tagger::set_fast_mode(bool /*fast*/) {
+  return false;
+}
+
+void tagger::memory_usage(vector<string>& /*components*/, vector<size_t>& /*bytes*/) const {}
+
+void tagger::share_identical() {}
+
 tagger* tagger::load_instance(istream& is) {
-  unique_ptr<tagger> res(create(tagger_id(is.get())));
+  tagger_identity_streambuf identity_buf(is.rdbuf());
+  istream identity_is(&identity_buf);
+
+  unique_ptr<tagger> res(create(tagger_id(identity_is.get())));
 
   if (!res) return nullptr;
-  if (!res->load(is)) return nullptr;
+  if (!res->load(identity_is)) return nullptr;
 
+  res->identity_hash = identity_buf.hash;
+  res->share_identical();
   return res.release();
 }
 
@@ -12,27 +12,80 @@
 #include "common.h"
 #include "bilou/ner_sentence.h"
 #include "tagger_ids.h"
+#include "utils/compressor.h"
 #include "utils/string_piece.h"
 
 namespace ufal {
 namespace nametag {
 
+// Scratch state of tagging used by a single thread, see tagger::new_context.
+class tagger_context {
+ public:
+  virtual ~tagger_context() {}
+};
+
 class tagger {
  public:
   virtual ~tagger() {}
 
-  virtual void tag(const vector<string_piece>& forms, ner_sentence& sentence) const = 0;
+  // Tag the given forms, using the given context if not NULL, and the
+  // internal caches otherwise.
+  virtual void tag(const vector<string_piece>& forms, ner_sentence& sentence, tagger_context* context = nullptr) const = 0;
+
+  // Return a new context holding the scratch state of tagging, which can be
+  // passed to tag by a single thread at a time. It must be used only with
+  // this tagger. Can return NULL if the tagger needs no such state.
+  virtual tagger_context* new_context() const;
+
+  // Taggers may fill only the word attributes given as ner_word flags, leaving
+  // the others unspecified. All attributes are filled by default.
+  inline void set_word_attributes(unsigned attributes) { word_attributes = attributes; }
+
+  // Cache of morphological analyses, if supported by the tagger
+  virtual bool set_analysis_cache(size_t forms);
+  virtual void analysis_cache_statistics(size_t& hits, size_t& misses) const;
+
+  // Beam size of the disambiguation, if supported by the tagger
+  virtual bool set_beam_size(int beam_size);
+
+  // Skipping of the disambiguation, if supported by the tagger
+  virtual bool set_fast_mode(bool fast);
+
+  // Append the approximate number of bytes used by the tagger components
+  virtual void memory_usage(vector<string>& components, vector<size_t>& bytes) const;
+
+  // Hash identifying the serialized tagger, available for taggers created by
+  // load_instance. It is computed from the structure of the serialized data,
+  // the lengths and ends of its blocks, and the data hashes in the headers of
+  // the stored blocks, without reading all the data.
+  inline uint64_t identity() const { return identity_hash; }
 
   // Factory methods
   static tagger* load_instance(istream& is);
   static tagger* create_and_encode_instance(const string& tagger_id_and_params, ostream& os);
 
+  // Re-encode the tagger from the seekable stream, storing the scores of its
+  // model as int16. Returns false if the tagger does not support it.
+  static bool quantize_int16_instance(istream& is, ostream& os);
+
+  // Re-encode the tagger from the stream, storing all blocks of its model
+  // using the given codec.
+  static bool recompress_instance(istream& is, ostream& os, compressor::codec codec);
+
  protected:
   virtual bool load(istream& is) = 0;
   virtual bool create_and_encode(const string& params, ostream& os) = 0;
 
+  // Called by load_instance once the identity is known, so that the data of
+  // identical taggers can be shared
+  virtual void share_identical();
+
+  unsigned word_attributes = ner_word::ALL;
+
  private:
   static tagger* create(tagger_id id);
+
+  uint64_t identity_hash = 0;
 };
 
 } // namespace nametag
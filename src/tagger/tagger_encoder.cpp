@@ -0,0 +1,46 @@
+// This file is part of NameTag <http://github.com/ufal/nametag/>.
+//
+// Copyright 2016 Institute of Formal and Applied Linguistics, Faculty of
+// Mathematics and Physics, Charles University in Prague, Czech Republic.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+
+#include "morphodita/tagger/tagger.h"
+#include "tagger.h"
+#include "tagger_ids.h"
+
+namespace ufal {
+namespace nametag {
+
+bool tagger::quantize_int16_instance(istream& is, ostream& os) {
+  int id = is.get();
+  if (id == EOF || !os.put(id)) return false;
+
+  // Only MorphoDiTa taggers have scores to quantize
+  if (tagger_id(id) == tagger_ids::MORPHODITA)
+    return morphodita::tagger::quantize_int16(is, os);
+
+  return false;
+}
+
+bool tagger::recompress_instance(istream& is, ostream& os, compressor::codec codec) {
+  int id = is.get();
+  if (id == EOF || !os.put(id)) return false;
+
+  // Only MorphoDiTa taggers have a model, the other ones consist of the id
+  switch (tagger_id(id)) {
+    case tagger_ids::TRIVIAL:
+    case tagger_ids::EXTERNAL:
+      return true;
+    case tagger_ids::MORPHODITA:
+      return morphodita::tagger::recompress(is, os, codec);
+  }
+
+  return false;
+}
+
+} // namespace nametag
+} // namespace ufal
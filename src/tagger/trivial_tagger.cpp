@@ -20,15 +20,21 @@ bool trivial_tagger::create_and_encode(const string& /*params*/, ostream& /*os*/
   return true;
 }
 
-void trivial_tagger::tag(const vector<string_piece>& forms, ner_sentence& sentence) const {
+void trivial_tagger::tag(const vector<string_piece>& forms, ner_sentence& sentence, tagger_context* /*context*/) const {
   sentence.resize(forms.size());
   for (unsigned i = 0; i < forms.size(); i++) {
-    sentence.words[i].form.assign(forms[i].str, forms[i].len);
-    sentence.words[i].raw_lemma = sentence.words[i].form;
-    sentence.words[i].raw_lemmas_all.assign(1, sentence.words[i].raw_lemma);
-    sentence.words[i].lemma_id = sentence.words[i].form;
-    sentence.words[i].lemma_comments.clear();
-    sentence.words[i].tag.clear();
+    auto& word = sentence.words[i];
+
+    // Fill only the required attributes, all of them copies of the form
+    if (word_attributes & ner_word::FORM) word.form.assign(forms[i].str, forms[i].len);
+    if (word_attributes & ner_word::RAW_LEMMA) word.raw_lemma.assign(forms[i].str, forms[i].len);
+    if (word_attributes & ner_word::RAW_LEMMAS_ALL) {
+      word.raw_lemmas_all.resize(1);
+      word.raw_lemmas_all[0].assign(forms[i].str, forms[i].len);
+    }
+    if (word_attributes & ner_word::LEMMA_ID) word.lemma_id.assign(forms[i].str, forms[i].len);
+    if (word_attributes & ner_word::LEMMA_COMMENTS) word.lemma_comments.clear();
+    if (word_attributes & ner_word::TAG) word.tag.clear();
   }
 }
 
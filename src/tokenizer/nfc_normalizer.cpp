@@ -0,0 +1,104 @@
+// This file is part of NameTag <http://github.com/ufal/nametag/>.
+//
+// Copyright 2016 Institute of Formal and Applied Linguistics, Faculty of
+// Mathematics and Physics, Charles University in Prague, Czech Republic.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#include <algorithm>
+
+#include "nfc_normalizer.h"
+#include "unilib/unicode.h"
+#include "unilib/uninorms.h"
+#include "unilib/utf8.h"
+
+namespace ufal {
+namespace nametag {
+
+bool nfc_normalizer::normalize(string_piece text, string& normalized) {
+  spans.clear();
+
+  // The text before copied is already appended to normalized. The last
+  // stable character is where a span starts, because the following
+  // characters can compose with it.
+  const char* copied = text.str;
+  const char* last_stable = nullptr;
+  size_t last_stable_chars = 0, chars = 0;
+  long delta = 0;
+  for (const char* str = text.str, *end = text.str + text.len; str < end; ) {
+    if ((unsigned char)*str < 0x80) {
+      last_stable = str++;
+      last_stable_chars = chars++;
+      continue;
+    }
+
+    const char* chr_start = str;
+    size_t len = end - str;
+    char32_t chr = unilib::utf8::decode(str, len);
+    if (stable(chr)) {
+      last_stable = chr_start;
+      last_stable_chars = chars++;
+      continue;
+    }
+
+    // Normalize the span from the last stable character to the next one
+    const char* span_start = last_stable ? last_stable : chr_start;
+    size_t span_chars = last_stable ? last_stable_chars : chars;
+    for (chars++; str < end; chars++) {
+      const char* next = str;
+      size_t next_len = end - next;
+      if ((unsigned char)*next < 0x80 || stable(unilib::utf8::decode(next, next_len))) break;
+      str = next;
+    }
+    last_stable = nullptr;
+
+    unilib::utf8::decode(span_start, str - span_start, buffer);
+    size_t span_original_chars = chars - span_chars;
+    unilib::uninorms::nfc(buffer);
+    unilib::utf8::encode(buffer, encoded);
+    if (encoded.size() == size_t(str - span_start) && equal(encoded.begin(), encoded.end(), span_start))
+      continue;
+
+    if (spans.empty()) normalized.clear();
+    normalized.append(copied, span_start - copied).append(encoded);
+    copied = str;
+    spans.push_back({span_chars + delta, span_chars + delta + buffer.size(), span_chars, chars});
+    delta += long(buffer.size()) - long(span_original_chars);
+  }
+
+  if (spans.empty()) return false;
+  normalized.append(copied, text.str + text.len - copied);
+  return true;
+}
+
+size_t nfc_normalizer::original_offset(size_t offset, bool end) const {
+  // Find the last span starting before the offset, or at it unless an end
+  auto it = end ? lower_bound(spans.begin(), spans.end(), offset, [](const span& span, size_t offset) { return span.start < offset; })
+                : upper_bound(spans.begin(), spans.end(), offset, [](size_t offset, const span& span) { return offset < span.start; });
+  if (it == spans.begin()) return offset;
+  --it;
+
+  if (offset < it->end) return end ? it->original_end : it->original_start;
+  return offset - it->end + it->original_end;
+}
+
+void nfc_normalizer::compute_stable_block(unsigned block) {
+  if (block >= stable_blocks.size()) stable_blocks.resize(block + 1);
+  stable_blocks[block].reset(new bitset<256>());
+
+  // Combining marks and the Hangul medial vowel and final consonant jamos can
+  // compose with the previous character; the others must not change
+  for (unsigned i = 0; i < 256; i++) {
+    char32_t chr = (block << 8) + i;
+    if (chr >= 0x110000 || (unilib::unicode::category(chr) & unilib::unicode::M) || (chr >= 0x1161 && chr <= 0x11C2)) continue;
+
+    buffer.assign(1, chr);
+    unilib::uninorms::nfc(buffer);
+    stable_blocks[block]->set(i, buffer.size() == 1 && buffer[0] == chr);
+  }
+}
+
+} // namespace nametag
+} // namespace ufal
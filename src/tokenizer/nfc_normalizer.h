@@ -0,0 +1,60 @@
+// This file is part of NameTag <http://github.com/ufal/nametag/>.
+//
+// Copyright 2016 Institute of Formal and Applied Linguistics, Faculty of
+// Mathematics and Physics, Charles University in Prague, Czech Republic.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include <bitset>
+
+#include "common.h"
+#include "utils/string_piece.h"
+
+namespace ufal {
+namespace nametag {
+
+// Normalization of UTF-8 text to NFC. Only the spans of the text which can
+// change are normalized, the rest (ASCII and characters passing the quick
+// check) being copied; the character offsets of the normalized text can be
+// mapped back to the original one. Not thread-safe, every thread must use
+// its own instance.
+class nfc_normalizer {
+ public:
+  // Normalize the text to NFC into the given string, unless it already is in
+  // NFC, in which case false is returned and the string is not modified
+  bool normalize(string_piece text, string& normalized);
+
+  // Map the character offset of the last normalized text to the original
+  // text. An offset inside a changed span is mapped to the start of the span,
+  // or to its end if end is set (as is right for an end of a token).
+  size_t original_offset(size_t offset, bool end = false) const;
+
+ private:
+  // The changed spans, in characters of the normalized and the original text
+  struct span {
+    size_t start, end, original_start, original_end;
+  };
+  vector<span> spans;
+  u32string buffer;
+  string encoded;
+
+  // Whether a character is in NFC in any context: it does not change when
+  // normalized and it does not compose with or reorder around the previous
+  // character. Computed lazily for every block of 256 characters.
+  vector<unique_ptr<bitset<256>>> stable_blocks;
+  inline bool stable(char32_t chr);
+  void compute_stable_block(unsigned block);
+};
+
+bool nfc_normalizer::stable(char32_t chr) {
+  unsigned block = chr >> 8;
+  if (block >= stable_blocks.size() || !stable_blocks[block]) compute_stable_block(block);
+  return stable_blocks[block]->test(chr & 0xFF);
+}
+
+} // namespace nametag
+} // namespace ufal
@@ -0,0 +1,37 @@
+// This file is part of NameTag <http://github.com/ufal/nametag/>.
+//
+// Copyright 2017 Institute of Formal and Applied Linguistics, Faculty of
+// Mathematics and Physics, Charles University in Prague, Czech Republic.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#include "normalizing_tokenizer.h"
+
+namespace ufal {
+namespace nametag {
+
+void normalizing_tokenizer::set_text(string_piece text, bool make_copy) {
+  // The normalized text is always owned by this tokenizer
+  text_normalized = normalizer.normalize(text, normalized);
+  if (text_normalized)
+    inner->set_text(normalized, false);
+  else
+    inner->set_text(text, make_copy);
+}
+
+bool normalizing_tokenizer::next_sentence(vector<string_piece>* forms, vector<token_range>* tokens) {
+  if (!inner->next_sentence(forms, tokens)) return false;
+
+  if (text_normalized && tokens)
+    for (auto&& token : *tokens) {
+      size_t start = normalizer.original_offset(token.start);
+      token.length = normalizer.original_offset(token.start + token.length, true) - start;
+      token.start = start;
+    }
+  return true;
+}
+
+} // namespace nametag
+} // namespace ufal
@@ -0,0 +1,38 @@
+// This file is part of NameTag <http://github.com/ufal/nametag/>.
+//
+// Copyright 2017 Institute of Formal and Applied Linguistics, Faculty of
+// Mathematics and Physics, Charles University in Prague, Czech Republic.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include "common.h"
+#include "nfc_normalizer.h"
+#include "tokenizer.h"
+
+namespace ufal {
+namespace nametag {
+
+// Tokenizer normalizing the text to NFC before passing it to the given one.
+// The forms point into the normalized text, while the token ranges are
+// in characters of the original text.
+class normalizing_tokenizer : public tokenizer {
+ public:
+  normalizing_tokenizer(tokenizer* inner) : inner(inner) {}
+  virtual ~normalizing_tokenizer() override {}
+
+  virtual void set_text(string_piece text, bool make_copy = false) override;
+  virtual bool next_sentence(vector<string_piece>* forms, vector<token_range>* tokens) override;
+
+ private:
+  unique_ptr<tokenizer> inner;
+  nfc_normalizer normalizer;
+  string normalized;
+  bool text_normalized = false;
+};
+
+} // namespace nametag
+} // namespace ufal
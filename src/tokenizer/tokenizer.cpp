@@ -10,6 +10,7 @@
 #include "tokenizer.h"
 
 #include "morphodita_tokenizer_wrapper.h"
+#include "normalizing_tokenizer.h"
 
 namespace ufal {
 namespace nametag {
@@ -18,5 +19,9 @@ tokenizer* tokenizer::new_vertical_tokenizer() {
     return new morphodita_tokenizer_wrapper(morphodita::tokenizer::new_vertical_tokenizer());
 }
 
+tokenizer* tokenizer::new_normalizing_tokenizer(tokenizer* inner) {
+  return inner ? new normalizing_tokenizer(inner) : nullptr;
+}
+
 } // namespace nametag
 } // namespace ufal
@@ -32,8 +32,12 @@ class tokenizer {
   virtual void set_text(string_piece text, bool make_copy = false) = 0;
   virtual bool next_sentence(vector<string_piece>* forms, vector<token_range>* tokens) = 0;
 
-  // Static factory method
+  // Static factory methods
   static tokenizer* new_vertical_tokenizer();
+  // Tokenizer normalizing the text to NFC before tokenizing it by the given
+  // tokenizer, which it takes ownership of; the token ranges are in
+  // characters of the original text
+  static tokenizer* new_normalizing_tokenizer(tokenizer* inner);
 };
 
 } // namespace nametag
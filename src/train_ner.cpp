@@ -8,10 +8,13 @@
 // file, You can obtain one at http://mozilla.org/MPL/2.0/.
 
 #include <fstream>
+#include <sstream>
 
+#include "classifier/tcp_network_distribution.h"
 #include "ner/bilou_ner_trainer.h"
 #include "ner/ner_ids.h"
 #include "tagger/tagger.h"
+#include "utils/compressor.h"
 #include "utils/iostreams.h"
 #include "utils/options.h"
 #include "utils/parse_double.h"
@@ -23,24 +26,130 @@ using namespace ufal::nametag;
 int main(int argc, char* argv[]) {
   iostreams_init();
 
+  // Options must precede the ner_identifier, as the ner_identifier_specific_options can be negative numbers
+  int option_args = 1;
+  while (option_args < argc && argv[option_args][0] == '-') option_args++;
+  int rest_args = argc - option_args;
+  char** rest_argv = argv + option_args;
+
   ner_id id;
   options::map options;
-  if (argc == 1 || !ner_ids::parse(argv[1], id))
-    if (!options::parse({{"version", options::value::none},
-                         {"help", options::value::none}}, argc, argv, options) ||
-        options.count("help") ||
-        (argc < 2 && !options.count("version")))
-      runtime_failure("Usage: " << argv[0] << " [options] ner_identifier [ner_identifier_specific_options]\n"
-                      "Options: --version\n"
-                      "         --help");
+  if (!options::parse({{"distributed", options::value::any},
+                       {"early_stopping", options::value::any},
+                       {"feature_hashing", options::value::any},
+                       {"fine_tune", options::value::any},
+                       {"optimizer", options::value{"sgd", "adagrad"}},
+                       {"prune_features", options::value::any},
+                       {"quantize", options::value{"float16"}},
+                       {"sweep", options::value::any},
+                       {"tagged_data_cache", options::value::any},
+                       {"threads", options::value::any},
+                       {"uncompressed", options::value::none},
+                       {"version", options::value::none},
+                       {"help", options::value::none}}, option_args, argv, options) ||
+      options.count("help") ||
+      (!rest_args && !options.count("version")))
+    runtime_failure("Usage: " << argv[0] << " [options] ner_identifier [ner_identifier_specific_options]\n"
+                    "       " << argv[0] << " [options] --fine_tune=model iterations initial_learning_rate final_learning_rate gaussian [heldout_data]\n"
+                    "Options: --distributed=rank:processes:host:port of the process of rank 0\n"
+                    "         --early_stopping=iterations without heldout improvement\n"
+                    "         --feature_hashing=number of buckets of hashed feature keys\n"
+                    "         --fine_tune=model to train further instead of a new one\n"
+                    "         --optimizer=sgd|adagrad (default sgd)\n"
+                    "         --prune_features=minimum feature count (default 1)\n"
+                    "         --quantize=float16\n"
+                    "         --sweep=file with additional network parameters to choose from\n"
+                    "         --tagged_data_cache=directory caching tagged data\n"
+                    "         --threads=number of threads tagging the data and training (default 1)\n"
+                    "         --uncompressed\n"
+                    "         --version\n"
+                    "         --help");
   if (options.count("version"))
     return cout << version::version_and_copyright() << endl, 0;
 
-  if (!ner_ids::parse(argv[1], id)) runtime_failure("Cannot parse ner_identifier '" << argv[1] << "'!\n");
+  // Keep only the program name and the remaining arguments in argv
+  for (int i = 0; i < rest_args; i++)
+    argv[1 + i] = rest_argv[i];
+  argc = 1 + rest_args;
+
+  bool float16_weights = options.count("quantize");
+  compressor::codec codec = options.count("uncompressed") ? compressor::STORED : compressor::LZMA;
+  int threads = options.count("threads") ? parse_int(options["threads"], "number of threads") : 1;
+  if (threads < 1) runtime_failure("The number of threads must be positive!");
+  int early_stopping = options.count("early_stopping") ? parse_int(options["early_stopping"], "early stopping iterations") : 0;
+  if (early_stopping < 0) runtime_failure("The early stopping iterations must not be negative!");
+  int min_feature_count = options.count("prune_features") ? parse_int(options["prune_features"], "minimum feature count") : 1;
+  bool adagrad = options.count("optimizer") && options["optimizer"] == "adagrad";
+  int feature_hashing = options.count("feature_hashing") ? parse_int(options["feature_hashing"], "number of feature hashing buckets") : 0;
+  if (feature_hashing < 0) runtime_failure("The number of feature hashing buckets must not be negative!");
+
+  // Connect to the other training processes, the host being allowed to
+  // contain colons, as IPv6 addresses do
+  tcp_network_distribution distribution;
+  if (options.count("distributed")) {
+    const string& distributed = options["distributed"];
+    size_t rank_end = distributed.find(':'), processes_end = rank_end == string::npos ? rank_end : distributed.find(':', rank_end + 1);
+    size_t host_end = distributed.rfind(':');
+    if (processes_end == string::npos || host_end <= processes_end)
+      runtime_failure("The distributed training must be specified as rank:processes:host:port!");
+    int rank = parse_int(distributed.substr(0, rank_end), "distributed training rank");
+    int processes = parse_int(distributed.substr(rank_end + 1, processes_end - rank_end - 1), "number of distributed training processes");
+    int port = parse_int(distributed.substr(host_end + 1), "distributed training port");
+    if (processes < 1 || rank < 0 || rank >= processes) runtime_failure("The distributed training rank must be smaller than the positive number of processes!");
+
+    string error;
+    if (!distribution.start(rank, processes, distributed.substr(processes_end + 1, host_end - processes_end - 1), port, 60, error))
+      runtime_failure("Cannot start the distributed training: " << error);
+    cerr << "Connected as distributed training process " << rank << " of " << processes << "." << endl;
+  }
 
   // Switch stdout to binary mode.
   iostreams_init_binary_output();
 
+  // Train the given model further, using its ner_identifier and tagger
+  if (options.count("fine_tune")) {
+    if (argc < 5) runtime_failure("Usage: " << argv[0] << " [options] --fine_tune=model iterations initial_learning_rate final_learning_rate gaussian [heldout_data]");
+    if (feature_hashing) runtime_failure("The feature hashing of a fine-tuned model cannot be changed!");
+    if (options.count("sweep")) runtime_failure("The parameter sweep cannot be used when fine-tuning!");
+
+    ifstream model(options["fine_tune"], ifstream::binary);
+    if (!model.is_open()) runtime_failure("Cannot open model file '" << options["fine_tune"] << "'!");
+    id = ner_id(model.get());
+    if (id != ner_ids::CZECH_NER && id != ner_ids::ENGLISH_NER && id != ner_ids::GENERIC_NER)
+      runtime_failure("Unknown ner_identifier of the model to fine-tune!");
+
+    // The missing_weight and hidden_layer of the model are kept
+    network_parameters parameters;
+    parameters.iterations = parse_int(argv[1], "iterations");
+    parameters.missing_weight = 0;
+    parameters.initial_learning_rate = parse_double(argv[2], "initial_learning_rate");
+    parameters.final_learning_rate = parse_double(argv[3], "final_learning_rate");
+    parameters.gaussian_sigma = parse_double(argv[4], "gaussian");
+    parameters.hidden_layer = 0;
+    parameters.threads = threads;
+    parameters.early_stopping = early_stopping;
+    parameters.adagrad = adagrad;
+    parameters.distribution = options.count("distributed") ? &distribution : nullptr;
+    const char* heldout_file = argc == 5 ? nullptr : argv[5];
+
+    ifstream heldout;
+    if (heldout_file) {
+      heldout.open(heldout_file);
+      if (!heldout.is_open()) runtime_failure("Cannot open heldout file '" << heldout_file << "'!");
+    } else {
+      heldout.setstate(ios::failbit);
+    }
+
+    cout.put(id);
+    bilou_ner_trainer::fine_tune(id, parameters, float16_weights, codec, threads, min_feature_count,
+                                 options.count("tagged_data_cache") ? options["tagged_data_cache"] : string(), model, cin, heldout, cout);
+
+    cerr << "Recognizer saved." << endl;
+    return 0;
+  }
+
+  if (!ner_ids::parse(argv[1], id)) runtime_failure("Cannot parse ner_identifier '" << argv[1] << "'!\n");
+
   switch (id) {
     case ner_ids::CZECH_NER:
     case ner_ids::ENGLISH_NER:
@@ -52,8 +161,14 @@ int main(int argc, char* argv[]) {
         cout.put(id);
 
         // Create and encode the tagger
-        unique_ptr<tagger> tagger(tagger::create_and_encode_instance(argv[2], cout));
+        ostringstream tagger_encoding;
+        unique_ptr<tagger> tagger(tagger::create_and_encode_instance(argv[2], tagger_encoding));
         if (!tagger) runtime_failure("Cannot load and encode tagger!");
+        cout << tagger_encoding.str();
+
+        string tagged_data_cache;
+        if (options.count("tagged_data_cache"))
+          tagged_data_cache = bilou_ner_trainer::tagged_data_cache_prefix(options["tagged_data_cache"], tagger_encoding.str());
 
         // Parse options
         network_parameters parameters;
@@ -65,8 +180,41 @@ int main(int argc, char* argv[]) {
         parameters.final_learning_rate = parse_double(argv[8], "final_learning_rate");
         parameters.gaussian_sigma = parse_double(argv[9], "gaussian");
         parameters.hidden_layer = parse_int(argv[10], "hidden_layer");
+        parameters.threads = threads;
+        parameters.early_stopping = early_stopping;
+        parameters.adagrad = adagrad;
+        parameters.warm_start = false;
+        parameters.distribution = options.count("distributed") ? &distribution : nullptr;
         const char* heldout_file = argc == 11 ? nullptr : argv[11];
 
+        // Add the configurations of the sweep file, each line containing
+        // iterations missing_weight initial_learning_rate final_learning_rate
+        // gaussian, to the one given on the command line
+        vector<network_parameters> configurations(1, parameters);
+        if (options.count("sweep")) {
+          if (parameters.distribution) runtime_failure("The parameter sweep cannot be used with distributed training!");
+          if (!heldout_file) runtime_failure("The parameter sweep requires heldout data!");
+
+          ifstream sweep(options["sweep"]);
+          if (!sweep.is_open()) runtime_failure("Cannot open sweep file '" << options["sweep"] << "'!");
+          vector<string> tokens;
+          for (string line; getline(sweep, line); ) {
+            istringstream fields(line);
+            tokens.clear();
+            for (string field; fields >> field; )
+              tokens.push_back(field);
+            if (tokens.empty()) continue;
+            if (tokens.size() != 5) runtime_failure("The sweep file line '" << line << "' does not contain five columns!");
+
+            configurations.push_back(parameters);
+            configurations.back().iterations = parse_int(tokens[0], "iterations");
+            configurations.back().missing_weight = parse_double(tokens[1], "missing_weight");
+            configurations.back().initial_learning_rate = parse_double(tokens[2], "initial_learning_rate");
+            configurations.back().final_learning_rate = parse_double(tokens[3], "final_learning_rate");
+            configurations.back().gaussian_sigma = parse_double(tokens[4], "gaussian");
+          }
+        }
+
         // Open needed files
         ifstream features(features_file);
         if (!features.is_open()) runtime_failure("Cannot open features file '" << features_file << "'!");
@@ -80,7 +228,7 @@ int main(int argc, char* argv[]) {
         }
 
         // Encode the ner itself
-        bilou_ner_trainer::train(id, stages, parameters, *tagger, features, cin, heldout, cout);
+        bilou_ner_trainer::train(id, stages, configurations, float16_weights, codec, threads, min_feature_count, feature_hashing, *tagger, tagged_data_cache, features, cin, heldout, cout);
 
         cerr << "Recognizer saved." << endl;
         break;
@@ -60,14 +60,22 @@ class unicode {
   static const uint8_t othercase_index[CHARS >> 8];
   static const char32_t othercase_block[][256];
 
+  // Characters below LATIN are looked up directly, without the two levels
+  static const char32_t LATIN = 0x250;
+  static const category_t latin_category[LATIN];
+  static const char32_t latin_lowercase[LATIN];
+  static const char32_t latin_uppercase[LATIN];
+
   enum othercase_type { LOWER_ONLY = 1, UPPERTITLE_ONLY = 2, LOWER_THEN_UPPER = 3, UPPER_THEN_TITLE = 4, TITLE_THEN_LOWER = 5 };
 };
 
 unicode::category_t unicode::category(char32_t chr) {
+  if (chr < LATIN) return latin_category[chr];
   return chr < CHARS ? 1 << category_block[category_index[chr >> 8]][chr & 0xFF] : DEFAULT_CAT;
 }
 
 char32_t unicode::lowercase(char32_t chr) {
+  if (chr < LATIN) return latin_lowercase[chr];
   if (chr < CHARS) {
     char32_t othercase = othercase_block[othercase_index[chr >> 8]][chr & 0xFF];
     if ((othercase & 0xFF) == othercase_type::LOWER_ONLY) return othercase >> 8;
@@ -78,6 +86,7 @@ char32_t unicode::lowercase(char32_t chr) {
 }
 
 char32_t unicode::uppercase(char32_t chr) {
+  if (chr < LATIN) return latin_uppercase[chr];
   if (chr < CHARS) {
     char32_t othercase = othercase_block[othercase_index[chr >> 8]][chr & 0xFF];
     if ((othercase & 0xFF) == othercase_type::UPPERTITLE_ONLY) return othercase >> 8;
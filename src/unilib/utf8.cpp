@@ -10,6 +10,8 @@
 // UniLib version: 3.1.1
 // Unicode version: 8.0.0
 
+#include <cstring>
+
 #include "utf8.h"
 
 namespace ufal {
@@ -60,14 +62,24 @@ void utf8::decode(const char* str, std::u32string& decoded) {
 }
 
 void utf8::decode(const char* str, size_t len, std::u32string& decoded) {
-  decoded.clear();
-
-  while (len)
-    decoded.push_back(decode(str, len));
+  // There are at most as many characters as bytes, so the characters are
+  // stored directly, converting whole words of ASCII characters at once
+  decoded.resize(len);
+  char32_t* chr = &decoded[0];
+  for (uint64_t word; len; )
+    if (len >= sizeof(word) && (std::memcpy(&word, str, sizeof(word)), !(word & 0x8080808080808080ULL))) {
+      for (unsigned i = 0; i < sizeof(word); i++)
+        chr[i] = (unsigned char)str[i];
+      chr += sizeof(word), str += sizeof(word), len -= sizeof(word);
+    } else {
+      *chr++ = decode(str, len);
+    }
+  decoded.resize(chr - &decoded[0]);
 }
 
 void utf8::encode(const std::u32string& str, std::string& encoded) {
   encoded.clear();
+  encoded.reserve(str.size());
 
   for (auto&& chr : str)
     append(encoded, chr);
@@ -231,6 +231,7 @@ template<class F> void utf8::map(F f, const char* str, std::string& result) {
 
 template<class F> void utf8::map(F f, const char* str, size_t len, std::string& result) {
   result.clear();
+  result.reserve(len);
 
   while (len)
     append(result, f(decode(str, len)));
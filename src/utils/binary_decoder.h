@@ -9,7 +9,9 @@
 
 #pragma once
 
+#include <cstdint>
 #include <cstring>
+#include <memory>
 #include <stdexcept>
 
 #include "common.h"
@@ -30,19 +32,34 @@ class binary_decoder_error : public runtime_error {
 class binary_decoder {
  public:
   inline unsigned char* fill(unsigned len);
+  // Decode the given data in place, which are kept alive by the storage
+  inline void fill(const shared_ptr<const void>& storage, const unsigned char* data, unsigned len);
 
   inline unsigned next_1B();
   inline unsigned next_2B();
   inline unsigned next_4B();
   inline void next_str(string& str);
   template <class T> inline const T* next(unsigned elements);
+  // Return the elements added by binary_encoder::add_aligned, which are
+  // aligned in the decoded data if the data start is aligned in memory.
+  // Otherwise, the elements are copied to the given vector and its data are
+  // returned, so that the result is always suitably aligned for T.
+  template <class T> inline const T* next_aligned(unsigned elements, vector<T>& copy);
 
   inline bool is_end();
   inline unsigned tell();
   inline void seek(unsigned pos);
+  inline unsigned size() const;
+  inline const unsigned char* begin() const;
+
+  // The decoded data are kept alive as long as the returned storage is
+  // referenced, so that the results of next can be used even after the
+  // decoder is destroyed or filled again.
+  inline shared_ptr<const void> storage() const;
 
  private:
-  vector<unsigned char> buffer;
+  shared_ptr<const void> buffer;
+  const unsigned char* data_start;
   const unsigned char* data;
   const unsigned char* data_end;
 };
@@ -52,11 +69,18 @@ class binary_decoder {
 //
 
 unsigned char* binary_decoder::fill(unsigned len) {
-  buffer.resize(len);
-  data = buffer.data();
-  data_end = buffer.data() + len;
+  auto buffer = make_shared<vector<unsigned char>>(len);
+  this->buffer = buffer;
+  data_start = data = buffer->data();
+  data_end = buffer->data() + len;
+
+  return buffer->data();
+}
 
-  return buffer.data();
+void binary_decoder::fill(const shared_ptr<const void>& storage, const unsigned char* data, unsigned len) {
+  buffer = storage;
+  data_start = this->data = data;
+  data_end = data + len;
 }
 
 unsigned binary_decoder::next_1B() {
@@ -93,17 +117,42 @@ template <class T> const T* binary_decoder::next(unsigned elements) {
   return result;
 }
 
+template <class T> const T* binary_decoder::next_aligned(unsigned elements, vector<T>& copy) {
+  while (tell() % alignof(T))
+    if (next_1B()) throw binary_decoder_error("Nonzero padding in binary_decoder");
+
+  if (elements > size_t(data_end - data) / sizeof(T)) throw binary_decoder_error("No more data in binary_decoder");
+  const unsigned char* result = next<unsigned char>(sizeof(T) * elements);
+  if (uintptr_t(result) % alignof(T) == 0) return (const T*) result;
+
+  copy.resize(elements);
+  if (elements) memcpy((unsigned char*) copy.data(), result, sizeof(T) * elements);
+  return copy.data();
+}
+
 bool binary_decoder::is_end() {
   return data >= data_end;
 }
 
 unsigned binary_decoder::tell() {
-  return data - buffer.data();
+  return data - data_start;
 }
 
 void binary_decoder::seek(unsigned pos) {
-  if (pos > buffer.size()) throw binary_decoder_error("Cannot seek past end of binary_decoder");
-  data = buffer.data() + pos;
+  if (pos > size()) throw binary_decoder_error("Cannot seek past end of binary_decoder");
+  data = data_start + pos;
+}
+
+unsigned binary_decoder::size() const {
+  return data_end - data_start;
+}
+
+const unsigned char* binary_decoder::begin() const {
+  return data_start;
+}
+
+shared_ptr<const void> binary_decoder::storage() const {
+  return buffer;
 }
 
 } // namespace utils
@@ -33,6 +33,9 @@ class binary_encoder {
   inline void add_data(string_piece data);
   template <class T> inline void add_data(const vector<T>& data);
   template <class T> inline void add_data(const T* data, size_t elements);
+  // Add the elements after zero padding aligning them for T relative to the
+  // start of the data, see binary_decoder::next_aligned.
+  template <class T> inline void add_aligned(const T* data, size_t elements);
 
   vector<unsigned char> data;
 };
@@ -88,6 +91,12 @@ void binary_encoder::add_data(const T* data, size_t elements) {
   this->data.insert(this->data.end(), (const unsigned char*) data, (const unsigned char*) (data + elements));
 }
 
+template <class T>
+void binary_encoder::add_aligned(const T* data, size_t elements) {
+  this->data.resize((this->data.size() + alignof(T) - 1) / alignof(T) * alignof(T));
+  add_data(data, elements);
+}
+
 } // namespace utils
 } // namespace nametag
 } // namespace ufal
@@ -17,11 +17,53 @@ namespace utils {
 
 class binary_decoder;
 class binary_encoder;
+class memory_streambuf;
 
 class compressor {
  public:
+  // Codec of a saved block. LZMA blocks are saved with the original block
+  // header, so that all versions can load them. Blocks of other codecs are
+  // saved with a versioned header, which older versions reject.
+  enum codec { LZMA = 0, STORED = 1 };
+
+  // The data of STORED blocks read from an in_place_streambuf are decoded in
+  // place, without copying them.
   static bool load(istream& is, binary_decoder& data);
-  static bool save(ostream& os, const binary_encoder& enc);
+  // Read the next block as is, so that it can be loaded later, possibly in another thread.
+  static bool read_raw(istream& is, string& raw);
+  // Read the next block as is into a stream buffer. Blocks read from a
+  // memory_streambuf are referenced in place instead of copied.
+  static bool read_raw(istream& is, unique_ptr<memory_streambuf>& raw);
+  // The STORED codec keeps the data as is, which makes loading considerably
+  // faster at the cost of larger size. When the position of the output stream
+  // is known, the data are aligned in it to data_alignment bytes.
+  static bool save(ostream& os, const binary_encoder& enc, codec codec = LZMA);
+  // Load the next block and save it again using the given codec.
+  static bool recompress(istream& is, ostream& os, codec codec);
+
+ private:
+  // The versioned header starts with the marker instead of the uncompressed
+  // length of the original header, followed by the version, the codec, the
+  // number of zero padding bytes following the header, the uncompressed and
+  // the data length, a check of the header, and an FNV-1a hash of the data.
+  // The hash is not verified during loading, which would read all the data;
+  // it makes the header identify the content of the block, see tagger::identity.
+  enum { versioned_marker = 0xFFFFFFFFU, versioned_version = 1 };
+  struct versioned_header {
+    uint8_t version, codec;
+    uint16_t padding;
+    uint32_t uncompressed_len, data_len, check;
+    uint64_t data_hash;
+
+    inline uint32_t compute_check() const {
+      return ((((version * 251U + codec) * 65521U + padding) * 19991U + uncompressed_len) * 199999991U + data_len) * 16777619U
+          + uint32_t(data_hash) + uint32_t(data_hash >> 32) + 1234567890U;
+    }
+  };
+  enum { data_alignment = 64 };
+  static bool load_versioned(istream& is, binary_decoder& data);
+  // Read the header of the next block to raw and return the length of the following data
+  static bool read_raw_header(istream& is, string& raw, size_t& data_len);
 };
 
 } // namespace utils
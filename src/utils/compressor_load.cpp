@@ -11,6 +11,7 @@
 
 #include "compressor.h"
 #include "binary_decoder.h"
+#include "memory_streambuf.h"
 
 namespace ufal {
 namespace nametag {
@@ -1389,22 +1390,106 @@ bool compressor::load(istream& is, binary_decoder& data) {
   unsigned char props_encoded[LZMA_PROPS_SIZE];
 
   if (!is.read((char *) &uncompressed_len, sizeof(uncompressed_len))) return false;
+  if (uncompressed_len == versioned_marker) return load_versioned(is, data);
   if (!is.read((char *) &compressed_len, sizeof(compressed_len))) return false;
   if (!is.read((char *) &poor_crc, sizeof(poor_crc))) return false;
   if (poor_crc != uncompressed_len * 19991 + compressed_len * 199999991 + 1234567890) return false;
+
   if (!is.read((char *) props_encoded, sizeof(props_encoded))) return false;
 
-  vector<unsigned char> compressed(compressed_len);
-  if (!is.read((char *) compressed.data(), compressed_len)) return false;
+  // The compressed data of in-place streams are decompressed without copying
+  vector<unsigned char> compressed;
+  shared_ptr<const void> compressed_storage;
+  const unsigned char* compressed_data = nullptr;
+  if (auto in_place = dynamic_cast<in_place_streambuf*>(is.rdbuf()))
+    compressed_data = (const unsigned char *) in_place->next_in_place(compressed_len, compressed_storage);
+  if (!compressed_data) {
+    compressed.resize(compressed_len);
+    if (!is.read((char *) compressed.data(), compressed_len)) return false;
+    compressed_data = compressed.data();
+  }
 
   lzma::ELzmaStatus status;
   size_t uncompressed_size = uncompressed_len, compressed_size = compressed_len;
-  auto res = lzma::LzmaDecode(data.fill(uncompressed_len), &uncompressed_size, compressed.data(), &compressed_size, props_encoded, LZMA_PROPS_SIZE, lzma::LZMA_FINISH_ANY, &status, &lzmaAllocator);
+  auto res = lzma::LzmaDecode(data.fill(uncompressed_len), &uncompressed_size, compressed_data, &compressed_size, props_encoded, LZMA_PROPS_SIZE, lzma::LZMA_FINISH_ANY, &status, &lzmaAllocator);
   if (res != SZ_OK || uncompressed_size != uncompressed_len || compressed_size != compressed_len) return false;
 
   return true;
 }
 
+bool compressor::load_versioned(istream& is, binary_decoder& data) {
+  versioned_header header;
+  static_assert(sizeof(header) == 24, "Unexpected size of compressor::versioned_header");
+
+  if (!is.read((char *) &header, sizeof(header))) return false;
+  if (header.check != header.compute_check()) return false;
+  if (header.version != versioned_version) return false;
+  if (!is.ignore(header.padding)) return false;
+
+  switch (header.codec) {
+    case STORED:
+      if (header.data_len != header.uncompressed_len) return false;
+      if (auto in_place = dynamic_cast<in_place_streambuf*>(is.rdbuf())) {
+        shared_ptr<const void> storage;
+        if (auto stored = in_place->next_in_place(header.data_len, storage))
+          return data.fill(storage, (const unsigned char *) stored, header.data_len), true;
+      }
+      return bool(is.read((char *) data.fill(header.uncompressed_len), header.uncompressed_len));
+  }
+
+  return false;
+}
+
+bool compressor::read_raw_header(istream& is, string& raw, size_t& data_len) {
+  uint32_t header[3];
+
+  if (!is.read((char *) header, sizeof(uint32_t))) return false;
+  if (header[0] == versioned_marker) {
+    versioned_header versioned;
+    if (!is.read((char *) &versioned, sizeof(versioned))) return false;
+    if (versioned.check != versioned.compute_check()) return false;
+
+    data_len = versioned.padding + size_t(versioned.data_len);
+    raw.assign((const char *) header, sizeof(uint32_t));
+    raw.append((const char *) &versioned, sizeof(versioned));
+    return true;
+  }
+
+  if (!is.read((char *) (header + 1), 2 * sizeof(uint32_t))) return false;
+  uint32_t uncompressed_len = header[0], compressed_len = header[1], poor_crc = header[2];
+  if (poor_crc != uncompressed_len * 19991 + compressed_len * 199999991 + 1234567890) return false;
+
+  data_len = LZMA_PROPS_SIZE + size_t(compressed_len);
+  raw.assign((const char *) header, sizeof(header));
+  return true;
+}
+
+bool compressor::read_raw(istream& is, string& raw) {
+  size_t data_len;
+  if (!read_raw_header(is, raw, data_len)) return false;
+
+  raw.resize(raw.size() + data_len);
+  return bool(is.read(&raw[raw.size() - data_len], data_len));
+}
+
+bool compressor::read_raw(istream& is, unique_ptr<memory_streambuf>& raw) {
+  if (auto memory = dynamic_cast<memory_streambuf*>(is.rdbuf())) {
+    const char* start = memory->current();
+    string header;
+    size_t data_len;
+    if (!read_raw_header(is, header, data_len)) return false;
+    shared_ptr<const void> storage;
+    if (!memory->next_in_place(data_len, storage)) return false;
+    raw.reset(new memory_streambuf(storage, start, memory->current() - start));
+    return true;
+  }
+
+  auto data = make_shared<string>();
+  if (!read_raw(is, *data)) return false;
+  raw.reset(new memory_streambuf(data, data->data(), data->size()));
+  return true;
+}
+
 } // namespace utils
 } // namespace nametag
 } // namespace ufal
@@ -9,6 +9,7 @@
 
 #include <cstring>
 
+#include "binary_decoder.h"
 #include "binary_encoder.h"
 #include "compressor.h"
 
@@ -3308,7 +3309,38 @@ static void LzmaFree(void* /*p*/, void *address) { delete[] (char*) address; }
 static lzma::ISzAlloc lzmaAllocator = { LzmaAlloc, LzmaFree };
 #endif // UFAL_CPPUTILS_COMPRESSOR_LZMA_ALLOCATOR_H
 
-bool compressor::save(ostream& os, const binary_encoder& enc) {
+bool compressor::save(ostream& os, const binary_encoder& enc, codec codec) {
+  if (codec == STORED) {
+    versioned_header header;
+    uint32_t marker = versioned_marker;
+    header.version = versioned_version;
+    header.codec = codec;
+    header.uncompressed_len = header.data_len = enc.data.size();
+    if (header.uncompressed_len != enc.data.size()) return false;
+
+    // Align the data in the output if its position is known, so that the
+    // data can be used in place when the output is memory mapped
+    header.padding = 0;
+    streamoff position = os.tellp();
+    if (position >= 0) {
+      position += sizeof(marker) + sizeof(header);
+      header.padding = (data_alignment - position % data_alignment) % data_alignment;
+    }
+
+    header.data_hash = 14695981039346656037ULL;
+    for (auto&& byte : enc.data)
+      header.data_hash = (header.data_hash ^ byte) * 1099511628211ULL;
+    header.check = header.compute_check();
+
+    static const char padding[data_alignment] = {};
+    if (!os.write((const char*) &marker, sizeof(uint32_t))) return false;
+    if (!os.write((const char*) &header, sizeof(header))) return false;
+    if (!os.write(padding, header.padding)) return false;
+    if (!os.write((const char*) enc.data.data(), header.data_len)) return false;
+    return true;
+  }
+  if (codec != LZMA) return false;
+
   size_t uncompressed_size = enc.data.size(), compressed_size = 2 * enc.data.size() + 100;
   vector<unsigned char> compressed(compressed_size);
 
@@ -3322,6 +3354,8 @@ bool compressor::save(ostream& os, const binary_encoder& enc) {
 
   uint32_t poor_crc = uncompressed_size * 19991 + compressed_size * 199999991 + 1234567890;
   if (uint32_t(uncompressed_size) != uncompressed_size || uint32_t(compressed_size) != compressed_size) return false;
+  // The uncompressed size in the original header must differ from the versioned_marker
+  if (uncompressed_size == versioned_marker) return false;
   if (!os.write((const char*) &uncompressed_size, sizeof(uint32_t))) return false;
   if (!os.write((const char*) &compressed_size, sizeof(uint32_t))) return false;
   if (!os.write((const char*) &poor_crc, sizeof(uint32_t))) return false;
@@ -3331,6 +3365,15 @@ bool compressor::save(ostream& os, const binary_encoder& enc) {
   return true;
 }
 
+bool compressor::recompress(istream& is, ostream& os, codec codec) {
+  binary_decoder data;
+  if (!load(is, data)) return false;
+
+  binary_encoder enc;
+  enc.data.assign(data.begin(), data.begin() + data.size());
+  return save(os, enc, codec);
+}
+
 } // namespace utils
 } // namespace nametag
 } // namespace ufal
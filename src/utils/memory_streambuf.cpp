@@ -0,0 +1,91 @@
+// This file is part of UFAL C++ Utils <http://github.com/ufal/cpp_utils/>.
+//
+// Copyright 2015 Institute of Formal and Applied Linguistics, Faculty of
+// Mathematics and Physics, Charles University in Prague, Czech Republic.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "memory_streambuf.h"
+
+namespace ufal {
+namespace nametag {
+namespace utils {
+
+memory_streambuf::memory_streambuf(const shared_ptr<const void>& storage, const char* data, size_t len) : data_storage(storage) {
+  // The buffer is never written to, the get area only needs non-const pointers
+  setg(const_cast<char*>(data), const_cast<char*>(data), const_cast<char*>(data) + len);
+}
+
+memory_streambuf* memory_streambuf::map_file(const char* fname) {
+#ifdef _WIN32
+  HANDLE file = CreateFileA(fname, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file == INVALID_HANDLE_VALUE) return nullptr;
+
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file, &size) || size.QuadPart <= 0 || uint64_t(size.QuadPart) != size_t(size.QuadPart))
+    return CloseHandle(file), nullptr;
+
+  HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  CloseHandle(file);
+  if (!mapping) return nullptr;
+
+  void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  CloseHandle(mapping);
+  if (!data) return nullptr;
+
+  shared_ptr<const void> storage(data, [](const void* data) { UnmapViewOfFile(data); });
+  return new memory_streambuf(storage, (const char*) data, size_t(size.QuadPart));
+#else
+  int fd = open(fname, O_RDONLY);
+  if (fd < 0) return nullptr;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0 || uint64_t(st.st_size) != size_t(st.st_size))
+    return close(fd), nullptr;
+
+  size_t len = st.st_size;
+  void* data = mmap(nullptr, len, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) return nullptr;
+
+  shared_ptr<const void> storage(data, [len](const void* data) { munmap(const_cast<void*>(data), len); });
+  return new memory_streambuf(storage, (const char*) data, len);
+#endif
+}
+
+const char* memory_streambuf::next_in_place(size_t len, shared_ptr<const void>& storage) {
+  if (size_t(egptr() - gptr()) < len) return nullptr;
+
+  const char* data = gptr();
+  setg(eback(), gptr() + len, egptr());
+  storage = data_storage;
+  return data;
+}
+
+memory_streambuf::pos_type memory_streambuf::seekoff(off_type off, ios_base::seekdir dir, ios_base::openmode which) {
+  off_type base = dir == ios_base::beg ? 0 : dir == ios_base::cur ? gptr() - eback() : egptr() - eback();
+  return seekpos(pos_type(base + off), which);
+}
+
+memory_streambuf::pos_type memory_streambuf::seekpos(pos_type pos, ios_base::openmode which) {
+  if (!(which & ios_base::in) || off_type(pos) < 0 || off_type(pos) > egptr() - eback()) return pos_type(off_type(-1));
+
+  setg(eback(), eback() + off_type(pos), egptr());
+  return pos;
+}
+
+} // namespace utils
+} // namespace nametag
+} // namespace ufal
@@ -0,0 +1,66 @@
+// This file is part of UFAL C++ Utils <http://github.com/ufal/cpp_utils/>.
+//
+// Copyright 2015 Institute of Formal and Applied Linguistics, Faculty of
+// Mathematics and Physics, Charles University in Prague, Czech Republic.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include <memory>
+#include <streambuf>
+
+#include "common.h"
+
+namespace ufal {
+namespace nametag {
+namespace utils {
+
+// Stream buffer which can provide the following data in place instead of
+// copying them, used by the compressor to reference stored blocks in place.
+class in_place_streambuf : public streambuf {
+ public:
+  // Return the next len bytes and skip them, storing the owner keeping them
+  // alive in storage. If the data are not available in place, nullptr is
+  // returned and nothing is skipped.
+  virtual const char* next_in_place(size_t len, shared_ptr<const void>& storage) = 0;
+};
+
+// Read-only seekable stream buffer over memory kept alive by its storage,
+// for example a memory mapped file.
+class memory_streambuf : public in_place_streambuf {
+ public:
+  memory_streambuf(const shared_ptr<const void>& storage, const char* data, size_t len);
+
+  // Map the given file read-only and shared, so that processes mapping the
+  // same file share its pages. Returns nullptr if the file cannot be mapped;
+  // the mapping is released once its storage is no longer referenced.
+  static memory_streambuf* map_file(const char* fname);
+
+  // Map a copy of the given file kept in the named shared memory segment,
+  // creating the segment first if it does not exist, is incomplete or
+  // contains another version of the file (by its size and mtime). The
+  // segment outlives the process, so that all processes mapping it share its
+  // pages even if the file is not kept in the page cache. On Windows the
+  // file is mapped directly by map_file. Defined in
+  // memory_streambuf_shared.cpp, which requires -lrt on older glibc.
+  static memory_streambuf* map_shared_memory(const char* fname, const char* name);
+
+  const shared_ptr<const void>& storage() const { return data_storage; }
+  const char* current() const { return gptr(); }
+
+  virtual const char* next_in_place(size_t len, shared_ptr<const void>& storage) override;
+
+ protected:
+  virtual pos_type seekoff(off_type off, ios_base::seekdir dir, ios_base::openmode which) override;
+  virtual pos_type seekpos(pos_type pos, ios_base::openmode which) override;
+
+ private:
+  shared_ptr<const void> data_storage;
+};
+
+} // namespace utils
+} // namespace nametag
+} // namespace ufal
@@ -0,0 +1,132 @@
+// This file is part of UFAL C++ Utils <http://github.com/ufal/cpp_utils/>.
+//
+// Copyright 2015 Institute of Formal and Applied Linguistics, Faculty of
+// Mathematics and Physics, Charles University in Prague, Czech Republic.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#ifndef _WIN32
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "memory_streambuf.h"
+
+namespace ufal {
+namespace nametag {
+namespace utils {
+
+#ifndef _WIN32
+// The segment contains the file followed by this trailer, which is written
+// last, so that the segments left incomplete by a crashed process are
+// recognized, and which identifies the version of the file
+struct segment_trailer {
+  enum : uint64_t { MAGIC = 0x4E54534547454E44ULL };
+  uint64_t magic, size;
+  int64_t mtime;
+};
+
+// Copy the file contents followed by its trailer to the given empty segment
+static bool copy_to_segment(int file, int segment, const segment_trailer& trailer) {
+  size_t len = trailer.size;
+  if (ftruncate(segment, len + sizeof(trailer)) != 0) return false;
+
+  void* data = mmap(nullptr, len + sizeof(trailer), PROT_READ | PROT_WRITE, MAP_SHARED, segment, 0);
+  if (data == MAP_FAILED) return false;
+
+  bool copied = true;
+  for (size_t copied_len = 0; copied && copied_len < len; ) {
+    ssize_t read_len = read(file, (char*) data + copied_len, len - copied_len);
+    if (read_len > 0) copied_len += read_len;
+    else copied = read_len < 0 && errno == EINTR;
+  }
+  if (copied) memcpy((char*) data + len, &trailer, sizeof(trailer));
+  munmap(data, len + sizeof(trailer));
+  return copied;
+}
+
+// Check that the segment is complete and contains the file of the trailer
+static bool segment_up_to_date(int segment, const segment_trailer& trailer) {
+  struct stat st;
+  if (fstat(segment, &st) != 0 || uint64_t(st.st_size) != trailer.size + sizeof(trailer)) return false;
+
+  segment_trailer stored;
+  if (pread(segment, &stored, sizeof(stored), trailer.size) != ssize_t(sizeof(stored))) return false;
+  return stored.magic == trailer.magic && stored.size == trailer.size && stored.mtime == trailer.mtime;
+}
+
+// Unlink the segment name only if it still refers to the given segment, and
+// not to a newer one created after another process unlinked this one
+static void unlink_segment(const char* name, int segment) {
+  struct stat st, named_st;
+  int named = shm_open(name, O_RDONLY, 0);
+  if (named < 0) return;
+  if (fstat(segment, &st) == 0 && fstat(named, &named_st) == 0 && st.st_dev == named_st.st_dev && st.st_ino == named_st.st_ino)
+    shm_unlink(name);
+  close(named);
+}
+#endif
+
+memory_streambuf* memory_streambuf::map_shared_memory(const char* fname, const char* name) {
+#ifdef _WIN32
+  // The mappings of the same file already share their pages on Windows
+  return map_file(fname);
+#else
+  int file = open(fname, O_RDONLY);
+  if (file < 0) return nullptr;
+
+  struct stat file_st;
+  if (fstat(file, &file_st) != 0 || !S_ISREG(file_st.st_mode) || file_st.st_size <= 0 || uint64_t(file_st.st_size) != size_t(file_st.st_size))
+    return close(file), nullptr;
+  segment_trailer trailer = {segment_trailer::MAGIC, uint64_t(file_st.st_size), int64_t(file_st.st_mtime)};
+  size_t len = trailer.size;
+
+  // The segment is checked and filled under an exclusive lock, so that
+  // concurrently starting processes copy the file only once. An outdated or
+  // incomplete segment is unlinked and created anew, because the processes
+  // still mapping it must keep their pages intact; the segments are only
+  // unlinked under their lock, so the check of the name cannot race.
+  for (int attempt = 0; attempt < 3; attempt++) {
+    int segment = shm_open(name, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (segment < 0) break;
+
+    struct stat st;
+    if (flock(segment, LOCK_EX) != 0 || fstat(segment, &st) != 0) {
+      close(segment);
+      break;
+    }
+    if (st.st_size && !segment_up_to_date(segment, trailer)) {
+      unlink_segment(name, segment);
+      close(segment);
+      continue;
+    }
+    if (!st.st_size && !copy_to_segment(file, segment, trailer)) {
+      unlink_segment(name, segment);
+      close(segment);
+      break;
+    }
+
+    void* data = mmap(nullptr, len, PROT_READ, MAP_SHARED, segment, 0);
+    close(segment);
+    if (data == MAP_FAILED) break;
+    close(file);
+
+    shared_ptr<const void> storage(data, [len](const void* data) { munmap(const_cast<void*>(data), len); });
+    return new memory_streambuf(storage, (const char*) data, len);
+  }
+
+  close(file);
+  return nullptr;
+#endif
+}
+
+} // namespace utils
+} // namespace nametag
+} // namespace ufal
@@ -0,0 +1,100 @@
+// This file is part of UFAL C++ Utils <http://github.com/ufal/cpp_utils/>.
+//
+// Copyright 2015 Institute of Formal and Applied Linguistics, Faculty of
+// Mathematics and Physics, Charles University in Prague, Czech Republic.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include <cstring>
+
+#include "common.h"
+#include "string_piece.h"
+
+namespace ufal {
+namespace nametag {
+namespace utils {
+
+//
+// Declarations
+//
+
+// Read paragraphs like getpara, but read the input in large chunks and return
+// the paragraphs as pieces of the internal buffer, without copying them line
+// by line. The returned paragraph is valid until the next call.
+class paragraph_reader {
+ public:
+  paragraph_reader(istream& is) : is(is) {}
+
+  // Return the lines until an empty line (stored too) or EOF. A paragraph
+  // reaching max_length bytes is returned in parts ending at line ends, once
+  // their length is at least max_length. If given, ended is set to whether
+  // the returned part ends with an empty line.
+  inline bool next(string_piece& para, bool* ended = nullptr, size_t max_length = size_t(-1));
+
+ private:
+  inline bool fill(size_t& end);
+
+  istream& is;
+  string buffer;
+  size_t start = 0;
+  bool eof = false;
+
+  enum { chunk_size = 1 << 20 };
+};
+
+//
+// Definitions
+//
+
+bool paragraph_reader::next(string_piece& para, bool* ended, size_t max_length) {
+  bool empty_line = false;
+  size_t end = start;
+
+  while (true) {
+    auto newline = (const char*) memchr(buffer.data() + end, '\n', buffer.size() - end);
+    if (!newline) {
+      if (fill(end)) continue;
+      if (end == buffer.size()) break;
+
+      // The last line without a newline gets one, like when using getline
+      buffer.push_back('\n');
+      continue;
+    }
+
+    empty_line = newline == buffer.data() + end;
+    end = newline + 1 - buffer.data();
+    if (empty_line || end - start >= max_length) break;
+  }
+
+  if (ended) *ended = empty_line;
+  if (end == start) return false;
+
+  para = string_piece(buffer.data() + start, end - start);
+  start = end;
+  return true;
+}
+
+bool paragraph_reader::fill(size_t& end) {
+  if (eof) return false;
+
+  // Drop the already returned data
+  buffer.erase(0, start);
+  end -= start;
+  start = 0;
+
+  size_t size = buffer.size();
+  buffer.resize(size + chunk_size);
+  is.read(&buffer[size], chunk_size);
+  buffer.resize(size + is.gcount());
+  if (!is) eof = true;
+
+  return buffer.size() > size;
+}
+
+} // namespace utils
+} // namespace nametag
+} // namespace ufal
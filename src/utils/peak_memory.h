@@ -0,0 +1,49 @@
+// This file is part of UFAL C++ Utils <http://github.com/ufal/cpp_utils/>.
+//
+// Copyright 2015 Institute of Formal and Applied Linguistics, Faculty of
+// Mathematics and Physics, Charles University in Prague, Czech Republic.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+#include "common.h"
+
+namespace ufal {
+namespace nametag {
+namespace utils {
+
+//
+// Declarations
+//
+
+// Return the peak resident memory of the process in kilobytes,
+// or -1 when it is not available on the platform.
+inline long peak_memory_kb();
+
+//
+// Definitions
+//
+
+long peak_memory_kb() {
+#ifndef _WIN32
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0)
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+#endif
+  return -1;
+}
+
+} // namespace utils
+} // namespace nametag
+} // namespace ufal
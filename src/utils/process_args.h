@@ -9,8 +9,10 @@
 
 #pragma once
 
+#include <atomic>
 #include <cstring>
 #include <fstream>
+#include <thread>
 
 #ifdef _WIN32
 #include <fcntl.h>
@@ -23,6 +25,21 @@ namespace ufal {
 namespace nametag {
 namespace utils {
 
+// Split the argument input_file:output_file in place, returning the output_file
+// or nullptr if it is not specified.
+inline char* split_output_file(char* file_in) {
+  char* file_out = strchr(file_in
+#ifdef _WIN32
+                          + ((((file_in[0] >= 'A' && file_in[0] <= 'Z') || (file_in[0] >= 'a' && file_in[0] <= 'z')) &&
+                              file_in[1] == ':' &&
+                              (file_in[2] == '/' || file_in[2] == '\\')
+                             ) ? 3 : 0)
+#endif
+                          , ':');
+  if (file_out) *file_out++ = '\0';
+  return file_out;
+}
+
 // Call a given processor on specified arguments. Every argument can be
 // either input_file or input_file:output_file. If not output_file is specified,
 // stdout is used. If there are no arguments at all, stdin and stdout are used.
@@ -32,15 +49,7 @@ void process_args(int argi, int argc, char* argv[], T processor, U&&... processo
     processor(cin, cout, std::forward<U>(processor_args)...);
   } else for (; argi < argc; argi++) {
     char* file_in = argv[argi];
-    char* file_out = strchr(file_in
-#ifdef _WIN32
-                            + ((((file_in[0] >= 'A' && file_in[0] <= 'Z') || (file_in[0] >= 'a' && file_in[0] <= 'z')) &&
-                                file_in[1] == ':' &&
-                                (file_in[2] == '/' || file_in[2] == '\\')
-                               ) ? 3 : 0)
-#endif
-                            , ':');
-    if (file_out) *file_out++ = '\0';
+    char* file_out = split_output_file(file_in);
 
     ifstream in(file_in);
     if (!in) runtime_failure("Cannot open file '" << file_in << "' for reading!");
@@ -55,6 +64,37 @@ void process_args(int argi, int argc, char* argv[], T processor, U&&... processo
   }
 }
 
+// Call a given processor on specified arguments like process_args, but using
+// the given number of threads, each processing one argument at a time. Every
+// argument must then be input_file:output_file.
+template <class T, class... U>
+void process_args_parallel(int jobs, int argi, int argc, char* argv[], T processor, U&&... processor_args) {
+  if (jobs <= 1 || argc - argi <= 1) return process_args(argi, argc, argv, processor, std::forward<U>(processor_args)...);
+
+  vector<char*> files_out;
+  for (int i = argi; i < argc; i++) {
+    files_out.push_back(split_output_file(argv[i]));
+    if (!files_out.back()) runtime_failure("An output file must be specified for '" << argv[i] << "' when processing files in parallel!");
+  }
+
+  atomic<int> next(argi);
+  vector<thread> threads;
+  for (int job = 0; job < jobs && job < argc - argi; job++)
+    threads.emplace_back([&]() {
+      for (int i; (i = next++) < argc; ) {
+        ifstream in(argv[i]);
+        if (!in) runtime_failure("Cannot open file '" << argv[i] << "' for reading!");
+
+        ofstream out(files_out[i - argi]);
+        if (!out) runtime_failure("Cannot open file '" << files_out[i - argi] << "' for writing!");
+
+        processor(in, out, processor_args...);
+      }
+    });
+  for (auto&& thread : threads)
+    thread.join();
+}
+
 // Call a given processor on specified arguments. Every argument is name of
 // input file; output is written to the file with specified name template,
 // which can contain {} for base name of the input file (without directories
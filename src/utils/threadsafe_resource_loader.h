@@ -35,6 +35,10 @@ class threadsafe_resource_loader {
   T* load(unsigned id);
   void release(unsigned id);
 
+  // Use the resource only if it is loaded already, without loading it or
+  // changing the order in which the loaded resources are released.
+  T* use_if_loaded(unsigned id);
+
  private:
   unsigned concurrent_limit;
 
@@ -145,6 +149,20 @@ T* threadsafe_resource_loader<T>::load(unsigned id) {
   return nullptr;
 }
 
+template <class T>
+T* threadsafe_resource_loader<T>::use_if_loaded(unsigned id) {
+  if (id < resources.size()) {
+    unique_lock<mutex> lock(resource_mutex);
+
+    if (resources[id].state == resource_info::LOADED) {
+      if (!resources[id].used_count++) used_resources++;
+      return resources[id].resource;
+    }
+  }
+
+  return nullptr;
+}
+
 template <class T>
 void threadsafe_resource_loader<T>::release(unsigned id) {
   bool notify_all = false;
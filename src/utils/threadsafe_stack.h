@@ -10,6 +10,9 @@
 #pragma once
 
 #include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
 
 #include "common.h"
 
@@ -21,33 +24,75 @@ namespace utils {
 // Declarations
 //
 
+// A stack of reusable objects. Every thread first uses its own slot, so that
+// acquiring an object does not contend with other threads in the common case,
+// and only falls back to a shared stack guarded by a spinlock.
 template <class T>
 class threadsafe_stack {
  public:
+  inline threadsafe_stack();
+  inline ~threadsafe_stack();
+
   inline void push(T* t);
   inline T* pop();
 
+  // Number of the objects kept in the stack, only approximate when the stack
+  // is used concurrently.
+  inline size_t size();
+
  private:
+  // Every slot occupies its own cache line. The slots are allocated separately
+  // and aligned manually, as the stack itself can be allocated by new, which
+  // does not respect extended alignment before C++17.
+  enum { slots_count = 64, cache_line = 64 };
+  struct alignas(cache_line) slot {
+    atomic<T*> t{nullptr};
+  };
+  unique_ptr<char[]> slots_buffer;
+  slot* slots;
+
   vector<unique_ptr<T>> stack;
   atomic_flag lock = ATOMIC_FLAG_INIT;
+
+  static inline unsigned thread_slot();
+  inline void acquire_lock();
 };
 
 //
 // Definitions
 //
 
+template <class T>
+threadsafe_stack<T>::threadsafe_stack() : slots_buffer(new char[(slots_count + 1) * sizeof(slot)]) {
+  slots = (slot*) ((uintptr_t(slots_buffer.get()) + cache_line - 1) & ~uintptr_t(cache_line - 1));
+  for (unsigned i = 0; i < slots_count; i++)
+    new (slots + i) slot();
+}
+
+template <class T>
+threadsafe_stack<T>::~threadsafe_stack() {
+  for (unsigned i = 0; i < slots_count; i++)
+    delete slots[i].t.load(memory_order_relaxed);
+}
+
 template <class T>
 void threadsafe_stack<T>::push(T* t) {
-  while (lock.test_and_set(memory_order_acquire)) {}
+  T* empty = nullptr;
+  if (slots[thread_slot()].t.compare_exchange_strong(empty, t, memory_order_release, memory_order_relaxed))
+    return;
+
+  acquire_lock();
   stack.emplace_back(t);
   lock.clear(memory_order_release);
 }
 
 template <class T>
 T* threadsafe_stack<T>::pop() {
-  T* res = nullptr;
+  auto& slot = slots[thread_slot()];
+  T* res = slot.t.load(memory_order_relaxed) ? slot.t.exchange(nullptr, memory_order_acquire) : nullptr;
+  if (res) return res;
 
-  while (lock.test_and_set(memory_order_acquire)) {}
+  acquire_lock();
   if (!stack.empty()) {
     res = stack.back().release();
     stack.pop_back();
@@ -57,6 +102,32 @@ T* threadsafe_stack<T>::pop() {
   return res;
 }
 
+template <class T>
+size_t threadsafe_stack<T>::size() {
+  size_t size = 0;
+  for (unsigned i = 0; i < slots_count; i++)
+    size += slots[i].t.load(memory_order_relaxed) != nullptr;
+
+  acquire_lock();
+  size += stack.size();
+  lock.clear(memory_order_release);
+
+  return size;
+}
+
+template <class T>
+unsigned threadsafe_stack<T>::thread_slot() {
+  static atomic<unsigned> threads(0);
+  static thread_local unsigned slot = threads++ % slots_count;
+  return slot;
+}
+
+template <class T>
+void threadsafe_stack<T>::acquire_lock() {
+  for (unsigned spins = 0; lock.test_and_set(memory_order_acquire); spins++)
+    if (spins >= 64) this_thread::yield();
+}
+
 } // namespace utils
 } // namespace nametag
 } // namespace ufal
@@ -0,0 +1,24 @@
+// This file is part of NameTag <http://github.com/ufal/nametag/>.
+//
+// Copyright 2016 Institute of Formal and Applied Linguistics, Faculty of
+// Mathematics and Physics, Charles University in Prague, Czech Republic.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+// Static tracepoints of the recognition pipeline. When NAMETAG_TRACEPOINTS
+// is defined (make TRACEPOINTS=1), they are compiled as USDT probes of the
+// nametag provider using sys/sdt.h of SystemTap, which are a single nop
+// instruction until a tracer like bpftrace attaches to them. Otherwise they
+// are compiled to nothing.
+#ifdef NAMETAG_TRACEPOINTS
+#include <sys/sdt.h>
+#define NAMETAG_TRACE1(name, arg1) DTRACE_PROBE1(nametag, name, arg1)
+#define NAMETAG_TRACE2(name, arg1, arg2) DTRACE_PROBE2(nametag, name, arg1, arg2)
+#else
+#define NAMETAG_TRACE1(name, arg1)
+#define NAMETAG_TRACE2(name, arg1, arg2)
+#endif
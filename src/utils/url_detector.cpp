@@ -7,6 +7,8 @@
 // License, v. 2.0. If a copy of the MPL was not distributed with this
 // file, You can obtain one at http://mozilla.org/MPL/2.0/.
 
+#include <cstring>
+
 #include "url_detector.h"
 
 namespace ufal {
@@ -1222,7 +1224,26 @@ static const int url_detector_start = 1;
 
 
 
+// Every URL and email contains a hostname or a host number, and therefore
+// a dot between two ASCII alphanumeric characters. As nearly all strings do
+// not contain one, checking it first avoids running the automaton on them.
+static inline bool is_ascii_alnum(char chr) {
+  return (chr >= '0' && chr <= '9') || (chr >= 'a' && chr <= 'z') || (chr >= 'A' && chr <= 'Z');
+}
+
+static inline bool contains_host_dot(string_piece str) {
+  for (const char* dot = str.str + 1; str.str + str.len - dot > 1 && (dot = (const char*) memchr(dot, '.', str.str + str.len - 1 - dot)); dot++)
+    if (is_ascii_alnum(dot[-1]) && is_ascii_alnum(dot[1]))
+      return true;
+  return false;
+}
+
 url_detector::url_type url_detector::detect(string_piece str, size_t* length) {
+  if (str.len < 4 || !contains_host_dot(str)) {
+    if (length) *length = 0;
+    return NO_URL;
+  }
+
   int cs;
   const char* p = str.str;
 
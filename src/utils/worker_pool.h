@@ -0,0 +1,166 @@
+// This file is part of NameTag <http://github.com/ufal/nametag/>.
+//
+// Copyright 2016 Institute of Formal and Applied Linguistics, Faculty of
+// Mathematics and Physics, Charles University in Prague, Czech Republic.
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <thread>
+
+#include "common.h"
+
+namespace ufal {
+namespace nametag {
+namespace utils {
+
+//
+// Declarations
+//
+
+// Fixed number of worker threads executing jobs from a queue. Without any
+// worker threads, the jobs are executed directly by the calling thread.
+// The jobs with low priority are executed only when no other job waits.
+class worker_pool {
+ public:
+  inline ~worker_pool();
+
+  // Start the given number of worker threads and return how many of them
+  // were started. Must not be called concurrently with the other methods.
+  inline unsigned start(unsigned workers);
+  inline unsigned workers() const { return threads.size(); }
+
+  // Execute the job by a worker thread and wait until it finishes
+  inline void run(const function<void()>& job, bool low_priority = false);
+
+  // Execute job(0), ..., job(jobs - 1) in parallel and wait until all of
+  // them finish. The calling thread executes the jobs too, so this can be
+  // used also by a job running on a worker, even if all workers are busy.
+  inline void run_parallel(unsigned jobs, const function<void(unsigned)>& job, bool low_priority = false);
+
+ private:
+  inline void submit(function<void()>&& task, bool low_priority);
+  inline void worker();
+
+  vector<thread> threads;
+  deque<function<void()>> queue, low_priority_queue;
+  mutex queue_mutex;
+  condition_variable queue_cv;
+  bool stopping = false;
+};
+
+//
+// Definitions
+//
+
+worker_pool::~worker_pool() {
+  {
+    lock_guard<mutex> lock(queue_mutex);
+    stopping = true;
+  }
+  queue_cv.notify_all();
+  for (auto&& thread : threads)
+    thread.join();
+}
+
+unsigned worker_pool::start(unsigned workers) {
+  while (threads.size() < workers)
+    try {
+      threads.emplace_back(&worker_pool::worker, this);
+    } catch (system_error&) {
+      break;
+    }
+  return threads.size();
+}
+
+void worker_pool::run(const function<void()>& job, bool low_priority) {
+  if (threads.empty()) return job();
+
+  mutex done_mutex;
+  condition_variable done_cv;
+  bool done = false;
+  submit([&job, &done_mutex, &done_cv, &done]{
+    job();
+    lock_guard<mutex> lock(done_mutex);
+    done = true;
+    done_cv.notify_one();
+  }, low_priority);
+
+  unique_lock<mutex> lock(done_mutex);
+  done_cv.wait(lock, [&done]{ return done; });
+}
+
+void worker_pool::run_parallel(unsigned jobs, const function<void(unsigned)>& job, bool low_priority) {
+  if (threads.empty() || jobs <= 1) {
+    for (unsigned i = 0; i < jobs; i++)
+      job(i);
+    return;
+  }
+
+  // The state is shared with the helping workers, which may start even after
+  // all the jobs have finished; in that case they must not access the job.
+  struct parallel_state {
+    const function<void(unsigned)>* job;
+    unsigned jobs;
+    atomic<unsigned> next;
+    unsigned finished;
+    mutex finished_mutex;
+    condition_variable finished_cv;
+  };
+  auto state = make_shared<parallel_state>();
+  state->job = &job;
+  state->jobs = jobs;
+  state->next = 0;
+  state->finished = 0;
+
+  auto work = [state]{
+    for (unsigned i; (i = state->next.fetch_add(1)) < state->jobs; ) {
+      (*state->job)(i);
+      lock_guard<mutex> lock(state->finished_mutex);
+      if (++state->finished == state->jobs) state->finished_cv.notify_all();
+    }
+  };
+  for (unsigned i = 1; i < jobs && i <= threads.size(); i++)
+    submit(work, low_priority);
+  work();
+
+  unique_lock<mutex> lock(state->finished_mutex);
+  state->finished_cv.wait(lock, [&state]{ return state->finished == state->jobs; });
+}
+
+void worker_pool::submit(function<void()>&& task, bool low_priority) {
+  {
+    lock_guard<mutex> lock(queue_mutex);
+    (low_priority ? low_priority_queue : queue).push_back(move(task));
+  }
+  queue_cv.notify_one();
+}
+
+void worker_pool::worker() {
+  unique_lock<mutex> lock(queue_mutex);
+  while (true) {
+    queue_cv.wait(lock, [this]{ return stopping || !queue.empty() || !low_priority_queue.empty(); });
+    auto& tasks = !queue.empty() ? queue : low_priority_queue;
+    if (tasks.empty()) return;
+
+    function<void()> task = move(tasks.front());
+    tasks.pop_front();
+    lock.unlock();
+    task();
+    lock.lock();
+  }
+}
+
+} // namespace utils
+} // namespace nametag
+} // namespace ufal
@@ -20,6 +20,7 @@ vector<string> namespaces_opening;
 vector<string> namespaces_closing;
 
 set<string> system_includes;
+vector<string> conditional_includes;
 set<string> local_includes;
 
 struct bundle_file {
@@ -44,6 +45,7 @@ void add_file(list<bundle_file>::iterator it, const string& top_directory, const
   // - system includes
   // - local includes
   // - #pragma once
+  // - #if ... #endif blocks of conditional defines and system includes
   string line;
   while (getline(is, line)) {
     if (line.empty() || line.find("//") == 0) {
@@ -52,6 +54,15 @@ void add_file(list<bundle_file>::iterator it, const string& top_directory, const
     } else if (line == "#pragma once") {
     } else if (line.find("#include <") == 0 && line.substr(line.size() - 1) == ">") {
       system_includes.insert(string(line, 10, line.size() - 11));
+    } else if (line.find("#if") == 0) {
+      string block = line;
+      while (line.find("#endif") != 0 && getline(is, line)) {
+        if (!(line.find("#include <") == 0 || line.find("#define ") == 0 || line.find("#el") == 0 || line.find("#endif") == 0))
+          cerr << "Unsupported line " << line << " in conditional block in file " << file << "!" << endl, exit(1);
+        block.append("\n").append(line);
+      }
+      if (find(conditional_includes.begin(), conditional_includes.end(), block) == conditional_includes.end())
+        conditional_includes.push_back(block);
     } else if (line.find("#include \"") == 0) {
       string header_path;
       for (int location = 0; header_path.empty() && location <= 1; location++) {
@@ -120,6 +131,8 @@ int main(int argc, char* argv[]) {
   cout << endl;
   for (auto&& system_include : system_includes)
     cout << "#include <" << system_include << ">" << endl;
+  for (auto&& conditional_include : conditional_includes)
+    cout << endl << conditional_include << endl;
 
   cout << endl;
   for (auto&& namespace_opening : namespaces_opening)
@@ -12,6 +12,8 @@
 
 #include <cstdio>
 #include <cstring>
+#include <functional>
+#include <future>
 #include <string>
 #include <vector>
 
@@ -66,8 +68,50 @@ class tokenizer {
   virtual void set_text(string_piece text, bool make_copy = false) = 0;
   virtual bool next_sentence(std::vector<string_piece>* forms, std::vector<token_range>* tokens) = 0;
 
-  // Static factory method
+  // Static factory methods
   static tokenizer* new_vertical_tokenizer();
+  // Tokenizer normalizing the text to NFC before tokenizing it by the given
+  // tokenizer, which it takes ownership of; the token ranges are in
+  // characters of the original text
+  static tokenizer* new_normalizing_tokenizer(tokenizer* inner);
+};
+
+// Statistics of a feature template gathered during stage profiling, see
+// ner::template_statistics.
+struct feature_template_statistics {
+  std::string name;
+  size_t calls;
+  double seconds;
+  size_t features;
+  size_t lookups;
+  size_t lookup_hits;
+
+  feature_template_statistics() : calls(0), seconds(0), features(0), lookups(0), lookup_hits(0) {}
+};
+
+// Scratch state of recognition used by a single thread, see ner::new_context.
+class ner_context {
+ public:
+  virtual ~ner_context() {}
+
+  // Return only the entities of the given types from the recognitions using
+  // this context, all of them if the types are empty. The processing of the
+  // found entities which can add only entities of the other types is skipped;
+  // the results are the same as when filtering all the found entities.
+  // Returns false if the recognizer does not support it or if some of the
+  // types cannot be found by the recognizer.
+  virtual bool set_entity_types(const std::vector<std::string>& types);
+};
+
+// Receiver of the found named entities, see ner::recognize with a sink.
+class entity_sink {
+ public:
+  virtual ~entity_sink() {}
+
+  // Receive an entity of the given sentence of the recognized batch. The type
+  // is given as its index in ner::entity_types (or -1 if it is not listed
+  // there) and as its name, which is valid only during the call.
+  virtual void on_entity(unsigned sentence, unsigned start, unsigned length, int type_id, string_piece type) = 0;
 };
 
 class ner {
@@ -81,17 +125,228 @@ class ner {
   // named entities in the given vector.
   virtual void recognize(const std::vector<string_piece>& forms, std::vector<named_entity>& entities) const = 0;
 
+  // Perform named entity recognition on a batch of tokenized sentences and
+  // return found named entities of every sentence in the given vector.
+  virtual void recognize_batch(const std::vector<std::vector<string_piece> >& sentences, std::vector<std::vector<named_entity> >& entities) const;
+
+  // Perform named entity recognition on a tokenized sentence and return found
+  // named entities together with their confidences, which are the marginal
+  // probabilities of the entities. Returns false if the recognizer does not
+  // support it.
+  virtual bool recognize_with_confidences(const std::vector<string_piece>& forms, std::vector<named_entity>& entities, std::vector<double>& confidences) const;
+
+  // Perform named entity recognition on a tokenized sentence and return at
+  // most n best alternative decodings of its named entities, the best first,
+  // together with their probabilities. Returns false if the recognizer does
+  // not support it.
+  virtual bool recognize_nbest(const std::vector<string_piece>& forms, unsigned n, std::vector<std::vector<named_entity> >& decodings, std::vector<double>& probabilities) const;
+
+  // Perform named entity recognition on a sentence of already tagged tokens,
+  // every token consisting of a form, a lemma and a tag separated by spaces
+  // (the form is used as a missing lemma), instead of tagging the forms by
+  // the tagger of the recognizer. Returns false if the recognizer does not
+  // support it.
+  virtual bool recognize_pretagged(const std::vector<string_piece>& tokens, std::vector<named_entity>& entities) const;
+
+  // Return a new context holding all the scratch state of recognition, which
+  // can be passed to recognize and recognize_batch by a single thread at a
+  // time instead of acquiring the internal caches of the recognizer. The
+  // context must be deleted before the recognizer.
+  virtual ner_context* new_context() const;
+
+  // Perform named entity recognition like recognize and recognize_batch,
+  // using the given context created by new_context of this recognizer.
+  virtual void recognize(const std::vector<string_piece>& forms, std::vector<named_entity>& entities, ner_context& context) const;
+  virtual void recognize_batch(const std::vector<std::vector<string_piece> >& sentences, std::vector<std::vector<named_entity> >& entities, ner_context& context) const;
+
+  // Perform named entity recognition like recognize and recognize_batch with
+  // the given context, passing the found entities to the sink instead of
+  // storing them. The sentences are passed in order (a single sentence
+  // having index 0), and the entities of every sentence sorted by their
+  // start, longer first. When the entities need no further processing, they
+  // are passed directly from the decoding, without copying their types.
+  virtual void recognize(const std::vector<string_piece>& forms, entity_sink& sink, ner_context& context) const;
+  virtual void recognize_batch(const std::vector<std::vector<string_piece> >& sentences, entity_sink& sink, ner_context& context) const;
+
+  // Tokenize the given text using new_tokenizer and recognize all its
+  // sentences, returning the found named entities with start and length in
+  // Unicode characters of the text, sorted by start and longer first. Returns
+  // false if no tokenizer is defined for the recognizer.
+  virtual bool recognize_text(string_piece text, std::vector<named_entity>& entities) const;
+
   // Return the possible entity types
   virtual void entity_types(std::vector<std::string>& types) const = 0;
 
   // Return gazetteers used by the recognizer, if any, optionally with the index of entity type
   virtual void gazetteers(std::vector<std::string>& gazetteers, std::vector<int>* gazetteer_types) const = 0;
 
+  // Reload the gazetteers which are not embedded in the model (currently only
+  // GazetteersEnhanced ones). Recognition can run concurrently, using either
+  // the old or the new gazetteers. On failure, false is returned and the
+  // current gazetteers are kept.
+  virtual bool reload_gazetteers();
+
+  // Cache morphological analyses of at most the given number of forms, shared
+  // by all threads; zero disables the cache. Returns false if the recognizer
+  // does not perform morphological analysis. Must not be called concurrently
+  // with recognition.
+  virtual bool set_analysis_cache(size_t forms);
+
+  // Return the number of analysis cache hits and misses.
+  virtual void analysis_cache_statistics(size_t& hits, size_t& misses) const;
+
+  // Reuse the classifier results of the recently classified feature vectors,
+  // caching at most the given number of them separately in every thread; zero
+  // disables the cache. Returns false if the recognizer does not classify
+  // feature vectors. Must not be called concurrently with recognition.
+  virtual bool set_classification_cache(size_t feature_vectors);
+
+  // Return the number of classification cache hits and misses.
+  virtual void classification_cache_statistics(size_t& hits, size_t& misses) const;
+
+  // Cache the entities of at most the given number of recently recognized
+  // sentences, shared by all threads, so that identical sentences are not
+  // tagged and classified again; zero disables the cache. The cache is
+  // cleared when the recognition results can change. Returns false if the
+  // recognizer does not support it. Must not be called concurrently with
+  // recognition.
+  virtual bool set_sentence_cache(size_t sentences);
+
+  // Return the number of sentence cache hits and misses.
+  virtual void sentence_cache_statistics(size_t& hits, size_t& misses) const;
+
+  // Skip the following classifier stages of a sentence once the probability
+  // of the decoded bilou type of every word, according to the classifier of
+  // the current stage, is at least the given one; zero disables the skipping.
+  // This can change the recognition results. Returns false if the recognizer
+  // does not support it. Must not be called concurrently with recognition.
+  virtual bool set_stage_skipping(double probability);
+
+  // Return the number of sentences whose following stages were skipped and
+  // the number of all sentences recognized by multiple stages.
+  virtual void stage_skipping_statistics(size_t& skipped, size_t& sentences) const;
+
+  // Return no entities for the sentences without any candidate of an entity,
+  // i.e., without an uppercase or caseless letter, a digit, an URL or an email
+  // and a form starting a gazetteer match, without tagging and classifying
+  // them. This can change the recognition results, so the recall of the model
+  // should be verified first, for example using nametag_bench --prefilter
+  // with --heldout. Returns false if the recognizer does not support it.
+  // Must not be called concurrently with recognition.
+  virtual bool set_candidate_prefilter(bool enabled);
+
+  // Return the number of sentences without candidates and the number of all
+  // sentences checked by the candidate prefilter.
+  virtual void candidate_prefilter_statistics(size_t& filtered, size_t& sentences) const;
+
+  // Keep only the given number of best hypotheses for every word during
+  // morphological disambiguation, instead of exact decoding used when zero.
+  // Returns false if the recognizer does not perform morphological
+  // disambiguation. Must not be called concurrently with recognition.
+  virtual bool set_tagger_beam_size(int beam_size);
+
+  // Skip the morphological disambiguation, using the first analysis of every
+  // word, which is faster but usually chooses worse lemmas and tags. Returns
+  // false if the recognizer does not perform morphological disambiguation.
+  // Must not be called concurrently with recognition.
+  virtual bool set_tagger_fast_mode(bool fast);
+
+  // Split sentences longer than the given number of words into overlapping
+  // chunks, which are recognized independently and whose entities are then
+  // merged; zero disables the splitting. Returns false if the recognizer does
+  // not support it. Must not be called concurrently with recognition.
+  virtual bool set_max_sentence_length(int max_length);
+
+  // Tag the sentences of a batch by the given number of additional threads,
+  // while the already tagged sentences are recognized by the calling thread;
+  // zero disables the pipelining. The recognition results are not changed.
+  // Returns false if the recognizer does not support it. Must not be called
+  // concurrently with recognition.
+  virtual bool set_pipeline_threads(int threads);
+
+  // Return the approximate number of bytes used by the individual components
+  // of the recognizer, like the tagger, the feature processors and the
+  // classifiers. Components shared with other recognizers are included in
+  // the figures of each of them. Must not be called concurrently with
+  // recognition.
+  virtual void memory_usage(std::vector<std::string>& components, std::vector<size_t>& bytes) const;
+
+  // Return the number of the recognition working states, which are allocated
+  // by the threads performing recognition and kept for reuse afterwards.
+  virtual size_t pooled_states() const;
+
+  // Accumulate the wall time spent in the individual recognition stages, like
+  // tagging, every feature processor, every classifier stage and decoding,
+  // summed over all threads. Enabling the profiling resets the accumulated
+  // times. Returns false if the recognizer does not support profiling. Must
+  // not be called concurrently with recognition.
+  virtual bool set_stage_profiling(bool profiling);
+
+  // Return the names of the profiled stages and the seconds spent in them.
+  virtual void stage_profiling_statistics(std::vector<std::string>& stages, std::vector<double>& seconds) const;
+
+  // Return the statistics of every feature template gathered while the stage
+  // profiling is enabled: the number of processed sentences, the seconds
+  // spent, the number of added features and the number of lookups of feature
+  // keys together with the number of found ones.
+  virtual void template_statistics(std::vector<feature_template_statistics>& statistics) const;
+
   // Construct a new tokenizer instance appropriate for this recognizer.
   // Can return NULL if no such tokenizer exists.
   virtual tokenizer* new_tokenizer() const = 0;
 };
 
+// A pool of recognizers loaded on demand, keeping a bounded number of them
+// loaded and unloading the least recently used ones.
+class ner_pool {
+ public:
+  virtual ~ner_pool() {}
+
+  // Create a pool keeping at most the given number of recognizers loaded,
+  // which must be positive.
+  static ner_pool* create(unsigned max_loaded);
+
+  // Add a recognizer model file to the pool without loading it, returning
+  // its id. Must not be called concurrently with other methods.
+  virtual unsigned add(const char* fname) = 0;
+
+  // Return the recognizer with the given id, loading it if needed. When the
+  // maximum number of recognizers is in use, wait until one is released;
+  // otherwise the least recently used unused recognizer is unloaded if
+  // required. Returns NULL if the model cannot be loaded. Every returned
+  // recognizer must be released after use.
+  virtual const ner* acquire(unsigned id) = 0;
+  virtual void release(unsigned id) = 0;
+};
+
+// Recognition of texts by a pool of worker threads, every one of them
+// keeping its own tokenizer and context of the recognizer.
+class ner_executor {
+ public:
+  // Wait until all submitted texts are recognized and stop the threads.
+  virtual ~ner_executor() {}
+
+  // Create an executor using the given positive number of threads to
+  // recognize the texts by the given recognizer, which must not be destroyed
+  // before the executor. Returns NULL if the recognizer has no tokenizer or
+  // the threads cannot be started.
+  static ner_executor* create(const ner* recognizer, unsigned threads);
+
+  // Recognize the given text, which is copied, like ner::recognize_text, the
+  // texts being processed in the order of submission. The entities are
+  // returned either in the future, or passed to the callback called by
+  // the worker thread, which must not call wait. An exception thrown during
+  // the recognition is stored in the future; with the callback, the first
+  // exception thrown during the recognition or by the callback is rethrown
+  // by wait.
+  virtual std::future<std::vector<named_entity> > recognize_async(string_piece text) = 0;
+  virtual void recognize_async(string_piece text, const std::function<void(std::vector<named_entity>& entities)>& callback) = 0;
+
+  // Wait until all texts submitted so far are recognized, rethrowing the
+  // first exception of the texts submitted with a callback.
+  virtual void wait() = 0;
+};
+
 } // namespace nametag
 } // namespace ufal
 